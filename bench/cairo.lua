@@ -0,0 +1,31 @@
+-- vim: ts=4 sw=4 noet ai cindent syntax=lua
+-- 48 ring meters of conky_values, redrawn every update
+
+require 'cairo'
+
+local function ring(cr, x, y, r, value)
+	cairo_set_line_width(cr, 6)
+	cairo_set_source_rgba(cr, 1, 1, 1, 0.2)
+	cairo_arc(cr, x, y, r, 0, 2 * math.pi)
+	cairo_stroke(cr)
+	cairo_set_source_rgba(cr, 0.2, 0.8, 0.2, 0.9)
+	cairo_arc(cr, x, y, r, -math.pi / 2, -math.pi / 2 + 2 * math.pi * value / 100)
+	cairo_stroke(cr)
+end
+
+function conky_rings()
+	if conky_window == nil then return end
+	local cs = cairo_conky_window_surface(conky_window.display, conky_window.drawable,
+		conky_window.visual, conky_window.width, conky_window.height)
+	local cr = cairo_create(cs)
+	local cpu = conky_values and conky_values.cpu or {}
+
+	for i = 0, 47 do
+		local x, y = 50 + (i % 8) * 70, 80 + math.floor(i / 8) * 80
+		local value = cpu[i % (#cpu + 1)] or tonumber(conky_parse('${cpu cpu0}')) or 0
+
+		ring(cr, x, y, 25, value)
+		ring(cr, x, y, 15, tonumber(conky_parse('${memperc}')) or 0)
+	end
+	cairo_destroy(cr)
+end
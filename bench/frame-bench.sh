@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# frame-bench.sh - time the frames of conky under a virtual X server
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# Invocation is as follows:
+# $1: the conky binary
+# $2...: configs to run, by default data/conky.conf and the ones in bench/
+#
+# Each config runs for FRAMES updates (200 by default) every INTERVAL seconds
+# (0.05) on an Xvfb of its own, with --profile. What is printed per config is
+# the profile report: the percentiles of the update, text (generate_text()),
+# layout (update_text_area()) and draw (draw_stuff()) phases, and at the end
+# the cpu time and X requests per update. The top/exec config, 5000 lines of
+# $top and $exec, is written on the fly.
+
+[ $# -ge 1 ] || {
+	echo "usage: $0 conky [config...]" >&2
+	exit 1
+}
+
+conky=$1
+shift
+bench=$(cd "$(dirname "$0")" && pwd)
+frames=${FRAMES:-200}
+interval=${INTERVAL:-0.05}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+command -v Xvfb >/dev/null || {
+	echo "$0: Xvfb is needed" >&2
+	exit 1
+}
+
+# 5000 lines of top and exec
+{
+	echo "dofile('$bench/graphs.conf')"
+	echo "conky.text = [["
+	i=0
+	while [ $i -lt 1000 ]; do
+		echo "\${top name 1} \${top cpu 1} \${top mem 1}"
+		echo "\${top name 2} \${top pid 2} \${top_mem name 1}"
+		echo "\${exec echo $i} \${top_mem mem 2}"
+		echo "\${execi 5 date +%s} \${top time 1}"
+		echo "\${top name 3} \${top cpu 3}"
+		i=$((i + 1))
+	done
+	echo "]]"
+} > "$tmp/top-exec.conf"
+
+if [ $# -eq 0 ]; then
+	set -- "$bench/../data/conky.conf" "$bench/graphs.conf" "$bench/cairo.conf" \
+		"$tmp/top-exec.conf"
+fi
+
+display=99
+for config in "$@"; do
+	# the same config, updated as fast and as often as asked
+	cat > "$tmp/run.conf" <<EOC
+dofile('$config')
+conky.config.total_run_times = $frames
+conky.config.update_interval = $interval
+conky.config.out_to_x = true
+conky.config.own_window = true
+conky.config.background = false
+EOC
+	while [ -e /tmp/.X$display-lock ]; do
+		display=$((display + 1))
+	done
+	Xvfb :$display -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+	xvfb=$!
+	sleep 1
+
+	echo "== $(basename "$config"), $frames updates"
+	(cd "$bench" && DISPLAY=:$display "$conky" --profile -c "$tmp/run.conf" 2>&1 >/dev/null) |
+		grep -E 'calls|updates|  (update|text|layout|draw)$'
+
+	kill $xvfb
+	wait $xvfb 2>/dev/null
+done
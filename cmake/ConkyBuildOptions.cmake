@@ -61,7 +61,7 @@ set(DEFAULTNETDEV "eth0" CACHE STRING "Default networkdevice")
 set(CONFIG_FILE "$HOME/.conkyrc" CACHE STRING "Configfile of the user")
 set(MAX_USER_TEXT_DEFAULT "16384" CACHE STRING "Default maximum size of config TEXT buffer, i.e. below TEXT line.")
 set(DEFAULT_TEXT_BUFFER_SIZE "256" CACHE STRING "Default size used for temporary, static text buffers")
-set(MAX_NET_INTERFACES "64" CACHE STRING "Maximum number of network devices")
+set(MAX_NET_INTERFACES "64" CACHE STRING "Maximum number of IPv4 addresses listed per network device")
 
 
 # Platform specific options
@@ -71,16 +71,36 @@ if(OS_LINUX)
 	option(BUILD_IBM "Support for IBM/Lenovo notebooks" true)
 	option(BUILD_HDDTEMP "Support for hddtemp" true)
 	option(BUILD_WLAN "Enable wireless support" false)
+	# with BUILD_WLAN, Wireless Extensions are still used when nl80211 isn't there
+	option(BUILD_NL80211 "Read wireless statistics with nl80211 instead of Wireless Extensions" false)
 	# nvidia may also work on FreeBSD, not sure
 	option(BUILD_NVIDIA "Enable nvidia support" false)
+	# NVML comes with the driver and works without X, NV-CONTROL is still used with X11
+	# for what NVML doesn't know
+	option(BUILD_NVML "Query nvidia GPUs through NVML" false)
 	option(BUILD_IPV6 "Enable if you want IPv6 support" true)
+	# needs CAP_NET_ADMIN at runtime, conky falls back to scanning /proc without it
+	option(BUILD_PROC_CONNECTOR "Track processes for top with the netlink proc connector" false)
+	option(BUILD_RTNETLINK "Read network statistics with rtnetlink instead of /proc/net/dev" false)
+	# needs Linux 5.6 at runtime, conky reads the files one by one without it
+	option(BUILD_IO_URING "Read the procfs files of each update in one io_uring batch" false)
+	# needs CAP_BPF and CAP_PERFMON at runtime, top reads all of /proc without them
+	option(BUILD_BPF "Account the cpu time and traffic of processes for top with eBPF" false)
+	option(BUILD_ALSA "Read the mixer through ALSA instead of the OSS emulation" false)
 else(OS_LINUX)
 	set(BUILD_PORT_MONITORS false)
 	set(BUILD_IBM false)
 	set(BUILD_HDDTEMP false)
 	set(BUILD_WLAN false)
+	set(BUILD_NL80211 false)
 	set(BUILD_NVIDIA false)
+	set(BUILD_NVML false)
 	set(BUILD_IPV6 false)
+	set(BUILD_PROC_CONNECTOR false)
+	set(BUILD_RTNETLINK false)
+	set(BUILD_IO_URING false)
+	set(BUILD_BPF false)
+	set(BUILD_ALSA false)
 endif(OS_LINUX)
 
 # Optional features etc
@@ -106,12 +126,14 @@ if(BUILD_X11)
 	option(OWN_WINDOW "Enable own_window support" true)
 	option(BUILD_XDAMAGE "Build Xdamage support" true)
 	option(BUILD_XDBE "Build Xdbe (double-buffer) support" false)
+	option(BUILD_XDPMS "Build DPMS support (slower updates while the screen is off)" true)
 	option(BUILD_XFT "Build Xft (freetype fonts) support" true)
 	option(BUILD_IMLIB2 "Enable Imlib2 support" false)
 else(BUILD_X11)
 	set(OWN_WINDOW false CACHE BOOL "Enable own_window support" FORCE)
 	set(BUILD_XDAMAGE false CACHE BOOL "Build Xdamage support" FORCE)
 	set(BUILD_XDBE false CACHE BOOL "Build Xdbe (double-buffer) support" FORCE)
+	set(BUILD_XDPMS false CACHE BOOL "Build DPMS support (slower updates while the screen is off)" FORCE)
 	set(BUILD_XFT false CACHE BOOL "Build Xft (freetype fonts) support" FORCE)
 	set(BUILD_IMLIB2 false CACHE BOOL "Enable Imlib2 support" FORCE)
 endif(BUILD_X11)
@@ -125,6 +147,7 @@ endif(OWN_WINDOW)
 option(BUILD_LUA_CAIRO "Build cairo bindings for Lua" false)
 option(BUILD_LUA_IMLIB2 "Build Imlib2 bindings for Lua" false)
 option(BUILD_LUA_RSVG "Build rsvg bindings for Lua" false)
+option(BUILD_LUA_FFI "Build against LuaJIT, with C functions for its FFI to read values with" false)
 
 option(BUILD_AUDACIOUS "Build audacious (music player) support" false)
 
@@ -146,9 +169,9 @@ option(BUILD_RSS "Enable if you want RSS support" false)
 
 option(BUILD_WEATHER_METAR "Enable METAR weather support" false)
 option(BUILD_WEATHER_XOAP "Enable XOAP weather support" false)
-if(BUILD_WEATHER_METAR OR BUILD_WEATHER_XOAP OR BUILD_RSS)
+if(BUILD_WEATHER_METAR OR BUILD_WEATHER_XOAP OR BUILD_RSS OR BUILD_EVE)
 	set(BUILD_CURL true)
-endif(BUILD_WEATHER_METAR OR BUILD_WEATHER_XOAP OR BUILD_RSS)
+endif(BUILD_WEATHER_METAR OR BUILD_WEATHER_XOAP OR BUILD_RSS OR BUILD_EVE)
 if(BUILD_WEATHER_XOAP)
 	set(XOAP_FILE "$HOME/.xoaprc" CACHE STRING "Path of XOAP file for weather" FORCE)
 endif(BUILD_WEATHER_XOAP)
@@ -159,11 +182,21 @@ option(BUILD_ICAL "Enable if you want iCalendar (RFC 5545) support" false)
 
 option(BUILD_IRC "Enable if you want IRC support" false)
 
+option(BUILD_PLUGINS "Build the modules with libraries of their own (IRC) as plugins, loaded when the config uses them" false)
+
 option(BUILD_HTTP "Enable if you want HTTP support" false)
 if(BUILD_HTTP)
 	set(HTTPPORT "10080" CACHE STRING "Port to use for out_to_http")
 endif(BUILD_HTTP)
 
+option(BUILD_SHM "Enable publishing and reading a shared memory snapshot" false)
+
+option(BUILD_REMOTE "Enable the agent mode and the remote variable" false)
+
+option(BUILD_BENCHMARKS "Build conky_bench, which times the parsers and text evaluation" false)
+
+option(BUILD_USDT "Enable static tracepoints (needs sys/sdt.h from systemtap)" false)
+
 option(BUILD_ICONV "Enable iconv support" false)
 
 option(BUILD_CMUS "Enable support for cmus music player" false)
@@ -29,6 +29,7 @@ include(CheckSymbolExists)
 check_include_files(sys/statfs.h HAVE_SYS_STATFS_H)
 check_include_files(sys/param.h HAVE_SYS_PARAM_H)
 check_include_files(sys/inotify.h HAVE_SYS_INOTIFY_H)
+check_include_files(sys/epoll.h HAVE_SYS_EPOLL_H)
 check_include_files(dirent.h HAVE_DIRENT_H)
 
 # Check for some functions
@@ -37,6 +38,8 @@ check_function_exists(strndup HAVE_STRNDUP)
 check_symbol_exists(pipe2 "unistd.h" HAVE_PIPE2)
 check_symbol_exists(O_CLOEXEC "fcntl.h" HAVE_O_CLOEXEC)
 check_symbol_exists(statfs64 "sys/statfs.h" HAVE_STATFS64)
+check_symbol_exists(mallinfo2 "malloc.h" HAVE_MALLINFO2)
+check_symbol_exists(malloc_trim "malloc.h" HAVE_MALLOC_TRIM)
 
 AC_SEARCH_LIBS(clock_gettime "time.h" CLOCK_GETTIME_LIB "rt")
 if(NOT DEFINED CLOCK_GETTIME_LIB)
@@ -99,7 +102,11 @@ if(BUILD_IRC)
 	if(NOT IRC_H_)
 		message(FATAL_ERROR "Unable to find libircclient")
 	endif(NOT IRC_H_)
-	set(conky_libs ${conky_libs} -lircclient)
+	if(BUILD_PLUGINS)
+		set(irc_libs -lircclient)
+	else(BUILD_PLUGINS)
+		set(conky_libs ${conky_libs} -lircclient)
+	endif(BUILD_PLUGINS)
 endif(BUILD_IRC)
 
 if(BUILD_IPV6)
@@ -109,6 +116,40 @@ if(BUILD_IPV6)
 	endif(NOT IF_INET6)
 endif(BUILD_IPV6)
 
+if(BUILD_PROC_CONNECTOR)
+	check_include_files("sys/socket.h;linux/netlink.h;linux/connector.h;linux/cn_proc.h" CN_PROC_H_)
+	if(NOT CN_PROC_H_)
+		message(FATAL_ERROR "Unable to find linux/cn_proc.h")
+	endif(NOT CN_PROC_H_)
+endif(BUILD_PROC_CONNECTOR)
+
+if(BUILD_RTNETLINK)
+	check_include_files("sys/socket.h;linux/netlink.h;linux/rtnetlink.h" RTNETLINK_H_)
+	if(NOT RTNETLINK_H_)
+		message(FATAL_ERROR "Unable to find linux/rtnetlink.h")
+	endif(NOT RTNETLINK_H_)
+endif(BUILD_RTNETLINK)
+
+if(BUILD_IO_URING)
+	check_include_files("sys/syscall.h;linux/io_uring.h" IO_URING_H_)
+	if(NOT IO_URING_H_)
+		message(FATAL_ERROR "Unable to find linux/io_uring.h")
+	endif(NOT IO_URING_H_)
+endif(BUILD_IO_URING)
+
+if(BUILD_BPF)
+	check_include_files("sys/syscall.h;linux/bpf.h;linux/perf_event.h" BPF_H_)
+	if(NOT BPF_H_)
+		message(FATAL_ERROR "Unable to find linux/bpf.h")
+	endif(NOT BPF_H_)
+endif(BUILD_BPF)
+
+if(BUILD_ALSA)
+	pkg_check_modules(ALSA REQUIRED alsa)
+	set(conky_libs ${conky_libs} ${ALSA_LIBRARIES})
+	set(conky_includes ${conky_includes} ${ALSA_INCLUDE_DIRS})
+endif(BUILD_ALSA)
+
 if(BUILD_HTTP)
 	find_file(HTTP_H_ microhttpd.h)
 	#I'm not using check_include_files because microhttpd.h seems to need a lot of different headers and i'm not sure which...
@@ -118,6 +159,25 @@ if(BUILD_HTTP)
 	set(conky_libs ${conky_libs} -lmicrohttpd)
 endif(BUILD_HTTP)
 
+if(BUILD_SHM)
+	check_include_files("sys/mman.h" MMAN_H_)
+	if(NOT MMAN_H_)
+		message(FATAL_ERROR "Unable to find sys/mman.h")
+	endif(NOT MMAN_H_)
+	# shm_open() is in librt with older glibc
+	find_library(RT_LIB NAMES rt)
+	if(RT_LIB)
+		set(conky_libs ${conky_libs} ${RT_LIB})
+	endif(RT_LIB)
+endif(BUILD_SHM)
+
+if(BUILD_USDT)
+	check_include_files("sys/sdt.h" SDT_H_)
+	if(NOT SDT_H_)
+		message(FATAL_ERROR "Unable to find sys/sdt.h")
+	endif(NOT SDT_H_)
+endif(BUILD_USDT)
+
 if(BUILD_NCURSES)
 	check_include_file(ncurses.h NCURSES_H)
 	find_library(NCURSES_LIB NAMES ncurses)
@@ -153,6 +213,13 @@ if(BUILD_WLAN)
 	check_function_exists(iw_sockets_open IWLIB_SOCKETS_OPEN_FUNC)
 endif(BUILD_WLAN)
 
+if(BUILD_WLAN AND BUILD_NL80211)
+	check_include_files("sys/socket.h;linux/netlink.h;linux/genetlink.h;linux/nl80211.h" NL80211_H_)
+	if(NOT NL80211_H_)
+		message(FATAL_ERROR "Unable to find linux/nl80211.h")
+	endif(NOT NL80211_H_)
+endif(BUILD_WLAN AND BUILD_NL80211)
+
 if(BUILD_PORT_MONITORS)
 	check_function_exists(getnameinfo HAVE_GETNAMEINFO)
 	if(NOT HAVE_GETNAMEINFO)
@@ -219,6 +286,10 @@ if(BUILD_X11)
 				message(FATAL_ERROR "Unable to find Xft library")
 			endif(NOT X11_Xft_FOUND)
 			set(conky_libs ${conky_libs} ${X11_Xft_LIB})
+			# fonts.cc loads the fontconfig caches itself, see start_font_warmup()
+			pkg_check_modules(FONTCONFIG REQUIRED fontconfig)
+			set(conky_libs ${conky_libs} ${FONTCONFIG_LIBRARIES})
+			set(conky_includes ${conky_includes} ${FONTCONFIG_INCLUDE_DIRS})
 		endif(BUILD_XFT)
 
 		# check for Xdbe
@@ -228,12 +299,24 @@ if(BUILD_X11)
 			endif(NOT X11_Xext_FOUND)
 			set(conky_libs ${conky_libs} ${X11_Xext_LIB})
 		endif(BUILD_XDBE)
+
+		# check for DPMS, which is part of Xext
+		if(BUILD_XDPMS)
+			if(NOT X11_dpms_FOUND)
+				message(FATAL_ERROR "Unable to find DPMS extension headers")
+			endif(NOT X11_dpms_FOUND)
+			set(conky_libs ${conky_libs} ${X11_Xext_LIB})
+		endif(BUILD_XDPMS)
 	else(X11_FOUND)
 		message(FATAL_ERROR "Unable to find X11 library")
 	endif(X11_FOUND)
 endif(BUILD_X11)
 
-pkg_search_module(LUA REQUIRED lua5.2 lua-5.2 lua>=5.1 lua5.1 lua-5.1)
+if(BUILD_LUA_FFI)
+	pkg_search_module(LUA REQUIRED luajit)
+else(BUILD_LUA_FFI)
+	pkg_search_module(LUA REQUIRED lua5.2 lua-5.2 lua>=5.1 lua5.1 lua-5.1)
+endif(BUILD_LUA_FFI)
 set(conky_libs ${conky_libs} ${LUA_LIBRARIES})
 set(conky_includes ${conky_includes} ${LUA_INCLUDE_DIRS})
 link_directories(${LUA_LIBRARY_DIRS})
@@ -311,7 +394,7 @@ if(BUILD_WEATHER_XOAP)
 	set(BUILD_WEATHER true)
 endif(BUILD_WEATHER_XOAP)
 
-if(BUILD_NVIDIA)
+if(BUILD_NVIDIA AND BUILD_X11)
 	find_path(XNVCtrl_INCLUDE_PATH NVCtrl/NVCtrl.h ${INCLUDE_SEARCH_PATH})
 	find_library(XNVCtrl_LIB NAMES XNVCtrl)
 	if(XNVCtrl_INCLUDE_PATH AND XNVCtrl_LIB)
@@ -321,7 +404,22 @@ if(BUILD_NVIDIA)
 	else(XNVCtrl_INCLUDE_PATH AND XNVCtrl_LIB)
 		message(FATAL_ERROR "Unable to find XNVCtrl library")
 	endif(XNVCtrl_INCLUDE_PATH AND XNVCtrl_LIB)
-endif(BUILD_NVIDIA)
+endif(BUILD_NVIDIA AND BUILD_X11)
+
+if(BUILD_NVIDIA AND BUILD_NVML)
+	find_path(NVML_INCLUDE_PATH nvml.h ${INCLUDE_SEARCH_PATH} PATH_SUFFIXES nvidia/gdk cuda)
+	find_library(NVML_LIB NAMES nvidia-ml)
+	if(NVML_INCLUDE_PATH AND NVML_LIB)
+		set(conky_libs ${conky_libs} ${NVML_LIB})
+		set(conky_includes ${conky_includes} ${NVML_INCLUDE_PATH})
+	else(NVML_INCLUDE_PATH AND NVML_LIB)
+		message(FATAL_ERROR "Unable to find NVML library")
+	endif(NVML_INCLUDE_PATH AND NVML_LIB)
+endif(BUILD_NVIDIA AND BUILD_NVML)
+
+if(BUILD_NVIDIA AND NOT BUILD_X11 AND NOT BUILD_NVML)
+	message(FATAL_ERROR "nvidia support needs X11 or NVML (BUILD_NVML)")
+endif(BUILD_NVIDIA AND NOT BUILD_X11 AND NOT BUILD_NVML)
 
 if(BUILD_IMLIB2)
 	pkg_search_module(IMLIB2 REQUIRED imlib2 Imlib2)
@@ -26,6 +26,9 @@
 #define _LIBCAIRO_HELPER_H_
 
 #include <cairo.h>
+#include <cairo-xlib.h>
+#include <stdlib.h>
+#include <string.h>
 
 cairo_text_extents_t *create_cairo_text_extents_t(void) {
 	return calloc(1, sizeof(cairo_text_extents_t));
@@ -39,4 +42,111 @@ cairo_matrix_t *create_cairo_matrix_t(void) {
 	return calloc(1, sizeof(cairo_matrix_t));
 }
 
+/* the surface of conky's window, kept from one draw hook to the next */
+static cairo_surface_t *conky_window_surface;
+static Display *conky_window_display;
+static Visual *conky_window_visual;
+
+cairo_surface_t *cairo_conky_window_surface(Display *display, Drawable drawable,
+		Visual *visual, int width, int height) {
+	if (conky_window_surface && (display != conky_window_display
+				|| visual != conky_window_visual)) {
+		cairo_surface_destroy(conky_window_surface);
+		conky_window_surface = NULL;
+	}
+	if (!conky_window_surface) {
+		conky_window_surface = cairo_xlib_surface_create(display, drawable,
+				visual, width, height);
+		conky_window_display = display;
+		conky_window_visual = visual;
+	} else if (drawable != cairo_xlib_surface_get_drawable(conky_window_surface)) {
+		cairo_xlib_surface_set_drawable(conky_window_surface, drawable, width, height);
+	} else if (width != cairo_xlib_surface_get_width(conky_window_surface)
+			|| height != cairo_xlib_surface_get_height(conky_window_surface)) {
+		cairo_xlib_surface_set_size(conky_window_surface, width, height);
+	}
+	return conky_window_surface;
+}
+
+/* named image surfaces for the parts of a drawing that seldom change */
+struct conky_layer {
+	char *name;
+	cairo_surface_t *surface;
+	int stale;
+	struct conky_layer *next;
+};
+
+static struct conky_layer *conky_layers;
+
+static struct conky_layer *find_conky_layer(const char *name) {
+	struct conky_layer *layer;
+
+	for (layer = conky_layers; layer; layer = layer->next) {
+		if (strcmp(layer->name, name) == 0) {
+			return layer;
+		}
+	}
+	return NULL;
+}
+
+cairo_surface_t *cairo_conky_layer(const char *name, int width, int height) {
+	struct conky_layer *layer = find_conky_layer(name);
+
+	if (!layer) {
+		layer = calloc(1, sizeof(struct conky_layer));
+		layer->name = strdup(name);
+		layer->next = conky_layers;
+		conky_layers = layer;
+	} else if (cairo_image_surface_get_width(layer->surface) == width
+			&& cairo_image_surface_get_height(layer->surface) == height) {
+		return layer->surface;
+	} else {
+		cairo_surface_destroy(layer->surface);
+	}
+	layer->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	layer->stale = 1;
+	return layer->surface;
+}
+
+int cairo_conky_layer_stale(const char *name) {
+	struct conky_layer *layer = find_conky_layer(name);
+	int stale;
+
+	if (!layer) {
+		return 1;
+	}
+	stale = layer->stale;
+	layer->stale = 0;
+	return stale;
+}
+
+void cairo_conky_layer_invalidate(const char *name) {
+	struct conky_layer *layer = find_conky_layer(name);
+	cairo_t *cr;
+
+	if (!layer) {
+		return;
+	}
+	cr = cairo_create(layer->surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	layer->stale = 1;
+}
+
+void cairo_conky_free_surfaces(void) {
+	struct conky_layer *layer;
+
+	while ((layer = conky_layers)) {
+		conky_layers = layer->next;
+		cairo_surface_destroy(layer->surface);
+		free(layer->name);
+		free(layer);
+	}
+	if (conky_window_surface) {
+		cairo_surface_destroy(conky_window_surface);
+		conky_window_surface = NULL;
+	}
+}
+
 #endif /* _LIBCAIRO_HELPER_H_ */
@@ -0,0 +1,244 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "alerts.h"
+#include "algebra.h"
+#include "exec.h"
+#include "llua.h"
+#include "logging.h"
+#include "setting.hh"
+#include "text_object.h"
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+	/*
+	 * alerts = {
+	 *     { source = 'cpu cpu0', above = 90, clear = 80, exec = 'notify-send busy' },
+	 *     { name = 'disk', source = 'fs_free_perc /', below = 10, lua = 'disk_low' },
+	 * }
+	 * The table is read by init_alerts() once the text is parsed, the setting
+	 * only makes sure it is one.
+	 */
+	class alerts_setting: public conky::config_setting_template<bool> {
+		typedef conky::config_setting_template<bool> Base;
+
+	protected:
+		virtual void lua_setter(lua::state &l, bool init)
+		{
+			lua::stack_sentry s(l, -2);
+
+			if (!init) {
+				NORM_ERR("Setting 'alerts' is not modifiable");
+				l.replace(-2);
+			} else if (!l.isnil(-2) && l.type(-2) != lua::TTABLE) {
+				NORM_ERR("Invalid value of type '%s' for setting 'alerts'. "
+						"Expected value of type 'table'.", l.type_name(l.type(-2)));
+				l.replace(-2);
+			} else
+				l.pop();
+			++s;
+		}
+
+		virtual bool getter(lua::state &l)
+		{
+			bool ret = l.type(-1) == lua::TTABLE;
+
+			l.pop();
+			return ret;
+		}
+
+	public:
+		alerts_setting()
+			: Base("alerts")
+		{}
+	};
+
+	alerts_setting alerts_table;
+
+	struct alert {
+		std::string name;
+		/* an expr object */
+		struct text_object source;
+		/* raised above threshold, otherwise below it */
+		bool above;
+		double threshold, clear;
+		std::string exec, lua, print;
+		bool raised;
+
+		alert()
+			: above(true), threshold(0), clear(0), raised(false)
+		{
+			memset(&source, 0, sizeof(source));
+		}
+
+		~alert()
+		{ free_expr(&source); }
+	};
+
+	std::vector<std::unique_ptr<alert>> alerts;
+
+	/* field of the table on top of the stack, empty if there is none */
+	std::string string_field(lua::state &l, const char *key)
+	{
+		std::string ret;
+
+		l.getfield(-1, key);
+		if (l.isstring(-1))
+			ret = l.tostring(-1);
+		l.pop();
+		return ret;
+	}
+
+	double number_field(lua::state &l, const char *key)
+	{
+		double ret = NAN;
+
+		l.getfield(-1, key);
+		if (l.isnumber(-1))
+			ret = l.tonumber(-1);
+		l.pop();
+		return ret;
+	}
+
+	/* an alert from the table on top of the stack, NULL if it makes no sense */
+	alert *read_alert(lua::state &l, int index)
+	{
+		std::unique_ptr<alert> a(new alert);
+		std::string source = string_field(l, "source");
+		double above = number_field(l, "above"), below = number_field(l, "below");
+
+		if (source.empty()) {
+			NORM_ERR("alert %d has no source", index);
+			return NULL;
+		}
+		if (std::isnan(above) == std::isnan(below)) {
+			NORM_ERR("alert %d needs either above or below", index);
+			return NULL;
+		}
+		a->above = !std::isnan(above);
+		a->threshold = a->above ? above : below;
+		a->clear = number_field(l, "clear");
+		if (std::isnan(a->clear))
+			a->clear = a->threshold;
+		else if (a->above ? a->clear > a->threshold : a->clear < a->threshold) {
+			NORM_ERR("alert %d: clear must be on the other side of the threshold", index);
+			return NULL;
+		}
+		a->name = string_field(l, "name");
+		if (a->name.empty())
+			a->name = source;
+		a->exec = string_field(l, "exec");
+		a->lua = string_field(l, "lua");
+		a->print = string_field(l, "print");
+		if (a->exec.empty() && a->lua.empty() && a->print.empty()) {
+			NORM_ERR("alert %d has no action (exec, lua or print)", index);
+			return NULL;
+		}
+
+		scan_expr(&a->source, source.c_str());
+		if (!a->source.data.opaque)
+			return NULL;
+		return a.release();
+	}
+
+	/* exec only when raised, the others both ways */
+	void fire(const alert &a, double value)
+	{
+		if (a.raised && !a.exec.empty())
+			exec_detached(a.exec);
+		if (!a.lua.empty())
+			llua_alert_hook(a.lua.c_str(), a.name.c_str(), value, a.raised);
+		if (!a.print.empty()) {
+			printf("%s %s: %s (%g)\n", a.raised ? "alert" : "cleared", a.name.c_str(),
+					a.print.c_str(), value);
+			fflush(stdout);
+		}
+	}
+}
+
+void init_alerts(void)
+{
+	lua::state &l = *state;
+
+	if (!alerts_table.get(l))
+		return;
+
+	std::lock_guard<lua::state> guard(l);
+	lua::stack_sentry s(l);
+	l.checkstack(4);
+
+	l.getglobal("conky");
+	l.getfield(-1, "config");
+	l.replace(-2);
+	l.getfield(-1, "alerts");
+	l.replace(-2);
+	for (int i = 1; ; ++i) {
+		l.rawgeti(-1, i);
+		if (l.isnil(-1)) {
+			l.pop();
+			break;
+		}
+		if (l.type(-1) != lua::TTABLE)
+			NORM_ERR("alert %d is not a table", i);
+		else if (alert *a = read_alert(l, i))
+			alerts.push_back(std::unique_ptr<alert>(a));
+		l.pop();
+	}
+	l.pop();
+}
+
+void free_alerts(void)
+{
+	alerts.clear();
+}
+
+void check_alerts(void)
+{
+	for (auto i = alerts.begin(); i != alerts.end(); ++i) {
+		alert &a = **i;
+		double v = expr_value(&a.source);
+
+		if (std::isnan(v))
+			continue;
+		if (!a.raised && (a.above ? v > a.threshold : v < a.threshold))
+			a.raised = true;
+		else if (a.raised && (a.above ? v <= a.clear : v >= a.clear))
+			a.raised = false;
+		else
+			continue;
+		fire(a, v);
+	}
+}
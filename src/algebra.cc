@@ -30,12 +30,17 @@
 #include "config.h"
 #include "conky.h"
 #include "algebra.h"
+#include "common.h"
+#include "core.h"
 #include "logging.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <cmath>
 #include <memory>
+#include <string>
+#include <vector>
 
 /* find the operand in the given expression
  * returns the index of the first op character or -1 on error
@@ -190,32 +195,15 @@ long arg_to_long(const char *arg)
 	}
 	return l;
 }
-int compare(const char *expr)
+/* compare the operand texts a and b, -2 if they can't be compared */
+static int compare_args(const char *a, enum match_type mtype, const char *b)
 {
-	char *expr_dup;
-	int idx, mtype;
 	enum arg_type type1, type2;
-	long lng_a, lng_b;
-	double dbl_a, dbl_b;
-
-	idx = find_match_op(expr);
-	mtype = get_match_type(expr);
-
-	if (!idx || mtype == -1) {
-		NORM_ERR("failed to parse compare string '%s'", expr);
-		return -2;
-	}
-
-	expr_dup = strdup(expr);
-	expr_dup[idx] = '\0';
-	if (expr_dup[idx + 1] == '=')
-		expr_dup[++idx] = '\0';
 
-	type1 = get_arg_type(expr_dup);
-	type2 = get_arg_type(expr_dup + idx + 1);
+	type1 = get_arg_type(a);
+	type2 = get_arg_type(b);
 	if (type1 == ARG_BAD || type2 == ARG_BAD) {
-		NORM_ERR("Bad arguments: '%s' and '%s'", expr_dup, (expr_dup + idx + 1));
-		free(expr_dup);
+		NORM_ERR("Bad arguments: '%s' and '%s'", a, b);
 		return -2;
 	}
 	if (type1 == ARG_LONG && type2 == ARG_DOUBLE)
@@ -223,40 +211,54 @@ int compare(const char *expr)
 	if (type1 == ARG_DOUBLE && type2 == ARG_LONG)
 		type2 = ARG_DOUBLE;
 	if (type1 != type2) {
-		NORM_ERR("trying to compare args '%s' and '%s' of different type",
-				expr_dup, (expr_dup + idx + 1));
-		free(expr_dup);
+		NORM_ERR("trying to compare args '%s' and '%s' of different type", a, b);
 		return -2;
 	}
 	switch (type1) {
 		case ARG_STRING:
 			{
-				char *a, *b;
-				a = arg_to_string(expr_dup);
-				b = arg_to_string(expr_dup + idx + 1);
-				idx = scompare(a, (enum match_type) mtype, b);
-				free(a);
-				free(b);
-				free(expr_dup);
-				return idx;
+				char *sa, *sb;
+				int r;
+				sa = arg_to_string(a);
+				sb = arg_to_string(b);
+				r = scompare(sa, mtype, sb);
+				free(sa);
+				free(sb);
+				return r;
 			}
 		case ARG_LONG:
-			lng_a = arg_to_long(expr_dup);
-			lng_b = arg_to_long(expr_dup + idx + 1);
-			free(expr_dup);
-			return lcompare(lng_a, (enum match_type) mtype,	lng_b);
+			return lcompare(arg_to_long(a), mtype, arg_to_long(b));
 		case ARG_DOUBLE:
-			dbl_a = arg_to_double(expr_dup);
-			dbl_b = arg_to_double(expr_dup + idx + 1);
-			free(expr_dup);
-			return dcompare(dbl_a, (enum match_type) mtype, dbl_b);
+			return dcompare(arg_to_double(a), mtype, arg_to_double(b));
 		case ARG_BAD: /* make_gcc_happy() */;
 	}
 	/* not reached */
-	free(expr_dup);
 	return -2;
 }
 
+int compare(const char *expr)
+{
+	char *expr_dup;
+	int idx, mtype, r;
+
+	idx = find_match_op(expr);
+	mtype = get_match_type(expr);
+
+	if (!idx || mtype == -1) {
+		NORM_ERR("failed to parse compare string '%s'", expr);
+		return -2;
+	}
+
+	expr_dup = strdup(expr);
+	expr_dup[idx] = '\0';
+	if (expr_dup[idx + 1] == '=')
+		expr_dup[++idx] = '\0';
+
+	r = compare_args(expr_dup, (enum match_type) mtype, expr_dup + idx + 1);
+	free(expr_dup);
+	return r;
+}
+
 int check_if_match(struct text_object *obj)
 {
 	std::unique_ptr<char []> expression(new char[max_user_text.get(*state)]);
@@ -274,3 +276,603 @@ int check_if_match(struct text_object *obj)
 	}
 	return result;
 }
+
+/* An if_match whose operator is in its own text (not in what a variable
+ * prints) is split when it is parsed, so that each evaluation only generates
+ * the operands. An operand that is a single object with a numeric value (a
+ * bar, gauge, graph or percentage, or a variable with a value callback) is
+ * compared by that value, without printing and parsing it. */
+struct match_operand {
+	struct text_object root;
+	struct text_object *number;	/* the single numeric object of root, if any */
+};
+
+struct match_data {
+	struct match_operand left, right;
+	enum match_type mtype;
+};
+
+/* the index of the operator in arg, skipping variables and quoted strings,
+ * or -1 */
+static int find_scan_op(const char *arg)
+{
+	int depth = 0;
+	bool quoted = false;
+
+	for (int idx = 0; arg[idx]; idx++) {
+		if (arg[idx] == '$' && arg[idx + 1] == '{') {
+			depth++;
+			idx++;
+		} else if (depth && arg[idx] == '{') {
+			depth++;
+		} else if (depth && arg[idx] == '}') {
+			depth--;
+		} else if (!depth && arg[idx] == '"') {
+			quoted = !quoted;
+		} else if (!depth && !quoted && strchr("=!<>", arg[idx])) {
+			return find_match_op(arg + idx) == 0 ? idx : -1;
+		}
+	}
+	return -1;
+}
+
+static void scan_match_operand(struct match_operand *op, const char *start, const char *end)
+{
+	std::string text;
+	struct text_object *obj;
+
+	while (start < end && isspace(*start))
+		start++;
+	while (end > start && isspace(*(end - 1)))
+		end--;
+	text.assign(start, end - start);
+
+	extract_variable_text_internal(&op->root, text.c_str());
+	obj = op->root.next;
+	op->number = NULL;
+	if (!obj || obj->next)
+		return;
+	if (obj->callbacks.print ? obj->callbacks.value != NULL :
+			!obj->callbacks.iftest && (obj->callbacks.barval || obj->callbacks.gaugeval ||
+				obj->callbacks.graphval || obj->callbacks.percentage))
+		op->number = obj;
+}
+
+/* the value of a numeric operand, NAN if it has none right now */
+static double number_value(struct text_object *obj)
+{
+	/* the same order of precedence the text program uses */
+	if (obj->callbacks.print)
+		return (*obj->callbacks.value)(obj);
+	if (obj->callbacks.barval)
+		return (*obj->callbacks.barval)(obj);
+	if (obj->callbacks.gaugeval)
+		return (*obj->callbacks.gaugeval)(obj);
+	if (obj->callbacks.graphval)
+		return (*obj->callbacks.graphval)(obj);
+	return (*obj->callbacks.percentage)(obj);
+}
+
+/* the operand's value, or its text if it has none, into buf */
+static void generate_match_operand(struct match_operand *op, char *buf, int size)
+{
+	double v = op->number ? number_value(op->number) : NAN;
+
+	if (!std::isnan(v))
+		snprintf(buf, size, "%f", v);
+	else
+		generate_text_internal(buf, size, op->root);
+}
+
+static int check_match_data(struct text_object *obj)
+{
+	struct match_data *md = (struct match_data *)obj->data.opaque;
+	int size = max_user_text.get(*state);
+	std::unique_ptr<char []> left(new char[size]), right(new char[size]);
+	int val;
+
+	if (md->left.number && md->right.number) {
+		double a = number_value(md->left.number), b = number_value(md->right.number);
+
+		if (!std::isnan(a) && !std::isnan(b))
+			return dcompare(a, md->mtype, b);
+	}
+
+	generate_match_operand(&md->left, left.get(), size);
+	generate_match_operand(&md->right, right.get(), size);
+	DBGP("parsed args into '%s' and '%s'", left.get(), right.get());
+
+	val = compare_args(left.get(), md->mtype, right.get());
+	if (val == -2) {
+		NORM_ERR("compare failed for '%s' and '%s'", left.get(), right.get());
+		return 1;
+	}
+	return val;
+}
+
+static void free_match_data(struct text_object *obj)
+{
+	struct match_data *md = (struct match_data *)obj->data.opaque;
+
+	if (!md)
+		return;
+	free_text_objects(&md->left.root);
+	free_text_objects(&md->right.root);
+	delete md;
+	obj->data.opaque = NULL;
+}
+
+void scan_if_match(struct text_object *obj, const char *arg)
+{
+	int idx = find_scan_op(arg);
+	int mtype;
+	struct match_data *md;
+
+	if (idx <= 0 || (mtype = get_match_type(arg + idx)) == -1) {
+		/* the operator may come from a variable, compare the whole text */
+		obj->sub = new_text_object();
+		extract_variable_text_internal(obj->sub, arg);
+		obj->callbacks.iftest = &check_if_match;
+		return;
+	}
+
+	md = new match_data;
+	md->mtype = (enum match_type) mtype;
+	scan_match_operand(&md->left, arg, arg + idx);
+	idx += (arg[idx + 1] == '=') ? 2 : 1;
+	scan_match_operand(&md->right, arg + idx, arg + strlen(arg));
+	obj->data.opaque = md;
+	obj->callbacks.iftest = &check_match_data;
+	obj->callbacks.free = &free_match_data;
+}
+
+/* An expr object is parsed once into a tree of these. Its operands are
+ * objects (variables) evaluated by their numeric value, like the numeric
+ * operands of if_match; only those without one are printed and read back as
+ * a number. */
+enum expr_kind {
+	EXPR_NUMBER, EXPR_OBJECT, EXPR_NEG, EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV,
+	EXPR_MOD, EXPR_CMP, EXPR_RATE, EXPR_AVG, EXPR_MIN, EXPR_MAX
+};
+
+struct expr_node {
+	enum expr_kind kind;
+	double number;			/* EXPR_NUMBER, and the window of EXPR_AVG */
+	struct match_operand operand;	/* EXPR_OBJECT */
+	enum match_type mtype;		/* EXPR_CMP */
+	std::vector<std::unique_ptr<expr_node>> args;
+	/* rate(): the last value and when it was seen */
+	double last, last_time;
+	/* avg(): the last values, a ring */
+	std::vector<double> values;
+	size_t next;
+
+	explicit expr_node(enum expr_kind kind_)
+		: kind(kind_), number(0), mtype(OP_EQ), last(NAN), last_time(0), next(0)
+	{
+		memset(&operand, 0, sizeof(operand));
+	}
+
+	~expr_node()
+	{
+		if (kind == EXPR_OBJECT)
+			free_text_objects(&operand.root);
+	}
+};
+typedef std::unique_ptr<expr_node> expr_ptr;
+
+static const struct {
+	const char *name;
+	enum expr_kind kind;
+	/* how many arguments it takes, at least and at most */
+	size_t min_args, max_args;
+} expr_functions[] = {
+	{ "rate", EXPR_RATE, 1, 1 },
+	{ "avg", EXPR_AVG, 2, 2 },
+	{ "min", EXPR_MIN, 1, SIZE_MAX },
+	{ "max", EXPR_MAX, 1, SIZE_MAX },
+};
+
+/* how far the parser got, and what went wrong there */
+struct expr_parser {
+	const char *p;
+	const char *error;
+};
+
+static expr_ptr parse_expr(struct expr_parser *ep);
+
+static void skip_blanks(struct expr_parser *ep)
+{
+	while (isspace(*ep->p))
+		ep->p++;
+}
+
+/* the length of the operator at p, if a word made of operator characters
+ * is one, otherwise 0 */
+static size_t operator_word(const char *p)
+{
+	size_t n = strspn(p, "+-*/%<>=!");
+
+	if (n == 0 || n > 2 || (p[n] && !isspace(p[n]) && p[n] != '(' && p[n] != '$' &&
+				!isdigit(p[n])))
+		return 0;
+	return n;
+}
+
+/* where the variable starting with ${ at p ends, NULL if it doesn't */
+static const char *variable_end(const char *p)
+{
+	int depth = 0;
+
+	for (; *p; p++) {
+		if (*p == '{')
+			depth++;
+		else if (*p == '}' && --depth == 0)
+			return p + 1;
+	}
+	return NULL;
+}
+
+static expr_ptr make_operand(const std::string &text)
+{
+	expr_ptr n(new expr_node(EXPR_OBJECT));
+
+	scan_match_operand(&n->operand, text.c_str(), text.c_str() + text.size());
+	return n;
+}
+
+/* a variable written as ${name args} or bare, as name and the words up to
+ * the next operator, comma or parenthesis */
+static expr_ptr parse_variable(struct expr_parser *ep, const char *name, size_t len)
+{
+	std::string text = "${" + std::string(name, len);
+
+	for (;;) {
+		const char *start;
+
+		while (*ep->p == ' ' || *ep->p == '\t')
+			ep->p++;
+		if (!*ep->p || strchr("),", *ep->p) || operator_word(ep->p))
+			break;
+		for (start = ep->p; *ep->p && !isspace(*ep->p) && !strchr("),", *ep->p); ep->p++)
+			;
+		text += ' ' + std::string(start, ep->p - start);
+	}
+	return make_operand(text + '}');
+}
+
+static expr_ptr parse_call(struct expr_parser *ep, const char *name, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(expr_functions) / sizeof(expr_functions[0]); i++) {
+		if (strlen(expr_functions[i].name) == len &&
+				strncmp(expr_functions[i].name, name, len) == 0)
+			break;
+	}
+	if (i == sizeof(expr_functions) / sizeof(expr_functions[0])) {
+		ep->error = "unknown function";
+		return expr_ptr();
+	}
+
+	expr_ptr n(new expr_node(expr_functions[i].kind));
+	ep->p++;	/* ( */
+	for (;;) {
+		expr_ptr arg = parse_expr(ep);
+
+		if (!arg)
+			return expr_ptr();
+		n->args.push_back(std::move(arg));
+		skip_blanks(ep);
+		if (*ep->p == ',') {
+			ep->p++;
+			continue;
+		}
+		if (*ep->p != ')') {
+			ep->error = "expected ',' or ')'";
+			return expr_ptr();
+		}
+		ep->p++;
+		break;
+	}
+	if (n->args.size() < expr_functions[i].min_args ||
+			n->args.size() > expr_functions[i].max_args) {
+		ep->error = "wrong number of arguments";
+		return expr_ptr();
+	}
+	if (n->kind == EXPR_AVG) {
+		/* the window is a constant */
+		if (n->args[1]->kind != EXPR_NUMBER || n->args[1]->number < 1 ||
+				n->args[1]->number > 65536) {
+			ep->error = "the window of avg() must be 1 to 65536 values";
+			return expr_ptr();
+		}
+		n->values.reserve((size_t) n->args[1]->number);
+	}
+	return n;
+}
+
+static expr_ptr parse_primary(struct expr_parser *ep)
+{
+	skip_blanks(ep);
+
+	if (*ep->p == '-') {
+		ep->p++;
+		expr_ptr arg = parse_primary(ep);
+		if (!arg)
+			return arg;
+		expr_ptr n(new expr_node(EXPR_NEG));
+		n->args.push_back(std::move(arg));
+		return n;
+	}
+	if (*ep->p == '(') {
+		ep->p++;
+		expr_ptr n = parse_expr(ep);
+		if (!n)
+			return n;
+		skip_blanks(ep);
+		if (*ep->p != ')') {
+			ep->error = "expected ')'";
+			return expr_ptr();
+		}
+		ep->p++;
+		return n;
+	}
+	if (isdigit(*ep->p) || (*ep->p == '.' && isdigit(ep->p[1]))) {
+		expr_ptr n(new expr_node(EXPR_NUMBER));
+		n->number = proc_scan_double(ep->p);
+		return n;
+	}
+	if (*ep->p == '$' && ep->p[1] == '{') {
+		const char *end = variable_end(ep->p);
+
+		if (!end) {
+			ep->error = "unterminated variable";
+			return expr_ptr();
+		}
+		expr_ptr n = make_operand(std::string(ep->p, end - ep->p));
+		ep->p = end;
+		return n;
+	}
+	if (isalpha(*ep->p) || *ep->p == '_') {
+		const char *name = ep->p;
+		size_t len;
+
+		while (isalnum(*ep->p) || *ep->p == '_')
+			ep->p++;
+		len = ep->p - name;
+		if (*ep->p == '(')
+			return parse_call(ep, name, len);
+		return parse_variable(ep, name, len);
+	}
+	ep->error = *ep->p ? "unexpected character" : "unexpected end";
+	return expr_ptr();
+}
+
+static expr_ptr binary(enum expr_kind kind, expr_ptr left, expr_ptr right)
+{
+	expr_ptr n(new expr_node(kind));
+
+	n->args.push_back(std::move(left));
+	n->args.push_back(std::move(right));
+	return n;
+}
+
+static expr_ptr parse_product(struct expr_parser *ep)
+{
+	expr_ptr n = parse_primary(ep);
+
+	while (n) {
+		enum expr_kind kind;
+
+		skip_blanks(ep);
+		if (*ep->p == '*')
+			kind = EXPR_MUL;
+		else if (*ep->p == '/')
+			kind = EXPR_DIV;
+		else if (*ep->p == '%')
+			kind = EXPR_MOD;
+		else
+			break;
+		ep->p++;
+		expr_ptr right = parse_primary(ep);
+		if (!right)
+			return right;
+		n = binary(kind, std::move(n), std::move(right));
+	}
+	return n;
+}
+
+static expr_ptr parse_sum(struct expr_parser *ep)
+{
+	expr_ptr n = parse_product(ep);
+
+	while (n) {
+		enum expr_kind kind;
+
+		skip_blanks(ep);
+		if (*ep->p == '+')
+			kind = EXPR_ADD;
+		else if (*ep->p == '-')
+			kind = EXPR_SUB;
+		else
+			break;
+		ep->p++;
+		expr_ptr right = parse_product(ep);
+		if (!right)
+			return right;
+		n = binary(kind, std::move(n), std::move(right));
+	}
+	return n;
+}
+
+/* a sum, or two compared with one of the operators of if_match, which is 1
+ * if the comparison holds and 0 if it doesn't */
+static expr_ptr parse_expr(struct expr_parser *ep)
+{
+	expr_ptr n = parse_sum(ep);
+	int mtype;
+
+	if (!n)
+		return n;
+	skip_blanks(ep);
+	if (!*ep->p || !strchr("=!<>", *ep->p))
+		return n;
+	if ((mtype = get_match_type(ep->p)) == -1) {
+		ep->error = "unknown operator";
+		return expr_ptr();
+	}
+	ep->p += ep->p[1] == '=' ? 2 : 1;
+	expr_ptr right = parse_sum(ep);
+	if (!right)
+		return right;
+	n = binary(EXPR_CMP, std::move(n), std::move(right));
+	n->mtype = (enum match_type) mtype;
+	return n;
+}
+
+/* the number an object without a numeric value prints, NAN if none */
+static double operand_text_value(struct match_operand *op)
+{
+	int size = max_user_text.get(*state);
+	std::unique_ptr<char []> buf(new char[size]);
+	const char *p = buf.get();
+	bool negative;
+
+	generate_text_internal(buf.get(), size, op->root);
+	while (isspace(*p))
+		p++;
+	negative = *p == '-';
+	if (negative)
+		p++;
+	if (!isdigit(*p) && !(*p == '.' && isdigit(p[1])))
+		return NAN;
+	return negative ? -proc_scan_double(p) : proc_scan_double(p);
+}
+
+static double eval_expr(expr_node *n)
+{
+	double a, b;
+
+	switch (n->kind) {
+		case EXPR_NUMBER:
+			return n->number;
+		case EXPR_OBJECT:
+			if (n->operand.number)
+				return number_value(n->operand.number);
+			return operand_text_value(&n->operand);
+		case EXPR_NEG:
+			return -eval_expr(n->args[0].get());
+		case EXPR_ADD:
+			return eval_expr(n->args[0].get()) + eval_expr(n->args[1].get());
+		case EXPR_SUB:
+			return eval_expr(n->args[0].get()) - eval_expr(n->args[1].get());
+		case EXPR_MUL:
+			return eval_expr(n->args[0].get()) * eval_expr(n->args[1].get());
+		case EXPR_DIV:
+			a = eval_expr(n->args[0].get());
+			b = eval_expr(n->args[1].get());
+			return b == 0 ? NAN : a / b;
+		case EXPR_MOD:
+			a = eval_expr(n->args[0].get());
+			b = eval_expr(n->args[1].get());
+			return b == 0 ? NAN : fmod(a, b);
+		case EXPR_CMP:
+			a = eval_expr(n->args[0].get());
+			b = eval_expr(n->args[1].get());
+			if (std::isnan(a) || std::isnan(b))
+				return NAN;
+			return dcompare(a, n->mtype, b);
+		case EXPR_RATE:
+			{
+				const double now = get_time();
+				double r = NAN;
+
+				a = eval_expr(n->args[0].get());
+				if (std::isnan(a))
+					return NAN;
+				if (!std::isnan(n->last) && now > n->last_time)
+					r = (a - n->last) / (now - n->last_time);
+				n->last = a;
+				n->last_time = now;
+				return r;
+			}
+		case EXPR_AVG:
+			{
+				const size_t window = (size_t) n->args[1]->number;
+				double sum = 0;
+
+				a = eval_expr(n->args[0].get());
+				if (std::isnan(a))
+					return NAN;
+				if (n->values.size() < window)
+					n->values.push_back(a);
+				else
+					n->values[n->next] = a;
+				n->next = (n->next + 1) % window;
+				for (auto i = n->values.begin(); i != n->values.end(); ++i)
+					sum += *i;
+				return sum / n->values.size();
+			}
+		case EXPR_MIN:
+		case EXPR_MAX:
+			{
+				double r = NAN;
+
+				for (auto i = n->args.begin(); i != n->args.end(); ++i) {
+					a = eval_expr(i->get());
+					if (std::isnan(a))
+						return NAN;
+					if (std::isnan(r) || (n->kind == EXPR_MIN ? a < r : a > r))
+						r = a;
+				}
+				return r;
+			}
+	}
+	return NAN;
+}
+
+void scan_expr(struct text_object *obj, const char *arg)
+{
+	struct expr_parser ep = { arg, NULL };
+	expr_ptr n = parse_expr(&ep);
+
+	if (n) {
+		skip_blanks(&ep);
+		if (*ep.p) {
+			ep.error = "unexpected character";
+			n.reset();
+		}
+	}
+	if (!n) {
+		NORM_ERR("expr: %s at '%s' in '%s'", ep.error, ep.p, arg);
+		return;
+	}
+	obj->data.opaque = n.release();
+}
+
+double expr_value(struct text_object *obj)
+{
+	expr_node *n = (expr_node *) obj->data.opaque;
+
+	return n ? eval_expr(n) : NAN;
+}
+
+/* whole numbers as such, the others with two decimals */
+void print_expr(struct text_object *obj, char *p, int p_max_size)
+{
+	double v = expr_value(obj);
+
+	if (std::isnan(v) || std::isinf(v))
+		return;
+	if (v == std::floor(v) && std::fabs(v) < 1e15)
+		snprintf(p, p_max_size, "%.0f", v);
+	else
+		snprintf(p, p_max_size, "%.2f", v);
+}
+
+void free_expr(struct text_object *obj)
+{
+	delete (expr_node *) obj->data.opaque;
+	obj->data.opaque = NULL;
+}
@@ -49,4 +49,14 @@ enum arg_type {
 int compare(const char *);
 int check_if_match(struct text_object *);
 
+/* set up an if_match object for arg */
+void scan_if_match(struct text_object *, const char *);
+
+/* expr: arithmetic (+ - * / %, the comparisons of if_match and rate(), avg(),
+ * min() and max()) over the numeric values of variables, parsed once */
+void scan_expr(struct text_object *, const char *);
+void print_expr(struct text_object *, char *, int);
+double expr_value(struct text_object *);
+void free_expr(struct text_object *);
+
 #endif /* _ALGEBRA_H */
@@ -32,6 +32,13 @@
 #include <netdb.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <mutex>
+#include <string>
+#include "update-cb.hh"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 enum _apcupsd_items {
 	APCUPSD_NAME,
@@ -137,20 +144,57 @@ static int get_line(int sock, char line[], short linesize)
 	return sz;
 }
 
-#define FILL(NAME,FIELD,FIRST)														\
-	if (!strncmp(NAME, line, sizeof(NAME)-1)) {										\
-		strncpy(apc->items[FIELD], line+11, APCUPSD_MAXSTR);						\
-		/* remove trailing newline and assure termination */						\
-		apc->items[FIELD][len-11 > APCUPSD_MAXSTR ? APCUPSD_MAXSTR : len-12] = 0;	\
-		if (FIRST) {																\
-			char* c;																\
-			for (c = apc->items[FIELD]; *c; ++c)									\
-				if (*c == ' ' && c > apc->items[FIELD]+2) {							\
-					*c = 0;															\
-					break;															\
-				}																	\
-		}																			\
+struct apcupsd_field {
+	const char *name;
+	int item;
+	/* only the number is wanted, not its unit */
+	bool first;
+};
+
+static const apcupsd_field apcupsd_fields[] = {
+	{ "UPSNAME",	APCUPSD_NAME,		false },
+	{ "MODEL",		APCUPSD_MODEL,		false },
+	{ "UPSMODE",	APCUPSD_UPSMODE,	false },
+	{ "CABLE",		APCUPSD_CABLE,		false },
+	{ "STATUS",		APCUPSD_STATUS,		false },
+	{ "LINEV",		APCUPSD_LINEV,		true },
+	{ "LOADPCT",	APCUPSD_LOAD,		true },
+	{ "BCHARGE",	APCUPSD_CHARGE,		true },
+	{ "TIMELEFT",	APCUPSD_TIMELEFT,	true },
+	{ "ITEMP",		APCUPSD_TEMP,		true },
+	{ "LASTXFER",	APCUPSD_LASTXFER,	false },
+};
+
+//
+// puts a "NAME     : value" line into its item
+//
+static void fill_item(const char *line, int len, PAPCUPSD_S apc)
+{
+	const char *colon = strchr(line, ':');
+	size_t namelen;
+
+	if (!colon || len < 11)
+		return;
+	for (namelen = colon - line; namelen && line[namelen - 1] == ' '; --namelen)
+		;
+	for (const apcupsd_field &f : apcupsd_fields) {
+		if (strlen(f.name) != namelen || strncmp(f.name, line, namelen))
+			continue;
+
+		char *item = apc->items[f.item];
+		strncpy(item, line + 11, APCUPSD_MAXSTR);
+		/* remove trailing newline and assure termination */
+		item[len-11 > APCUPSD_MAXSTR ? APCUPSD_MAXSTR : len-12] = 0;
+		if (f.first) {
+			for (char *c = item; *c; ++c)
+				if (*c == ' ' && c > item+2) {
+					*c = 0;
+					break;
+				}
+		}
+		return;
 	}
+}
 
 //
 // fills in the data received from a socket
@@ -159,95 +203,132 @@ static int fill_items(int sock, PAPCUPSD_S apc)
 {
 	char line[512];
 	int len;
-	while ((len = get_line(sock, line, sizeof(line)))) {
-		// fill the right types in
-		FILL("UPSNAME",		APCUPSD_NAME,		FALSE);
-		FILL("MODEL",		APCUPSD_MODEL,		FALSE);
-		FILL("UPSMODE",		APCUPSD_UPSMODE,	FALSE);
-		FILL("CABLE",		APCUPSD_CABLE,		FALSE);
-		FILL("STATUS",		APCUPSD_STATUS,		FALSE);
-		FILL("LINEV",		APCUPSD_LINEV,		TRUE);
-		FILL("LOADPCT",		APCUPSD_LOAD,		TRUE);
-		FILL("BCHARGE",		APCUPSD_CHARGE,		TRUE);
-		FILL("TIMELEFT",	APCUPSD_TIMELEFT,	TRUE);
-		FILL("ITEMP",		APCUPSD_TEMP,		TRUE);
-		FILL("LASTXFER",	APCUPSD_LASTXFER,	FALSE);
-	}
+	while ((len = get_line(sock, line, sizeof(line))) > 0)
+		fill_item(line, len, apc);
 
 	return len == 0;
 }
 
-//
-// Conky update function for apcupsd data
-//
-int update_apcupsd(void)
-{
-	int i;
-	APCUPSD_S apc;
-	int sock;
+namespace {
+	//
+	// asks apcupsd in the background, the main thread copies the result
+	// in update_apcupsd(). The connection is kept, apcupsd answers any
+	// number of requests on it.
+	//
+	class apcupsd_cb: public conky::callback<APCUPSD_S, std::string, int> {
+		typedef conky::callback<APCUPSD_S, std::string, int> Base;
 
-	for (i = 0; i < _APCUPSD_COUNT; ++i)
-		memcpy(apc.items[i], "N/A", 4); // including \0
+		int sock;
 
-	do {
-		struct addrinfo hints;
-		struct addrinfo *ai, *rp;
-		int res;
-		short sz = 0;
-		char portbuf[8];
-		//
-		// connect to apcupsd daemon
-		//
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = 0;
-		hints.ai_protocol = 0;
-		snprintf(portbuf, 8, "%d", apcupsd.port);
-		res = getaddrinfo(apcupsd.host, portbuf, &hints, &ai);
-		if (res != 0) {
-			NORM_ERR("APCUPSD getaddrinfo: %s", gai_strerror(res));
-			break;
-		}
-		for (rp = ai; rp != NULL; rp = rp->ai_next) {
-			sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-			if (sock == -1) {
-				continue;
-			}
-			if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) {
-				break;
-			}
-			close(sock);
+		bool connect_daemon();
+		bool request(PAPCUPSD_S apc);
+
+	protected:
+		virtual void work();
+
+	public:
+		apcupsd_cb(uint32_t period, const std::string &host, int port)
+			: Base(period, false, Tuple(host, port)), sock(-1)
+		{
+			for (int i = 0; i < _APCUPSD_COUNT; ++i)
+				memcpy(result.items[i], "N/A", 4); // including \0
 		}
-		freeaddrinfo(ai);
-		if (rp == NULL) {
-			// no error reporting, the daemon is probably not running
-			break;
+
+		~apcupsd_cb()
+		{
+			if (sock != -1)
+				close(sock);
 		}
+	};
+}
 
-		//
-		// send status request - "status" - 6B
-		//
-		sz = htons(6);
-		// no waiting to become writeable is really needed
-		if (send(sock, &sz, sizeof(sz), 0) != sizeof(sz) || send(sock, "status", 6, 0) != 6) {
-			perror("send");
+bool apcupsd_cb::connect_daemon()
+{
+	struct addrinfo hints;
+	struct addrinfo *ai, *rp;
+	int res;
+	char portbuf[8];
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = 0;
+	hints.ai_protocol = 0;
+	snprintf(portbuf, 8, "%d", get<1>());
+	res = getaddrinfo(get<0>().c_str(), portbuf, &hints, &ai);
+	if (res != 0) {
+		NORM_ERR("APCUPSD getaddrinfo: %s", gai_strerror(res));
+		return false;
+	}
+	for (rp = ai; rp != NULL; rp = rp->ai_next) {
+		sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if (sock == -1) {
+			continue;
+		}
+		if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) {
 			break;
 		}
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(ai);
+	// no error reporting, the daemon is probably not running
+	return rp != NULL;
+}
+
+bool apcupsd_cb::request(PAPCUPSD_S apc)
+{
+	//
+	// send status request - "status" - 6B
+	//
+	short sz = htons(6);
+	// no waiting to become writeable is really needed
+	if (send(sock, &sz, sizeof(sz), MSG_NOSIGNAL) != sizeof(sz)
+			|| send(sock, "status", 6, MSG_NOSIGNAL) != 6) {
+		return false;
+	}
+
+	//
+	// read the lines of output and put them into the info structure
+	//
+	return fill_items(sock, apc);
+}
 
-		//
-		// read the lines of output and put them into the info structure
-		//
-		if (!fill_items(sock, &apc)) break;
+void apcupsd_cb::work()
+{
+	APCUPSD_S apc;
+
+	for (int i = 0; i < _APCUPSD_COUNT; ++i)
+		memcpy(apc.items[i], "N/A", 4); // including \0
+
+	// a kept connection may have been closed by the daemon, try a new one then
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		if (sock == -1 && !connect_daemon())
+			break;
+		if (request(&apc))
+			break;
+		close(sock);
+		sock = -1;
+		for (int i = 0; i < _APCUPSD_COUNT; ++i)
+			memcpy(apc.items[i], "N/A", 4);
+	}
 
-	} while (0);
+	std::lock_guard<std::mutex> lock(result_mutex);
+	memcpy(result.items, apc.items, sizeof(result.items));
+}
 
-	close(sock);
+//
+// Conky update function for apcupsd data
+//
+int update_apcupsd(void)
+{
+	auto cb = conky::register_cb<apcupsd_cb>(1, std::string(apcupsd.host), apcupsd.port);
 
 	//
-	// "atomically" copy the data into working set
+	// copy the last snapshot into the working set
 	//
-	memcpy(apcupsd.items, apc.items, sizeof(apcupsd.items));
+	std::lock_guard<std::mutex> lock(cb->result_mutex);
+	memcpy(apcupsd.items, cb->get_result().items, sizeof(apcupsd.items));
 	return 0;
 }
 
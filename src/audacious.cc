@@ -30,7 +30,7 @@
 #include "logging.h"
 #include "audacious.h"
 #include <mutex>
-#include "update-cb.hh"
+#include "player-cb.hh"
 
 #include <glib.h>
 #ifdef NEW_AUDACIOUS_FOUND
@@ -78,6 +78,8 @@ namespace {
 		int playlist_position;
 		int main_volume;
 		aud_status status;
+		/* position in seconds, running on while playing */
+		conky::playback_clock clock;
 
 		aud_result()
 			: length(0), position(0), bitrate(0), frequency(0), channels(0), playlist_length(0),
@@ -85,8 +87,10 @@ namespace {
 		{}
 	};
 
-	class audacious_cb: public conky::callback<aud_result> {
-		typedef conky::callback<aud_result> Base;
+	/* the remote control interface has no change notifications, so the state
+	 * is still asked for every period, but the position moves on in between */
+	class audacious_cb: public conky::player_callback<aud_result> {
+		typedef conky::player_callback<aud_result> Base;
 
 #ifdef NEW_AUDACIOUS_FOUND
 		DBusGProxy *session;
@@ -95,11 +99,11 @@ namespace {
 #endif
 
 	protected:
-		virtual void work();
+		virtual void refresh();
 
 	public:
 		audacious_cb(uint32_t period)
-			: Base(period, false, Tuple())
+			: Base(period)
 		{
 #ifdef NEW_AUDACIOUS_FOUND
 			g_type_init();
@@ -128,7 +132,7 @@ namespace {
 	/* ---------------------------------------------------
 	 * Worker thread function for audacious data sampling.
 	 * --------------------------------------------------- */
-	void audacious_cb::work()
+	void audacious_cb::refresh()
 	{
 		aud_result tmp;
 		gchar *psong, *pfilename;
@@ -163,6 +167,7 @@ namespace {
 
 			/* Current song position */
 			tmp.position = audacious_remote_get_output_time(session);
+			tmp.clock.set(tmp.position / 1000.0, tmp.status == AS_PLAYING);
 
 			/* Current song bitrate, frequency, channels */
 			audacious_remote_get_info(session, &tmp.bitrate, &tmp.frequency, &tmp.channels);
@@ -192,7 +197,11 @@ namespace {
 		uint32_t period = std::max(
 				lround(music_player_interval.get(*state)/active_update_interval()), 1l
 				);
-		return conky::register_cb<audacious_cb>(period)->get_result_copy();
+		aud_result res = conky::register_cb<audacious_cb>(period)->get_result_copy();
+
+		if (res.clock.is_running())
+			res.position = lround(res.clock.get(res.length / 1000.0) * 1000);
+		return res;
 	}
 }
 
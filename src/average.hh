@@ -0,0 +1,98 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef AVERAGE_HH
+#define AVERAGE_HH
+
+#include <algorithm>
+#include <cstddef>
+
+enum average_mode {
+	AVERAGE_WINDOW,			// the mean of the last n samples
+	AVERAGE_EXPONENTIAL		// an exponentially weighted mean, with the weight of n samples
+};
+
+namespace conky {
+	/*
+	 * The average of the last samples of some value, as used for cpu_avg_samples and
+	 * friends. The last N samples are kept in a ring, together with their running sum, so
+	 * pushing a sample is O(1) whatever the window. The window may change between pushes
+	 * (the settings can be changed at run time), then the sum is built anew once.
+	 *
+	 * Like the arrays it replaces, the ring starts out as zeros, so the average takes n
+	 * pushes to reach the value. All zero bytes are the same as a default constructed
+	 * object, so this may live in structs that are calloc()ed.
+	 */
+	template<typename T, size_t N = 15>
+	class moving_average {
+		T ring[N];
+		size_t head;		// where the next sample goes
+		size_t window;		// the number of samples sum covers, 0 if it has to be built
+		size_t pushes;		// since the sum was built, so rounding errors don't pile up
+		T sum;
+		T ewma;
+
+		void build_sum(size_t n)
+		{
+			sum = 0;
+			for(size_t i = 1; i <= n; ++i)
+				sum += ring[(head + N - i) % N];
+			window = n;
+			pushes = 0;
+		}
+
+	public:
+		moving_average()
+			: ring(), head(0), window(0), pushes(0), sum(0), ewma(0)
+		{}
+
+		// add a sample and return the average over n of them (clamped to 1..N)
+		T push(T v, size_t n, average_mode mode = AVERAGE_WINDOW)
+		{
+			n = std::min(std::max(n, size_t(1)), N);
+
+			if(mode == AVERAGE_EXPONENTIAL) {
+				// the usual weight for an EWMA equivalent to an n sample window
+				ewma += (v - ewma) * (T(2) / T(n + 1));
+				window = 0;
+				return ewma;
+			}
+
+			if(n != window || pushes >= N)
+				build_sum(n);
+			sum += v - ring[(head + N - n) % N];
+			ring[head] = v;
+			head = (head + 1) % N;
+			++pushes;
+			// so that switching to the exponential mode carries on from here
+			ewma = sum / T(n);
+			return ewma;
+		}
+
+		T get() const { return ewma; }
+	};
+}
+
+#endif /* AVERAGE_HH */
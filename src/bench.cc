@@ -0,0 +1,344 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* conky_bench: times the hot paths of conky and prints one JSON object per
+ * benchmark on stdout, so the numbers of two builds can be compared by a
+ * script. With -P the collectors parse an update recording (see --record)
+ * instead of the live /proc, which keeps the input the same between runs,
+ * and with -S they read a generated procfs of the given size, to see how
+ * they scale with the number of processes and interfaces. */
+
+#include "conky.h"
+#include "core.h"
+#include "diskio.h"
+#include "lua-config.hh"
+#include "samples.h"
+#include "setting.hh"
+#include "specials.h"
+#include "template.h"
+#include "text_object.h"
+#include "top.h"
+#ifdef __linux__
+#include "linux.h"
+#endif
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char bench_config[] =
+	"conky.config = {\n"
+#ifdef BUILD_X11
+	"	out_to_x = false,\n"
+#endif
+	"	template0 = [[${\\1} ${\\2}]],\n"
+	"}\n";
+
+/* one block of a config typical for us, repeated to make it large */
+static const char bench_text[] =
+	"${time %H:%M:%S} ${uptime} ${mem}/${memmax} ${swap} ${loadavg} ${processes}\n"
+	"${fs_used /}/${fs_size /} "
+	"${if_match ${memperc} > 50}high${else}low${endif} ${template0 mem memperc}\n";
+
+static unsigned long iterations = 1000;
+static const char *only = NULL;
+
+/* advance to the next update, the next recorded one if replaying */
+static void bench_tick(void)
+{
+	last_update_time = current_update_time;
+	current_update_time = sample_tick(get_time());
+}
+
+template<typename Fn>
+static void bench(const char *name, Fn fn)
+{
+	double total = 0, min = std::numeric_limits<double>::infinity(), max = 0;
+
+	if (only && strcmp(only, name))
+		return;
+
+	fn();	/* warm up */
+	for (unsigned long i = 0; i < iterations; i++) {
+		double start = get_time(), t;
+
+		fn();
+		t = get_time() - start;
+		total += t;
+		min = std::min(min, t);
+		max = std::max(max, t);
+	}
+	printf("{\"name\":\"%s\",\"iterations\":%lu,\"mean_ns\":%.0f,"
+			"\"min_ns\":%.0f,\"max_ns\":%.0f}\n", name, iterations,
+			total / iterations * 1e9, min * 1e9, max * 1e9);
+	fflush(stdout);
+}
+
+static std::string read_text(const char *file)
+{
+	std::string text;
+	char buf[4096];
+	size_t n;
+	FILE *fp = fopen(file, "r");
+
+	if (!fp) {
+		fprintf(stderr, "conky_bench: can't open '%s': %s\n", file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+		text.append(buf, n);
+	fclose(fp);
+	return text;
+}
+
+static void write_file(const std::string &path, const std::string &contents)
+{
+	FILE *fp = fopen(path.c_str(), "w");
+
+	if (!fp || fwrite(contents.data(), 1, contents.size(), fp) != contents.size()) {
+		fprintf(stderr, "conky_bench: can't write '%s': %s\n", path.c_str(),
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+}
+
+/* a procfs with procs processes and ifaces interfaces in a new directory
+ * under /tmp, returns its path */
+static std::string make_synthetic_procfs(unsigned long procs, unsigned long ifaces)
+{
+	char root[] = "/tmp/conky-bench-XXXXXX";
+	char buf[512];
+	std::string netdev;
+
+	if (!mkdtemp(root)) {
+		fprintf(stderr, "conky_bench: mkdtemp(): %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	std::string dir(root);
+
+	write_file(dir + "/stat", "cpu  4705 356 584 3699176 23060 0 277 0 0 0\n"
+			"cpu0 4705 356 584 3699176 23060 0 277 0 0 0\n"
+			"intr 0\nctxt 0\nbtime 0\nprocesses 0\nprocs_running 1\n"
+			"procs_blocked 0\n");
+	write_file(dir + "/uptime", "36991.76 36991.76\n");
+	write_file(dir + "/loadavg", "0.10 0.20 0.30 1/100 1000\n");
+	write_file(dir + "/meminfo", "MemTotal: 1000000 kB\nMemFree: 500000 kB\n"
+			"Buffers: 10000 kB\nCached: 100000 kB\nSwapTotal: 0 kB\n"
+			"SwapFree: 0 kB\n");
+
+	mkdir((dir + "/net").c_str(), 0755);
+	netdev = "Inter-|   Receive                            "
+		"                    |  Transmit\n"
+		" face |bytes    packets errs drop fifo frame compressed multicast"
+		"|bytes    packets errs drop fifo colls carrier compressed\n";
+	for (unsigned long i = 0; i < ifaces; i++) {
+		snprintf(buf, sizeof buf, "eth%lu: %lu 100 0 0 0 0 0 0 %lu 100 0 0 0 0 0 0\n",
+				i, i * 1000, i * 500);
+		netdev += buf;
+	}
+	write_file(dir + "/net/dev", netdev);
+
+	for (unsigned long pid = 1; pid <= procs; pid++) {
+		std::string pdir = dir + "/" + std::to_string(pid);
+
+		mkdir(pdir.c_str(), 0755);
+		snprintf(buf, sizeof buf, "%lu (proc%lu) S 1 %lu %lu 0 -1 4194304 10 0 0 0 "
+				"%lu %lu 0 0 20 0 1 0 %lu 10000000 %lu\n", pid, pid, pid, pid,
+				pid % 1000, pid % 100, pid, 100 + pid % 1000);
+		write_file(pdir + "/stat", buf);
+		snprintf(buf, sizeof buf, "/usr/bin/proc%lu", pid);
+		write_file(pdir + "/cmdline", std::string(buf, strlen(buf) + 1));
+	}
+	return dir;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+	return remove(path);
+}
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+			"   -n COUNT    iterations of each benchmark, default 1000\n"
+			"   -b NAME     only run the benchmark NAME\n"
+			"   -t FILE     parse and evaluate the text in FILE instead of the built-in one\n"
+			"   -P FILE     parse the updates recorded with conky --record in FILE\n"
+			"   -r DIR      read procfs from DIR instead of /proc\n"
+			"   -S P,I      read procfs from a synthetic tree with P processes and I\n"
+			"               network interfaces\n",
+			prog);
+}
+
+int main(int argc, char **argv)
+{
+	std::string text, synthetic;
+	unsigned long procs, ifaces;
+	int c, rc = EXIT_SUCCESS;
+
+	while ((c = getopt(argc, argv, "n:b:t:P:r:S:h")) != -1) {
+		switch (c) {
+			case 'n':
+				iterations = std::max(strtoul(optarg, NULL, 10), 1ul);
+				break;
+			case 'b':
+				only = optarg;
+				break;
+			case 't':
+				text = read_text(optarg);
+				break;
+			case 'P':
+				if (!open_replay(optarg))
+					return EXIT_FAILURE;
+				break;
+			case 'r':
+				procfs_root = optarg;
+				break;
+			case 'S':
+				if (sscanf(optarg, "%lu,%lu", &procs, &ifaces) != 2) {
+					print_usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				synthetic = procfs_root = make_synthetic_procfs(procs, ifaces);
+				break;
+			default:
+				print_usage(argv[0]);
+				return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (text.empty()) {
+		for (int i = 0; i < 100; i++)
+			text += bench_text;
+	}
+
+	try {
+		state.reset(new lua::state);
+		conky::export_symbols(*state);
+		state->loadstring(bench_config);
+		state->call(0, 0);
+		conky::set_config_settings(*state);
+
+		/* the collectors compute rates, so they need a previous update */
+		bench_tick();
+#ifdef __linux__
+		update_stat();
+#endif
+		update_net_stats();
+		update_diskio();
+
+#ifdef __linux__
+		bench("update_stat", [] { bench_tick(); update_stat(); });
+#endif
+		bench("update_net_stats", [] { bench_tick(); update_net_stats(); });
+		bench("update_diskio", [] { bench_tick(); update_diskio(); });
+		{
+			struct text_object root;
+
+			memset(&root, 0, sizeof root);
+			extract_variable_text_internal(&root, "${top name 1}${top_mem name 1}");
+			bench("process_find_top", [] { bench_tick(); update_top(); });
+			free_text_objects(&root);
+		}
+#ifdef __linux__
+		bench("process_parse_stat", [] {
+			bench_tick();
+			process_parse_stat(get_process(getpid()));
+		});
+#endif
+
+		bench("find_and_replace_templates", [&text] {
+			free(find_and_replace_templates(text.c_str()));
+		});
+
+		bench("construct_text_object", [&text] {
+			struct text_object root;
+
+			memset(&root, 0, sizeof root);
+			extract_variable_text_internal(&root, text.c_str());
+			free_text_objects(&root);
+		});
+
+		{
+			struct text_object root;
+			unsigned int size = max_user_text.get(*state);
+			char *buf = (char *) malloc(size);
+
+			memset(&root, 0, sizeof root);
+			extract_variable_text_internal(&root, text.c_str());
+			bench_tick();
+			update_stuff();
+			bench("generate_text_internal", [&root, buf, size] {
+				generate_text_internal(buf, size, root);
+				clear_specials();
+			});
+			free_text_objects(&root);
+			free(buf);
+		}
+
+#ifdef BUILD_X11
+		{
+			struct text_object obj;
+			struct special_t s;
+			unsigned int i = 0;
+
+			memset(&obj, 0, sizeof obj);
+			memset(&s, 0, sizeof s);
+			free(scan_graph(&obj, "", 0));
+			s.graph = resize_graph_history(&obj, 300);
+			s.scaled = 1;
+			s.scale = 1;
+			bench("graph_append", [&s, &i] { graph_append(&s, i++ % 100, 0); });
+			free_special_data(&obj);
+		}
+#endif /* BUILD_X11 */
+
+		bench("human_readable", [] {
+			char buf[64];
+
+			for (long long n = 1; n > 0 && n < (1LL << 60); n *= 3)
+				human_readable(n, buf, sizeof buf);
+		});
+	}
+	catch(std::exception &e) {
+		fprintf(stderr, "conky_bench: %s\n", e.what());
+		rc = EXIT_FAILURE;
+	}
+	close_samples();
+	if (!synthetic.empty())
+		nftw(synthetic.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	return rc;
+}
@@ -0,0 +1,537 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "bpf_top.h"
+#include "logging.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/utsname.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+#if defined(__aarch64__)
+#include <asm/ptrace.h>
+#endif
+
+/* The programs are assembled here rather than compiled with clang, so that
+ * building conky takes nothing but the kernel headers. All of them add to
+ * one hash map from the tgid to a struct usage_value. */
+
+/* processes that fit in the map, it is cleaned up when it gets 3/4 full */
+#define BPF_TOP_ENTRIES 16384
+
+/* the offsets of the arguments of a function in the struct pt_regs of a
+ * kprobe, without them there is no traffic accounting */
+#if defined(__x86_64__)
+#define KPROBE_ARG2 offsetof(struct user_regs_struct, rsi)
+#define KPROBE_ARG3 offsetof(struct user_regs_struct, rdx)
+#elif defined(__aarch64__)
+#define KPROBE_ARG2 offsetof(struct user_pt_regs, regs[1])
+#define KPROBE_ARG3 offsetof(struct user_pt_regs, regs[2])
+#endif
+
+namespace {
+	struct usage_value {
+		uint64_t runtime;
+		uint64_t tx;
+		uint64_t rx;
+	};
+
+	/* the frame of the programs, below r10 */
+	enum {
+		FP_KEY = -4,					/* the u32 tgid, or the array index */
+		FP_VALUE = -32,					/* a struct usage_value to insert */
+	};
+
+	/* a program, with forward jumps to labels */
+	class assembler {
+		std::vector<struct bpf_insn> insns;
+		std::vector<std::pair<size_t, int>> fixups;
+		std::vector<ssize_t> labels;
+
+	public:
+		void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+		{
+			struct bpf_insn i;
+
+			i.code = code;
+			i.dst_reg = dst;
+			i.src_reg = src;
+			i.off = off;
+			i.imm = imm;
+			insns.push_back(i);
+		}
+
+		/* a jump comparing dst with imm, or an unconditional one with BPF_JA */
+		void jump(uint8_t op, uint8_t dst, int32_t imm, int label)
+		{
+			fixups.push_back(std::make_pair(insns.size(), label));
+			emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+		}
+
+		void place(int label)
+		{
+			if (labels.size() <= (size_t) label)
+				labels.resize(label + 1, -1);
+			labels[label] = insns.size();
+		}
+
+		/* r<dst> = the map of fd, which takes two instructions */
+		void load_map(uint8_t dst, int fd)
+		{
+			emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+			emit(0, 0, 0, 0, 0);
+		}
+
+		void call(int32_t helper)
+		{ emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper); }
+
+		const std::vector<struct bpf_insn> &finish()
+		{
+			for (auto i = fixups.begin(); i != fixups.end(); ++i)
+				insns[i->first].off = labels[i->second] - i->first - 1;
+			return insns;
+		}
+	};
+
+	int sys_bpf(int cmd, union bpf_attr *attr)
+	{ return syscall(__NR_bpf, cmd, attr, sizeof(*attr)); }
+
+	int perf_event_open(struct perf_event_attr *attr, int cpu)
+	{ return syscall(__NR_perf_event_open, attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC); }
+
+	int map_fd = -1;
+	/* the per cpu time of the last sched_switch */
+	int switch_map_fd = -1;
+	std::vector<int> prog_fds;
+	std::vector<int> event_fds;
+	/* the values of the map at the last bpf_top_read() */
+	std::unordered_map<pid_t, struct usage_value> last;
+	bool started = false, failed = false;
+
+	int create_map(uint32_t type, uint32_t value_size, uint32_t entries)
+	{
+		union bpf_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_type = type;
+		attr.key_size = sizeof(uint32_t);
+		attr.value_size = value_size;
+		attr.max_entries = entries;
+		return sys_bpf(BPF_MAP_CREATE, &attr);
+	}
+
+	/* r0 = the value of the current tgid in FP_KEY, or NULL */
+	void emit_lookup(assembler &a)
+	{
+		a.load_map(1, map_fd);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0);
+		a.emit(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, FP_KEY);
+		a.call(BPF_FUNC_map_lookup_elem);
+	}
+
+	/* Adds r<src> to the field at off of the value of the current tgid,
+	 * inserting the value if there is none. Clobbers r0-r5 and r9. */
+	void emit_add_usage(assembler &a, uint8_t src, int16_t off, int done)
+	{
+		enum { INSERT = 100, RACED };
+
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 9, src, 0, 0);
+		a.call(BPF_FUNC_get_current_pid_tgid);
+		a.emit(BPF_ALU64 | BPF_RSH | BPF_K, 0, 0, 0, 32);
+		a.emit(BPF_STX | BPF_MEM | BPF_W, 10, 0, FP_KEY, 0);
+		emit_lookup(a);
+		a.jump(BPF_JEQ, 0, 0, INSERT);
+		a.emit(BPF_STX | BPF_ATOMIC | BPF_DW, 0, 9, off, BPF_ADD);
+		a.jump(BPF_JA, 0, 0, done);
+
+		a.place(INSERT);
+		a.emit(BPF_ST | BPF_MEM | BPF_DW, 10, 0, FP_VALUE, 0);
+		a.emit(BPF_ST | BPF_MEM | BPF_DW, 10, 0, FP_VALUE + 8, 0);
+		a.emit(BPF_ST | BPF_MEM | BPF_DW, 10, 0, FP_VALUE + 16, 0);
+		a.emit(BPF_STX | BPF_MEM | BPF_DW, 10, 9, FP_VALUE + off, 0);
+		a.load_map(1, map_fd);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0);
+		a.emit(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, FP_KEY);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 3, 10, 0, 0);
+		a.emit(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, FP_VALUE);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, BPF_NOEXIST);
+		a.call(BPF_FUNC_map_update_elem);
+		a.jump(BPF_JEQ, 0, -EEXIST, RACED);
+		a.jump(BPF_JA, 0, 0, done);
+
+		/* another cpu inserted it in the meantime (loops aren't allowed) */
+		a.place(RACED);
+		emit_lookup(a);
+		a.jump(BPF_JEQ, 0, 0, done);
+		a.emit(BPF_STX | BPF_ATOMIC | BPF_DW, 0, 9, off, BPF_ADD);
+	}
+
+	/* on sched_switch, the time since the last switch of the cpu goes to the
+	 * task switched out, which is still current */
+	void assemble_switch(assembler &a)
+	{
+		enum { DONE };
+
+		a.emit(BPF_ST | BPF_MEM | BPF_W, 10, 0, FP_KEY, 0);
+		a.load_map(1, switch_map_fd);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0);
+		a.emit(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, FP_KEY);
+		a.call(BPF_FUNC_map_lookup_elem);
+		a.jump(BPF_JEQ, 0, 0, DONE);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 7, 0, 0, 0);
+		a.call(BPF_FUNC_ktime_get_ns);
+		a.emit(BPF_LDX | BPF_MEM | BPF_DW, 8, 7, 0, 0);
+		a.emit(BPF_STX | BPF_MEM | BPF_DW, 7, 0, 0, 0);
+		/* the first switch on this cpu since loading */
+		a.jump(BPF_JEQ, 8, 0, DONE);
+		a.emit(BPF_ALU64 | BPF_SUB | BPF_X, 0, 8, 0, 0);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_X, 8, 0, 0, 0);
+		/* the idle task has pid 0 */
+		a.call(BPF_FUNC_get_current_pid_tgid);
+		a.emit(BPF_ALU64 | BPF_LSH | BPF_K, 0, 0, 0, 32);
+		a.jump(BPF_JEQ, 0, 0, DONE);
+		emit_add_usage(a, 8, offsetof(struct usage_value, runtime), DONE);
+
+		a.place(DONE);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0);
+		a.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+	}
+
+#ifdef KPROBE_ARG2
+	/* a kprobe on a function with the byte count as argument at arg_off */
+	void assemble_traffic(assembler &a, int16_t arg_off, int16_t off)
+	{
+		enum { DONE };
+
+		a.emit(BPF_LDX | BPF_MEM | BPF_DW, 8, 1, arg_off, 0);
+		/* it is an int for tcp_cleanup_rbuf(), size_t for tcp_sendmsg() */
+		a.emit(BPF_ALU64 | BPF_LSH | BPF_K, 8, 0, 0, 32);
+		a.emit(BPF_ALU64 | BPF_ARSH | BPF_K, 8, 0, 0, 32);
+		a.jump(BPF_JSLE, 8, 0, DONE);
+		emit_add_usage(a, 8, off, DONE);
+
+		a.place(DONE);
+		a.emit(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0);
+		a.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+	}
+#endif /* KPROBE_ARG2 */
+
+	/* the kernel version, which kprobe programs had to state before 5.0 */
+	uint32_t kernel_version(void)
+	{
+		struct utsname u;
+		unsigned int a = 0, b = 0, c = 0;
+
+		if (uname(&u) == 0)
+			sscanf(u.release, "%u.%u.%u", &a, &b, &c);
+		return (a << 16) + (b << 8) + (c > 255 ? 255 : c);
+	}
+
+	int load_prog(uint32_t type, const std::vector<struct bpf_insn> &insns)
+	{
+		static const char license[] = "GPL";
+		union bpf_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.prog_type = type;
+		attr.insns = (uintptr_t) insns.data();
+		attr.insn_cnt = insns.size();
+		attr.license = (uintptr_t) license;
+		attr.kern_version = kernel_version();
+		return sys_bpf(BPF_PROG_LOAD, &attr);
+	}
+
+	/* attaches prog to the event on all cpus, false if none took it */
+	bool attach(struct perf_event_attr *attr, int prog)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_CONF);
+		bool any = false;
+
+		for (long cpu = 0; cpu < cpus; cpu++) {
+			/* fails for the cpus which are offline */
+			int fd = perf_event_open(attr, cpu);
+
+			if (fd < 0)
+				continue;
+			if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, prog) < 0 ||
+					ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+				close(fd);
+				continue;
+			}
+			event_fds.push_back(fd);
+			any = true;
+		}
+		return any;
+	}
+
+	/* the first line of the first of the files that can be read, as a number */
+	int read_number(const char *const *paths)
+	{
+		for (; *paths; paths++) {
+			FILE *f = fopen(*paths, "r");
+			int n;
+
+			if (!f)
+				continue;
+			if (fscanf(f, "%d", &n) != 1)
+				n = -1;
+			fclose(f);
+			return n;
+		}
+		return -1;
+	}
+
+	bool attach_switch(void)
+	{
+		static const char *const ids[] = {
+			"/sys/kernel/tracing/events/sched/sched_switch/id",
+			"/sys/kernel/debug/tracing/events/sched/sched_switch/id",
+			NULL
+		};
+		struct perf_event_attr attr;
+		assembler a;
+		int id, prog;
+
+		if ((id = read_number(ids)) < 0) {
+			NORM_ERR("bpf: can't find the sched_switch tracepoint");
+			return false;
+		}
+		assemble_switch(a);
+		if ((prog = load_prog(BPF_PROG_TYPE_TRACEPOINT, a.finish())) < 0) {
+			NORM_ERR("bpf: can't load the sched_switch program: %s", strerror(errno));
+			return false;
+		}
+		prog_fds.push_back(prog);
+
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.size = sizeof(attr);
+		attr.config = id;
+		attr.sample_period = 1;
+		attr.wakeup_events = 1;
+		if (!attach(&attr, prog)) {
+			NORM_ERR("bpf: can't attach to sched_switch: %s", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+	/* the traffic is nice to have, nothing is said if it can't be counted */
+	void attach_traffic(void)
+	{
+#ifdef KPROBE_ARG2
+		static const char *const types[] = {
+			"/sys/bus/event_source/devices/kprobe/type", NULL
+		};
+		static const struct {
+			const char *func;
+			int16_t arg_off, off;
+		} probes[] = {
+			{ "tcp_sendmsg", KPROBE_ARG3, offsetof(struct usage_value, tx) },
+			{ "tcp_cleanup_rbuf", KPROBE_ARG2, offsetof(struct usage_value, rx) },
+		};
+		int type = read_number(types);
+
+		if (type < 0)
+			return;
+		for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+			struct perf_event_attr attr;
+			assembler a;
+			int prog;
+
+			assemble_traffic(a, probes[i].arg_off, probes[i].off);
+			if ((prog = load_prog(BPF_PROG_TYPE_KPROBE, a.finish())) < 0)
+				continue;
+			prog_fds.push_back(prog);
+
+			memset(&attr, 0, sizeof(attr));
+			attr.type = type;
+			attr.size = sizeof(attr);
+			attr.config1 = (uintptr_t) probes[i].func;
+			attr.sample_period = 1;
+			attr.wakeup_events = 1;
+			attach(&attr, prog);
+		}
+#endif /* KPROBE_ARG2 */
+	}
+
+	/* the values of all the processes in the map, in one syscall per 256
+	 * with BPF_MAP_LOOKUP_BATCH (5.6), else in two per process */
+	void read_map(std::vector<std::pair<uint32_t, struct usage_value>> &out)
+	{
+		static bool no_batch = false;
+		uint32_t keys[256], token = 0;
+		struct usage_value values[256];
+		union bpf_attr attr;
+		bool first = true;
+
+		while (!no_batch) {
+			int ret;
+
+			memset(&attr, 0, sizeof(attr));
+			attr.batch.in_batch = first ? 0 : (uintptr_t) &token;
+			attr.batch.out_batch = (uintptr_t) &token;
+			attr.batch.keys = (uintptr_t) keys;
+			attr.batch.values = (uintptr_t) values;
+			attr.batch.count = 256;
+			attr.batch.map_fd = map_fd;
+			ret = sys_bpf(BPF_MAP_LOOKUP_BATCH, &attr);
+			if (ret < 0 && errno != ENOENT) {
+				if (!first || (errno != EINVAL && errno != ENOTSUP && errno != EOPNOTSUPP))
+					return;
+				no_batch = true;
+				break;
+			}
+			for (uint32_t i = 0; i < attr.batch.count; i++)
+				out.push_back(std::make_pair(keys[i], values[i]));
+			if (ret < 0)
+				return;
+			first = false;
+		}
+
+		for (uint32_t key = 0, next; ; key = next) {
+			memset(&attr, 0, sizeof(attr));
+			attr.map_fd = map_fd;
+			attr.key = first ? 0 : (uintptr_t) &key;
+			attr.next_key = (uintptr_t) &next;
+			if (sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr) < 0)
+				return;
+			first = false;
+
+			memset(&attr, 0, sizeof(attr));
+			attr.map_fd = map_fd;
+			attr.key = (uintptr_t) &next;
+			attr.value = (uintptr_t) &values[0];
+			if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) == 0)
+				out.push_back(std::make_pair(next, values[0]));
+		}
+	}
+
+	void unload(void)
+	{
+		for (auto i = event_fds.begin(); i != event_fds.end(); ++i)
+			close(*i);
+		for (auto i = prog_fds.begin(); i != prog_fds.end(); ++i)
+			close(*i);
+		event_fds.clear();
+		prog_fds.clear();
+		if (map_fd >= 0)
+			close(map_fd);
+		if (switch_map_fd >= 0)
+			close(switch_map_fd);
+		map_fd = switch_map_fd = -1;
+		last.clear();
+		started = false;
+	}
+
+	void delete_key(uint32_t key)
+	{
+		union bpf_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = map_fd;
+		attr.key = (uintptr_t) &key;
+		sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+	}
+}
+
+bool bpf_top_start(void)
+{
+	if (started || failed)
+		return started;
+
+	map_fd = create_map(BPF_MAP_TYPE_HASH, sizeof(struct usage_value), BPF_TOP_ENTRIES);
+	switch_map_fd = create_map(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint64_t), 1);
+	if (map_fd < 0 || switch_map_fd < 0) {
+		NORM_ERR("bpf: can't create the maps: %s, top reads /proc", strerror(errno));
+		unload();
+		failed = true;
+		return false;
+	}
+	if (!attach_switch()) {
+		NORM_ERR("bpf: top reads /proc");
+		unload();
+		failed = true;
+		return false;
+	}
+	attach_traffic();
+	started = true;
+	return true;
+}
+
+void bpf_top_read(std::vector<struct bpf_top_usage> &usage)
+{
+	std::vector<std::pair<uint32_t, struct usage_value>> values;
+	std::unordered_map<pid_t, struct usage_value> seen;
+	bool full;
+
+	usage.clear();
+	if (!started)
+		return;
+
+	read_map(values);
+	/* the processes which didn't do anything are dropped from the map to make
+	 * room, they are counted from 0 if they come back */
+	full = values.size() > BPF_TOP_ENTRIES * 3 / 4;
+	seen.reserve(values.size());
+	for (auto i = values.begin(); i != values.end(); ++i) {
+		struct usage_value now = i->second, before = { 0, 0, 0 };
+		auto l = last.find(i->first);
+
+		if (l != last.end())
+			before = l->second;
+		/* a pid that was dropped and came back */
+		if (now.runtime < before.runtime || now.tx < before.tx || now.rx < before.rx)
+			before = { 0, 0, 0 };
+		if (now.runtime == before.runtime && now.tx == before.tx &&
+				now.rx == before.rx) {
+			if (full) {
+				delete_key(i->first);
+				continue;
+			}
+		} else {
+			usage.push_back({ (pid_t) i->first, now.runtime - before.runtime,
+					now.tx - before.tx, now.rx - before.rx });
+		}
+		seen[i->first] = now;
+	}
+	last.swap(seen);
+}
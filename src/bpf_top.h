@@ -0,0 +1,59 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _BPF_TOP_H
+#define _BPF_TOP_H
+
+#include <sys/types.h>
+#include <vector>
+
+/* With BUILD_BPF, the cpu time and the TCP traffic of each process are summed
+ * up by eBPF programs in the kernel: on sched_switch for the cpu time, in
+ * tcp_sendmsg() and tcp_cleanup_rbuf() for the bytes sent and received. top
+ * then only reads /proc/<pid>/stat of the processes it shows, instead of
+ * those of all processes. Loading the programs takes CAP_BPF and
+ * CAP_PERFMON (or root); without them, or without the tracepoint, top reads
+ * /proc as usual. The traffic needs kprobes, and is 0 without them. A task
+ * is only credited with its time when it is switched out. */
+
+/* what a process used since the last bpf_top_read() */
+struct bpf_top_usage {
+	pid_t pid;
+	unsigned long long runtime;		/* nanoseconds on a cpu */
+	unsigned long long tx, rx;		/* bytes through TCP sockets */
+};
+
+/* loads and attaches the programs on first use, false if that fails */
+bool bpf_top_start(void);
+
+/* the processes that ran or used the network since the last call */
+void bpf_top_read(std::vector<struct bpf_top_usage> &usage);
+
+#endif /* _BPF_TOP_H */
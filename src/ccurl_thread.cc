@@ -27,8 +27,16 @@
 #include "logging.h"
 #include "ccurl_thread.h"
 #include "text_object.h"
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cmath>
+#include <condition_variable>
+#include <map>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #ifdef DEBUG
 #include <assert.h>
@@ -43,7 +51,124 @@
  * example.
  */
 
+namespace {
+	conky::range_config_setting<unsigned int> curl_max_connections("curl_max_connections",
+			0, std::numeric_limits<unsigned int>::max(), 0, true);
+	conky::range_config_setting<unsigned int> curl_max_host_connections(
+			"curl_max_host_connections", 0, std::numeric_limits<unsigned int>::max(), 0, true);
+
+	/*
+	 * All transfers go through one thread driving a curl multi handle, so connections,
+	 * HTTP/2 streams, the DNS cache and TLS sessions are shared between all curl callbacks.
+	 * perform() blocks until the transfer is done, like curl_easy_perform().
+	 */
+	class curl_fetcher {
+		std::mutex mutex;
+		std::condition_variable done_cv;
+		CURLM *multi;
+		CURLSH *share;
+		std::pair<int, int> wakeup;
+		std::vector<CURL *> pending;
+		std::map<CURL *, CURLcode> done;
+		long max_total, max_host;
+
+		void loop();
+
+	public:
+		curl_fetcher();
+		CURLcode perform(CURL *curl);
+	};
+
+	curl_fetcher::curl_fetcher()
+		: multi(curl_multi_init()), share(curl_share_init()), wakeup(pipe2(O_CLOEXEC)),
+		  max_total(0), max_host(0)
+	{
+		if(not multi or not share)
+			throw std::runtime_error("curl_multi_init() failed");
+
+		fcntl(wakeup.first, F_SETFL, O_NONBLOCK);
+		// only the fetcher thread uses the share, so it needs no locking
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+		curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+		std::thread(&curl_fetcher::loop, this).detach();
+	}
+
+	CURLcode curl_fetcher::perform(CURL *curl)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		char c = 0;
+
+		max_total = curl_max_connections.get(*state);
+		max_host = curl_max_host_connections.get(*state);
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+		pending.push_back(curl);
+		if(write(wakeup.second, &c, 1) == -1 && errno != EAGAIN)
+			NORM_ERR("curl: waking up the fetcher failed: %s", strerror(errno));
+
+		done_cv.wait(lock, [this, curl] { return done.count(curl) != 0; });
+		CURLcode res = done[curl];
+		done.erase(curl);
+		return res;
+	}
+
+	void curl_fetcher::loop()
+	{
+		struct curl_waitfd wfd;
+		char buf[64];
+		int running, left;
+
+		conky::setup_worker_thread("conky-curl");
+
+		wfd.fd = wakeup.first;
+		wfd.events = CURL_WAIT_POLLIN;
+		for(;;) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_total);
+				curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host);
+				for(CURL *curl : pending)
+					curl_multi_add_handle(multi, curl);
+				pending.clear();
+			}
+
+			curl_multi_perform(multi, &running);
+
+			while(CURLMsg *msg = curl_multi_info_read(multi, &left)) {
+				if(msg->msg != CURLMSG_DONE)
+					continue;
+
+				CURL *curl = msg->easy_handle;
+				CURLcode res = msg->data.result;
+				curl_multi_remove_handle(multi, curl);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				done[curl] = res;
+				done_cv.notify_all();
+			}
+
+			curl_multi_wait(multi, &wfd, 1, 1000, NULL);
+			while(read(wakeup.first, buf, sizeof buf) > 0)
+				;
+		}
+	}
+
+	// never destroyed, its thread runs until conky exits
+	curl_fetcher &fetcher()
+	{
+		static curl_fetcher *f = new curl_fetcher;
+		return *f;
+	}
+}
+
 namespace priv {
+	// don't believe a Content-Length beyond this
+	const unsigned long MAX_RESERVE = 16 * 1024 * 1024;
+
 	/* callback used by curl for parsing the header data */
 	size_t curl_internal::parse_header_cb(void *ptr, size_t size, size_t nmemb, void *data)
 	{
@@ -54,10 +179,16 @@ namespace priv {
 		if(realsize > 0 && (value[realsize-1] == '\r' || value[realsize-1] == 0))
 			--realsize;
 
-		if (strncmp(value, "Last-Modified: ", 15) == EQUAL) {
+		// HTTP/2 sends the header names in lower case
+		if (strncasecmp(value, "Last-Modified: ", 15) == EQUAL) {
 			obj->last_modified = std::string(value + 15, realsize - 15);
-		} else if (strncmp(value,"ETag: ", 6) == EQUAL) {
+		} else if (strncasecmp(value,"ETag: ", 6) == EQUAL) {
 			obj->etag = std::string(value + 6, realsize - 6);
+		} else if (strncasecmp(value, "Content-Length: ", 16) == EQUAL) {
+			// the compressed size, when the data is compressed, still a good start
+			unsigned long length = strtoul(value + 16, NULL, 10);
+
+			obj->data.reserve(std::min(length, MAX_RESERVE));
 		}
 
 		return size*nmemb;
@@ -70,13 +201,13 @@ namespace priv {
 		const char *value = static_cast<const char *>(ptr);
 		size_t realsize = size * nmemb;
 
-		obj->data += std::string(value, realsize);
+		obj->data.append(value, realsize);
 
 		return realsize;
 	}
 
-	curl_internal::curl_internal(const std::string &url)
-		: curl(curl_easy_init())
+	curl_internal::curl_internal(const std::string &url_)
+		: url(url_), curl(curl_easy_init())
 	{
 		if(not curl)
 			throw std::runtime_error("curl_easy_init() failed");
@@ -88,18 +219,24 @@ namespace priv {
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
 		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
 		curl_easy_setopt(curl, CURLOPT_USERAGENT, "conky-curl/1.1");
+		// an empty string asks for any encoding this libcurl can decode
+		curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1000);
 		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60);
 
 		// curl's usage of alarm()+longjmp() is a really bad idea for multi-threaded applications
 		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+		// prefer waiting for a connection that can multiplex over opening another one
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1);
+#endif
 
 	}
 
 
-	/* fetch our datums */
-	void curl_internal::do_work()
+	/* fetch our datums, returns what went wrong, if anything */
+	std::string curl_internal::do_work()
 	{
 		CURLcode res;
 		struct headers_ {
@@ -123,28 +260,26 @@ namespace priv {
 			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.h);
 		}
 
-		res = curl_easy_perform(curl);
-		if (res == CURLE_OK) {
-			long http_status_code;
-
-			if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status_code) == CURLE_OK) {
-				switch (http_status_code) {
-					case 200:
-						process_data();
-						break;
-					case 304:
-						break;
-					default:
-						NORM_ERR("curl: no data from server, got HTTP status %ld",
-								http_status_code);
-						break;
-				}
-			} else {
-				NORM_ERR("curl: no HTTP status from server");
-			}
-		} else {
-			NORM_ERR("curl: could not retrieve data from server");
+		res = fetcher().perform(curl);
+		if (res != CURLE_OK)
+			return std::string("curl: could not retrieve data from ") + url + ": "
+				+ curl_easy_strerror(res);
+
+		long http_status_code;
+
+		if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status_code) != CURLE_OK)
+			return "curl: no HTTP status from " + url;
+		switch (http_status_code) {
+			case 200:
+				process_data();
+				break;
+			case 304:
+				break;
+			default:
+				return "curl: no data from " + url + ", got HTTP status "
+					+ std::to_string(http_status_code);
 		}
+		return std::string();
 	}
 }
 
@@ -154,10 +289,7 @@ namespace {
 
 	protected:
 		virtual void process_data()
-		{
-			std::lock_guard<std::mutex> lock(result_mutex);
-			result = data;
-		}
+		{ publish_result(std::string(data)); }
 	
 	public:
 		simple_curl_cb(uint32_t period, const std::string &uri)
@@ -166,6 +298,32 @@ namespace {
 	};
 }
 
+namespace {
+	// a single download, for ccurl_fetch()
+	struct curl_once: public priv::curl_internal {
+		bool ok;
+
+		virtual void process_data()
+		{ ok = true; }
+
+		curl_once(const std::string &url)
+			: curl_internal(url), ok(false)
+		{}
+	};
+}
+
+bool ccurl_fetch(const std::string &url, std::string &data)
+{
+	curl_once once(url);
+	std::string error = once.do_work();
+
+	if (!error.empty())
+		NORM_ERR("%s", error.c_str());
+	if (once.ok)
+		data.swap(once.data);
+	return once.ok;
+}
+
 /*
  * This is where the $curl section begins.
  */
@@ -181,7 +339,7 @@ void ccurl_process_info(char *p, int p_max_size, const std::string &uri, int int
 	uint32_t period = std::max(lround(interval/active_update_interval()), 1l);
 	auto cb = conky::register_cb<simple_curl_cb>(period, uri);
 
-	strncpy(p, cb->get_result_copy().c_str(), p_max_size);
+	strncpy(p, cb->get_result_ptr()->c_str(), p_max_size);
 }
 
 void curl_parse_arg(struct text_object *obj, const char *arg)
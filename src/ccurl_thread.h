@@ -33,6 +33,7 @@
 namespace priv {
 	// factored out stuff that does not depend on the template parameters
 	struct curl_internal {
+		const std::string url;
 		std::string last_modified;
 		std::string etag;
 		std::string data;
@@ -41,7 +42,8 @@ namespace priv {
 		static size_t parse_header_cb(void *ptr, size_t size, size_t nmemb, void *data);
 		static size_t write_cb(void *ptr, size_t size, size_t nmemb, void *data);
 
-		void do_work();
+		// empty if the server answered, what went wrong otherwise
+		std::string do_work();
 
 		// called by do_work() after downloading data from the uri
 		// it should populate the result variable
@@ -66,7 +68,12 @@ protected:
 	virtual void work()
 	{
 		DBGP("reading curl data from '%s'", std::get<0>(Base1::tuple).c_str());
-		do_work();
+		std::string error = do_work();
+
+		if (error.empty())
+			this->succeeded();
+		else
+			this->failed(error);
 	}
 
 public:
@@ -76,6 +83,10 @@ public:
 };
 
 
+/* downloads url in the calling thread, through the shared multi handle like
+ * the curl callbacks; false if there was no HTTP 200 */
+bool ccurl_fetch(const std::string &url, std::string &data);
+
 /* $curl exports begin */
 
 /* runs instance of $curl */
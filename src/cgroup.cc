@@ -0,0 +1,577 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "logging.h"
+#include "common.h"
+#include "cgroup.h"
+#include "text_object.h"
+#include "top.h"
+#include "update-cb.hh"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+	/* the rankings of top_cgroup, top_cgroup_mem and top_cgroup_io */
+	enum cgroup_rank { RANK_CPU, RANK_MEM, RANK_IO, RANK_COUNT };
+
+	/* the figures of one cgroup */
+	struct cgroup_stat {
+		/* the name of its directory */
+		std::string name;
+		/* percent of all the CPUs */
+		double cpu;
+		/* memory.current, bytes */
+		unsigned long long mem;
+		/* bytes per second, summed over the devices */
+		double io_read;
+		double io_write;
+
+		cgroup_stat()
+			: cpu(0), mem(0), io_read(0), io_write(0)
+		{}
+	};
+
+	/* what a cgroup_cb read in one run, never changed afterwards */
+	struct cgroup_sample {
+		/* whether the cgroup itself could be read */
+		bool valid;
+		cgroup_stat self;
+		/* memory.stat of the cgroup itself, only if asked for */
+		std::unordered_map<std::string, unsigned long long> memory_stat;
+		/* the direct children, only if asked for */
+		std::vector<cgroup_stat> children;
+		/* the highest ranking children, pointing into children, NULL past the last */
+		cgroup_stat *top[RANK_COUNT][MAX_SP];
+
+		cgroup_sample()
+			: valid(false)
+		{
+			for (int i = 0; i < RANK_COUNT; ++i)
+				std::fill(top[i], top[i] + MAX_SP, (cgroup_stat *) NULL);
+		}
+	};
+	typedef std::shared_ptr<const cgroup_sample> sample_ptr;
+
+	int read_fd(int fd, char *buf, size_t size)
+	{
+		if (fd < 0)
+			return -1;
+
+		ssize_t n = pread(fd, buf, size - 1, 0);
+		if (n < 0)
+			return -1;
+		buf[n] = '\0';
+		return n;
+	}
+
+	/*
+	 * The files of a cgroup, opened on the first read and kept open, cgroupfs gives
+	 * fresh figures on every read from the start. The counters of the last read are
+	 * kept for the rates. The files of controllers which aren't enabled for the
+	 * cgroup don't exist, their figures stay 0.
+	 */
+	class cgroup_files {
+		int cpu_fd, mem_fd, memstat_fd, io_fd;
+		bool opened;
+		unsigned long long usage_usec, rbytes, wbytes;
+		double read_at;
+
+		cgroup_files(const cgroup_files &) = delete;
+		cgroup_files& operator=(const cgroup_files &) = delete;
+
+	public:
+		cgroup_files()
+			: cpu_fd(-1), mem_fd(-1), memstat_fd(-1), io_fd(-1), opened(false),
+			  usage_usec(0), rbytes(0), wbytes(0), read_at(0)
+		{}
+
+		~cgroup_files()
+		{
+			int fds[] = { cpu_fd, mem_fd, memstat_fd, io_fd };
+
+			for (int i = 0; i < 4; ++i) {
+				if (fds[i] >= 0)
+					close(fds[i]);
+			}
+		}
+
+		/* false if the cgroup is gone, or was never there */
+		bool read(const std::string &dir, long ncpus, cgroup_stat &st,
+				std::unordered_map<std::string, unsigned long long> *memory_stat);
+	};
+
+	bool cgroup_files::read(const std::string &dir, long ncpus, cgroup_stat &st,
+			std::unordered_map<std::string, unsigned long long> *memory_stat)
+	{
+		char buf[8192];
+		const double now = get_time();
+		const double elapsed = read_at > 0 ? now - read_at : 0;
+		unsigned long long usage = 0, r = 0, w = 0;
+		char *pos;
+
+		if (!opened) {
+			cpu_fd = open((dir + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+			mem_fd = open((dir + "/memory.current").c_str(), O_RDONLY | O_CLOEXEC);
+			io_fd = open((dir + "/io.stat").c_str(), O_RDONLY | O_CLOEXEC);
+			opened = true;
+		}
+		if (memory_stat && memstat_fd < 0)
+			memstat_fd = open((dir + "/memory.stat").c_str(), O_RDONLY | O_CLOEXEC);
+
+		/* cpu.stat is there whatever the controllers */
+		if (read_fd(cpu_fd, buf, sizeof(buf)) < 0)
+			return false;
+		if ((pos = strstr(buf, "usage_usec ")))
+			sscanf(pos, "usage_usec %llu", &usage);
+
+		if (read_fd(mem_fd, buf, sizeof(buf)) > 0)
+			st.mem = strtoull(buf, NULL, 10);
+
+		/* 8:0 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0 */
+		if (read_fd(io_fd, buf, sizeof(buf)) > 0) {
+			for (char *line = buf, *next; line && *line; line = next) {
+				next = strchr(line, '\n');
+				if (next)
+					*next++ = '\0';
+				if ((pos = strstr(line, " rbytes=")))
+					r += strtoull(pos + 8, NULL, 10);
+				if ((pos = strstr(line, " wbytes=")))
+					w += strtoull(pos + 8, NULL, 10);
+			}
+		}
+
+		if (memory_stat && read_fd(memstat_fd, buf, sizeof(buf)) > 0) {
+			for (char *line = buf, *next; line && *line; line = next) {
+				char key[64];
+				unsigned long long val;
+
+				next = strchr(line, '\n');
+				if (next)
+					*next++ = '\0';
+				if (sscanf(line, "%63s %llu", key, &val) == 2)
+					(*memory_stat)[key] = val;
+			}
+		}
+
+		/* the counters only go backwards if the cgroup was made anew */
+		if (elapsed > 0) {
+			if (usage >= usage_usec)
+				st.cpu = 100.0 * (usage - usage_usec) / (elapsed * 1e6 * ncpus);
+			if (r >= rbytes)
+				st.io_read = (r - rbytes) / elapsed;
+			if (w >= wbytes)
+				st.io_write = (w - wbytes) / elapsed;
+		}
+		usage_usec = usage;
+		rbytes = r;
+		wbytes = w;
+		read_at = now;
+		return true;
+	}
+
+	int compare_cpu(cgroup_stat *a, cgroup_stat *b)
+	{
+		return (b->cpu > a->cpu) - (a->cpu > b->cpu);
+	}
+
+	int compare_mem(cgroup_stat *a, cgroup_stat *b)
+	{
+		return (b->mem > a->mem) - (a->mem > b->mem);
+	}
+
+	int compare_io(cgroup_stat *a, cgroup_stat *b)
+	{
+		double io_a = a->io_read + a->io_write, io_b = b->io_read + b->io_write;
+
+		return (io_b > io_a) - (io_a > io_b);
+	}
+
+	/*
+	 * Samples a cgroup once per update for all the objects showing it, and its direct
+	 * children too if a top_cgroup object ranks them. The objects say what they need
+	 * with want(), so memory.stat and the children are only read when shown.
+	 */
+	class cgroup_cb: public conky::callback<sample_ptr, std::string> {
+		typedef conky::callback<sample_ptr, std::string> Base;
+
+		long ncpus;
+		cgroup_files self;
+		std::map<std::string, std::unique_ptr<cgroup_files>> children;
+		std::atomic<unsigned int> wanted;
+
+		void read_children(cgroup_sample &sample);
+
+	protected:
+		virtual void work();
+
+	public:
+		enum { WANT_MEMORY_STAT = 1, WANT_CHILDREN = 2 };
+
+		cgroup_cb(uint32_t period, const std::string &dir)
+			: Base(period, true, Tuple(dir)), ncpus(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1l)),
+			  wanted(0)
+		{}
+
+		void want(unsigned int what)
+		{ wanted |= what; }
+	};
+
+	void cgroup_cb::read_children(cgroup_sample &sample)
+	{
+		const std::string &dir = get<0>();
+		std::set<std::string> seen;
+		DIR *d = opendir(dir.c_str());
+		struct dirent *ent;
+
+		if (!d)
+			return;
+		while ((ent = readdir(d))) {
+			if (ent->d_type != DT_DIR || ent->d_name[0] == '.')
+				continue;
+
+			std::unique_ptr<cgroup_files> &files = children[ent->d_name];
+			cgroup_stat st;
+
+			if (!files)
+				files.reset(new cgroup_files);
+			seen.insert(ent->d_name);
+			st.name = ent->d_name;
+			if (files->read(dir + '/' + ent->d_name, ncpus, st, NULL))
+				sample.children.push_back(st);
+		}
+		closedir(d);
+
+		for (auto i = children.begin(); i != children.end(); ) {
+			if (seen.count(i->first))
+				++i;
+			else
+				children.erase(i++);
+		}
+
+		/* one pass over the children for all the rankings, like for the processes */
+		struct top_list<cgroup_stat> lists[RANK_COUNT] = {
+			{ &compare_cpu, sample.top[RANK_CPU], 0, MAX_SP },
+			{ &compare_mem, sample.top[RANK_MEM], 0, MAX_SP },
+			{ &compare_io, sample.top[RANK_IO], 0, MAX_SP },
+		};
+		for (auto i = sample.children.begin(); i != sample.children.end(); ++i) {
+			for (int j = 0; j < RANK_COUNT; ++j)
+				top_list_insert(&lists[j], &*i);
+		}
+	}
+
+	void cgroup_cb::work()
+	{
+		const unsigned int w = wanted;
+		std::shared_ptr<cgroup_sample> sample(new cgroup_sample);
+
+		sample->valid = self.read(get<0>(), ncpus, sample->self,
+				w & WANT_MEMORY_STAT ? &sample->memory_stat : NULL);
+		if (w & WANT_CHILDREN)
+			read_children(*sample);
+
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result = sample;
+	}
+
+	/* where the cgroup2 hierarchy is mounted, in the unified or the hybrid layout */
+	const std::string &cgroup2_root()
+	{
+		static std::string root;
+
+		if (root.empty()) {
+			if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+				root = "/sys/fs/cgroup";
+			else if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) == 0)
+				root = "/sys/fs/cgroup/unified";
+			else {
+				NORM_ERR("cgroup: no cgroup2 hierarchy found below /sys/fs/cgroup");
+				root = "/sys/fs/cgroup";
+			}
+		}
+		return root;
+	}
+
+	/* the directory of a cgroup given by its path in the hierarchy */
+	std::string cgroup_dir(const char *path)
+	{
+		std::string dir = cgroup2_root();
+
+		while (*path == '/')
+			++path;
+		if (*path)
+			dir += '/' + std::string(path);
+		while (dir.size() > 1 && dir[dir.size() - 1] == '/')
+			dir.erase(dir.size() - 1);
+		return dir;
+	}
+
+	struct cgroup_obj {
+		std::string dir;
+		/* cgroup_mem_stat: the key in memory.stat */
+		std::string key;
+		/* top_cgroup: the ranking and the place in it, from 0 */
+		cgroup_rank rank;
+		int num;
+	};
+
+	sample_ptr get_sample(struct text_object *obj, unsigned int want)
+	{
+		struct cgroup_obj *cg = (struct cgroup_obj *) obj->data.opaque;
+
+		if (!cg)
+			return sample_ptr();
+
+		auto cb = conky::register_cb<cgroup_cb>(1, cg->dir);
+		cb->want(want);
+		sample_ptr sample = cb->get_result_copy();
+		return sample && sample->valid ? sample : sample_ptr();
+	}
+
+	/* the child a top_cgroup object shows, NULL if there is none, sample keeps it */
+	const cgroup_stat *get_ranked(struct text_object *obj, sample_ptr &sample)
+	{
+		struct cgroup_obj *cg = (struct cgroup_obj *) obj->data.opaque;
+
+		sample = get_sample(obj, cgroup_cb::WANT_CHILDREN);
+		return sample ? sample->top[cg->rank][cg->num] : NULL;
+	}
+
+	/* the memory.stat entries which count events rather than bytes */
+	bool is_memory_stat_counter(const std::string &key)
+	{
+		static const char *prefixes[] = { "pg", "workingset_", "thp_", "numa_" };
+
+		for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+			if (key.compare(0, strlen(prefixes[i]), prefixes[i]) == 0)
+				return true;
+		}
+		return false;
+	}
+}
+
+void parse_cgroup_args(struct text_object *obj, const char *arg)
+{
+	struct cgroup_obj *cg = new cgroup_obj;
+
+	cg->dir = cgroup_dir(arg ? arg : "/");
+	cg->rank = RANK_CPU;
+	cg->num = 0;
+	obj->data.opaque = cg;
+}
+
+void parse_cgroup_mem_stat_args(struct text_object *obj, const char *arg)
+{
+	char path[256], key[64];
+	struct cgroup_obj *cg;
+
+	if (sscanf(arg, "%255s %63s", path, key) != 2) {
+		NORM_ERR("cgroup_mem_stat needs a cgroup and a key, e.g. / anon");
+		return;
+	}
+	parse_cgroup_args(obj, path);
+	cg = (struct cgroup_obj *) obj->data.opaque;
+	cg->key = key;
+}
+
+uint8_t cgroup_cpu_percentage(struct text_object *obj)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	return sample ? round_to_int(std::min(sample->self.cpu, 100.0)) : 0;
+}
+
+void print_cgroup_mem(struct text_object *obj, char *p, int p_max_size)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	if (sample)
+		human_readable(sample->self.mem, p, p_max_size);
+}
+
+double cgroup_mem_value(struct text_object *obj)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	return sample ? (double) sample->self.mem : NAN;
+}
+
+void print_cgroup_mem_stat(struct text_object *obj, char *p, int p_max_size)
+{
+	struct cgroup_obj *cg = (struct cgroup_obj *) obj->data.opaque;
+	sample_ptr sample = get_sample(obj, cgroup_cb::WANT_MEMORY_STAT);
+
+	if (!sample)
+		return;
+
+	auto i = sample->memory_stat.find(cg->key);
+	if (i == sample->memory_stat.end())
+		return;
+	if (is_memory_stat_counter(cg->key))
+		snprintf(p, p_max_size, "%llu", i->second);
+	else
+		human_readable(i->second, p, p_max_size);
+}
+
+double cgroup_mem_stat_value(struct text_object *obj)
+{
+	struct cgroup_obj *cg = (struct cgroup_obj *) obj->data.opaque;
+	sample_ptr sample = get_sample(obj, cgroup_cb::WANT_MEMORY_STAT);
+
+	if (!sample)
+		return NAN;
+
+	auto i = sample->memory_stat.find(cg->key);
+	return i == sample->memory_stat.end() ? NAN : (double) i->second;
+}
+
+void print_cgroup_io_read(struct text_object *obj, char *p, int p_max_size)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	if (sample)
+		human_readable(sample->self.io_read, p, p_max_size);
+}
+
+double cgroup_io_read_value(struct text_object *obj)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	return sample ? sample->self.io_read : NAN;
+}
+
+void print_cgroup_io_write(struct text_object *obj, char *p, int p_max_size)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	if (sample)
+		human_readable(sample->self.io_write, p, p_max_size);
+}
+
+double cgroup_io_write_value(struct text_object *obj)
+{
+	sample_ptr sample = get_sample(obj, 0);
+
+	return sample ? sample->self.io_write : NAN;
+}
+
+void free_cgroup(struct text_object *obj)
+{
+	delete (struct cgroup_obj *) obj->data.opaque;
+	obj->data.opaque = NULL;
+}
+
+#define PRINT_TOP_CGROUP_GENERATOR(name, stmt) \
+static void print_top_cgroup_##name(struct text_object *obj, char *p, int p_max_size) \
+{ \
+	sample_ptr sample; \
+	const cgroup_stat *st = get_ranked(obj, sample); \
+	if (st) \
+		stmt; \
+}
+
+#define TOP_CGROUP_VALUE_GENERATOR(name, expr) \
+static double top_cgroup_##name##_value(struct text_object *obj) \
+{ \
+	sample_ptr sample; \
+	const cgroup_stat *st = get_ranked(obj, sample); \
+	return st ? (double) (expr) : NAN; \
+}
+
+PRINT_TOP_CGROUP_GENERATOR(name, snprintf(p, p_max_size, "%s", st->name.c_str()))
+PRINT_TOP_CGROUP_GENERATOR(cpu, snprintf(p, MIN(p_max_size, 7), "%6.2f", st->cpu))
+PRINT_TOP_CGROUP_GENERATOR(mem, human_readable(st->mem, p, p_max_size))
+PRINT_TOP_CGROUP_GENERATOR(io_read, human_readable(st->io_read, p, p_max_size))
+PRINT_TOP_CGROUP_GENERATOR(io_write, human_readable(st->io_write, p, p_max_size))
+
+TOP_CGROUP_VALUE_GENERATOR(cpu, st->cpu)
+TOP_CGROUP_VALUE_GENERATOR(mem, st->mem)
+TOP_CGROUP_VALUE_GENERATOR(io_read, st->io_read)
+TOP_CGROUP_VALUE_GENERATOR(io_write, st->io_write)
+
+int parse_top_cgroup_args(struct text_object *obj, const char *s, const char *arg)
+{
+	struct cgroup_obj *cg;
+	char field[64], path[256] = "/";
+	cgroup_rank rank;
+	int n;
+
+	if (strcmp(s, "top_cgroup") == EQUAL) {
+		rank = RANK_CPU;
+	} else if (strcmp(s, "top_cgroup_mem") == EQUAL) {
+		rank = RANK_MEM;
+	} else if (strcmp(s, "top_cgroup_io") == EQUAL) {
+		rank = RANK_IO;
+	} else {
+		NORM_ERR("Must be top_cgroup, top_cgroup_mem or top_cgroup_io");
+		return 0;
+	}
+
+	if (!arg || sscanf(arg, "%63s %i %255s", field, &n, path) < 2) {
+		NORM_ERR("%s needs a field and a number, and optionally a cgroup", s);
+		return 0;
+	}
+	if (n < 1 || n > MAX_SP) {
+		NORM_ERR("invalid num arg for %s. Must be between 1 and %d.", s, MAX_SP);
+		return 0;
+	}
+
+	if (strcmp(field, "name") == EQUAL) {
+		obj->callbacks.print = &print_top_cgroup_name;
+	} else if (strcmp(field, "cpu") == EQUAL) {
+		obj->callbacks.print = &print_top_cgroup_cpu;
+		obj->callbacks.value = &top_cgroup_cpu_value;
+	} else if (strcmp(field, "mem") == EQUAL) {
+		obj->callbacks.print = &print_top_cgroup_mem;
+		obj->callbacks.value = &top_cgroup_mem_value;
+	} else if (strcmp(field, "io_read") == EQUAL) {
+		obj->callbacks.print = &print_top_cgroup_io_read;
+		obj->callbacks.value = &top_cgroup_io_read_value;
+	} else if (strcmp(field, "io_write") == EQUAL) {
+		obj->callbacks.print = &print_top_cgroup_io_write;
+		obj->callbacks.value = &top_cgroup_io_write_value;
+	} else {
+		NORM_ERR("invalid type arg for %s", s);
+		NORM_ERR("must be one of: name, cpu, mem, io_read, io_write");
+		return 0;
+	}
+
+	parse_cgroup_args(obj, path);
+	cg = (struct cgroup_obj *) obj->data.opaque;
+	cg->rank = rank;
+	cg->num = n - 1;
+	obj->callbacks.free = &free_cgroup;
+	return 1;
+}
@@ -0,0 +1,53 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+#include <stdint.h>
+
+struct text_object;
+
+/* the cgroup_* objects, showing a cgroup v2 given by its path below the
+ * cgroup2 mount, e.g. /system.slice/docker.service */
+void parse_cgroup_args(struct text_object *, const char *arg);
+/* cgroup_mem_stat, a cgroup and a key of its memory.stat */
+void parse_cgroup_mem_stat_args(struct text_object *, const char *arg);
+
+uint8_t cgroup_cpu_percentage(struct text_object *);
+void print_cgroup_mem(struct text_object *, char *, int);
+double cgroup_mem_value(struct text_object *);
+void print_cgroup_mem_stat(struct text_object *, char *, int);
+double cgroup_mem_stat_value(struct text_object *);
+void print_cgroup_io_read(struct text_object *, char *, int);
+double cgroup_io_read_value(struct text_object *);
+void print_cgroup_io_write(struct text_object *, char *, int);
+double cgroup_io_write_value(struct text_object *);
+void free_cgroup(struct text_object *);
+
+/* top_cgroup, ranking the children of a cgroup like top ranks processes */
+int parse_top_cgroup_args(struct text_object *, const char *name, const char *arg);
+
+#endif /* _CGROUP_H */
@@ -28,11 +28,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <cmath>
 #include <mutex>
+#include <string>
+#include <vector>
 #include <math.h>
 
-#include "update-cb.hh"
+#include "player-cb.hh"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 namespace {
 	struct cmus_result {
@@ -51,27 +62,171 @@ namespace {
 		std::string date;
 		float progress;
 		float timeleft;
+		conky::playback_clock clock;
+
+		cmus_result()
+			: progress(0), timeleft(0)
+		{}
 	};
 
-	class cmus_cb: public conky::callback<cmus_result> {
-		typedef conky::callback<cmus_result> Base;
+	/* Asks cmus for its status over its control socket, the way cmus-remote -Q
+	 * does, without starting a cmus-remote each time. The connection is kept
+	 * and cmus-remote is only used when the socket can't be found. */
+	class cmus_cb: public conky::player_callback<cmus_result> {
+		typedef conky::player_callback<cmus_result> Base;
+
+		int sock;
+
+		bool connect_socket();
+		bool query(std::string &answer);
 
 	protected:
-		virtual void work();
+		virtual void refresh();
 
 	public:
 		cmus_cb(uint32_t period)
-			: Base(period, false, Tuple())
+			: Base(period), sock(-1)
 		{}
+
+		~cmus_cb()
+		{
+			if (sock != -1)
+				close(sock);
+		}
 	};
 
-	void cmus_cb::work()
+	/* the places cmus puts its socket in, depending on its version */
+	bool cmus_cb::connect_socket()
+	{
+		std::vector<std::string> paths;
+		const char *env;
+
+		if ((env = getenv("CMUS_SOCKET")))
+			paths.push_back(env);
+		if ((env = getenv("XDG_RUNTIME_DIR")))
+			paths.push_back(std::string(env) + "/cmus-socket");
+		if ((env = getenv("XDG_CONFIG_HOME")))
+			paths.push_back(std::string(env) + "/cmus/socket");
+		if ((env = getenv("HOME"))) {
+			paths.push_back(std::string(env) + "/.config/cmus/socket");
+			paths.push_back(std::string(env) + "/.cmus/socket");
+		}
+
+		for (auto i = paths.begin(); i != paths.end(); ++i) {
+			struct sockaddr_un addr;
+
+			if (i->size() >= sizeof(addr.sun_path))
+				continue;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			strcpy(addr.sun_path, i->c_str());
+
+			sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (sock == -1)
+				return false;
+			if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+				return true;
+			close(sock);
+			sock = -1;
+		}
+		return false;
+	}
+
+	/* the answer to a command ends with an empty line */
+	bool cmus_cb::query(std::string &answer)
+	{
+		static const char command[] = "status\n";
+		char buf[4096];
+		ssize_t len;
+
+		if (sock == -1 && !connect_socket())
+			return false;
+
+		if (send(sock, command, sizeof(command) - 1, MSG_NOSIGNAL) != sizeof(command) - 1)
+			goto fail;
+
+		while (answer.size() < 2 || answer.compare(answer.size() - 2, 2, "\n\n") != 0) {
+			struct pollfd pfd = { sock, POLLIN, 0 };
+
+			if (poll(&pfd, 1, 1000) <= 0)
+				goto fail;
+			len = recv(sock, buf, sizeof(buf), 0);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len <= 0)
+				goto fail;
+			answer.append(buf, len);
+		}
+		return true;
+
+	fail:
+		/* cmus went away (or never answered), look for it again next time */
+		close(sock);
+		sock = -1;
+		answer.clear();
+		return false;
+	}
+
+	void parse_line(cmus_result &cmus, char *line)
+	{
+		if (strncmp(line, "status ", 7) == 0)
+		    cmus.state = line + 7;
+
+		else if (strncmp(line, "file ", 5) == 0)
+		    cmus.file = line + 5;
+
+		else if (strncmp(line, "tag artist ", 11) == 0)
+		    cmus.artist = line + 11;
+
+		else if (strncmp(line, "tag title ", 10) == 0)
+		    cmus.title = line + 10;
+
+		else if (strncmp(line, "tag album ", 10) == 0)
+		    cmus.album = line + 10;
+
+		else if (strncmp(line, "duration ", 9) == 0)
+		    cmus.totaltime = line + 9;
+
+		else if (strncmp(line, "position ", 9) == 0)
+		    cmus.curtime = line + 9;
+
+		else if (strncmp(line, "set shuffle ", 12) == 0)
+			cmus.random = (strncmp(line+12, "true", 4) == 0 ?
+			    "on" : "off" );
+
+		else if (strncmp(line, "set repeat ", 11) == 0)
+			cmus.repeat = (strncmp((line+11), "true", 4) == 0 ?
+			    "all" : "off" );
+
+		else if (strncmp(line, "set repeat_current ", 19) == 0)
+			cmus.repeat = (strncmp((line + 19), "true", 4) == 0 ?
+			    "song" : cmus.repeat );
+		else if (strncmp(line, "set aaa_mode ", 13) == 0)
+			cmus.aaa = line + 13;
+
+		else if (strncmp(line, "tag tracknumber ", 16) == 0)
+			cmus.track = line + 16;
+		else if (strncmp(line, "tag genre ", 10) == 0)
+			cmus.genre = line + 10;
+		else if (strncmp(line, "tag date ", 9) == 0)
+			cmus.date = line + 9;
+	}
+
+	void cmus_cb::refresh()
 	{
 		cmus_result cmus;
+		std::string answer;
 		FILE *fp;
 
-		fp = popen("cmus-remote -Q 2>/dev/null", "r");
-		if (!fp) {
+		if (query(answer)) {
+			char *line = &answer[0], *p;
+
+			while ((p = strchr(line, '\n'))) {
+				*p = '\0';
+				parse_line(cmus, line);
+				line = p + 1;
+			}
+		} else if (!(fp = popen("cmus-remote -Q 2>/dev/null", "r"))) {
 			cmus.state = "Can't run 'cmus-remote -Q'";
 		} else {
 			while (1) {
@@ -84,73 +239,43 @@ namespace {
 				if ((p = strrchr(line, '\n')))
 					*p = '\0';
 
-				/* Parse infos. */
-				if (strncmp(line, "status ", 7) == 0)
-				    cmus.state = line + 7;
-
-				else if (strncmp(line, "file ", 5) == 0)
-				    cmus.file = line + 5;
-
-				else if (strncmp(line, "tag artist ", 11) == 0)
-				    cmus.artist = line + 11;
-
-				else if (strncmp(line, "tag title ", 10) == 0)
-				    cmus.title = line + 10;
-
-				else if (strncmp(line, "tag album ", 10) == 0)
-				    cmus.album = line + 10;
-
-				else if (strncmp(line, "duration ", 9) == 0)
-				    cmus.totaltime = line + 9;
-
-				else if (strncmp(line, "position ", 9) == 0)
-				{
-				    cmus.curtime = line + 9;
-				    cmus.timeleft = atoi(cmus.totaltime.c_str()) - atoi(cmus.curtime.c_str());
-				    if (cmus.curtime.size() > 0)
-					cmus.progress = (float) atoi(cmus.curtime.c_str()) / atoi(cmus.totaltime.c_str());
-				    else
-					cmus.progress = 0;
-				}
-
-				else if (strncmp(line, "set shuffle ", 12) == 0)
-					cmus.random = (strncmp(line+12, "true", 4) == 0 ?
-					    "on" : "off" );
-
-				else if (strncmp(line, "set repeat ", 11) == 0)
-					cmus.repeat = (strncmp((line+11), "true", 4) == 0 ?
-					    "all" : "off" );
-
-				else if (strncmp(line, "set repeat_current ", 19) == 0)
-					cmus.repeat = (strncmp((line + 19), "true", 4) == 0 ?
-					    "song" : cmus.repeat );
-				else if (strncmp(line, "set aaa_mode ", 13) == 0)
-					cmus.aaa = line + 13;
-
-				else if (strncmp(line, "tag tracknumber ", 16) == 0)
-					cmus.track = line + 16;
-				else if (strncmp(line, "tag genre ", 10) == 0)
-					cmus.genre = line + 10;
-				else if (strncmp(line, "tag date ", 9) == 0)
-					cmus.date = line + 9;
+				parse_line(cmus, line);
 			}
+			pclose(fp);
 		}
 
-		pclose(fp);
+		/* the position moves on by itself until the next refresh */
+		if (cmus.curtime.size() > 0)
+			cmus.clock.set(atoi(cmus.curtime.c_str()), cmus.state == "playing");
 
 		std::lock_guard<std::mutex> l(result_mutex);
 		result = cmus;
 	}
+
+	cmus_result get_cmus()
+	{
+		uint32_t period = std::max(
+				lround(music_player_interval.get(*state)/active_update_interval()), 1l
+			);
+		cmus_result cmus = conky::register_cb<cmus_cb>(period)->get_result_copy();
+
+		if (cmus.curtime.size() > 0) {
+			int total = atoi(cmus.totaltime.c_str());
+			int cur = cmus.clock.get(total);
+
+			cmus.curtime = std::to_string(cur);
+			cmus.timeleft = total - cur;
+			cmus.progress = total > 0 ? (float) cur / total : 0;
+		}
+		return cmus;
+	}
 }
 
 #define CMUS_PRINT_GENERATOR(type, alt) \
 void print_cmus_##type(struct text_object *obj, char *p, int p_max_size) \
 { \
 	(void)obj; \
-	uint32_t period = std::max( \
-				lround(music_player_interval.get(*state)/active_update_interval()), 1l \
-			); \
-	const cmus_result &cmus = conky::register_cb<cmus_cb>(period)->get_result_copy(); \
+	const cmus_result &cmus = get_cmus(); \
 	snprintf(p, p_max_size, "%s", (cmus.type.length() ? cmus.type.c_str() : alt)); \
 }
 
@@ -169,36 +294,28 @@ CMUS_PRINT_GENERATOR(date, "")
 uint8_t cmus_percent(struct text_object *obj)
 {
 	(void)obj;
-	uint32_t period = std::max(
-	    lround(music_player_interval.get(*state)/active_update_interval()), 1l);
-	const cmus_result &cmus = conky::register_cb<cmus_cb>(period)->get_result_copy();
+	const cmus_result &cmus = get_cmus();
 	return (uint8_t) round(cmus.progress * 100.0f);
 }
 
 double cmus_progress(struct text_object *obj)
 {
 	(void)obj;
-	uint32_t period = std::max(
-	    lround(music_player_interval.get(*state)/active_update_interval()), 1l);
-	const cmus_result &cmus = conky::register_cb<cmus_cb>(period)->get_result_copy();
+	const cmus_result &cmus = get_cmus();
 	return (double) cmus.progress;
 }
 
 void print_cmus_totaltime(struct text_object *obj, char *p, int p_max_size)
 {
 	(void)obj;
-	uint32_t period = std::max(
-	    lround(music_player_interval.get(*state)/active_update_interval()), 1l);
-	const cmus_result &cmus = conky::register_cb<cmus_cb>(period)->get_result_copy();
+	const cmus_result &cmus = get_cmus();
 	format_seconds_short(p, p_max_size, atol(cmus.totaltime.c_str()));
 }
 
 void print_cmus_timeleft(struct text_object *obj, char *p, int p_max_size)
 {
 	(void)obj;
-	uint32_t period = std::max(
-	    lround(music_player_interval.get(*state)/active_update_interval()), 1l);
-	const cmus_result &cmus = conky::register_cb<cmus_cb>(period)->get_result_copy();
+	const cmus_result &cmus = get_cmus();
 	//format_seconds_short(p, p_max_size, atol(cmus.timeleft.c_str()));
 	format_seconds_short(p, p_max_size, (long)cmus.timeleft);
 }
@@ -206,9 +323,7 @@ void print_cmus_timeleft(struct text_object *obj, char *p, int p_max_size)
 void print_cmus_curtime(struct text_object *obj, char *p, int p_max_size)
 {
 	(void)obj;
-	uint32_t period = std::max(
-	    lround(music_player_interval.get(*state)/active_update_interval()), 1l);
-	const cmus_result &cmus = conky::register_cb<cmus_cb>(period)->get_result_copy();
+	const cmus_result &cmus = get_cmus();
 	format_seconds_short(p, p_max_size, atol(cmus.curtime.c_str()));
 }
 
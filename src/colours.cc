@@ -29,6 +29,9 @@
  */
 #include "conky.h"
 #include "logging.h"
+#include <algorithm>
+#include <list>
+#include <vector>
 #ifdef BUILD_X11
 #include "x11.h"
 #endif
@@ -90,77 +93,88 @@ unsigned int adjust_colours(unsigned int colour)
 	return colour;
 }
 
-/* this function returns the next colour between two colours for a gradient */
-unsigned long *do_gradient(int width, unsigned long first_colour, unsigned long last_colour)
-{
-	int red1, green1, blue1;				// first colour
-	int red2, green2, blue2;				// last colour
-	int reddiff, greendiff, bluediff;		// difference
-	short redshift = (2 * colour_depth / 3 + colour_depth % 3);
-	short greenshift = (colour_depth / 3);
-	unsigned long *colours = (unsigned long*)malloc(width * sizeof(unsigned long));
-	int i;
+namespace {
+	/* gradients kept around, graphs usually draw the same few every frame */
+	const size_t gradient_cache_size = 32;
+
+	struct gradient {
+		int width;
+		unsigned long first_colour, last_colour;
+		std::vector<unsigned long> colours;
+	};
+
+	/* most recently used first */
+	std::list<gradient> gradients;
+
+	void compute_gradient(gradient &g)
+	{
+		short redshift = (2 * colour_depth / 3 + colour_depth % 3);
+		short greenshift = (colour_depth / 3);
+		int red1 = (g.first_colour & redmask) >> redshift;
+		int green1 = (g.first_colour & greenmask) >> greenshift;
+		int blue1 = g.first_colour & bluemask;
+		int red2 = (g.last_colour & redmask) >> redshift;
+		int green2 = (g.last_colour & greenmask) >> greenshift;
+		int blue2 = g.last_colour & bluemask;
+		/* the sign of each step and its size */
+		int redsign = red1 < red2 ? 1 : -1;
+		int greensign = green1 < green2 ? 1 : -1;
+		int bluesign = blue1 < blue2 ? 1 : -1;
+		int reddiff = abs(red1 - red2);
+		int greendiff = abs(green1 - green2);
+		int bluediff = abs(blue1 - blue2);
+		int max = bluemask;
+		int last = std::max(g.width - 1, 1);
+		unsigned long *colours = &g.colours[0];
 
+		/* no branches in here, so the compiler can vectorise it */
+		for (int i = 0; i < g.width; i++) {
+			float factor = (float) i / last;
+			/* the '+ 0.5' bit rounds our floats to ints properly */
+			int red3 = red1 + redsign * (int) (factor * reddiff + 0.5);
+			int green3 = green1 + greensign * (int) (factor * greendiff + 0.5);
+			int blue3 = blue1 + bluesign * (int) (factor * bluediff + 0.5);
+
+			red3 = std::min(std::max(red3, 0), max);
+			green3 = std::min(std::max(green3, 0), max);
+			blue3 = std::min(std::max(blue3, 0), max);
+			colours[i] = ((unsigned long) red3 << redshift)
+				| ((unsigned long) green3 << greenshift) | blue3;
+		}
+	}
+}
+
+/* this function returns the colours between two colours for a gradient, the
+ * table belongs to the cache and stays valid until the next call */
+const unsigned long *do_gradient(int width, unsigned long first_colour, unsigned long last_colour)
+{
+	if (width <= 0) {
+		return NULL;
+	}
 	if (colour_depth == 0) {
 		set_up_gradient();
 	}
-	red1 = (first_colour & redmask) >> redshift;
-	green1 = (first_colour & greenmask) >> greenshift;
-	blue1 = first_colour & bluemask;
-	red2 = (last_colour & redmask) >> redshift;
-	green2 = (last_colour & greenmask) >> greenshift;
-	blue2 = last_colour & bluemask;
-	reddiff = abs(red1 - red2);
-	greendiff = abs(green1 - green2);
-	bluediff = abs(blue1 - blue2);
-#ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(dynamic,10) shared(colours)
-#endif /* HAVE_OPENMP */
-	for (i = 0; i < width; i++) {
-		int red3 = 0, green3 = 0, blue3 = 0;	// colour components
-
-		float factor = ((float) i / (width - 1));
-
-		/* the '+ 0.5' bit rounds our floats to ints properly */
-		if (red1 >= red2) {
-			red3 = -(factor * reddiff) - 0.5;
-		} else if (red1 < red2) {
-			red3 = factor * reddiff + 0.5;
-		}
-		if (green1 >= green2) {
-			green3 = -(factor * greendiff) - 0.5;
-		} else if (green1 < green2) {
-			green3 = factor * greendiff + 0.5;
-		}
-		if (blue1 >= blue2) {
-			blue3 = -(factor * bluediff) - 0.5;
-		} else if (blue1 < blue2) {
-			blue3 = factor * bluediff + 0.5;
-		}
-		red3 += red1;
-		green3 += green1;
-		blue3 += blue1;
-		if (red3 < 0) {
-			red3 = 0;
-		}
-		if (green3 < 0) {
-			green3 = 0;
-		}
-		if (blue3 < 0) {
-			blue3 = 0;
+	for (auto it = gradients.begin(); it != gradients.end(); ++it) {
+		if (it->width == width && it->first_colour == first_colour
+				&& it->last_colour == last_colour) {
+			gradients.splice(gradients.begin(), gradients, it);
+			return &it->colours[0];
 		}
-		if (red3 > bluemask) {
-			red3 = bluemask;
-		}
-		if (green3 > bluemask) {
-			green3 = bluemask;
-		}
-		if (blue3 > bluemask) {
-			blue3 = bluemask;
-		}
-		colours[i] = (red3 << redshift) | (green3 << greenshift) | blue3;
 	}
-	return colours;
+
+	if (gradients.size() >= gradient_cache_size) {
+		/* reuse the least recently used table */
+		gradients.splice(gradients.begin(), gradients, --gradients.end());
+	} else {
+		gradients.push_front(gradient());
+	}
+	gradient &g = gradients.front();
+	g.width = width;
+	g.first_colour = first_colour;
+	g.last_colour = last_colour;
+	g.colours.resize(width);
+	compute_gradient(g);
+	return &g.colours[0];
 }
 
 #ifdef BUILD_X11
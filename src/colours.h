@@ -31,7 +31,7 @@
 #define _COLOURS_H
 
 unsigned int adjust_colours(unsigned int);
-unsigned long *do_gradient(int, unsigned long, unsigned long);
+const unsigned long *do_gradient(int, unsigned long, unsigned long);
 
 long get_x11_color(const std::string &colour);
 // XXX: when everyone uses C++ strings, remove this C version
@@ -28,16 +28,26 @@
  *
  */
 
+#include <algorithm>
 #include <vector>
 
 #include "core.h"
 #include "logging.h"
 #include "text_object.h"
 
+struct combine_row {
+	size_t start;
+	size_t len;
+};
+
+/* buf and rows are kept between updates, so that combining does not
+ * allocate once they have grown to the size the halves need */
 struct combine_data {
 	char *left;
 	char *seperation;
 	char *right;
+	std::vector<char> buf[2];
+	std::vector<combine_row> rows[2];
 };
 
 void parse_combine_arg(struct text_object *obj, const char *arg)
@@ -67,8 +77,7 @@ void parse_combine_arg(struct text_object *obj, const char *arg)
 		}
 	}
 	if(startvar[0] >= 0 && endvar[0] >= 0 && startvar[1] >= 0 && endvar[1] >= 0) {
-		cd = (struct combine_data*)malloc(sizeof(struct combine_data));
-		memset(cd, 0, sizeof(struct combine_data));
+		cd = new combine_data;
 
 		cd->left = (char*)malloc(endvar[0]-startvar[0] + 1);
 		cd->seperation = (char*)malloc(startvar[1] - endvar[0] + 1);
@@ -83,9 +92,9 @@ void parse_combine_arg(struct text_object *obj, const char *arg)
 		strncpy(cd->right, arg + startvar[1], endvar[1] - startvar[1]);
 		cd->right[endvar[1] - startvar[1]] = 0;
 
-		obj->sub = (struct text_object*)malloc(sizeof(struct text_object));
+		obj->sub = new_text_object();
 		extract_variable_text_internal(obj->sub, cd->left);
-		obj->sub->sub = (struct text_object*)malloc(sizeof(struct text_object));
+		obj->sub->sub = new_text_object();
 		extract_variable_text_internal(obj->sub->sub, cd->right);
 		obj->data.opaque = cd;
 	} else {
@@ -93,83 +102,70 @@ void parse_combine_arg(struct text_object *obj, const char *arg)
 	}
 }
 
+/* appends len bytes of s to p, keeping room for the terminating 0 */
+static inline void combine_append(char *p, int p_max_size, size_t &pos,
+		const char *s, size_t len)
+{
+	if (pos + len >= (size_t) p_max_size)
+		len = p_max_size - 1 - pos;
+	memcpy(p + pos, s, len);
+	pos += len;
+}
+
 void print_combine(struct text_object *obj, char *p, int p_max_size)
 {
 	struct combine_data *cd = (struct combine_data *)obj->data.opaque;
-	std::vector<std::vector<char>> buf;
-	buf.resize(2);
-	buf[0].resize(max_user_text.get(*state));
-	buf[1].resize(max_user_text.get(*state));
-	int i, j;
-	long longest=0;
-	int nextstart;
-	int nr_rows[2];
-	struct llrows {
-		char* row;
-		struct llrows* next;
-	};
-	struct llrows *ll_rows[2], *current[2];
+	size_t i, j, nextstart, longest = 0, nr_rows, pos = 0;
+	size_t seplen;
 	struct text_object * objsub = obj->sub;
 
 	if (!cd || !p_max_size)
 		return;
 
-	p[0]=0;
+	seplen = strlen(cd->seperation);
 	for(i=0; i<2; i++) {
-		nr_rows[i] = 1;
+		std::vector<char> &buf = cd->buf[i];
+		std::vector<combine_row> &rows = cd->rows[i];
+
+		if (buf.size() < (size_t) max_user_text.get(*state))
+			buf.resize(max_user_text.get(*state));
+		rows.clear();
 		nextstart = 0;
-		ll_rows[i] = (struct llrows*)malloc(sizeof(struct llrows));
-		current[i] = ll_rows[i];
-		for(j=0; j<i; j++) objsub = objsub->sub;
-		generate_text_internal(&(buf[i][0]), max_user_text.get(*state), *objsub);
-		for(j=0; buf[i][j] != 0; j++) {
-			if(buf[i][j] == '\t') buf[i][j] = ' ';
-			if(buf[i][j] == '\n') buf[i][j] = 0;	//the vars inside combine may not have a \n at the end
-			if(buf[i][j] == 2) {	// \002 is used instead of \n to separate lines inside a var
-				buf[i][j] = 0;
-				current[i]->row = strdup(&(buf[i][0])+nextstart);
-				if(i==0 && (long)strlen(current[i]->row) > longest) longest = (long)strlen(current[i]->row);
-				current[i]->next = (struct llrows*)malloc(sizeof(struct llrows));
-				current[i] = current[i]->next;
+		if (i) objsub = objsub->sub;
+		generate_text_internal(&(buf[0]), buf.size(), *objsub);
+		for(j=0; ; j++) {
+			if(buf[j] == '\t') buf[j] = ' ';
+			//the vars inside combine may not have a \n at the end,
+			//\002 is used instead of \n to separate lines inside a var
+			if(buf[j] == 0 || buf[j] == '\n' || buf[j] == 2) {
+				rows.push_back({nextstart, j - nextstart});
+				if(i==0 && j - nextstart > longest) longest = j - nextstart;
 				nextstart = j + 1;
-				nr_rows[i]++;
+				if(buf[j] != 2) break;
 			}
 		}
-		current[i]->row = strdup(&(buf[i][0])+nextstart);
-		if(i==0 && (long)strlen(current[i]->row) > longest) longest = (long)strlen(current[i]->row);
-		current[i]->next = NULL;
-		current[i] = ll_rows[i];
 	}
-	for(j=0; j < (nr_rows[0] > nr_rows[1] ? nr_rows[0] : nr_rows[1] ); j++) {
-		if(current[0]) {
-			strcat(p, current[0]->row);
-			i=strlen(current[0]->row);
-		}else i = 0;
-		while(i < longest) {
-			strcat(p, " ");
-			i++;
-		}
-		if(current[1]) {
-			strcat(p, cd->seperation);
-			strcat(p, current[1]->row);
+	nr_rows = std::max(cd->rows[0].size(), cd->rows[1].size());
+	for(j=0; j < nr_rows; j++) {
+		size_t len = 0;
+
+		if(j < cd->rows[0].size()) {
+			const combine_row &row = cd->rows[0][j];
+
+			combine_append(p, p_max_size, pos, &(cd->buf[0][row.start]), row.len);
+			len = row.len;
 		}
-		strcat(p, "\n");
-#ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(dynamic,10)
-#endif /* HAVE_OPENMP */
-		for(i=0; i<2; i++) if(current[i]) current[i]=current[i]->next;
-	}
-#ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(dynamic,10)
-#endif /* HAVE_OPENMP */
-	for(i=0; i<2; i++) {
-		while(ll_rows[i] != NULL) {
-			current[i]=ll_rows[i];
-			free(current[i]->row);
-			ll_rows[i]=current[i]->next;
-			free(current[i]);
+		for(; len < longest && pos + 1 < (size_t) p_max_size; len++)
+			p[pos++] = ' ';
+		if(j < cd->rows[1].size()) {
+			const combine_row &row = cd->rows[1][j];
+
+			combine_append(p, p_max_size, pos, cd->seperation, seplen);
+			combine_append(p, p_max_size, pos, &(cd->buf[1][row.start]), row.len);
 		}
+		combine_append(p, p_max_size, pos, "\n", 1);
 	}
+	p[pos] = 0;
 }
 
 void free_combine(struct text_object *obj)
@@ -182,8 +178,11 @@ void free_combine(struct text_object *obj)
 	free(cd->seperation);
 	free(cd->right);
 	free_text_objects(obj->sub->sub);
-	free_and_zero(obj->sub->sub);
+	delete_text_object(obj->sub->sub);
+	obj->sub->sub = NULL;
 	free_text_objects(obj->sub);
-	free_and_zero(obj->sub);
-	free_and_zero(obj->data.opaque);
+	delete_text_object(obj->sub);
+	obj->sub = NULL;
+	delete cd;
+	obj->data.opaque = NULL;
 }
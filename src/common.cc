@@ -30,10 +30,16 @@
 
 #include "config.h"
 #include "conky.h"
+#include "alerts.h"
 #include "core.h"
+#include "data-source.hh"
 #include "fs.h"
 #include "logging.h"
 #include "net_stat.h"
+#ifdef BUILD_IO_URING
+#include "proc_batch.h"
+#endif /* BUILD_IO_URING */
+#include "samples.h"
 #include "specials.h"
 #include "temphelper.h"
 #include "timeinfo.h"
@@ -49,6 +55,8 @@
 #include <semaphore.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <unordered_map>
 #include <vector>
 
 /* check for OS and include appropriate headers */
@@ -179,6 +187,119 @@ FILE *open_file(const char *file, int *reported)
 	return fp;
 }
 
+std::string procfs_root = "/proc";
+
+std::string procfs_path(const std::string &path)
+{
+	if (path.compare(0, 5, "/proc") == 0 && (path.size() == 5 || path[5] == '/'))
+		return procfs_root + path.substr(5);
+	return path;
+}
+
+proc_file::~proc_file()
+{
+#ifdef BUILD_IO_URING
+	if (batched)
+		proc_batch_remove(this);
+#endif /* BUILD_IO_URING */
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	free(pbuf);
+}
+
+bool proc_file::read()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	ssize_t n;
+	bool complete;
+
+	if (replaying_samples) {
+		std::string sample;
+
+		len = 0;
+		if (!replay_sample(path.c_str(), &sample)) {
+			if (buf)
+				buf[0] = 0;
+			return false;
+		}
+		if (size < sample.size() + 1) {
+			size = sample.size() + 1;
+			buf = (char *) realloc(buf, size);
+		}
+		len = sample.size();
+		memcpy(buf, sample.data(), len);
+		buf[len] = 0;
+		return true;
+	}
+
+	if (fd < 0) {
+		fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			if (!reported) {
+				NORM_ERR("can't open %s: %s", path.c_str(), strerror(errno));
+				reported = 1;
+			}
+			return false;
+		}
+#ifdef BUILD_IO_URING
+		if (batched)
+			proc_batch_add(this);
+#endif /* BUILD_IO_URING */
+	}
+
+	if (!buf) {
+		size = 4096;
+		buf = (char *) malloc(size);
+	}
+
+	/* procfs hands out everything there is if the buffer is big enough, so a
+	 * short read means we got it all */
+	complete = false;
+	len = 0;
+#ifdef BUILD_IO_URING
+	wanted = true;
+	/* a read-ahead that filled the buffer may have been cut short, the file
+	 * is read again below then */
+	if (prefetch_gen != 0 && prefetch_gen == proc_batch_generation() &&
+			prefetch_res >= 0 && (size_t) prefetch_res + 1 < psize) {
+		std::swap(buf, pbuf);
+		std::swap(size, psize);
+		len = prefetch_res;
+		complete = true;
+	}
+	prefetch_gen = 0;
+#endif /* BUILD_IO_URING */
+	while (!complete) {
+		n = pread(fd, buf + len, size - len - 1, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!reported) {
+				NORM_ERR("can't read %s: %s", path.c_str(), strerror(errno));
+				reported = 1;
+			}
+			close(fd);
+			fd = -1;
+			len = 0;
+			buf[0] = 0;
+			return false;
+		}
+		len += n;
+		if (len + 1 < size) {
+			complete = true;
+		} else {
+			size *= 2;
+			buf = (char *) realloc(buf, size);
+		}
+	}
+	buf[len] = 0;
+	reported = 0;
+	if (recording_samples)
+		record_sample(path.c_str(), buf, len);
+	return true;
+}
+
 std::string variable_substitute(std::string s)
 {
 	std::string::size_type pos = 0;
@@ -274,7 +395,7 @@ void format_seconds_short(char *buf, unsigned int n, long seconds)
 
 conky::simple_config_setting<bool> no_buffers("no_buffers", true, true);
 
-void update_stuff(void)
+static void begin_update(void)
 {
 	int i;
 
@@ -284,27 +405,124 @@ void update_stuff(void)
 	#ifdef HAVE_OPENMP
 	#pragma omp parallel for schedule(dynamic,10)
 	#endif /* HAVE_OPENMP */
-	for (i = 0; i < MAX_NET_INTERFACES; i++) {
-		if (netstats[i].dev) {
-			netstats[i].up = 0;
-			netstats[i].recv_speed = 0.0;
-			netstats[i].trans_speed = 0.0;
-			netstats[i].addr.sa_data[2] = 0;
-			netstats[i].addr.sa_data[3] = 0;
-			netstats[i].addr.sa_data[4] = 0;
-			netstats[i].addr.sa_data[5] = 0;
-		}
+	for (i = 0; i < (int) netstats.size(); i++) {
+		netstats[i]->up = 0;
+		netstats[i]->recv_speed = 0.0;
+		netstats[i]->trans_speed = 0.0;
+		netstats[i]->addr.sa_data[2] = 0;
+		netstats[i]->addr.sa_data[3] = 0;
+		netstats[i]->addr.sa_data[4] = 0;
+		netstats[i]->addr.sa_data[5] = 0;
 	}
 
 	prepare_update();
+}
 
-	conky::run_all_callbacks();
-
+static void end_update(void)
+{
 	/* XXX: move the following into the update_meminfo() functions? */
 	if (no_buffers.get(*state)) {
 		info.mem -= info.bufmem;
 		info.memeasyfree += info.bufmem;
 	}
+	/* what the objects showed is out of date */
+	text_memo_next_frame();
+}
+
+void update_stuff(void)
+{
+	start_update_stuff();
+	finish_update_stuff();
+}
+
+/* the two halves of update_stuff(), the callbacks run in the background
+ * between them */
+void start_update_stuff(void)
+{
+#ifdef BUILD_IO_URING
+	proc_batch_prefetch();
+#endif /* BUILD_IO_URING */
+	begin_update();
+	conky::start_all_callbacks();
+}
+
+void finish_update_stuff(void)
+{
+	conky::finish_callbacks();
+#ifdef BUILD_IO_URING
+	proc_batch_end_update();
+#endif /* BUILD_IO_URING */
+	end_update();
+	check_alerts();
+}
+
+/* between two updates (see sample_interval), only what is collected on every
+ * update is collected again */
+void sample_stuff(void)
+{
+	begin_update();
+	conky::run_sample_callbacks();
+	end_update();
+	check_alerts();
+}
+
+/* before the first update, for the rates it works out */
+void prime_stuff(void)
+{
+	start_prime_stuff();
+	finish_prime_stuff();
+}
+
+/* the two halves of prime_stuff(), the main thread may set up the window in
+ * between */
+void start_prime_stuff(void)
+{
+	begin_update();
+	conky::start_prime_callbacks();
+}
+
+void finish_prime_stuff(void)
+{
+	conky::finish_callbacks();
+	end_update();
+}
+
+/* what update_stuff() collected, for the config and in the snapshot of the
+ * Lua scripts; memory is in KiB like in info */
+namespace {
+	conky::register_numeric_source<double> uptime_source("uptime", &info.uptime);
+	conky::register_numeric_source<unsigned long long> mem_source("mem", &info.mem);
+	conky::register_numeric_source<unsigned long long> memmax_source("memmax", &info.memmax);
+	conky::register_numeric_source<unsigned long long> memfree_source("memfree", &info.memfree);
+	conky::register_numeric_source<unsigned long long> memeasyfree_source("memeasyfree",
+			&info.memeasyfree);
+	conky::register_numeric_source<unsigned long long> buffers_source("buffers", &info.buffers);
+	conky::register_numeric_source<unsigned long long> cached_source("cached", &info.cached);
+	conky::register_numeric_source<unsigned long long> swap_source("swap", &info.swap);
+	conky::register_numeric_source<unsigned long long> swapfree_source("swapfree",
+			&info.swapfree);
+	conky::register_numeric_source<unsigned long long> swapmax_source("swapmax", &info.swapmax);
+	conky::register_numeric_source<unsigned short> processes_source("processes", &info.procs);
+	conky::register_numeric_source<unsigned short> running_processes_source(
+			"running_processes", &info.run_procs);
+	conky::register_numeric_source<unsigned short> threads_source("threads", &info.threads);
+	conky::register_numeric_source<unsigned short> running_threads_source(
+			"running_threads", &info.run_threads);
+
+	/* cpu[0] is all of them, cpu[n] the n-th core, in percent */
+	conky::register_snapshot cpu_snapshot("cpu", [](conky::snapshot_writer &w) {
+		w.open("cpu");
+		for (int i = 0; info.cpu_usage && i <= info.cpu_count; i++)
+			w.number(i, info.cpu_usage[i] * 100);
+		w.close();
+	});
+
+	conky::register_snapshot loadavg_snapshot("loadavg", [](conky::snapshot_writer &w) {
+		w.open("loadavg");
+		for (int i = 0; i < 3; i++)
+			w.number(i + 1, info.loadavg[i]);
+		w.close();
+	});
 }
 
 /* Ohkie to return negative values for temperatures */
@@ -352,6 +570,12 @@ void print_loadavg(struct text_object *obj, char *p, int p_max_size)
 	}
 }
 
+double loadavg_value(struct text_object *obj)
+{
+	/* all three print as one text, the first is the value */
+	return info.loadavg[obj->data.i < 0 ? 0 : obj->data.i];
+}
+
 void scan_no_update(struct text_object *obj, const char *arg)
 {
 	obj->data.s = (char*) malloc(text_buffer_size.get(*state));
@@ -415,6 +639,13 @@ void print_##name(struct text_object *obj, char *p, int p_max_size) \
 	human_readable(info.name * 1024, p, p_max_size); \
 }
 
+#define HR_VALUE_GENERATOR(name) \
+double name##_value(struct text_object *obj) \
+{ \
+	(void)obj; \
+	return info.name * 1024.; \
+}
+
 PRINT_HR_GENERATOR(mem)
 PRINT_HR_GENERATOR(memwithbuffers)
 PRINT_HR_GENERATOR(memeasyfree)
@@ -425,6 +656,18 @@ PRINT_HR_GENERATOR(swap)
 PRINT_HR_GENERATOR(swapfree)
 PRINT_HR_GENERATOR(swapmax)
 
+HR_VALUE_GENERATOR(mem)
+HR_VALUE_GENERATOR(memwithbuffers)
+HR_VALUE_GENERATOR(memeasyfree)
+HR_VALUE_GENERATOR(memfree)
+HR_VALUE_GENERATOR(memmax)
+HR_VALUE_GENERATOR(memdirty)
+HR_VALUE_GENERATOR(swap)
+HR_VALUE_GENERATOR(swapfree)
+HR_VALUE_GENERATOR(swapmax)
+HR_VALUE_GENERATOR(buffers)
+HR_VALUE_GENERATOR(cached)
+
 uint8_t mem_percentage(struct text_object *obj)
 {
 	(void)obj;
@@ -516,6 +759,12 @@ void print_uptime_short(struct text_object *obj, char *p, int p_max_size)
 	format_seconds_short(p, p_max_size, (int)info.uptime);
 }
 
+double uptime_value(struct text_object *obj)
+{
+	(void)obj;
+	return info.uptime;
+}
+
 void print_processes(struct text_object *obj, char *p, int p_max_size)
 {
 	(void)obj;
@@ -540,6 +789,18 @@ void print_threads(struct text_object *obj, char *p, int p_max_size)
 	spaced_print(p, p_max_size, "%hu", 4, info.threads);
 }
 
+#define COUNT_VALUE_GENERATOR(name, field) \
+double name##_value(struct text_object *obj) \
+{ \
+	(void)obj; \
+	return info.field; \
+}
+
+COUNT_VALUE_GENERATOR(processes, procs)
+COUNT_VALUE_GENERATOR(running_processes, run_procs)
+COUNT_VALUE_GENERATOR(running_threads, run_threads)
+COUNT_VALUE_GENERATOR(threads, threads)
+
 void print_buffers(struct text_object *obj, char *p, int p_max_size)
 {
 	(void)obj;
@@ -570,41 +831,96 @@ int if_empty_iftest(struct text_object *obj)
 	return result;
 }
 
-static int check_contains(char *f, char *s)
+/* The contents of the files $if_existing looks into, shared by all objects
+ * naming the same path. An entry stays valid while stat() reports the same
+ * inode, size and modification time, and remembers which strings were found
+ * in it, so an unchanged file is neither read nor scanned again. Only files
+ * whose size matches what was read are kept: procfs and sysfs report a size
+ * of 0 or a page and no useful mtime, those are read every time. */
+struct contents_cache_entry {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	std::string contents;
+	std::unordered_map<std::string, bool> found;
+};
+
+static std::unordered_map<std::string, contents_cache_entry> contents_cache;
+
+static bool same_file(const contents_cache_entry &e, const struct stat &st)
 {
-	int ret = 0;
-	FILE *where = open_file(f, 0);
-
-	if (where) {
-		char buf1[256];
+	return e.dev == st.st_dev && e.ino == st.st_ino && e.size == st.st_size &&
+		e.mtime.tv_sec == st.st_mtim.tv_sec && e.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
 
-		while (fgets(buf1, 256, where)) {
-			if (strstr(buf1, s)) {
-				ret = 1;
-				break;
-			}
+static int check_contains(char *f, char *s, const struct stat &st)
+{
+	auto it = contents_cache.find(f);
+
+	if (it == contents_cache.end() || !same_file(it->second, st)) {
+		FILE *where = open_file(f, 0);
+		struct stat rst;
+		std::string contents;
+		char buf[4096];
+		size_t len;
+
+		if (it != contents_cache.end()) {
+			contents_cache.erase(it);
+			it = contents_cache.end();
+		}
+		if (!where) {
+			NORM_ERR("Could not open the file");
+			return 0;
+		}
+		while ((len = fread(buf, 1, sizeof(buf), where)) > 0)
+			contents.append(buf, len);
+		if (fstat(fileno(where), &rst) == 0 && S_ISREG(rst.st_mode) &&
+				(off_t) contents.size() == rst.st_size) {
+			contents_cache_entry &e = contents_cache[f];
+
+			e.dev = rst.st_dev;
+			e.ino = rst.st_ino;
+			e.size = rst.st_size;
+			e.mtime = rst.st_mtim;
+			e.contents.swap(contents);
+			it = contents_cache.find(f);
 		}
 		fclose(where);
-	} else {
-		NORM_ERR("Could not open the file");
+		if (it == contents_cache.end())
+			return strstr(contents.c_str(), s) != NULL;
 	}
-	return ret;
+
+	auto found = it->second.found.find(s);
+	if (found == it->second.found.end())
+		found = it->second.found.emplace(s,
+				strstr(it->second.contents.c_str(), s) != NULL).first;
+	return found->second;
 }
 
 int if_existing_iftest(struct text_object *obj)
 {
 	char *spc;
+	struct stat st;
 	int result = 0;
 
 	spc = strchr(obj->data.s, ' ');
 	if(spc != NULL) *spc = 0;
-	if (access(obj->data.s, F_OK) == 0) {
-		if(spc == NULL || check_contains(obj->data.s, spc + 1)) result = 1;
+	if (stat(obj->data.s, &st) == 0) {
+		if(spc == NULL || check_contains(obj->data.s, spc + 1, st)) result = 1;
+	} else {
+		contents_cache.erase(obj->data.s);
 	}
 	if(spc != NULL) *spc = ' ';
 	return result;
 }
 
+void free_if_existing(struct text_object *obj)
+{
+	contents_cache.clear();
+	gen_free_opaque(obj);
+}
+
 int if_running_iftest(struct text_object *obj)
 {
 #ifdef __linux__
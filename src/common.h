@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <mutex>
 #include <string>
 #include <string.h>
 #include <sys/socket.h>
@@ -50,6 +51,12 @@ int update_uname(void);
 int update_threads(void);
 int update_running_processes(void);
 void update_stuff(void);
+void start_update_stuff(void);
+void finish_update_stuff(void);
+void sample_stuff(void);
+void prime_stuff(void);
+void start_prime_stuff(void);
+void finish_prime_stuff(void);
 char get_freq(char *, size_t, const char *, int, unsigned int);
 void print_voltage_mv(struct text_object *, char *, int);
 void print_voltage_v(struct text_object *, char *, int);
@@ -64,6 +71,118 @@ double get_time(void);
 std::string to_real_path(const std::string &source);
 FILE *open_file(const char *file, int *reported);
 int open_fifo(const char *file, int *reported);
+
+/* Where procfs is read from, "/proc" unless conky_bench points it at a
+ * synthetic tree. procfs_path() puts it in place of a leading /proc. The
+ * interfaces which bypass procfs, rtnetlink and the proc connector, are only
+ * used while it is the real one. */
+extern std::string procfs_root;
+std::string procfs_path(const std::string &path);
+static inline bool procfs_is_real(void)
+{ return procfs_root == "/proc"; }
+
+/* A file in /proc or /sys which is read as a whole on every update. The file
+ * is kept open and the contents are read at once with pread() into a buffer,
+ * which is kept too and only grows. With BUILD_IO_URING, a batched file is
+ * read ahead together with the others at the start of each update (see
+ * proc_batch.h), into a buffer of its own that read() swaps in. */
+class proc_file {
+	const std::string path;
+	int fd;
+	char *buf;
+	size_t size;
+	size_t len;
+	int reported;
+	const bool batched;
+	/* read since the last read-ahead */
+	bool wanted;
+	/* the read-ahead: its buffer, the update it was made for and its result */
+	char *pbuf;
+	size_t psize;
+	unsigned int prefetch_gen;
+	int prefetch_res;
+	/* held by read() and by the read-ahead */
+	std::mutex mutex;
+
+	proc_file(const proc_file &) = delete;
+	proc_file& operator=(const proc_file &) = delete;
+
+	friend class proc_batch;
+
+public:
+	explicit proc_file(const std::string &path_, bool batched_ = false)
+		: path(procfs_path(path_)), fd(-1), buf(NULL), size(0), len(0), reported(0),
+		  batched(batched_), wanted(false), pbuf(NULL), psize(0), prefetch_gen(0),
+		  prefetch_res(0)
+	{}
+
+	~proc_file();
+
+	/* read the current contents, returns false if the file can't be read */
+	bool read();
+
+	/* the contents from the last read(), NUL-terminated; they stay until
+	 * the next read() */
+	const char *data() const
+	{ return buf; }
+
+	size_t length() const
+	{ return len; }
+};
+
+/* Helpers for parsing the contents of a proc_file. They advance p past
+ * what they consumed. */
+
+/* skip blanks, then parse an unsigned decimal number, 0 if there is none */
+static inline unsigned long long proc_scan_ull(const char *&p)
+{
+	unsigned long long n = 0;
+
+	while (*p == ' ' || *p == '\t')
+		++p;
+	for (; (unsigned char) (*p - '0') < 10; ++p)
+		n = n * 10 + (*p - '0');
+	return n;
+}
+
+/* skip blanks, then parse a decimal number with an optional fraction, which
+ * unlike strtod() doesn't depend on the locale */
+static inline double proc_scan_double(const char *&p)
+{
+	double n = proc_scan_ull(p);
+
+	if (*p == '.') {
+		double scale = 0.1;
+		for (++p; (unsigned char) (*p - '0') < 10; ++p, scale /= 10)
+			n += (*p - '0') * scale;
+	}
+	return n;
+}
+
+/* skip blanks, then a word, returns its length */
+static inline size_t proc_skip_word(const char *&p)
+{
+	const char *start;
+
+	while (*p == ' ' || *p == '\t')
+		++p;
+	for (start = p; *p && *p != ' ' && *p != '\t' && *p != '\n'; ++p)
+		;
+	return p - start;
+}
+
+/* move to the start of the next line, returns false at the end of the data */
+static inline bool proc_next_line(const char *&p)
+{
+	const char *nl = strchr(p, '\n');
+
+	if (!nl || !nl[1]) {
+		p += strlen(p);
+		return false;
+	}
+	p = nl + 1;
+	return true;
+}
 std::string variable_substitute(std::string s);
 
 void format_seconds(char *buf, unsigned int n, long t);
@@ -90,6 +209,7 @@ void free_no_update(struct text_object *);
 
 void scan_loadavg_arg(struct text_object *, const char *);
 void print_loadavg(struct text_object *, char *, int);
+double loadavg_value(struct text_object *);
 #ifdef BUILD_X11
 void scan_loadgraph_arg(struct text_object *, const char *);
 double loadgraphval(struct text_object *);
@@ -107,6 +227,15 @@ void print_memdirty(struct text_object *, char *, int);
 void print_swap(struct text_object *, char *, int);
 void print_swapfree(struct text_object *, char *, int);
 void print_swapmax(struct text_object *, char *, int);
+double mem_value(struct text_object *);
+double memwithbuffers_value(struct text_object *);
+double memeasyfree_value(struct text_object *);
+double memfree_value(struct text_object *);
+double memmax_value(struct text_object *);
+double memdirty_value(struct text_object *);
+double swap_value(struct text_object *);
+double swapfree_value(struct text_object *);
+double swapmax_value(struct text_object *);
 uint8_t mem_percentage(struct text_object *);
 double mem_barval(struct text_object *);
 double mem_with_buffers_barval(struct text_object *);
@@ -126,19 +255,27 @@ void print_version(struct text_object *obj, char *p, int p_max_size);
 
 void print_uptime(struct text_object *, char *, int);
 void print_uptime_short(struct text_object *, char *, int);
+double uptime_value(struct text_object *);
 
 void print_processes(struct text_object *, char *, int);
 void print_running_processes(struct text_object *, char *, int);
 void print_running_threads(struct text_object *, char *, int);
 void print_threads(struct text_object *, char *, int);
+double processes_value(struct text_object *);
+double running_processes_value(struct text_object *);
+double running_threads_value(struct text_object *);
+double threads_value(struct text_object *);
 
 void print_buffers(struct text_object *, char *, int);
 void print_cached(struct text_object *, char *, int);
+double buffers_value(struct text_object *);
+double cached_value(struct text_object *);
 
 void print_evaluate(struct text_object *, char *, int);
 
 int if_empty_iftest(struct text_object *);
 int if_existing_iftest(struct text_object *);
+void free_if_existing(struct text_object *);
 int if_running_iftest(struct text_object *);
 
 #ifndef __OpenBSD__
@@ -32,10 +32,15 @@
 #include "text_object.h"
 #include "conky.h"
 #include "common.h"
+#include "alerts.h"
 #include <iostream>
 #include <algorithm>
 #include <sstream>
 #include <string>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <thread>
 #include <stdarg.h>
 #include <cmath>
 #include <ctime>
@@ -43,6 +48,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
 #endif /* HAVE_DIRENT_H */
@@ -90,8 +96,15 @@
 #include "logging.h"
 #include "mail.h"
 #include "nc.h"
+#include "history.h"
+#include "latency.h"
 #include "net_stat.h"
 #include "temphelper.h"
+#include "profile.h"
+#include "reactor.hh"
+#include "self.h"
+#include "trace.h"
+#include "samples.h"
 #include "template.h"
 #include "timeinfo.h"
 #include "top.h"
@@ -123,6 +136,18 @@
 #endif
 #ifdef BUILD_HTTP
 #include <microhttpd.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "metrics.h"
+#endif
+#ifdef BUILD_SHM
+#include <sys/mman.h>
+#include "shm.h"
+#endif
+#ifdef BUILD_REMOTE
+#include "remote.h"
 #endif
 
 #if defined(__FreeBSD_kernel__)
@@ -184,6 +209,11 @@ static conky::simple_config_setting<bool> out_to_stdout("out_to_console",
 #endif
 														false);
 static conky::simple_config_setting<bool> out_to_stderr("out_to_stderr", false, false);
+static conky::simple_config_setting<bool> out_to_json("out_to_json", false, false);
+/* what each instruction of the global text produced in this and
+ * in the previous frame, the instruction index is the field's id */
+static std::vector<std::string> json_values, json_last_values;
+
 
 
 int top_cpu, top_mem, top_time;
@@ -191,6 +221,7 @@ int top_cpu, top_mem, top_time;
 int top_io;
 #endif
 int top_running;
+int top_group;
 static conky::simple_config_setting<bool> extra_newline("extra_newline", false, false);
 static volatile int g_signal_pending;
 
@@ -200,9 +231,57 @@ conky::range_config_setting<double> update_interval("update_interval", 0.0,
 conky::range_config_setting<double> update_interval_on_battery("update_interval_on_battery", 0.0,
 										std::numeric_limits<double>::infinity(), NOBATTERY, true);
 static bool on_battery = false;
+/* longer intervals while nobody can see conky or the system is busy */
+static conky::range_config_setting<double> update_interval_hidden("update_interval_hidden",
+										0.0, std::numeric_limits<double>::infinity(), 0.0, true);
+static conky::range_config_setting<double> update_interval_busy("update_interval_busy", 0.0,
+										std::numeric_limits<double>::infinity(), 0.0, true);
+static conky::range_config_setting<double> busy_load("busy_load", 0.0,
+										std::numeric_limits<double>::infinity(), 1.0, true);
+static bool window_obscured = false;
+static bool screen_blanked = false;
+static bool system_busy = false;
+/* collecting more often than the text is updated, 0 to collect on updates */
+conky::range_config_setting<double> sample_interval("sample_interval", 0.0,
+										std::numeric_limits<double>::infinity(), 0.0, true);
+/* collect the data of the next update as soon as the text of this one is
+ * generated, instead of at the start of the next one */
+static conky::simple_config_setting<bool> update_pipelining("update_pipelining", false, true);
+/* how long after the sample taken at startup the first update comes, 0 to
+ * start with the update */
+static conky::range_config_setting<double> startup_prime_delay("startup_prime_delay",
+										0.0, 10.0, 0.1, false);
 
 double active_update_interval()
-{ return (on_battery?update_interval_on_battery:update_interval).get(*state); }
+{
+	double ui = (on_battery?update_interval_on_battery:update_interval).get(*state);
+
+	if (system_busy)
+		ui = std::max(ui, update_interval_busy.get(*state));
+	if (window_obscured || screen_blanked)
+		ui = std::max(ui, update_interval_hidden.get(*state));
+	return ui;
+}
+
+/* the time between two collections of the data */
+double active_sample_interval()
+{
+	double ui = active_update_interval();
+	double si = sample_interval.get(*state);
+
+	return si > 0 && si < ui ? si : ui;
+}
+
+/* turns what was counted since the last collection into a count per update
+ * interval, as collections needn't be an update interval apart */
+double update_delta_scale()
+{
+	double delta = current_update_time - last_update_time;
+
+	if (last_update_time <= 0 || delta <= 0)
+		return 1;
+	return active_update_interval() / delta;
+}
 
 void music_player_interval_setting::lua_setter(lua::state &l, bool init)
 {
@@ -234,7 +313,7 @@ char** argv_copy;
 
 /* prototypes for internally used functions */
 static void signal_handler(int);
-static void reload_config(void);
+static void reload_config(bool settle);
 
 static void print_version(void)
 {
@@ -306,6 +385,18 @@ static void print_version(void)
 #ifdef BUILD_IOSTATS
                 << _("  * iostats\n")
 #endif /* BUILD_IOSTATS */
+#ifdef BUILD_PROC_CONNECTOR
+                << _("  * proc connector\n")
+#endif /* BUILD_PROC_CONNECTOR */
+#ifdef BUILD_RTNETLINK
+                << _("  * rtnetlink\n")
+#endif /* BUILD_RTNETLINK */
+#ifdef BUILD_IO_URING
+                << _("  * io_uring\n")
+#endif /* BUILD_IO_URING */
+#ifdef BUILD_BPF
+                << _("  * eBPF\n")
+#endif /* BUILD_BPF */
 #ifdef BUILD_NCURSES
                 << _("  * ncurses\n")
 #endif /* BUILD_NCURSES */
@@ -372,7 +463,7 @@ static void print_version(void)
 #ifdef BUILD_HTTP
 	<< "  * HTTP-port: " << HTTPPORT << "\n"
 #endif
-	<< "  * Maximum netdevices: " << MAX_NET_INTERFACES << "\n"
+	<< "  * Maximum addresses per netdevice: " << MAX_NET_INTERFACES << "\n"
 	<< "  * Maximum text size: " << MAX_USER_TEXT_DEFAULT << "\n"
 	<< "  * Size text buffer: " << DEFAULT_TEXT_BUFFER_SIZE << "\n"
         ;
@@ -429,22 +520,346 @@ conky::range_config_setting<int> cpu_avg_samples("cpu_avg_samples", 1, 14, 2, tr
 conky::range_config_setting<int> net_avg_samples("net_avg_samples", 1, 14, 2, true);
 conky::range_config_setting<int> diskio_avg_samples("diskio_avg_samples", 1, 14, 2, true);
 
+template<>
+conky::lua_traits<average_mode>::Map conky::lua_traits<average_mode>::map = {
+	{ "window",      AVERAGE_WINDOW },
+	{ "exponential", AVERAGE_EXPONENTIAL }
+};
+conky::simple_config_setting<average_mode> average_mode_setting("average_mode",
+		AVERAGE_WINDOW, true);
+
 /* filenames for output */
 static conky::simple_config_setting<std::string> overwrite_file("overwrite_file",
 																std::string(), true);
 static FILE *overwrite_fpointer = NULL;
+static std::string overwrite_tmpname;
 static conky::simple_config_setting<std::string> append_file("append_file",
 																std::string(), true);
 static FILE *append_fpointer = NULL;
+static std::string append_name;
+static double append_last_flush = 0;
+static conky::range_config_setting<double> append_flush_interval("append_flush_interval",
+		0.0, std::numeric_limits<double>::infinity(), 0.0, true);
+
+/* the text is written next to the target and renamed over it once complete,
+ * so readers never see a truncated or half-written file */
+static void open_overwrite_file(void)
+{
+	const std::string &name = overwrite_file.get(*state);
+	int fd;
+
+	overwrite_tmpname = name + ".tmp";
+	fd = open(overwrite_tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0 || !(overwrite_fpointer = fdopen(fd, "w"))) {
+		if (fd >= 0) close(fd);
+		NORM_ERR("Cannot overwrite '%s'", name.c_str());
+	}
+}
+
+static void close_overwrite_file(void)
+{
+	bool ok = !ferror(overwrite_fpointer);
+
+	if (fclose(overwrite_fpointer) != 0) ok = false;
+	overwrite_fpointer = NULL;
+	if (ok && rename(overwrite_tmpname.c_str(), overwrite_file.get(*state).c_str()) == 0)
+		return;
+	NORM_ERR("Cannot overwrite '%s': %s", overwrite_file.get(*state).c_str(),
+			strerror(errno));
+	unlink(overwrite_tmpname.c_str());
+}
+
+static void close_append_file(void)
+{
+	if (append_fpointer) {
+		fclose(append_fpointer);
+		append_fpointer = NULL;
+	}
+	append_name.clear();
+}
+
+/* the append file stays open between updates, reopened only when append_file
+ * changes, and is flushed at most every append_flush_interval seconds */
+static void open_append_file(void)
+{
+	const std::string &name = append_file.get(*state);
+
+	if (append_fpointer && name == append_name)
+		return;
+	close_append_file();
+	append_fpointer = fopen(name.c_str(), "a");
+	if(!append_fpointer) {
+		NORM_ERR("Cannot append to '%s'", name.c_str());
+		return;
+	}
+	append_name = name;
+	append_last_flush = get_time();
+}
+
+static void flush_append_file(void)
+{
+	double now = get_time();
+
+	if (now - append_last_flush < append_flush_interval.get(*state))
+		return;
+	append_last_flush = now;
+	if (fflush(append_fpointer) != 0) {
+		NORM_ERR("Cannot append to '%s': %s", append_name.c_str(), strerror(errno));
+		close_append_file();
+	}
+}
 
 #ifdef BUILD_HTTP
 std::string webpage;
 struct MHD_Daemon *httpd;
 static conky::simple_config_setting<bool> http_refresh("http_refresh", false, true);
 
+static conky::range_config_setting<unsigned int> http_threads("http_threads", 1,
+		std::numeric_limits<unsigned int>::max(), 1, false);
+
+#ifndef MHD_CONTENT_READER_END_OF_STREAM
+#define MHD_CONTENT_READER_END_OF_STREAM ((ssize_t) -1)
+#endif
+
+/* webpage as it was at the end of a frame, the http threads keep a
+ * reference to the snapshot they send while the main loop goes on */
+struct http_page {
+	std::string body;
+	std::string etag;
+};
+
+static std::mutex http_page_mutex;
+static std::shared_ptr<const http_page> http_page_snapshot;
+
+/* the page moves into the snapshot, the next one is built in a buffer of
+ * the same size */
+static void publish_webpage(void)
+{
+	std::shared_ptr<http_page> page(new http_page);
+	unsigned long long h = 14695981039346656037ull;
+	size_t size = webpage.size();
+	char etag[24];
+
+	for (size_t i = 0; i < size; i++) {
+		h = (h ^ (unsigned char) webpage[i]) * 1099511628211ull;
+	}
+	snprintf(etag, sizeof etag, "\"%016llx\"", h);
+	page->body.swap(webpage);
+	page->etag = etag;
+	webpage.reserve(size);
+
+	std::shared_ptr<const http_page> snapshot(page);
+	std::lock_guard<std::mutex> lock(http_page_mutex);
+	http_page_snapshot.swap(snapshot);
+}
+
+static std::shared_ptr<const http_page> get_webpage(void)
+{
+	std::lock_guard<std::mutex> lock(http_page_mutex);
+
+	return http_page_snapshot;
+}
+
+/* appends a line of text to webpage in one pass, with its line breaks as
+ * <br /> and runs of spaces as &nbsp; so the browser doesn't collapse them;
+ * a single space stays as it is */
+static void append_webpage_text(const char *s)
+{
+	const char *start = s;
+
+	while (*s) {
+		if (*s == '\n') {
+			webpage.append(start, s - start);
+			webpage.append("<br />", 6);
+			start = ++s;
+		} else if (*s == ' ' && s[1] == ' ') {
+			webpage.append(start, s - start);
+			for (; *s == ' '; ++s)
+				webpage.append("&nbsp;", 6);
+			start = s;
+		} else {
+			++s;
+		}
+	}
+	webpage.append(start, s - start);
+}
+
+/* the response owns a reference to the body it reads from */
+static ssize_t http_body_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+	const std::string &body = **(std::shared_ptr<const std::string> *) cls;
+
+	if (pos >= body.size())
+		return MHD_CONTENT_READER_END_OF_STREAM;
+	size_t n = std::min(max, (size_t) (body.size() - pos));
+	memcpy(buf, body.data() + pos, n);
+	return n;
+}
+
+static void http_body_free(void *cls)
+{
+	delete (std::shared_ptr<const std::string> *) cls;
+}
+
+static struct MHD_Response *http_body_response(const std::shared_ptr<const std::string> &body)
+{
+	return MHD_create_response_from_callback(body->size(), 32 * 1024,
+			&http_body_reader, new std::shared_ptr<const std::string>(body),
+			&http_body_free);
+}
+
+static conky::simple_config_setting<bool> http_events("http_events", false, false);
+
+/* /events streams the lines of the text that changed in each update to
+ * every client as server-sent events. A client that falls further behind
+ * than the backlog, or has just connected, gets all the lines. */
+namespace {
+	const size_t http_event_backlog = 64;
+	/* seconds without an update before a client gets a keep-alive */
+	const int http_event_keepalive = 15;
+
+	std::mutex http_event_mutex;
+	std::condition_variable http_event_cond;
+	std::deque<std::string> http_event_queue;	/* the newest events */
+	unsigned long long http_event_seq;		/* id of the newest event */
+	std::vector<std::string> http_event_lines;	/* the text as of http_event_seq */
+	bool http_event_stop;
+
+	struct http_event_client {
+		bool full;				/* needs every line */
+		unsigned long long seq;	/* last event it was given */
+		std::string pending;
+		size_t sent;
+	};
+}
+
+static void http_event_append(std::string &ev, size_t line, const std::string &text)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof buf, "data: %zu\t", line);
+	ev += buf;
+	ev += text;
+	ev += '\n';
+}
+
+/* the event of the current frame with all its lines, under http_event_mutex */
+static std::string http_event_full(void)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof buf, "id: %llu\ndata: lines\t%zu\n", http_event_seq,
+			http_event_lines.size());
+	std::string ev = buf;
+	for (size_t i = 0; i < http_event_lines.size(); i++) {
+		http_event_append(ev, i, http_event_lines[i]);
+	}
+	return ev + '\n';
+}
+
+/* queue the lines of text_buffer that changed since the last update */
+static void publish_text_events(const char *text)
+{
+	std::vector<std::string> lines(1);
+	std::string changed;
+	char buf[64];
+
+	for (; *text; text++) {
+		if (*text == '\n')
+			lines.push_back(std::string());
+		else if (*text != SPECIAL_CHAR)
+			lines.back() += *text;
+	}
+
+	std::lock_guard<std::mutex> lock(http_event_mutex);
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (i >= http_event_lines.size() || lines[i] != http_event_lines[i])
+			http_event_append(changed, i, lines[i]);
+	}
+	if (changed.empty() && lines.size() == http_event_lines.size())
+		return;
+	http_event_seq++;
+	snprintf(buf, sizeof buf, "id: %llu\ndata: lines\t%zu\n", http_event_seq,
+			lines.size());
+	http_event_queue.push_back(buf + changed + '\n');
+	if (http_event_queue.size() > http_event_backlog)
+		http_event_queue.pop_front();
+	http_event_lines.swap(lines);
+	http_event_cond.notify_all();
+}
+
+/* runs in the connection's own thread, so it may wait for the next update */
+static ssize_t http_event_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+	http_event_client *c = (http_event_client *) cls;
+
+	(void) pos;
+	if (c->sent == c->pending.size()) {
+		std::unique_lock<std::mutex> lock(http_event_mutex);
+
+		c->pending.clear();
+		c->sent = 0;
+		if (!c->full && c->seq == http_event_seq && !http_event_stop) {
+			http_event_cond.wait_for(lock,
+					std::chrono::seconds(http_event_keepalive));
+		}
+		if (http_event_stop)
+			return MHD_CONTENT_READER_END_OF_STREAM;
+		if (!c->full && c->seq == http_event_seq) {
+			c->pending = ":\n\n";
+		} else if (c->full || http_event_seq - c->seq > http_event_queue.size()) {
+			c->pending = http_event_full();
+		} else {
+			for (size_t k = http_event_queue.size() - (http_event_seq - c->seq);
+					k < http_event_queue.size(); k++) {
+				c->pending += http_event_queue[k];
+			}
+		}
+		c->full = false;
+		c->seq = http_event_seq;
+	}
+	size_t n = std::min(max, c->pending.size() - c->sent);
+	memcpy(buf, c->pending.data() + c->sent, n);
+	c->sent += n;
+	return n;
+}
+
+static void http_event_free(void *cls)
+{
+	delete (http_event_client *) cls;
+}
+
 int sendanswer(void *cls, struct MHD_Connection *connection, const char *url, const char *method, const char *version, const char *upload_data, size_t *upload_data_size, void **con_cls) {
-	struct MHD_Response *response = MHD_create_response_from_data(webpage.length(), (void*) webpage.c_str(), MHD_NO, MHD_NO);
-	int ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+	struct MHD_Response *response;
+	unsigned int status = MHD_HTTP_OK;
+	if (url && strcmp(url, "/events") == 0 && http_events.get(*state)) {
+		http_event_client *c = new http_event_client;
+
+		c->full = true;
+		c->seq = 0;
+		c->sent = 0;
+		response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4096,
+				&http_event_reader, c, &http_event_free);
+		MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/event-stream");
+		MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+	} else if (url && strcmp(url, "/metrics") == 0) {
+		response = http_body_response(get_metrics());
+		MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+	} else {
+		std::shared_ptr<const http_page> page = get_webpage();
+		if (!page)
+			page.reset(new http_page);
+		const char *match = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
+		if (match && page->etag == match) {
+			/* the client has this frame already */
+			status = MHD_HTTP_NOT_MODIFIED;
+			response = MHD_create_response_from_data(0, NULL, MHD_NO, MHD_NO);
+		} else {
+			response = http_body_response(std::shared_ptr<const std::string>(page, &page->body));
+		}
+		MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, page->etag.c_str());
+	}
+	int ret = MHD_queue_response (connection, status, response);
 	MHD_destroy_response(response);
 	if(cls || url || method || version || upload_data || upload_data_size || con_cls) {}	//make compiler happy
 	return ret;
@@ -461,8 +876,22 @@ protected:
         Base::lua_setter(l, init);
 
         if(init && do_convert(l, -1).first) {
-			httpd = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, HTTPPORT,
-							NULL, NULL, &sendanswer, NULL, MHD_OPTION_END);
+			unsigned int threads = http_threads.get(l);
+
+			http_event_stop = false;
+			if (http_events.get(l)) {
+				/* event streams wait for updates in their reader */
+				httpd = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION, HTTPPORT,
+								NULL, NULL, &sendanswer, NULL, MHD_OPTION_END);
+			} else if (threads > 1) {
+				httpd = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, HTTPPORT,
+								NULL, NULL, &sendanswer, NULL,
+								MHD_OPTION_THREAD_POOL_SIZE, threads,
+								MHD_OPTION_END);
+			} else {
+				httpd = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, HTTPPORT,
+								NULL, NULL, &sendanswer, NULL, MHD_OPTION_END);
+			}
         }
 
         ++s;
@@ -473,6 +902,11 @@ protected:
 		lua::stack_sentry s(l, -1);
 
 		if(do_convert(l, -1).first) {
+			{
+				std::lock_guard<std::mutex> lock(http_event_mutex);
+				http_event_stop = true;
+				http_event_cond.notify_all();
+			}
 			MHD_stop_daemon(httpd);
 			httpd = NULL;
 		}
@@ -578,6 +1012,92 @@ int get_total_updates(void)
 	return total_updates;
 }
 
+#ifdef BUILD_X11
+namespace {
+	/* strings remembered per font, besides the ASCII advances */
+	const size_t text_width_cache_size = 256;
+
+	typedef std::list<std::pair<std::string, int> > text_width_list;
+
+	/* calc_text_width() results of one font, indexed like fonts */
+	struct text_width_cache {
+		const void *font;		/* what the widths were measured with */
+		short ascii[128];		/* advance of each ASCII character, -1 if unknown */
+		text_width_list lru;	/* most recently used first */
+		std::unordered_map<std::string, text_width_list::iterator> index;
+
+		text_width_cache(const void *f)
+			: font(f)
+		{ std::fill(ascii, ascii + 128, -1); }
+	};
+
+	std::vector<std::unique_ptr<text_width_cache> > text_width_caches;
+
+	int measure_text_width(size_t f, const char *s, size_t slen)
+	{
+#ifdef BUILD_XFT
+		if (use_xft.get(*state)) {
+			XGlyphInfo gi;
+
+			if (utf8_mode.get(*state)) {
+				XftTextExtentsUtf8(display, fonts[f].xftfont,
+						(const FcChar8 *) s, slen, &gi);
+			} else {
+				XftTextExtents8(display, fonts[f].xftfont,
+						(const FcChar8 *) s, slen, &gi);
+			}
+			return gi.xOff;
+		} else
+#endif /* BUILD_XFT */
+		{
+			return XTextWidth(fonts[f].font, s, slen);
+		}
+	}
+
+	text_width_cache &get_text_width_cache(size_t f)
+	{
+		const void *font = fonts[f].font;
+
+#ifdef BUILD_XFT
+		if (use_xft.get(*state)) {
+			font = fonts[f].xftfont;
+		}
+#endif /* BUILD_XFT */
+		if (text_width_caches.size() <= f) {
+			text_width_caches.resize(f + 1);
+		}
+		std::unique_ptr<text_width_cache> &c = text_width_caches[f];
+		if (!c || c->font != font) {
+			c.reset(new text_width_cache(font));
+		}
+		return *c;
+	}
+
+	/* measure the printable ASCII characters of the fonts that were just
+	 * loaded, so drawing the first frame in a new font doesn't */
+	void prime_text_widths(void)
+	{
+		for (size_t f = 0; f < fonts.size(); f++) {
+			text_width_cache &c = get_text_width_cache(f);
+
+			for (char ch = ' '; ch < 127; ch++) {
+				if (c.ascii[(unsigned char) ch] < 0) {
+					c.ascii[(unsigned char) ch] = measure_text_width(f, &ch, 1);
+				}
+			}
+		}
+	}
+
+	/* load the fonts that were added since the last time, if any */
+	void update_fonts(void)
+	{
+		if (load_fonts(utf8_mode.get(*state))) {
+			prime_text_widths();
+		}
+	}
+}
+#endif /* BUILD_X11 */
+
 int calc_text_width(const char *s)
 {
 	size_t slen = strlen(s);
@@ -588,23 +1108,38 @@ int calc_text_width(const char *s)
 		return slen;
 #ifdef BUILD_X11
 	}
-#ifdef BUILD_XFT
-	if (use_xft.get(*state)) {
-		XGlyphInfo gi;
 
-		if (utf8_mode.get(*state)) {
-			XftTextExtentsUtf8(display, fonts[selected_font].xftfont,
-					(const FcChar8 *) s, slen, &gi);
-		} else {
-			XftTextExtents8(display, fonts[selected_font].xftfont,
-					(const FcChar8 *) s, slen, &gi);
+	text_width_cache &c = get_text_width_cache(selected_font);
+	int width = 0;
+	size_t i;
+
+	/* ASCII runs are the sum of their advances */
+	for (i = 0; i < slen && (unsigned char) s[i] < 128; i++) {
+		short &adv = c.ascii[(unsigned char) s[i]];
+
+		if (adv < 0) {
+			adv = measure_text_width(selected_font, s + i, 1);
 		}
-		return gi.xOff;
-	} else
-#endif /* BUILD_XFT */
-	{
-		return XTextWidth(fonts[selected_font].font, s, slen);
+		width += adv;
+	}
+	if (i == slen) {
+		return width;
+	}
+
+	std::string key(s, slen);
+	auto it = c.index.find(key);
+	if (it != c.index.end()) {
+		c.lru.splice(c.lru.begin(), c.lru, it->second);
+		return it->second->second;
+	}
+	width = measure_text_width(selected_font, s, slen);
+	c.lru.push_front(std::make_pair(key, width));
+	c.index[key] = c.lru.begin();
+	if (c.lru.size() > text_width_cache_size) {
+		c.index.erase(c.lru.back().first);
+		c.lru.pop_back();
 	}
+	return width;
 #endif /* BUILD_X11 */
 }
 
@@ -612,6 +1147,54 @@ int calc_text_width(const char *s)
  * drawn in draw_stuff() */
 
 static char *text_buffer;
+static size_t text_buffer_capacity;
+/* text_buffer with the lines longer than max_text_width broken, the two are
+ * swapped after wrapping */
+static char *wrap_buffer;
+static size_t wrap_buffer_capacity;
+
+/* text_buffer starts at max_user_text bytes and grows when the text of the
+ * frame needs more room */
+static void alloc_text_buffer(void)
+{
+	text_buffer_capacity = max_user_text.get(*state);
+	text_buffer = (char*)malloc(text_buffer_capacity);
+	memset(text_buffer, 0, text_buffer_capacity);
+}
+
+size_t text_buffer_bytes(void)
+{
+	return text_buffer_capacity + wrap_buffer_capacity;
+}
+
+static void free_text_buffer(void)
+{
+	free_and_zero(text_buffer);
+	free_and_zero(wrap_buffer);
+	text_buffer_capacity = wrap_buffer_capacity = 0;
+}
+
+/* make room for at least size bytes in *buf, keeping its contents */
+static bool grow_buffer(char **buf, size_t *buf_capacity, size_t size)
+{
+	size_t capacity = *buf_capacity ? *buf_capacity : 1;
+	char *b;
+
+	while (capacity < size)
+		capacity *= 2;
+	if (capacity == *buf_capacity)
+		return true;
+	if (!(b = (char *) realloc(*buf, capacity)))
+		return false;
+	*buf = b;
+	*buf_capacity = capacity;
+	return true;
+}
+
+static bool grow_text_buffer(size_t size)
+{
+	return grow_buffer(&text_buffer, &text_buffer_capacity, size);
+}
 
 /* quite boring functions */
 
@@ -655,12 +1238,43 @@ static void convert_escapes(char *buf)
 	*p = '\0';
 }
 
+/* Copy the len characters of s into buf, padded to width as use_spacer says.
+ * Returns what snprintf() would, the length of the whole padded text. */
+static int spacer_copy(char *buf, int size, const char *s, int len, int width)
+{
+	spacer_state spacer = use_spacer.get(*state);
+	int pad = (spacer != NO_SPACER && len < width) ? width - len : 0;
+	int room = size - 1, n;
+	char *o = buf;
+
+	if (size < 1) {
+		return len + pad;
+	}
+	if (spacer == LEFT_SPACER) {
+		n = std::min(pad, room);
+		memset(o, ' ', n);
+		o += n;
+		room -= n;
+	}
+	n = std::min(len, room);
+	memmove(o, s, n);
+	o += n;
+	room -= n;
+	if (spacer == RIGHT_SPACER) {
+		n = std::min(pad, room);
+		memset(o, ' ', n);
+		o += n;
+	}
+	*o = '\0';
+	return len + pad;
+}
+
 /* Prints anything normally printed with snprintf according to the current value
  * of use_spacer.  Actually slightly more flexible than snprintf, as you can
  * safely specify the destination buffer as one of your inputs.  */
 int spaced_print(char *buf, int size, const char *format, int width, ...)
 {
-	int len = 0;
+	int len;
 	va_list argp;
 	char *tempbuf;
 
@@ -671,31 +1285,83 @@ int spaced_print(char *buf, int size, const char *format, int width, ...)
 
 	// Passes the varargs along to vsnprintf
 	va_start(argp, width);
-	vsnprintf(tempbuf, size, format, argp);
+	len = vsnprintf(tempbuf, size, format, argp);
 	va_end(argp);
 
-	switch (use_spacer.get(*state)) {
-		case NO_SPACER:
-			len = snprintf(buf, size, "%s", tempbuf);
-			break;
-		case LEFT_SPACER:
-			len = snprintf(buf, size, "%*s", width, tempbuf);
-			break;
-		case RIGHT_SPACER:
-			len = snprintf(buf, size, "%-*s", width, tempbuf);
-			break;
-	}
+	len = spacer_copy(buf, size, tempbuf, std::max(0, std::min(len, size - 1)), width);
 	free(tempbuf);
 	return len;
 }
 
+/* The numbers of human_readable() and percent_print() are written digit pair by
+ * digit pair, they are printed far too often to go through printf. */
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* write v in decimal to out, which must have room for 20 digits; returns the
+ * number of digits */
+static int format_ull(char *out, unsigned long long v)
+{
+	char tmp[20];
+	char *p = tmp + sizeof tmp;
+	int len;
+
+	while (v >= 100) {
+		p -= 2;
+		memcpy(p, digit_pairs + (v % 100) * 2, 2);
+		v /= 100;
+	}
+	if (v >= 10) {
+		p -= 2;
+		memcpy(p, digit_pairs + v * 2, 2);
+	} else {
+		*--p = '0' + v;
+	}
+	len = tmp + sizeof tmp - p;
+	memcpy(out, p, len);
+	return len;
+}
+
+/* write f with precision decimals (at most 2) like printf("%.*f") does: the
+ * float times 100 is exact in a double, so rounding it to the nearest integer
+ * (ties to even) rounds the same way printf does */
+static int format_fixed(char *out, float f, int precision)
+{
+	static const unsigned scale[] = { 1, 10, 100 };
+	unsigned long long v;
+	int len = 0;
+
+	if (std::signbit(f)) {
+		out[len++] = '-';
+		f = -f;
+	}
+	v = (unsigned long long) std::nearbyint((double) f * scale[precision]);
+	len += format_ull(out + len, v / scale[precision]);
+	if (precision) {
+		unsigned frac = v % scale[precision];
+
+		out[len++] = '.';
+		if (precision == 2) {
+			memcpy(out + len, digit_pairs + frac * 2, 2);
+			len += 2;
+		} else {
+			out[len++] = '0' + frac;
+		}
+	}
+	return len;
+}
+
 /* print percentage values
  *
  * - i.e., unsigned values between 0 and 100
  * - respect the value of pad_percents */
 int percent_print(char *buf, int size, unsigned value)
 {
-	return spaced_print(buf, size, "%u", pad_percents.get(*state), value);
+	char tmp[24];
+
+	return spacer_copy(buf, size, tmp, format_ull(tmp, value), pad_percents.get(*state));
 }
 
 #if defined(__FreeBSD__)
@@ -716,58 +1382,75 @@ void human_readable(long long num, char *buf, int size)
 	float fnum;
 	int precision;
 	int width;
-	const char *format;
+	/* a sign, 20 digits, a dot, 2 decimals and a translated suffix */
+	char tmp[64];
+	int len;
 
 	/* Possibly just output as usual, for example for stdout usage */
 	if (not format_human_readable.get(*state)) {
-		spaced_print(buf, size, "%lld", 6, num);
+		len = 0;
+		if (num < 0)
+			tmp[len++] = '-';
+		len += format_ull(tmp + len, num < 0 ? -(unsigned long long) num : num);
+		spacer_copy(buf, size, tmp, len, 6);
 		return;
 	}
-	if (short_units.get(*state)) {
-		width = 5;
-		format = "%.*f%.1s";
-	} else {
-		width = 7;
-		format = "%.*f%-3s";
-	}
 
 	if (llabs(num) < 1000LL) {
-		spaced_print(buf, size, format, width, 0, (float)num, _(*suffix));
-		return;
-	}
+		fnum = num;
+		precision = 0;
+	} else {
+		while (llabs(num / 1024) >= 1000LL && **(suffix + 2)) {
+			num /= 1024;
+			suffix++;
+		}
 
-	while (llabs(num / 1024) >= 1000LL && **(suffix + 2)) {
-		num /= 1024;
 		suffix++;
+		fnum = num / 1024.0;
+
+		/* fnum should now be < 1000, so looks like 'AAA.BBBBB'
+		 *
+		 * The goal is to always have a significance of 3, by
+		 * adjusting the decimal part of the number. Sample output:
+		 *  123MiB
+		 * 23.4GiB
+		 * 5.12B
+		 * so the point of alignment resides between number and unit. The
+		 * upside of this is that there is minimal padding necessary, though
+		 * there should be a way to make alignment take place at the decimal
+		 * dot (then with fixed width decimal part).
+		 *
+		 * Note the repdigits below: when given a precision value, printf()
+		 * rounds the float to it, not just cuts off the remaining digits. So
+		 * e.g. 99.95 with a precision of 1 gets 100.0, which again should be
+		 * printed with a precision of 0. Yay. */
+
+		precision = 0;		/* print 100-999 without decimal part */
+		if (fnum < 99.95)
+			precision = 1;	/* print 10-99 with one decimal place */
+		if (fnum < 9.995)
+			precision = 2;	/* print 0-9 with two decimal places */
 	}
 
-	suffix++;
-	fnum = num / 1024.0;
-
-	/* fnum should now be < 1000, so looks like 'AAA.BBBBB'
-	 *
-	 * The goal is to always have a significance of 3, by
-	 * adjusting the decimal part of the number. Sample output:
-	 *  123MiB
-	 * 23.4GiB
-	 * 5.12B
-	 * so the point of alignment resides between number and unit. The
-	 * upside of this is that there is minimal padding necessary, though
-	 * there should be a way to make alignment take place at the decimal
-	 * dot (then with fixed width decimal part).
-	 *
-	 * Note the repdigits below: when given a precision value, printf()
-	 * rounds the float to it, not just cuts off the remaining digits. So
-	 * e.g. 99.95 with a precision of 1 gets 100.0, which again should be
-	 * printed with a precision of 0. Yay. */
-
-	precision = 0;		/* print 100-999 without decimal part */
-	if (fnum < 99.95)
-		precision = 1;	/* print 10-99 with one decimal place */
-	if (fnum < 9.995)
-		precision = 2;	/* print 0-9 with two decimal places */
-
-	spaced_print(buf, size, format, width, precision, fnum, _(*suffix));
+	len = format_fixed(tmp, fnum, precision);
+	const char *unit = _(*suffix);
+	int unit_len = strlen(unit);
+	if (short_units.get(*state)) {
+		/* "%.1s" */
+		width = 5;
+		unit_len = std::min(unit_len, 1);
+	} else {
+		/* "%-3s" */
+		width = 7;
+		unit_len = std::min(unit_len, (int) sizeof tmp - len - 3);
+	}
+	memcpy(tmp + len, unit, unit_len);
+	len += unit_len;
+	if (!short_units.get(*state)) {
+		for (; unit_len < 3; unit_len++)
+			tmp[len++] = ' ';
+	}
+	spacer_copy(buf, size, tmp, len, width);
 }
 
 /* global object list root element */
@@ -787,12 +1470,19 @@ long get_current_text_color(void)
 
 static void extract_variable_text(const char *p)
 {
+	free_alerts();
 	free_text_objects(&global_root_object);
+	clear_profile();
+	clear_evaluate_cache();
+	close_append_file();
+	json_values.clear();
+	json_last_values.clear();
 	free_and_zero(tmpstring1);
 	free_and_zero(tmpstring2);
-	free_and_zero(text_buffer);
+	free_text_buffer();
 
-	extract_variable_text_internal(&global_root_object, p);
+	extract_config_text(&global_root_object, p);
+	init_alerts();
 }
 
 void parse_conky_vars(struct text_object *root, const char *txt,
@@ -820,113 +1510,585 @@ void parse_conky_vars(struct text_object *root, const char *txt,
  * so we need to jump always. If we encounter an ENDIF, it's corresponding IF
  * or ELSE has not jumped, and there is nothing to do.
  */
-void generate_text_internal(char *p, int p_max_size, struct text_object root)
+static void json_record_number(size_t i, double v)
 {
-	struct text_object *obj;
-	size_t a;
+	char buf[32];
 
-	if(! p) return;
+	snprintf(buf, sizeof buf, "%g", v);
+	json_values[i] = buf;
+}
 
-#ifdef BUILD_ICONV
-	char *buff_in;
+static void json_record_text(size_t i, const char *s, size_t len)
+{
+	std::string &v = json_values[i];
 
-	buff_in = (char *)malloc(p_max_size);
-	memset(buff_in, 0, p_max_size);
-#endif /* BUILD_ICONV */
+	v.clear();
+	for (size_t k = 0; k < len; k++) {
+		/* the markers of specials mean nothing outside conky */
+		if (s[k] != SPECIAL_CHAR)
+			v += s[k];
+	}
+}
 
-	p[0] = 0;
-	obj = root.next;
-	while (obj && p_max_size > 0) {
-
-		/* check callbacks for existence and act accordingly */
-		if (obj->callbacks.print) {
-			(*obj->callbacks.print)(obj, p, p_max_size);
-		} else if (obj->callbacks.iftest) {
-			if (!(*obj->callbacks.iftest)(obj)) {
-				DBGP2("jumping");
-				if (obj->ifblock_next)
-					obj = obj->ifblock_next;
+static void json_append_string(std::string &out, const std::string &s)
+{
+	out += '"';
+	for (size_t k = 0; k < s.size(); k++) {
+		unsigned char c = s[k];
+
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (c == '\n') {
+			out += "\\n";
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof buf, "\\u%04x", c);
+			out += buf;
+		} else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+/* print the fields that changed since the last frame as one JSON object a
+ * line, all of them when the text itself changed */
+static void print_json_diff(void)
+{
+	bool all = json_values.size() != json_last_values.size();
+	std::string out;
+
+	for (size_t i = 0; i < json_values.size(); i++) {
+		if (!all && json_values[i] == json_last_values[i])
+			continue;
+		out += out.empty() ? '{' : ',';
+		char id[16];
+		snprintf(id, sizeof id, "\"%zu\":", i);
+		out += id;
+		json_append_string(out, json_values[i]);
+	}
+	json_last_values.swap(json_values);
+	if (out.empty())
+		return;
+	out += "}\n";
+	fputs(out.c_str(), stdout);
+	fflush(stdout);	/* output immediately, don't buffer */
+}
+
+/* what the object prints, or what one with the same memo printed in this
+ * frame */
+static void memo_print(const struct text_instr &in, char *p, int p_max_size)
+{
+	struct text_memo *memo = in.obj->memo;
+
+	if (memo && text_memo_get_text(memo, p, p_max_size))
+		return;
+	(*in.fn.print)(in.obj, p, p_max_size);
+	/* a text cut off here might not be where the others are */
+	if (memo && (int) strlen(p) + 1 < p_max_size)
+		text_memo_set_text(memo, p);
+}
+
+/* the same for the value of a meter or percentage */
+static double memo_value(const struct text_instr &in)
+{
+	struct text_memo *memo = in.obj->memo;
+	double v;
+
+	if (memo && text_memo_get_value(memo, &v))
+		return v;
+	if (in.op == TEXT_OP_PERCENTAGE)
+		v = (*in.fn.percentage)(in.obj);
+	else
+		v = (*in.fn.val)(in.obj);
+	if (memo)
+		text_memo_set_value(memo, v);
+	return v;
+}
+
+/*
+ * Generates program[begin, end) at p, with p_max_size left there. With buf, p
+ * points into *buf, which grows as needed (the frame's own text); without,
+ * the text is cut off at p_max_size (evaluated texts). Returns the end of the
+ * text. visit is false where the callbacks were visited already.
+ */
+static char *generate_range(const text_program &program, size_t begin, size_t end,
+		char *p, int p_max_size, char **buf, size_t *capacity, bool json, bool visit)
+{
+	size_t a;
+	size_t reserve = text_buffer_size.get(*state) + 1;
+
+	for (size_t i = begin; i < end && p_max_size > 0; i++) {
+		const struct text_instr &in = program[i];
+		struct profile_start start;
+		double v;
+
+		if (buf && (size_t) p_max_size < reserve) {
+			size_t used = p - *buf;
+
+			if (grow_buffer(buf, capacity, used + p_max_size + reserve)) {
+				p = *buf + used;
+				p_max_size = *capacity - used;
 			}
-		} else if (obj->callbacks.barval) {
-			new_bar(obj, p, p_max_size, (*obj->callbacks.barval)(obj));
-		} else if (obj->callbacks.gaugeval) {
-			new_gauge(obj, p, p_max_size, (*obj->callbacks.gaugeval)(obj));
+		}
+		if (in.cb && visit)
+			in.cb->visit();
+		if (profiling)
+			profile_begin(start);
+		switch (in.op) {
+			case TEXT_OP_PRINT:
+				memo_print(in, p, p_max_size);
+				break;
+			case TEXT_OP_IFTEST:
+				if (!(*in.fn.iftest)(in.obj)) {
+					DBGP2("jumping");
+					i = in.jump - 1;
+				}
+				if (profiling)
+					profile_end_object(in.obj, start);
+				/* nothing was printed */
+				continue;
+			case TEXT_OP_BARVAL:
+				v = memo_value(in);
+				new_bar(in.obj, p, p_max_size, v);
+				if (json) json_record_number(i, v);
+				break;
+			case TEXT_OP_GAUGEVAL:
+				v = memo_value(in);
+				new_gauge(in.obj, p, p_max_size, v);
+				if (json) json_record_number(i, v);
+				break;
 #ifdef BUILD_X11
-		} else if (obj->callbacks.graphval) {
-			new_graph(obj, p, p_max_size, (*obj->callbacks.graphval)(obj));
+			case TEXT_OP_GRAPHVAL:
+				v = memo_value(in);
+				new_graph(in.obj, p, p_max_size, v);
+				if (json) json_record_number(i, v);
+				break;
 #endif /* BUILD_X11 */
-		} else if (obj->callbacks.percentage) {
-			percent_print(p, p_max_size, (*obj->callbacks.percentage)(obj));
+			case TEXT_OP_PERCENTAGE:
+				percent_print(p, p_max_size, (uint8_t) memo_value(in));
+				break;
+			default:
+				continue;
 		}
+		if (profiling)
+			profile_end_object(in.obj, start);
 
 		a = strlen(p);
 #ifdef BUILD_ICONV
-		iconv_convert(&a, buff_in, p, p_max_size);
+		iconv_convert(&a, p, p_max_size);
 #endif /* BUILD_ICONV */
+		if (json && in.op == TEXT_OP_PRINT && in.obj->callbacks.value &&
+				!std::isnan(v = (*in.obj->callbacks.value)(in.obj)))
+			json_record_number(i, v);
+		else if (json && (in.op == TEXT_OP_PRINT || in.op == TEXT_OP_PERCENTAGE))
+			json_record_text(i, p, a);
 		p += a;
 		p_max_size -= a;
 		(*p) = 0;
+	}
+	return p;
+}
+
+/* a parallel chunk of the frame, generated into its own buffer */
+struct chunk_text {
+	char *buf;
+	size_t capacity;
+	size_t len;
+};
+
+/*
+ * The frame in chunks (see text_chunk): the parallel ones are generated on
+ * the update threads first, each into its own buffer, then the others in
+ * order on this one, with the parallel ones copied in between. Only the
+ * others make specials, so those stay in order.
+ */
+static void generate_chunks(const text_program &program, bool json)
+{
+	const std::vector<struct text_chunk> &chunks = program.chunks;
+	std::vector<size_t> parallel;
+	std::vector<struct chunk_text> texts(chunks.size());
+	size_t reserve = text_buffer_size.get(*state) + 1;
+	size_t used = 0;
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		if (!chunks[c].parallel)
+			continue;
+		parallel.push_back(c);
+		/* there are no ifblocks in them, so every object is reached */
+		for (size_t i = chunks[c].begin; i < chunks[c].end; i++) {
+			if (program[i].cb)
+				program[i].cb->visit();
+		}
+	}
+
+	conky::parallel_for(parallel.size(), [&](size_t n) {
+		const struct text_chunk &chunk = chunks[parallel[n]];
+		struct chunk_text &t = texts[parallel[n]];
+		char *end;
+
+		t.len = 0;
+		t.capacity = 0;
+		if (!(t.buf = (char *) malloc(reserve)))
+			return;
+		t.capacity = reserve;
+		t.buf[0] = 0;
+		end = generate_range(program, chunk.begin, chunk.end, t.buf, t.capacity,
+				&t.buf, &t.capacity, json, false);
+		t.len = end - t.buf;
+	});
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		char *p = text_buffer + used;
+
+		if (!chunks[c].parallel) {
+			p = generate_range(program, chunks[c].begin, chunks[c].end, p,
+					text_buffer_capacity - used, &text_buffer, &text_buffer_capacity,
+					json, true);
+			used = p - text_buffer;
+			continue;
+		}
+		if (texts[c].len && grow_text_buffer(used + texts[c].len + 1)) {
+			memcpy(text_buffer + used, texts[c].buf, texts[c].len + 1);
+			used += texts[c].len;
+		}
+		free(texts[c].buf);
+	}
+}
+
+void generate_text_internal(char *p, int p_max_size, struct text_object &root)
+{
+	if(! p) return;
 
-		obj = obj->next;
+	p[0] = 0;
+	const text_program &program = get_text_program(&root);
+	/* evaluated texts are part of the field that evaluates them */
+	bool json = &root == &global_root_object && out_to_json.get(*state);
+	if (json) {
+		json_values.resize(program.size());
+		for (size_t i = 0; i < json_values.size(); i++)
+			json_values[i].clear();
 	}
+	/* the frame's own text grows as needed, evaluated texts are cut off at
+	 * the size they're given */
+	if (p != text_buffer)
+		generate_range(program, 0, program.size(), p, p_max_size, NULL, NULL,
+				json, true);
+	else if (!program.chunks.empty() && !profiling)
+		generate_chunks(program, json);
+	else
+		generate_range(program, 0, program.size(), p, p_max_size, &text_buffer,
+				&text_buffer_capacity, json, true);
 #ifdef BUILD_X11
 	/* load any new fonts we may have had */
-	load_fonts(utf8_mode.get(*state));
+	update_fonts();
 #endif /* BUILD_X11 */
-#ifdef BUILD_ICONV
-	free(buff_in);
-#endif /* BUILD_ICONV */
+}
+
+/* The texts given to evaluate() are mostly the same from frame to frame, so
+ * the parsed objects of the most recently used ones are kept, along with
+ * their update callbacks. An entry is in use while its text is generated;
+ * that may evaluate other texts, and the entry must not go away under it. */
+namespace {
+	conky::range_config_setting<unsigned int> evaluate_cache_size("evaluate_cache_size",
+			0, std::numeric_limits<unsigned int>::max(), 64, false);
+
+	struct evaluate_entry {
+		std::string text;
+		struct text_object root;
+		int in_use;
+	};
+	typedef std::list<evaluate_entry> evaluate_lru;
+
+	evaluate_lru evaluate_cache;	/* most recently used first */
+	std::unordered_map<std::string, evaluate_lru::iterator> evaluate_index;
+}
+
+static void evaluate_cache_evict(size_t max)
+{
+	evaluate_lru::iterator i = evaluate_cache.end();
+
+	while (evaluate_cache.size() > max && i != evaluate_cache.begin()) {
+		--i;
+		if (i->in_use)
+			continue;
+		evaluate_index.erase(i->text);
+		free_text_objects(&i->root);
+		i = evaluate_cache.erase(i);
+	}
+}
+
+void clear_evaluate_cache(void)
+{
+	evaluate_cache_evict(0);
 }
 
 void evaluate(const char *text, char *p, int p_max_size)
 {
-	struct text_object subroot;
+	size_t max = evaluate_cache_size.get(*state);
+	evaluate_lru::iterator entry;
 
-	parse_conky_vars(&subroot, text, p, p_max_size);
-	DBGP2("evaluated '%s' to '%s'", text, p);
+	if (!max) {
+		struct text_object subroot;
 
-	free_text_objects(&subroot);
+		parse_conky_vars(&subroot, text, p, p_max_size);
+		DBGP2("evaluated '%s' to '%s'", text, p);
+
+		free_text_objects(&subroot);
+		return;
+	}
+
+	std::unordered_map<std::string, evaluate_lru::iterator>::iterator i =
+		evaluate_index.find(text);
+	if (i != evaluate_index.end()) {
+		entry = i->second;
+		evaluate_cache.splice(evaluate_cache.begin(), evaluate_cache, entry);
+		entry->in_use++;
+	} else {
+		evaluate_cache_evict(max - 1);
+		evaluate_cache.push_front(evaluate_entry());
+		entry = evaluate_cache.begin();
+		entry->text = text;
+		entry->in_use = 1;
+		evaluate_index[entry->text] = entry;
+		extract_variable_text_internal(&entry->root, text);
+	}
+
+	generate_text_internal(p, p_max_size, entry->root);
+	DBGP2("evaluated '%s' to '%s'", text, p);
+	entry->in_use--;
 }
 
 double current_update_time, next_update_time, last_update_time;
+static double next_sample_time;
+
+#ifdef BUILD_X11
+/* give the graphs a sample without generating the text, following the
+ * conditionals like generate_text_internal() */
+static void sample_graphs(struct text_object &root)
+{
+	const text_program &program = get_text_program(&root);
+
+	for (size_t i = 0; i < program.size(); i++) {
+		const struct text_instr &in = program[i];
+
+		if (in.op == TEXT_OP_IFTEST) {
+			if (!(*in.fn.iftest)(in.obj))
+				i = in.jump - 1;
+		} else if (in.op == TEXT_OP_GRAPHVAL) {
+			sample_graph(in.obj, (*in.fn.val)(in.obj));
+		}
+	}
+}
+#endif /* BUILD_X11 */
+
+/* how often to look whether the screen came back on, there is no event for it */
+#define BLANKED_POLL_INTERVAL 2.0
+
+/* when the interval got shorter than before, don't wait out the longer one */
+static void update_sooner(double before)
+{
+	double ui = active_update_interval();
+
+	if (ui < before)
+		next_update_time = std::min(next_update_time,
+				std::max(last_update_time + ui, get_time()));
+}
+
+/* pick the conditions active_update_interval() goes by */
+static void update_interval_policy(void)
+{
+	double before = active_update_interval();
+
+	if (update_interval_busy.get(*state) > 0) {
+		double load;
+
+		system_busy = getloadavg(&load, 1) == 1 && load > busy_load.get(*state) *
+			std::max(std::thread::hardware_concurrency(), 1u);
+	} else {
+		system_busy = false;
+	}
+#ifdef BUILD_X11
+	screen_blanked = out_to_x.get(*state) && update_interval_hidden.get(*state) > 0 &&
+		x11_screen_blanked();
+#endif /* BUILD_X11 */
+
+	update_sooner(before);
+}
+
+static bool sampling_between_updates(void)
+{
+	return active_sample_interval() < active_update_interval() && !update_pipelining.get(*state);
+}
+
+/* collect the data once more between two updates of the text */
+static void collect_samples(void)
+{
+	double si = active_sample_interval();
+
+	current_update_time = sample_tick(get_time());
+	{
+		profile_scope scope("update", &self_update_time);
+		sample_stuff();
+	}
+#ifdef BUILD_X11
+	if (out_to_x.get(*state))
+		sample_graphs(global_root_object);
+#endif /* BUILD_X11 */
+	last_update_time = current_update_time;
+
+	next_sample_time += si;
+	if (next_sample_time < get_time())
+		next_sample_time = get_time() + si;
+}
+
+/* Rates like those of cpu, downspeed, diskio and top need two samples, so
+ * the collectors take one at startup and the first update follows a moment
+ * later, instead of showing zeros until the second one an interval later.
+ * The callbacks take it while initialisation() sets up the window and loads
+ * the fonts, it waits for them before anything else looks at what they
+ * collect. */
+static bool priming, primed;
+
+static void start_prime_collectors(void)
+{
+	if (startup_prime_delay.get(*state) <= 0)
+		return;
+	current_update_time = sample_tick(get_time());
+	start_prime_stuff();
+	priming = true;
+}
+
+static void finish_prime_collectors(void)
+{
+	if (!priming)
+		return;
+	{
+		profile_scope scope("update", &self_update_time);
+		finish_prime_stuff();
+	}
+	priming = false;
+	primed = true;
+}
+
+/* the first update comes a moment after the sample, if there is one */
+static void prime_collectors(void)
+{
+	if (!primed)
+		return;
+	last_update_time = current_update_time;
+	next_update_time = get_time() + startup_prime_delay.get(*state);
+}
+
+/* when the main loop has something to do before the next update */
+static double next_wake_time(void)
+{
+	double deadline = conky::next_callback_deadline();
+
+	if (sampling_between_updates())
+		deadline = std::min(deadline, next_sample_time);
+	if (screen_blanked)
+		deadline = std::min(deadline, get_time() + BLANKED_POLL_INTERVAL);
+	return deadline;
+}
+
+static void run_between_updates(void)
+{
+	/* round like the callbacks do, wakeups never come exactly on time */
+	if (sampling_between_updates() &&
+			next_sample_time - get_time() < active_sample_interval() / 2)
+		collect_samples();
+	conky::run_background_callbacks();
+}
+
+/*
+ * With update_pipelining, the callbacks collecting the data of the next update
+ * start right after the text of this one is generated, so they run while the
+ * frame is drawn and the main loop waits. The next update then only has to
+ * wait for those that aren't done yet, the text it shows was collected an
+ * update earlier. Anything but generate_text() which looks at what the
+ * callbacks collect calls wait_for_update() first.
+ */
+static bool collecting;
+
+static void start_collection(void)
+{
+	current_update_time = sample_tick(get_time());
+	start_update_stuff();
+	collecting = true;
+}
+
+void wait_for_update(void)
+{
+	if (collecting) {
+		profile_scope scope("update", &self_update_time);
+		finish_update_stuff();
+		collecting = false;
+	}
+}
 
 static void generate_text(void)
 {
 	char *p;
-	unsigned int i, j, k;
+	unsigned int i, j;
 
+	TRACE(text__start);
+	tick_latency.record(get_time() - next_update_time);
 	special_count = 0;
 
-	/* update info */
+	/* update info, unless it was started after the last update */
 
-	current_update_time = get_time();
-
-	update_stuff();
+	if (!collecting) {
+		start_collection();
+	}
+	wait_for_update();
+#ifdef BUILD_HTTP
+	if (out_to_http.get(*state)) {
+		update_metrics();
+	}
+#endif /* BUILD_HTTP */
+#ifdef BUILD_SHM
+	update_shm();
+#endif /* BUILD_SHM */
+#ifdef BUILD_REMOTE
+	update_agent();
+#endif /* BUILD_REMOTE */
 
 	/* add things to the buffer */
 
 	/* generate text */
 
-	p = text_buffer;
-
-	generate_text_internal(p, max_user_text.get(*state), global_root_object);
+	{
+		profile_scope scope("text", &self_text_time);
+		generate_text_internal(text_buffer, text_buffer_capacity, global_root_object);
+	}
+	if (out_to_json.get(*state)) {
+		print_json_diff();
+	}
 	unsigned int mw = max_text_width.get(*state);
-	unsigned int tbs = text_buffer_size.get(*state);
 	if(mw > 0) {
-		for(i = 0, j = 0; p[i] != 0; i++) {
-			if(p[i] == '\n') j = 0;
+		size_t len = strlen(text_buffer);
+		/* at worst a newline after every mw characters */
+		size_t size = len + len / mw + 1;
+
+		if (wrap_buffer_capacity < size) {
+			free(wrap_buffer);
+			wrap_buffer = (char *) malloc(size);
+			wrap_buffer_capacity = size;
+		}
+		p = wrap_buffer;
+		for(i = 0, j = 0; text_buffer[i] != 0; i++) {
+			if(text_buffer[i] == '\n') j = 0;
 			else if(j == mw) {
-				k = i + strlen(p + i) + 1;
-				if(k < tbs) {
-					while(k != i) {
-						p[k] = p[k-1];
-						k--;
-					}
-					p[k] = '\n';
-					j = 0;
-				} else NORM_ERR("The end of the text_buffer is reached, increase \"text_buffer_size\"");
+				*p++ = '\n';
+				j = 1;
 			} else j++;
+			*p++ = text_buffer[i];
 		}
+		*p = 0;
+		std::swap(text_buffer, wrap_buffer);
+		std::swap(text_buffer_capacity, wrap_buffer_capacity);
 	}
 
 	if (stuff_in_uppercase.get(*state)) {
@@ -939,15 +2101,27 @@ static void generate_text(void)
 		}
 	}
 
+#ifdef BUILD_HTTP
+	if (out_to_http.get(*state) && http_events.get(*state)) {
+		publish_text_events(text_buffer);
+	}
+#endif /* BUILD_HTTP */
+
 	double ui = active_update_interval();
 	next_update_time += ui;
 	if (next_update_time < get_time()) {
 		next_update_time = get_time() + ui;
+		self_missed_updates++;
 	} else if (next_update_time > get_time() + ui) {
 		next_update_time = get_time() + ui;
 	}
 	last_update_time = current_update_time;
+	next_sample_time = current_update_time + active_sample_interval();
 	total_updates++;
+	if (update_pipelining.get(*state)) {
+		start_collection();
+	}
+	TRACE(text__done);
 }
 
 int get_string_width(const char *s)
@@ -965,7 +2139,7 @@ static inline int get_border_total()
 static int get_string_width_special(char *s, int special_index)
 {
 	char *p, *final;
-	special_t *current = specials;
+	special_t *current;
 	int idx = 1;
 	int width = 0;
 	long i;
@@ -979,10 +2153,7 @@ static int get_string_width_special(char *s, int special_index)
 	p = strndup(s, text_buffer_size.get(*state));
 	final = p;
 
-	for(i = 0; i < special_index; i++)
-		current = current->next;
-	for(i = 0; i < idx; i++)
-		current = current->next;
+	current = get_special(special_index + idx);
 
 	while (*p) {
 		if (*p == SPECIAL_CHAR) {
@@ -1037,6 +2208,84 @@ static int get_string_width_special(char *s, int special_index)
 	return width;
 }
 
+/* what the layout measured for the text following a special */
+struct special_layout {
+	int font;		/* selected_font the width was measured with */
+	int width;		/* -1 until measured */
+};
+
+/* get_string_width_special() of the ALIGNR and ALIGNC specials, measured once
+ * by text_size_updater() and replayed by every draw pass of the frame */
+static std::vector<special_layout> special_layouts;
+
+static void layout_special_width(char *s, int special_index)
+{
+	if (special_layouts.size() < (size_t) special_count) {
+		special_layout unknown = { 0, -1 };
+		special_layouts.resize(special_count, unknown);
+	}
+	special_layouts[special_index].font = selected_font;
+	special_layouts[special_index].width =
+		get_string_width_special(s, special_index);
+}
+
+static int special_width(char *s, int special_index)
+{
+	if ((size_t) special_index < special_layouts.size()) {
+		const special_layout &l = special_layouts[special_index];
+
+		if (l.width >= 0 && l.font == selected_font)
+			return l.width;
+	}
+	return get_string_width_special(s, special_index);
+}
+
+static inline unsigned long hash_bytes(unsigned long h, const void *p, size_t len)
+{
+	const unsigned char *c = (const unsigned char *) p;
+
+	while (len--) {
+		h = (h ^ *c++) * 16777619ul;
+	}
+	return h;
+}
+
+/* fold everything a special draws with into h */
+static unsigned long hash_special(unsigned long h, const struct special_t *current)
+{
+	h = hash_bytes(h, &current->type, sizeof(current->type));
+	h = hash_bytes(h, &current->height, sizeof(current->height));
+	h = hash_bytes(h, &current->width, sizeof(current->width));
+	h = hash_bytes(h, &current->arg, sizeof(current->arg));
+	h = hash_bytes(h, &current->scale, sizeof(current->scale));
+	h = hash_bytes(h, &current->show_scale, sizeof(current->show_scale));
+	h = hash_bytes(h, &current->scaled, sizeof(current->scaled));
+	h = hash_bytes(h, &current->first_colour, sizeof(current->first_colour));
+	h = hash_bytes(h, &current->last_colour, sizeof(current->last_colour));
+	h = hash_bytes(h, &current->font_added, sizeof(current->font_added));
+	h = hash_bytes(h, &current->tempgrad, sizeof(current->tempgrad));
+	if (current->graph) {
+		const struct graph_history *g = current->graph;
+		int n = std::min(g->width, g->allocated);
+
+		h = hash_bytes(h, &g->width, sizeof(g->width));
+		for (int j = 0; j < n; j++) {
+			float v = graph_value(g, j);
+			h = hash_bytes(h, &v, sizeof(v));
+		}
+	}
+	return h;
+}
+
+/* what text_size_updater() laid out on a line, relative to text_start_y */
+struct line_box {
+	unsigned long hash;
+	int y, height;
+};
+
+/* the lines of the current and of the previous layout */
+static std::vector<line_box> line_boxes, last_line_boxes;
+
 static int text_size_updater(char *s, int special_index);
 
 int last_font_height;
@@ -1046,11 +2295,16 @@ static void update_text_area(void)
 
 	if (not out_to_x.get(*state))
 		return;
-	/* update text size if it isn't fixed */
-#ifdef OWN_WINDOW
-	if (!fixed_size)
-#endif
+	profile_scope scope("layout", &self_layout_time);
+	TRACE(layout__start);
+	/* update text size if it isn't fixed, the lines are laid out anyway so
+	 * that changed ones can be repainted on their own */
 	{
+		int old_width = text_width, old_height = text_height;
+
+		last_line_boxes.swap(line_boxes);
+		line_boxes.clear();
+		special_layouts.clear();
 		text_width = minimum_width.get(*state);
 		text_height = 0;
 		last_font_height = font_height();
@@ -1063,6 +2317,15 @@ static void update_text_area(void)
 		if (text_width > mw && mw > 0) {
 			text_width = mw;
 		}
+#ifdef OWN_WINDOW
+		if (fixed_size) {
+			text_width = old_width;
+			text_height = old_height;
+		}
+#else
+		UNUSED(old_width);
+		UNUSED(old_height);
+#endif
 	}
 
 	alignment align = text_alignment.get(*state);
@@ -1128,6 +2391,7 @@ static void update_text_area(void)
 	}
 	/* update lua window globals */
 	llua_update_window_table(text_start_x, text_start_y, text_width, text_height);
+	TRACE(layout__done);
 }
 
 /* drawing stuff */
@@ -1143,13 +2407,13 @@ static int text_size_updater(char *s, int special_index)
 {
 	int w = 0;
 	char *p;
-	special_t *current = specials;
-
-	for(int i = 0; i < special_index; i++)
-		current = current->next;
+	special_t *current = get_special(special_index);
+	line_box box;
 
 	if (not out_to_x.get(*state))
 		return 0;
+	box.hash = hash_bytes(2166136261ul, s, strlen(s));
+	box.y = text_height;
 	/* get string widths and skip specials */
 	p = s;
 	while (*p) {
@@ -1157,6 +2421,7 @@ static int text_size_updater(char *s, int special_index)
 			*p = '\0';
 			w += get_string_width(s);
 			*p = SPECIAL_CHAR;
+			box.hash = hash_special(box.hash, current);
 
 			if (current->type == BAR
 					|| current->type == GAUGE
@@ -1189,6 +2454,8 @@ static int text_size_updater(char *s, int special_index)
 				if (font_height() > last_font_height) {
 					last_font_height = font_height();
 				}
+			} else if (current->type == ALIGNR || current->type == ALIGNC) {
+				layout_special_width(p + 1, special_index);
 			}
 
 			special_index++;
@@ -1209,6 +2476,8 @@ static int text_size_updater(char *s, int special_index)
 	}
 
 	text_height += last_font_height;
+	box.height = last_font_height;
+	line_boxes.push_back(box);
 	last_font_height = font_height();
 	return special_index;
 }
@@ -1227,7 +2496,7 @@ static inline void set_foreground_color(long c)
 #ifdef BUILD_ARGB
 		}
 #endif /* BUILD_ARGB */
-		XSetForeground(display, window.gc, current_color);
+		set_gc_foreground(current_color);
 	}
 #endif /* BUILD_X11 */
 #ifdef BUILD_NCURSES
@@ -1239,15 +2508,101 @@ static inline void set_foreground_color(long c)
 	return;
 }
 
-std::string string_replace_all(std::string original, std::string oldpart, std::string newpart, std::string::size_type start) {
-	std::string::size_type i = start;
-	int oldpartlen = oldpart.length();
-	while(1) {
-		i = original.find(oldpart, i);
-		if(i == std::string::npos) break;
-		original.replace(i, oldpartlen, newpart);
+#if defined(BUILD_X11) && defined(BUILD_XFT)
+/* glyphs drawn in xft_glyph_colour but not sent yet, a pass of draw_text()
+ * goes out as one request per colour change */
+static std::vector<XftGlyphFontSpec> xft_glyphs;
+static XftColor xft_glyph_colour;
+
+/* XQueryColor() answers, so drawing text doesn't wait for the server */
+static std::unordered_map<unsigned long, XColor> xft_colours;
+
+static void flush_xft_glyphs(void)
+{
+	if (xft_glyphs.empty()) {
+		return;
+	}
+	XftDrawGlyphFontSpec(window.xftdraw, &xft_glyph_colour, &xft_glyphs[0],
+			xft_glyphs.size());
+	xft_glyphs.clear();
+}
+
+static void queue_xft_string(const char *s, int x, int y)
+{
+	XftFont *font = fonts[selected_font].xftfont;
+	size_t len = strlen(s);
+	auto it = xft_colours.find(current_color);
+
+	if (it == xft_colours.end()) {
+		XColor c;
+
+		c.pixel = current_color;
+		// query color on custom colormap
+		XQueryColor(display, window.colourmap, &c);
+		it = xft_colours.insert(std::make_pair(current_color, c)).first;
+	}
+	if (!xft_glyphs.empty() && (xft_glyph_colour.pixel != it->second.pixel
+				|| xft_glyph_colour.color.alpha != fonts[selected_font].font_alpha)) {
+		flush_xft_glyphs();
+	}
+	xft_glyph_colour.pixel = it->second.pixel;
+	xft_glyph_colour.color.red = it->second.red;
+	xft_glyph_colour.color.green = it->second.green;
+	xft_glyph_colour.color.blue = it->second.blue;
+	xft_glyph_colour.color.alpha = fonts[selected_font].font_alpha;
+
+	/* the same glyphs and advances XftDrawString{8,Utf8}() would use */
+	while (len > 0) {
+		XftGlyphFontSpec g;
+		XGlyphInfo gi;
+		FcChar32 ucs4;
+		int n = 1;
+
+		if (utf8_mode.get(*state)) {
+			n = FcUtf8ToUcs4((const FcChar8 *) s, &ucs4, len);
+			if (n <= 0) {
+				break;
+			}
+		} else {
+			ucs4 = (unsigned char) *s;
+		}
+		g.font = font;
+		g.glyph = XftCharIndex(display, font, ucs4);
+		g.x = x;
+		g.y = y;
+		XftGlyphExtents(display, font, &g.glyph, 1, &gi);
+		x += gi.xOff;
+		xft_glyphs.push_back(g);
+		s += n;
+		len -= n;
+	}
+}
+#endif /* BUILD_X11 && BUILD_XFT */
+
+/* the lines of a frame for out_to_console and out_to_stderr, which go out
+ * with one write() at its end, so that a status bar reading a pipe gets the
+ * frame at once rather than line by line (and whole if it fits in PIPE_BUF) */
+static std::string stdout_frame, stderr_frame;
+
+static void write_frame(int fd, FILE *stream, std::string &frame)
+{
+	const char *p = frame.data();
+	size_t left = frame.size();
+
+	/* anything printed through stdio comes first */
+	fflush(stream);
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		p += n;
+		left -= n;
 	}
-	return original;
+	frame.clear();
 }
 
 static void draw_string(const char *s)
@@ -1262,13 +2617,13 @@ static void draw_string(const char *s)
 
 	width_of_s = get_string_width(s);
 	if (out_to_stdout.get(*state) && draw_mode == FG) {
-		printf("%s\n", s);
-		if (extra_newline.get(*state)) fputc('\n', stdout);
-		fflush(stdout);	/* output immediately, don't buffer */
+		stdout_frame.append(s);
+		stdout_frame += '\n';
+		if (extra_newline.get(*state)) stdout_frame += '\n';
 	}
 	if (out_to_stderr.get(*state) && draw_mode == FG) {
-		fprintf(stderr, "%s\n", s);
-		fflush(stderr);	/* output immediately, don't buffer */
+		stderr_frame.append(s);
+		stderr_frame += '\n';
 	}
 	if (draw_mode == FG && overwrite_fpointer) {
 		fprintf(overwrite_fpointer, "%s\n", s);
@@ -1283,11 +2638,7 @@ static void draw_string(const char *s)
 #endif
 #ifdef BUILD_HTTP
 	if (out_to_http.get(*state) && draw_mode == FG) {
-		std::string::size_type origlen = webpage.length();
-		webpage.append(s);
-		webpage = string_replace_all(webpage, "\n", "<br />", origlen);
-		webpage = string_replace_all(webpage, "  ", "&nbsp;&nbsp;", origlen);
-		webpage = string_replace_all(webpage, "&nbsp; ", "&nbsp;&nbsp;", origlen);
+		append_webpage_text(s);
 		webpage.append("<br />");
 	}
 #endif
@@ -1339,25 +2690,7 @@ static void draw_string(const char *s)
 	if (out_to_x.get(*state)) {
 #ifdef BUILD_XFT
 		if (use_xft.get(*state)) {
-			XColor c;
-			XftColor c2;
-
-			c.pixel = current_color;
-			// query color on custom colormap
-			XQueryColor(display, window.colourmap, &c);
-
-			c2.pixel = c.pixel;
-			c2.color.red = c.red;
-			c2.color.green = c.green;
-			c2.color.blue = c.blue;
-			c2.color.alpha = fonts[selected_font].font_alpha;
-			if (utf8_mode.get(*state)) {
-				XftDrawStringUtf8(window.xftdraw, &c2, fonts[selected_font].xftfont,
-					cur_x, cur_y, (const XftChar8 *) s, strlen(s));
-			} else {
-				XftDrawString8(window.xftdraw, &c2, fonts[selected_font].xftfont,
-					cur_x, cur_y, (const XftChar8 *) s, strlen(s));
-			}
+			queue_xft_string(s, cur_x, cur_y);
 		} else
 #endif
 		{
@@ -1375,6 +2708,47 @@ static void draw_string(const char *s)
 	memcpy(tmpstring1, s, tbs);
 }
 
+#ifdef BUILD_X11
+/* a column of a graph, collected so that a whole graph goes out as one
+ * XDrawSegments per colour instead of a request per column */
+struct graph_column {
+	unsigned long colour;
+	XSegment seg;
+};
+
+static std::vector<graph_column> graph_columns;
+static std::vector<XSegment> graph_segments;
+
+static bool graph_column_colour_less(const graph_column &a, const graph_column &b)
+{
+	return a.colour < b.colour;
+}
+
+static void draw_graph_columns(bool gradient)
+{
+	size_t i = 0;
+
+	if (gradient) {
+		std::stable_sort(graph_columns.begin(), graph_columns.end(),
+				graph_column_colour_less);
+	}
+	while (i < graph_columns.size()) {
+		unsigned long colour = graph_columns[i].colour;
+
+		graph_segments.clear();
+		for (; i < graph_columns.size() && (!gradient
+					|| graph_columns[i].colour == colour); i++) {
+			graph_segments.push_back(graph_columns[i].seg);
+		}
+		if (gradient) {
+			set_foreground_color(colour);
+		}
+		XDrawSegments(display, window.drawable, window.gc,
+				&graph_segments[0], graph_segments.size());
+	}
+}
+#endif /* BUILD_X11 */
+
 int draw_each_line_inner(char *s, int special_index, int last_special_applied)
 {
 #ifdef BUILD_X11
@@ -1410,9 +2784,7 @@ int draw_each_line_inner(char *s, int special_index, int last_special_applied)
 				s = p + 1;
 			}
 			/* draw special */
-			special_t *current = specials;
-			for(int i = 0; i < special_index; i++)
-				current = current->next;
+			special_t *current = get_special(special_index);
 			switch (current->type) {
 #ifdef BUILD_X11
 				case HORIZONTAL_LINE:
@@ -1552,11 +2924,11 @@ int draw_each_line_inner(char *s, int special_index, int last_special_applied)
 						by -= h / 2 - 1;
 					}
 					w = current->width;
-					if (w == 0) {
+					if (w == 0 && current->graph) {
 						w = text_start_x + text_width - cur_x - 1;
-						current->graph_width = MAX(w - 1, 0);
-						if (current->graph_width != current->graph_allocated) {
-							w = current->graph_allocated + 1;
+						current->graph->width = MAX(w - 1, 0);
+						if (current->graph->width != current->graph->allocated) {
+							w = current->graph->allocated + 1;
 						}
 
 					}
@@ -1573,53 +2945,58 @@ int draw_each_line_inner(char *s, int special_index, int last_special_applied)
 						CapButt, JoinMiter);
 
 					/* in case we don't have a graph yet */
-					if (current->graph) {
-						unsigned long *tmpcolour = 0;
+					if (current->graph && current->graph->allocated) {
+						const unsigned long *tmpcolour = 0;
 
 						if (current->last_colour != 0 || current->first_colour != 0) {
 							tmpcolour = do_gradient(w - 1,
 									current->last_colour, current->first_colour);
 						}
 						colour_idx = 0;
+						graph_columns.clear();
 						for (i = w - 2; i > -1; i--) {
-							if (current->last_colour != 0 || current->first_colour != 0) {
+							graph_column col;
+
+							col.colour = current_color;
+							if (tmpcolour) {
 								if (current->tempgrad) {
 #ifdef DEBUG_lol
 									assert(
-											(int)((float)(w - 2) - current->graph[j] *
+											(int)((float)(w - 2) - graph_value(current->graph, j) *
 												(w - 2) / (float)current->scale)
 											< w-1
 										  );
 									assert(
-											(int)((float)(w - 2) - current->graph[j] *
+											(int)((float)(w - 2) - graph_value(current->graph, j) *
 												(w - 2) / (float)current->scale)
 											> -1
 										  );
-									if (current->graph[j] == current->scale) {
+									if (graph_value(current->graph, j) == current->scale) {
 										assert(
-												(int)((float)(w - 2) - current->graph[j] *
+												(int)((float)(w - 2) - graph_value(current->graph, j) *
 													(w - 2) / (float)current->scale)
 												== 0
 											  );
 									}
 #endif /* DEBUG_lol */
-									set_foreground_color(tmpcolour[
+									col.colour = tmpcolour[
 											(int)((float)(w - 2) -
-												current->graph[j] * (w - 2) /
+												graph_value(current->graph, j) * (w - 2) /
 												std::max((float)current->scale, 1.0f))
-											]);
+											];
 								} else {
-									set_foreground_color(tmpcolour[colour_idx++]);
+									col.colour = tmpcolour[colour_idx++];
 								}
 							}
 							/* this is mugfugly, but it works */
-							XDrawLine(display, window.drawable, window.gc,
-									cur_x + i + 1, by + h, cur_x + i + 1,
-									round_to_int((double)by + h - current->graph[j] *
-										(h - 1) / current->scale));
+							col.seg.x1 = col.seg.x2 = cur_x + i + 1;
+							col.seg.y1 = by + h;
+							col.seg.y2 = round_to_int((double)by + h - graph_value(current->graph, j) *
+										(h - 1) / current->scale);
+							graph_columns.push_back(col);
 							++j;
 						}
-						free_and_zero(tmpcolour);
+						draw_graph_columns(tmpcolour != NULL);
 					}
 					if (h > cur_y_add
 							&& h > font_h) {
@@ -1759,7 +3136,7 @@ int draw_each_line_inner(char *s, int special_index, int last_special_applied)
 					/* TODO: add back in "+ window.border_inner_margin" to the end of
 					 * this line? */
 					int pos_x = text_start_x + text_width -
-						get_string_width_special(s, special_index);
+						special_width(s, special_index);
 
 					/* printf("pos_x %i text_start_x %i text_width %i cur_x %i "
 						"get_string_width(p) %i gap_x %i "
@@ -1776,7 +3153,7 @@ int draw_each_line_inner(char *s, int special_index, int last_special_applied)
 
 				case ALIGNC:
 				{
-					int pos_x = (text_width) / 2 - get_string_width_special(s,
+					int pos_x = (text_width) / 2 - special_width(s,
 							special_index) / 2 - (cur_x -
 								text_start_x);
 					/* int pos_x = text_start_x + text_width / 2 -
@@ -1892,29 +3269,44 @@ static void draw_text(void)
 	attron(COLOR_PAIR(COLOR_WHITE));
 #endif /* BUILD_NCURSES */
 	for_each_line(text_buffer, draw_line);
+#if defined(BUILD_X11) && defined(BUILD_XFT)
+	flush_xft_glyphs();
+#endif /* BUILD_X11 && BUILD_XFT */
+	if (!stdout_frame.empty()) {
+		write_frame(STDOUT_FILENO, stdout, stdout_frame);
+	}
+	if (!stderr_frame.empty()) {
+		write_frame(STDERR_FILENO, stderr, stderr_frame);
+	}
 #ifdef BUILD_HTTP
 	if (out_to_http.get(*state)) {
 		webpage.append(WEBPAGE_END);
+		publish_webpage();
 	}
 #endif
 }
 
 static void draw_stuff(void)
 {
+	profile_scope scope("draw", &self_draw_time);
+	TRACE(draw__start);
+
 #ifdef BUILD_IMLIB2
 	cimlib_render(text_start_x, text_start_y, window.width, window.height);
 #endif /* BUILD_IMLIB2 */
 	if (overwrite_file.get(*state).size()) {
-		overwrite_fpointer = fopen(overwrite_file.get(*state).c_str(), "w");
-		if(!overwrite_fpointer)
-			NORM_ERR("Cannot overwrite '%s'", overwrite_file.get(*state).c_str());
+		open_overwrite_file();
 	}
 	if (append_file.get(*state).size()) {
-		append_fpointer = fopen(append_file.get(*state).c_str(), "a");
-		if(!append_fpointer)
-			NORM_ERR("Cannot append to '%s'", append_file.get(*state).c_str());
+		open_append_file();
+	} else {
+		close_append_file();
 	}
 #ifdef BUILD_X11
+	/* the hooks may look at info */
+	if (llua_has_draw_hooks()) {
+		wait_for_update();
+	}
 	llua_draw_pre_hook();
 	if (out_to_x.get(*state)) {
 		selected_font = 0;
@@ -1966,13 +3358,12 @@ static void draw_stuff(void)
 #endif
 #endif /* BUILD_X11 && BUILD_XDBE */
 	if(overwrite_fpointer) {
-		fclose(overwrite_fpointer);
-		overwrite_fpointer = 0;
+		close_overwrite_file();
 	}
 	if (append_fpointer) {
-		fclose(append_fpointer);
-		append_fpointer = 0;
+		flush_append_file();
 	}
+	TRACE(draw__done);
 }
 
 #ifdef BUILD_X11
@@ -2002,6 +3393,119 @@ static void clear_text(int exposures)
 static int need_to_update;
 
 /* update_text() generates new text and clears old text area */
+#ifdef BUILD_X11
+/* hash of the last laid out frame, 0 means there is none */
+static unsigned long frame_hash;
+
+/* damage is collected and drawn at most this many times a second, 0 draws
+ * as soon as it comes in */
+static conky::range_config_setting<double> max_fps("max_fps", 0.0,
+		std::numeric_limits<double>::infinity(), 0.0, true);
+
+/* when the last frame was drawn, see next_frame_time() */
+static double last_frame_time;
+
+/* the earliest time the next frame may be drawn */
+static double next_frame_time(void)
+{
+	double fps = max_fps.get(*state);
+
+	return fps > 0 ? last_frame_time + 1.0 / fps : 0;
+}
+
+/* hash text_buffer and the specials of the frame, so an unchanged frame can
+ * skip the layout and the redraw */
+static unsigned long hash_frame(void)
+{
+	unsigned long h = hash_bytes(2166136261ul, text_buffer, strlen(text_buffer));
+	struct special_t *current = specials;
+
+	for (int i = 0; i < special_count && current; i++, current = current->next) {
+		h = hash_special(h, current);
+	}
+	return h ? h : 1;
+}
+
+/* the frame only goes to the window, so an unchanged one needs no redraw */
+static bool frame_is_x_only(void)
+{
+	return out_to_x.get(*state) && !out_to_stdout.get(*state)
+		&& !out_to_stderr.get(*state) && !out_to_ncurses.get(*state)
+#ifdef BUILD_HTTP
+		&& !out_to_http.get(*state)
+#endif /* BUILD_HTTP */
+		&& overwrite_file.get(*state).empty()
+		&& append_file.get(*state).empty() && !llua_has_draw_hooks();
+}
+
+/* the changed lines of a frame can be repainted on their own, nothing like
+ * images or lua hooks draws across them */
+static bool partial_repaint;
+
+/* clear what changed since the previous layout, which covered the area at
+ * old_x, old_y of old_width x old_height */
+static void damage_text(int old_x, int old_y, int old_width, int old_height)
+{
+	int border_total = get_border_total();
+	XRectangle r;
+	bool whole = !partial_repaint || old_x != text_start_x
+		|| old_y != text_start_y || old_width != text_width
+		|| old_height != text_height
+		|| line_boxes.size() != last_line_boxes.size();
+
+#ifdef BUILD_XDBE
+	/* XdbeBackground throws the whole back buffer away on every swap */
+	whole = whole || use_xdbe.get(*state);
+#endif
+
+	if (whole) {
+		if (partial_repaint && display && window.window) {
+			XClearArea(display, window.window, old_x - border_total,
+				old_y - border_total, old_width + 2*border_total,
+				old_height + 2*border_total, True);
+		}
+		clear_text(1);
+#if defined(BUILD_XDBE)
+		if (use_xdbe.get(*state)) {
+#else
+		if (use_xpmdb.get(*state)) {
+#endif
+			r.x = text_start_x - border_total;
+			r.y = text_start_y - border_total;
+			r.width = text_width + 2*border_total;
+			r.height = text_height + 2*border_total;
+			XUnionRectWithRegion(&r, x11_stuff.region, x11_stuff.region);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < line_boxes.size(); i++) {
+		const line_box &cur = line_boxes[i], &last = last_line_boxes[i];
+
+		if (cur.hash == last.hash && cur.y == last.y
+				&& cur.height == last.height) {
+			continue;
+		}
+		/* one pixel more on each side for shades and outlines */
+		r.x = text_start_x - border_total;
+		r.y = text_start_y + cur.y - 1;
+		r.width = text_width + 2*border_total;
+		r.height = cur.height + 2;
+#ifndef BUILD_XDBE
+		if (use_xpmdb.get(*state)) {
+			/* the back buffer is blank outside the last region, so drawing
+			 * and copying only the damaged lines is enough */
+			XUnionRectWithRegion(&r, x11_stuff.region, x11_stuff.region);
+		} else
+#endif
+		if (display && window.window) {
+			XClearArea(display, window.window, r.x, r.y, r.width, r.height,
+				True);
+		}
+	}
+}
+#endif /* BUILD_X11 */
+
 static void update_text(void)
 {
 #ifdef BUILD_IMLIB2
@@ -2009,8 +3513,23 @@ static void update_text(void)
 #endif /* BUILD_IMLIB2 */
 	generate_text();
 #ifdef BUILD_X11
-	if (out_to_x.get(*state))
-		clear_text(1);
+	if (out_to_x.get(*state)) {
+		unsigned long h = hash_frame();
+
+		if (h == frame_hash && frame_is_x_only()) {
+			llua_update_info(&info, active_update_interval());
+			return;
+		}
+		frame_hash = h;
+		partial_repaint = frame_is_x_only()
+#ifdef BUILD_IMLIB2
+			&& !cimlib_has_images()
+#endif /* BUILD_IMLIB2 */
+			;
+		/* with a partial repaint the old area is cleared by damage_text() */
+		if (!partial_repaint)
+			clear_text(1);
+	}
 #endif /* BUILD_X11 */
 	need_to_update = 1;
 	llua_update_info(&info, active_update_interval());
@@ -2018,8 +3537,90 @@ static void update_text(void)
 
 #ifdef HAVE_SYS_INOTIFY_H
 int inotify_fd = -1;
+static int inotify_config_wd = -1;
+/* set when inotify saw current_config change, the reload happens at the end
+ * of the main loop iteration */
+static bool config_modified = false;
+
+static void read_inotify_events(int events)
+{
+#define INOTIFY_EVENT_SIZE  (sizeof(struct inotify_event))
+#define INOTIFY_BUF_LEN     (20 * (INOTIFY_EVENT_SIZE + 16)) + 1
+	char inotify_buff[INOTIFY_BUF_LEN];
+	int len, idx = 0;
+
+	(void)events;
+	len = read(inotify_fd, inotify_buff, INOTIFY_BUF_LEN - 1);
+	while (len > 0 && idx < len) {
+		struct inotify_event *ev = (struct inotify_event *) &inotify_buff[idx];
+		if (inotify_config_wd != -1 && ev->wd == inotify_config_wd
+				&& (ev->mask & IN_MODIFY || ev->mask & IN_IGNORED)) {
+			/* current_config should be reloaded */
+			config_modified = true;
+			if (ev->mask & IN_IGNORED) {
+				/* for some reason we get IN_IGNORED here
+				 * sometimes, so we need to re-add the watch */
+				inotify_config_wd = inotify_add_watch(inotify_fd,
+						current_config.c_str(),
+						IN_MODIFY);
+			}
+		} else {
+			llua_inotify_query(ev->wd, ev->mask);
+		}
+		idx += INOTIFY_EVENT_SIZE + ev->len;
+	}
+}
+
+static void close_inotify(void)
+{
+	if (inotify_fd != -1) {
+		conky::unwatch_fd(inotify_fd);
+		inotify_rm_watch(inotify_fd, inotify_config_wd);
+		close(inotify_fd);
+		inotify_fd = inotify_config_wd = -1;
+	}
+}
 #endif
 
+/* set by the handler of the wake fds, which is all they do */
+static bool woken = false;
+
+static void wake_up(int events)
+{
+	(void)events;
+	woken = true;
+}
+
+void add_wake_fd(int fd)
+{
+	conky::watch_fd(fd, POLLPRI, wake_up);
+}
+
+void remove_wake_fd(int fd)
+{
+	conky::unwatch_fd(fd);
+}
+
+/* waits up to t seconds for the watched fds, returns what wait_for_fds()
+ * returned and sets *wake if a wake fd was among them */
+static int wait_for_fds(double t, bool *wake)
+{
+	int n;
+
+	woken = false;
+	n = conky::wait_for_fds(t);
+	*wake = woken;
+	return n;
+}
+
+/* sleeps for t seconds, returns true if a watched fd cut it short */
+static bool sleep_unless_woken(double t)
+{
+	bool wake;
+
+	return wait_for_fds(t, &wake) > 0;
+}
+
 static void main_loop(void)
 {
 	int terminate = 0;
@@ -2027,12 +3628,10 @@ static void main_loop(void)
 	sigset_t newmask, oldmask;
 #endif
 	double t;
-#ifdef HAVE_SYS_INOTIFY_H
-	int inotify_config_wd = -1;
-#define INOTIFY_EVENT_SIZE  (sizeof(struct inotify_event))
-#define INOTIFY_BUF_LEN     (20 * (INOTIFY_EVENT_SIZE + 16)) + 1
-	char inotify_buff[INOTIFY_BUF_LEN];
-#endif /* HAVE_SYS_INOTIFY_H */
+#ifdef BUILD_X11
+	int x_fd = -1;
+	unsigned long first_x_request = display ? NextRequest(display) : 0;
+#endif /* BUILD_X11 */
 
 
 #ifdef SIGNAL_BLOCKING
@@ -2040,10 +3639,19 @@ static void main_loop(void)
 	sigaddset(&newmask, SIGINT);
 	sigaddset(&newmask, SIGTERM);
 	sigaddset(&newmask, SIGUSR1);
+	sigaddset(&newmask, SIGUSR2);
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+	if (inotify_fd != -1)
+		conky::watch_fd(inotify_fd, POLLIN, read_inotify_events);
+#endif /* HAVE_SYS_INOTIFY_H */
+
 	last_update_time = 0.0;
 	next_update_time = get_time();
+	prime_collectors();
+	/* the first sample comes after the first update */
+	next_sample_time = std::numeric_limits<double>::infinity();
 	info.looped = 0;
 	while (terminate == 0
 			&& (total_run_times.get(*state) == 0 || info.looped < total_run_times.get(*state))) {
@@ -2053,6 +3661,7 @@ static void main_loop(void)
 			get_battery_short_status(buf, 64, "BAT0");
 			on_battery = (buf[0] == 'D');
 		}
+		update_interval_policy();
 		info.looped++;
 
 #ifdef SIGNAL_BLOCKING
@@ -2069,26 +3678,47 @@ static void main_loop(void)
 			/* wait for X event or timeout */
 
 			if (!XPending(display)) {
-				fd_set fdsr;
-				struct timeval tv;
+				bool woken_up;
 				int s;
-				t = next_update_time - get_time();
+				double deadline = next_wake_time();
+				double wake = std::min(next_update_time, deadline);
+				bool frame_wake = false;
+
+				/* wake up for damage that is waiting for its frame */
+				if (!XEmptyRegion(x11_stuff.region)
+						&& next_frame_time() < wake) {
+					wake = next_frame_time();
+					frame_wake = true;
+				}
+				llua_gc_idle(wake);
+				self_malloc_idle(wake);
+				t = wake - get_time();
 
 				t = std::min(std::max(t, 0.0), active_update_interval());
 
-				tv.tv_sec = (long) t;
-				tv.tv_usec = (long) (t * 1000000) % 1000000;
-				FD_ZERO(&fdsr);
-				FD_SET(ConnectionNumber(display), &fdsr);
+				/* the display is opened again by some reloads */
+				if (x_fd != ConnectionNumber(display)) {
+					if (x_fd != -1)
+						conky::unwatch_fd(x_fd);
+					x_fd = ConnectionNumber(display);
+					/* the events are read by XPending() */
+					conky::watch_fd(x_fd, POLLIN, [](int) {});
+				}
 
-				s = select(ConnectionNumber(display) + 1, &fdsr, 0, 0, &tv);
+				s = wait_for_fds(t, &woken_up);
 				if (s == -1) {
 					if (errno != EINTR) {
-						NORM_ERR("can't select(): %s", strerror(errno));
+						NORM_ERR("can't wait for events: %s", strerror(errno));
 					}
 				} else {
 					/* timeout */
-					if (s == 0) {
+					if (s == 0 && !frame_wake) {
+						if (deadline < next_update_time) {
+							run_between_updates();
+						} else {
+							update_text();
+						}
+					} else if (s > 0 && woken_up) {
 						update_text();
 					}
 				}
@@ -2098,6 +3728,8 @@ static void main_loop(void)
 #ifdef OWN_WINDOW
 				int wx = window.x, wy = window.y;
 #endif
+				int tx = text_start_x, ty = text_start_y;
+				int tw = text_width, th = text_height;
 
 				need_to_update = 0;
 				selected_font = 0;
@@ -2122,20 +3754,10 @@ static void main_loop(void)
 						/* swap buffers */
 						xdbe_swap_buffers();
 #else
-						if (use_xpmdb.get(*state)) {
-
-							XFreePixmap(display, window.back_buffer);
-							window.back_buffer = XCreatePixmap(display,
-								window.window, window.width, window.height, DefaultDepth(display, screen));
-						
-							if (window.back_buffer != None) {
-								window.drawable = window.back_buffer;
-							} else {
-								// this is probably reallllly bad
-								NORM_ERR("Failed to allocate back buffer");
-							}
-							XSetForeground(display, window.gc, 0);
-							XFillRectangle(display, window.drawable, window.gc, 0, 0, window.width, window.height);
+						if (use_xpmdb.get(*state)
+								&& !xpmdb_fit_back_buffer()) {
+							// this is probably reallllly bad
+							NORM_ERR("Failed to allocate back buffer");
 						}
 #endif
 
@@ -2191,22 +3813,7 @@ static void main_loop(void)
 				}
 #endif
 
-				clear_text(1);
-
-#if defined(BUILD_XDBE)
-				if (use_xdbe.get(*state)) {
-#else
-				if (use_xpmdb.get(*state)) {
-#endif
-					XRectangle r;
-					int border_total = get_border_total();
-
-					r.x = text_start_x - border_total;
-					r.y = text_start_y - border_total;
-					r.width = text_width + 2*border_total;
-					r.height = text_height + 2*border_total;
-					XUnionRectWithRegion(&r, x11_stuff.region, x11_stuff.region);
-				}
+				damage_text(tx, ty, tw, th);
 			}
 
 			/* handle X events */
@@ -2226,6 +3833,15 @@ static void main_loop(void)
 						break;
 					}
 
+					case VisibilityNotify:
+					{
+						double before = active_update_interval();
+
+						window_obscured = ev.xvisibility.state == VisibilityFullyObscured;
+						update_sooner(before);
+						break;
+					}
+
 					case PropertyNotify:
 					{
 						if ( ev.xproperty.state == PropertyNewValue ) {
@@ -2344,6 +3960,8 @@ static void main_loop(void)
 				}
 			}
 
+			refresh_x11_desktop_info(display);
+
 #ifdef BUILD_XDAMAGE
 			XDamageSubtract(display, x11_stuff.damage, x11_stuff.region2, None);
 			XFixesSetRegion(display, x11_stuff.region2, 0, 0);
@@ -2354,9 +3972,13 @@ static void main_loop(void)
 			 * XdbeBackground to XdbeSwapBuffers. That means that if we're
 			 * using XDBE, we need to redraw the text even if it wasn't part of
 			 * the exposed area. OTOH, if we're not going to call draw_stuff at
-			 * all, then no swap happens and we can safely do nothing. */
+			 * all, then no swap happens and we can safely do nothing.
+			 * Damage that comes in faster than max_fps stays in the region
+			 * and is drawn with the next frame. */
 
-			if (!XEmptyRegion(x11_stuff.region)) {
+			if (!XEmptyRegion(x11_stuff.region)
+					&& get_time() >= next_frame_time()) {
+				last_frame_time = get_time();
 #if defined(BUILD_XDBE)
 				if (use_xdbe.get(*state)) {
 #else
@@ -2383,14 +4005,29 @@ static void main_loop(void)
 			}
 		} else {
 #endif /* BUILD_X11 */
-			t = (next_update_time - get_time()) * 1000000;
-			if(t > 0) usleep((useconds_t)t);
+			for (;;) {
+				double deadline = next_wake_time();
+
+				llua_gc_idle(std::min(next_update_time, deadline));
+				self_malloc_idle(std::min(next_update_time, deadline));
+				t = std::min(next_update_time, deadline) - get_time();
+				if (t > 0 && sleep_unless_woken(t)) {
+					break;
+				}
+				if (deadline >= next_update_time) {
+					break;
+				}
+				run_between_updates();
+			}
 			update_text();
 			draw_stuff();
 #ifdef BUILD_NCURSES
 			if(out_to_ncurses.get(*state)) {
+				/* erase() only blanks the next frame in memory, so refresh()
+				 * sends just the cells that changed; clear() would make it
+				 * repaint the whole terminal */
 				refresh();
-				clear();
+				erase();
 			}
 #endif
 #ifdef BUILD_X11
@@ -2408,7 +4045,10 @@ static void main_loop(void)
 			case SIGHUP:
 			case SIGUSR1:
 				NORM_ERR("received SIGHUP or SIGUSR1. reloading the config file.");
-				reload_config();
+				reload_config(false);
+				break;
+			case SIGUSR2:
+				print_latency_report();
 				break;
 			case SIGINT:
 			case SIGTERM:
@@ -2444,79 +4084,55 @@ static void main_loop(void)
 					current_config.c_str(),
 					IN_MODIFY);
 		}
-		if (!disable_auto_reload.get(*state) && inotify_fd != -1
-						&& inotify_config_wd != -1 && !current_config.empty()) {
-			int len = 0, idx = 0;
-			fd_set descriptors;
-			struct timeval time_to_wait;
-
-			FD_ZERO(&descriptors);
-			FD_SET(inotify_fd, &descriptors);
-
-			time_to_wait.tv_sec = time_to_wait.tv_usec = 0;
-
-			select(inotify_fd + 1, &descriptors, NULL, NULL, &time_to_wait);
-			if (FD_ISSET(inotify_fd, &descriptors)) {
-				/* process inotify events */
-				len = read(inotify_fd, inotify_buff, INOTIFY_BUF_LEN - 1);
-				inotify_buff[len] = 0;
-				while (len > 0 && idx < len) {
-					struct inotify_event *ev = (struct inotify_event *) &inotify_buff[idx];
-					if (ev->wd == inotify_config_wd && (ev->mask & IN_MODIFY || ev->mask & IN_IGNORED)) {
-						/* current_config should be reloaded */
-						NORM_ERR("'%s' modified, reloading...", current_config.c_str());
-						reload_config();
-						if (ev->mask & IN_IGNORED) {
-							/* for some reason we get IN_IGNORED here
-							 * sometimes, so we need to re-add the watch */
-							inotify_config_wd = inotify_add_watch(inotify_fd,
-									current_config.c_str(),
-									IN_MODIFY);
-						}
-						break;
-					}
-					else {
-						llua_inotify_query(ev->wd, ev->mask);
-					}
-					idx += INOTIFY_EVENT_SIZE + ev->len;
-				}
-			}
+		if (!disable_auto_reload.get(*state) && config_modified) {
+			config_modified = false;
+			NORM_ERR("'%s' modified, reloading...", current_config.c_str());
+			reload_config(true);
 		} else if (disable_auto_reload.get(*state) && inotify_fd != -1) {
-			inotify_rm_watch(inotify_fd, inotify_config_wd);
-			close(inotify_fd);
-			inotify_fd = inotify_config_wd = -1;
+			close_inotify();
 		}
 #endif /* HAVE_SYS_INOTIFY_H */
 
 		llua_update_info(&info, active_update_interval());
 		g_signal_pending = 0;
 	}
+	profile_frames = info.looped;
+#ifdef BUILD_X11
+	if (display)
+		profile_x_requests = NextRequest(display) - first_x_request;
+#endif /* BUILD_X11 */
 	clean_up(NULL, NULL);
 
+#ifdef BUILD_X11
+	if (x_fd != -1)
+		conky::unwatch_fd(x_fd);
+#endif /* BUILD_X11 */
 #ifdef HAVE_SYS_INOTIFY_H
-	if (inotify_fd != -1) {
-		inotify_rm_watch(inotify_fd, inotify_config_wd);
-		close(inotify_fd);
-		inotify_fd = inotify_config_wd = -1;
-	}
+	close_inotify();
 #endif /* HAVE_SYS_INOTIFY_H */
 }
 
 void initialisation(int argc, char** argv);
 
-	/* reload the config file */
-static void reload_config(void)
+/* reload the config file, waiting a moment first for whoever is still writing
+ * it if settle is set. Callbacks stay registered across the reload, so the ones
+ * the new config still uses keep running, and graphs keep their samples. */
+static void reload_config(bool settle)
 {
 	struct stat sb;
 	if (stat(current_config.c_str(), &sb) || (!S_ISREG(sb.st_mode) && !S_ISLNK(sb.st_mode))) {
 		NORM_ERR(_("Config file '%s' is gone, continuing with config from memory.\nIf you recreate this file sent me a SIGUSR1 to tell me about it. ( kill -s USR1 %d )"), current_config.c_str(), getpid());
 		return;
 	}
+	wait_for_update();
+	keep_graph_histories();
 	clean_up(NULL, NULL);
 	state.reset(new lua::state);
 	conky::export_symbols(*state);
-	sleep(1); /* slight pause */
+	if (settle)
+		sleep(1); /* slight pause */
 	initialisation(argc_copy, argv_copy);
+	forget_graph_histories();
 }
 
 #ifdef BUILD_X11
@@ -2531,6 +4147,10 @@ void clean_up_x11(void)
 	}
 	destroy_window();
 	free_fonts(utf8_mode.get(*state));
+	text_width_caches.clear();
+#ifdef BUILD_XFT
+	xft_colours.clear();
+#endif /* BUILD_XFT */
 	if(x11_stuff.region) {
 		XDestroyRegion(x11_stuff.region);
 		x11_stuff.region = NULL;
@@ -2538,16 +4158,6 @@ void clean_up_x11(void)
 }
 #endif
 
-void free_specials(special_t *&current) {
-	if (current) {
-		free_specials(current->next);
-		if(current->type == GRAPH)
-			free(current->graph);
-		delete current;
-		current = NULL;
-	}
-}
-
 void clean_up_without_threads(void *memtofree1, void* memtofree2)
 {
 	free_and_zero(memtofree1);
@@ -2559,6 +4169,10 @@ void clean_up_without_threads(void *memtofree1, void* memtofree2)
 		clean_up_x11();
 	else
 		fonts.clear();	//in set_default_configurations a font is set but not loaded
+	frame_hash = 0;
+	line_boxes.clear();
+	last_line_boxes.clear();
+	special_layouts.clear();
 #endif /* BUILD_X11 */
 
 	if (info.first_process) {
@@ -2566,10 +4180,25 @@ void clean_up_without_threads(void *memtofree1, void* memtofree2)
 		info.first_process = NULL;
 	}
 
+	free_alerts();
 	free_text_objects(&global_root_object);
+	clear_history();
+	clear_evaluate_cache();
+	json_values.clear();
+	json_last_values.clear();
+#ifdef BUILD_HTTP
+	clear_metrics();
+#endif /* BUILD_HTTP */
+#ifdef BUILD_SHM
+	clear_shm();
+#endif /* BUILD_SHM */
+#ifdef BUILD_REMOTE
+	clear_agent();
+#endif /* BUILD_REMOTE */
+	free_top_lists();
 	free_and_zero(tmpstring1);
 	free_and_zero(tmpstring2);
-	free_and_zero(text_buffer);
+	free_text_buffer();
 	free_and_zero(global_text);
 
 #ifdef BUILD_PORT_MONITORS
@@ -2580,7 +4209,8 @@ void clean_up_without_threads(void *memtofree1, void* memtofree2)
 	xmlCleanupParser();
 #endif
 
-	free_specials(specials);
+	clear_specials();
+	close_exec_shell();
 
 	clear_net_stats();
 	clear_diskio_stats();
@@ -2607,6 +4237,7 @@ static void set_default_configurations(void)
 	top_io = 0;
 #endif
 	top_running = 0;
+	top_group = 0;
 #ifdef BUILD_XMMS2
 	info.xmms2.artist = NULL;
 	info.xmms2.album = NULL;
@@ -2631,8 +4262,11 @@ static void set_default_configurations(void)
 static void X11_create_window(void)
 {
 	if (out_to_x.get(*state)) {
+#ifdef BUILD_XFT
+		finish_font_warmup();
+#endif /* BUILD_XFT */
 		setup_fonts();
-		load_fonts(utf8_mode.get(*state));
+		update_fonts();
 		update_text_area();	/* to position text/window on screen */
 
 #ifdef OWN_WINDOW
@@ -2746,7 +4380,7 @@ static void print_help(const char *prog_name) {
 			"   -v, --version             version\n"
 			"   -q, --quiet               quiet mode\n"
 			"   -D, --debug               increase debugging output, ie. -DD for more debugging\n"
-			"   -c, --config=FILE         config file to load\n"
+			"   -c, --config=FILE         config file to load, repeat to run several\n"
 #ifdef BUILD_BUILTIN_CONFIG
 			"   -C, --print-config        print the builtin default config to stdout\n"
 			"                             e.g. 'conky -C > ~/.conkyrc' will create a new default config\n"
@@ -2765,10 +4399,16 @@ static void print_help(const char *prog_name) {
 			"   -x X                      x position\n"
 			"   -y Y                      y position\n"
 #endif /* BUILD_X11 */
+#ifdef BUILD_REMOTE
+			"   -A, --agent=PORT          headless, serve what is collected to ${remote} on PORT\n"
+#endif
 			"   -t, --text=TEXT           text to render, remember single quotes, like -t '$uptime'\n"
 			"   -u, --interval=SECS       update interval\n"
 			"   -i COUNT                  number of times to update " PACKAGE_NAME " (and quit)\n"
-			"   -p, --pause=SECS          pause for SECS seconds at startup before doing anything\n",
+			"   -p, --pause=SECS          pause for SECS seconds at startup before doing anything\n"
+			"   -R, --record=FILE         record what is read from /proc on each update to FILE\n"
+			"   -P, --replay=FILE         use the updates recorded in FILE instead of /proc\n"
+			"   -F, --profile             measure objects, callbacks and drawing, report on exit\n",
 			prog_name
 	);
 }
@@ -2794,6 +4434,10 @@ static const char *getopt_string = "vVqdDSs:t:u:i:hc:p:"
 #ifdef BUILD_BUILTIN_CONFIG
 	"C"
 #endif
+#ifdef BUILD_REMOTE
+	"A:"
+#endif
+	"R:P:F"
 	;
 
 static const struct option longopts[] = {
@@ -2819,6 +4463,12 @@ static const struct option longopts[] = {
 	{ "text", 1, NULL, 't' },
 	{ "interval", 1, NULL, 'u' },
 	{ "pause", 1, NULL, 'p' },
+#ifdef BUILD_REMOTE
+	{ "agent", 1, NULL, 'A' },
+#endif
+	{ "record", 1, NULL, 'R' },
+	{ "replay", 1, NULL, 'P' },
+	{ "profile", 0, NULL, 'F' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -2853,6 +4503,58 @@ void set_current_config() {
 		current_config = "/dev/stdin";
 }
 
+/* Every config after the first -c runs in a child of its own. With BUILD_SHM
+ * the first config publishes what it collects and the children only read
+ * that, so /proc is scanned once however many windows there are. */
+static std::vector<std::string> extra_configs;
+static std::vector<pid_t> config_children;
+static bool config_child = false;
+#ifdef BUILD_SHM
+static std::string config_shm_name;
+#endif /* BUILD_SHM */
+
+static void start_config_children(void)
+{
+	if (extra_configs.empty())
+		return;
+#ifdef BUILD_SHM
+	config_shm_name = "/conky-" + std::to_string(getpid());
+#else
+	NORM_ERR("built without BUILD_SHM, every config collects its own values");
+#endif /* BUILD_SHM */
+	for (size_t i = 0; i < extra_configs.size(); i++) {
+		pid_t pid = fork();
+
+		if (pid == -1) {
+			NORM_ERR("can't fork() for '%s': %s", extra_configs[i].c_str(),
+					strerror(errno));
+		} else if (pid == 0) {
+			current_config = extra_configs[i];
+			config_child = true;
+			config_children.clear();
+			break;
+		} else {
+			config_children.push_back(pid);
+		}
+	}
+	extra_configs.clear();
+}
+
+static void stop_config_children(void)
+{
+	if (config_child)
+		return;
+	for (size_t i = 0; i < config_children.size(); i++)
+		kill(config_children[i], SIGTERM);
+	config_children.clear();
+#ifdef BUILD_SHM
+	if (!config_shm_name.empty()) {
+		shm_unlink(config_shm_name.c_str());
+		config_shm_name.clear();
+	}
+#endif /* BUILD_SHM */
+}
+
 void initialisation(int argc, char **argv) {
 	struct sigaction act, oact;
 
@@ -2861,6 +4563,15 @@ void initialisation(int argc, char **argv) {
 	set_current_config();
 	load_config_file();
 
+#ifdef BUILD_SHM
+	if (!config_shm_name.empty()) {
+		state->pushstring(config_shm_name.c_str());
+		shm_name.lua_set(*state);
+		state->pushboolean(config_child);
+		shm_reader.lua_set(*state);
+	}
+#endif /* BUILD_SHM */
+
 	/* handle other command line arguments */
 
 	reset_optind();
@@ -2924,6 +4635,18 @@ void initialisation(int argc, char **argv) {
 				convert_escapes(global_text);
 				break;
 
+#ifdef BUILD_REMOTE
+			case 'A':
+				state->pushinteger(strtol(optarg, &conv_end, 10));
+				if(*conv_end != 0) { CRIT_ERR(NULL, NULL, "'%s' is a wrong agent port", optarg); }
+				agent_port.lua_set(*state);
+#ifdef BUILD_X11
+				state->pushboolean(false);
+				out_to_x.lua_set(*state);
+#endif /* BUILD_X11 */
+				break;
+#endif /* BUILD_REMOTE */
+
 			case 'u':
 				state->pushinteger(strtol(optarg, &conv_end, 10));
 				if(*conv_end != 0) { CRIT_ERR(NULL, NULL, "'%s' is a wrong update-interval", optarg); }
@@ -2961,19 +4684,30 @@ void initialisation(int argc, char **argv) {
 	}
 
 	conky::set_config_settings(*state);
+	self_malloc_setup();
 
 #ifdef BUILD_X11
 	if(out_to_x.get(*state)) {
 		current_text_color = default_color.get(*state);
 	}
 #endif
+#ifdef BUILD_XFT
+	/* while the text is parsed */
+	start_font_warmup();
+#endif /* BUILD_XFT */
 
 	/* generate text and get initial size */
 	extract_variable_text(global_text);
 	free_and_zero(global_text);
 	/* fork */
 	if (fork_to_background.get(*state) && first_pass) {
-		int pid = fork();
+		int pid;
+
+#ifdef BUILD_XFT
+		/* the thread wouldn't be there in the child */
+		finish_font_warmup();
+#endif /* BUILD_XFT */
+		pid = fork();
 
 		switch (pid) {
 			case -1:
@@ -2997,16 +4731,19 @@ void initialisation(int argc, char **argv) {
 		}
 	}
 
-	text_buffer = (char*)malloc(max_user_text.get(*state));
-	memset(text_buffer, 0, max_user_text.get(*state));
+	alloc_text_buffer();
 	tmpstring1 = (char*)malloc(text_buffer_size.get(*state));
 	memset(tmpstring1, 0, text_buffer_size.get(*state));
 	tmpstring2 = (char*)malloc(text_buffer_size.get(*state));
 	memset(tmpstring2, 0, text_buffer_size.get(*state));
 
+	/* the first sample is taken while the window is set up */
+	if (first_pass)
+		start_prime_collectors();
 #ifdef BUILD_X11
 	X11_create_window();
 #endif /* BUILD_X11 */
+	finish_prime_collectors();
 	llua_setup_info(&info, active_update_interval());
 #ifdef BUILD_WEATHER_XOAP
 	xmlInitParser();
@@ -3023,6 +4760,7 @@ void initialisation(int argc, char **argv) {
 	if (		sigaction(SIGINT,  &act, &oact) < 0
 			||	sigaction(SIGALRM, &act, &oact) < 0
 			||	sigaction(SIGUSR1, &act, &oact) < 0
+			||	sigaction(SIGUSR2, &act, &oact) < 0
 			||	sigaction(SIGHUP,  &act, &oact) < 0
 			||	sigaction(SIGTERM, &act, &oact) < 0) {
 		NORM_ERR("error setting signal handler: %s", strerror(errno));
@@ -3031,6 +4769,8 @@ void initialisation(int argc, char **argv) {
 	llua_startup_hook();
 }
 
+/* conky_bench brings its own */
+#ifndef CONKY_BENCH
 int main(int argc, char **argv)
 {
 #ifdef BUILD_I18N
@@ -3077,8 +4817,22 @@ int main(int argc, char **argv)
 			case 'V':
 				print_version();
 				return EXIT_SUCCESS;
+			case 'R':
+				if (!open_record(optarg))
+					return EXIT_FAILURE;
+				break;
+			case 'P':
+				if (!open_replay(optarg))
+					return EXIT_FAILURE;
+				break;
+			case 'F':
+				profiling = profile_report = true;
+				break;
 			case 'c':
-				current_config = optarg;
+				if (current_config.empty())
+					current_config = optarg;
+				else
+					extra_configs.push_back(optarg);
 				break;
 			case 'q':
 				if (!freopen("/dev/null", "w", stderr))
@@ -3103,6 +4857,8 @@ int main(int argc, char **argv)
 		}
 	}
 
+	start_config_children();
+
 	try {
 		set_current_config();
 
@@ -3132,16 +4888,22 @@ int main(int argc, char **argv)
 		main_loop();
 	}
 	catch(fork_throw &e) { return EXIT_SUCCESS; }
-	catch(unknown_arg_throw &e) { return EXIT_FAILURE; }
+	catch(unknown_arg_throw &e) { stop_config_children(); return EXIT_FAILURE; }
 	catch(obj_create_error &e) {
 		std::cerr << e.what() << std::endl;
 		clean_up(NULL, NULL);
+		stop_config_children();
 		return EXIT_FAILURE;
 	}
 	catch(std::exception &e) {
 		std::cerr << PACKAGE_NAME": " << e.what() << std::endl;
+		stop_config_children();
 		return EXIT_FAILURE;
 	}
+	stop_config_children();
+	close_samples();
+	if (profile_report)
+		print_profile_report();
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 	kvm_close(kd);
@@ -3153,6 +4915,7 @@ int main(int argc, char **argv)
 	return 0;
 
 }
+#endif /* CONKY_BENCH */
 
 static void signal_handler(int sig)
 {
@@ -39,6 +39,7 @@
 #include <arpa/inet.h>
 #include <memory>
 #include "luamm.hh"
+#include "average.hh"
 
 #if defined(HAS_MCHECK_H)
 #include <mcheck.h>
@@ -204,11 +205,12 @@ struct information {
 	struct bmpx_s bmpx;
 #endif /* BUILD_BMPX */
 	struct usr_info users;
-	struct process *cpu[10];
-	struct process *memu[10];
-	struct process *time[10];
+	/* the top lists, top_list_size entries each (see top.h) */
+	struct process **cpu;
+	struct process **memu;
+	struct process **time;
 #ifdef BUILD_IOSTATS
-	struct process *io[10];
+	struct process **io;
 #endif /* BUILD_IOSTATS */
 	struct process *first_process;
 	unsigned long looped;
@@ -236,6 +238,7 @@ extern music_player_interval_setting music_player_interval;
 extern conky::range_config_setting<int> cpu_avg_samples;
 extern conky::range_config_setting<int> net_avg_samples;
 extern conky::range_config_setting<int> diskio_avg_samples;
+extern conky::simple_config_setting<average_mode> average_mode_setting;
 
 /* needed by linux.c and top.c -> outsource somewhere */
 enum {
@@ -252,12 +255,15 @@ enum {
 #define KFLAG_FLIP(a) info.kflags ^= a
 #define KFLAG_ISSET(a) info.kflags & a
 
-/* defined in conky.c, needed by top.c */
+/* defined in conky.c, needed by top.c; the number of entries of each top
+ * list the objects show, 0 if there are none */
 extern int top_cpu, top_mem, top_time;
 #ifdef BUILD_IOSTATS
 extern int top_io;
 #endif /* BUILD_IOSTATS */
 extern int top_running;
+/* the number of entries of the top_group lists the objects show, 0 if none */
+extern int top_group;
 
 /* struct that has all info to be shared between
  * instances of the same text object */
@@ -268,7 +274,15 @@ extern double current_update_time, last_update_time;
 
 extern conky::range_config_setting<double> update_interval;
 extern conky::range_config_setting<double> update_interval_on_battery;
+extern conky::range_config_setting<double> sample_interval;
 double active_update_interval();
+double active_sample_interval();
+double update_delta_scale();
+/* with update_pipelining, wait for the data collection running in the
+ * background before looking at info and such */
+void wait_for_update(void);
+/* the bytes the buffers of the frame's text take, for $conky_mem */
+size_t text_buffer_bytes(void);
 
 extern conky::range_config_setting<char>  stippled_borders;
 
@@ -284,16 +298,25 @@ int spaced_print(char *, int, const char *, int, ...)
 	__attribute__((format(printf, 3, 5)));
 extern int inotify_fd;
 
+/* defined in conky.c
+ * files with an exceptional condition to wait for (POLLPRI, like a PSI trigger
+ * firing), which makes the main loop update right away instead of at the next
+ * update_interval */
+void add_wake_fd(int fd);
+void remove_wake_fd(int fd);
+
 /* defined in conky.c
  * evaluates 'text' and places the result in 'p' of max length 'p_max_size'
  */
 void evaluate(const char *text, char *p, int p_max_size);
+/* forget the texts evaluate() kept parsed */
+void clear_evaluate_cache(void);
 
 void parse_conky_vars(struct text_object *, const char *, char *, int);
 
 void extract_object_args_to_sub(struct text_object *, const char *);
 
-void generate_text_internal(char *, int, struct text_object);
+void generate_text_internal(char *, int, struct text_object &);
 
 int percent_print(char *, int, unsigned);
 void human_readable(long long, char *, int);
@@ -0,0 +1,82 @@
+/* -*- mode: c; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=c
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* The values of the last update for LuaJIT's FFI, built with BUILD_LUA_FFI.
+ *
+ * These are plain C functions of the conky executable, reading the same
+ * values the conky_values table has, without going through the Lua stack
+ * or conky_parse(). A script declares them with ffi.cdef() (this header has
+ * no preprocessor lines between the markers below, so it can be pasted as
+ * is) and calls them through ffi.C:
+ *
+ *	local ffi = require("ffi")
+ *	ffi.cdef[[ int conky_metric_id(const char *path);
+ *		double conky_metric_get(int id); ]]
+ *	local load1 = ffi.C.conky_metric_id("loadavg.1")
+ *	function conky_main() print(ffi.C.conky_metric_get(load1)) end
+ *
+ * Ids are looked up once, the getters then only index an array. They must
+ * only be called from the Lua scripts, which run in conky's main thread. */
+
+#ifndef _CONKY_FFI_H
+#define _CONKY_FFI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* cdef begin */
+
+/* The id of a value by its path in conky_values, with dots between the
+ * keys: "cpu.0", "loadavg.1", "net.eth0.downspeed". A path that isn't there
+ * (yet) gets an id too. -1 for NULL. */
+int conky_metric_id(const char *path);
+
+/* the value with id in the last update, NaN if it had none */
+double conky_metric_get(int id);
+
+/* the usage of cpu n in percent, n = 0 for all of them; NaN if there is no
+ * such cpu */
+double conky_cpu_usage(int n);
+
+/* The id of the network interface iface for conky_net_rate(), -1 for NULL.
+ * Its rates are NaN until conky collects them for a ${downspeed} or such. */
+int conky_net_id(const char *iface);
+
+/* bytes per second iface_id received (dir 0) or sent (dir 1) */
+double conky_net_rate(int iface_id, int dir);
+
+/* cdef end */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CONKY_FFI_H */
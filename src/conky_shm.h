@@ -0,0 +1,167 @@
+/* -*- mode: c; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=c
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Layout of the shared memory snapshot conky publishes with shm_name.
+ *
+ * This header is plain C and doesn't depend on anything else in conky, so
+ * other programs can include it. A reader maps the region read-only:
+ *
+ *	int fd = shm_open("/conky", O_RDONLY, 0);
+ *	const struct conky_shm *shm = mmap(NULL, sizeof *shm, PROT_READ,
+ *			MAP_SHARED, fd, 0);
+ *	struct conky_shm copy;
+ *
+ *	if (conky_shm_read(shm, &copy) == 0)
+ *		printf("%f\n", copy.cpu_usage[0]);
+ *
+ * and then calls conky_shm_read() on every update without any syscalls.
+ * conky writes into the region under a sequence lock: seq is odd while a
+ * snapshot is being written and is incremented again when it is complete,
+ * so a copy taken while seq didn't change and was even is consistent.
+ *
+ * Only what the publishing config collects is filled in; everything else is
+ * zero. The layout changes only together with CONKY_SHM_VERSION. */
+
+#ifndef _CONKY_SHM_H
+#define _CONKY_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define CONKY_SHM_MAGIC		0x4b4e4f43	/* "CONK" */
+#define CONKY_SHM_VERSION	1
+
+#define CONKY_SHM_MAX_CPUS	256
+#define CONKY_SHM_MAX_NET	32
+#define CONKY_SHM_MAX_DISKS	32
+#define CONKY_SHM_MAX_FS	64
+#define CONKY_SHM_MAX_TOP	10
+#define CONKY_SHM_NAME_LEN	32
+#define CONKY_SHM_PATH_LEN	256
+
+struct conky_shm_net {
+	char dev[CONKY_SHM_NAME_LEN];
+	int32_t up;
+	int32_t link_qual;
+	int32_t link_qual_max;
+	int32_t pad;
+	int64_t recv, trans;			/* bytes */
+	double recv_speed, trans_speed;	/* bytes per second */
+	unsigned char addr[16];			/* struct sockaddr */
+	char essid[32];
+};
+
+struct conky_shm_disk {
+	char dev[CONKY_SHM_NAME_LEN];	/* "" for the total of all disks */
+	/* kB per update interval, averaged over diskio_avg_samples */
+	double current, current_read, current_write;
+};
+
+struct conky_shm_fs {
+	char path[CONKY_SHM_PATH_LEN];
+	char type[CONKY_SHM_NAME_LEN];
+	int64_t size, avail, free;		/* bytes */
+};
+
+/* an entry with pid 0 is unused */
+struct conky_shm_process {
+	char name[CONKY_SHM_NAME_LEN];
+	int32_t pid;
+	uint32_t uid;
+	float amount;					/* cpu percentage */
+	float io_perc;
+	uint64_t rss, vsize;			/* bytes */
+	uint64_t total_cpu_time;		/* hundredths of seconds */
+	uint64_t read_bytes, write_bytes;
+};
+
+struct conky_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;					/* sizeof(struct conky_shm) */
+	uint32_t seq;
+
+	double update_time;				/* seconds since the epoch */
+	double update_interval;
+	double uptime;
+
+	/* kilobytes */
+	uint64_t mem, memwithbuffers, memeasyfree, memfree, memmax, memdirty;
+	uint64_t swap, swapfree, swapmax;
+	uint64_t bufmem, buffers, cached;
+
+	uint32_t procs, run_procs, threads, run_threads;
+	float loadavg[3];
+
+	/* cpu_usage[0] is all cpus, 1..cpu_count the single ones */
+	int32_t cpu_count;
+	float cpu_usage[CONKY_SHM_MAX_CPUS + 1];
+
+	uint32_t net_count;
+	uint32_t disk_count;
+	uint32_t fs_count;
+	uint32_t pad;
+	struct conky_shm_net net[CONKY_SHM_MAX_NET];
+	struct conky_shm_disk disk[CONKY_SHM_MAX_DISKS];
+	struct conky_shm_fs fs[CONKY_SHM_MAX_FS];
+
+	struct conky_shm_process top_cpu[CONKY_SHM_MAX_TOP];
+	struct conky_shm_process top_mem[CONKY_SHM_MAX_TOP];
+	struct conky_shm_process top_time[CONKY_SHM_MAX_TOP];
+	struct conky_shm_process top_io[CONKY_SHM_MAX_TOP];
+};
+
+/* Copy a consistent snapshot out of shm. Returns 0 on success, -1 if nothing
+ * has been published yet, the layout doesn't match or the writer kept it
+ * busy for too long. */
+static inline int conky_shm_read(const struct conky_shm *shm,
+		struct conky_shm *out)
+{
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+
+		if (seq & 1)
+			continue;
+		memcpy(out, shm, sizeof *out);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		if (seq == 0 || out->magic != CONKY_SHM_MAGIC
+				|| out->version != CONKY_SHM_VERSION
+				|| out->size != sizeof *out)
+			return -1;
+		return 0;
+	}
+	return -1;
+}
+
+#endif /* _CONKY_SHM_H */
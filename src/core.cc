@@ -44,13 +44,18 @@
 #include "imlib2.h"
 #endif
 #include "proc.h"
+#include "profile.h"
+#include "latency.h"
 #ifdef BUILD_MYSQL
 #include "mysql.h"
 #endif
 #ifdef BUILD_ICAL
 #include "ical.h"
 #endif
-#ifdef BUILD_IRC
+#ifdef BUILD_PLUGINS
+#include "plugin.h"
+#endif /* BUILD_PLUGINS */
+#if defined(BUILD_IRC) && !defined(BUILD_PLUGINS)
 #include "irc.h"
 #endif
 #ifdef BUILD_X11
@@ -75,7 +80,14 @@
 #include "nvidia.h"
 #endif
 #include "read_tcpip.h"
+#ifdef BUILD_REMOTE
+#include "remote.h"
+#endif
 #include "scroll.h"
+#include "self.h"
+#ifdef BUILD_SHM
+#include "shm.h"
+#endif
 #include "specials.h"
 #include "temphelper.h"
 #include "template.h"
@@ -103,6 +115,8 @@
 /* check for OS and include appropriate headers */
 #if defined(__linux__)
 #include "linux.h"
+#include "cgroup.h"
+#include "perf.h"
 #elif defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include "freebsd.h"
 #elif defined(__DragonFly__)
@@ -113,6 +127,8 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <memory>
+#include <vector>
 
 /* strip a leading /dev/ if any, following symlinks first
  *
@@ -137,13 +153,39 @@ const char *dev_name(const char *path)
 #undef DEV_NAME
 }
 
-static struct text_object *new_text_object_internal(void)
+/* Whole trees of text objects come and go with every reload and with the
+ * texts evaluate() stops caching, so they are taken from blocks and handed
+ * back to a free list rather than malloc()ed one by one. */
+namespace {
+	const size_t text_object_block_size = 256;
+
+	std::vector<std::unique_ptr<struct text_object []> > text_object_blocks;
+	std::vector<struct text_object *> free_text_object_list;
+}
+
+struct text_object *new_text_object(void)
 {
-	struct text_object *obj = (text_object*)malloc(sizeof(struct text_object));
+	struct text_object *obj;
+
+	if (free_text_object_list.empty()) {
+		struct text_object *block = new struct text_object[text_object_block_size];
+
+		text_object_blocks.emplace_back(block);
+		for (size_t i = text_object_block_size; i > 0; i--)
+			free_text_object_list.push_back(block + i - 1);
+	}
+	obj = free_text_object_list.back();
+	free_text_object_list.pop_back();
 	memset(obj, 0, sizeof(struct text_object));
 	return obj;
 }
 
+void delete_text_object(struct text_object *obj)
+{
+	if (obj)
+		free_text_object_list.push_back(obj);
+}
+
 static struct text_object *create_plain_text(const char *s)
 {
 	struct text_object *obj;
@@ -152,7 +194,7 @@ static struct text_object *create_plain_text(const char *s)
 		return NULL;
 	}
 
-	obj = new_text_object_internal();
+	obj = new_text_object();
 
 	obj_be_plain_text(obj, s);
 	return obj;
@@ -261,26 +303,67 @@ void stock_parse_arg(struct text_object *obj, const char *arg)
 }
 #endif /* BUILD_CURL */
 
-legacy_cb_handle *create_cb_handle(int (*fn)())
+/* update functions which need the data gathered by another one, the latter is
+ * always run first. Anything not listed here may run in parallel. */
+static const struct {
+	int (*fn)();
+	int (*dep)();
+} legacy_cb_deps[] = {
+	{ &update_top, &update_meminfo },
+#ifdef __linux__
+	{ &update_cpu_usage, &update_stat },
+	{ &update_running_processes, &update_stat },
+#endif
+};
+
+static legacy_cb_handle register_legacy_cb(int (*fn)(), const char *name)
+{
+	legacy_cb_handle h = conky::register_cb<legacy_cb>(1, fn, name);
+
+	for (size_t i = 0; i < sizeof(legacy_cb_deps) / sizeof(legacy_cb_deps[0]); i++) {
+		if (legacy_cb_deps[i].fn == fn) {
+			h->depends_on(register_legacy_cb(legacy_cb_deps[i].dep, name));
+		}
+	}
+	return h;
+}
+
+legacy_cb_handle *create_cb_handle(int (*fn)(), const char *name)
 {
+#ifdef BUILD_SHM
+	fn = shm_collector(fn);
+#endif /* BUILD_SHM */
 	if(fn)
-		return new legacy_cb_handle(conky::register_cb<legacy_cb>(1, fn));
+		return new legacy_cb_handle(register_legacy_cb(fn, name));
 	else
 		return NULL;
 }
 
+/* FNV-1a, evaluated by the compiler for the case labels below */
+static constexpr uint32_t obj_name_hash(const char *s, uint32_t h = 2166136261u)
+{
+	return *s ? obj_name_hash(s + 1, (h ^ (uint8_t) *s) * 16777619u) : h;
+}
+
 /* construct_text_object() creates a new text_object */
 struct text_object *construct_text_object(char *s, const char *arg,
 		long line, void **ifblock_opaque, void *free_at_crash)
 {
 	// struct text_object *obj = new_text_object();
-	struct text_object *obj = new_text_object_internal();
+	struct text_object *obj = new_text_object();
 
 	obj->line = line;
 
-/* helper defines for internal use only */
-#define __OBJ_HEAD(a, n) if (!strcmp(s, #a)) { \
-	obj->cb_handle = create_cb_handle(n);
+/* helper defines for internal use only
+ *
+ * The objects are cases of a switch over the hash of their name, so finding
+ * one doesn't take a strcmp() per object before it. Two names with the same
+ * hash won't compile; a name that only shares the hash with an object ends
+ * up unknown. */
+#define __OBJ_HEAD(a, n) case obj_name_hash(#a): \
+	if (strcmp(s, #a)) { goto unknown_object; } { \
+	obj->name = #a; \
+	obj->cb_handle = create_cb_handle(n, #a);
 #define __OBJ_IF obj_be_ifblock_if(ifblock_opaque, obj)
 #define __OBJ_ARG(...) if (!arg) { free(s); CRIT_ERR(obj, free_at_crash, __VA_ARGS__); }
 
@@ -289,7 +372,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #define OBJ_ARG(a, n, ...) __OBJ_HEAD(a, n) __OBJ_ARG(__VA_ARGS__) {
 #define OBJ_IF(a, n) __OBJ_HEAD(a, n) __OBJ_IF; {
 #define OBJ_IF_ARG(a, n, ...) __OBJ_HEAD(a, n) __OBJ_ARG(__VA_ARGS__) __OBJ_IF; {
-#define END } } else
+#define END } } break;
 
 #ifdef BUILD_X11
 	if (s[0] == '#') {
@@ -297,6 +380,45 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &new_fg;
 	} else
 #endif /* BUILD_X11 */
+	/* we have four different types of top (top, top_mem, top_time and top_io). To
+	 * avoid having almost-same code four times, we have this special
+	 * handler. */
+	/* XXX: maybe fiddle them apart later, as print_top() does
+	 * nothing else than just that, using an ugly switch(). */
+#ifdef __linux__
+	if (strncmp(s, "top_cgroup", 10) == EQUAL) {
+		if (parse_top_cgroup_args(obj, s, arg)) {
+			obj->name = "top_cgroup";
+		} else {
+			delete_text_object(obj);
+			return NULL;
+		}
+	} else
+#endif /* __linux__ */
+	if (strcmp(s, "top_group") == EQUAL) {
+		if (parse_top_group_args(obj, arg)) {
+#ifdef __linux__
+			determine_longstat_file();
+#endif
+			obj->name = "top_group";
+			obj->cb_handle = create_cb_handle(update_top, "top");
+		} else {
+			delete_text_object(obj);
+			return NULL;
+		}
+	} else
+	if (strncmp(s, "top", 3) == EQUAL) {
+		if (parse_top_args(s, arg, obj)) {
+#ifdef __linux__
+			determine_longstat_file();
+#endif
+			obj->name = "top";
+			obj->cb_handle = create_cb_handle(update_top, "top");
+		} else {
+			delete_text_object(obj);
+			return NULL;
+		}
+	} else switch (obj_name_hash(s)) {
 #ifndef __OpenBSD__
 	OBJ(acpitemp, 0)
 		obj->data.i = open_acpi_temperature(arg);
@@ -322,7 +444,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #endif /* !__OpenBSD__ */
 	END OBJ(freq, 0)
 		get_cpu_count();
-		if (!arg || !isdigit(arg[0]) || strlen(arg) >= 2 || atoi(&arg[0]) == 0
+		if (!arg || !isdigit(arg[0]) || atoi(&arg[0]) == 0
 				|| atoi(&arg[0]) > info.cpu_count) {
 			obj->data.i = 1;
 			/* NORM_ERR("freq: Invalid CPU number or you don't have that many CPUs! "
@@ -333,7 +455,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &print_freq;
 	END OBJ(freq_g, 0)
 		get_cpu_count();
-		if (!arg || !isdigit(arg[0]) || strlen(arg) >= 2 || atoi(&arg[0]) == 0
+		if (!arg || !isdigit(arg[0]) || atoi(&arg[0]) == 0
 				|| atoi(&arg[0]) > info.cpu_count) {
 			obj->data.i = 1;
 			/* NORM_ERR("freq_g: Invalid CPU number or you don't have that many "
@@ -475,34 +597,43 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #endif /* !__OpenBSD__ */
 
 #if defined(__linux__)
+	END OBJ_ARG(meminfo, &update_meminfo, "meminfo needs a key of /proc/meminfo, e.g. Shmem")
+		parse_meminfo_arg(obj, arg);
+		obj->callbacks.print = &print_meminfo;
+		obj->callbacks.value = &meminfo_value;
+	END OBJ_ARG(pressure, 0, "pressure needs a resource: cpu, memory or io")
+		parse_pressure_arg(obj, arg);
+		obj->callbacks.print = &print_pressure;
+		obj->callbacks.value = &pressure_value;
+		obj->callbacks.free = &free_pressure;
 	END OBJ_ARG(disk_protect, 0, "disk_protect needs an argument")
 		obj->data.s = strndup(dev_name(arg), text_buffer_size.get(*state));
 		obj->callbacks.print = &print_disk_protect_queue;
 		obj->callbacks.free = &gen_free_opaque;
-	END OBJ(i8k_version, &update_i8k)
+	END OBJ(i8k_version, 0)
 		obj->callbacks.print = &print_i8k_version;
-	END OBJ(i8k_bios, &update_i8k)
+	END OBJ(i8k_bios, 0)
 		obj->callbacks.print = &print_i8k_bios;
-	END OBJ(i8k_serial, &update_i8k)
+	END OBJ(i8k_serial, 0)
 		obj->callbacks.print = &print_i8k_serial;
-	END OBJ(i8k_cpu_temp, &update_i8k)
+	END OBJ(i8k_cpu_temp, 0)
 		obj->callbacks.print = &print_i8k_cpu_temp;
-	END OBJ(i8k_left_fan_status, &update_i8k)
+	END OBJ(i8k_left_fan_status, 0)
 		obj->callbacks.print = &print_i8k_left_fan_status;
-	END OBJ(i8k_right_fan_status, &update_i8k)
+	END OBJ(i8k_right_fan_status, 0)
 		obj->callbacks.print = &print_i8k_right_fan_status;
-	END OBJ(i8k_left_fan_rpm, &update_i8k)
+	END OBJ(i8k_left_fan_rpm, 0)
 		obj->callbacks.print = &print_i8k_left_fan_rpm;
-	END OBJ(i8k_right_fan_rpm, &update_i8k)
+	END OBJ(i8k_right_fan_rpm, 0)
 		obj->callbacks.print = &print_i8k_right_fan_rpm;
-	END OBJ(i8k_ac_status, &update_i8k)
+	END OBJ(i8k_ac_status, 0)
 		obj->callbacks.print = &print_i8k_ac_status;
-	END OBJ(i8k_buttons_status, &update_i8k)
+	END OBJ(i8k_buttons_status, 0)
 		obj->callbacks.print = &print_i8k_buttons_status;
 #if defined(BUILD_IBM)
 	END OBJ(ibm_fan, 0)
 		obj->callbacks.print = &get_ibm_acpi_fan;
-	END OBJ_ARG(ibm_temps, &get_ibm_acpi_temps, "ibm_temps: needs an argument")
+	END OBJ_ARG(ibm_temps, 0, "ibm_temps: needs an argument")
 		parse_ibm_temps_arg(obj, arg);
 		obj->callbacks.print = &print_ibm_temps;
 	END OBJ(ibm_volume, 0)
@@ -559,8 +690,10 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #endif /* __OpenBSD__ */
 	END OBJ(buffers, &update_meminfo)
 		obj->callbacks.print = &print_buffers;
+		obj->callbacks.value = &buffers_value;
 	END OBJ(cached, &update_meminfo)
 		obj->callbacks.print = &print_cached;
+		obj->callbacks.value = &cached_value;
 #define SCAN_CPU(__arg, __var) { \
 	int __offset = 0; \
 	if (__arg && sscanf(__arg, " cpu%d %n", &__var, &__offset) > 0) \
@@ -599,12 +732,33 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(diskio, &update_diskio)
 		parse_diskio_arg(obj, arg);
 		obj->callbacks.print = &print_diskio;
+		obj->callbacks.value = &diskio_value;
 	END OBJ(diskio_read, &update_diskio)
 		parse_diskio_arg(obj, arg);
 		obj->callbacks.print = &print_diskio_read;
+		obj->callbacks.value = &diskio_read_value;
 	END OBJ(diskio_write, &update_diskio)
 		parse_diskio_arg(obj, arg);
 		obj->callbacks.print = &print_diskio_write;
+		obj->callbacks.value = &diskio_write_value;
+#ifdef __linux__
+	END OBJ(diskio_iops, &update_diskio)
+		parse_diskio_arg(obj, arg);
+		obj->callbacks.print = &print_diskio_iops;
+		obj->callbacks.value = &diskio_iops_value;
+	END OBJ(diskio_await, &update_diskio)
+		parse_diskio_arg(obj, arg);
+		obj->callbacks.print = &print_diskio_await;
+		obj->callbacks.value = &diskio_await_value;
+	END OBJ(diskio_util, &update_diskio)
+		parse_diskio_arg(obj, arg);
+		obj->callbacks.print = &print_diskio_util;
+		obj->callbacks.value = &diskio_util_value;
+	END OBJ(diskio_queue, &update_diskio)
+		parse_diskio_arg(obj, arg);
+		obj->callbacks.print = &print_diskio_queue;
+		obj->callbacks.value = &diskio_queue_value;
+#endif /* __linux__ */
 #ifdef BUILD_X11
 	END OBJ(diskiograph, &update_diskio)
 		parse_diskiograph_arg(obj, arg);
@@ -703,9 +857,11 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(downspeed, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
 		obj->callbacks.print = &print_downspeed;
+		obj->callbacks.value = &downspeed_value;
 	END OBJ(downspeedf, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
 		obj->callbacks.print = &print_downspeedf;
+		obj->callbacks.value = &downspeedf_value;
 #ifdef BUILD_X11
 	END OBJ(downspeedgraph, &update_net_stats)
 		parse_net_stat_graph_arg(obj, arg, free_at_crash);
@@ -788,6 +944,17 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->thread = false;
 		obj->callbacks.print = &print_execi;
 		obj->callbacks.free = &free_execi;
+	END OBJ_ARG(execstream, 0, "execstream needs arguments")
+		scan_execstream_arg(obj, arg);
+		obj->parse = false;
+		obj->thread = false;
+		obj->callbacks.print = &print_execstream;
+		obj->callbacks.free = &free_execstream;
+	END OBJ_ARG(expr, 0, "expr needs an expression")
+		scan_expr(obj, arg);
+		obj->callbacks.print = &print_expr;
+		obj->callbacks.value = &expr_value;
+		obj->callbacks.free = &free_expr;
 	END OBJ_ARG(texeci, 0, "texeci needs arguments")
 		scan_execi_arg(obj, arg);
 		obj->parse = false;
@@ -809,6 +976,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(fs_free, &update_fs_stats)
 		init_fs(obj, arg);
 		obj->callbacks.print = &print_fs_free;
+		obj->callbacks.value = &fs_free_value;
 	END OBJ(fs_used_perc, &update_fs_stats)
 		init_fs(obj, arg);
 		obj->callbacks.percentage = &fs_used_percentage;
@@ -818,12 +986,14 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(fs_size, &update_fs_stats)
 		init_fs(obj, arg);
 		obj->callbacks.print = &print_fs_size;
+		obj->callbacks.value = &fs_size_value;
 	END OBJ(fs_type, &update_fs_stats)
 		init_fs(obj, arg);
 		obj->callbacks.print = &print_fs_type;
 	END OBJ(fs_used, &update_fs_stats)
 		init_fs(obj, arg);
 		obj->callbacks.print = &print_fs_used;
+		obj->callbacks.value = &fs_used_value;
 #ifdef BUILD_X11
 	END OBJ(hr, 0)
 		obj->data.l = arg ? atoi(arg) : 1;
@@ -862,22 +1032,6 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.free = &free_sysfs_sensor;
 #endif /* __linux__ */
 	END
-	/* we have four different types of top (top, top_mem, top_time and top_io). To
-	 * avoid having almost-same code four times, we have this special
-	 * handler. */
-	/* XXX: maybe fiddle them apart later, as print_top() does
-	 * nothing else than just that, using an ugly switch(). */
-	if (strncmp(s, "top", 3) == EQUAL) {
-		if (parse_top_args(s, arg, obj)) {
-#ifdef __linux__
-			determine_longstat_file();
-#endif
-			obj->cb_handle = create_cb_handle(update_top);
-		} else {
-			free(obj);
-			return NULL;
-		}
-	} else
 #ifdef __linux__
 	OBJ(addr, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
@@ -901,28 +1055,27 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &print_head;
 		obj->callbacks.free = &free_tailhead;
 	END OBJ_ARG(lines, 0, "lines needs an argument")
-		obj->data.s = strndup(arg, text_buffer_size.get(*state));
+		scan_filecount(obj, arg);
 		obj->callbacks.print = &print_lines;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_filecount;
 	END OBJ_ARG(words, 0, "words needs a argument")
-		obj->data.s = strndup(arg, text_buffer_size.get(*state));
+		scan_filecount(obj, arg);
 		obj->callbacks.print = &print_words;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_filecount;
 	END OBJ(loadavg, &update_load_average)
 		scan_loadavg_arg(obj, arg);
 		obj->callbacks.print = &print_loadavg;
+		obj->callbacks.value = &loadavg_value;
 	END OBJ_IF_ARG(if_empty, 0, "if_empty needs an argument")
-		obj->sub = (text_object*)malloc(sizeof(struct text_object));
+		obj->sub = new_text_object();
 		extract_variable_text_internal(obj->sub, arg);
 		obj->callbacks.iftest = &if_empty_iftest;
 	END OBJ_IF_ARG(if_match, 0, "if_match needs arguments")
-		obj->sub = (text_object*)malloc(sizeof(struct text_object));
-		extract_variable_text_internal(obj->sub, arg);
-		obj->callbacks.iftest = &check_if_match;
+		scan_if_match(obj, arg);
 	END OBJ_IF_ARG(if_existing, 0, "if_existing needs an argument or two")
 		obj->data.s = strndup(arg, text_buffer_size.get(*state));
 		obj->callbacks.iftest = &if_existing_iftest;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_if_existing;
 #ifdef __linux__
 	END OBJ_IF_ARG(if_mounted, 0, "if_mounted needs an argument")
 		obj->data.s = strndup(arg, text_buffer_size.get(*state));
@@ -1004,19 +1157,25 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.free = &free_mboxscan;
 	END OBJ(mem, &update_meminfo)
 		obj->callbacks.print = &print_mem;
+		obj->callbacks.value = &mem_value;
 	END OBJ(memwithbuffers, &update_meminfo)
 		obj->callbacks.print = &print_memwithbuffers;
+		obj->callbacks.value = &memwithbuffers_value;
 	END OBJ(memeasyfree, &update_meminfo)
 		obj->callbacks.print = &print_memeasyfree;
+		obj->callbacks.value = &memeasyfree_value;
 	END OBJ(memfree, &update_meminfo)
 		obj->callbacks.print = &print_memfree;
+		obj->callbacks.value = &memfree_value;
 	END OBJ(memmax, &update_meminfo)
 		obj->callbacks.print = &print_memmax;
+		obj->callbacks.value = &memmax_value;
 	END OBJ(memperc, &update_meminfo)
 		obj->callbacks.percentage = &mem_percentage;
 #ifdef __linux__
 	END OBJ(memdirty, &update_meminfo)
 		obj->callbacks.print = &print_memdirty;
+		obj->callbacks.value = &memdirty_value;
 #endif
 #ifdef BUILD_X11
 	END OBJ(memgauge, &update_meminfo)
@@ -1071,7 +1230,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &print_desktop_name;
 #endif /* BUILD_X11 */
 	END OBJ_ARG(format_time, 0, "format_time needs a pid as argument")
-		obj->sub = (text_object*)malloc(sizeof(struct text_object));
+		obj->sub = new_text_object();
 		extract_variable_text_internal(obj->sub, arg);
 		obj->callbacks.print = &print_format_time;
 	END OBJ(nodename, 0)
@@ -1214,23 +1373,29 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(processes, &update_total_processes)
 #endif
 		obj->callbacks.print = &print_processes;
+		obj->callbacks.value = &processes_value;
 #ifdef __linux__
 	END OBJ(distribution, 0)
 		obj->callbacks.print = &print_distribution;
 	END OBJ(running_processes, &update_top)
 		top_running = 1;
 		obj->callbacks.print = &print_running_processes;
+		obj->callbacks.value = &running_processes_value;
 	END OBJ(threads, &update_threads)
 		obj->callbacks.print = &print_threads;
+		obj->callbacks.value = &threads_value;
 	END OBJ(running_threads, &update_stat)
 		obj->callbacks.print = &print_running_threads;
+		obj->callbacks.value = &running_threads_value;
 #else
 #if defined(__DragonFly__)
 	END OBJ(running_processes, &update_top)
 	obj->callbacks.print = &print_running_processes;
+	obj->callbacks.value = &running_processes_value;
 #else
 	END OBJ(running_processes, &update_running_processes)
 	obj->callbacks.print = &print_running_processes;
+	obj->callbacks.value = &running_processes_value;
 #endif
 #endif /* __linux__ */
 	END OBJ(shadecolor, 0)
@@ -1250,10 +1415,13 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #endif /* BUILD_X11 */
 	END OBJ(swap, &update_meminfo)
 		obj->callbacks.print = &print_swap;
+		obj->callbacks.value = &swap_value;
 	END OBJ(swapfree, &update_meminfo)
 		obj->callbacks.print = &print_swapfree;
+		obj->callbacks.value = &swapfree_value;
 	END OBJ(swapmax, &update_meminfo)
 		obj->callbacks.print = &print_swapmax;
+		obj->callbacks.value = &swapmax_value;
 	END OBJ(swapperc, &update_meminfo)
 		obj->callbacks.percentage = &swap_percentage;
 	END OBJ(swapbar, &update_meminfo)
@@ -1267,7 +1435,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &print_time;
 		obj->callbacks.free = &free_time;
 	END OBJ(utime, 0)
-		scan_time(obj, arg);
+		scan_utime(obj, arg);
 		obj->callbacks.print = &print_utime;
 		obj->callbacks.free = &free_time;
 	END OBJ(tztime, 0)
@@ -1280,7 +1448,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &print_ical;
 		obj->callbacks.free = &free_ical;
 #endif
-#ifdef BUILD_IRC
+#if defined(BUILD_IRC) && !defined(BUILD_PLUGINS)
 	END OBJ_ARG(irc, 0, "irc requires arguments")
 		parse_irc_args(obj, arg);
 		obj->callbacks.print = &print_irc;
@@ -1298,9 +1466,11 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(totaldown, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
 		obj->callbacks.print = &print_totaldown;
+		obj->callbacks.value = &totaldown_value;
 	END OBJ(totalup, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
 		obj->callbacks.print = &print_totalup;
+		obj->callbacks.value = &totalup_value;
 	END OBJ(updates, 0)
 		obj->callbacks.print = &print_updates;
 	END OBJ_IF(if_updatenr, 0)
@@ -1317,9 +1487,11 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(upspeed, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
 		obj->callbacks.print = &print_upspeed;
+		obj->callbacks.value = &upspeed_value;
 	END OBJ(upspeedf, &update_net_stats)
 		parse_net_stat_arg(obj, arg, free_at_crash);
 		obj->callbacks.print = &print_upspeedf;
+		obj->callbacks.value = &upspeedf_value;
 #ifdef BUILD_X11
 	END OBJ(upspeedgraph, &update_net_stats)
 		parse_net_stat_graph_arg(obj, arg, free_at_crash);
@@ -1327,16 +1499,47 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #endif
 	END OBJ(uptime_short, &update_uptime)
 		obj->callbacks.print = &print_uptime_short;
+		obj->callbacks.value = &uptime_value;
 	END OBJ(uptime, &update_uptime)
 		obj->callbacks.print = &print_uptime;
+		obj->callbacks.value = &uptime_value;
 #if defined(__linux__)
+	END OBJ(cgroup_cpu, 0)
+		parse_cgroup_args(obj, arg);
+		obj->callbacks.percentage = &cgroup_cpu_percentage;
+		obj->callbacks.free = &free_cgroup;
+	END OBJ(cgroup_mem, 0)
+		parse_cgroup_args(obj, arg);
+		obj->callbacks.print = &print_cgroup_mem;
+		obj->callbacks.value = &cgroup_mem_value;
+		obj->callbacks.free = &free_cgroup;
+	END OBJ_ARG(cgroup_mem_stat, 0, "cgroup_mem_stat needs a cgroup and a key of its memory.stat")
+		parse_cgroup_mem_stat_args(obj, arg);
+		obj->callbacks.print = &print_cgroup_mem_stat;
+		obj->callbacks.value = &cgroup_mem_stat_value;
+		obj->callbacks.free = &free_cgroup;
+	END OBJ(cgroup_io_read, 0)
+		parse_cgroup_args(obj, arg);
+		obj->callbacks.print = &print_cgroup_io_read;
+		obj->callbacks.value = &cgroup_io_read_value;
+		obj->callbacks.free = &free_cgroup;
+	END OBJ(cgroup_io_write, 0)
+		parse_cgroup_args(obj, arg);
+		obj->callbacks.print = &print_cgroup_io_write;
+		obj->callbacks.value = &cgroup_io_write_value;
+		obj->callbacks.free = &free_cgroup;
+	END OBJ_ARG(perf, 0, "perf needs a figure, e.g. ipc or llc_miss_rate cpu1")
+		parse_perf_args(obj, arg);
+		obj->callbacks.print = &print_perf;
+		obj->callbacks.value = &perf_value;
+		obj->callbacks.free = &free_perf;
 	END OBJ(user_names, &update_users)
 		obj->callbacks.print = &print_user_names;
 		obj->callbacks.free = &free_user_names;
 	END OBJ(user_times, &update_users)
 		obj->callbacks.print = &print_user_times;
 		obj->callbacks.free = &free_user_times;
-	END OBJ_ARG(user_time, 0, "user time needs a console name as argument")
+	END OBJ_ARG(user_time, &update_users, "user time needs a console name as argument")
 		obj->data.s = strndup(arg, text_buffer_size.get(*state));
 		obj->callbacks.print = &print_user_time;
 		obj->callbacks.free = &free_user_time;
@@ -1493,24 +1696,6 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &print_moc_rate;
 #endif /* BUILD_MOC */
 #ifdef BUILD_CMUS
-	END OBJ(cmus_state, 0)
-		obj->callbacks.print = &print_cmus_state;
-	END OBJ(cmus_file, 0)
-		obj->callbacks.print = &print_cmus_file;
-	END OBJ(cmus_title, 0)
-		obj->callbacks.print = &print_cmus_title;
-	END OBJ(cmus_artist, 0)
-		obj->callbacks.print = &print_cmus_artist;
-	END OBJ(cmus_album, 0)
-		obj->callbacks.print = &print_cmus_album;
-	END OBJ(cmus_totaltime, 0)
-		obj->callbacks.print = &print_cmus_totaltime;
-	END OBJ(cmus_timeleft, 0)
-		obj->callbacks.print = &print_cmus_timeleft;
-	END OBJ(cmus_curtime, 0)
-		obj->callbacks.print = &print_cmus_curtime;
-	END OBJ(cmus_random, 0)
-		obj->callbacks.print = &print_cmus_random;
 	END OBJ(cmus_state, 0)
 		obj->callbacks.print = &print_cmus_state;
 	END OBJ(cmus_file, 0)
@@ -1690,45 +1875,46 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.free = &free_weather;
 #endif /* BUILD_WEATHER_XOAP */
 	END OBJ_ARG(lua, 0, "lua needs arguments: <function name> [function parameters]")
-		obj->data.s = strndup(arg, text_buffer_size.get(*state));
+		parse_lua_arg(obj, arg);
 		obj->callbacks.print = &print_lua;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_lua;
 	END OBJ_ARG(lua_parse, 0, "lua_parse needs arguments: <function name> [function parameters]")
-		obj->data.s = strndup(arg, text_buffer_size.get(*state));
+		parse_lua_arg(obj, arg);
 		obj->callbacks.print = &print_lua_parse;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_lua;
 	END OBJ_ARG(lua_bar, 0, "lua_bar needs arguments: <height>,<width> <function name> [function parameters]")
 		arg = scan_bar(obj, arg, 100);
 		if(arg) {
-			obj->data.s = strndup(arg, text_buffer_size.get(*state));
+			parse_lua_arg(obj, arg);
 		} else {
 			CRIT_ERR(obj, free_at_crash, "lua_bar needs arguments: <height>,<width> <function name> [function parameters]");
 		}
 		obj->callbacks.barval = &lua_barval;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_lua;
 #ifdef BUILD_X11
 	END OBJ_ARG(lua_graph, 0, "lua_graph needs arguments: <function name> [height],[width] [gradient colour 1] [gradient colour 2] [scale] [-t] [-l]")
 		char *buf = 0;
 		buf = scan_graph(obj, arg, 100);
 		if (buf) {
-			obj->data.s = buf;
+			parse_lua_arg(obj, buf);
+			free(buf);
 		} else {
 			CRIT_ERR(obj, free_at_crash, "lua_graph needs arguments: <function name> [height],[width] [gradient colour 1] [gradient colour 2] [scale] [-t] [-l]");
 		}
 		obj->callbacks.graphval = &lua_barval;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_lua;
 	END OBJ_ARG(lua_gauge, 0, "lua_gauge needs arguments: <height>,<width> <function name> [function parameters]")
 		arg = scan_gauge(obj, arg, 100);
 		if (arg) {
-			obj->data.s = strndup(arg, text_buffer_size.get(*state));
+			parse_lua_arg(obj, arg);
 		} else {
 			CRIT_ERR(obj, free_at_crash, "lua_gauge needs arguments: <height>,<width> <function name> [function parameters]");
 		}
 		obj->callbacks.gaugeval = &lua_barval;
-		obj->callbacks.free = &gen_free_opaque;
+		obj->callbacks.free = &free_lua;
 #endif /* BUILD_X11 */
 #ifdef BUILD_HDDTEMP
-	END OBJ(hddtemp, &update_hddtemp)
+	END OBJ(hddtemp, 0)
 		if (arg)
 			obj->data.s = strndup(arg, text_buffer_size.get(*state));
 		obj->callbacks.print = &print_hddtemp;
@@ -1740,6 +1926,32 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		obj->callbacks.print = &tcp_portmon_action;
 		obj->callbacks.free = &tcp_portmon_free;
 #endif /* BUILD_PORT_MONITORS */
+#ifdef BUILD_REMOTE
+	END OBJ_ARG(remote, 0, "remote needs arguments: <host[:port]> <value> [device]")
+		parse_remote_arg(obj, arg);
+		obj->callbacks.print = &print_remote;
+		obj->callbacks.free = &free_remote;
+#endif /* BUILD_REMOTE */
+	END OBJ(conky_profile, 0)
+		parse_conky_profile_arg(obj, arg);
+		obj->callbacks.print = &print_conky_profile;
+		obj->callbacks.free = &free_conky_profile;
+	END OBJ(conky_self, 0)
+		parse_conky_self_arg(obj, arg);
+		obj->callbacks.print = &print_conky_self;
+		obj->callbacks.free = &free_conky_self;
+	END OBJ(conky_mem, 0)
+		parse_conky_mem_arg(obj, arg);
+		obj->callbacks.print = &print_conky_mem;
+		obj->callbacks.value = &conky_mem_value;
+	END OBJ_ARG(source_state, 0, "source_state needs a callback name, like imap or curl")
+		obj->data.s = strndup(arg, text_buffer_size.get(*state));
+		obj->callbacks.print = &print_source_state;
+		obj->callbacks.free = &gen_free_opaque;
+	END OBJ(latency, 0)
+		parse_latency_arg(obj, arg);
+		obj->callbacks.print = &print_latency;
+		obj->callbacks.free = &free_latency;
 	END OBJ(entropy_avail, &update_entropy)
 		obj->callbacks.print = &print_entropy_avail;
 	END OBJ(entropy_perc, &update_entropy)
@@ -1750,11 +1962,11 @@ struct text_object *construct_text_object(char *s, const char *arg,
 		scan_bar(obj, arg, 1);
 		obj->callbacks.barval = &entropy_barval;
 	END OBJ_ARG(blink, 0, "blink needs a argument")
-		obj->sub = (text_object*)malloc(sizeof(struct text_object));
+		obj->sub = new_text_object();
 		extract_variable_text_internal(obj->sub, arg);
 		obj->callbacks.print = &print_blink;
 	END OBJ_ARG(to_bytes, 0, "to_bytes needs a argument")
-		obj->sub = (text_object*)malloc(sizeof(struct text_object));
+		obj->sub = new_text_object();
 		extract_variable_text_internal(obj->sub, arg);
 		obj->callbacks.print = &print_to_bytes;
 #ifdef BUILD_CURL
@@ -1775,7 +1987,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 			parse_combine_arg(obj, arg);
 		}
 		catch(combine_needs_2_args_error &e) {
-			free(obj);
+			delete_text_object(obj);
 			throw obj_create_error(e.what());
 		}
 		obj->callbacks.print = &print_combine;
@@ -1831,14 +2043,23 @@ struct text_object *construct_text_object(char *s, const char *arg,
 	END OBJ(apcupsd_lastxfer, &update_apcupsd)
 		obj->callbacks.print = &print_apcupsd_lastxfer;
 #endif /* BUILD_APCUPSD */
-	END {
-		char *buf = (char *)malloc(text_buffer_size.get(*state));
+	END
+	default:
+	unknown_object: {
+		char *buf;
+
+#ifdef BUILD_PLUGINS
+		if (construct_plugin_object(obj, s, arg, free_at_crash))
+			break;
+#endif /* BUILD_PLUGINS */
+		buf = (char *)malloc(text_buffer_size.get(*state));
 
 		NORM_ERR("unknown variable '$%s'", s);
 		snprintf(buf, text_buffer_size.get(*state), "${%s}", s);
 		obj_be_plain_text(obj, buf);
 		free(buf);
 	}
+	}
 #undef OBJ
 #undef OBJ_IF
 #undef OBJ_ARG
@@ -1848,6 +2069,7 @@ struct text_object *construct_text_object(char *s, const char *arg,
 #undef __OBJ_ARG
 #undef END
 
+	text_memo_attach(obj, arg);
 	return obj;
 }
 
@@ -1886,31 +2108,19 @@ size_t remove_comments(char *string)
 	return folded;
 }
 
-int extract_variable_text_internal(struct text_object *retval, const char *const_p)
+/* parse the template-free text p into objects, p is freed afterwards */
+static int extract_text(struct text_object *retval, char *p)
 {
 	struct text_object *obj;
-	char *p, *s, *orig_p;
+	char *s, *orig_p;
 	long line;
 	void *ifblock_opaque = NULL;
 	char *tmp_p;
 	char *arg = 0;
 	size_t len = 0;
 
-	p = strndup(const_p, max_user_text.get(*state) - 1);
-	while (text_contains_templates(p)) {
-		char *tmp;
-		tmp = find_and_replace_templates(p);
-		free(p);
-		p = tmp;
-	}
 	s = orig_p = p;
 
-	if (strcmp(p, const_p)) {
-		DBGP2("replaced all templates in text: input is\n'%s'\noutput is\n'%s'", const_p, p);
-	} else {
-		DBGP2("no templates to replace");
-	}
-
 	memset(retval, 0, sizeof(struct text_object));
 
 	line = global_text_lines;
@@ -2050,10 +2260,19 @@ int extract_variable_text_internal(struct text_object *retval, const char *const
 	return 0;
 }
 
+int extract_variable_text_internal(struct text_object *retval, const char *const_p)
+{
+	return extract_text(retval, replace_templates(const_p, false));
+}
+
+int extract_config_text(struct text_object *retval, const char *const_p)
+{
+	return extract_text(retval, replace_templates(const_p, true));
+}
+
 void extract_object_args_to_sub(struct text_object *obj, const char *args)
 {
-	obj->sub = (struct text_object *)malloc(sizeof(struct text_object));
-	memset(obj->sub, 0, sizeof(struct text_object));
+	obj->sub = new_text_object();
 	extract_variable_text_internal(obj->sub, args);
 }
 
@@ -2062,6 +2281,9 @@ void free_text_objects(struct text_object *root)
 {
 	struct text_object *obj;
 
+	if (root)
+		free_text_program(root);
+
 	if(root && root->prev) {
 		for (obj = root->prev; obj; obj = root->prev) {
 			root->prev = obj->prev;
@@ -2070,11 +2292,12 @@ void free_text_objects(struct text_object *root)
 				(*obj->callbacks.free)(obj);
 			}
 			free_text_objects(obj->sub);
-			free_and_zero(obj->sub);
-			free_and_zero(obj->special_data);
+			delete_text_object(obj->sub);
+			free_special_data(obj);
 			delete obj->cb_handle;
+			text_memo_release(obj);
 
-			free(obj);
+			delete_text_object(obj);
 		}
 	}
 }
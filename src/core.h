@@ -39,9 +39,20 @@ struct text_object *construct_text_object(const char *s, const char *arg, long
 size_t remove_comments(char *string);
 
 int extract_variable_text_internal(struct text_object *retval, const char *const_p);
+/* the same for the text of the config, whose templates may come from text_cache */
+int extract_config_text(struct text_object *retval, const char *const_p);
 
 void free_text_objects(struct text_object *root);
 
+/* a zeroed text object, and giving it back; all of them, subs included, are
+ * made with these */
+struct text_object *new_text_object(void);
+void delete_text_object(struct text_object *);
+
 const char *dev_name(const char *);
 
+/* register fn as a collector for the variable name, it runs as long as the
+ * handle exists */
+legacy_cb_handle *create_cb_handle(int (*fn)(), const char *name = NULL);
+
 #endif /* _CONKY_CORE_H_ */
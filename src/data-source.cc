@@ -26,6 +26,7 @@
 #include "data-source.hh"
 
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <unordered_map>
 
@@ -40,6 +41,7 @@ namespace conky {
 		float NaN = std::numeric_limits<float>::quiet_NaN();
 
 		typedef std::unordered_map<std::string, lua::cpp_function> data_sources_t;
+		typedef std::map<std::string, snapshot_function> snapshots_t;
 
 		/*
 		 * We cannot construct this object statically, because order of object construction in
@@ -47,6 +49,8 @@ namespace conky {
 		 * object is constructed. Therefore, we create it on the first call to register_source.
 		 */
 		data_sources_t *data_sources;
+		/* created on the first call just like data_sources */
+		snapshots_t *snapshots;
 
 		data_source_base& get_data_source(lua::state *l)
 		{
@@ -121,6 +125,27 @@ namespace conky {
 		return s.str();
 	}
 
+	register_snapshot::register_snapshot(const std::string &name, const snapshot_function &fn)
+	{
+		struct snapshots_constructor {
+			snapshots_constructor()  { snapshots = new snapshots_t(); }
+			~snapshots_constructor() { delete snapshots; snapshots = NULL; }
+		};
+		static snapshots_constructor constructor;
+
+		bool inserted = snapshots->insert({name, fn}).second;
+		if(not inserted)
+			throw std::logic_error("Snapshot with name '" + name + "' already registered");
+	}
+
+	void write_snapshot(snapshot_writer &w)
+	{
+		if(not snapshots)
+			return;
+		for(auto i = snapshots->begin(); i != snapshots->end(); ++i)
+			i->second(w);
+	}
+
 	register_disabled_data_source::register_disabled_data_source(const std::string &name, 
 			const std::string &setting)
 		: register_data_source<priv::disabled_data_source>(name, setting)
@@ -157,9 +182,3 @@ namespace conky {
 		l.rawsetfield(-2, "astext");
 	}
 }
-
-/////////// example data sources, remove after real data sources are available ///////
-int asdf_ = 47;
-conky::register_data_source<conky::simple_numeric_source<int>> asdf("asdf", &asdf_);
-
-conky::register_disabled_data_source zxcv("zxcv", "BUILD_ZXCV");
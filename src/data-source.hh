@@ -24,6 +24,7 @@
 #ifndef DATA_SOURCE_HH
 #define DATA_SOURCE_HH
 
+#include <functional>
 #include <limits>
 #include <string>
 #include <type_traits>
@@ -133,6 +134,56 @@ namespace conky {
 	 * into that table (actually, into a "variables" subtable).
 	 */
 	void export_data_sources(lua::state &l);
+
+	/*
+	 * The values collected in an update are also handed to the Lua scripts as numbers, in the
+	 * conky_values table, so they don't have to conky_parse() a variable and tonumber() the
+	 * text. Each registered snapshot function writes the values of one metric (or a group of
+	 * them) through a snapshot_writer. number() and text() set a field of the current table,
+	 * open() makes a field (or index) the current table until the matching close(). The
+	 * tables are kept between updates, so writing the same fields again allocates nothing.
+	 */
+	class snapshot_writer {
+	public:
+		virtual ~snapshot_writer() {}
+		virtual void number(const char *key, double value) = 0;
+		virtual void number(int index, double value) = 0;
+		virtual void text(const char *key, const char *value) = 0;
+		virtual void open(const char *key) = 0;
+		virtual void open(int index) = 0;
+		virtual void close() = 0;
+		/* remove an index of the current table, e.g. a top entry that has no process now */
+		virtual void erase(int index) = 0;
+	};
+
+	typedef std::function<void (snapshot_writer &)> snapshot_function;
+
+	/*
+	 * Declaring an object of this type at global scope will add fn to the snapshot. The name
+	 * only has to be unique, the functions are called in the order of their names.
+	 */
+	class register_snapshot {
+	public:
+		register_snapshot(const std::string &name, const snapshot_function &fn);
+	};
+
+	/* call all the snapshot functions */
+	void write_snapshot(snapshot_writer &w);
+
+	/*
+	 * A simple_numeric_source which is in the snapshot as well, under the same name.
+	 */
+	template<typename T>
+	class register_numeric_source: public register_data_source<simple_numeric_source<T>> {
+		register_snapshot snapshot;
+
+	public:
+		register_numeric_source(const std::string &name, const T *source)
+			: register_data_source<simple_numeric_source<T>>(name, source),
+			  snapshot(name, [name, source](snapshot_writer &w)
+					  { w.number(name.c_str(), *source); })
+		{}
+	};
 }
 
 #endif /* DATA_SOURCE_HH */
@@ -32,18 +32,31 @@
 #include "conky.h"	/* text_buffer_size */
 #include "core.h"
 #include "logging.h"
+#include "data-source.hh"
 #include "diskio.h"
 #include "common.h"
 #include "specials.h"
 #include "text_object.h"
+#include <math.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+#include <algorithm>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 /* this is the root of all per disk stats,
  * also containing the totals. */
 struct diskio_stat stats;
 
+/* the same entries indexed by device number and by name, so that every name
+ * of a device shares one entry */
+static std::unordered_map<dev_t, struct diskio_stat *> diskio_by_rdev;
+static std::unordered_map<std::string, struct diskio_stat *> diskio_by_name;
+
 void clear_diskio_stats(void)
 {
 	struct diskio_stat *cur;
@@ -51,8 +64,13 @@ void clear_diskio_stats(void)
 		cur = stats.next;
 		stats.next = stats.next->next;
 		free_and_zero(cur->dev);
-		free(cur);
+#ifdef __linux__
+		delete cur->sysfs_stat;
+#endif
+		delete cur;
 	}
+	diskio_by_rdev.clear();
+	diskio_by_name.clear();
 }
 
 struct diskio_stat *prepare_diskio_stat(const char *s)
@@ -76,23 +94,58 @@ struct diskio_stat *prepare_diskio_stat(const char *s)
 
 	if (stat(&(stat_name[0]), &sb)) {
 		NORM_ERR("diskio device '%s' does not exist", s);
+		sb.st_rdev = 0;
+	} else if (!S_ISBLK(sb.st_mode)) {
+		sb.st_rdev = 0;
 	}
 
 	/* lookup existing */
-	while (cur->next) {
-		cur = cur->next;
-		if (!strcmp(cur->dev, &(device_name[0]))) {
-			return cur;
-		}
+	std::unordered_map<std::string, struct diskio_stat *>::iterator i =
+		diskio_by_name.find(&(device_name[0]));
+	if (i != diskio_by_name.end()) {
+		return i->second;
+	}
+	/* another name for a device that's already known, share its entry */
+	std::unordered_map<dev_t, struct diskio_stat *>::iterator j;
+	if (sb.st_rdev && (j = diskio_by_rdev.find(sb.st_rdev)) != diskio_by_rdev.end()) {
+		diskio_by_name[&(device_name[0])] = j->second;
+		return j->second;
 	}
 
 	/* no existing found, make a new one */
+	while (cur->next) {
+		cur = cur->next;
+	}
 	cur->next = new diskio_stat;
 	cur = cur->next;
 	cur->dev = strndup(&(device_name[0]), text_buffer_size.get(*state));
-	cur->last = UINT_MAX;
-	cur->last_read = UINT_MAX;
-	cur->last_write = UINT_MAX;
+	cur->last = ULLONG_MAX;
+	cur->last_read = ULLONG_MAX;
+	cur->last_write = ULLONG_MAX;
+
+	diskio_by_name[cur->dev] = cur;
+	/* symlinks such as /dev/mapper/<name> resolve to the kernel's device */
+	if (sb.st_rdev) {
+		cur->rdev = sb.st_rdev;
+		diskio_by_rdev[sb.st_rdev] = cur;
+	}
+
+#ifdef __linux__
+	/* update_diskio() reads the counters of each device from /sys, which
+	 * knows it by number; a device without a node yet is looked up by name
+	 * there, with the slashes of names like cciss/c0d0 turned into '!' */
+	if (cur->rdev) {
+		snprintf(&(stat_name[0]), text_buffer_size.get(*state), "/sys/dev/block/%u:%u/stat",
+				major(cur->rdev), minor(cur->rdev));
+	} else {
+		std::string name(cur->dev);
+
+		std::replace(name.begin(), name.end(), '/', '!');
+		snprintf(&(stat_name[0]), text_buffer_size.get(*state), "/sys/class/block/%s/stat",
+				name.c_str());
+	}
+	cur->sysfs_stat = new proc_file(&(stat_name[0]), true);
+#endif
 
 	return cur;
 }
@@ -127,6 +180,25 @@ static void print_diskio_dir(struct text_object *obj, int dir, char *p, int p_ma
 	human_readable((val / active_update_interval()) * 1024LL, p, p_max_size);
 }
 
+/* what print_diskio_dir() shows, in bytes per second */
+static double diskio_dir_value(struct text_object *obj, int dir)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+	double val;
+
+	if (!diskio)
+		return NAN;
+
+	if (dir < 0)
+		val = diskio->current_read;
+	else if (dir == 0)
+		val = diskio->current;
+	else
+		val = diskio->current_write;
+
+	return val / active_update_interval() * 1024;
+}
+
 void print_diskio(struct text_object *obj, char *p, int p_max_size)
 {
 	print_diskio_dir(obj, 0, p, p_max_size);
@@ -142,6 +214,81 @@ void print_diskio_write(struct text_object *obj, char *p, int p_max_size)
 	print_diskio_dir(obj, 1, p, p_max_size);
 }
 
+double diskio_value(struct text_object *obj)
+{
+	return diskio_dir_value(obj, 0);
+}
+
+double diskio_read_value(struct text_object *obj)
+{
+	return diskio_dir_value(obj, -1);
+}
+
+double diskio_write_value(struct text_object *obj)
+{
+	return diskio_dir_value(obj, 1);
+}
+
+void print_diskio_iops(struct text_object *obj, char *p, int p_max_size)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	if (diskio && diskio->have_counters)
+		snprintf(p, p_max_size, "%.1f", diskio->current_iops);
+}
+
+void print_diskio_await(struct text_object *obj, char *p, int p_max_size)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	if (diskio && diskio->have_counters)
+		snprintf(p, p_max_size, "%.2f", diskio->current_await);
+}
+
+void print_diskio_util(struct text_object *obj, char *p, int p_max_size)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	if (diskio && diskio->have_counters)
+		percent_print(p, p_max_size, round_to_int(diskio->current_util));
+}
+
+void print_diskio_queue(struct text_object *obj, char *p, int p_max_size)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	if (diskio && diskio->have_counters)
+		snprintf(p, p_max_size, "%.2f", diskio->current_queue);
+}
+
+double diskio_iops_value(struct text_object *obj)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	return diskio && diskio->have_counters ? diskio->current_iops : NAN;
+}
+
+double diskio_await_value(struct text_object *obj)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	return diskio && diskio->have_counters ? diskio->current_await : NAN;
+}
+
+double diskio_util_value(struct text_object *obj)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	return diskio && diskio->have_counters ? diskio->current_util : NAN;
+}
+
+double diskio_queue_value(struct text_object *obj)
+{
+	struct diskio_stat *diskio = (struct diskio_stat *)obj->data.opaque;
+
+	return diskio && diskio->have_counters ? diskio->current_queue : NAN;
+}
+
 #ifdef BUILD_X11
 void parse_diskiograph_arg(struct text_object *obj, const char *arg)
 {
@@ -175,10 +322,9 @@ double diskiographval_write(struct text_object *obj)
 #endif /* BUILD_X11 */
 
 void update_diskio_values(struct diskio_stat *ds,
-		unsigned int reads, unsigned int writes)
+		unsigned long long reads, unsigned long long writes)
 {
-	int i;
-	double sum=0, sum_r=0, sum_w=0;
+	double sample_read, sample_write;
 
 	if (reads < ds->last_read || writes < ds->last_write) {
 		/* counter overflow or reset - rebase to sane values */
@@ -186,30 +332,21 @@ void update_diskio_values(struct diskio_stat *ds,
 		ds->last_read = reads;
 		ds->last_write = writes;
 	}
-	/* since the values in /proc/diskstats are absolute, we have to subtract
+	/* since the kernel's counters are absolute, we have to subtract
 	 * our last reading. The numbers stand for "sectors read", and we therefore
 	 * have to divide by two to get KB */
-	ds->sample_read[0] = (reads - ds->last_read) / 2;
-	ds->sample_write[0] = (writes - ds->last_write) / 2;
-	ds->sample[0] = ds->sample_read[0] + ds->sample_write[0];
+	sample_read = (reads - ds->last_read) / 2;
+	sample_write = (writes - ds->last_write) / 2;
+	/* the samples are kB per update interval, also with sample_interval */
+	sample_read *= update_delta_scale();
+	sample_write *= update_delta_scale();
 
 	/* compute averages */
 	int samples = diskio_avg_samples.get(*state);
-	for (i = 0; i < samples; i++) {
-		sum += ds->sample[i];
-		sum_r += ds->sample_read[i];
-		sum_w += ds->sample_write[i];
-	}
-	ds->current = sum / (double) samples;
-	ds->current_read = sum_r / (double) samples;
-	ds->current_write = sum_w / (double) samples;
-
-	/* shift sample history */
-	for (i = samples-1; i > 0; i--) {
-		ds->sample[i] = ds->sample[i-1];
-		ds->sample_read[i] = ds->sample_read[i-1];
-		ds->sample_write[i] = ds->sample_write[i-1];
-	}
+	average_mode mode = average_mode_setting.get(*state);
+	ds->current = ds->avg.push(sample_read + sample_write, samples, mode);
+	ds->current_read = ds->avg_read.push(sample_read, samples, mode);
+	ds->current_write = ds->avg_write.push(sample_write, samples, mode);
 
 	/* save last */
 	ds->last_read = reads;
@@ -217,3 +354,56 @@ void update_diskio_values(struct diskio_stat *ds,
 	ds->last = ds->last_read + ds->last_write;
 }
 
+/* like update_diskio_values(), for the diskio_counters of one device or
+ * those of several disks summed up; the utilisation is their mean then */
+void update_diskio_counters(struct diskio_stat *ds, const struct diskio_counters &c,
+		unsigned int disks)
+{
+	const struct diskio_counters &l = ds->last_counters;
+	double seconds = active_update_interval() / update_delta_scale();
+	double ios, ticks, io_ticks, time_in_queue;
+
+	if (!ds->have_counters || c.ios < l.ios || c.ticks < l.ticks ||
+			c.io_ticks < l.io_ticks || c.time_in_queue < l.time_in_queue) {
+		/* the first reading, or counter overflow or reset */
+		ds->last_counters = c;
+		ds->have_counters = true;
+		return;
+	}
+	ios = c.ios - l.ios;
+	ticks = c.ticks - l.ticks;
+	io_ticks = c.io_ticks - l.io_ticks;
+	time_in_queue = c.time_in_queue - l.time_in_queue;
+
+	int samples = diskio_avg_samples.get(*state);
+	average_mode mode = average_mode_setting.get(*state);
+	ds->current_iops = ds->avg_iops.push(ios / seconds, samples, mode);
+	ds->current_await = ds->avg_await.push(ios > 0 ? ticks / ios : 0, samples, mode);
+	ds->current_util = ds->avg_util.push(std::min(100.0,
+				io_ticks / (seconds * 10 * std::max(disks, 1u))), samples, mode);
+	ds->current_queue = ds->avg_queue.push(time_in_queue / (seconds * 1000), samples, mode);
+
+	ds->last_counters = c;
+}
+
+
+/* diskio.<device> in the snapshot of the Lua scripts, diskio.total for all
+ * of them, in bytes per second, with what the $diskio_iops and friends show
+ * where the counters are known */
+static conky::register_snapshot diskio_snapshot("diskio", [](conky::snapshot_writer &w) {
+	w.open("diskio");
+	for (struct diskio_stat *ds = &stats; ds; ds = ds->next) {
+		w.open(ds->dev ? ds->dev : "total");
+		w.number("total", ds->current);
+		w.number("read", ds->current_read);
+		w.number("write", ds->current_write);
+		if (ds->have_counters) {
+			w.number("iops", ds->current_iops);
+			w.number("await", ds->current_await);
+			w.number("util", ds->current_util);
+			w.number("queue", ds->current_queue);
+		}
+		w.close();
+	}
+	w.close();
+});
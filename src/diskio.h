@@ -32,32 +32,65 @@
 #define DISKIO_H_
 
 #include <limits.h>
+#include <sys/types.h>
+#include "average.hh"
+
+class proc_file;
+
+/* what a block device has done, from the fields of its stat file in /sys
+ * (see Documentation/block/stat.rst of the kernel); the times are in
+ * milliseconds */
+struct diskio_counters {
+	unsigned long long ios;			/* reads and writes completed */
+	unsigned long long ticks;		/* what they took together */
+	unsigned long long io_ticks;	/* time the device was busy */
+	unsigned long long time_in_queue;	/* ticks weighted by the requests in flight */
+};
 
 struct diskio_stat {
 	diskio_stat() :
 		next(NULL),
+		rdev(0),
 		current(0),
 		current_read(0),
 		current_write(0),
-		last(UINT_MAX),
-		last_read(UINT_MAX),
-		last_write(UINT_MAX)
-	{
-		memset(sample, 0, sizeof(sample) / sizeof(sample[0]));
-		memset(sample_read, 0, sizeof(sample_read) / sizeof(sample_read[0]));
-		memset(sample_write, 0, sizeof(sample_write) / sizeof(sample_write[0]));
-	}
+		last(ULLONG_MAX),
+		last_read(ULLONG_MAX),
+		last_write(ULLONG_MAX),
+		current_iops(0),
+		current_await(0),
+		current_util(0),
+		current_queue(0),
+		last_counters(),
+		have_counters(false)
+#ifdef __linux__
+		, sysfs_stat(NULL)
+#endif
+	{}
 	struct diskio_stat *next;
 	char *dev;
-	double sample[15];
-	double sample_read[15];
-	double sample_write[15];
+	dev_t rdev;	/* 0 until the device node has been seen */
+	conky::moving_average<double> avg, avg_read, avg_write;
 	double current;
 	double current_read;
 	double current_write;
-	double last;
-	double last_read;
-	double last_write;
+	/* raw sector counters of the last update */
+	unsigned long long last;
+	unsigned long long last_read;
+	unsigned long long last_write;
+	/* from the diskio_counters: requests per second, milliseconds per
+	 * request, percent of the time busy and requests waiting or in service */
+	conky::moving_average<double> avg_iops, avg_await, avg_util, avg_queue;
+	double current_iops;
+	double current_await;
+	double current_util;
+	double current_queue;
+	struct diskio_counters last_counters;
+	bool have_counters;
+#ifdef __linux__
+	/* the kernel's counters of just this device, its stat file in /sys */
+	proc_file *sysfs_stat;
+#endif
 };
 
 extern struct diskio_stat stats;
@@ -65,12 +98,24 @@ extern struct diskio_stat stats;
 struct diskio_stat *prepare_diskio_stat(const char *);
 int update_diskio(void);
 void clear_diskio_stats(void);
-void update_diskio_values(struct diskio_stat *, unsigned int, unsigned int);
+void update_diskio_values(struct diskio_stat *, unsigned long long, unsigned long long);
+void update_diskio_counters(struct diskio_stat *, const struct diskio_counters &, unsigned int);
 
 void parse_diskio_arg(struct text_object *, const char *);
 void print_diskio(struct text_object *, char *, int);
 void print_diskio_read(struct text_object *, char *, int);
 void print_diskio_write(struct text_object *, char *, int);
+double diskio_value(struct text_object *);
+double diskio_read_value(struct text_object *);
+double diskio_write_value(struct text_object *);
+void print_diskio_iops(struct text_object *, char *, int);
+void print_diskio_await(struct text_object *, char *, int);
+void print_diskio_util(struct text_object *, char *, int);
+void print_diskio_queue(struct text_object *, char *, int);
+double diskio_iops_value(struct text_object *);
+double diskio_await_value(struct text_object *);
+double diskio_util_value(struct text_object *);
+double diskio_queue_value(struct text_object *);
 #ifdef BUILD_X11
 void parse_diskiograph_arg(struct text_object *, const char *);
 double diskiographval(struct text_object *);
@@ -612,8 +612,8 @@ int update_diskio(void)
 	static struct statinfo statinfo_cur;
 	char device_name[DEFAULT_TEXT_BUFFER_SIZE];
 	struct diskio_stat *cur;
-	unsigned int reads, writes;
-	unsigned int total_reads = 0, total_writes = 0;
+	unsigned long long reads, writes;
+	unsigned long long total_reads = 0, total_writes = 0;
 
 
 	memset(&statinfo_cur, 0, sizeof(statinfo_cur));
@@ -688,9 +688,10 @@ static void proc_count(struct kinfo_proc *kp, size_t proc_n)
 
 static void proc_fill(struct kinfo_proc *kp, size_t proc_n)
 {
+	static std::vector<struct process_sample> samples;
 	size_t i, f = getpagesize();
-	static long prev_ticks = 0; /* safe as long as in same thread */
 
+	samples.clear();
 	for (i = 0; i < proc_n; i++) {
 		struct kinfo_proc *p = &kp[i];
 		struct kinfo_lwp *lwp = &p->kp_lwp;
@@ -698,27 +699,20 @@ static void proc_fill(struct kinfo_proc *kp, size_t proc_n)
 		if (!(p->kp_flags & P_SYSTEM) &&
 			p->kp_comm && *p->kp_comm && /* just to be sure */
 			!lwp->kl_tid) { /* 'main' lwp, the real process (observed) */
-
-			struct process *my = get_process(p->kp_pid);
-			long ticks = proc_rusage(p);
-
-			my->time_stamp = g_time;
-
-			free_and_zero(my->name);
-			my->name = strdup(p->kp_comm);
-
-			my->amount = 100.0 * lwp->kl_pctcpu / FSCALE;
-			my->vsize = p->kp_vm_map_size;
-			my->rss = p->kp_vm_rssize * f;
-
-			my->total_cpu_time = ticks - prev_ticks;
-			prev_ticks = ticks;
-
-			// printf("\tmy[%p]: %s(%u) %d %d 0x%x 0x%x %f\n", p,
-			//        my->name, my->pid, my->vsize, my->rss,
-			// 	   p->kp_flags, lwp->kl_stat, my->amount);
+			struct process_sample s;
+
+			s.pid = p->kp_pid;
+			s.uid = p->kp_uid;
+			s.name = p->kp_comm;
+			s.cpu_perc = 100.0 * lwp->kl_pctcpu / FSCALE;
+			s.vsize = p->kp_vm_map_size;
+			s.rss = p->kp_vm_rssize * f;
+			/* proc_rusage() is in microseconds */
+			s.total_cpu_time = proc_rusage(p) / 10000;
+			samples.push_back(s);
 		}
 	}
+	top_update_processes(samples);
 }
 
 void get_top_info(void)
@@ -26,47 +26,27 @@
 #include "config.h"
 #include "logging.h"
 #include "text_object.h"
+#include "ccurl_thread.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <utime.h>
+#include <sys/time.h>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
-#include <libxml/xmlwriter.h>
-
-#include <curl/curl.h>
-#include <curl/easy.h>
 
 #include <time.h>
 
 #include "conky.h"
 
-#define MAXCHARS 4
-#define EVE_UPDATE_DELAY 60
-
-typedef struct {
-	char *charid;
-	char *skillname;
-	char *time;
-	char *lastOutput;
-
-	struct tm ends;
-	struct tm cache;
-
-	time_t delay;
-
-	int level;
-	int skill;
-} Character;
-
-struct xmlData {
-	char *data;
-	size_t size;
-};
+/* seconds between downloads of the training of a character and of the skill
+ * tree */
+#define EVE_TRAINING_INTERVAL 900
+#define EVE_SKILLTREE_INTERVAL 86400
 
 struct eve_data {
 	char apikey[65];
@@ -74,144 +54,141 @@ struct eve_data {
 	char userid[21];
 };
 
-int num_chars = 0;
-Character eveCharacters[MAXCHARS];
-
-static size_t write_data(void *ptr, size_t size, size_t nmemb, void *stream)
-{
-	size_t realsize = 0;
-	struct xmlData *data = 0;
-	data = (struct xmlData *)stream;
-	realsize = size * nmemb;
-
-	data->data = (char *)realloc(data->data, data->size + realsize + 1);
-	if (data->data) {
-		memcpy(&(data->data[data->size]), ptr, realsize);
-		data->size += realsize;
-		data->data[data->size] = '\0';
+namespace {
+	/* what a character is training */
+	struct eve_training {
+		/* the API answered with an error, or something unreadable */
+		bool error;
+		int skill;
+		int level;
+		struct tm ends;
+	};
+	typedef std::shared_ptr<const eve_training> training_ptr;
+
+	/* skill id -> name */
+	typedef std::unordered_map<int, std::string> skill_index;
+	typedef std::shared_ptr<const skill_index> skill_index_ptr;
+
+	/* the text of the first child of node named name, NULL if there is none */
+	const char *child_text(xmlNodePtr node, const char *name)
+	{
+		for (xmlNodePtr c = node->children; c; c = c->next) {
+			if (c->type == XML_ELEMENT_NODE && !strcasecmp((const char *) c->name, name))
+				return c->children ? (const char *) c->children->content : NULL;
+		}
+		return NULL;
 	}
 
-	return realsize;
-}
+	/* the rows of the skill tree, at whatever depth, with a typeID and a
+	 * typeName are skills */
+	void index_skills(xmlNodePtr node, skill_index &index)
+	{
+		for (; node; node = node->next) {
+			if (node->type != XML_ELEMENT_NODE)
+				continue;
+
+			xmlChar *id = xmlGetProp(node, (const xmlChar *) "typeID");
+			xmlChar *name = xmlGetProp(node, (const xmlChar *) "typeName");
+			if (id && name)
+				index[atoi((const char *) id)] = (const char *) name;
+			xmlFree(id);
+			xmlFree(name);
+			index_skills(node->children, index);
+		}
+	}
 
-int parseTrainingXml(char *data, Character * s)
-{
-	char *skill, *level, *ends, *cache;
-	xmlNodePtr n;
-	xmlDocPtr doc = 0;
-	xmlNodePtr root = 0;
-	struct tm end_tm, cache_tm;
-
-	if (!data)
-		return 1;
-
-	doc = xmlReadMemory(data, strlen(data), "", NULL, 0);
-	root = xmlDocGetRootElement(doc);
-	for (n = root->children; n; n = n->next) {
-		if (n->type == XML_ELEMENT_NODE) {
-			if (!strcasecmp((const char *)n->name, "error")) {
-				return 1;
-			} else if (!strcasecmp((const char *)n->name, "result")) {
-				xmlNodePtr c;
-				for (c = n->children; c; c = c->next) {
-					if (!strcasecmp((const char *)c->name, "trainingEndTime")) {
-						ends = (char *)c->children->content;
-					} else if (!strcasecmp((const char *)c->name, "trainingTypeID")) {
-						if (c->children->content)
-							skill = (char *)c->children->content;
-					} else if (!strcasecmp((const char *)c->name, "trainingToLevel")) {
-						level = (char *)c->children->content;
-					}
+	/* POSTs the user, key and character to the training url */
+	class training_cb: public curl_callback<training_ptr, std::string, std::string, std::string> {
+		typedef curl_callback<training_ptr, std::string, std::string, std::string> Base;
+
+	protected:
+		virtual void process_data()
+		{
+			std::shared_ptr<eve_training> training(new eve_training());
+			xmlDocPtr doc = xmlReadMemory(data.data(), data.size(), "", NULL, 0);
+			xmlNodePtr root = doc ? xmlDocGetRootElement(doc) : NULL;
+			const char *skill = NULL, *level = NULL, *ends = NULL;
+
+			training->error = true;
+			for (xmlNodePtr n = root ? root->children : NULL; n; n = n->next) {
+				if (n->type != XML_ELEMENT_NODE)
+					continue;
+				if (!strcasecmp((const char *) n->name, "error")) {
+					break;
+				} else if (!strcasecmp((const char *) n->name, "result")) {
+					ends = child_text(n, "trainingEndTime");
+					skill = child_text(n, "trainingTypeID");
+					level = child_text(n, "trainingToLevel");
 				}
-			} else if (!strcasecmp((const char *)n->name, "cachedUntil")) {
-				cache = (char *)n->children->content;
 			}
+			if (skill && level && ends
+					&& strptime(ends, "%Y-%m-%d %H:%M:%S", &training->ends)) {
+				training->skill = atoi(skill);
+				training->level = atoi(level);
+				training->error = false;
+			}
+			if (doc)
+				xmlFreeDoc(doc);
+
+			std::lock_guard<std::mutex> lock(Base::result_mutex);
+			Base::result = training;
 		}
-	}
 
-	strptime(ends, "%Y-%m-%d %H:%M:%S", &end_tm);
-	strptime(cache, "%Y-%m-%d %H:%M:%S", &cache_tm);
-	s->skill = atoi(skill);
-	s->level = atoi(level);
-	s->ends = end_tm;
-	s->cache = cache_tm;
+	public:
+		training_cb(uint32_t period, const std::string &url, const std::string &userid,
+				const std::string &apikey, const std::string &charid)
+			: Base(period, Base::Tuple(url, userid, apikey, charid))
+		{
+			std::string post = "userID=" + escape(userid) + "&apiKey=" + escape(apikey)
+				+ "&characterID=" + escape(charid);
 
-	xmlFreeDoc(doc);
-	return 0;
-}
+			curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, post.c_str());
+		}
 
-static char *getXmlFromAPI(const char *userid, const char *apikey, const char *charid, const char *url)
-{
-	struct curl_httppost *post = NULL;
-	struct curl_httppost *last = NULL;
-	struct xmlData chr;
-	char *content;
-	CURL *curl_handle;
-	int rc = 0;
-
-	chr.data = NULL;
-	chr.size = 0;
-
-	curl_handle = curl_easy_init();
-	curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 1);
-	curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-	curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 1);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_data);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&chr);
-
-	if (userid != NULL && apikey != NULL && charid != NULL) {
-		curl_formadd(&post, &last, CURLFORM_COPYNAME, "userID", CURLFORM_COPYCONTENTS, userid, CURLFORM_END);
-		curl_formadd(&post, &last, CURLFORM_COPYNAME, "apiKey", CURLFORM_COPYCONTENTS, apikey, CURLFORM_END);
-		curl_formadd(&post, &last, CURLFORM_COPYNAME, "characterID", CURLFORM_COPYCONTENTS, charid, CURLFORM_END);
-
-		curl_easy_setopt(curl_handle, CURLOPT_HTTPPOST, post);
-	}
+		std::string escape(const std::string &s)
+		{
+			char *e = curl_easy_escape(curl, s.c_str(), s.size());
+			std::string ret(e ? e : "");
 
-	if ((rc = curl_easy_perform(curl_handle)) != CURLE_OK) {
-		return NULL;
-	}
+			curl_free(e);
+			return ret;
+		}
+	};
+
+	/* The skill tree is indexed once per download, which happens rarely and
+	 * is mostly answered with 304 Not Modified */
+	class skilltree_cb: public curl_callback<skill_index_ptr> {
+		typedef curl_callback<skill_index_ptr> Base;
+
+	protected:
+		virtual void process_data()
+		{
+			std::shared_ptr<skill_index> index(new skill_index);
+			xmlDocPtr doc = xmlReadMemory(data.data(), data.size(), "", NULL, 0);
+
+			if (!doc) {
+				NORM_ERR("eve: can't parse the skill tree");
+				return;
+			}
+			index_skills(xmlDocGetRootElement(doc), *index);
+			xmlFreeDoc(doc);
 
-	content = strdup(chr.data);
-	curl_easy_cleanup(curl_handle);
+			std::lock_guard<std::mutex> lock(Base::result_mutex);
+			Base::result = index;
+		}
 
-	return content;
-}
+	public:
+		skilltree_cb(uint32_t period, const std::string &url)
+			: Base(period, Base::Tuple(url))
+		{}
+	};
 
-static void init_eve(void)
-{
-	int i;
-
-	for (i = 0; i < MAXCHARS; i++) {
-		eveCharacters[i].charid = NULL;
-		eveCharacters[i].skillname = NULL;
-		eveCharacters[i].time = NULL;
-		eveCharacters[i].level = 0;
-		eveCharacters[i].skill = 0;
-		eveCharacters[i].delay = 0;
+	uint32_t period_of(double seconds)
+	{
+		return std::max(lround(seconds / active_update_interval()), 1l);
 	}
 }
 
-static int isCacheValid(struct tm cached)
-{
-	struct timeval tv;
-	struct timezone tz;
-	double offset = 0;
-	time_t now = 0;
-	time_t cache = 0;
-	double diff = 0;
-
-	gettimeofday(&tv, &tz);
-	offset = (double)(tz.tz_minuteswest * 60);
-	now = time(NULL);
-	cache = mktime(&cached);
-	diff = difftime(cache, now);
-
-	if (diff < offset)
-		return 0;
-	else
-		return 1;
-}
-
 static char *formatTime(struct tm *ends)
 {
 	struct timeval tv;
@@ -253,177 +230,53 @@ static char *formatTime(struct tm *ends)
 	}
 }
 
-static void writeSkilltree(char *content, const char *filename)
-{
-	FILE *fp = fopen(filename, "w");
-	if (fwrite(content, sizeof(char), strlen(content), fp) < strlen(content))
-		NORM_ERR("skill tree write failed");
-	fclose(fp);
-}
-
-static char *getSkillname(const char *file, int skillid)
-{
-	char *skilltree;
-	char *skill = NULL;
-	xmlNodePtr n;
-	xmlDocPtr doc = 0;
-	xmlNodePtr root = 0;
-
-	skilltree = getXmlFromAPI(NULL, NULL, NULL, EVEURL_SKILLTREE);
-	writeSkilltree(skilltree, file);
-	free(skilltree);
-
-	doc = xmlReadFile(file, NULL, 0);
-	unlink(file);
-	if (!doc)
-		return NULL;
-
-	root = xmlDocGetRootElement(doc);
-
-	for (n = root->children; n; n = n->next) {
-		xmlNodePtr o;
-		for (o = n->children; o; o = o->next) {
-			xmlNodePtr p;
-			for (p = o->children; p; p = p->next) {
-				xmlNodePtr q;
-				for (q = p->children; q; q = q->next) {
-					xmlNodePtr r;
-					for (r = q->children; r; r = r->next) {
-						xmlElementPtr ele = (xmlElementPtr) r;
-						xmlAttrPtr attr = (xmlAttrPtr) ele->attributes;
-						char *mySkill = NULL;
-						int id;
-
-						while (attr != NULL) {
-							if (!strcasecmp((const char *)attr->name, "typeName")) {
-								mySkill = strdup((const char *)attr->children->content);
-							} else if (!strcasecmp((const char *)attr->name, "typeID")) {
-								id = atoi((const char *)attr->children->content);
-							}
-							attr = attr->next;
-						}
-
-						if (id == skillid) {
-							skill = mySkill;
-							goto END;
-						}
-
-						free(mySkill);
-					}
-				}
-			}
-		}
-	}
-      END:
-	xmlFreeDoc(doc);
-
-	return skill;
-}
-
-static char *eve(char *userid, char *apikey, char *charid)
-{
-	Character *chr = NULL;
-	char skillfile[] = "/tmp/.cesfXXXXXX";
-	int i = 0;
-	char *output = 0;
-	char *timel = 0;
-	char *skill = 0;
-	char *content = 0;
-	time_t now = 0;
-	char *error = 0;
-	int tmp_fd, old_umask;
-
-
-	for (i = 0; i < MAXCHARS; i++) {
-		if (eveCharacters[i].charid != NULL) {
-			if (strcasecmp(eveCharacters[i].charid, charid) == 0) {
-				chr = &eveCharacters[i];
-				break;
-			}
-		}
-	}
-
-	if (!chr) {
-		if (num_chars == MAXCHARS - 1)
-			return NULL;
-		chr = &eveCharacters[num_chars];
-		chr->charid = strdup(charid);
-		num_chars++;
-	}
-
-	if (chr->delay > 0) {
-		now = time(NULL);
-		if (now < chr->delay) {
-			output = strdup("Server error");
-			return output;
-		} else
-			chr->delay = 0;
-	}
-
-	if (isCacheValid(chr->cache)) {
-		output = (char *)malloc(200 * sizeof(char));
-		timel = strdup(formatTime(&chr->ends));
-		sprintf(output, EVE_OUTPUT_FORMAT, chr->skillname, chr->level, timel);
-		free(timel);
-		return output;
-	} else {
-		content = getXmlFromAPI(userid, apikey, charid, EVEURL_TRAINING);
-		if (content == NULL) {
-			error = strdup("Server error");
-			now = time(NULL);
-			now += (time_t) 1800;
-			chr->delay = now;
-			return error;
-		}
-
-		if (parseTrainingXml(content, chr)) {
-			output = strdup("API error");
-			return output;
-		}
-
-		timel = formatTime(&chr->ends);
-		old_umask = umask(0066);
-		tmp_fd = mkstemp(skillfile);
-		umask(old_umask);
-		if (tmp_fd == -1) {
-			error = strdup("Cannot create temporary file");
-			return error;
-		}
-		close(tmp_fd);
-		skill = getSkillname(skillfile, chr->skill);
-
-		chr->skillname = strdup(skill);
-
-		output = (char *)malloc(200 * sizeof(char));
-		sprintf(output, EVE_OUTPUT_FORMAT, chr->skillname, chr->level, timel);
-		free(skill);
-		return output;
-	}
-
-}
-
 void scan_eve(struct text_object *obj, const char *arg)
 {
-	int argc;
 	struct eve_data *ed;
 
 	ed = (struct eve_data *) malloc(sizeof(struct eve_data));
 	memset(ed, 0, sizeof(struct eve_data));
 
-	argc = sscanf(arg, "%20s %64s %20s", ed->userid, ed->apikey, ed->charid);
+	sscanf(arg, "%20s %64s %20s", ed->userid, ed->apikey, ed->charid);
 
-	init_eve();
 	obj->data.opaque = ed;
 }
 
+/* Both downloads run in the background on the shared curl fetcher; until
+ * they are done this shows nothing, and the skill id until the skill tree
+ * is in */
 void print_eve(struct text_object *obj, char *p, int p_max_size)
 {
 	struct eve_data *ed = (struct eve_data *) obj->data.opaque;
+	training_ptr training;
+	skill_index_ptr skills;
+	std::string skill;
+	char *timel;
 
 	if (!ed)
 		return;
 
-	snprintf(p, p_max_size, "%s", eve(ed->userid, ed->apikey, ed->charid));
+	training = conky::register_cb<training_cb>(period_of(EVE_TRAINING_INTERVAL),
+			EVEURL_TRAINING, ed->userid, ed->apikey, ed->charid)->get_result_copy();
+	if (!training)
+		return;
+	if (training->error) {
+		snprintf(p, p_max_size, "API error");
+		return;
+	}
+
+	skills = conky::register_cb<skilltree_cb>(period_of(EVE_SKILLTREE_INTERVAL),
+			EVEURL_SKILLTREE)->get_result_copy();
+	auto i = skills ? skills->find(training->skill) : skill_index::const_iterator();
+	if (skills && i != skills->end())
+		skill = i->second;
+	else
+		skill = std::to_string(training->skill);
+
+	struct tm ends = training->ends;
+	timel = formatTime(&ends);
+	snprintf(p, p_max_size, EVE_OUTPUT_FORMAT, skill.c_str(), training->level, timel);
+	free(timel);
 }
 
 void free_eve(struct text_object *obj)
@@ -33,14 +33,30 @@
 #include "logging.h"
 #include "specials.h"
 #include "text_object.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <cmath>
+#include <deque>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 #include "update-cb.hh"
 
+extern char **environ;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 namespace {
 	class exec_cb: public conky::callback<std::string, std::string> {
 		typedef conky::callback<std::string, std::string> Base;
@@ -53,6 +69,167 @@ namespace {
 			: Base(period, wait, Base::Tuple(cmd))
 		{}
 	};
+
+	// keeps a command running, its result are the last lines it printed
+	class execstream_cb: public conky::callback<std::string, std::string, unsigned int> {
+		typedef conky::callback<std::string, std::string, unsigned int> Base;
+
+		pid_t pid;
+		int fd;
+		std::string partial;
+		std::deque<std::string> lines;
+
+		void add_line(const std::string &line);
+
+	protected:
+		virtual void work();
+
+	public:
+		execstream_cb(uint32_t period, const std::string &cmd, unsigned int nlines)
+			: Base(period, true, Base::Tuple(cmd, nlines)), pid(-1), fd(-1)
+		{}
+
+		~execstream_cb();
+	};
+}
+
+static conky::simple_config_setting<bool> exec_shell("exec_shell", false, false);
+static conky::range_config_setting<double> exec_timeout("exec_timeout", 0.0,
+		std::numeric_limits<double>::infinity(), 0.0, true);
+
+/* One long running /bin/sh that runs the exec commands given to it, instead
+ * of a sh -c for each of them. A command is sent as an eval of it, followed
+ * by a printf of a marker line, and its output is everything up to the
+ * marker. Commands run one at a time. */
+class shared_shell {
+	std::mutex mutex;
+	pid_t pid;
+	int fd;
+	unsigned long serial;
+
+	bool start();
+	void stop();
+	bool send_all(const std::string &s);
+
+public:
+	shared_shell() : pid(-1), fd(-1), serial(0) {}
+	bool run(const std::string &cmd, std::string &out);
+	void close();
+};
+
+static shared_shell exec_shell_process;
+
+bool shared_shell::start()
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return false;
+	pid = fork();
+	if (pid == -1) {
+		::close(fds[0]);
+		::close(fds[1]);
+		return false;
+	} else if (pid == 0) {
+		::close(fds[0]);
+		dup2(fds[1], 0);
+		dup2(fds[1], 1);
+		if (fds[1] > 1)
+			::close(fds[1]);
+		execl("/bin/sh", "sh", (char *) NULL);
+		_exit(EXIT_FAILURE);
+	}
+	::close(fds[1]);
+	fd = fds[0];
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	TRACE2(exec__start, pid, "/bin/sh");
+	return true;
+}
+
+void shared_shell::stop()
+{
+	if (fd != -1)
+		::close(fd);
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	fd = -1;
+	pid = -1;
+}
+
+bool shared_shell::send_all(const std::string &s)
+{
+	size_t done = 0;
+
+	while (done < s.size()) {
+		ssize_t n = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+/* returns false if the shell could not be used, out is then untouched */
+bool shared_shell::run(const std::string &cmd, std::string &out)
+{
+	std::lock_guard<std::mutex> l(mutex);
+	std::string script("eval '"), marker, buf, end;
+	char b[0x1000];
+
+	if (pid == -1 && !start())
+		return false;
+
+	for (char c : cmd) {
+		if (c == '\'')
+			script += "'\\''";
+		else
+			script += c;
+	}
+	marker = "conky-exec-" + std::to_string(getpid()) + "-" + std::to_string(++serial);
+	script += "' </dev/null\nprintf '\\n%s\\n' " + marker + "\n";
+	end = "\n" + marker + "\n";
+
+	if (!send_all(script)) {
+		stop();
+		return false;
+	}
+	for (;;) {
+		ssize_t n = read(fd, b, sizeof b);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			/* the command ended the shell, the next one starts another */
+			stop();
+			break;
+		}
+		buf.append(b, n);
+		if (buf.size() >= end.size()
+				&& buf.compare(buf.size() - end.size(), end.size(), end) == 0) {
+			buf.resize(buf.size() - end.size());
+			break;
+		}
+	}
+	TRACE2(exec__done, pid, buf.size());
+	out = buf;
+	return true;
+}
+
+void shared_shell::close()
+{
+	std::lock_guard<std::mutex> l(mutex);
+
+	stop();
+}
+
+void close_exec_shell(void)
+{
+	exec_shell_process.close();
 }
 
 struct execi_data {
@@ -61,81 +238,207 @@ struct execi_data {
 	execi_data() : interval(0), cmd(0) {}
 };
 
-//our own implementation of popen, the difference : the value of 'childpid' will be filled with
-//the pid of the running 'command'. This is useful if want to kill it when it hangs while reading
-//or writing to it. We have to kill it because pclose will wait until the process dies by itself
-static FILE* pid_popen(const char *command, const char *mode, pid_t *child) {
-	int ends[2];
-	int parentend, childend;
-
-	//by running pipe after the strcmp's we make sure that we don't have to create a pipe
-	//and close the ends if mode is something illegal
-	if(strcmp(mode, "r") == 0) {
-		if(pipe(ends) != 0) {
-			return NULL;
-		}
-		parentend = ends[0];
-		childend = ends[1];
-	} else if(strcmp(mode, "w") == 0) {
-		if(pipe(ends) != 0) {
-			return NULL;
-		}
-		parentend = ends[1];
-		childend = ends[0];
-	} else {
-		return NULL;
+struct execstream_data {
+	unsigned int lines;
+	char *cmd;
+	execstream_data() : lines(1), cmd(0) {}
+};
+
+//start command under /bin/sh with its stdout going to the returned pipe, which is
+//nonblocking. posix_spawn() doesn't copy the memory of conky (large with Lua, cairo and
+//Imlib2 loaded) the way fork() does. Returns -1 if it could not be started
+static int spawn_command(const char *command, pid_t *child) {
+	std::pair<int, int> ends;
+	posix_spawn_file_actions_t actions;
+	const char *argv[] = { "sh", "-c", command, NULL };
+	int err;
+
+	try {
+		ends = pipe2(O_CLOEXEC);
+	} catch(errno_error &e) {
+		NORM_ERR("exec: %s", e.what());
+		return -1;
 	}
-	*child = fork();
-	if(*child == -1) {
-		close(parentend);
-		close(childend);
-		return NULL;
-	} else if(*child > 0) {
-		close(childend);
-		waitpid(*child, NULL, 0);
-	} else {
-		//don't read from both stdin and pipe or write to both stdout and pipe
-		if(childend == ends[0]) {
-			close(0);
-		} else {
-			close(1);
+
+	//dup2() clears close-on-exec of the child's stdout, the other ends are closed by exec
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, ends.second, 1);
+	err = posix_spawn(child, "/bin/sh", &actions, NULL, const_cast<char **>(argv), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(ends.second);
+	if(err != 0) {
+		close(ends.first);
+		return -1;
+	}
+	TRACE2(exec__start, *child, command);
+	fcntl(ends.first, F_SETFL, fcntl(ends.first, F_GETFL) | O_NONBLOCK);
+	return ends.first;
+}
+
+void exec_detached(const std::string &command)
+{
+	std::thread([command]() {
+		std::string out;
+		char b[0x1000];
+		pid_t pid;
+		int fd;
+
+		conky::setup_worker_thread("conky-exec");
+		if(exec_shell.get(*::state) && exec_shell_process.run(command, out))
+			return;
+
+		fd = spawn_command(command.c_str(), &pid);
+		if(fd == -1) {
+			NORM_ERR("exec: can't start '%s'", command.c_str());
+			return;
 		}
-		close(parentend);
+		//the output is thrown away, but read so the command doesn't block on it
+		for(;;) {
+			struct pollfd pfd = { fd, POLLIN, 0 };
 
-		//by dupping childend, the returned fd will have close-on-exec turned off
-		if (dup(childend) == -1)
-			perror("dup()");
-		close(childend);
+			if(poll(&pfd, 1, -1) < 0 && errno != EINTR)
+				break;
 
-		execl("/bin/sh", "sh", "-c", command, (char *) NULL);
-		_exit(EXIT_FAILURE); //child should die here, (normally execl will take care of this but it can fail)
-	}
-	return fdopen(parentend, mode);
+			ssize_t length = read(fd, b, sizeof b);
+			if(length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR))
+				break;
+		}
+		close(fd);
+		waitpid(pid, NULL, 0);
+		TRACE2(exec__done, pid, 0);
+	}).detach();
 }
 
 void exec_cb::work()
 {
 	pid_t childpid;
 	std::string buf;
-	std::shared_ptr<FILE> fp;
 	char b[0x1000];
+	int fd;
+	double timeout = exec_timeout.get(*::state);
+	double deadline = get_time() + timeout;
 
-	if(FILE *t = pid_popen(std::get<0>(tuple).c_str(), "r", &childpid))
-		fp.reset(t, fclose);
-	else
+	if(exec_shell.get(*::state) && exec_shell_process.run(std::get<0>(tuple), buf)) {
+		if(!buf.empty() && *buf.rbegin() == '\n')
+			buf.resize(buf.size()-1);
+
+		publish_result(std::move(buf));
 		return;
+	}
 
-	while(!feof(fp.get()) && !ferror(fp.get())) {
-		int length = fread(b, 1, sizeof b, fp.get());
-		buf.append(b, length);
+	fd = spawn_command(std::get<0>(tuple).c_str(), &childpid);
+	if(fd == -1)
+		return;
+
+	//read as the output comes, a child with more of it than fits in the pipe would
+	//otherwise never exit
+	for(;;) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int wait_ms = -1;
+
+		if(timeout > 0) {
+			double left = deadline - get_time();
+
+			if(left <= 0) {
+				NORM_ERR("exec: '%s' took longer than exec_timeout, killing it",
+						std::get<0>(tuple).c_str());
+				kill(childpid, SIGKILL);
+				break;
+			}
+			wait_ms = std::ceil(left * 1000);
+		}
+		if(poll(&pfd, 1, wait_ms) < 0 && errno != EINTR)
+			break;
+
+		ssize_t length = read(fd, b, sizeof b);
+		if(length > 0)
+			buf.append(b, length);
+		else if(length == 0 || (errno != EAGAIN && errno != EINTR))
+			break;
 	}
+	close(fd);
+	waitpid(childpid, NULL, 0);
+
+	TRACE2(exec__done, childpid, buf.size());
 
-	if(*buf.rbegin() == '\n')
+	if(!buf.empty() && *buf.rbegin() == '\n')
 		buf.resize(buf.size()-1);
 
-	std::lock_guard<std::mutex> l(result_mutex);
-	result = buf;
+	publish_result(std::move(buf));
 }
+void execstream_cb::add_line(const std::string &line)
+{
+	lines.push_back(line);
+	while(lines.size() > get<1>())
+		lines.pop_front();
+}
+
+void execstream_cb::work()
+{
+	char b[0x1000];
+	bool changed = false;
+
+	if(fd == -1) {
+		fd = spawn_command(get<0>().c_str(), &pid);
+		if(fd == -1)
+			return;
+	}
+
+	for(;;) {
+		ssize_t length = read(fd, b, sizeof b);
+
+		if(length > 0) {
+			partial.append(b, length);
+			changed = true;
+			continue;
+		}
+		if(length < 0 && errno == EINTR)
+			continue;
+		if(length < 0 && errno == EAGAIN)
+			break;
+
+		//the command ended, it is started again on the next run
+		close(fd);
+		waitpid(pid, NULL, 0);
+		TRACE2(exec__done, pid, partial.size());
+		fd = -1;
+		pid = -1;
+		if(!partial.empty()) {
+			partial += '\n';
+			changed = true;
+		}
+		break;
+	}
+	if(!changed)
+		return;
+
+	size_t start = 0, end;
+	while((end = partial.find('\n', start)) != std::string::npos) {
+		add_line(partial.substr(start, end - start));
+		start = end + 1;
+	}
+	partial.erase(0, start);
+
+	std::string text;
+	for(const std::string &line : lines) {
+		if(!text.empty())
+			text += '\n';
+		text += line;
+	}
+
+	publish_result(std::move(text));
+}
+
+execstream_cb::~execstream_cb()
+{
+	if(fd == -1)
+		return;
+
+	close(fd);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
 //remove backspaced chars, example: "dog^H^H^Hcat" becomes "cat"
 //string has to end with \0 and it's length should fit in a int
 #define BACKSPACE 8
@@ -191,6 +494,24 @@ void scan_execi_arg(struct text_object *obj, const char *arg)
 	obj->data.opaque = ed;
 }
 
+void scan_execstream_arg(struct text_object *obj, const char *arg)
+{
+	struct execstream_data *ed;
+	int n = 0;
+
+	ed = new execstream_data;
+
+	if (sscanf(arg, "%u %n", &ed->lines, &n) <= 0)
+		n = 0;
+	if (!ed->lines || !arg[n]) {
+		NORM_ERR("${execstream (lines) command}");
+		delete ed;
+		return;
+	}
+	ed->cmd = strndup(arg + n, text_buffer_size.get(*state));
+	obj->data.opaque = ed;
+}
+
 void scan_execi_bar_arg(struct text_object *obj, const char *arg)
 {
 	/* XXX: do real bar parsing here */
@@ -231,10 +552,63 @@ void fill_p(const char *buffer, struct text_object *obj, char *p, int p_max_size
 	remove_deleted_chars(p);
 }
 
+namespace {
+	/* The output of an execp, execpi or texecpi, parsed into objects.
+	 * Commands mostly print the same thing again, so the objects (and the
+	 * callbacks they registered) are kept until the output changes, then
+	 * thrown away straight away instead of filling the evaluate() cache. */
+	struct parsed_output {
+		std::shared_ptr<const std::string> text;
+		struct text_object root;
+		bool in_use;
+
+		parsed_output() : text(), root(), in_use(false) {}
+	};
+
+	std::unordered_map<const struct text_object *, parsed_output> parsed_outputs;
+}
+
+static void print_output(const std::shared_ptr<const std::string> &out,
+		struct text_object *obj, char *p, int p_max_size)
+{
+	if(!obj->parse) {
+		fill_p(out->c_str(), obj, p, p_max_size);
+		return;
+	}
+
+	parsed_output &po = parsed_outputs[obj];
+	if(po.in_use) {
+		//the output prints itself somehow
+		fill_p(out->c_str(), obj, p, p_max_size);
+		return;
+	}
+	//the same snapshot of the output, or the same text again
+	if(po.text != out && (!po.text || *po.text != *out)) {
+		free_text_objects(&po.root);
+		extract_variable_text_internal(&po.root, out->c_str());
+	}
+	po.text = out;
+
+	po.in_use = true;
+	generate_text_internal(p, p_max_size, po.root);
+	po.in_use = false;
+	remove_deleted_chars(p);
+}
+
+static void free_parsed_output(struct text_object *obj)
+{
+	auto i = parsed_outputs.find(obj);
+
+	if(i == parsed_outputs.end())
+		return;
+	free_text_objects(&i->second.root);
+	parsed_outputs.erase(i);
+}
+
 void print_exec(struct text_object *obj, char *p, int p_max_size)
 {
 	auto cb = conky::register_cb<exec_cb>(1, true, obj->data.s);
-	fill_p(cb->get_result_copy().c_str(), obj, p, p_max_size);
+	print_output(cb->get_result_ptr(), obj, p, p_max_size);
 }
 
 void print_execi(struct text_object *obj, char *p, int p_max_size)
@@ -248,13 +622,25 @@ void print_execi(struct text_object *obj, char *p, int p_max_size)
 
 	auto cb = conky::register_cb<exec_cb>(period, !obj->thread, ed->cmd);
 
-	fill_p(cb->get_result_copy().c_str(), obj, p, p_max_size);
+	print_output(cb->get_result_ptr(), obj, p, p_max_size);
+}
+
+void print_execstream(struct text_object *obj, char *p, int p_max_size)
+{
+	struct execstream_data *ed = (struct execstream_data *)obj->data.opaque;
+
+	if (!ed)
+		return;
+
+	auto cb = conky::register_cb<execstream_cb>(1, ed->cmd, ed->lines);
+
+	fill_p(cb->get_result_ptr()->c_str(), obj, p, p_max_size);
 }
 
 double execbarval(struct text_object *obj)
 {
 	auto cb = conky::register_cb<exec_cb>(1, true, obj->data.s);
-	return get_barnum(cb->get_result_copy().c_str());
+	return get_barnum(cb->get_result_ptr()->c_str());
 }
 
 double execi_barval(struct text_object *obj)
@@ -268,11 +654,12 @@ double execi_barval(struct text_object *obj)
 
 	auto cb = conky::register_cb<exec_cb>(period, !obj->thread, ed->cmd);
 
-	return get_barnum(cb->get_result_copy().c_str());
+	return get_barnum(cb->get_result_ptr()->c_str());
 }
 
 void free_exec(struct text_object *obj)
 {
+	free_parsed_output(obj);
 	free_and_zero(obj->data.s);
 }
 
@@ -280,6 +667,19 @@ void free_execi(struct text_object *obj)
 {
 	struct execi_data *ed = (struct execi_data *)obj->data.opaque;
 
+	free_parsed_output(obj);
+	if (!ed)
+		return;
+
+	free_and_zero(ed->cmd);
+	delete ed;
+	obj->data.opaque = NULL;
+}
+
+void free_execstream(struct text_object *obj)
+{
+	struct execstream_data *ed = (struct execstream_data *)obj->data.opaque;
+
 	if (!ed)
 		return;
 
@@ -32,17 +32,27 @@
 #define _EXEC_H
 
 #include "text_object.h"
+#include <string>
 
 void scan_exec_arg(struct text_object *, const char *);
 void scan_execi_arg(struct text_object *, const char *);
+void scan_execstream_arg(struct text_object *, const char *);
 void scan_execi_bar_arg(struct text_object *, const char *);
 void scan_execi_gauge_arg(struct text_object *, const char *);
 void scan_execgraph_arg(struct text_object *, const char *);
 void print_exec(struct text_object *, char *, int);
 void print_execi(struct text_object *, char *, int);
+void print_execstream(struct text_object *, char *, int);
 double execbarval(struct text_object *);
 double execi_barval(struct text_object *);
 void free_exec(struct text_object *);
 void free_execi(struct text_object *);
+void free_execstream(struct text_object *);
+void close_exec_shell(void);
+
+/* run a command for what it does, in a thread of its own, like the exec
+ * objects run theirs (in the shared shell with exec_shell); what it prints is
+ * thrown away */
+void exec_detached(const std::string &command);
 
 #endif /* _EXEC_H */
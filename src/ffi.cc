@@ -0,0 +1,153 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "conky_ffi.h"
+#include "data-source.hh"
+#include "ffi.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+	/* the paths ids were asked for, and their values in the last update */
+	std::unordered_map<std::string, int> ffi_ids;
+	std::vector<double> ffi_values;
+	/* the ids of the received and sent rates of the interfaces */
+	std::vector<std::pair<int, int>> ffi_net_ids;
+
+	/* stores the values of the snapshot that have an id, by their path */
+	class ffi_snapshot_writer: public conky::snapshot_writer {
+		std::string path;
+		std::vector<size_t> lengths;
+
+		void value(const std::string &key, double value)
+		{
+			size_t len = path.size();
+
+			path += key;
+			auto i = ffi_ids.find(path);
+			if (i != ffi_ids.end())
+				ffi_values[i->second] = value;
+			path.resize(len);
+		}
+
+		void enter(const std::string &key)
+		{
+			lengths.push_back(path.size());
+			path += key;
+			path += '.';
+		}
+
+	public:
+		void number(const char *key, double v)
+		{ value(key, v); }
+
+		void number(int index, double v)
+		{ value(std::to_string(index), v); }
+
+		void text(const char *, const char *)
+		{}
+
+		void open(const char *key)
+		{ enter(key); }
+
+		void open(int index)
+		{ enter(std::to_string(index)); }
+
+		void close()
+		{
+			path.resize(lengths.back());
+			lengths.pop_back();
+		}
+
+		void erase(int)
+		{}
+	};
+}
+
+void update_ffi(void)
+{
+	ffi_snapshot_writer w;
+
+	if (ffi_ids.empty())
+		return;
+	std::fill(ffi_values.begin(), ffi_values.end(), NAN);
+	conky::write_snapshot(w);
+}
+
+extern "C" {
+
+int conky_metric_id(const char *path)
+{
+	if (!path)
+		return -1;
+	auto i = ffi_ids.insert({path, ffi_values.size()});
+	if (i.second)
+		ffi_values.push_back(NAN);
+	return i.first->second;
+}
+
+double conky_metric_get(int id)
+{
+	if (id < 0 || (size_t) id >= ffi_values.size())
+		return NAN;
+	return ffi_values[id];
+}
+
+double conky_cpu_usage(int n)
+{
+	if (!info.cpu_usage || n < 0 || n > info.cpu_count)
+		return NAN;
+	return info.cpu_usage[n] * 100;
+}
+
+int conky_net_id(const char *iface)
+{
+	std::string prefix;
+
+	if (!iface)
+		return -1;
+	prefix = std::string("net.") + iface + '.';
+	ffi_net_ids.push_back({ conky_metric_id((prefix + "downspeed").c_str()),
+			conky_metric_id((prefix + "upspeed").c_str()) });
+	return ffi_net_ids.size() - 1;
+}
+
+double conky_net_rate(int iface_id, int dir)
+{
+	if (iface_id < 0 || (size_t) iface_id >= ffi_net_ids.size())
+		return NAN;
+	return conky_metric_get(dir ? ffi_net_ids[iface_id].second : ffi_net_ids[iface_id].first);
+}
+
+}
@@ -30,10 +30,16 @@
 #include "conky.h"
 #include "fonts.h"
 #include "logging.h"
+#include "update-cb.hh"
+#ifdef BUILD_XFT
+#include <thread>
+#endif /* BUILD_XFT */
 
 int selected_font = 0;
 std::vector<font_list> fonts;
 char fontloaded = 0;
+/* fonts were added or renamed since load_fonts() last went over them */
+static bool fonts_dirty = true;
 
 void font_setting::lua_setter(lua::state &l, bool init)
 {
@@ -45,6 +51,7 @@ void font_setting::lua_setter(lua::state &l, bool init)
 		if(fonts.size() == 0)
 			fonts.resize(1);
 		fonts[0].name = do_convert(l, -1).first;
+		fonts_dirty = true;
 	}
 
 	++s;
@@ -116,6 +123,7 @@ int add_font(const char *data_in)
 	}
 	fonts.push_back(font_list());
 	fonts.rbegin()->name = data_in;
+	fonts_dirty = true;
 
 	return fonts.size()-1;
 }
@@ -146,6 +154,7 @@ void free_fonts(bool utf8) {
 		}
 	}
 	fonts.clear();
+	fonts_dirty = true;
 	selected_font = 0;
 #ifdef BUILD_XFT
 	if (window.xftdraw) {
@@ -155,9 +164,52 @@ void free_fonts(bool utf8) {
 #endif /* BUILD_XFT */
 }
 
-void load_fonts(bool utf8) {
-	if (not out_to_x.get(*state))
+#ifdef BUILD_XFT
+/* Opening the first Xft font makes fontconfig read its configuration and
+ * caches, which takes a while with many fonts installed. A thread does that,
+ * and matches the fonts set so far, while the text is parsed; the fonts are
+ * then opened from what it loaded. It only uses fontconfig, not Xlib. */
+static std::thread font_warmup;
+
+void start_font_warmup(void)
+{
+	std::vector<std::string> names;
+
+	if (not out_to_x.get(*state) || not use_xft.get(*state) || font_warmup.joinable())
 		return;
+	for (size_t i = 0; i < fonts.size(); i++)
+		names.push_back(fonts[i].name);
+
+	font_warmup = std::thread([names] {
+		conky::setup_worker_thread("conky-fonts");
+		if (!FcInit())
+			return;
+		for (size_t i = 0; i < names.size(); i++) {
+			FcPattern *pattern = FcNameParse((const FcChar8 *) names[i].c_str());
+			FcResult result;
+
+			if (!pattern)
+				continue;
+			FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+			FcDefaultSubstitute(pattern);
+			if (FcPattern *match = FcFontMatch(NULL, pattern, &result))
+				FcPatternDestroy(match);
+			FcPatternDestroy(pattern);
+		}
+	});
+}
+
+void finish_font_warmup(void)
+{
+	if (font_warmup.joinable())
+		font_warmup.join();
+}
+#endif /* BUILD_XFT */
+
+bool load_fonts(bool utf8) {
+	if (not out_to_x.get(*state) || not fonts_dirty)
+		return false;
+	fonts_dirty = false;
 	for (size_t i = 0; i < fonts.size(); i++) {
 #ifdef BUILD_XFT
 		/* load Xft font */
@@ -202,4 +254,5 @@ void load_fonts(bool utf8) {
 			}
 		}
 	}
+	return true;
 }
@@ -83,7 +83,15 @@ void setup_fonts(void);
 void set_font(void);
 int add_font(const char *);
 void free_fonts(bool utf8);
-void load_fonts(bool utf8);
+/* load the fonts added since the last call, true if there were any */
+bool load_fonts(bool utf8);
+
+#ifdef BUILD_XFT
+/* have fontconfig load its caches in the background, from when the settings
+ * are known until the fonts are loaded; finish_font_warmup() waits for it */
+void start_font_warmup(void);
+void finish_font_warmup(void);
+#endif /* BUILD_XFT */
 
 class font_setting: public conky::simple_config_setting<std::string> {
 	typedef conky::simple_config_setting<std::string> Base;
@@ -54,6 +54,9 @@
 #include <dev/acpica/acpiio.h>
 
 #include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "conky.h"
 #include "freebsd.h"
@@ -80,11 +83,47 @@ proc_find_top(struct process **cpu, struct process **mem, struct process **time)
 
 static short cpu_setup = 0;
 
+/* the MIBs of the sysctl names used so far, empty for the unknown ones, so
+ * only the first lookup of a name has to resolve it */
+static std::mutex mib_mutex;
+static std::unordered_map<std::string, std::vector<int> > mib_cache;
+
+static const std::vector<int> &sysctl_mib(const char *name)
+{
+	std::lock_guard<std::mutex> guard(mib_mutex);
+	auto i = mib_cache.find(name);
+
+	if (i == mib_cache.end()) {
+		int mib[CTL_MAXNAME];
+		size_t miblen = CTL_MAXNAME;
+		std::vector<int> v;
+
+		if (sysctlnametomib(name, mib, &miblen) == 0) {
+			v.assign(mib, mib + miblen);
+		}
+		i = mib_cache.emplace(name, std::move(v)).first;
+	}
+	/* the nodes of an unordered_map stay put */
+	return i->second;
+}
+
+/* sysctlbyname() with the cached MIB */
+static int sysctl_cached(const char *name, void *ptr, size_t *len)
+{
+	const std::vector<int> &mib = sysctl_mib(name);
+
+	if (mib.empty()) {
+		errno = ENOENT;
+		return -1;
+	}
+	return sysctl(const_cast<int *>(mib.data()), mib.size(), ptr, len, NULL, 0);
+}
+
 static int getsysctl(const char *name, void *ptr, size_t len)
 {
 	size_t nlen = len;
 
-	if (sysctlbyname(name, ptr, &nlen, NULL, 0) == -1) {
+	if (sysctl_cached(name, ptr, &nlen) == -1) {
 		return -1;
 	}
 
@@ -275,12 +314,32 @@ int update_net_stats(void)
 	return 0;
 }
 
+/* The processes of this update, from one kvm_getprocs() shared by everything
+ * that looks at them. Call with kvm_proc_mutex held; the array is kvm's and
+ * stays as it is until the next update asks for it again. */
+static struct kinfo_proc *get_processes(int *n_processes)
+{
+	static double last_update = -1;
+	static struct kinfo_proc *p = NULL;
+	static int n = 0;
+
+	if (last_update != current_update_time) {
+		p = kvm_getprocs(kd, KERN_PROC_PROC, 0, &n);
+		if (!p) {
+			n = 0;
+		}
+		last_update = current_update_time;
+	}
+	*n_processes = n;
+	return p;
+}
+
 int update_total_processes(void)
 {
 	int n_processes;
 
 	std::lock_guard<std::mutex> guard(kvm_proc_mutex);
-	kvm_getprocs(kd, KERN_PROC_ALL, 0, &n_processes);
+	get_processes(&n_processes);
 
 	info.procs = n_processes;
 	return 0;
@@ -293,7 +352,7 @@ int update_running_processes(void)
 	int i, cnt = 0;
 
 	std::lock_guard<std::mutex> guard(kvm_proc_mutex);
-	p = kvm_getprocs(kd, KERN_PROC_ALL, 0, &n_processes);
+	p = get_processes(&n_processes);
 	for (i = 0; i < n_processes; i++) {
 #if (__FreeBSD__ < 5) && !defined(__FreeBSD_kernel__)
 		if (p[i].kp_proc.p_stat == SRUN) {
@@ -358,7 +417,7 @@ int update_cpu_usage(void)
 	cp_len = CPUSTATES * sizeof(long);
 	cp_time = (long int *) malloc(cp_len);
 
-	if (sysctlbyname("kern.cp_time", cp_time, &cp_len, NULL, 0) < 0) {
+	if (sysctl_cached("kern.cp_time", cp_time, &cp_len) < 0) {
 		fprintf(stderr, "Cannot get kern.cp_time\n");
 	}
 
@@ -385,7 +444,7 @@ int update_cpu_usage(void)
 	cp_time = (long int *) malloc(cp_len);
 
 	/* on e.g. i386 SMP we may have more values than actual cpus; this will just drop extra values */
-	if (sysctlbyname("kern.cp_times", cp_time, &cp_len, NULL, 0) < 0 && errno != ENOMEM) {
+	if (sysctl_cached("kern.cp_times", cp_time, &cp_len) < 0 && errno != ENOMEM) {
 		fprintf(stderr, "Cannot get kern.cp_times\n");
 	}
 
@@ -666,8 +725,8 @@ int update_diskio(void)
 	static struct statinfo statinfo_cur;
 	char device_name[text_buffer_size.get(*state)];
 	struct diskio_stat *cur;
-	unsigned int reads, writes;
-	unsigned int total_reads = 0, total_writes = 0;
+	unsigned long long reads, writes;
+	unsigned long long total_reads = 0, total_writes = 0;
 
 
 	memset(&statinfo_cur, 0, sizeof(statinfo_cur));
@@ -715,30 +774,32 @@ int update_diskio(void)
 
 void get_top_info(void)
 {
+	static std::vector<struct process_sample> samples;
 	struct kinfo_proc *p;
-	struct process *proc;
 	int n_processes;
 	int i;
 
 	std::lock_guard<std::mutex> guard(kvm_proc_mutex);
-	p = kvm_getprocs(kd, KERN_PROC_PROC, 0, &n_processes);
+	p = get_processes(&n_processes);
 
+	samples.clear();
 	for (i = 0; i < n_processes; i++) {
 		if (!((p[i].ki_flag & P_SYSTEM)) && p[i].ki_comm != NULL) {
-			proc = find_process(p[i].ki_pid);
-			if (!proc)
-				proc = new_process(p[i].ki_pid);
-
-			proc->time_stamp = g_time;
-			proc->name = strndup(p[i].ki_comm, text_buffer_size.get(*state));
-			proc->amount = 100.0 * p[i].ki_pctcpu / FSCALE;
-			proc->vsize = p[i].ki_size;
-			proc->rss = (p[i].ki_rssize * getpagesize());
+			struct process_sample s;
+
+			s.pid = p[i].ki_pid;
+			s.uid = p[i].ki_uid;
+			s.name = p[i].ki_comm;
+			s.cpu_perc = 100.0 * p[i].ki_pctcpu / FSCALE;
+			s.vsize = p[i].ki_size;
+			s.rss = (p[i].ki_rssize * getpagesize());
 			/* ki_runtime is in microseconds, total_cpu_time in centiseconds.
 			 * Therefore we divide by 10000. */
-			proc->total_cpu_time = p[i].ki_runtime / 10000;
+			s.total_cpu_time = p[i].ki_runtime / 10000;
+			samples.push_back(s);
 		}
 	}
+	top_update_processes(samples);
 }
 
 void get_battery_short_status(char *buffer, unsigned int n, const char *bat)
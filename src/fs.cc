@@ -30,14 +30,23 @@
 
 #include "conky.h"
 #include "logging.h"
+#include "data-source.hh"
 #include "fs.h"
 #include "specials.h"
 #include "text_object.h"
+#include "update-cb.hh"
 #include <ctype.h>
 #include <unistd.h>
 #include <errno.h>
+#include <math.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #ifdef HAVE_SYS_STATFS_H
 #include <sys/statfs.h>
@@ -52,31 +61,136 @@
 
 #if !defined(HAVE_STRUCT_STATFS_F_FSTYPENAME) && \
 	!defined (__OpenBSD__) && !defined(__FreeBSD__) && !defined(__DragonFly__)
+#ifdef __linux__
+#include <poll.h>
+#else
 #include <mntent.h>
 #endif
+#endif
 
-#define MAX_FS_STATS 64
 
 static struct fs_stat fs_stats_[MAX_FS_STATS];
 struct fs_stat *fs_stats = fs_stats_;
 
-static void update_fs_stat(struct fs_stat *fs);
+/* how long an update waits for the statfs() calls it started */
+static conky::range_config_setting<double> fs_timeout("fs_timeout", 0.0,
+		std::numeric_limits<double>::infinity(), 1.0, true);
+
+namespace {
+	/*
+	 * One statfs() of a path, done in a thread of its own. A hung network filesystem
+	 * can block a statfs() for minutes, this way it only blocks that thread. The slot
+	 * starts no other job until the hung one returns, so there are never more of these
+	 * threads than slots.
+	 */
+	struct statfs_job {
+		const std::string path;
+		double started;
+		/* the rest is protected by fs_job_mutex */
+		bool done;
+		int err;
+		struct statfs64 s;
+
+		statfs_job(const char *path_)
+			: path(path_), started(get_time()), done(false), err(0)
+		{}
+	};
+
+	std::mutex fs_job_mutex;
+	/* signalled whenever a job is done */
+	std::condition_variable fs_job_cv;
+
+	/* the job of each slot of fs_stats_, if one is running or wasn't looked at yet */
+	std::shared_ptr<statfs_job> fs_jobs[MAX_FS_STATS];
+
+	void run_statfs_job(std::shared_ptr<statfs_job> job)
+	{
+		struct statfs64 s;
+		int err = 0;
+
+		conky::setup_worker_thread("conky-statfs");
+		if (statfs64(job->path.c_str(), &s) != 0)
+			err = errno;
+
+		std::lock_guard<std::mutex> lock(fs_job_mutex);
+		job->s = s;
+		job->err = err;
+		job->done = true;
+		fs_job_cv.notify_all();
+	}
+}
+
+static void update_fs_stat(struct fs_stat *fs, const statfs_job &job);
+
+static void get_fs_type(const char *path, char *result);
+
+/* starts a job for every slot in use which doesn't have one running, then gives them
+ * fs_timeout seconds to finish */
+static void start_fs_jobs(void)
+{
+	for (unsigned i = 0; i < MAX_FS_STATS; ++i) {
+		if (!fs_stats[i].set || fs_jobs[i])
+			continue;
+
+		fs_jobs[i] = std::make_shared<statfs_job>(fs_stats[i].path);
+		try {
+			std::thread(run_statfs_job, fs_jobs[i]).detach();
+		} catch (std::system_error &e) {
+			NORM_ERR("can't start a thread for statfs of '%s': %s", fs_stats[i].path,
+					e.what());
+			fs_jobs[i].reset();
+		}
+	}
+
+	const double deadline = get_time() + fs_timeout.get(*state);
+	std::unique_lock<std::mutex> lock(fs_job_mutex);
+	for (unsigned i = 0; i < MAX_FS_STATS; ++i) {
+		while (fs_jobs[i] && !fs_jobs[i]->done) {
+			double left = deadline - get_time();
 
-void get_fs_type(const char *path, char *result);
+			if (left <= 0)
+				return;
+			fs_job_cv.wait_for(lock, std::chrono::duration<double>(left));
+		}
+	}
+}
+
+/* applies the results of the jobs that are done, and marks the filesystems whose
+ * job is late as stale, they keep showing the last values they had */
+static void collect_fs_jobs(void)
+{
+	std::lock_guard<std::mutex> lock(fs_job_mutex);
+
+	for (unsigned i = 0; i < MAX_FS_STATS; ++i) {
+		struct fs_stat *fs = &fs_stats[i];
+
+		if (!fs_jobs[i])
+			continue;
+		if (fs_jobs[i]->done) {
+			if (fs->stale)
+				NORM_ERR("statfs64 '%s' answered again", fs->path);
+			fs->stale = 0;
+			update_fs_stat(fs, *fs_jobs[i]);
+			fs_jobs[i].reset();
+		} else if (!fs->stale) {
+			NORM_ERR("statfs64 '%s' doesn't answer, keeping the old values", fs->path);
+			fs->stale = 1;
+		}
+	}
+}
 
 int update_fs_stats(void)
 {
-	unsigned i;
 	static double last_fs_update = 0.0;
 
+	/* results that came in after the last update gave up waiting for them */
+	collect_fs_jobs();
+
 	if (current_update_time - last_fs_update < 13)
 		return 0;
 
-	for (i = 0; i < MAX_FS_STATS; ++i) {
-		if (fs_stats[i].set) {
-			update_fs_stat(&fs_stats[i]);
-		}
-	}
+	start_fs_jobs();
+	collect_fs_jobs();
 	last_fs_update = current_update_time;
 	return 0;
 }
@@ -85,6 +199,8 @@ void clear_fs_stats(void)
 {
 	unsigned i;
 	for (i = 0; i < MAX_FS_STATS; ++i) {
+		/* a job still running just finds nobody interested */
+		fs_jobs[i].reset();
 		memset(&fs_stats[i], 0, sizeof(struct fs_stat));
 	}
 }
@@ -110,23 +226,28 @@ struct fs_stat *prepare_fs_stat(const char *s)
 		return 0;
 	}
 	strncpy(next->path, s, DEFAULT_TEXT_BUFFER_SIZE);
+	strncpy(next->type, "unknown", DEFAULT_TEXT_BUFFER_SIZE);
 	next->set = 1;
-	update_fs_stat(next);
+	start_fs_jobs();
+	collect_fs_jobs();
 	return next;
 }
 
-static void update_fs_stat(struct fs_stat *fs)
+static void update_fs_stat(struct fs_stat *fs, const statfs_job &job)
 {
-	struct statfs64 s;
-
-	if (statfs64(fs->path, &s) == 0) {
-		fs->size = (long long)s.f_blocks * s.f_bsize;
+	if (job.err == 0) {
+		fs->size = (long long)job.s.f_blocks * job.s.f_bsize;
 		/* bfree (root) or bavail (non-roots) ? */
-		fs->avail = (long long)s.f_bavail * s.f_bsize;
-		fs->free = (long long)s.f_bfree * s.f_bsize;
+		fs->avail = (long long)job.s.f_bavail * job.s.f_bsize;
+		fs->free = (long long)job.s.f_bfree * job.s.f_bsize;
+#if defined(HAVE_STRUCT_STATFS_F_FSTYPENAME) || \
+	defined(__FreeBSD__) || defined (__OpenBSD__) || defined(__DragonFly__)
+		strncpy(fs->type, job.s.f_fstypename, DEFAULT_TEXT_BUFFER_SIZE);
+#else
 		get_fs_type(fs->path, fs->type);
+#endif
 	} else {
-		NORM_ERR("statfs64 '%s': %s", fs->path, strerror(errno));
+		NORM_ERR("statfs64 '%s': %s", fs->path, strerror(job.err));
 		fs->size = 0;
 		fs->avail = 0;
 		fs->free = 0;
@@ -134,22 +255,146 @@ static void update_fs_stat(struct fs_stat *fs)
 	}
 }
 
-void get_fs_type(const char *path, char *result)
-{
+#if !defined(HAVE_STRUCT_STATFS_F_FSTYPENAME) && \
+	!defined (__OpenBSD__) && !defined(__FreeBSD__) && !defined(__DragonFly__)
+#ifdef __linux__
+
+namespace {
+	/*
+	 * The mount table, read from /proc/self/mountinfo only when the kernel says that
+	 * it changed: after every mount and umount poll() reports POLLPRI on the open file,
+	 * until it is read again.
+	 */
+	class mount_table {
+		struct mount {
+			std::string dir;
+			std::string type;
+		};
+
+		int fd;
+		std::vector<mount> mounts;
+
+		void reload();
+
+	public:
+		mount_table()
+			: fd(-1)
+		{}
+
+		~mount_table()
+		{
+			if (fd >= 0)
+				close(fd);
+		}
 
-#if defined(HAVE_STRUCT_STATFS_F_FSTYPENAME) || \
-	defined(__FreeBSD__) || defined (__OpenBSD__) || defined(__DragonFly__)
+		/* the type of the filesystem path is on, NULL if none was found */
+		const char *find_type(const char *path);
+	};
+
+	/* mount points have spaces and the like escaped as \ooo */
+	std::string unescape_mount_dir(const char *s, size_t len)
+	{
+		std::string r;
+
+		for (size_t i = 0; i < len; ++i) {
+			if (s[i] == '\\' && i + 3 < len && isdigit(s[i + 1])
+					&& isdigit(s[i + 2]) && isdigit(s[i + 3])) {
+				r += (char) ((s[i + 1] - '0') * 64 + (s[i + 2] - '0') * 8 + (s[i + 3] - '0'));
+				i += 3;
+			} else {
+				r += s[i];
+			}
+		}
+		return r;
+	}
 
-	struct statfs64 s;
-	if (statfs64(path, &s) == 0) {
-		strncpy(result, s.f_fstypename, DEFAULT_TEXT_BUFFER_SIZE);
-	} else {
-		NORM_ERR("statfs64 '%s': %s", path, strerror(errno));
+	void mount_table::reload()
+	{
+		std::string buf;
+		char chunk[4096];
+		ssize_t n;
+
+		if (lseek(fd, 0, SEEK_SET) < 0)
+			return;
+		while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+			buf.append(chunk, n);
+
+		mounts.clear();
+		for (size_t pos = 0, end; pos < buf.size(); pos = end + 1) {
+			end = buf.find('\n', pos);
+			if (end == std::string::npos)
+				end = buf.size();
+
+			/* 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw */
+			const std::string line = buf.substr(pos, end - pos);
+			size_t dir = 0, sep;
+
+			for (int field = 0; field < 4 && dir != std::string::npos; ++field) {
+				dir = line.find(' ', dir);
+				if (dir != std::string::npos)
+					++dir;
+			}
+			sep = line.find(" - ");
+			if (dir == std::string::npos || sep == std::string::npos || sep < dir)
+				continue;
+
+			mount m;
+			size_t dir_end = line.find(' ', dir);
+			size_t type = sep + 3;
+			m.dir = unescape_mount_dir(line.c_str() + dir, dir_end - dir);
+			m.type = line.substr(type, line.find(' ', type) - type);
+			mounts.push_back(m);
+		}
 	}
-	return;
 
-#else				/* HAVE_STRUCT_STATFS_F_FSTYPENAME */
+	const char *mount_table::find_type(const char *path)
+	{
+		const mount *best = NULL;
+		size_t len = strlen(path);
+
+		if (fd < 0) {
+			fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				NORM_ERR("can't open /proc/self/mountinfo: %s", strerror(errno));
+				return NULL;
+			}
+			reload();
+		} else {
+			struct pollfd pfd = { fd, POLLPRI, 0 };
+
+			if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR)))
+				reload();
+		}
 
+		/* the longest mount point path is on, the last one if some are mounted over
+		 * each other */
+		for (auto i = mounts.begin(); i != mounts.end(); ++i) {
+			size_t n = i->dir.size();
+
+			if (n > len || strncmp(path, i->dir.c_str(), n))
+				continue;
+			if (n != len && path[n] != '/' && i->dir != "/")
+				continue;
+			if (!best || n >= best->dir.size())
+				best = &*i;
+		}
+		return best ? best->type.c_str() : NULL;
+	}
+}
+
+/* only called with fs_job_mutex locked, which serializes the use of the table */
+static void get_fs_type(const char *path, char *result)
+{
+	static mount_table mounts;
+	const char *type = mounts.find_type(path);
+
+	strncpy(result, type ? type : "unknown", DEFAULT_TEXT_BUFFER_SIZE);
+}
+
+#else /* __linux__ */
+
+static void get_fs_type(const char *path, char *result)
+{
 	struct mntent *me;
 	FILE *mtab = setmntent("/etc/mtab", "r");
 	char *search_path;
@@ -190,12 +435,14 @@ void get_fs_type(const char *path, char *result)
 		strncpy(result, me->mnt_type, DEFAULT_TEXT_BUFFER_SIZE);
 		return;
 	}
-#endif				/* HAVE_STRUCT_STATFS_F_FSTYPENAME */
 
 	strncpy(result, "unknown", DEFAULT_TEXT_BUFFER_SIZE);
 
 }
 
+#endif /* __linux__ */
+#endif /* !HAVE_STRUCT_STATFS_F_FSTYPENAME */
+
 void init_fs_bar(struct text_object *obj, const char *arg)
 {
 	arg = scan_bar(obj, arg, 1);
@@ -265,6 +512,17 @@ HUMAN_PRINT_FS_GENERATOR(free, fs->avail)
 HUMAN_PRINT_FS_GENERATOR(size, fs->size)
 HUMAN_PRINT_FS_GENERATOR(used, fs->size - fs->free)
 
+#define FS_VALUE_GENERATOR(name, expr)                                 \
+double fs_##name##_value(struct text_object *obj)                      \
+{                                                                      \
+	struct fs_stat *fs = (struct fs_stat *)obj->data.opaque;           \
+	return fs ? (double) (expr) : NAN;                                 \
+}
+
+FS_VALUE_GENERATOR(free, fs->avail)
+FS_VALUE_GENERATOR(size, fs->size)
+FS_VALUE_GENERATOR(used, fs->size - fs->free)
+
 void print_fs_type(struct text_object *obj, char *p, int p_max_size)
 {
 	struct fs_stat *fs = (struct fs_stat *)obj->data.opaque;
@@ -272,3 +530,19 @@ void print_fs_type(struct text_object *obj, char *p, int p_max_size)
 	if (fs)
 		snprintf(p, p_max_size, "%s", fs->type);
 }
+
+/* fs.<mount point> in the snapshot of the Lua scripts, in bytes */
+static conky::register_snapshot fs_snapshot("fs", [](conky::snapshot_writer &w) {
+	w.open("fs");
+	for (int i = 0; fs_stats && i < MAX_FS_STATS; i++) {
+		if (!fs_stats[i].set)
+			continue;
+		w.open(fs_stats[i].path);
+		w.number("size", fs_stats[i].size);
+		w.number("used", fs_stats[i].size - fs_stats[i].free);
+		w.number("free", fs_stats[i].free);
+		w.number("avail", fs_stats[i].avail);
+		w.close();
+	}
+	w.close();
+});
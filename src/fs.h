@@ -41,6 +41,8 @@ struct fs_stat {
 	long long avail;
 	long long free;
 	char set;
+	/* the last statfs() didn't return in time, the values are old */
+	char stale;
 };
 
 /* forward declare to make gcc happy (fs.h <-> text_object.h include) */
@@ -56,8 +58,16 @@ uint8_t fs_used_percentage(struct text_object *);
 void print_fs_free(struct text_object *, char *, int);
 void print_fs_size(struct text_object *, char *, int);
 void print_fs_used(struct text_object *, char *, int);
+double fs_free_value(struct text_object *);
+double fs_size_value(struct text_object *);
+double fs_used_value(struct text_object *);
 void print_fs_type(struct text_object *, char *, int);
 
+#define MAX_FS_STATS 64
+
+/* MAX_FS_STATS slots, the ones in use have set */
+extern struct fs_stat *fs_stats;
+
 int update_fs_stats(void);
 struct fs_stat *prepare_fs_stat(const char *path);
 void clear_fs_stats(void);
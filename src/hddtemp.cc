@@ -39,59 +39,55 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-
-#define BUFLEN 512
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "update-cb.hh"
 
 static conky::simple_config_setting<std::string> hddtemp_host("hddtemp_host", "localhost", false);
 static conky::simple_config_setting<std::string> hddtemp_port("hddtemp_port", "7634", false);
 
 struct hdd_info {
-	hdd_info() : next(0) {}
-	struct hdd_info *next;
-	char *dev;
 	short temp;
 	char unit;
+	/* the reply this device was last in */
+	unsigned long seen;
 };
 
-struct hdd_info hdd_info_head;
+struct hddtemp_result {
+	std::unordered_map<std::string, hdd_info> devices;
+	/* the first device of the reply, for $hddtemp without a device */
+	std::string first;
+};
 
-static void __free_hddtemp_info(struct hdd_info *hdi)
-{
-	if (hdi->next)
-		__free_hddtemp_info(hdi->next);
-	free(hdi->dev);
-	delete hdi;
-}
+namespace {
+	/* hddtemp closes the connection after each reply, so it is fetched anew each
+	 * period, in the background */
+	class hddtemp_cb: public conky::callback<hddtemp_result, std::string, std::string> {
+		typedef conky::callback<hddtemp_result, std::string, std::string> Base;
 
-static void free_hddtemp_info(void)
-{
-	DBGP("free_hddtemp_info() called");
-	if (!hdd_info_head.next)
-		return;
-	__free_hddtemp_info(hdd_info_head.next);
-	hdd_info_head.next = NULL;
-}
+		unsigned long replies;
 
-static void add_hddtemp_info(char *dev, short temp, char unit)
-{
-	struct hdd_info *hdi = &hdd_info_head;
+		bool fetch(std::string &out, std::string &error);
+		void parse(const std::string &data);
 
-	DBGP("add_hddtemp_info(%s, %d, %c) being called", dev, temp, unit);
-	while (hdi->next)
-		hdi = hdi->next;
+	protected:
+		virtual void work();
 
-	hdi->next = new hdd_info;
-	memset(hdi->next, 0, sizeof(struct hdd_info));
-	hdi->next->dev = strdup(dev);
-	hdi->next->temp = temp;
-	hdi->next->unit = unit;
+	public:
+		hddtemp_cb(uint32_t period, const std::string &host, const std::string &port)
+			: Base(period, false, Tuple(host, port)), replies(0)
+		{}
+	};
 }
 
-static char *fetch_hddtemp_output(void)
+bool hddtemp_cb::fetch(std::string &out, std::string &error)
 {
-	int sockfd;
-	char *buf = NULL;
-	int buflen, offset = 0, rlen;
+	int sockfd = -1;
+	char buf[BUFSIZ];
+	ssize_t rlen;
 	struct addrinfo hints, *result, *rp;
 	int i;
 
@@ -99,10 +95,9 @@ static char *fetch_hddtemp_output(void)
 	hints.ai_family = AF_INET;	/* XXX: hddtemp has no ipv6 support (yet?) */
 	hints.ai_socktype = SOCK_STREAM;
 
-	if ((i = getaddrinfo(hddtemp_host.get(*state).c_str(),
-							hddtemp_port.get(*state).c_str(), &hints, &result))) {
-		NORM_ERR("getaddrinfo(): %s", gai_strerror(i));
-		return NULL;
+	if ((i = getaddrinfo(get<0>().c_str(), get<1>().c_str(), &hints, &result))) {
+		error = std::string("hddtemp: getaddrinfo(): ") + gai_strerror(i);
+		return false;
 	}
 
 	for (rp = result; rp; rp = rp->ai_next) {
@@ -113,142 +108,94 @@ static char *fetch_hddtemp_output(void)
 			break;
 		close(sockfd);
 	}
+	freeaddrinfo(result);
 	if (!rp) {
-		NORM_ERR("could not connect to hddtemp host");
-		goto GET_OUT;
+		error = "could not connect to hddtemp host";
+		return false;
 	}
 
-	buflen = 1024;
-	buf = (char*)malloc(buflen);
-	while ((rlen = recv(sockfd, buf + offset, buflen - offset - 1, 0)) > 0) {
-		offset += rlen;
-		if (buflen - offset < 1) {
-			buflen += 1024;
-			buf = (char*)realloc(buf, buflen);
-		}
-	}
+	while ((rlen = recv(sockfd, buf, sizeof buf, 0)) > 0)
+		out.append(buf, rlen);
 	if (rlen < 0)
 		perror("recv");
 
-	buf[offset] = '\0';
-
 	close(sockfd);
-GET_OUT:
-	freeaddrinfo(result);
-	return buf;
+	return true;
 }
 
-/* this is an iterator:
- * set line to NULL in consecutive calls to get the next field
- * note that exhausing iteration is assumed - otherwise *saveptr
- * is not being freed!
- */
-static int read_hdd_val(const char *line, char **dev, short *val, char *unit,
-		char **saveptr)
+/* The reply looks like |/dev/sda|model|34|C||/dev/sdb|model|SLP|*|, the
+ * first character separates the fields. Devices without a number (sleeping,
+ * unknown) are left out. */
+void hddtemp_cb::parse(const std::string &data)
 {
-	char *line_s, *cval, *endptr;
-	static char *p = 0;
+	std::vector<std::string> fields;
+	size_t pos = 1, next;
 
-	if (line) {
-		*saveptr = strdup(line);
-		p = *saveptr;
-	}
-	line_s = *saveptr;
-
-again:
-	if(!*p)
-		goto out_fail;
-	/* read the device */
-	*dev = ++p;
-	if (!(p = strchr(p, line_s[0])))
-		goto out_fail;
-	*(p++) = '\0';
-	/* jump over the devname */
-	if (!(p = strchr(p, line_s[0])))
-		goto out_fail;
-	/* read the value */
-	cval = ++p;
-	if (!(p = strchr(p, line_s[0])))
-		goto out_fail;
-	*(p++) = '\0';
-	*unit = *(p++);
-	*val = strtol(cval, &endptr, 10);
-	if (*endptr) {
-		if (!(p = strchr(p, line_s[0])))
-			goto out_fail;
-
-		p++;
-		goto again;
+	if (data.empty())
+		return;
+	while ((next = data.find(data[0], pos)) != std::string::npos) {
+		fields.push_back(data.substr(pos, next - pos));
+		pos = next + 1;
 	}
-	
-	/* preset p for next call */
-	p++;
-
-	return 0;
-out_fail:
-	free(*saveptr);
-	return 1;
-}
 
-int update_hddtemp(void) {
-	char *data, *dev, unit, *saveptr;
-	short val;
-	static double last_hddtemp_update = 0.0;
+	std::lock_guard<std::mutex> lock(result_mutex);
+	++replies;
+	result.first.clear();
+	for (size_t i = 0; i + 3 < fields.size(); i += 5) {
+		char *endptr;
+		short val = strtol(fields[i + 2].c_str(), &endptr, 10);
 
-	/* limit tcp connection overhead */
-	if (current_update_time - last_hddtemp_update < 5)
-		return 0;
-	last_hddtemp_update = current_update_time;
+		if (fields[i + 2].empty() || *endptr)
+			continue;
 
-	free_hddtemp_info();
+		/* updated in place, the same devices come every time */
+		hdd_info &hdi = result.devices[fields[i]];
+		hdi.temp = val;
+		hdi.unit = fields[i + 3].empty() ? 'C' : fields[i + 3][0];
+		hdi.seen = replies;
+		if (result.first.empty())
+			result.first = fields[i];
+	}
+	for (auto it = result.devices.begin(); it != result.devices.end();) {
+		if (it->second.seen != replies)
+			it = result.devices.erase(it);
+		else
+			++it;
+	}
+}
 
-	if (!(data = fetch_hddtemp_output()))
-		return 0;
+void hddtemp_cb::work()
+{
+	std::string data, error;
 
-	if (read_hdd_val(data, &dev, &val, &unit, &saveptr)) {
-		free(data);
-		return 0;
+	if (!fetch(data, error)) {
+		failed(error);
+		return;
 	}
-	do {
-		add_hddtemp_info(dev, val, unit);
-	} while (!read_hdd_val(NULL, &dev, &val, &unit, &saveptr));
-	free(data);
-	return 0;
+	succeeded();
+	parse(data);
 }
 
 void free_hddtemp(struct text_object *obj)
 {
-	free_hddtemp_info();
 	free_and_zero(obj->data.s);
 }
 
-static int get_hddtemp_info(const char *dev, short *val, char *unit)
-{
-	struct hdd_info *hdi = hdd_info_head.next;
-
-	/* if no dev is given, just use hdd_info_head->next */
-	while(dev && hdi) {
-		if (!strcmp(dev, hdi->dev))
-			break;
-		hdi = hdi->next;
-	}
-	if (!hdi)
-		return 1;
-	
-	*val = hdi->temp;
-	*unit = hdi->unit;
-	return 0;
-}
-
 void print_hddtemp(struct text_object *obj, char *p, int p_max_size)
 {
-	short val;
-	char unit;
+	/* limit tcp connection overhead */
+	uint32_t period = std::max(lround(5/active_update_interval()), 1l);
+	auto cb = conky::register_cb<hddtemp_cb>(period, hddtemp_host.get(*state),
+			hddtemp_port.get(*state));
+
+	std::lock_guard<std::mutex> lock(cb->result_mutex);
+	const hddtemp_result &res = cb->get_result();
+	auto it = res.devices.find(obj->data.s ? obj->data.s : res.first);
 
-	if (get_hddtemp_info(obj->data.s, &val, &unit)) {
+	if (it == res.devices.end()) {
 		snprintf(p, p_max_size, "N/A");
 	} else {
-		temp_print(p, p_max_size, (double)val,
-				(unit == 'C' ? TEMP_CELSIUS : TEMP_FAHRENHEIT));
+		temp_print(p, p_max_size, (double)it->second.temp,
+				(it->second.unit == 'C' ? TEMP_CELSIUS : TEMP_FAHRENHEIT));
 	}
 }
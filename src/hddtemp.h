@@ -27,7 +27,6 @@
 #ifndef HDDTEMP_H_
 #define HDDTEMP_H_
 
-int update_hddtemp(void);
 void free_hddtemp(struct text_object *);
 void print_hddtemp(struct text_object *, char *, int);
 
@@ -0,0 +1,166 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "conky.h"
+#include "common.h"
+#include "history.h"
+#include "logging.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+conky::simple_config_setting<std::string> history_file("history_file", std::string(), false);
+
+namespace {
+	const size_t history_size = sizeof(struct history_file_header) +
+		HISTORY_SLOTS * sizeof(struct history_slot);
+
+	/* kept open for the lock, another conky would scribble over our rings */
+	int history_fd = -1;
+	struct history_file_header *history_header = NULL;
+	struct history_slot *history_slots = NULL;
+	std::vector<bool> history_claimed;
+	bool history_warned = false;
+
+	bool history_map(void)
+	{
+		std::string path;
+		struct stat st;
+		void *p;
+
+		if (history_slots)
+			return true;
+		if (history_warned)
+			return false;
+		history_warned = true;
+
+		path = to_real_path(history_file.get(*state));
+		history_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (history_fd < 0) {
+			NORM_ERR("can't open history_file '%s': %s", path.c_str(), strerror(errno));
+			return false;
+		}
+		if (flock(history_fd, LOCK_EX | LOCK_NB) < 0) {
+			NORM_ERR("history_file '%s' is in use by another conky", path.c_str());
+			goto fail;
+		}
+		if (fstat(history_fd, &st) < 0 || (st.st_size != (off_t) history_size &&
+					ftruncate(history_fd, history_size) < 0)) {
+			NORM_ERR("can't resize history_file '%s': %s", path.c_str(), strerror(errno));
+			goto fail;
+		}
+		p = mmap(NULL, history_size, PROT_READ | PROT_WRITE, MAP_SHARED, history_fd, 0);
+		if (p == MAP_FAILED) {
+			NORM_ERR("can't map history_file '%s': %s", path.c_str(), strerror(errno));
+			goto fail;
+		}
+		history_header = (struct history_file_header *) p;
+		history_slots = (struct history_slot *) (history_header + 1);
+
+		/* a new file, or one of another layout, starts out empty */
+		if (history_header->magic != HISTORY_MAGIC || history_header->version != HISTORY_VERSION
+				|| history_header->slots != HISTORY_SLOTS
+				|| history_header->samples != HISTORY_SAMPLES) {
+			memset(p, 0, history_size);
+			history_header->magic = HISTORY_MAGIC;
+			history_header->version = HISTORY_VERSION;
+			history_header->slots = HISTORY_SLOTS;
+			history_header->samples = HISTORY_SAMPLES;
+		}
+		history_claimed.assign(HISTORY_SLOTS, false);
+		history_warned = false;
+		return true;
+
+fail:
+		close(history_fd);
+		history_fd = -1;
+		return false;
+	}
+}
+
+struct history_slot *history_claim(const char *key)
+{
+	int found = -1, free_slot = -1, oldest = -1;
+
+	if (history_file.get(*state).empty() || !history_map())
+		return NULL;
+
+	for (int i = 0; i < HISTORY_SLOTS; i++) {
+		struct history_slot *s = &history_slots[i];
+
+		if (history_claimed[i])
+			continue;
+		if (!s->key[0]) {
+			if (free_slot < 0)
+				free_slot = i;
+		} else if (!strncmp(s->key, key, HISTORY_KEY_LEN - 1)) {
+			found = i;
+			break;
+		} else if (oldest < 0 || s->last_time < history_slots[oldest].last_time) {
+			oldest = i;
+		}
+	}
+	/* a graph that isn't in the file yet takes a free slot, or else the one
+	 * which got no samples for the longest time */
+	if (found < 0) {
+		found = free_slot >= 0 ? free_slot : oldest;
+		if (found < 0)
+			return NULL;
+		memset(&history_slots[found], 0, sizeof(struct history_slot));
+		strncpy(history_slots[found].key, key, HISTORY_KEY_LEN - 1);
+	}
+	history_claimed[found] = true;
+	return &history_slots[found];
+}
+
+void history_release(struct history_slot *slot)
+{
+	if (slot && history_slots)
+		history_claimed[slot - history_slots] = false;
+}
+
+void clear_history(void)
+{
+	if (history_header)
+		munmap(history_header, history_size);
+	if (history_fd >= 0)
+		close(history_fd);
+	history_fd = -1;
+	history_header = NULL;
+	history_slots = NULL;
+	history_claimed.clear();
+	history_warned = false;
+}
@@ -0,0 +1,92 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdint.h>
+#include "setting.hh"
+
+/* With history_file, the samples of the graphs are also kept in a file that
+ * stays mapped, so that they are still there after a restart. The file is
+ * HISTORY_SLOTS rings of HISTORY_SAMPLES floats, one per graph, behind a
+ * header, in host byte order. Appending a sample is a store into the
+ * mapping; the kernel writes it back whenever it likes. */
+
+#define HISTORY_MAGIC		0x53484b43	/* "CKHS" */
+#define HISTORY_VERSION		1
+#define HISTORY_SLOTS		128
+#define HISTORY_SAMPLES		1024
+#define HISTORY_KEY_LEN		128
+
+struct history_slot {
+	char key[HISTORY_KEY_LEN];	/* name and arguments of the object, "" if free */
+	uint32_t seq;				/* number of samples appended, the ring is seq % HISTORY_SAMPLES */
+	uint32_t pad;
+	double last_time;			/* of the newest sample */
+	float samples[HISTORY_SAMPLES];
+};
+
+struct history_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t samples;
+};
+
+extern conky::simple_config_setting<std::string> history_file;
+
+/* The slot for the samples of an object, which nobody else has claimed yet.
+ * Maps the file on first use. NULL if there's no file or no free slot. */
+struct history_slot *history_claim(const char *key);
+void history_release(struct history_slot *);
+
+/* unmap the file, after all slots have been released */
+void clear_history(void);
+
+static inline void history_append(struct history_slot *slot, float f, double now)
+{
+	slot->samples[slot->seq % HISTORY_SAMPLES] = f;
+	slot->seq++;
+	slot->last_time = now;
+}
+
+/* the number of samples kept, and the j-th newest of them, j < that */
+static inline unsigned int history_count(const struct history_slot *slot)
+{
+	return slot->seq < HISTORY_SAMPLES ? slot->seq : HISTORY_SAMPLES;
+}
+
+static inline float history_value(const struct history_slot *slot, unsigned int j)
+{
+	return slot->samples[(slot->seq - 1 - j) % HISTORY_SAMPLES];
+}
+
+#endif /* _HISTORY_H */
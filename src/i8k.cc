@@ -33,63 +33,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include "conky.h"
+#include "laptop.h"
 #include "logging.h"
 #include "temphelper.h"
 #include "text_object.h"
 
-struct _i8k {
-	char *version;
-	char *bios;
-	char *serial;
-	char *cpu_temp;
-	char *left_fan_status;
-	char *right_fan_status;
-	char *left_fan_rpm;
-	char *right_fan_rpm;
-	char *ac_status;
-	char *buttons_status;
-} i8k;
-
-/* FIXME: there should be an ioctl interface to request specific data */
-#define PROC_I8K "/proc/i8k"
-#define I8K_DELIM " "
-static char *i8k_procbuf = NULL;
-int update_i8k(void)
+/* the fields of /proc/i8k, empty until it was read */
+static laptop_ptr i8k_sample(void)
 {
-	FILE *fp;
+	laptop_ptr sample = get_laptop_sample(LAPTOP_I8K);
 
-	if (!i8k_procbuf) {
-		i8k_procbuf = (char *) malloc(128 * sizeof(char));
-	}
-	if ((fp = fopen(PROC_I8K, "r")) == NULL) {
-		free_and_zero(i8k_procbuf);
-		/*THREAD_CRIT_ERR(NULL, NULL, "/proc/i8k doesn't exist! use insmod to make sure the kernel "
-			"driver is loaded...");*/
-		NORM_ERR("/proc/i8k doesn't exist! use insmod to make sure the kernel driver is loaded...");
-		clean_up_without_threads(NULL, NULL);
-		return 1;
-	}
-
-	memset(&i8k_procbuf[0], 0, 128);
-	if (fread(&i8k_procbuf[0], sizeof(char), 128, fp) == 0) {
-		NORM_ERR("something wrong with /proc/i8k...");
+	if (!sample) {
+		static const laptop_ptr empty(new laptop_sample);
+		return empty;
 	}
+	return sample;
+}
 
-	fclose(fp);
-
-	DBGP("read `%s' from /proc/i8k\n", i8k_procbuf);
-
-	i8k.version = strtok(&i8k_procbuf[0], I8K_DELIM);
-	i8k.bios = strtok(NULL, I8K_DELIM);
-	i8k.serial = strtok(NULL, I8K_DELIM);
-	i8k.cpu_temp = strtok(NULL, I8K_DELIM);
-	i8k.left_fan_status = strtok(NULL, I8K_DELIM);
-	i8k.right_fan_status = strtok(NULL, I8K_DELIM);
-	i8k.left_fan_rpm = strtok(NULL, I8K_DELIM);
-	i8k.right_fan_rpm = strtok(NULL, I8K_DELIM);
-	i8k.ac_status = strtok(NULL, I8K_DELIM);
-	i8k.buttons_status = strtok(NULL, I8K_DELIM);
-	return 0;
+static const char *i8k_field(enum i8k_field field, laptop_ptr &sample)
+{
+	sample = i8k_sample();
+	return sample->i8k[field].empty() ? NULL : sample->i8k[field].c_str();
 }
 
 static void print_i8k_fan_status(char *p, int p_max_size, const char *status)
@@ -105,33 +69,43 @@ static void print_i8k_fan_status(char *p, int p_max_size, const char *status)
 
 void print_i8k_left_fan_status(struct text_object *obj, char *p, int p_max_size)
 {
+	laptop_ptr sample;
+
 	(void)obj;
-	print_i8k_fan_status(p, p_max_size, i8k.left_fan_status);
+	print_i8k_fan_status(p, p_max_size, i8k_field(I8K_LEFT_FAN_STATUS, sample));
 }
 
 void print_i8k_cpu_temp(struct text_object *obj, char *p, int p_max_size)
 {
+	laptop_ptr sample;
+	const char *s = i8k_field(I8K_CPU_TEMP, sample);
 	int cpu_temp;
 
 	(void)obj;
 
-	sscanf(i8k.cpu_temp, "%d", &cpu_temp);
+	if (!s || sscanf(s, "%d", &cpu_temp) != 1)
+		return;
 	temp_print(p, p_max_size, (double)cpu_temp, TEMP_CELSIUS);
 }
 
 void print_i8k_right_fan_status(struct text_object *obj, char *p, int p_max_size)
 {
+	laptop_ptr sample;
+
 	(void)obj;
-	print_i8k_fan_status(p, p_max_size, i8k.right_fan_status);
+	print_i8k_fan_status(p, p_max_size, i8k_field(I8K_RIGHT_FAN_STATUS, sample));
 }
 
 void print_i8k_ac_status(struct text_object *obj, char *p, int p_max_size)
 {
+	laptop_ptr sample;
+	const char *s = i8k_field(I8K_AC_STATUS, sample);
 	int ac_status;
 
 	(void)obj;
 
-	sscanf(i8k.ac_status, "%d", &ac_status);
+	if (!s || sscanf(s, "%d", &ac_status) != 1)
+		return;
 	if (ac_status == -1) {
 		snprintf(p, p_max_size, "disabled (read i8k docs)");
 	}
@@ -143,18 +117,18 @@ void print_i8k_ac_status(struct text_object *obj, char *p, int p_max_size)
 	}
 }
 
-#define I8K_PRINT_GENERATOR(name) \
+#define I8K_PRINT_GENERATOR(name, field) \
 void print_i8k_##name(struct text_object *obj, char *p, int p_max_size) \
 { \
 	(void)obj; \
-	snprintf(p, p_max_size, "%s", i8k.name); \
+	snprintf(p, p_max_size, "%s", i8k_sample()->i8k[field].c_str()); \
 }
 
-I8K_PRINT_GENERATOR(version)
-I8K_PRINT_GENERATOR(bios)
-I8K_PRINT_GENERATOR(serial)
-I8K_PRINT_GENERATOR(left_fan_rpm)
-I8K_PRINT_GENERATOR(right_fan_rpm)
-I8K_PRINT_GENERATOR(buttons_status)
+I8K_PRINT_GENERATOR(version, I8K_VERSION)
+I8K_PRINT_GENERATOR(bios, I8K_BIOS)
+I8K_PRINT_GENERATOR(serial, I8K_SERIAL)
+I8K_PRINT_GENERATOR(left_fan_rpm, I8K_LEFT_FAN_RPM)
+I8K_PRINT_GENERATOR(right_fan_rpm, I8K_RIGHT_FAN_RPM)
+I8K_PRINT_GENERATOR(buttons_status, I8K_BUTTONS_STATUS)
 
 #undef I8K_PRINT_GENERATOR
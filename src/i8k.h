@@ -32,7 +32,6 @@
 #ifndef _I8K_H
 #define _I8K_H
 
-int update_i8k(void);
 void print_i8k_left_fan_status(struct text_object *, char *, int);
 void print_i8k_cpu_temp(struct text_object *, char *, int);
 void print_i8k_right_fan_status(struct text_object *, char *, int);
@@ -32,6 +32,7 @@
 #include "conky.h"
 #include "config.h"
 #include "ibm.h"
+#include "laptop.h"
 #include "logging.h"
 #include "temphelper.h"
 #include <ctype.h>
@@ -40,8 +41,6 @@
 #include <string.h>
 #include <stdlib.h>
 
-static int ibm_acpi_temps[8];
-
 /* Here come the IBM ACPI-specific things. For reference, see
  * http://ibm-acpi.sourceforge.net/README
  * If IBM ACPI is installed, /proc/acpi/ibm contains the following files:
@@ -62,9 +61,9 @@ video
 volume
  * The content of these files is described in detail in the aforementioned
  * README - some of them also in the following functions accessing them.
- * Peter Tarjan (ptarjan@citromail.hu) */
-
-#define IBM_ACPI_DIR "/proc/acpi/ibm"
+ * Peter Tarjan (ptarjan@citromail.hu)
+ *
+ * The files are read by the laptop callback, see laptop.cc. */
 
 /* get fan speed on IBM/Lenovo laptops running the ibm acpi.
  * /proc/acpi/ibm/fan looks like this (3 lines):
@@ -75,90 +74,15 @@ commands:       enable, disable
 
 void get_ibm_acpi_fan(struct text_object *obj, char *p, int p_max_size)
 {
-	FILE *fp;
-	unsigned int speed = 0;
-	char fan[128];
+	laptop_ptr sample = get_laptop_sample(LAPTOP_IBM_FAN);
 
 	(void)obj;
 
-	if (!p || p_max_size <= 0) {
+	if (!p || p_max_size <= 0 || !sample) {
 		return;
 	}
 
-	snprintf(fan, 127, "%s/fan", IBM_ACPI_DIR);
-
-	fp = fopen(fan, "r");
-	if (fp != NULL) {
-		while (!feof(fp)) {
-			char line[256];
-
-			if (fgets(line, 255, fp) == NULL) {
-				break;
-			}
-			if (sscanf(line, "speed: %u", &speed)) {
-				break;
-			}
-		}
-	} else {
-		CRIT_ERR(NULL, NULL, "can't open '%s': %s\nYou are not using the IBM ACPI. Remove "
-			"ibm* from your " PACKAGE_NAME" config file.", fan, strerror(errno));
-	}
-
-	fclose(fp);
-	snprintf(p, p_max_size, "%d", speed);
-}
-
-/* get the measured temperatures from the temperature sensors
- * on IBM/Lenovo laptops running the ibm acpi.
- * There are 8 values in /proc/acpi/ibm/thermal, and according to
- * http://ibm-acpi.sourceforge.net/README
- * these mean the following (at least on an IBM R51...)
- * 0:  CPU (also on the T series laptops)
- * 1:  Mini PCI Module (?)
- * 2:  HDD (?)
- * 3:  GPU (also on the T series laptops)
- * 4:  Battery (?)
- * 5:  N/A
- * 6:  Battery (?)
- * 7:  N/A
- * I'm not too sure about those with the question mark, but the values I'm
- * reading from *my* thermal file (on a T42p) look realistic for the
- * hdd and the battery.
- * #5 and #7 are always -128.
- * /proc/acpi/ibm/thermal looks like this (1 line):
-temperatures:   41 43 31 46 33 -128 29 -128
- * Peter Tarjan (ptarjan@citromail.hu) */
-
-int get_ibm_acpi_temps(void)
-{
-
-	FILE *fp;
-	char thermal[128];
-
-	snprintf(thermal, 127, "%s/thermal", IBM_ACPI_DIR);
-	fp = fopen(thermal, "r");
-
-	if (fp != NULL) {
-		while (!feof(fp)) {
-			char line[256];
-
-			if (fgets(line, 255, fp) == NULL) {
-				break;
-			}
-			if (sscanf(line, "temperatures: %d %d %d %d %d %d %d %d",
-					&ibm_acpi_temps[0], &ibm_acpi_temps[1], &ibm_acpi_temps[2],
-					&ibm_acpi_temps[3], &ibm_acpi_temps[4], &ibm_acpi_temps[5],
-					&ibm_acpi_temps[6], &ibm_acpi_temps[7])) {
-				break;
-			}
-		}
-	} else {
-		CRIT_ERR(NULL, NULL, "can't open '%s': %s\nYou are not using the IBM ACPI. Remove "
-			"ibm* from your " PACKAGE_NAME" config file.", thermal, strerror(errno));
-	}
-
-	fclose(fp);
-	return 0;
+	snprintf(p, p_max_size, "%d", sample->ibm_fan);
 }
 
 /* get volume (0-14) on IBM/Lenovo laptops running the ibm acpi.
@@ -173,51 +97,20 @@ commands:       level <level> (<level> is 0-15)
 
 void get_ibm_acpi_volume(struct text_object *obj, char *p, int p_max_size)
 {
-	FILE *fp;
-	char volume[128];
-	unsigned int vol = -1;
-	char mute[3] = "";
+	laptop_ptr sample = get_laptop_sample(LAPTOP_IBM_VOLUME);
 
 	(void)obj;
 
-	if (!p || p_max_size <= 0) {
+	if (!p || p_max_size <= 0 || !sample) {
 		return;
 	}
 
-	snprintf(volume, 127, "%s/volume", IBM_ACPI_DIR);
-
-	fp = fopen(volume, "r");
-	if (fp != NULL) {
-		while (!feof(fp)) {
-			char line[256];
-			unsigned int read_vol = -1;
-
-			if (fgets(line, 255, fp) == NULL) {
-				break;
-			}
-			if (sscanf(line, "level: %u", &read_vol)) {
-				vol = read_vol;
-				continue;
-			}
-			if (sscanf(line, "mute: %s", mute)) {
-				break;
-			}
-		}
-	} else {
-		CRIT_ERR(NULL, NULL, "can't open '%s': %s\nYou are not using the IBM ACPI. Remove "
-			"ibm* from your " PACKAGE_NAME" config file.", volume, strerror(errno));
-	}
-
-	fclose(fp);
-
-	if (strcmp(mute, "on") == 0)
+	if (sample->ibm_mute)
 		snprintf(p, p_max_size, "%s", "mute");
 	else
-		snprintf(p, p_max_size, "%d", vol);
+		snprintf(p, p_max_size, "%d", sample->ibm_volume);
 }
 
-/* static FILE *fp = NULL; */
-
 /* get LCD brightness on IBM/Lenovo laptops running the ibm acpi.
  * /proc/acpi/ibm/brightness looks like this (3 lines):
 level:          7
@@ -227,40 +120,38 @@ commands:       level <level> (<level> is 0-7)
 
 void get_ibm_acpi_brightness(struct text_object *obj, char *p, int p_max_size)
 {
-	FILE *fp;
-	unsigned int brightness = 0;
-	char filename[128];
+	laptop_ptr sample = get_laptop_sample(LAPTOP_IBM_BRIGHTNESS);
 
 	(void)obj;
 
-	if (!p || p_max_size <= 0) {
+	if (!p || p_max_size <= 0 || !sample) {
 		return;
 	}
 
-	snprintf(filename, 127, "%s/brightness", IBM_ACPI_DIR);
-
-	fp = fopen(filename, "r");
-	if (fp != NULL) {
-		while (!feof(fp)) {
-			char line[256];
-
-			if (fgets(line, 255, fp) == NULL) {
-				break;
-			}
-			if (sscanf(line, "level: %u", &brightness)) {
-				break;
-			}
-		}
-	} else {
-		CRIT_ERR(NULL, NULL, "can't open '%s': %s\nYou are not using the IBM ACPI. Remove "
-			"ibm* from your " PACKAGE_NAME" config file.", filename, strerror(errno));
-	}
-
-	fclose(fp);
-
-	snprintf(p, p_max_size, "%d", brightness);
+	snprintf(p, p_max_size, "%d", sample->ibm_brightness);
 }
 
+/* get the measured temperatures from the temperature sensors
+ * on IBM/Lenovo laptops running the ibm acpi.
+ * There are 8 values in /proc/acpi/ibm/thermal, and according to
+ * http://ibm-acpi.sourceforge.net/README
+ * these mean the following (at least on an IBM R51...)
+ * 0:  CPU (also on the T series laptops)
+ * 1:  Mini PCI Module (?)
+ * 2:  HDD (?)
+ * 3:  GPU (also on the T series laptops)
+ * 4:  Battery (?)
+ * 5:  N/A
+ * 6:  Battery (?)
+ * 7:  N/A
+ * I'm not too sure about those with the question mark, but the values I'm
+ * reading from *my* thermal file (on a T42p) look realistic for the
+ * hdd and the battery.
+ * #5 and #7 are always -128.
+ * /proc/acpi/ibm/thermal looks like this (1 line):
+temperatures:   41 43 31 46 33 -128 29 -128
+ * Peter Tarjan (ptarjan@citromail.hu) */
+
 void parse_ibm_temps_arg(struct text_object *obj, const char *arg)
 {
 	if (!isdigit(arg[0]) || strlen(arg) > 1 || atoi(&arg[0]) >= 8) {
@@ -273,5 +164,9 @@ void parse_ibm_temps_arg(struct text_object *obj, const char *arg)
 
 void print_ibm_temps(struct text_object *obj, char *p, int p_max_size)
 {
-	temp_print(p, p_max_size, ibm_acpi_temps[obj->data.l], TEMP_CELSIUS);
+	laptop_ptr sample = get_laptop_sample(LAPTOP_IBM_THERMAL);
+
+	if (!sample)
+		return;
+	temp_print(p, p_max_size, sample->ibm_temps[obj->data.l], TEMP_CELSIUS);
 }
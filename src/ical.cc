@@ -25,160 +25,211 @@
 
 #include <libical/ical.h>
 #include "conky.h"
+#include "core.h"
 #include "logging.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "update-cb.hh"
 
-struct ical_event {
-	icaltimetype start;
-	icalcomponent *event;
-	ical_event *next, *prev;
-};
+/* how often (in seconds) the calendar file is checked for changes */
+#define ICAL_CHECK_INTERVAL 5
 
-struct obj_ical {
-	struct ical_event *list;
-	icalcomponent *comps;
-	icalparser *parser;
-	unsigned int num;
-};
+namespace {
+	struct ical_event {
+		time_t start;
+		std::string summary;
 
-char* read_stream(char *s, size_t size, void *d) {
-	return fgets(s, size, (FILE*) d);
-}
+		bool operator<(const ical_event &other) const
+		{ return start < other.start; }
+	};
 
-struct ical_event *add_event(struct ical_event *listend, icalcomponent *new_ev) {
-	struct ical_event *ev_new, *ev_cur;
-	icaltimetype start;
-
-	start = icalcomponent_get_dtstart(new_ev);
-	if(icaltime_compare(start, icaltime_from_timet(time(NULL), 0)) <= 0) {
-		icalproperty *rrule = icalcomponent_get_first_property(new_ev, ICAL_RRULE_PROPERTY);
-		if(rrule) {
-			icalrecur_iterator* ritr = icalrecur_iterator_new(icalproperty_get_rrule(rrule), start);
-			icaltimetype nexttime = icalrecur_iterator_next(ritr);
-			while (!icaltime_is_null_time(nexttime)) {
-				if(icaltime_compare(nexttime, icaltime_from_timet(time(NULL), 0)) > 0) {
-					start = nexttime;
-					break;
-				}
-				nexttime = icalrecur_iterator_next(ritr);
-			}
-			icalrecur_iterator_free(ritr);
-		} else return NULL;
+	/* the upcoming events of a calendar file, sorted by start */
+	struct ical_calendar {
+		std::vector<ical_event> events;
+		/* the file as it was when it was read */
+		time_t mtime;
+		off_t size;
+		ino_t ino;
+		/* the earliest time a recurring event moves to its next occurrence,
+		 * the calendar has to be read again then */
+		time_t expires;
+
+		ical_calendar()
+			: mtime(0), size(0), ino(0), expires(std::numeric_limits<time_t>::max())
+		{}
+	};
+
+	typedef std::shared_ptr<const ical_calendar> calendar_ptr;
+
+	/* Reads a calendar file whenever it changes, shared by all $ical objects
+	 * showing the same file. */
+	class ical_cb: public conky::callback<calendar_ptr, std::string> {
+		typedef conky::callback<calendar_ptr, std::string> Base;
+
+		void load(ical_calendar &cal);
+
+	protected:
+		virtual void work();
+
+	public:
+		ical_cb(uint32_t period, const std::string &file)
+			: Base(period, false, Tuple(file))
+		{}
+	};
+
+	char* read_stream(char *s, size_t size, void *d) {
+		return fgets(s, size, (FILE*) d);
 	}
-	ev_new = (struct ical_event *) malloc(sizeof(struct ical_event));
-	memset(ev_new, 0, sizeof(struct ical_event));
-	ev_new->event = new_ev;
-	ev_new->start = start;
-	if(listend) {	//list already contains events
-		ev_cur = listend;
-		while(icaltime_compare(ev_new->start, ev_cur->start) <= 0) {
-			if( ! ev_cur->prev) {	//ev_new starts first
-				ev_new->next = ev_cur;
-				ev_cur->prev = ev_new;
-				return listend;
-			}
-			ev_cur = ev_cur->prev;
-		}
-		if(ev_cur == listend) {	//ev_new starts last
-			ev_cur->next = ev_new;
-			ev_new->prev = ev_cur;
-			return ev_new;
+
+	/* Adds the event if it's still to come. A recurring event is added with
+	 * its next occurrence. */
+	void add_event(ical_calendar &cal, icalcomponent *new_ev, icaltimetype now) {
+		icaltimetype start;
+		ical_event ev;
+
+		start = icalcomponent_get_dtstart(new_ev);
+		if(icaltime_compare(start, now) <= 0) {
+			icalproperty *rrule = icalcomponent_get_first_property(new_ev, ICAL_RRULE_PROPERTY);
+			if(rrule) {
+				icalrecur_iterator* ritr = icalrecur_iterator_new(icalproperty_get_rrule(rrule), start);
+				icaltimetype nexttime = icalrecur_iterator_next(ritr);
+				while (!icaltime_is_null_time(nexttime)) {
+					if(icaltime_compare(nexttime, now) > 0) {
+						start = nexttime;
+						break;
+					}
+					nexttime = icalrecur_iterator_next(ritr);
+				}
+				icalrecur_iterator_free(ritr);
+				if(icaltime_is_null_time(nexttime))
+					return;
+			} else return;
 		}
-		//ev_new somewhere in the middle
-		ev_new->prev = ev_cur;
-		ev_new->next = ev_cur->next;
-		ev_cur->next->prev = ev_new;
-		ev_cur->next = ev_new;
-		return listend;
+
+		ev.start = icaltime_as_timet(start);
+		if(icalcomponent_get_first_property(new_ev, ICAL_RRULE_PROPERTY))
+			cal.expires = std::min(cal.expires, ev.start);
+		const char *summary = icalproperty_get_summary(
+				icalcomponent_get_first_property(new_ev, ICAL_SUMMARY_PROPERTY));
+		if(summary)
+			ev.summary = summary;
+		cal.events.push_back(ev);
 	}
-	return ev_new;
 }
 
-void parse_ical_args(struct text_object *obj, const char* arg, void *free_at_crash, void *free_at_crash2) {
-	char *filename = strdup(arg);
+void ical_cb::load(ical_calendar &cal)
+{
 	FILE *file;
 	icalparser *parser;
 	icalcomponent *allc, *curc;
-	struct ical_event *ll_start, *ll_end, *ll_new;
-	struct obj_ical *opaque;
+	icaltimetype now = icaltime_from_timet(time(NULL), 0);
+
+	file = fopen(get<0>().c_str(), "r");
+	if( ! file) {
+		NORM_ERR("Can't read file %s", get<0>().c_str());
+		return;
+	}
+	parser = icalparser_new();
+	icalparser_set_gen_data(parser, file);
+	allc = icalparser_parse(parser, read_stream);
+	fclose(file);
+
+	for(curc = icalcomponent_get_first_component(allc, ICAL_VEVENT_COMPONENT); curc;
+			curc = icalcomponent_get_next_component(allc, ICAL_VEVENT_COMPONENT))
+		add_event(cal, curc, now);
+	if(cal.events.empty())
+		NORM_ERR("No ical events available");
+	std::stable_sort(cal.events.begin(), cal.events.end());
+
+	/* everything we need was copied out */
+	if(allc)
+		icalcomponent_free(allc);
+	icalparser_free(parser);
+}
+
+void ical_cb::work()
+{
+	struct stat st;
+	calendar_ptr old;
+
+	if(stat(get<0>().c_str(), &st))
+		memset(&st, 0, sizeof(st));
+	{
+		std::lock_guard<std::mutex> lock(result_mutex);
+		old = result;
+	}
+	if(old && old->mtime == st.st_mtime && old->size == st.st_size
+			&& old->ino == st.st_ino && time(NULL) < old->expires)
+		return;
+
+	std::shared_ptr<ical_calendar> cal(new ical_calendar);
+	cal->mtime = st.st_mtime;
+	cal->size = st.st_size;
+	cal->ino = st.st_ino;
+	load(*cal);
+
+	std::lock_guard<std::mutex> lock(result_mutex);
+	result = cal;
+}
+
+struct obj_ical {
+	std::string file;
+	unsigned int num;
+};
+
+void parse_ical_args(struct text_object *obj, const char* arg, void *free_at_crash, void *free_at_crash2) {
+	char *filename = strdup(arg);
+	FILE *file;
 	unsigned int num;
 
 	if(sscanf(arg , "%d %s", &num, filename) != 2) {
 		free(filename);
-		free(obj);
+		delete_text_object(obj);
 		CRIT_ERR(free_at_crash, free_at_crash2, "wrong number of arguments for $ical");
 	}
 	file = fopen(filename, "r");
 	if( ! file) {
-		free(obj);
+		delete_text_object(obj);
 		free(free_at_crash);
 		CRIT_ERR(filename, free_at_crash2, "Can't read file %s", filename);
 		return;
 	}
-	free(filename);
-	parser = icalparser_new();
-	icalparser_set_gen_data(parser, file);
-	allc = icalparser_parse(parser, read_stream);
 	fclose(file);
-	curc = icalcomponent_get_first_component(allc, ICAL_VEVENT_COMPONENT);
-	if(!curc) {
-		icalparser_free(parser);
-		icalcomponent_free(allc);
-		NORM_ERR("No ical events available");
-		return;
-	}
-	ll_start = add_event(NULL, curc);
-	ll_end = ll_start;
-	while(1) {
-		curc = icalcomponent_get_next_component(allc, ICAL_VEVENT_COMPONENT);
-		if(!curc) break;
-		ll_new = add_event(ll_end, curc);
-		if( ! ll_start) {	//first component was not added
-			ll_start = ll_new;
-			ll_end = ll_new;
-		}else if( ll_start->prev ) {
-			ll_start = ll_start->prev;
-		}else if( ll_end->next ) {
-			ll_end = ll_end->next;
-		}
-	}
-	opaque = (struct obj_ical *) malloc(sizeof(struct obj_ical));
-	opaque->list = ll_start;
-	opaque->parser = parser;
-	opaque->comps = allc;
+
+	struct obj_ical *opaque = new obj_ical;
+	opaque->file = filename;
 	opaque->num = num;
 	obj->data.opaque = opaque;
+	free(filename);
 }
 
 void print_ical(struct text_object *obj, char *p, int p_max_size) {
 	struct obj_ical *ical_obj = (struct obj_ical *) obj->data.opaque;
-	struct ical_event *ll_current;
-
-	if( ! ical_obj) return;
-	ll_current = ical_obj->list;
-	unsigned int i=1;
-	while(1) {
-		if( ! ll_current) return;
-		if(i > ical_obj->num) return;
-		if(i == ical_obj->num) break;
-		if(i < ical_obj->num) {
-			ll_current = ll_current->next;
-			i++;
-		}
-	}
-	snprintf(p, p_max_size, "%s", icalproperty_get_summary(icalcomponent_get_first_property(ll_current->event, ICAL_SUMMARY_PROPERTY)));
+
+	if( ! ical_obj || ical_obj->num < 1) return;
+
+	uint32_t period = std::max(lround(ICAL_CHECK_INTERVAL/active_update_interval()), 1l);
+	calendar_ptr cal = conky::register_cb<ical_cb>(period, ical_obj->file)->get_result_copy();
+	if( ! cal) return;
+
+	/* events that have started since the file was read don't count anymore */
+	ical_event now;
+	now.start = time(NULL);
+	auto first = std::upper_bound(cal->events.begin(), cal->events.end(), now);
+	if(size_t(cal->events.end() - first) < ical_obj->num) return;
+	snprintf(p, p_max_size, "%s", first[ical_obj->num - 1].summary.c_str());
 }
 
 void free_ical(struct text_object *obj) {
 	struct obj_ical *ical_free_me = (struct obj_ical *) obj->data.opaque;
 
 	if( ! ical_free_me) return;
-	icalcomponent_free(ical_free_me->comps);
-	icalparser_free(ical_free_me->parser);
-	while(ical_free_me->list) {
-		if(ical_free_me->list->next) {
-			ical_free_me->list = ical_free_me->list->next;
-			free_and_zero(ical_free_me->list->prev);
-		} else free_and_zero(ical_free_me->list);
-	}
-	free(obj->data.opaque);
+	delete ical_free_me;
+	obj->data.opaque = NULL;
 }
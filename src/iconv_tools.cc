@@ -43,6 +43,10 @@ static long iconv_count = 0;
 static char iconv_converting = 0;
 static iconv_t **iconv_cd = 0;
 
+/* the text being converted is copied here, kept from call to call */
+static char *iconv_buff = 0;
+static size_t iconv_buff_size = 0;
+
 int register_iconv(iconv_t *new_iconv)
 {
 	iconv_cd = (void ***) realloc(iconv_cd, sizeof(iconv_t *) * (iconv_count + 1));
@@ -75,26 +79,41 @@ void free_iconv(struct text_object *obj)
 	}
 	free(iconv_cd);
 	iconv_cd = 0;
+	free(iconv_buff);
+	iconv_buff = 0;
+	iconv_buff_size = 0;
 }
 
-void iconv_convert(size_t *a, char *buff_in, char *p, size_t p_max_size)
+/* convert the *a bytes at p, which has room for p_max_size, in place if
+ * we're between an $iconv_start and an $iconv_stop */
+void iconv_convert(size_t *a, char *p, size_t p_max_size)
 {
 	int bytes;
 	size_t dummy1, dummy2;
-#if defined(__FreeBSD__) || defined(__DragonFly__)
-	const char *ptr = buff_in;
-#else
-	char *ptr = buff_in;
-#endif
 	char *outptr = p;
 
 	if (*a <= 0 || !iconv_converting || iconv_selected <= 0
 			|| iconv_cd[iconv_selected - 1] == (iconv_t) (-1))
 		return;
 
-	dummy1 = dummy2 = *a;
+	if (*a >= p_max_size)
+		*a = p_max_size - 1;
+	if (iconv_buff_size < *a) {
+		iconv_buff = (char *) realloc(iconv_buff, *a);
+		if (!iconv_buff) {
+			CRIT_ERR(NULL, NULL, "Out of memory");
+		}
+		iconv_buff_size = *a;
+	}
+	memcpy(iconv_buff, p, *a);
+
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+	const char *ptr = iconv_buff;
+#else
+	char *ptr = iconv_buff;
+#endif
 
-	strncpy(buff_in, p, p_max_size);
+	dummy1 = dummy2 = *a;
 
 	iconv(*iconv_cd[iconv_selected - 1], NULL, NULL, NULL, NULL);
 	while (dummy1 > 0) {
@@ -32,7 +32,7 @@
 #define _ICONV_TOOLS_H
 
 void free_iconv(struct text_object *);
-void iconv_convert(size_t *, char *, char *, size_t);
+void iconv_convert(size_t *, char *, size_t);
 void init_iconv_start(struct text_object *, void *, const char *);
 void init_iconv_stop(void);
 
@@ -34,6 +34,10 @@
 #include <limits.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <unordered_map>
 
 #include "x11.h"
 
@@ -63,6 +67,43 @@ namespace {
 		);
 
 	unsigned int cimlib_cache_flush_last = 0;
+
+	/* A decoded image, already scaled to the size it is drawn at. The image
+	 * list is built again every update; these stay until an image isn't
+	 * drawn in a cimlib_render() pass, and are only decoded again when the
+	 * file is replaced or changes. */
+	struct decoded_image {
+		Imlib_Image image;
+		int w, h;				/* of image */
+		dev_t dev;
+		ino_t ino;
+		off_t size;
+		time_t mtime;
+		time_t loaded_at;
+		unsigned long drawn;	/* render_pass that last drew it */
+	};
+
+	/* by the name of the file and the size given with -s */
+	std::unordered_map<std::string, decoded_image> decoded_images;
+	unsigned long render_pass = 0;
+
+	void free_decoded_image(decoded_image &d)
+	{
+		imlib_context_set_image(d.image);
+		imlib_free_image();
+	}
+
+	void free_decoded_images(bool all)
+	{
+		for (auto i = decoded_images.begin(); i != decoded_images.end(); ) {
+			if (all || i->second.drawn != render_pass) {
+				free_decoded_image(i->second);
+				i = decoded_images.erase(i);
+			} else {
+				++i;
+			}
+		}
+	}
 }
 
 void imlib_cache_size_setting::lua_setter(lua::state &l, bool init)
@@ -96,6 +137,7 @@ void imlib_cache_size_setting::cleanup(lua::state &l)
 
 	if(out_to_x.get(l)) {
 		cimlib_cleanup();
+		free_decoded_images(true);
 		imlib_context_disconnect_display();
 		imlib_context_pop();
 		imlib_context_free(context);
@@ -113,6 +155,11 @@ void cimlib_cleanup(void)
 	image_list_start = image_list_end = NULL;
 }
 
+bool cimlib_has_images(void)
+{
+	return image_list_start != NULL;
+}
+
 void cimlib_add_image(const char *args)
 {
 	struct image_list_s *cur = NULL;
@@ -169,51 +216,100 @@ void cimlib_add_image(const char *args)
 	}
 }
 
-static void cimlib_draw_image(struct image_list_s *cur, int *clip_x, int
-		*clip_y, int *clip_x2, int *clip_y2)
+/* the decoded image for cur, loading it first if the file changed since */
+static decoded_image *cimlib_get_image(struct image_list_s *cur)
 {
-	int w, h;
-	time_t now = time(NULL);
 	static int rep = 0;
+	struct stat st;
+	char key[1100];
+	time_t now = time(NULL);
+	Imlib_Image image;
 
-	if (imlib_context_get_drawable() != window.drawable) {
-		imlib_context_set_drawable(window.drawable);
+	if (stat(cur->name, &st) != 0) {
+		if (!rep)
+			NORM_ERR("Unable to load image '%s'", cur->name);
+		rep = 1;
+		return NULL;
+	}
+
+	snprintf(key, sizeof(key), "%s|%dx%d", cur->name,
+			cur->wh_set ? cur->w : -1, cur->wh_set ? cur->h : -1);
+	auto it = decoded_images.find(key);
+	if (it != decoded_images.end() && !cur->no_cache
+			&& (!cur->flush_interval || now - it->second.loaded_at < cur->flush_interval)
+			&& it->second.dev == st.st_dev && it->second.ino == st.st_ino
+			&& it->second.size == st.st_size && it->second.mtime == st.st_mtime) {
+		return &it->second;
 	}
 
+	DBGP("Loading image '%s' scaled to %ix%i, "
+	     "caching interval set to %i (with -n opt %i)",
+	     cur->name, cur->w, cur->h, cur->flush_interval, cur->no_cache);
 
-	image = imlib_load_image(cur->name);
+	/* this one isn't kept in imlib2's cache as well */
+	image = imlib_load_image_immediately_without_cache(cur->name);
 	if (!image) {
 		if (!rep)
 			NORM_ERR("Unable to load image '%s'", cur->name);
 		rep = 1;
-		return;
+		/* half written, most likely: keep drawing what was there */
+		return it != decoded_images.end() ? &it->second : NULL;
 	}
 	rep = 0;	/* reset so disappearing images are reported */
 
-	DBGP("Drawing image '%s' at (%i,%i) scaled to %ix%i, "
-	     "caching interval set to %i (with -n opt %i)",
-	     cur->name, cur->x, cur->y, cur->w, cur->h,
-	     cur->flush_interval, cur->no_cache);
-
+	decoded_image d;
 	imlib_context_set_image(image);
 	/* turn alpha channel on */
 	imlib_image_set_has_alpha(1);
-	w = imlib_image_get_width();
-	h = imlib_image_get_height();
+	d.w = imlib_image_get_width();
+	d.h = imlib_image_get_height();
+	if (cur->wh_set && (cur->w != d.w || cur->h != d.h) && cur->w > 0 && cur->h > 0) {
+		d.image = imlib_create_cropped_scaled_image(0, 0, d.w, d.h, cur->w, cur->h);
+		imlib_free_image();
+		if (!d.image) {
+			return it != decoded_images.end() ? &it->second : NULL;
+		}
+		imlib_context_set_image(d.image);
+		imlib_image_set_has_alpha(1);
+		d.w = cur->w;
+		d.h = cur->h;
+	} else {
+		d.image = image;
+	}
+	d.dev = st.st_dev;
+	d.ino = st.st_ino;
+	d.size = st.st_size;
+	d.mtime = st.st_mtime;
+	d.loaded_at = now;
+	d.drawn = render_pass;
+
+	if (it != decoded_images.end()) {
+		free_decoded_image(it->second);
+		it->second = d;
+		return &it->second;
+	}
+	return &decoded_images.insert(std::make_pair(std::string(key), d)).first->second;
+}
+
+static void cimlib_draw_image(struct image_list_s *cur, int *clip_x, int
+		*clip_y, int *clip_x2, int *clip_y2)
+{
+	decoded_image *d;
+
+	if (imlib_context_get_drawable() != window.drawable) {
+		imlib_context_set_drawable(window.drawable);
+	}
+
+	if (!(d = cimlib_get_image(cur)))
+		return;
+	d->drawn = render_pass;
 	if (!cur->wh_set) {
-		cur->w = w;
-		cur->h = h;
+		cur->w = d->w;
+		cur->h = d->h;
 	}
 	imlib_context_set_image(buffer);
-	imlib_blend_image_onto_image(image, 1, 0, 0, w, h,
+	imlib_blend_image_onto_image(d->image, 1, 0, 0, d->w, d->h,
 			cur->x, cur->y, cur->w, cur->h);
-	imlib_context_set_image(image);
-	if (cur->no_cache || (cur->flush_interval &&
-	                      now % cur->flush_interval == 0)) {
-		imlib_free_image_and_decache();
-	} else {
-		imlib_free_image();
-	}
 	if (cur->x < *clip_x) *clip_x = cur->x;
 	if (cur->y < *clip_y) *clip_y = cur->y;
 	if (cur->x + cur->w > *clip_x2) *clip_x2 = cur->x + cur->w;
@@ -235,7 +331,11 @@ void cimlib_render(int x, int y, int width, int height)
 	int clip_x2 = 0, clip_y2 = 0;
 	time_t now;
 
-	if (!image_list_start) return; /* are we actually drawing anything? */
+	++render_pass;
+	if (!image_list_start) { /* are we actually drawing anything? */
+		free_decoded_images(false);
+		return;
+	}
 
 	/* cheque if it's time to flush our cache */
 	now = time(NULL);
@@ -244,6 +344,7 @@ void cimlib_render(int x, int y, int width, int height)
 		int size = imlib_get_cache_size();
 		imlib_set_cache_size(0);
 		imlib_set_cache_size(size);
+		free_decoded_images(true);
 		cimlib_cache_flush_last = now;
 		DBGP("Flushing Imlib2 cache (%li)\n", now);
 	}
@@ -260,6 +361,8 @@ void cimlib_render(int x, int y, int width, int height)
 	imlib_image_set_has_alpha(1);
 
 	cimlib_draw_all(&clip_x, &clip_y, &clip_x2, &clip_y2);
+	/* the images that weren't drawn this time */
+	free_decoded_images(false);
 
 	/* set the buffer image as our current image */
 	imlib_context_set_image(buffer);
@@ -32,6 +32,8 @@ void cimlib_set_cache_size(long size);
 void cimlib_set_cache_flush_interval(long interval);
 void cimlib_render(int x, int y, int width, int height);
 void cimlib_cleanup(void);
+/* true if images were added since the last cimlib_cleanup() */
+bool cimlib_has_images(void);
 
 void print_image_callback(struct text_object *, char *, int);
 
@@ -30,21 +30,35 @@
 #include <string.h>
 #include "text_object.h"
 #include <libircclient/libircclient.h>
+#include <atomic>
+
+/* messages the printer hasn't taken yet, newer ones are dropped */
+#define IRC_RING_SLOTS 64
+/* a line of IRC is at most 512 bytes, the nick comes on top */
+#define IRC_MSG_LEN 600
+
+/* The messages go from the irc thread to print_irc() through a ring of
+ * slots, with one writer and one reader: the irc thread fills the slot at
+ * head and then moves head on, print_irc() empties the ones up to head and
+ * then moves tail on. */
+struct irc_ring {
+	char slots[IRC_RING_SLOTS][IRC_MSG_LEN];
+	std::atomic<unsigned int> head, tail;
+	/* what didn't fit, counted by the irc thread */
+	unsigned long dropped;
+};
 
-struct ll_text {
-	char *text;
-	struct ll_text *next;
+struct ctx {
+	char *chan;
+	struct irc_ring messages;
 };
 
 struct obj_irc {
 	pthread_t *thread;
 	irc_session_t *session;
 	char *arg;
-};
-
-struct ctx {
-	char *chan;
-	struct ll_text *messages;
+	/* made before the thread starts and freed after it ended */
+	struct ctx *ctx;
 };
 
 void ev_connected(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count) {
@@ -56,19 +70,15 @@ void ev_connected(irc_session_t *session, const char *event, const char *origin,
 }
 
 void addmessage(struct ctx *ctxptr, char *nick, const char *text) {
-	struct ll_text *lastmsg = ctxptr->messages;
-	struct ll_text *newmsg = (struct ll_text*) malloc(sizeof(struct ll_text));
-	newmsg->text = (char*) malloc(strlen(nick) + strlen(text) + 4);	//4 = ": \n"
-	sprintf(newmsg->text, "%s: %s\n", nick, text);
-	newmsg->next = NULL;
-	if(!lastmsg) {
-		ctxptr->messages = newmsg;
-	} else {
-		while(lastmsg->next) {
-			lastmsg = lastmsg->next;
-		}
-		lastmsg->next = newmsg;
+	struct irc_ring *ring = &ctxptr->messages;
+	unsigned int head = ring->head.load(std::memory_order_relaxed);
+
+	if(head - ring->tail.load(std::memory_order_acquire) == IRC_RING_SLOTS) {
+		ring->dropped++;
+		return;
 	}
+	snprintf(ring->slots[head % IRC_RING_SLOTS], IRC_MSG_LEN, "%s: %s\n", nick, text);
+	ring->head.store(head + 1, std::memory_order_release);
 }
 
 void ev_talkinchan(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count) {
@@ -104,7 +114,7 @@ void ev_num(irc_session_t *session, unsigned int event, const char *origin, cons
 
 void *ircclient(void *ptr) {
 	struct obj_irc *ircobj = (struct obj_irc *) ptr;
-	struct ctx *ctxptr = (struct ctx *) malloc(sizeof(struct ctx));
+	struct ctx *ctxptr = ircobj->ctx;
 	irc_callbacks_t callbacks;
 	char *server;
 	char *strport;
@@ -120,7 +130,6 @@ void *ircclient(void *ptr) {
 	if( ! ctxptr->chan) {
 		NORM_ERR("irc: %s", IRCSYNTAX);
 	}
-	ctxptr->messages = NULL;
 	irc_set_ctx(ircobj->session, ctxptr);
 	server = strtok(server, ":");
 	strport = strtok(NULL, ":");
@@ -143,7 +152,6 @@ void *ircclient(void *ptr) {
 		}
 	}
 	free(ircobj->arg);
-	free(ctxptr);
 	return NULL;
 }
 
@@ -153,52 +161,70 @@ void parse_irc_args(struct text_object *obj, const char* arg) {
 	srand(time(NULL));
 	opaque->session = NULL;
 	opaque->arg = strdup(arg);
+	opaque->ctx = new ctx;
+	opaque->ctx->chan = NULL;
+	opaque->ctx->messages.head = 0;
+	opaque->ctx->messages.tail = 0;
+	opaque->ctx->messages.dropped = 0;
 	pthread_create(opaque->thread, NULL, ircclient, opaque);
 	obj->data.opaque = opaque;
 }
 
 void print_irc(struct text_object *obj, char *p, int p_max_size) {
 	struct obj_irc *ircobj = (struct obj_irc *) obj->data.opaque;
-	struct ctx *ctxptr;
-	struct ll_text *nextmsg, *curmsg;
+	struct irc_ring *ring = &ircobj->ctx->messages;
+	unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+	unsigned int head = ring->head.load(std::memory_order_acquire);
 
 	if( ! ircobj->session) return;
 	if( ! irc_is_connected(ircobj->session)) return;
-	ctxptr = (struct ctx *) irc_get_ctx(ircobj->session);
-	curmsg = ctxptr->messages;
-	while(curmsg) {
-		nextmsg = curmsg->next;
-		strncat(p, curmsg->text, p_max_size - strlen(p) - 1);
-		free(curmsg->text);
-		free(curmsg);
-		curmsg = nextmsg;
+	for(; tail != head; tail++) {
+		strncat(p, ring->slots[tail % IRC_RING_SLOTS], p_max_size - strlen(p) - 1);
 	}
 	if(p[0] != 0) {
 		p[strlen(p) - 1] = 0;
 	}
-	ctxptr->messages = NULL;
+	ring->tail.store(tail, std::memory_order_release);
 }
 
 void free_irc(struct text_object *obj) {
 	struct obj_irc *ircobj = (struct obj_irc *) obj->data.opaque;
-	struct ctx *ctxptr;
-	struct ll_text *nextmsg, *curmsg = NULL;
 
 	if(ircobj->session) {
 		if( irc_is_connected(ircobj->session)) {
-			ctxptr = (struct ctx *) irc_get_ctx(ircobj->session);
-			curmsg = ctxptr->messages;
 			irc_disconnect(ircobj->session);
 		}
 		pthread_join(*(ircobj->thread), NULL);
 		irc_destroy_session(ircobj->session);
 	}
+	if(ircobj->ctx->messages.dropped) {
+		NORM_ERR("irc: %lu messages came faster than they were shown and were dropped",
+				ircobj->ctx->messages.dropped);
+	}
+	delete ircobj->ctx;
 	free(ircobj->thread);
 	free(obj->data.opaque);
-	while(curmsg) {
-		nextmsg = curmsg->next;
-		free(curmsg->text);
-		free(curmsg);
-		curmsg = nextmsg;
-	}
 }
+
+#ifdef BUILD_PLUGINS
+#include "plugin.h"
+
+/* ${irc}, as construct_text_object() does it when irc is built in */
+static bool construct_irc(struct text_object *obj, const char *name,
+		const char *arg, void *free_at_crash)
+{
+	if (strcmp(name, "irc"))
+		return false;
+	if (!arg)
+		CRIT_ERR(obj, free_at_crash, "irc requires arguments");
+	obj->name = "irc";
+	parse_irc_args(obj, arg);
+	obj->callbacks.print = &print_irc;
+	obj->callbacks.free = &free_irc;
+	return true;
+}
+
+extern "C" const struct conky_plugin conky_plugin_irc = {
+	CONKY_PLUGIN_VERSION, &construct_irc
+};
+#endif /* BUILD_PLUGINS */
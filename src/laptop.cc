@@ -0,0 +1,215 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "common.h"
+#include "laptop.h"
+#include "logging.h"
+#include "setting.hh"
+#include "update-cb.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <atomic>
+#include <map>
+#include <set>
+
+#define PROC_I8K "/proc/i8k"
+#define IBM_ACPI_DIR "/proc/acpi/ibm"
+#define SONY_LAPTOP_DIR "/sys/devices/platform/sony-laptop"
+#define SYS_SMAPI_PATH "/sys/devices/platform/smapi"
+
+namespace {
+	/* seconds between the reads, 0 to read on every update */
+	conky::range_config_setting<double> laptop_interval("laptop_interval", 0.0,
+			std::numeric_limits<double>::infinity(), 0.0, true);
+
+	/*
+	 * Reads the files of the laptop drivers the objects ask for with want(). The
+	 * files of i8k, ibm and sony are proc_files, kept open and read with one
+	 * pread(), which complain once if the driver isn't loaded. The smapi files are
+	 * those of the batteries, which come and go, so they are opened again while
+	 * they are missing, and quietly.
+	 */
+	class laptop_cb: public conky::callback<laptop_ptr> {
+		typedef conky::callback<laptop_ptr> Base;
+
+		proc_file i8k, ibm_fan, ibm_thermal, ibm_volume, ibm_brightness, sony_fanspeed;
+		/* the smapi files by path, only used by work() */
+		std::map<std::string, int> smapi_fds;
+		std::atomic<unsigned int> wanted;
+		std::mutex smapi_mutex;
+		std::set<std::string> smapi_wanted;
+
+		void read_i8k(laptop_sample &sample);
+		void read_ibm(unsigned int w, laptop_sample &sample);
+		void read_smapi(laptop_sample &sample);
+
+	protected:
+		virtual void work();
+
+	public:
+		laptop_cb(uint32_t period)
+			: Base(period, true, Tuple()), i8k(PROC_I8K), ibm_fan(IBM_ACPI_DIR "/fan"),
+			  ibm_thermal(IBM_ACPI_DIR "/thermal"), ibm_volume(IBM_ACPI_DIR "/volume"),
+			  ibm_brightness(IBM_ACPI_DIR "/brightness"),
+			  sony_fanspeed(SONY_LAPTOP_DIR "/fanspeed"), wanted(0)
+		{}
+
+		~laptop_cb()
+		{
+			for (auto i = smapi_fds.begin(); i != smapi_fds.end(); ++i) {
+				if (i->second >= 0)
+					close(i->second);
+			}
+		}
+
+		void want(unsigned int what, const std::string &smapi_file)
+		{
+			wanted |= what;
+			if (!smapi_file.empty()) {
+				std::lock_guard<std::mutex> lock(smapi_mutex);
+				smapi_wanted.insert(smapi_file);
+			}
+		}
+	};
+
+	/* /proc/i8k is one line of fields separated by blanks:
+	 * 1.0 A17 2J59L02 52 2 1 8040 6420 1 2 */
+	void laptop_cb::read_i8k(laptop_sample &sample)
+	{
+		const char *p;
+		int i = 0;
+
+		if (!i8k.read())
+			return;
+		for (p = i8k.data(); *p && i < I8K_FIELDS; ++i) {
+			size_t n;
+
+			p += strspn(p, " \t\n");
+			n = strcspn(p, " \t\n");
+			if (n == 0)
+				break;
+			sample.i8k[i].assign(p, n);
+			p += n;
+		}
+	}
+
+	/* the files are described in the README of thinkpad_acpi (once ibm_acpi),
+	 * see ibm.cc */
+	void laptop_cb::read_ibm(unsigned int w, laptop_sample &sample)
+	{
+		const char *p;
+
+		if ((w & LAPTOP_IBM_FAN) && ibm_fan.read() &&
+				(p = strstr(ibm_fan.data(), "speed:")))
+			sscanf(p, "speed: %u", &sample.ibm_fan);
+
+		if ((w & LAPTOP_IBM_THERMAL) && ibm_thermal.read() &&
+				(p = strstr(ibm_thermal.data(), "temperatures:"))) {
+			int *t = sample.ibm_temps;
+
+			sscanf(p, "temperatures: %d %d %d %d %d %d %d %d",
+					&t[0], &t[1], &t[2], &t[3], &t[4], &t[5], &t[6], &t[7]);
+		}
+
+		if ((w & LAPTOP_IBM_VOLUME) && ibm_volume.read()) {
+			char mute[4] = "";
+
+			if ((p = strstr(ibm_volume.data(), "level:")))
+				sscanf(p, "level: %d", &sample.ibm_volume);
+			if ((p = strstr(ibm_volume.data(), "mute:")))
+				sscanf(p, "mute: %3s", mute);
+			sample.ibm_mute = strcmp(mute, "on") == 0;
+		}
+
+		if ((w & LAPTOP_IBM_BRIGHTNESS) && ibm_brightness.read() &&
+				(p = strstr(ibm_brightness.data(), "level:")))
+			sscanf(p, "level: %u", &sample.ibm_brightness);
+	}
+
+	void laptop_cb::read_smapi(laptop_sample &sample)
+	{
+		std::set<std::string> files;
+
+		{
+			std::lock_guard<std::mutex> lock(smapi_mutex);
+			files = smapi_wanted;
+		}
+		for (auto i = files.begin(); i != files.end(); ++i) {
+			int &fd = smapi_fds.insert(std::make_pair(*i, -1)).first->second;
+			char buf[256], word[256];
+			ssize_t n;
+
+			if (fd < 0)
+				fd = open((SYS_SMAPI_PATH "/" + *i).c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				continue;
+			n = pread(fd, buf, sizeof(buf) - 1, 0);
+			if (n < 0) {
+				/* the battery was taken out */
+				close(fd);
+				fd = -1;
+				continue;
+			}
+			buf[n] = '\0';
+			if (sscanf(buf, "%255s", word) == 1)
+				sample.smapi[*i] = word;
+			else
+				sample.smapi[*i] = std::string();
+		}
+	}
+
+	void laptop_cb::work()
+	{
+		const unsigned int w = wanted;
+		std::shared_ptr<laptop_sample> sample(new laptop_sample);
+
+		if (w & LAPTOP_I8K)
+			read_i8k(*sample);
+		read_ibm(w, *sample);
+		if ((w & LAPTOP_SONY_FANSPEED) && sony_fanspeed.read())
+			sscanf(sony_fanspeed.data(), "%u", &sample->sony_fanspeed);
+		if (w & LAPTOP_SMAPI)
+			read_smapi(*sample);
+
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result = sample;
+	}
+}
+
+laptop_ptr get_laptop_sample(unsigned int want, const std::string &smapi_file)
+{
+	uint32_t period = std::max(lround(laptop_interval.get(*state) / active_update_interval()), 1l);
+	auto cb = conky::register_cb<laptop_cb>(period);
+
+	cb->want(want, smapi_file);
+	return cb->get_result_copy();
+}
@@ -0,0 +1,89 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _LAPTOP_H
+#define _LAPTOP_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/* The figures of the laptop platform drivers, i8k, thinkpad_acpi (ibm),
+ * sony-laptop and tp_smapi, are read together by one callback, every
+ * laptop_interval seconds (every update with 0). It keeps the files open and
+ * only reads those the objects of the config show. */
+
+enum laptop_want {
+	LAPTOP_I8K = 1,
+	LAPTOP_IBM_FAN = 2,
+	LAPTOP_IBM_THERMAL = 4,
+	LAPTOP_IBM_VOLUME = 8,
+	LAPTOP_IBM_BRIGHTNESS = 16,
+	LAPTOP_SONY_FANSPEED = 32,
+	LAPTOP_SMAPI = 64,
+};
+
+/* the fields of /proc/i8k, in the order they come in */
+enum i8k_field {
+	I8K_VERSION, I8K_BIOS, I8K_SERIAL, I8K_CPU_TEMP, I8K_LEFT_FAN_STATUS,
+	I8K_RIGHT_FAN_STATUS, I8K_LEFT_FAN_RPM, I8K_RIGHT_FAN_RPM, I8K_AC_STATUS,
+	I8K_BUTTONS_STATUS, I8K_FIELDS
+};
+
+/* what the callback read in one run, never changed afterwards; what wasn't
+ * asked for or couldn't be read is 0 or empty */
+struct laptop_sample {
+	std::string i8k[I8K_FIELDS];
+	unsigned int ibm_fan;
+	int ibm_temps[8];
+	/* -1 if unknown */
+	int ibm_volume;
+	bool ibm_mute;
+	unsigned int ibm_brightness;
+	unsigned int sony_fanspeed;
+	/* the first word of each smapi file asked for, by its path below
+	 * /sys/devices/platform/smapi; missing if the file isn't there */
+	std::unordered_map<std::string, std::string> smapi;
+
+	laptop_sample()
+		: ibm_fan(0), ibm_volume(-1), ibm_mute(false), ibm_brightness(0),
+		  sony_fanspeed(0)
+	{
+		for (int i = 0; i < 8; ++i)
+			ibm_temps[i] = 0;
+	}
+};
+typedef std::shared_ptr<const laptop_sample> laptop_ptr;
+
+/* the latest sample, asking for want (and the smapi file, if any) from now
+ * on; NULL before the first run */
+laptop_ptr get_laptop_sample(unsigned int want, const std::string &smapi_file = std::string());
+
+#endif /* _LAPTOP_H */
@@ -0,0 +1,216 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "latency.h"
+#include "logging.h"
+#include "update-cb.hh"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+latency_histogram tick_latency;
+latency_histogram wait_latency;
+latency_histogram callback_latency;
+
+int latency_histogram::bucket_of(uint64_t us)
+{
+	int bits;
+
+	if (us < (1u << sub_bits))
+		return us;
+	if (us >= (1ull << max_bits))
+		return buckets - 1;
+	bits = 63 - __builtin_clzll(us);
+	/* the top sub_bits bits below the leading one pick the bucket */
+	return ((bits - sub_bits + 1) << sub_bits)
+		+ ((us >> (bits - sub_bits)) & ((1u << sub_bits) - 1));
+}
+
+uint64_t latency_histogram::bucket_top(int i)
+{
+	int octave = i >> sub_bits;
+
+	if (octave == 0)
+		return i;
+	return ((uint64_t) ((1u << sub_bits) + (i & ((1u << sub_bits) - 1)) + 1)
+			<< (octave - 1)) - 1;
+}
+
+void latency_histogram::record(double seconds)
+{
+	uint64_t us = seconds > 0 ? (uint64_t) (seconds * 1e6) : 0;
+	uint64_t max = max_us.load(std::memory_order_relaxed);
+
+	counts[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+	sum_us.fetch_add(us, std::memory_order_relaxed);
+	while (us > max && !max_us.compare_exchange_weak(max, us, std::memory_order_relaxed))
+		;
+}
+
+void latency_histogram::clear()
+{
+	for (int i = 0; i < buckets; i++)
+		counts[i].store(0, std::memory_order_relaxed);
+	total.store(0, std::memory_order_relaxed);
+	sum_us.store(0, std::memory_order_relaxed);
+	max_us.store(0, std::memory_order_relaxed);
+}
+
+double latency_histogram::percentile(double q) const
+{
+	uint64_t n = count(), seen = 0, rank;
+
+	if (n == 0)
+		return 0;
+	rank = std::max<uint64_t>(ceil(q * n), 1);
+	for (int i = 0; i < buckets; i++) {
+		seen += counts[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(bucket_top(i), max_us.load(std::memory_order_relaxed)) / 1e6;
+	}
+	return max();
+}
+
+double latency_histogram::max() const
+{
+	return max_us.load(std::memory_order_relaxed) / 1e6;
+}
+
+double latency_histogram::mean() const
+{
+	uint64_t n = count();
+
+	return n ? sum_us.load(std::memory_order_relaxed) / 1e6 / n : 0;
+}
+
+static void print_histogram(const char *name, const latency_histogram &h)
+{
+	fprintf(stderr, "%10llu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f  %s\n",
+			(unsigned long long) h.count(), h.mean() * 1000, h.percentile(0.5) * 1000,
+			h.percentile(0.9) * 1000, h.percentile(0.99) * 1000,
+			h.percentile(0.999) * 1000, h.max() * 1000, name);
+}
+
+void print_latency_report(void)
+{
+	fprintf(stderr, "%10s %10s %10s %10s %10s %10s %10s  %s\n", "count", "mean ms",
+			"p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms", "what");
+	print_histogram("tick lateness", tick_latency);
+	print_histogram("callback wait", wait_latency);
+	print_histogram("callbacks", callback_latency);
+	conky::for_each_callback_latency([](const std::string &name, const latency_histogram &h) {
+		if (h.count())
+			print_histogram(("callback " + name).c_str(), h);
+	});
+}
+
+enum latency_figure { LATENCY_PERCENTILE, LATENCY_MAX, LATENCY_MEAN, LATENCY_COUNT };
+
+struct latency_obj {
+	const latency_histogram *histogram;
+	latency_figure figure;
+	/* for LATENCY_PERCENTILE, between 0 and 1 */
+	double q;
+};
+
+void parse_latency_arg(struct text_object *obj, const char *arg)
+{
+	char which[16], figure[16] = "p99";
+	struct latency_obj *lo;
+	const latency_histogram *h;
+
+	if (!arg || sscanf(arg, "%15s %15s", which, figure) < 1) {
+		NORM_ERR("latency needs tick, wait or callbacks");
+		return;
+	}
+	if (!strcmp(which, "tick")) {
+		h = &tick_latency;
+	} else if (!strcmp(which, "wait")) {
+		h = &wait_latency;
+	} else if (!strcmp(which, "callbacks")) {
+		h = &callback_latency;
+	} else {
+		NORM_ERR("latency: unknown histogram '%s'", which);
+		return;
+	}
+
+	lo = new latency_obj;
+	lo->histogram = h;
+	lo->q = 0;
+	if (!strcmp(figure, "max")) {
+		lo->figure = LATENCY_MAX;
+	} else if (!strcmp(figure, "mean")) {
+		lo->figure = LATENCY_MEAN;
+	} else if (!strcmp(figure, "count")) {
+		lo->figure = LATENCY_COUNT;
+	} else {
+		/* p50, p99, p999 (99.9) */
+		const char *digits = figure + 1;
+
+		lo->figure = LATENCY_PERCENTILE;
+		if (figure[0] != 'p' || !*digits || strspn(digits, "0123456789") != strlen(digits)) {
+			NORM_ERR("latency: '%s' is not p50, p99, p999, max, mean or count", figure);
+			digits = "99";
+		}
+		lo->q = atof(digits) / pow(10, strlen(digits));
+	}
+	obj->data.opaque = lo;
+}
+
+/* milliseconds */
+void print_latency(struct text_object *obj, char *p, int p_max_size)
+{
+	struct latency_obj *lo = (struct latency_obj *) obj->data.opaque;
+
+	if (!lo)
+		return;
+	switch (lo->figure) {
+		case LATENCY_PERCENTILE:
+			snprintf(p, p_max_size, "%.2f", lo->histogram->percentile(lo->q) * 1000);
+			break;
+		case LATENCY_MAX:
+			snprintf(p, p_max_size, "%.2f", lo->histogram->max() * 1000);
+			break;
+		case LATENCY_MEAN:
+			snprintf(p, p_max_size, "%.2f", lo->histogram->mean() * 1000);
+			break;
+		case LATENCY_COUNT:
+			snprintf(p, p_max_size, "%llu", (unsigned long long) lo->histogram->count());
+			break;
+	}
+}
+
+void free_latency(struct text_object *obj)
+{
+	delete (struct latency_obj *) obj->data.opaque;
+	obj->data.opaque = NULL;
+}
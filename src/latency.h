@@ -0,0 +1,87 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <atomic>
+#include <stdint.h>
+
+struct text_object;
+
+/* A histogram of durations in the manner of HdrHistogram: the buckets are
+ * 8 per power of two of microseconds, so a percentile is within about 12%,
+ * up to some 18 minutes. Recording is lock free, from any thread. */
+class latency_histogram {
+	static const int sub_bits = 3;
+	static const int max_bits = 30;
+	static const int buckets = (max_bits - sub_bits + 1) << sub_bits;
+
+	std::atomic<uint64_t> counts[buckets];
+	std::atomic<uint64_t> total, sum_us, max_us;
+
+	static int bucket_of(uint64_t us);
+	/* the largest number of microseconds in bucket i */
+	static uint64_t bucket_top(int i);
+
+	latency_histogram(const latency_histogram &) = delete;
+	latency_histogram& operator=(const latency_histogram &) = delete;
+
+public:
+	latency_histogram() { clear(); }
+
+	void record(double seconds);
+	void clear();
+
+	uint64_t count() const
+	{ return total.load(std::memory_order_relaxed); }
+
+	/* seconds, q between 0 and 1; 0 if nothing was recorded */
+	double percentile(double q) const;
+	double max() const;
+	double mean() const;
+};
+
+/* how late the updates started, after the time they were due */
+extern latency_histogram tick_latency;
+/* how long the updates waited for their callbacks */
+extern latency_histogram wait_latency;
+/* how long the callbacks ran, all of them; each has one of its own too */
+extern latency_histogram callback_latency;
+
+/* print the histograms, those of the callbacks included, to stderr; on
+ * SIGUSR2 */
+void print_latency_report(void);
+
+void parse_latency_arg(struct text_object *, const char *);
+void print_latency(struct text_object *, char *, int);
+void free_latency(struct text_object *);
+
+#endif /* _LATENCY_H */
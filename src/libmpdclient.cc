@@ -1940,6 +1940,39 @@ char *mpd_getNextTagType(mpd_Connection *connection)
 	return mpd_getNextReturnElementNamed(connection, "tagtype");
 }
 
+void mpd_sendIdleCommand(mpd_Connection *connection, const char *subsystems)
+{
+	char *sSubsystems = mpd_sanitizeArg(subsystems);
+	int len = strlen("idle") + 1 + strlen(sSubsystems) + 2;
+	char *string = (char *) malloc(len);
+
+	snprintf(string, len, "idle %s\n", sSubsystems);
+	mpd_executeCommand(connection, string);
+	free(string);
+	free(sSubsystems);
+}
+
+int mpd_replyReady(mpd_Connection *connection)
+{
+	struct timeval tv;
+	fd_set fds;
+
+	if (connection->bufstart < connection->buflen) {
+		return 1;
+	}
+
+	FD_ZERO(&fds);
+	FD_SET(connection->sock, &fds);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	return select(connection->sock + 1, &fds, NULL, NULL, &tv) == 1;
+}
+
+char *mpd_getNextChanged(mpd_Connection *connection)
+{
+	return mpd_getNextReturnElementNamed(connection, "changed");
+}
+
 void mpd_startSearch(mpd_Connection *connection, int exact)
 {
 	if (connection->request) {
@@ -560,6 +560,23 @@ void mpd_sendTagTypesCommand(mpd_Connection *connection);
 
 char *mpd_getNextTagType(mpd_Connection *connection);
 
+/* IDLE STUFF */
+
+/* mpd_sendIdleCommand
+ * waits for changes in the space separated _subsystems_ (since mpd 0.14),
+ * don't send other commands until the answer was read with
+ * mpd_getNextChanged() and mpd_finishCommand() */
+void mpd_sendIdleCommand(mpd_Connection *connection, const char *subsystems);
+
+/* mpd_replyReady
+ * returns 1 if (the beginning of) the answer to the pending command can be
+ * read without blocking, 0 otherwise */
+int mpd_replyReady(mpd_Connection *connection);
+
+/* mpd_getNextChanged
+ * returns the next subsystem reported by idle, be sure to free it */
+char *mpd_getNextChanged(mpd_Connection *connection);
+
 /**
  * @param connection	a MpdConnection
  * @param path			the path to the playlist.
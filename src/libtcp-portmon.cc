@@ -28,11 +28,26 @@
 
 #include "libtcp-portmon.h"
 
+#include <cerrno>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#endif
+
 /* -------------------------------------------------------------------
  * IMPLEMENTATION INTERFACE
  *
@@ -151,6 +166,22 @@ private:
 struct _tcp_port_monitor_collection_t {
 	/* hash table of monitors */
 	monitor_hash_t hash;
+	/* sock_diag netlink socket, -1 if not open yet, -2 if unusable */
+	int diag_fd;
+
+	_tcp_port_monitor_collection_t()
+		: hash(), diag_fd(-1)
+	{ }
+
+	~_tcp_port_monitor_collection_t()
+	{
+		if (diag_fd >= 0)
+			close(diag_fd);
+	}
+
+private:
+	_tcp_port_monitor_collection_t(const _tcp_port_monitor_collection_t &);
+	const _tcp_port_monitor_collection_t& operator=(const _tcp_port_monitor_collection_t &);
 };
 
 namespace {
@@ -279,25 +310,166 @@ namespace {
 	}
 
 
+	/* fills in the socket address for the (possibly IPv4-mapped) address */
+	socklen_t to_sockaddr(union sockaddr_in46 *sa, const struct in6_addr *addr)
+	{
+		std::memset(sa, 0, sizeof(*sa));
+
+		if(is_4on6(addr)) {
+			sa->sa4.sin_family = AF_INET;
+			std::memcpy(&sa->sa4.sin_addr.s_addr, &addr->s6_addr[12], 4);
+			return sizeof(sa->sa4);
+		} else {
+			sa->sa6.sin6_family = AF_INET6;
+			std::memcpy(&sa->sa6.sin6_addr, addr, sizeof(struct in6_addr));
+			return sizeof(sa->sa6);
+		}
+	}
+
 	/* converts the address to appropriate textual representation (IPv6, IPv4 or fqdn) */
 	void print_host(char *p_buffer, size_t buffer_size, const struct in6_addr *addr, int fqdn)
 	{
 		union sockaddr_in46 sa;
-		socklen_t slen;
+		socklen_t slen = to_sockaddr(&sa, addr);
 
-		std::memset(&sa, 0, sizeof(sa));
+		getnameinfo(&sa.sa, slen, p_buffer, buffer_size, NULL, 0, fqdn?0:NI_NUMERICHOST);
+	}
 
-		if(is_4on6(addr)) {
-			sa.sa4.sin_family = AF_INET;
-			std::memcpy(&sa.sa4.sin_addr.s_addr, &addr->s6_addr[12], 4);
-			slen = sizeof(sa.sa4);
-		} else {
-			sa.sa6.sin6_family = AF_INET6;
-			std::memcpy(&sa.sa6.sin6_addr, addr, sizeof(struct in6_addr));
-			slen = sizeof(sa.sa6);
+	/* hash function for addresses */
+	struct in6_addr_hash {
+		size_t operator()(const struct in6_addr &a) const
+		{
+			size_t hash = 0;
+
+			for(size_t i = 0; i < sizeof(a.s6_addr); ++i)
+				hash = hash*47 + a.s6_addr[i];
+
+			return hash;
 		}
+	};
 
-		getnameinfo(&sa.sa, slen, p_buffer, buffer_size, NULL, 0, fqdn?0:NI_NUMERICHOST);
+	struct in6_addr_equal {
+		bool operator()(const struct in6_addr &a, const struct in6_addr &b) const
+		{
+			return ! std::memcmp(&a, &b, sizeof(a));
+		}
+	};
+
+	/* ------------------------------------------------------------------------
+	 * Reverse DNS cache
+	 *
+	 * Names are looked up by a single background thread so a slow resolver
+	 * never stalls peeking.  Until a name arrives the numeric address is
+	 * shown instead.
+	 * ------------------------------------------------------------------------ */
+	class host_resolver {
+		/* how long resolved names and failed lookups are kept, in seconds */
+		static const time_t NAME_TTL = 600;
+		static const time_t FAILURE_TTL = 60;
+		/* expired entries are only pruned once the cache grows beyond this */
+		static const size_t PRUNE_SIZE = 4096;
+
+		struct entry {
+			std::string name;
+			time_t expires;
+			bool pending;
+
+			entry() : expires(0), pending(false) { }
+		};
+		typedef std::unordered_map<struct in6_addr, entry,
+									in6_addr_hash, in6_addr_equal> cache_t;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		cache_t cache;
+		std::deque<struct in6_addr> queue;
+
+		void prune(time_t now)
+		{
+			for (cache_t::iterator i = cache.begin(); i != cache.end(); ) {
+				if (!i->second.pending && i->second.expires <= now)
+					cache.erase(i++);
+				else
+					++i;
+			}
+		}
+
+		void run()
+		{
+			char name[NI_MAXHOST];
+			std::unique_lock<std::mutex> lock(mutex);
+
+			for (;;) {
+				while (queue.empty())
+					cv.wait(lock);
+
+				struct in6_addr addr = queue.front();
+				queue.pop_front();
+
+				lock.unlock();
+				union sockaddr_in46 sa;
+				socklen_t slen = to_sockaddr(&sa, &addr);
+				/* with NI_NAMEREQD we can tell an unresolvable address apart */
+				bool ok = getnameinfo(&sa.sa, slen, name, sizeof(name), NULL, 0,
+						NI_NAMEREQD) == 0;
+				lock.lock();
+
+				entry &e = cache[addr];
+				e.pending = false;
+				if (ok) {
+					e.name = name;
+					e.expires = std::time(NULL) + NAME_TTL;
+				} else {
+					e.name.clear();
+					e.expires = std::time(NULL) + FAILURE_TTL;
+				}
+			}
+		}
+
+	public:
+		host_resolver()
+		{
+			std::thread(&host_resolver::run, this).detach();
+		}
+
+		/* copies the cached name of the address into p_buffer, the numeric
+		 * address if there is none (yet) */
+		void lookup(char *p_buffer, size_t buffer_size, const struct in6_addr *addr)
+		{
+			time_t now = std::time(NULL);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				entry &e = cache[*addr];
+
+				if (!e.pending && e.expires <= now) {
+					/* keep showing the stale name while it is refreshed */
+					e.pending = true;
+					queue.push_back(*addr);
+					cv.notify_one();
+				}
+				if (!e.name.empty()) {
+					std::snprintf(p_buffer, buffer_size, "%s", e.name.c_str());
+					return;
+				}
+				if (cache.size() > PRUNE_SIZE)
+					prune(now);
+			}
+
+			print_host(p_buffer, buffer_size, addr, 0);
+		}
+	};
+
+	host_resolver &resolver()
+	{
+		/* never destroyed, the thread may still be using it at exit */
+		static host_resolver *r = new host_resolver;
+		return *r;
+	}
+
+	/* converts the address to its host name, using the background resolver */
+	void resolve_host(char *p_buffer, size_t buffer_size, const struct in6_addr *addr)
+	{
+		resolver().lookup(p_buffer, buffer_size, addr);
 	}
 
 	/* converts the textual representation of an IPv4 or IPv6 address to struct in6_addr */
@@ -364,6 +536,166 @@ namespace {
 
 		std::fclose(fp);
 	}
+
+#ifdef __linux__
+	/* TCP_ESTABLISHED from the kernel's tcp_states.h */
+	const int diag_established = 1;
+
+	/* Builds an inet_diag filter accepting sockets whose local port falls in
+	 * any monitored range.  Each range is a S_GE/S_LE pair whose failure
+	 * falls through to the next range; a match jumps past the remaining ones
+	 * to the end of the program, which the kernel takes as "accept". */
+	std::vector<char> port_range_bytecode(const tcp_port_monitor_collection_t *p_collection)
+	{
+		const size_t range_len = 4 * sizeof(struct inet_diag_bc_op);
+		const size_t jmp_len = sizeof(struct inet_diag_bc_op);
+		size_t n = p_collection->hash.size();
+		size_t total = n * (range_len + jmp_len) - jmp_len;
+		std::vector<char> code(total);
+		struct inet_diag_bc_op *op = reinterpret_cast<struct inet_diag_bc_op *>(&code[0]);
+		size_t pos = 0;
+
+		for (monitor_hash_t::const_iterator i = p_collection->hash.begin();
+				i != p_collection->hash.end(); ++i) {
+			/* on failure both comparisons land on the next range or, for the
+			 * last one, just past the end which rejects the socket */
+			op[0].code = INET_DIAG_BC_S_GE;
+			op[0].yes = 2 * sizeof(*op);
+			op[0].no = range_len + jmp_len;
+			op[1].code = INET_DIAG_BC_NOP;
+			op[1].yes = 0;
+			op[1].no = i->first.first;
+			op[2].code = INET_DIAG_BC_S_LE;
+			op[2].yes = 2 * sizeof(*op);
+			op[2].no = range_len + jmp_len - 2 * sizeof(*op);
+			op[3].code = INET_DIAG_BC_NOP;
+			op[3].yes = 0;
+			op[3].no = i->first.second;
+			pos += range_len;
+			op += 4;
+
+			if (pos == total)
+				break;
+			op[0].code = INET_DIAG_BC_JMP;
+			op[0].yes = jmp_len;
+			op[0].no = total - pos;
+			pos += jmp_len;
+			op += 1;
+		}
+
+		return code;
+	}
+
+	/* adds connections of one address family to the collection, querying the
+	 * kernel over NETLINK_SOCK_DIAG.  Returns false if the kernel could not
+	 * answer, in which case the caller falls back to /proc. */
+	bool process_diag(tcp_port_monitor_collection_t *p_collection, int family)
+	{
+		struct {
+			struct nlmsghdr nlh;
+			struct inet_diag_req_v2 req;
+			struct nlattr attr;
+		} msg;
+		std::vector<char> code = port_range_bytecode(p_collection);
+		struct iovec iov[2];
+		struct sockaddr_nl nladdr;
+		struct msghdr mh;
+		char buf[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+		tcp_connection_t conn;
+
+		if (p_collection->diag_fd == -1) {
+			p_collection->diag_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+					NETLINK_SOCK_DIAG);
+			if (p_collection->diag_fd < 0) {
+				p_collection->diag_fd = -2;
+			}
+		}
+		if (p_collection->diag_fd < 0) {
+			return false;
+		}
+
+		std::memset(&msg, 0, sizeof(msg));
+		msg.nlh.nlmsg_len = sizeof(msg) + code.size();
+		msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+		msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		msg.req.sdiag_family = family;
+		msg.req.sdiag_protocol = IPPROTO_TCP;
+		msg.req.idiag_states = 1 << diag_established;
+		msg.attr.nla_type = INET_DIAG_REQ_BYTECODE;
+		msg.attr.nla_len = sizeof(msg.attr) + code.size();
+
+		iov[0].iov_base = &msg;
+		iov[0].iov_len = sizeof(msg);
+		iov[1].iov_base = &code[0];
+		iov[1].iov_len = code.size();
+
+		std::memset(&nladdr, 0, sizeof(nladdr));
+		nladdr.nl_family = AF_NETLINK;
+		std::memset(&mh, 0, sizeof(mh));
+		mh.msg_name = &nladdr;
+		mh.msg_namelen = sizeof(nladdr);
+		mh.msg_iov = iov;
+		mh.msg_iovlen = 2;
+
+		if (sendmsg(p_collection->diag_fd, &mh, 0) < 0) {
+			close(p_collection->diag_fd);
+			p_collection->diag_fd = -2;
+			return false;
+		}
+
+		for (;;) {
+			ssize_t len = recv(p_collection->diag_fd, buf, sizeof(buf), 0);
+			if (len < 0 && errno == EINTR) {
+				continue;
+			}
+			if (len <= 0) {
+				/* we can't tell where the dump stopped, start over next time */
+				close(p_collection->diag_fd);
+				p_collection->diag_fd = -1;
+				return false;
+			}
+
+			for (struct nlmsghdr *h = reinterpret_cast<struct nlmsghdr *>(buf);
+					NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+				if (h->nlmsg_type == NLMSG_DONE) {
+					return true;
+				}
+				if (h->nlmsg_type == NLMSG_ERROR) {
+					/* no inet_diag for this family (or a kernel rejecting our
+					 * filter); don't bother asking again */
+					close(p_collection->diag_fd);
+					p_collection->diag_fd = -2;
+					return false;
+				}
+				if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY) {
+					continue;
+				}
+
+				const struct inet_diag_msg *m =
+					static_cast<const struct inet_diag_msg *>(NLMSG_DATA(h));
+				/* same rule as the /proc parser: skip sockets without an inode */
+				if (m->idiag_inode == 0 || m->idiag_state != diag_established) {
+					continue;
+				}
+
+				if (m->idiag_family == AF_INET) {
+					std::memcpy(conn.local_addr.s6_addr, prefix_4on6, sizeof(prefix_4on6));
+					std::memcpy(&conn.local_addr.s6_addr[12], m->id.idiag_src, 4);
+					std::memcpy(conn.remote_addr.s6_addr, prefix_4on6, sizeof(prefix_4on6));
+					std::memcpy(&conn.remote_addr.s6_addr[12], m->id.idiag_dst, 4);
+				} else {
+					std::memcpy(conn.local_addr.s6_addr, m->id.idiag_src, 16);
+					std::memcpy(conn.remote_addr.s6_addr, m->id.idiag_dst, 16);
+				}
+				conn.local_port = ntohs(m->id.idiag_sport);
+				conn.remote_port = ntohs(m->id.idiag_dport);
+
+				for_each_tcp_port_monitor_in_collection(p_collection,
+					&show_connection_to_tcp_port_monitor, (void *) &conn);
+			}
+		}
+	}
+#endif
 }
 
 /* ----------------------------------------------------------------------
@@ -414,7 +746,7 @@ int peek_tcp_port_monitor(const tcp_port_monitor_t *p_monitor, int item,
 
 		case REMOTEHOST:
 
-			print_host(p_buffer, buffer_size, &p_monitor->p_peek[connection_index]->remote_addr, 1);
+			resolve_host(p_buffer, buffer_size, &p_monitor->p_peek[connection_index]->remote_addr);
 			break;
 
 		case REMOTEPORT:
@@ -436,7 +768,7 @@ int peek_tcp_port_monitor(const tcp_port_monitor_t *p_monitor, int item,
 
 		case LOCALHOST:
 
-			print_host(p_buffer, buffer_size, &p_monitor->p_peek[connection_index]->local_addr, 1);
+			resolve_host(p_buffer, buffer_size, &p_monitor->p_peek[connection_index]->local_addr);
 			break;
 
 		case LOCALPORT:
@@ -484,8 +816,19 @@ void update_tcp_port_monitor_collection(
 		return;
 	}
 
+	if (p_collection->hash.empty()) {
+		return;
+	}
+
+#ifdef __linux__
+	if (!process_diag(p_collection, AF_INET))
+		process_file(p_collection, "/proc/net/tcp");
+	if (!process_diag(p_collection, AF_INET6))
+		process_file(p_collection, "/proc/net/tcp6");
+#else
 	process_file(p_collection, "/proc/net/tcp");
 	process_file(p_collection, "/proc/net/tcp6");
+#endif
 
 	/* age the connections in all port monitors. */
 	for_each_tcp_port_monitor_in_collection(p_collection,
@@ -33,6 +33,11 @@
 #include "diskio.h"
 #include "temphelper.h"
 #include "proc.h"
+#include "samples.h"
+#include "proc_batch.h"
+#ifdef BUILD_BPF
+#include "bpf_top.h"
+#endif /* BUILD_BPF */
 #include <dirent.h>
 #include <ctype.h>
 #include <errno.h>
@@ -40,16 +45,24 @@
 #include <sys/types.h>
 #include <sys/sysinfo.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #ifndef HAVE_CLOCK_GETTIME
 #include <sys/time.h>
+#include <sys/resource.h>
 #endif
 #include <fcntl.h>
 #include <unistd.h>
 // #include <assert.h>
 #include <time.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include "setting.hh"
 #include "top.h"
+#include "update-cb.hh"
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -61,6 +74,17 @@
 #define _LINUX_IF_H
 #endif
 #include <linux/route.h>
+#if defined(BUILD_PROC_CONNECTOR) || defined(BUILD_RTNETLINK) || \
+	(defined(BUILD_WLAN) && defined(BUILD_NL80211))
+#include <linux/netlink.h>
+#endif
+#ifdef BUILD_PROC_CONNECTOR
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#endif /* BUILD_PROC_CONNECTOR */
+#ifdef BUILD_RTNETLINK
+#include <linux/rtnetlink.h>
+#endif /* BUILD_RTNETLINK */
 #include <math.h>
 #include <pthread.h>
 
@@ -85,14 +109,20 @@
 
 #ifdef BUILD_WLAN
 #include <iwlib.h>
+#ifdef BUILD_NL80211
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+#endif /* BUILD_NL80211 */
 #endif
 
 struct sysfs {
-	int fd;
 	int arg;
 	char devtype[256];
 	char type[64];
 	float factor, offset;
+	/* devtype split into the directory of the chip and the file in it */
+	std::string chip;
+	std::string file;
 };
 
 #define SHORTSTAT_TEMPL "%*s %llu %llu %llu"
@@ -121,16 +151,15 @@ int update_uptime(void)
 	} else
 #endif
 	{
-		static int rep = 0;
-		FILE *fp;
+		static proc_file uptime_file("/proc/uptime", true);
+		const char *p;
 
-		if (!(fp = open_file("/proc/uptime", &rep))) {
+		if (!uptime_file.read()) {
 			info.uptime = 0.0;
 			return 0;
 		}
-		if (fscanf(fp, "%lf", &info.uptime) <= 0)
-			info.uptime = 0;
-		fclose(fp);
+		p = uptime_file.data();
+		info.uptime = proc_scan_double(p);
 	}
 	return 0;
 }
@@ -160,45 +189,86 @@ int check_mount(struct text_object *obj)
 	return ret;
 }
 
+/* The lines of /proc/meminfo are told apart by an FNV-1a hash of their key,
+ * the part before the ':'. It is computed at compile time for the keys in
+ * info, whose case labels in update_meminfo() would clash if two of them had
+ * the same hash; a line with the hash of one is then compared only with that
+ * key. */
+static constexpr uint32_t meminfo_hash(const char *key, size_t len, uint32_t h = 2166136261u)
+{
+	return len == 0 ? h : meminfo_hash(key + 1, len - 1, (h ^ (unsigned char) *key) * 16777619u);
+}
+
+#define MEMINFO_KEY(k) meminfo_hash(k, sizeof(k) - 1)
+#define MEMINFO_FIELD(k, field) \
+	case MEMINFO_KEY(k): \
+		val = keylen == sizeof(k) - 1 && memcmp(line, k, keylen) == 0 ? &field : NULL; \
+		break;
+
+/* the keys of $meminfo objects, with their value of the last update */
+struct meminfo_value {
+	std::string key;
+	uint32_t hash;
+	unsigned long long value;
+	bool kb;		/* the value is in kB, not a count */
+	bool seen;		/* the key was there in the last update */
+};
+static std::vector<struct meminfo_value> meminfo_values;
+
 /* these things are also in sysinfo except Buffers:
  * (that's why I'm reading them from proc) */
 
 int update_meminfo(void)
 {
-	FILE *meminfo_fp;
-	static int rep = 0;
-
-	/* unsigned int a; */
-	char buf[256];
+	static proc_file meminfo_file("/proc/meminfo", true);
+	const char *line;
 
 	info.mem = info.memwithbuffers = info.memmax = info.memdirty = info.swap = info.swapfree = info.swapmax =
         info.bufmem = info.buffers = info.cached = info.memfree = info.memeasyfree = 0;
+	for (auto v = meminfo_values.begin(); v != meminfo_values.end(); ++v)
+		v->seen = false;
 
-	if (!(meminfo_fp = open_file("/proc/meminfo", &rep))) {
+	if (!meminfo_file.read()) {
 		return 0;
 	}
 
-	while (!feof(meminfo_fp)) {
-		if (fgets(buf, 255, meminfo_fp) == NULL) {
-			break;
+	line = meminfo_file.data();
+	do {
+		const char *p = line;
+		unsigned long long *val;
+		uint32_t h = 2166136261u;
+		size_t keylen;
+
+		for (; *p && *p != ':' && *p != '\n'; ++p)
+			h = (h ^ (unsigned char) *p) * 16777619u;
+		if (*p != ':')
+			continue;
+		keylen = p - line;
+		++p;
+
+		switch (h) {
+			MEMINFO_FIELD("MemTotal", info.memmax)
+			MEMINFO_FIELD("MemFree", info.memfree)
+			MEMINFO_FIELD("SwapTotal", info.swapmax)
+			MEMINFO_FIELD("SwapFree", info.swapfree)
+			MEMINFO_FIELD("Buffers", info.buffers)
+			MEMINFO_FIELD("Cached", info.cached)
+			MEMINFO_FIELD("Dirty", info.memdirty)
+			default:
+				val = NULL;
 		}
+		if (val)
+			*val = proc_scan_ull(p);
 
-		if (strncmp(buf, "MemTotal:", 9) == 0) {
-			sscanf(buf, "%*s %llu", &info.memmax);
-		} else if (strncmp(buf, "MemFree:", 8) == 0) {
-			sscanf(buf, "%*s %llu", &info.memfree);
-		} else if (strncmp(buf, "SwapTotal:", 10) == 0) {
-			sscanf(buf, "%*s %llu", &info.swapmax);
-		} else if (strncmp(buf, "SwapFree:", 9) == 0) {
-			sscanf(buf, "%*s %llu", &info.swapfree);
-		} else if (strncmp(buf, "Buffers:", 8) == 0) {
-			sscanf(buf, "%*s %llu", &info.buffers);
-		} else if (strncmp(buf, "Cached:", 7) == 0) {
-			sscanf(buf, "%*s %llu", &info.cached);
-		} else if (strncmp(buf, "Dirty:", 6) == 0) {
-			sscanf(buf, "%*s %llu", &info.memdirty);
+		for (auto v = meminfo_values.begin(); v != meminfo_values.end(); ++v) {
+			if (v->hash != h || v->key.compare(0, std::string::npos, line, keylen))
+				continue;
+			v->value = proc_scan_ull(p);
+			v->kb = strncmp(p, " kB", 3) == 0;
+			v->seen = true;
+			break;
 		}
-	}
+	} while (proc_next_line(line));
 
 	info.mem = info.memwithbuffers = info.memmax - info.memfree;
 	info.memeasyfree = info.memfree;
@@ -206,10 +276,59 @@ int update_meminfo(void)
 
 	info.bufmem = info.cached + info.buffers;
 
-	fclose(meminfo_fp);
 	return 0;
 }
 
+#undef MEMINFO_FIELD
+#undef MEMINFO_KEY
+
+void parse_meminfo_arg(struct text_object *obj, const char *arg)
+{
+	std::string key(arg);
+	size_t i;
+
+	/* like the file has it, but the ':' may be left out */
+	key = key.substr(0, key.find_first_of(": \t"));
+	for (i = 0; i < meminfo_values.size(); ++i) {
+		if (meminfo_values[i].key == key)
+			break;
+	}
+	if (i == meminfo_values.size()) {
+		struct meminfo_value v;
+
+		v.key = key;
+		v.hash = meminfo_hash(key.c_str(), key.size());
+		v.value = 0;
+		v.kb = false;
+		v.seen = false;
+		meminfo_values.push_back(v);
+	}
+	obj->data.l = i;
+}
+
+/* a size in kB like the other memory objects, a count as it is */
+void print_meminfo(struct text_object *obj, char *p, int p_max_size)
+{
+	const struct meminfo_value &v = meminfo_values[obj->data.l];
+
+	if (!v.seen)
+		return;
+	if (v.kb)
+		human_readable(v.value * 1024, p, p_max_size);
+	else
+		snprintf(p, p_max_size, "%llu", v.value);
+}
+
+/* in bytes or as a count */
+double meminfo_value(struct text_object *obj)
+{
+	const struct meminfo_value &v = meminfo_values[obj->data.l];
+
+	if (!v.seen)
+		return NAN;
+	return v.kb ? v.value * 1024.0 : v.value;
+}
+
 void print_laptop_mode(struct text_object *obj, char *p, int p_max_size)
 {
 	FILE *fp;
@@ -280,6 +399,12 @@ void update_gateway_info_failure(const char *reason)
 }
 
 
+#ifdef BUILD_RTNETLINK
+/* set when the kernel announced a route change, see rtnl_read_changes() */
+static bool rtnl_routes_stale = true;
+static bool rtnl_update_gateway_info(void);
+#endif /* BUILD_RTNETLINK */
+
 /* Iface Destination Gateway Flags RefCnt Use Metric Mask MTU Window IRTT */
 #define RT_ENTRY_FORMAT "%63s %lx %lx %x %*d %*d %*d %lx %*d %*d %*d\n"
 
@@ -291,6 +416,11 @@ int update_gateway_info(void)
 	unsigned long dest, gate, mask;
 	unsigned int flags;
 
+#ifdef BUILD_RTNETLINK
+	if (procfs_is_real() && rtnl_update_gateway_info())
+		return 0;
+#endif /* BUILD_RTNETLINK */
+
 	free_and_zero(gw_info.iface);
 	free_and_zero(gw_info.ip);
 	gw_info.count = 0;
@@ -330,6 +460,9 @@ void free_gateway_info(struct text_object *obj)
 	free_and_zero(gw_info.iface);
 	free_and_zero(gw_info.ip);
 	memset(&gw_info, 0, sizeof(gw_info));
+#ifdef BUILD_RTNETLINK
+	rtnl_routes_stale = true;
+#endif /* BUILD_RTNETLINK */
 }
 
 int gateway_exists(struct text_object *obj)
@@ -352,403 +485,1374 @@ void print_gateway_ip(struct text_object *obj, char *p, int p_max_size)
 	snprintf(p, p_max_size, "%s", gw_info.ip);
 }
 
-int update_net_stats(void)
+/* add what was transferred since the last read of the interface's counters
+ * to its totals and update the averaged speeds */
+static void net_stat_account(struct net_stat *ns, long long r, long long t,
+		double delta, char first)
 {
-	FILE *net_dev_fp;
-	static int rep = 0;
-	static char first = 1;
-
-	// FIXME: arbitrary size chosen to keep code simple.
-	int i, i2;
-	unsigned int curtmp1, curtmp2;
-	unsigned int k;
-	struct ifconf conf;
-	char buf[256];
-	double delta;
+	long long last_recv, last_trans;
+	double recv_rate = 0, trans_rate = 0;
 
-#ifdef BUILD_WLAN
-	// wireless info variables
-	int skfd, has_bitrate = 0;
-	struct wireless_info *winfo;
-	struct iwreq wrq;
-#endif
+	last_recv = ns->recv;
+	last_trans = ns->trans;
 
-	/* get delta */
-	delta = current_update_time - last_update_time;
-	if (delta <= 0.0001) {
-		return 0;
+	/* if recv or trans is less than last time, an overflow happened */
+	if (r < ns->last_read_recv) {
+		last_recv = 0;
+	} else {
+		ns->recv += (r - ns->last_read_recv);
 	}
+	ns->last_read_recv = r;
 
-	/* open file and ignore first two lines */
-	if (!(net_dev_fp = open_file("/proc/net/dev", &rep))) {
-		clear_net_stats();
-		return 0;
+	if (t < ns->last_read_trans) {
+		last_trans = 0;
+	} else {
+		ns->trans += (t - ns->last_read_trans);
 	}
+	ns->last_read_trans = t;
 
-	if (!fgets(buf, 255, net_dev_fp) ||  /* garbage */
-	    !fgets(buf, 255, net_dev_fp)) {  /* garbage (field names) */
-		fclose(net_dev_fp);
-		return 0;
+	if (!first) {
+		/* calculate speeds */
+		recv_rate = (ns->recv - last_recv) / delta;
+		trans_rate = (ns->trans - last_trans) / delta;
 	}
 
-	/* read each interface */
-	for (i2 = 0; i2 < MAX_NET_INTERFACES; i2++) {
-		struct net_stat *ns;
-		char *s, *p;
-		char temp_addr[18];
-		long long r, t, last_recv, last_trans;
-
-		if (fgets(buf, 255, net_dev_fp) == NULL) {
-			break;
-		}
-		p = buf;
-		while (isspace((int) *p)) {
-			p++;
-		}
-
-		s = p;
-
-		while (*p && *p != ':') {
-			p++;
-		}
-		if (*p == '\0') {
-			continue;
-		}
-		*p = '\0';
-		p++;
-
-		ns = get_net_stat(s, NULL, NULL);
-		ns->up = 1;
-		memset(&(ns->addr.sa_data), 0, 14);
-
-		memset(ns->addrs, 0, 17 * MAX_NET_INTERFACES + 1); /* Up to 17 chars per ip, max MAX_NET_INTERFACES interfaces. Nasty memory usage... */
-
-		last_recv = ns->recv;
-		last_trans = ns->trans;
+	int samples = net_avg_samples.get(*state);
+	average_mode mode = average_mode_setting.get(*state);
+	ns->recv_speed = ns->recv_avg.push(recv_rate, samples, mode);
+	ns->trans_speed = ns->trans_avg.push(trans_rate, samples, mode);
+}
 
-		/* bytes packets errs drop fifo frame compressed multicast|bytes ... */
-		sscanf(p, "%lld  %*d     %*d  %*d  %*d  %*d   %*d        %*d       %lld",
-			&r, &t);
+/* append the address in ns->addr to the interface's list of addresses */
+static void net_stat_add_addr(struct net_stat *ns)
+{
+	char temp_addr[18];
+	size_t len = strlen(ns->addrs);
+
+	sprintf(temp_addr, "%u.%u.%u.%u, ",
+			ns->addr.sa_data[2] & 255,
+			ns->addr.sa_data[3] & 255,
+			ns->addr.sa_data[4] & 255,
+			ns->addr.sa_data[5] & 255);
+	if(NULL == strstr(ns->addrs, temp_addr) && len + 17 < sizeof(ns->addrs))
+		strncpy(ns->addrs + len, temp_addr, 17);
+}
 
-		/* if recv or trans is less than last time, an overflow happened */
-		if (r < ns->last_read_recv) {
-			last_recv = 0;
-		} else {
-			ns->recv += (r - ns->last_read_recv);
-		}
-		ns->last_read_recv = r;
+#if defined(BUILD_WLAN) && defined(BUILD_NL80211)
+/******************************************
+ * Wireless statistics from nl80211       *
+ ******************************************/
 
-		if (t < ns->last_read_trans) {
-			last_trans = 0;
-		} else {
-			ns->trans += (t - ns->last_read_trans);
-		}
-		ns->last_read_trans = t;
+/* The ssid, mode and frequency of all wireless interfaces come from one
+ * NL80211_CMD_GET_INTERFACE dump, which is only repeated after nl80211
+ * announced a change on its "config" or "mlme" groups. Signal, bitrate and
+ * access point come from a station dump of each associated interface per
+ * update. If nl80211 can't be set up, the Wireless Extensions ioctls are
+ * used as before. */
+static int nl80211_fd = -1;		/* requests and their answers */
+static int nl80211_mon_fd = -1;	/* change notifications */
+static int nl80211_family = 0;
+static bool nl80211_failed = false;
+static bool nl80211_stale = true;
+static unsigned int nl80211_seq = 0;
+
+struct nl80211_iface {
+	std::string name;
+	unsigned int ifindex;
+	unsigned int iftype;
+	unsigned int freq;		/* MHz, 0 if not known */
+	bool has_ssid;
+	char ssid[33];
+};
+static std::vector<struct nl80211_iface> nl80211_ifaces;
 
-		/*** ip addr patch ***/
-		i = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+struct nl80211_req {
+	struct nlmsghdr nlh;
+	struct genlmsghdr genl;
+	char attrs[64];
+};
 
-		conf.ifc_buf = (char*)malloc(sizeof(struct ifreq) * MAX_NET_INTERFACES);
-		conf.ifc_len = sizeof(struct ifreq) * MAX_NET_INTERFACES;
-		memset(conf.ifc_buf, 0, conf.ifc_len);
+#define NL80211_ATTR_DATA(nla)	((void *) ((char *) (nla) + NLA_HDRLEN))
+#define NL80211_ATTR_LEN(nla)	((int) (nla)->nla_len - NLA_HDRLEN)
 
-		ioctl((long) i, SIOCGIFCONF, &conf);
+/* tb[type] = the attribute of that type among the len bytes at head */
+static void nl80211_parse(struct nlattr **tb, int max, void *head, int len)
+{
+	memset(tb, 0, (max + 1) * sizeof(*tb));
+	for (struct nlattr *nla = (struct nlattr *) head; len >= (int) sizeof(*nla) &&
+			nla->nla_len >= sizeof(*nla) && nla->nla_len <= len;
+			len -= NLA_ALIGN(nla->nla_len),
+			nla = (struct nlattr *) ((char *) nla + NLA_ALIGN(nla->nla_len))) {
+		int type = nla->nla_type & NLA_TYPE_MASK;
+
+		if (type <= max)
+			tb[type] = nla;
+	}
+}
 
-		for (k = 0; k < conf.ifc_len / sizeof(struct ifreq); k++) {
-			struct net_stat *ns2;
+static void nl80211_parse_msg(struct nlattr **tb, int max, struct nlmsghdr *nlh)
+{
+	nl80211_parse(tb, max, (char *) NLMSG_DATA(nlh) + GENL_HDRLEN,
+			nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
 
-			if (!(((struct ifreq *) conf.ifc_buf) + k))
-				break;
+static void nl80211_init_req(struct nl80211_req *req, int family, int cmd, int flags)
+{
+	memset(req, 0, sizeof(*req));
+	req->nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	req->nlh.nlmsg_type = family;
+	req->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+	req->genl.cmd = cmd;
+	req->genl.version = 1;
+}
 
-			ns2 = get_net_stat(
-					((struct ifreq *) conf.ifc_buf)[k].ifr_ifrn.ifrn_name, NULL, NULL);
-			ns2->addr = ((struct ifreq *) conf.ifc_buf)[k].ifr_ifru.ifru_addr;
-			sprintf(temp_addr, "%u.%u.%u.%u, ",
-					ns2->addr.sa_data[2] & 255,
-					ns2->addr.sa_data[3] & 255,
-					ns2->addr.sa_data[4] & 255,
-					ns2->addr.sa_data[5] & 255);
-			if(NULL == strstr(ns2->addrs, temp_addr))
-				strncpy(ns2->addrs + strlen(ns2->addrs), temp_addr, 17);
-		}
+static void nl80211_put(struct nl80211_req *req, int type, const void *data, int len)
+{
+	struct nlattr *nla = (struct nlattr *) ((char *) req + NLMSG_ALIGN(req->nlh.nlmsg_len));
 
-		close((long) i);
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy(NL80211_ATTR_DATA(nla), data, len);
+	req->nlh.nlmsg_len = NLMSG_ALIGN(req->nlh.nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
 
-		free(conf.ifc_buf);
+static void nl80211_close(const char *what)
+{
+	NORM_ERR("nl80211: %s failed: %s, using Wireless Extensions instead", what,
+			strerror(errno));
+	if (nl80211_fd >= 0)
+		close(nl80211_fd);
+	if (nl80211_mon_fd >= 0)
+		close(nl80211_mon_fd);
+	nl80211_fd = nl80211_mon_fd = -1;
+	nl80211_failed = true;
+}
 
-		/*** end ip addr patch ***/
+/* send req and hand every answer to handle(), returns false if it failed;
+ * the errno of an error answer is kept, it's up to the caller what it means */
+static bool nl80211_talk(struct nl80211_req *req,
+		void (*handle)(struct nlmsghdr *, void *), void *data)
+{
+	static union {
+		struct nlmsghdr nlh;
+		char buf[32768];
+	} msg;
+	bool dump = req->nlh.nlmsg_flags & NLM_F_DUMP;
+	int len;
+
+	req->nlh.nlmsg_seq = ++nl80211_seq;
+	if (send(nl80211_fd, req, req->nlh.nlmsg_len, 0) < 0) {
+		nl80211_close("send()");
+		return false;
+	}
 
-		if (!first) {
-			/* calculate speeds */
-			ns->net_rec[0] = (ns->recv - last_recv) / delta;
-			ns->net_trans[0] = (ns->trans - last_trans) / delta;
+	while (true) {
+		len = recv(nl80211_fd, msg.buf, sizeof(msg.buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			nl80211_close("recv()");
+			return false;
 		}
 
-		curtmp1 = 0;
-		curtmp2 = 0;
-		// get an average
-		int samples = net_avg_samples.get(*state);
-#ifdef HAVE_OPENMP
-#pragma omp parallel for reduction(+:curtmp1, curtmp2) schedule(dynamic,10)
-#endif /* HAVE_OPENMP */
-		for (i = 0; i < samples; i++) {
-			curtmp1 = curtmp1 + ns->net_rec[i];
-			curtmp2 = curtmp2 + ns->net_trans[i];
-		}
-		ns->recv_speed = curtmp1 / (double) samples;
-		ns->trans_speed = curtmp2 / (double) samples;
-		if (samples > 1) {
-#ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(dynamic,10)
-#endif /* HAVE_OPENMP */
-			for (i = samples; i > 1; i--) {
-				ns->net_rec[i - 1] = ns->net_rec[i - 2];
-				ns->net_trans[i - 1] = ns->net_trans[i - 2];
+		for (struct nlmsghdr *nlh = &msg.nlh; NLMSG_OK(nlh, len);
+				nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != nl80211_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return true;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				errno = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+				return errno == 0;
 			}
+			handle(nlh, data);
+			if (!dump)
+				return true;
 		}
+	}
+}
 
-#ifdef BUILD_WLAN
-		/* update wireless info */
-		winfo = (struct wireless_info *) malloc(sizeof(struct wireless_info));
-		memset(winfo, 0, sizeof(struct wireless_info));
-
-		skfd = iw_sockets_open();
-		if (iw_get_basic_config(skfd, s, &(winfo->b)) > -1) {
-
-			// set present winfo variables
-			if (iw_get_range_info(skfd, s, &(winfo->range)) >= 0) {
-				winfo->has_range = 1;
-			}
-			if (iw_get_stats(skfd, s, &(winfo->stats),
-					&winfo->range, winfo->has_range) >= 0) {
-				winfo->has_stats = 1;
-			}
-			if (iw_get_ext(skfd, s, SIOCGIWAP, &wrq) >= 0) {
-				winfo->has_ap_addr = 1;
-				memcpy(&(winfo->ap_addr), &(wrq.u.ap_addr), sizeof(sockaddr));
-			}
+/* the id of nl80211, and joining the notification groups that matter */
+static void nl80211_handle_family(struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *tb[CTRL_ATTR_MAX + 1];
 
-			// get bitrate
-			if (iw_get_ext(skfd, s, SIOCGIWRATE, &wrq) >= 0) {
-				memcpy(&(winfo->bitrate), &(wrq.u.bitrate), sizeof(iwparam));
-				iw_print_bitrate(ns->bitrate, 16, winfo->bitrate.value);
-				has_bitrate = 1;
-			}
+	(void)data;
 
-			// get link quality
-			if (winfo->has_range && winfo->has_stats
-					&& ((winfo->stats.qual.level != 0)
-					|| (winfo->stats.qual.updated & IW_QUAL_DBM))) {
-				if (!(winfo->stats.qual.updated & IW_QUAL_QUAL_INVALID)) {
-					ns->link_qual = winfo->stats.qual.qual;
-					ns->link_qual_max = winfo->range.max_qual.qual;
-				}
-			}
+	nl80211_parse_msg(tb, CTRL_ATTR_MAX, nlh);
+	if (tb[CTRL_ATTR_FAMILY_ID])
+		nl80211_family = *(uint16_t *) NL80211_ATTR_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+	if (!tb[CTRL_ATTR_MCAST_GROUPS])
+		return;
 
-			// get ap mac
-			if (winfo->has_ap_addr) {
-				iw_sawap_ntop(&winfo->ap_addr, ns->ap);
-			}
+	struct nlattr *grp = (struct nlattr *) NL80211_ATTR_DATA(tb[CTRL_ATTR_MCAST_GROUPS]);
+	int len = NL80211_ATTR_LEN(tb[CTRL_ATTR_MCAST_GROUPS]);
 
-			// get essid
-			if (winfo->b.has_essid) {
-				if (winfo->b.essid_on) {
-					snprintf(ns->essid, 32, "%s", winfo->b.essid);
-				} else {
-					snprintf(ns->essid, 32, "off/any");
-				}
-			}
-			// get channel and freq
-			if (winfo->b.has_freq) {
-				if(winfo->has_range == 1) {
-					ns->channel = iw_freq_to_channel(winfo->b.freq, &(winfo->range));
-					iw_print_freq_value(ns->freq, 16, winfo->b.freq);
-				} else {
-					ns->channel = 0;
-					ns->freq[0] = 0;
-				}
-			}
+	for (; len >= (int) sizeof(*grp) && grp->nla_len >= sizeof(*grp) && grp->nla_len <= len;
+			len -= NLA_ALIGN(grp->nla_len),
+			grp = (struct nlattr *) ((char *) grp + NLA_ALIGN(grp->nla_len))) {
+		struct nlattr *g[CTRL_ATTR_MCAST_GRP_MAX + 1];
+		const char *name;
 
-			snprintf(ns->mode, 16, "%s", iw_operation_mode[winfo->b.mode]);
-		}
-		iw_sockets_close(skfd);
-		free(winfo);
-#endif
-	}
+		nl80211_parse(g, CTRL_ATTR_MCAST_GRP_MAX, NL80211_ATTR_DATA(grp), NL80211_ATTR_LEN(grp));
+		if (!g[CTRL_ATTR_MCAST_GRP_NAME] || !g[CTRL_ATTR_MCAST_GRP_ID])
+			continue;
+		name = (const char *) NL80211_ATTR_DATA(g[CTRL_ATTR_MCAST_GRP_NAME]);
+		if (strcmp(name, NL80211_MULTICAST_GROUP_CONFIG) &&
+				strcmp(name, NL80211_MULTICAST_GROUP_MLME))
+			continue;
 
-#ifdef BUILD_IPV6
-	FILE *file;
-	char v6addr[32];
-	char devname[21];
-	unsigned int netmask, scope;
-	struct net_stat *ns;
-	struct v6addr *lastv6;
-	//remove the old v6 addresses otherwise they are listed multiple times
-	for (unsigned int i = 0; i < MAX_NET_INTERFACES; i++) {
-		ns = &netstats[i];
-		while(ns->v6addrs != NULL) {
-			lastv6 = ns->v6addrs;
-			ns->v6addrs = ns->v6addrs->next;
-			free(lastv6);
-		}
+		uint32_t id = *(uint32_t *) NL80211_ATTR_DATA(g[CTRL_ATTR_MCAST_GRP_ID]);
+		if (setsockopt(nl80211_mon_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &id,
+					sizeof(id)) < 0)
+			NORM_ERR("nl80211: can't join the %s group: %s", name, strerror(errno));
 	}
-	if ((file = fopen(PROCDIR"/net/if_inet6", "r")) != NULL) {
-		while (fscanf(file, "%32s %*02x %02x %02x %*02x %20s\n", v6addr, &netmask, &scope, devname) != EOF) {
-			ns = get_net_stat(devname, NULL, NULL);
-			if(ns->v6addrs == NULL) {
-				lastv6 = (struct v6addr *) malloc(sizeof(struct v6addr));
-				ns->v6addrs = lastv6;
-			} else {
-				lastv6 = ns->v6addrs;
-				while(lastv6->next) lastv6 = lastv6->next;
-				lastv6->next = (struct v6addr *) malloc(sizeof(struct v6addr));
-				lastv6 = lastv6->next;
-			}
-			for(int i=0; i<16; i++)
-				sscanf(v6addr+2*i, "%2hhx", &(lastv6->addr.s6_addr[i]));
-			lastv6->netmask = netmask;
-			switch(scope) {
-			case 0:	//global
-				lastv6->scope = 'G';
-				break;
-			case 16:	//host-local
-				lastv6->scope = 'H';
-				break;
-			case 32:	//link-local
-				lastv6->scope = 'L';
-				break;
-			case 64:	//site-local
-				lastv6->scope = 'S';
-				break;
-			case 128:	//compat
-				lastv6->scope = 'C';
-				break;
-			default:
-				lastv6->scope = '?';
-			}
-			lastv6->next = NULL;
-		}
-	}
-	fclose(file);
-#endif /* BUILD_IPV6 */
-
-	first = 0;
-
-	fclose(net_dev_fp);
-	return 0;
 }
 
-int result;
-
-int update_total_processes(void)
+static void nl80211_open(void)
 {
-	DIR *dir;
-	struct dirent *entry;
-	int ignore1;
-	char ignore2;
+	struct nl80211_req req;
 
-	info.procs = 0;
-	if (!(dir = opendir("/proc"))) {
-		return 0;
+	nl80211_fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (nl80211_fd < 0) {
+		nl80211_close("socket()");
+		return;
 	}
-	while ((entry = readdir(dir))) {
-		if (!entry) {
-			/* Problem reading list of processes */
-			closedir(dir);
-			info.procs = 0;
-			return 0;
-		}
-		if (sscanf(entry->d_name, "%d%c", &ignore1, &ignore2) == 1) {
-			info.procs++;
-		}
+	nl80211_mon_fd = socket(PF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_GENERIC);
+	if (nl80211_mon_fd < 0) {
+		nl80211_close("socket()");
+		return;
 	}
-	closedir(dir);
-	return 0;
+
+	nl80211_init_req(&req, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0);
+	nl80211_put(&req, CTRL_ATTR_FAMILY_NAME, NL80211_GENL_NAME, sizeof(NL80211_GENL_NAME));
+	if (!nl80211_talk(&req, &nl80211_handle_family, NULL) || !nl80211_family) {
+		/* no cfg80211 in this kernel */
+		if (!nl80211_failed)
+			nl80211_close("looking up " NL80211_GENL_NAME);
+		return;
+	}
+	nl80211_stale = true;
 }
 
-int update_threads(void)
+static void nl80211_handle_iface(struct nlmsghdr *nlh, void *data)
 {
-#ifdef HAVE_SYSINFO
-	if (!prefer_proc) {
-		struct sysinfo s_info;
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nl80211_iface iface;
 
-		sysinfo(&s_info);
-		info.threads = s_info.procs;
-	} else
-#endif
-	{
-		static int rep = 0;
-		FILE *fp;
+	(void)data;
 
-		if (!(fp = open_file("/proc/loadavg", &rep))) {
-			info.threads = 0;
-			return 0;
-		}
-		if (fscanf(fp, "%*f %*f %*f %*d/%hu", &info.threads) <= 0)
-			info.threads = 0;
-		fclose(fp);
+	nl80211_parse_msg(tb, NL80211_ATTR_MAX, nlh);
+	if (!tb[NL80211_ATTR_IFINDEX] || !tb[NL80211_ATTR_IFNAME])
+		return;
+
+	iface.name = (const char *) NL80211_ATTR_DATA(tb[NL80211_ATTR_IFNAME]);
+	iface.ifindex = *(uint32_t *) NL80211_ATTR_DATA(tb[NL80211_ATTR_IFINDEX]);
+	iface.iftype = tb[NL80211_ATTR_IFTYPE] ?
+		*(uint32_t *) NL80211_ATTR_DATA(tb[NL80211_ATTR_IFTYPE]) : (uint32_t) NL80211_IFTYPE_UNSPECIFIED;
+	iface.freq = tb[NL80211_ATTR_WIPHY_FREQ] ?
+		*(uint32_t *) NL80211_ATTR_DATA(tb[NL80211_ATTR_WIPHY_FREQ]) : 0;
+	iface.has_ssid = tb[NL80211_ATTR_SSID] != NULL;
+	if (iface.has_ssid) {
+		int len = std::min(NL80211_ATTR_LEN(tb[NL80211_ATTR_SSID]), 32);
+
+		memcpy(iface.ssid, NL80211_ATTR_DATA(tb[NL80211_ATTR_SSID]), len);
+		iface.ssid[len] = 0;
 	}
-	return 0;
+	nl80211_ifaces.push_back(iface);
 }
 
-#define CPU_SAMPLE_COUNT 15
-struct cpu_info {
-	unsigned long long cpu_user;
-	unsigned long long cpu_system;
-	unsigned long long cpu_nice;
-	unsigned long long cpu_idle;
-	unsigned long long cpu_iowait;
-	unsigned long long cpu_irq;
-	unsigned long long cpu_softirq;
-	unsigned long long cpu_steal;
-	unsigned long long cpu_total;
-	unsigned long long cpu_active_total;
-	unsigned long long cpu_last_total;
-	unsigned long long cpu_last_active_total;
-	double cpu_val[CPU_SAMPLE_COUNT];
+struct nl80211_station {
+	bool found;
+	unsigned char mac[6];
+	int signal;				/* dBm */
+	bool has_signal;
+	unsigned int bitrate;	/* 100 kbit/s, 0 if not known */
 };
-static short cpu_setup = 0;
 
-/* Determine if this kernel gives us "extended" statistics information in
- * /proc/stat.
- * Kernels around 2.5 and earlier only reported user, system, nice, and
- * idle values in proc stat.
- * Kernels around 2.6 and greater report these PLUS iowait, irq, softirq,
- * and steal */
-void determine_longstat(char *buf)
+/* the access point of a managed interface is its only station */
+static void nl80211_handle_station(struct nlmsghdr *nlh, void *data)
 {
-	unsigned long long iowait = 0;
+	struct nl80211_station *sta = (struct nl80211_station *) data;
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *sinfo[NL80211_STA_INFO_MAX + 1];
+	struct nlattr *rinfo[NL80211_RATE_INFO_MAX + 1];
 
-	KFLAG_SETOFF(KFLAG_IS_LONGSTAT);
-	/* scanf will either return -1 or 1 because there is only 1 assignment */
-	if (sscanf(buf, "%*s %*d %*d %*d %*d %llu", &iowait) > 0) {
-		KFLAG_SETON(KFLAG_IS_LONGSTAT);
+	nl80211_parse_msg(tb, NL80211_ATTR_MAX, nlh);
+	if (sta->found || !tb[NL80211_ATTR_MAC] || !tb[NL80211_ATTR_STA_INFO])
+		return;
+	sta->found = true;
+	memcpy(sta->mac, NL80211_ATTR_DATA(tb[NL80211_ATTR_MAC]), 6);
+
+	nl80211_parse(sinfo, NL80211_STA_INFO_MAX, NL80211_ATTR_DATA(tb[NL80211_ATTR_STA_INFO]),
+			NL80211_ATTR_LEN(tb[NL80211_ATTR_STA_INFO]));
+	if (sinfo[NL80211_STA_INFO_SIGNAL]) {
+		sta->signal = *(int8_t *) NL80211_ATTR_DATA(sinfo[NL80211_STA_INFO_SIGNAL]);
+		sta->has_signal = true;
+	}
+	if (sinfo[NL80211_STA_INFO_TX_BITRATE]) {
+		nl80211_parse(rinfo, NL80211_RATE_INFO_MAX,
+				NL80211_ATTR_DATA(sinfo[NL80211_STA_INFO_TX_BITRATE]),
+				NL80211_ATTR_LEN(sinfo[NL80211_STA_INFO_TX_BITRATE]));
+		if (rinfo[NL80211_RATE_INFO_BITRATE32])
+			sta->bitrate = *(uint32_t *) NL80211_ATTR_DATA(rinfo[NL80211_RATE_INFO_BITRATE32]);
+		else if (rinfo[NL80211_RATE_INFO_BITRATE])
+			sta->bitrate = *(uint16_t *) NL80211_ATTR_DATA(rinfo[NL80211_RATE_INFO_BITRATE]);
 	}
 }
 
-void determine_longstat_file(void) {
-#define MAX_PROCSTAT_LINELEN 255
-	FILE *stat_fp;
-	static int rep = 0;
-	char buf[MAX_PROCSTAT_LINELEN + 1];
-
-	if ( not (stat_fp = open_file("/proc/stat", &rep))) return;
-	while ( not feof(stat_fp)) {
-		if (fgets(buf, MAX_PROCSTAT_LINELEN, stat_fp) == NULL) break;
-		if (strncmp(buf, "cpu", 3) == 0) {
-			determine_longstat(buf);
+/* drain the notifications, anything that arrives may have changed an interface */
+static void nl80211_read_changes(void)
+{
+	char buf[8192];
+	int len;
+
+	while (nl80211_mon_fd >= 0) {
+		len = recv(nl80211_mon_fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				nl80211_stale = true;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				nl80211_close("recv()");
 			break;
 		}
+		nl80211_stale = true;
 	}
-	fclose(stat_fp);
 }
 
-void get_cpu_count(void)
+/* the channel of a frequency in MHz, as cfg80211 numbers them */
+static int nl80211_channel(unsigned int freq)
 {
-	FILE *stat_fp;
-	static int rep = 0;
-	char buf[256];
-
+	if (freq == 2484)
+		return 14;
+	if (freq < 2484)
+		return (freq - 2407) / 5;
+	if (freq >= 4910 && freq <= 4980)
+		return (freq - 4000) / 5;
+	if (freq >= 5955 && freq <= 7115)
+		return (freq - 5950) / 5;
+	if (freq <= 45000)
+		return (freq - 5000) / 5;
+	if (freq >= 58320 && freq <= 70200)
+		return (freq - 56160) / 2160;
+	return 0;
+}
+
+static const char *nl80211_mode(unsigned int iftype)
+{
+	/* the names iwlib gives the modes cfg80211 maps these to */
+	switch (iftype) {
+		case NL80211_IFTYPE_ADHOC: return "Ad-Hoc";
+		case NL80211_IFTYPE_STATION:
+		case NL80211_IFTYPE_P2P_CLIENT: return "Managed";
+		case NL80211_IFTYPE_AP:
+		case NL80211_IFTYPE_P2P_GO: return "Master";
+		case NL80211_IFTYPE_WDS: return "Repeater";
+		case NL80211_IFTYPE_MONITOR: return "Monitor";
+		default: return "Auto";
+	}
+}
+
+/* returns false if the Wireless Extensions have to be asked instead */
+static bool nl80211_update_wireless(struct net_stat *ns)
+{
+	static double last_update = -1;
+	struct nl80211_req req;
+	struct nl80211_station sta;
+	const struct nl80211_iface *iface = NULL;
+
+	if (nl80211_failed)
+		return false;
+
+	/* the interfaces are looked at once per update, not per net_stat */
+	if (last_update != current_update_time) {
+		if (nl80211_fd < 0)
+			nl80211_open();
+		nl80211_read_changes();
+		if (nl80211_failed)
+			return false;
+		if (nl80211_stale) {
+			nl80211_ifaces.clear();
+			nl80211_init_req(&req, nl80211_family, NL80211_CMD_GET_INTERFACE, NLM_F_DUMP);
+			if (!nl80211_talk(&req, &nl80211_handle_iface, NULL)) {
+				if (!nl80211_failed)
+					nl80211_close("NL80211_CMD_GET_INTERFACE");
+				return false;
+			}
+			nl80211_stale = false;
+		}
+		last_update = current_update_time;
+	}
+
+	for (unsigned int i = 0; i < nl80211_ifaces.size(); i++) {
+		if (nl80211_ifaces[i].name == ns->dev) {
+			iface = &nl80211_ifaces[i];
+			break;
+		}
+	}
+	/* not a wireless interface */
+	if (!iface)
+		return true;
+
+	if (iface->has_ssid)
+		snprintf(ns->essid, 32, "%s", iface->ssid);
+	else
+		snprintf(ns->essid, 32, "off/any");
+	snprintf(ns->mode, 16, "%s", nl80211_mode(iface->iftype));
+	if (iface->freq) {
+		ns->channel = nl80211_channel(iface->freq);
+		snprintf(ns->freq, 16, "%g GHz", iface->freq / 1000.0);
+	} else {
+		ns->channel = 0;
+		ns->freq[0] = 0;
+	}
+
+	memset(&sta, 0, sizeof(sta));
+	if (iface->iftype == NL80211_IFTYPE_STATION || iface->iftype == NL80211_IFTYPE_P2P_CLIENT) {
+		uint32_t ifindex = iface->ifindex;
+
+		nl80211_init_req(&req, nl80211_family, NL80211_CMD_GET_STATION, NLM_F_DUMP);
+		nl80211_put(&req, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+		/* an interface that just went away fails, the next update sees it gone */
+		if (!nl80211_talk(&req, &nl80211_handle_station, &sta))
+			nl80211_stale = true;
+		if (nl80211_failed)
+			return false;
+	}
+
+	if (sta.found) {
+		snprintf(ns->ap, 18, "%02X:%02X:%02X:%02X:%02X:%02X", sta.mac[0], sta.mac[1],
+				sta.mac[2], sta.mac[3], sta.mac[4], sta.mac[5]);
+	} else {
+		snprintf(ns->ap, 18, "Not-Associated");
+	}
+	if (sta.bitrate) {
+		/* as iw_print_bitrate() does it */
+		if (sta.bitrate >= 10000)
+			snprintf(ns->bitrate, 16, "%g Gb/s", sta.bitrate / 10000.0);
+		else
+			snprintf(ns->bitrate, 16, "%g Mb/s", sta.bitrate / 10.0);
+	} else {
+		ns->bitrate[0] = 0;
+	}
+	if (sta.has_signal) {
+		/* the quality cfg80211 reports to the Wireless Extensions */
+		ns->link_qual = std::min(std::max(sta.signal, -110), -40) + 110;
+		ns->link_qual_max = 70;
+	} else {
+		ns->link_qual = 0;
+	}
+	return true;
+}
+#endif /* BUILD_WLAN && BUILD_NL80211 */
+
+#ifdef BUILD_WLAN
+static void net_stat_update_wireless(struct net_stat *ns)
+{
+	// wireless info variables
+	int skfd, has_bitrate = 0;
+	struct wireless_info *winfo;
+	struct iwreq wrq;
+	char *s = ns->dev;
+
+#ifdef BUILD_NL80211
+	if (nl80211_update_wireless(ns))
+		return;
+#endif /* BUILD_NL80211 */
+
+	/* update wireless info */
+	winfo = (struct wireless_info *) malloc(sizeof(struct wireless_info));
+	memset(winfo, 0, sizeof(struct wireless_info));
+
+	skfd = iw_sockets_open();
+	if (iw_get_basic_config(skfd, s, &(winfo->b)) > -1) {
+
+		// set present winfo variables
+		if (iw_get_range_info(skfd, s, &(winfo->range)) >= 0) {
+			winfo->has_range = 1;
+		}
+		if (iw_get_stats(skfd, s, &(winfo->stats),
+				&winfo->range, winfo->has_range) >= 0) {
+			winfo->has_stats = 1;
+		}
+		if (iw_get_ext(skfd, s, SIOCGIWAP, &wrq) >= 0) {
+			winfo->has_ap_addr = 1;
+			memcpy(&(winfo->ap_addr), &(wrq.u.ap_addr), sizeof(sockaddr));
+		}
+
+		// get bitrate
+		if (iw_get_ext(skfd, s, SIOCGIWRATE, &wrq) >= 0) {
+			memcpy(&(winfo->bitrate), &(wrq.u.bitrate), sizeof(iwparam));
+			iw_print_bitrate(ns->bitrate, 16, winfo->bitrate.value);
+			has_bitrate = 1;
+		}
+
+		// get link quality
+		if (winfo->has_range && winfo->has_stats
+				&& ((winfo->stats.qual.level != 0)
+				|| (winfo->stats.qual.updated & IW_QUAL_DBM))) {
+			if (!(winfo->stats.qual.updated & IW_QUAL_QUAL_INVALID)) {
+				ns->link_qual = winfo->stats.qual.qual;
+				ns->link_qual_max = winfo->range.max_qual.qual;
+			}
+		}
+
+		// get ap mac
+		if (winfo->has_ap_addr) {
+			iw_sawap_ntop(&winfo->ap_addr, ns->ap);
+		}
+
+		// get essid
+		if (winfo->b.has_essid) {
+			if (winfo->b.essid_on) {
+				snprintf(ns->essid, 32, "%s", winfo->b.essid);
+			} else {
+				snprintf(ns->essid, 32, "off/any");
+			}
+		}
+		// get channel and freq
+		if (winfo->b.has_freq) {
+			if(winfo->has_range == 1) {
+				ns->channel = iw_freq_to_channel(winfo->b.freq, &(winfo->range));
+				iw_print_freq_value(ns->freq, 16, winfo->b.freq);
+			} else {
+				ns->channel = 0;
+				ns->freq[0] = 0;
+			}
+		}
+
+		snprintf(ns->mode, 16, "%s", iw_operation_mode[winfo->b.mode]);
+	}
+	iw_sockets_close(skfd);
+	free(winfo);
+}
+#endif /* BUILD_WLAN */
+
+/* read the IPv4 addresses of all interfaces with one SIOCGIFCONF */
+static void update_net_addrs(void)
+{
+	struct ifconf conf;
+	unsigned int k;
+	int fd;
+
+	for (unsigned int i = 0; i < netstats.size(); i++) {
+		memset(&(netstats[i]->addr.sa_data), 0, 14);
+		memset(netstats[i]->addrs, 0, sizeof(netstats[i]->addrs));
+	}
+
+	if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP)) < 0)
+		return;
+
+	/* a full buffer might mean there are more addresses than fit */
+	conf.ifc_buf = NULL;
+	for (k = MAX_NET_INTERFACES; ; k *= 2) {
+		conf.ifc_buf = (char*)realloc(conf.ifc_buf, sizeof(struct ifreq) * k);
+		conf.ifc_len = sizeof(struct ifreq) * k;
+		memset(conf.ifc_buf, 0, conf.ifc_len);
+
+		if (ioctl(fd, SIOCGIFCONF, &conf) < 0) {
+			conf.ifc_len = 0;
+			break;
+		}
+		if ((unsigned int) conf.ifc_len < sizeof(struct ifreq) * k)
+			break;
+	}
+
+	for (k = 0; k < conf.ifc_len / sizeof(struct ifreq); k++) {
+		struct net_stat *ns;
+
+		ns = get_net_stat(
+				((struct ifreq *) conf.ifc_buf)[k].ifr_ifrn.ifrn_name, NULL, NULL);
+		ns->addr = ((struct ifreq *) conf.ifc_buf)[k].ifr_ifru.ifru_addr;
+		net_stat_add_addr(ns);
+	}
+
+	close(fd);
+
+	free(conf.ifc_buf);
+}
+
+#ifdef BUILD_IPV6
+static void free_net_v6addrs(void)
+{
+	struct net_stat *ns;
+	struct v6addr *lastv6;
+
+	v6addrs_generation++;
+	for (unsigned int i = 0; i < netstats.size(); i++) {
+		ns = netstats[i];
+		while(ns->v6addrs != NULL) {
+			lastv6 = ns->v6addrs;
+			ns->v6addrs = ns->v6addrs->next;
+			free(lastv6);
+		}
+	}
+}
+
+/* append an address to the end of the interface's list */
+static struct v6addr *net_stat_add_v6addr(struct net_stat *ns)
+{
+	struct v6addr *lastv6;
+
+	if(ns->v6addrs == NULL) {
+		lastv6 = (struct v6addr *) malloc(sizeof(struct v6addr));
+		ns->v6addrs = lastv6;
+	} else {
+		lastv6 = ns->v6addrs;
+		while(lastv6->next) lastv6 = lastv6->next;
+		lastv6->next = (struct v6addr *) malloc(sizeof(struct v6addr));
+		lastv6 = lastv6->next;
+	}
+	lastv6->next = NULL;
+	return lastv6;
+}
+
+/* the lists are only made anew when the file changed */
+static void update_net_v6addrs(void)
+{
+	static proc_file if_inet6_file(PROCDIR "/net/if_inet6");
+	static std::string last;
+	static unsigned int built_generation;
+	const char *line;
+	char v6addr[33];
+	char devname[21];
+	unsigned int netmask, scope;
+	struct v6addr *lastv6;
+
+	if (!if_inet6_file.read()) {
+		if (!last.empty())
+			free_net_v6addrs();
+		last.clear();
+		return;
+	}
+	/* the generation differs after clear_net_stats() or rtnetlink dumps */
+	if (last == if_inet6_file.data() && built_generation == v6addrs_generation)
+		return;
+	last = if_inet6_file.data();
+
+	//remove the old v6 addresses otherwise they are listed multiple times
+	free_net_v6addrs();
+	built_generation = v6addrs_generation;
+	line = if_inet6_file.data();
+	do {
+		if (sscanf(line, "%32s %*02x %02x %02x %*02x %20s", v6addr, &netmask, &scope, devname) != 4)
+			continue;
+		lastv6 = net_stat_add_v6addr(get_net_stat(devname, NULL, NULL));
+		for(int i=0; i<16; i++)
+			sscanf(v6addr+2*i, "%2hhx", &(lastv6->addr.s6_addr[i]));
+		lastv6->netmask = netmask;
+		switch(scope) {
+		case 0:	//global
+			lastv6->scope = 'G';
+			break;
+		case 16:	//host-local
+			lastv6->scope = 'H';
+			break;
+		case 32:	//link-local
+			lastv6->scope = 'L';
+			break;
+		case 64:	//site-local
+			lastv6->scope = 'S';
+			break;
+		case 128:	//compat
+			lastv6->scope = 'C';
+			break;
+		default:
+			lastv6->scope = '?';
+		}
+	} while (proc_next_line(line));
+}
+#endif /* BUILD_IPV6 */
+
+#ifdef BUILD_RTNETLINK
+/******************************************
+ * Network statistics from rtnetlink      *
+ ******************************************/
+
+/* The counters of all interfaces arrive in one binary RTM_GETLINK dump per
+ * update. Addresses are only dumped again after the kernel announced that
+ * a link or an address changed, in between the last dump is kept in
+ * net_stat.nl_addr. Likewise the default routes are only dumped after a
+ * route changed, gw_info keeps them in between. If the sockets can't be set
+ * up, /proc/net/dev, /proc/net/route and ioctl()s are used on every update
+ * as usual. */
+static int rtnl_fd = -1;		/* dump requests and their answers */
+static int rtnl_mon_fd = -1;	/* change notifications */
+static bool rtnl_failed = false;
+static bool rtnl_addrs_stale = true;
+static unsigned int rtnl_seq = 0;
+
+struct rtnl_link_update {
+	double delta;
+	char first;
+};
+
+static void rtnl_close(const char *what)
+{
+	NORM_ERR("rtnetlink: %s failed: %s, reading /proc/net/dev instead", what,
+			strerror(errno));
+	if (rtnl_fd >= 0)
+		close(rtnl_fd);
+	if (rtnl_mon_fd >= 0)
+		close(rtnl_mon_fd);
+	rtnl_fd = rtnl_mon_fd = -1;
+	rtnl_failed = true;
+}
+
+static void rtnl_open(void)
+{
+	struct sockaddr_nl addr;
+
+	rtnl_fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (rtnl_fd < 0) {
+		rtnl_close("socket()");
+		return;
+	}
+	rtnl_mon_fd = socket(PF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_ROUTE);
+	if (rtnl_mon_fd < 0) {
+		rtnl_close("socket()");
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE;
+#ifdef BUILD_IPV6
+	addr.nl_groups |= RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE;
+#endif /* BUILD_IPV6 */
+	if (bind(rtnl_mon_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		rtnl_close("bind()");
+		return;
+	}
+	rtnl_addrs_stale = true;
+	rtnl_routes_stale = true;
+}
+
+/* send a dump request and hand every answer to handle(), returns false if
+ * the dump couldn't be completed */
+static bool rtnl_dump(int type, unsigned char family,
+		void (*handle)(struct nlmsghdr *, void *), void *data)
+{
+	struct {
+		struct nlmsghdr nlh;
+		union {
+			struct ifinfomsg ifi;
+			struct ifaddrmsg ifa;
+			struct rtmsg rtm;
+		};
+	} req;
+	static union {
+		struct nlmsghdr nlh;
+		char buf[32768];
+	} msg;
+	int len;
+
+	memset(&req, 0, sizeof(req));
+	if (type == RTM_GETLINK) {
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+		req.ifi.ifi_family = family;
+	} else if (type == RTM_GETROUTE) {
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+		req.rtm.rtm_family = family;
+	} else {
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		req.ifa.ifa_family = family;
+	}
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++rtnl_seq;
+	if (send(rtnl_fd, &req, req.nlh.nlmsg_len, 0) < 0) {
+		rtnl_close("send()");
+		return false;
+	}
+
+	while (true) {
+		len = recv(rtnl_fd, msg.buf, sizeof(msg.buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			rtnl_close("recv()");
+			return false;
+		}
+
+		for (struct nlmsghdr *nlh = &msg.nlh; NLMSG_OK(nlh, len);
+				nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != rtnl_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return true;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				errno = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+				rtnl_close(type == RTM_GETLINK ? "RTM_GETLINK" :
+						type == RTM_GETROUTE ? "RTM_GETROUTE" : "RTM_GETADDR");
+				return false;
+			}
+			handle(nlh, data);
+		}
+	}
+}
+
+static void rtnl_handle_link(struct nlmsghdr *nlh, void *data)
+{
+	struct rtnl_link_update *update = (struct rtnl_link_update *) data;
+	struct ifinfomsg *ifi = (struct ifinfomsg *) NLMSG_DATA(nlh);
+	int len = IFLA_PAYLOAD(nlh);
+	const char *name = NULL;
+	bool have_stats64 = false, have_stats = false;
+	long long r = 0, t = 0;
+	struct net_stat *ns;
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return;
+
+	for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+			rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case IFLA_IFNAME:
+				name = (const char *) RTA_DATA(rta);
+				break;
+			case IFLA_STATS64:
+				if (RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)) {
+					/* the attribute is only 4 byte aligned */
+					struct rtnl_link_stats64 st;
+					memcpy(&st, RTA_DATA(rta), sizeof(st));
+					r = st.rx_bytes;
+					t = st.tx_bytes;
+					have_stats64 = have_stats = true;
+				}
+				break;
+			case IFLA_STATS:
+				if (!have_stats64 && RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats)) {
+					struct rtnl_link_stats *st = (struct rtnl_link_stats *) RTA_DATA(rta);
+					r = st->rx_bytes;
+					t = st->tx_bytes;
+					have_stats = true;
+				}
+				break;
+		}
+	}
+	if (!name || !have_stats)
+		return;
+
+	ns = get_net_stat(name, NULL, NULL);
+	ns->up = 1;
+	net_stat_account(ns, r, t, update->delta, update->first);
+#ifdef BUILD_WLAN
+	net_stat_update_wireless(ns);
+#endif /* BUILD_WLAN */
+}
+
+static void rtnl_handle_addr(struct nlmsghdr *nlh, void *data)
+{
+	struct ifaddrmsg *ifa = (struct ifaddrmsg *) NLMSG_DATA(nlh);
+	int len = IFA_PAYLOAD(nlh);
+	const void *local = NULL, *address = NULL;
+	const char *label = NULL;
+	char ifname[IF_NAMESIZE];
+	struct net_stat *ns;
+
+	(void)data;
+
+	if (nlh->nlmsg_type != RTM_NEWADDR)
+		return;
+
+	for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len);
+			rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case IFA_LOCAL:
+				local = RTA_DATA(rta);
+				break;
+			case IFA_ADDRESS:
+				address = RTA_DATA(rta);
+				break;
+			case IFA_LABEL:
+				label = (const char *) RTA_DATA(rta);
+				break;
+		}
+	}
+
+	if (ifa->ifa_family == AF_INET) {
+		struct sockaddr_in *sin;
+
+		/* the label carries the alias, just like SIOCGIFCONF reports it */
+		if (!label && !(label = if_indextoname(ifa->ifa_index, ifname)))
+			return;
+		/* point-to-point links have the peer in IFA_ADDRESS */
+		if (!local && !(local = address))
+			return;
+
+		ns = get_net_stat(label, NULL, NULL);
+		sin = (struct sockaddr_in *) &ns->nl_addr;
+		memset(sin, 0, sizeof(ns->nl_addr));
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, local, sizeof(sin->sin_addr));
+		ns->addr = ns->nl_addr;
+		net_stat_add_addr(ns);
+	}
+#ifdef BUILD_IPV6
+	else if (ifa->ifa_family == AF_INET6) {
+		struct v6addr *lastv6;
+
+		if (!address || !if_indextoname(ifa->ifa_index, ifname))
+			return;
+
+		lastv6 = net_stat_add_v6addr(get_net_stat(ifname, NULL, NULL));
+		memcpy(&lastv6->addr, address, sizeof(lastv6->addr));
+		lastv6->netmask = ifa->ifa_prefixlen;
+		switch(ifa->ifa_scope) {
+		case RT_SCOPE_UNIVERSE:
+			lastv6->scope = 'G';
+			break;
+		case RT_SCOPE_HOST:
+			lastv6->scope = 'H';
+			break;
+		case RT_SCOPE_LINK:
+			lastv6->scope = 'L';
+			break;
+		case RT_SCOPE_SITE:
+			lastv6->scope = 'S';
+			break;
+		default:
+			lastv6->scope = '?';
+		}
+	}
+#endif /* BUILD_IPV6 */
+}
+
+static void rtnl_add_gateway(unsigned char family, int ifindex,
+		const void *gateway)
+{
+	static const unsigned char any[16] = { 0 };
+	char ifname[IF_NAMESIZE];
+	char ip[INET6_ADDRSTRLEN];
+
+	if (!if_indextoname(ifindex, ifname))
+		return;
+	/* a route straight out of the interface counts too, as 0.0.0.0 */
+	if (!inet_ntop(family, gateway ? gateway : any, ip, sizeof(ip)))
+		return;
+
+	gw_info.count++;
+	SAVE_SET_STRING(gw_info.iface, ifname)
+	SAVE_SET_STRING(gw_info.ip, ip)
+}
+
+/* collect the default routes of the main table into gw_info */
+static void rtnl_handle_route(struct nlmsghdr *nlh, void *data)
+{
+	struct rtmsg *rtm = (struct rtmsg *) NLMSG_DATA(nlh);
+	int len = RTM_PAYLOAD(nlh);
+	unsigned int table = rtm->rtm_table;
+	const void *gateway = NULL;
+	struct rtattr *multipath = NULL;
+	int oif = 0;
+
+	(void)data;
+
+	if (nlh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_dst_len != 0 ||
+			rtm->rtm_type != RTN_UNICAST || (rtm->rtm_flags & RTM_F_CLONED))
+		return;
+
+	for (struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len);
+			rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case RTA_TABLE:
+				table = *(uint32_t *) RTA_DATA(rta);
+				break;
+			case RTA_GATEWAY:
+				gateway = RTA_DATA(rta);
+				break;
+			case RTA_OIF:
+				oif = *(int *) RTA_DATA(rta);
+				break;
+			case RTA_MULTIPATH:
+				multipath = rta;
+				break;
+		}
+	}
+	if (table != RT_TABLE_MAIN)
+		return;
+
+	if (!multipath) {
+		rtnl_add_gateway(rtm->rtm_family, oif, gateway);
+		return;
+	}
+	/* every next hop of a multipath route is a gateway of its own */
+	len = RTA_PAYLOAD(multipath);
+	for (struct rtnexthop *rtnh = (struct rtnexthop *) RTA_DATA(multipath);
+			RTNH_OK(rtnh, len); len -= RTNH_ALIGN(rtnh->rtnh_len),
+			rtnh = RTNH_NEXT(rtnh)) {
+		int attrlen = rtnh->rtnh_len - sizeof(*rtnh);
+
+		gateway = NULL;
+		for (struct rtattr *rta = RTNH_DATA(rtnh); RTA_OK(rta, attrlen);
+				rta = RTA_NEXT(rta, attrlen)) {
+			if (rta->rta_type == RTA_GATEWAY)
+				gateway = RTA_DATA(rta);
+		}
+		rtnl_add_gateway(rtm->rtm_family, rtnh->rtnh_ifindex, gateway);
+	}
+}
+
+/* drain the change notifications, which tell whether the links and
+ * addresses or the routes have to be dumped again */
+static void rtnl_read_changes(void)
+{
+	static union {
+		struct nlmsghdr nlh;
+		char buf[8192];
+	} msg;
+	int len;
+
+	while (rtnl_mon_fd >= 0) {
+		len = recv(rtnl_mon_fd, msg.buf, sizeof(msg.buf), 0);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				/* we were too slow and lost some notifications */
+				rtnl_addrs_stale = true;
+				rtnl_routes_stale = true;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				rtnl_close("recv()");
+			break;
+		}
+
+		for (struct nlmsghdr *nlh = &msg.nlh; NLMSG_OK(nlh, len);
+				nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == RTM_NEWROUTE || nlh->nlmsg_type == RTM_DELROUTE)
+				rtnl_routes_stale = true;
+			else
+				rtnl_addrs_stale = true;
+		}
+	}
+}
+
+/* returns false if /proc/net/route has to be read instead */
+static bool rtnl_update_gateway_info(void)
+{
+	if (rtnl_failed)
+		return false;
+	if (rtnl_fd < 0)
+		rtnl_open();
+
+	rtnl_read_changes();
+	if (rtnl_failed)
+		return false;
+	if (!rtnl_routes_stale)
+		return true;
+
+	free_and_zero(gw_info.iface);
+	free_and_zero(gw_info.ip);
+	gw_info.count = 0;
+	if (!rtnl_dump(RTM_GETROUTE, AF_INET, &rtnl_handle_route, NULL))
+		return false;
+#ifdef BUILD_IPV6
+	if (!rtnl_dump(RTM_GETROUTE, AF_INET6, &rtnl_handle_route, NULL))
+		return false;
+#endif /* BUILD_IPV6 */
+	rtnl_routes_stale = false;
+	return true;
+}
+
+/* returns false if /proc/net/dev has to be read instead */
+static bool rtnl_update_net_stats(double delta, char first)
+{
+	struct rtnl_link_update update;
+
+	if (rtnl_failed)
+		return false;
+	if (rtnl_fd < 0)
+		rtnl_open();
+
+	rtnl_read_changes();
+	if (rtnl_failed)
+		return false;
+
+	if (rtnl_addrs_stale) {
+		for (unsigned int i = 0; i < netstats.size(); i++) {
+			memset(&netstats[i]->nl_addr, 0, sizeof(netstats[i]->nl_addr));
+			memset(netstats[i]->addrs, 0, sizeof(netstats[i]->addrs));
+		}
+		if (!rtnl_dump(RTM_GETADDR, AF_INET, &rtnl_handle_addr, NULL))
+			return false;
+#ifdef BUILD_IPV6
+		free_net_v6addrs();
+		if (!rtnl_dump(RTM_GETADDR, AF_INET6, &rtnl_handle_addr, NULL))
+			return false;
+#endif /* BUILD_IPV6 */
+		rtnl_addrs_stale = false;
+	} else {
+		/* the addresses were cleared for this update */
+		for (unsigned int i = 0; i < netstats.size(); i++)
+			netstats[i]->addr = netstats[i]->nl_addr;
+	}
+
+	update.delta = delta;
+	update.first = first;
+	return rtnl_dump(RTM_GETLINK, AF_UNSPEC, &rtnl_handle_link, &update);
+}
+#endif /* BUILD_RTNETLINK */
+
+int update_net_stats(void)
+{
+	static proc_file net_dev_file("/proc/net/dev", true);
+	const char *line;
+	static char first = 1;
+
+	unsigned int k;
+	// FIXME: arbitrary size chosen to keep code simple.
+	char buf[256];
+	double delta;
+
+	/* get delta */
+	delta = current_update_time - last_update_time;
+	if (delta <= 0.0001) {
+		return 0;
+	}
+
+#ifdef BUILD_RTNETLINK
+	if (procfs_is_real() && rtnl_update_net_stats(delta, first)) {
+		first = 0;
+		return 0;
+	}
+#endif /* BUILD_RTNETLINK */
+
+	/* read the file and ignore first two lines */
+	if (!net_dev_file.read()) {
+		/* the entries can't go away, text objects point at them; they are
+		 * already marked down for this update */
+		return 0;
+	}
+
+	line = net_dev_file.data();
+	if (!proc_next_line(line) ||  /* garbage */
+	    !proc_next_line(line)) {  /* garbage (field names) */
+		return 0;
+	}
+
+	/* read each interface */
+	while (*line) {
+		struct net_stat *ns;
+		char *s, *p;
+		const char *q;
+		long long r, t;
+
+		/* the name is needed as a string, so work on a copy of the line */
+		q = line;
+		proc_next_line(line);
+		snprintf(buf, sizeof(buf), "%.*s", (int) (line - q), q);
+		p = buf;
+		while (isspace((int) *p)) {
+			p++;
+		}
+
+		s = p;
+
+		while (*p && *p != ':') {
+			p++;
+		}
+		if (*p == '\0') {
+			continue;
+		}
+		*p = '\0';
+		p++;
+
+		ns = get_net_stat(s, NULL, NULL);
+		ns->up = 1;
+
+		/* bytes packets errs drop fifo frame compressed multicast|bytes ... */
+		q = p;
+		r = proc_scan_ull(q);
+		for (k = 0; k < 7; k++)
+			proc_scan_ull(q);
+		t = proc_scan_ull(q);
+
+		net_stat_account(ns, r, t, delta, first);
+
+#ifdef BUILD_WLAN
+		net_stat_update_wireless(ns);
+#endif /* BUILD_WLAN */
+	}
+
+	update_net_addrs();
+#ifdef BUILD_IPV6
+	update_net_v6addrs();
+#endif /* BUILD_IPV6 */
+
+	first = 0;
+
+	return 0;
+}
+
+int result;
+
+int update_total_processes(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int ignore1;
+	char ignore2;
+
+	info.procs = 0;
+	if (!(dir = opendir(procfs_root.c_str()))) {
+		return 0;
+	}
+	while ((entry = readdir(dir))) {
+		if (!entry) {
+			/* Problem reading list of processes */
+			closedir(dir);
+			info.procs = 0;
+			return 0;
+		}
+		if (sscanf(entry->d_name, "%d%c", &ignore1, &ignore2) == 1) {
+			info.procs++;
+		}
+	}
+	closedir(dir);
+	return 0;
+}
+
+/* /proc/loadavg, which update_threads() and update_load_average() both take
+ * their figures from. It is read once per update for the two of them, which
+ * may run at the same time. */
+static void read_loadavg(float loadavg[3], unsigned short *threads)
+{
+	static std::mutex mutex;
+	static proc_file loadavg_file("/proc/loadavg", true);
+	static double read_at = -1;
+	static float values[3];
+	static unsigned short nthreads;
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (read_at != current_update_time) {
+		const char *p;
+
+		read_at = current_update_time;
+		values[0] = values[1] = values[2] = 0.0;
+		nthreads = 0;
+		if (loadavg_file.read()) {
+			p = loadavg_file.data();
+			for (int i = 0; i < 3; i++)
+				values[i] = proc_scan_double(p);
+			/* the 5th field, after the '/' */
+			p = strchr(p, '/');
+			nthreads = p ? proc_scan_ull(++p) : 0;
+		}
+	}
+	memcpy(loadavg, values, sizeof(values));
+	*threads = nthreads;
+}
+
+int update_threads(void)
+{
+#ifdef HAVE_SYSINFO
+	if (!prefer_proc) {
+		struct sysinfo s_info;
+
+		sysinfo(&s_info);
+		info.threads = s_info.procs;
+	} else
+#endif
+	{
+		float loadavg[3];
+
+		read_loadavg(loadavg, &info.threads);
+	}
+	return 0;
+}
+
+#define CPU_SAMPLE_COUNT 15
+enum { CPU_USER, CPU_NICE, CPU_SYSTEM, CPU_IDLE, CPU_IOWAIT, CPU_IRQ, CPU_SOFTIRQ,
+	CPU_STEAL, CPU_FIELDS };
+
+/* The counters of all cpus, kept as one column per /proc/stat field, so that update_stat()
+ * can work out the usage of all cpus at once in plain loops over arrays, which the
+ * compiler vectorises, and their averages. Index 0 is the "cpu" total line. The columns
+ * live in the same allocation as the header, so global_cpu can be freed in one go. */
+struct cpu_history {
+	unsigned int ncpu;
+	conky::moving_average<float, CPU_SAMPLE_COUNT> *avg;
+	unsigned long long *field[CPU_FIELDS];
+	unsigned long long *last_total;
+	unsigned long long *last_active;
+	float *val;
+};
+
+static struct cpu_history *alloc_cpu_history(unsigned int ncpu)
+{
+	typedef conky::moving_average<float, CPU_SAMPLE_COUNT> average;
+	size_t size = sizeof(struct cpu_history) + ncpu * (sizeof(average) +
+			(CPU_FIELDS + 2) * sizeof(unsigned long long) + sizeof(float));
+	/* all zeros is a valid moving_average, see average.hh */
+	struct cpu_history *h = (struct cpu_history *)calloc(1, size);
+	unsigned long long *col;
+	int i;
+
+	h->ncpu = ncpu;
+	h->avg = (average *)(h + 1);
+	col = (unsigned long long *)(h->avg + ncpu);
+	for (i = 0; i < CPU_FIELDS; i++, col += ncpu) {
+		h->field[i] = col;
+	}
+	h->last_total = col;
+	col += ncpu;
+	h->last_active = col;
+	col += ncpu;
+	h->val = (float *)col;
+	return h;
+}
+
+static short cpu_setup = 0;
+
+/* Determine if this kernel gives us "extended" statistics information in
+ * /proc/stat.
+ * Kernels around 2.5 and earlier only reported user, system, nice, and
+ * idle values in proc stat.
+ * Kernels around 2.6 and greater report these PLUS iowait, irq, softirq,
+ * and steal */
+void determine_longstat(char *buf)
+{
+	unsigned long long iowait = 0;
+
+	KFLAG_SETOFF(KFLAG_IS_LONGSTAT);
+	/* scanf will either return -1 or 1 because there is only 1 assignment */
+	if (sscanf(buf, "%*s %*d %*d %*d %*d %llu", &iowait) > 0) {
+		KFLAG_SETON(KFLAG_IS_LONGSTAT);
+	}
+}
+
+void determine_longstat_file(void) {
+#define MAX_PROCSTAT_LINELEN 255
+	FILE *stat_fp;
+	static int rep = 0;
+	char buf[MAX_PROCSTAT_LINELEN + 1];
+
+	if ( not (stat_fp = open_file("/proc/stat", &rep))) return;
+	while ( not feof(stat_fp)) {
+		if (fgets(buf, MAX_PROCSTAT_LINELEN, stat_fp) == NULL) break;
+		if (strncmp(buf, "cpu", 3) == 0) {
+			determine_longstat(buf);
+			break;
+		}
+	}
+	fclose(stat_fp);
+}
+
+void get_cpu_count(void)
+{
+	FILE *stat_fp;
+	static int rep = 0;
+	char buf[256];
+
 	if (info.cpu_usage) {
 		return;
 	}
@@ -776,55 +1880,32 @@ void get_cpu_count(void)
 	fclose(stat_fp);
 }
 
-#define TMPL_LONGSTAT "%*s %llu %llu %llu %llu %llu %llu %llu %llu"
-#define TMPL_SHORTSTAT "%*s %llu %llu %llu %llu"
-
 int update_stat(void)
 {
-	FILE *stat_fp;
-	static int rep = 0;
-	static struct cpu_info *cpu = NULL;
-	char buf[256];
-	int i;
-	unsigned int idx;
-	double curtmp;
-	const char *stat_template = NULL;
-	unsigned int malloc_cpu_size = 0;
+	static proc_file stat_file("/proc/stat", true);
+	struct cpu_history *cpu;
+	const char *line;
+	unsigned int idx, n;
+	int i, fields;
+	float *val;
 	extern void* global_cpu;
 
-	static pthread_mutex_t last_stat_update_mutex = PTHREAD_MUTEX_INITIALIZER;
-	static double last_stat_update = 0.0;
-
-	/* since we use wrappers for this function, the update machinery
-	 * can't eliminate double invocations of this function. Check for
-	 * them here, otherwise cpu_usage counters are freaking out. */
-	pthread_mutex_lock(&last_stat_update_mutex);
-	if (last_stat_update == current_update_time) {
-		pthread_mutex_unlock(&last_stat_update_mutex);
-		return 0;
-	}
-	last_stat_update = current_update_time;
-	pthread_mutex_unlock(&last_stat_update_mutex);
-
 	/* add check for !info.cpu_usage since that mem is freed on a SIGUSR1 */
 	if (!cpu_setup || !info.cpu_usage) {
 		get_cpu_count();
 		cpu_setup = 1;
 	}
-
-	if (!stat_template) {
-		stat_template =
-			KFLAG_ISSET(KFLAG_IS_LONGSTAT) ? TMPL_LONGSTAT : TMPL_SHORTSTAT;
+	if (!info.cpu_usage) {
+		return 0;
 	}
 
 	if (!global_cpu) {
-		malloc_cpu_size = (info.cpu_count + 1) * sizeof(struct cpu_info);
-		cpu = (struct cpu_info *)malloc(malloc_cpu_size);
-		memset(cpu, 0, malloc_cpu_size);
-		global_cpu = cpu;
+		global_cpu = alloc_cpu_history(info.cpu_count + 1);
 	}
+	cpu = (struct cpu_history *)global_cpu;
+	n = cpu->ncpu;
 
-	if (!(stat_fp = open_file("/proc/stat", &rep))) {
+	if (!stat_file.read()) {
 		info.run_threads = 0;
 		if (info.cpu_usage) {
 			memset(info.cpu_usage, 0, info.cpu_count * sizeof(float));
@@ -832,101 +1913,89 @@ int update_stat(void)
 		return 0;
 	}
 
-	idx = 0;
-	while (!feof(stat_fp)) {
-		if (fgets(buf, 255, stat_fp) == NULL) {
-			break;
-		}
-
-		if (strncmp(buf, "procs_running ", 14) == 0) {
-			sscanf(buf, "%*s %hu", &info.run_threads);
-		} else if (strncmp(buf, "cpu", 3) == 0) {
-			double delta;
-			if (isdigit(buf[3])) {
-				idx = atoi(&buf[3]) + 1;
+	/* first only store the counters of each cpu in the columns */
+	fields = KFLAG_ISSET(KFLAG_IS_LONGSTAT) ? CPU_FIELDS : 4;
+	line = stat_file.data();
+	do {
+		if (strncmp(line, "procs_running ", 14) == 0) {
+			const char *p = line + 14;
+			info.run_threads = proc_scan_ull(p);
+		} else if (strncmp(line, "cpu", 3) == 0) {
+			const char *p = line + 3;
+
+			if (isdigit(*p)) {
+				idx = proc_scan_ull(p) + 1;
 			} else {
 				idx = 0;
 			}
-			sscanf(buf, stat_template, &(cpu[idx].cpu_user),
-				&(cpu[idx].cpu_nice), &(cpu[idx].cpu_system),
-				&(cpu[idx].cpu_idle), &(cpu[idx].cpu_iowait),
-				&(cpu[idx].cpu_irq), &(cpu[idx].cpu_softirq),
-				&(cpu[idx].cpu_steal));
-
-			cpu[idx].cpu_total = cpu[idx].cpu_user + cpu[idx].cpu_nice +
-				cpu[idx].cpu_system + cpu[idx].cpu_idle +
-				cpu[idx].cpu_iowait + cpu[idx].cpu_irq +
-				cpu[idx].cpu_softirq + cpu[idx].cpu_steal;
-
-			cpu[idx].cpu_active_total = cpu[idx].cpu_total -
-				(cpu[idx].cpu_idle + cpu[idx].cpu_iowait);
-
-			delta = current_update_time - last_update_time;
-
-			if (delta <= 0.001) {
-				break;
+			/* ignore cpus which came online after we counted them */
+			if (idx >= n) {
+				continue;
+			}
+			for (i = 0; i < fields; i++) {
+				cpu->field[i][idx] = proc_scan_ull(p);
 			}
+		}
+	} while (proc_next_line(line));
 
-			cpu[idx].cpu_val[0] = (cpu[idx].cpu_active_total -
-				cpu[idx].cpu_last_active_total) /
-				(float) (cpu[idx].cpu_total - cpu[idx].cpu_last_total);
-			curtmp = 0;
+	if (current_update_time - last_update_time <= 0.001) {
+		return 0;
+	}
 
-			int samples = cpu_avg_samples.get(*state);
-#ifdef HAVE_OPENMP
-#pragma omp parallel for reduction(+:curtmp) schedule(dynamic,10)
-#endif /* HAVE_OPENMP */
-			for (i = 0; i < samples; i++) {
-				curtmp = curtmp + cpu[idx].cpu_val[i];
-			}
-			info.cpu_usage[idx] = curtmp / samples;
+	/* then the usage since the last update, for all cpus at once. A cpu that has gone
+	 * offline doesn't move its counters, and counts as idle. */
+	val = cpu->val;
+	{
+		const unsigned long long *user = cpu->field[CPU_USER];
+		const unsigned long long *nice = cpu->field[CPU_NICE];
+		const unsigned long long *system = cpu->field[CPU_SYSTEM];
+		const unsigned long long *idle = cpu->field[CPU_IDLE];
+		const unsigned long long *iowait = cpu->field[CPU_IOWAIT];
+		const unsigned long long *irq = cpu->field[CPU_IRQ];
+		const unsigned long long *softirq = cpu->field[CPU_SOFTIRQ];
+		const unsigned long long *steal = cpu->field[CPU_STEAL];
+		unsigned long long *last_total = cpu->last_total;
+		unsigned long long *last_active = cpu->last_active;
 
-			cpu[idx].cpu_last_total = cpu[idx].cpu_total;
-			cpu[idx].cpu_last_active_total = cpu[idx].cpu_active_total;
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(dynamic,10)
+#pragma omp simd
 #endif /* HAVE_OPENMP */
-			for (i = samples - 1; i > 0; i--) {
-				cpu[idx].cpu_val[i] = cpu[idx].cpu_val[i - 1];
-			}
+		for (idx = 0; idx < n; idx++) {
+			unsigned long long active = user[idx] + nice[idx] + system[idx] +
+				irq[idx] + softirq[idx] + steal[idx];
+			unsigned long long total = active + idle[idx] + iowait[idx];
+			unsigned long long dt = total - last_total[idx];
+
+			val[idx] = dt ? (float) (active - last_active[idx]) / dt : 0;
+			last_total[idx] = total;
+			last_active[idx] = active;
+		}
+	}
+
+	/* and their averages, each in O(1) */
+	{
+		int samples = cpu_avg_samples.get(*state);
+		average_mode mode = average_mode_setting.get(*state);
+
+		for (idx = 0; idx < n; idx++) {
+			info.cpu_usage[idx] = cpu->avg[idx].push(val[idx], samples, mode);
 		}
 	}
-	fclose(stat_fp);
 	return 0;
 }
 
+/* the work is done by update_stat(), which core.cc registers as their
+ * dependency, so that several objects don't parse /proc/stat concurrently */
 int update_running_processes(void)
 {
-	update_stat();
 	return 0;
 }
 
 int update_cpu_usage(void)
 {
-	update_stat();
 	return 0;
 }
 
-//fscanf() that reads floats with points even if you are using a locale where
-//floats are with commas
-int fscanf_no_i18n(FILE *stream, const char *format, ...) {
-	int returncode;
-	va_list ap;
-
-#ifdef BUILD_I18N
-	const char *oldlocale = setlocale(LC_NUMERIC, NULL);
-
-	setlocale(LC_NUMERIC, "C");
-#endif
-	va_start(ap, format);
-	returncode = vfscanf(stream, format, ap);
-	va_end(ap);
-#ifdef BUILD_I18N
-	setlocale(LC_NUMERIC, oldlocale);
-#endif
-	return returncode;
-}
-
 int update_load_average(void)
 {
 #ifdef HAVE_GETLOADAVG
@@ -940,17 +2009,9 @@ int update_load_average(void)
 	} else
 #endif
 	{
-		static int rep = 0;
-		FILE *fp;
+		unsigned short threads;
 
-		if (!(fp = open_file("/proc/loadavg", &rep))) {
-			info.loadavg[0] = info.loadavg[1] = info.loadavg[2] = 0.0;
-			return 0;
-		}
-		if (fscanf_no_i18n(fp, "%f %f %f", &info.loadavg[0], &info.loadavg[1],
-		           &info.loadavg[2]) < 0)
-			info.loadavg[0] = info.loadavg[1] = info.loadavg[2] = 0.0;
-		fclose(fp);
+		read_loadavg(info.loadavg, &threads);
 	}
 	return 0;
 }
@@ -1099,38 +2160,100 @@ static int open_sysfs_sensor(const char *dir, const char *dev, const char *type,
 	return fd;
 }
 
-static double get_sysfs_info(int *fd, int divisor, char *devtype, char *type)
-{
-	int val = 0;
+namespace {
+	/* the raw values of all the sensors of a chip, by file name */
+	typedef std::unordered_map<std::string, int> sysfs_values;
 
-	if (*fd <= 0) {
-		return 0;
+	/*
+	 * Reads every *_input file of a sensor chip directory in one go, so all the objects
+	 * showing sensors of the same chip share a single callback. The files are opened once
+	 * and re-read from the start with pread(), sysfs regenerates the value then.
+	 */
+	class sysfs_chip_cb: public conky::callback<sysfs_values, std::string> {
+		typedef conky::callback<sysfs_values, std::string> Base;
+
+		std::vector<std::pair<std::string, int>> files;
+		bool opened;
+		/* the batch of reads of the files, 64 bytes of bufs for each */
+		std::vector<struct proc_batch_op> ops;
+		std::vector<char> bufs;
+
+		void open_files();
+
+	protected:
+		virtual void work();
+
+	public:
+		sysfs_chip_cb(uint32_t period, const std::string &chip)
+			: Base(period, true, Tuple(chip)), opened(false)
+		{}
+		~sysfs_chip_cb();
+	};
+
+	/* done on the first run rather than in the constructor, register_cb() constructs a
+	 * callback on every registration and throws it away if the chip is known already */
+	void sysfs_chip_cb::open_files()
+	{
+		const std::string &chip = get<0>();
+		DIR *dir = opendir(chip.c_str());
+		struct dirent *ent;
+
+		opened = true;
+		if (!dir) {
+			NORM_ERR("can't open '%s': %s", chip.c_str(), strerror(errno));
+			return;
+		}
+		while ((ent = readdir(dir))) {
+			size_t len = strlen(ent->d_name);
+
+			if (len < 6 || strcmp(ent->d_name + len - 6, "_input"))
+				continue;
+			int fd = open((chip + '/' + ent->d_name).c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd >= 0)
+				files.push_back(std::make_pair(std::string(ent->d_name), fd));
+		}
+		closedir(dir);
 	}
 
-	lseek(*fd, 0, SEEK_SET);
+	sysfs_chip_cb::~sysfs_chip_cb()
+	{
+		for (auto i = files.begin(); i != files.end(); ++i)
+			close(i->second);
+	}
 
-	/* read integer */
+	void sysfs_chip_cb::work()
 	{
-		char buf[64];
-		int n;
-		n = read(*fd, buf, 63);
-		/* should read until n == 0 but I doubt that kernel will give these
-		 * in multiple pieces. :) */
-		if (n < 0) {
-			NORM_ERR("get_sysfs_info(): read from %s failed\n", devtype);
-		} else {
-			buf[n] = '\0';
-			val = atoi(buf);
+		sysfs_values values;
+
+		if (!opened)
+			open_files();
+
+		/* all the inputs of the chip in one batch */
+		bufs.resize(files.size() * 64);
+		ops.resize(files.size());
+		for (size_t i = 0; i < files.size(); i++)
+			ops[i] = { files[i].second, &bufs[i * 64], 63, NULL, 0 };
+		proc_batch_run(ops.data(), ops.size());
+
+		for (size_t i = 0; i < files.size(); i++) {
+			/* should read until n == 0 but I doubt that kernel will give these
+			 * in multiple pieces. :) */
+			if (ops[i].res < 0) {
+				/* some drivers fail while the device sleeps, that's no reason
+				 * to drop the other sensors */
+				continue;
+			}
+			bufs[i * 64 + ops[i].res] = '\0';
+			values[files[i].first] = atoi(&bufs[i * 64]);
 		}
-	}
 
-	close(*fd);
-	/* open file */
-	*fd = open(devtype, O_RDONLY);
-	if (*fd < 0) {
-		NORM_ERR("can't open '%s': %s", devtype, strerror(errno));
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result.swap(values);
 	}
+}
 
+static double get_sysfs_info(int val, int divisor, char *type)
+{
 	/* My dirty hack for computing CPU value
 	 * Filedil, from forums.gentoo.org */
 	/* if (strstr(devtype, "temp1_input") != NULL) {
@@ -1180,13 +2303,22 @@ static void parse_sysfs_sensor(struct text_object *obj, const char *arg, const c
 		return;
 	}
 	DBGP("parsed %s args: '%s' '%s' %d %f %f\n", type, buf1, buf2, n, factor, offset);
-	sf = (struct sysfs*)malloc(sizeof(struct sysfs));
-	memset(sf, 0, sizeof(struct sysfs));
-	sf->fd = open_sysfs_sensor(path, (*buf1) ? buf1 : 0, buf2, n,
+	sf = new sysfs;
+	memset(sf->devtype, 0, sizeof(sf->devtype));
+	memset(sf->type, 0, sizeof(sf->type));
+	sf->arg = 0;
+	int fd = open_sysfs_sensor(path, (*buf1) ? buf1 : 0, buf2, n,
 			&sf->arg, sf->devtype);
 	strncpy(sf->type, buf2, 63);
 	sf->factor = factor;
 	sf->offset = offset;
+	if (fd >= 0) {
+		/* from now on the chip's callback does the reading */
+		close(fd);
+		const char *slash = strrchr(sf->devtype, '/');
+		sf->chip.assign(sf->devtype, slash - sf->devtype);
+		sf->file = slash + 1;
+	}
 	obj->data.opaque = sf;
 }
 
@@ -1205,11 +2337,20 @@ void print_sysfs_sensor(struct text_object *obj, char *p, int p_max_size)
 	double r;
 	struct sysfs *sf = (struct sysfs *)obj->data.opaque;
 
-	if (!sf || sf->fd < 0)
+	if (!sf || sf->chip.empty())
 		return;
 
-	r = get_sysfs_info(&sf->fd, sf->arg,
-			sf->devtype, sf->type);
+	auto cb = conky::register_cb<sysfs_chip_cb>(1, sf->chip);
+	{
+		std::lock_guard<std::mutex> lock(cb->result_mutex);
+		const sysfs_values &values = cb->get_result();
+		sysfs_values::const_iterator i = values.find(sf->file);
+
+		/* not read yet, or the read failed */
+		if (i == values.end())
+			return;
+		r = get_sysfs_info(i->second, sf->arg, sf->type);
+	}
 
 	r = r * sf->factor + sf->offset;
 
@@ -1229,95 +2370,146 @@ void free_sysfs_sensor(struct text_object *obj)
 	if (!sf)
 		return;
 
-	if(sf->fd >= 0)
-		close(sf->fd);
-	free_and_zero(obj->data.opaque);
+	delete sf;
+	obj->data.opaque = NULL;
 }
 
 #define CPUFREQ_PREFIX "/sys/devices/system/cpu"
 #define CPUFREQ_POSTFIX "cpufreq/scaling_cur_freq"
 
 /* return system frequency in MHz (use divisor=1) or GHz (use divisor=1000) */
-char get_freq(char *p_client_buffer, size_t client_buffer_size,
-		const char *p_format, int divisor, unsigned int cpu)
-{
-	FILE *f;
-	static int rep = 0;
-	char frequency[32];
-	char s[256];
-	double freq = 0;
-
-	if (!p_client_buffer || client_buffer_size <= 0 || !p_format
-			|| divisor <= 0) {
-		return 0;
-	}
-
-	if (!prefer_proc) {
-		char current_freq_file[128];
-
-		snprintf(current_freq_file, 127, "%s/cpu%d/%s", CPUFREQ_PREFIX, cpu - 1,
-			CPUFREQ_POSTFIX);
-		f = fopen(current_freq_file, "r");
-		if (f) {
-			/* if there's a cpufreq /sys node, read the current frequency from
-			 * this node and divide by 1000 to get Mhz. */
-			if (fgets(s, sizeof(s), f)) {
-				s[strlen(s) - 1] = '\0';
-				freq = strtod(s, NULL);
-			}
-			fclose(f);
-			snprintf(p_client_buffer, client_buffer_size, p_format,
-				(freq / 1000) / divisor);
-			return 1;
+namespace {
+	/* the current frequency of every cpu in MHz, as of the update it was read in */
+	struct cpu_freq {
+		/* scaling_cur_freq, kept open; -1 if the cpu has none, -2 if not tried yet */
+		int fd;
+		double mhz;
+		double read_at;
+
+		cpu_freq()
+			: fd(-2), mhz(0), read_at(-1)
+		{}
+	};
+
+	std::vector<cpu_freq> freq_table;
+
+	/* one pass over /proc/cpuinfo gives the frequencies of all cpus */
+	bool read_cpuinfo_freqs()
+	{
+		static int rep = 0;
+		FILE *f;
+		char s[256];
+		size_t cpu = 0;
+
+		// open the CPU information file
+		f = open_file("/proc/cpuinfo", &rep);
+		if (!f) {
+			perror(PACKAGE_NAME": Failed to access '/proc/cpuinfo' at get_freq()");
+			return false;
 		}
-	}
-
-	// open the CPU information file
-	f = open_file("/proc/cpuinfo", &rep);
-	if (!f) {
-		perror(PACKAGE_NAME": Failed to access '/proc/cpuinfo' at get_freq()");
-		return 0;
-	}
 
-	// read the file
-	while (fgets(s, sizeof(s), f) != NULL) {
+		// read the file
+		while (fgets(s, sizeof(s), f) != NULL) {
+			if (strncmp(s, "processor", 9) == 0) {
+				cpu++;
+				continue;
+			}
 
 #if defined(__i386) || defined(__x86_64)
-		// and search for the cpu mhz
-		if (strncmp(s, "cpu MHz", 7) == 0 && cpu == 0) {
+			// and search for the cpu mhz
+			if (strncmp(s, "cpu MHz", 7) == 0 && cpu > 0) {
 #else
 #if defined(__alpha)
-		// different on alpha
-		if (strncmp(s, "cycle frequency [Hz]", 20) == 0 && cpu == 0) {
+			// different on alpha
+			if (strncmp(s, "cycle frequency [Hz]", 20) == 0 && cpu > 0) {
 #else
-		// this is different on ppc for some reason
-		if (strncmp(s, "clock", 5) == 0 && cpu == 0) {
+			// this is different on ppc for some reason
+			if (strncmp(s, "clock", 5) == 0 && cpu > 0) {
 #endif // defined(__alpha)
 #endif // defined(__i386) || defined(__x86_64)
+				const char *colon = strchr(s, ':');
 
-			// copy just the number
-			strcpy(frequency, strchr(s, ':') + 2);
+				if (!colon)
+					continue;
+				if (freq_table.size() < cpu)
+					freq_table.resize(cpu);
 #if defined(__alpha)
-			// strip " est.\n"
-			frequency[strlen(frequency) - 6] = '\0';
-			// kernel reports in Hz
-			freq = strtod(frequency, NULL) / 1000000;
+				// kernel reports in Hz
+				freq_table[cpu - 1].mhz = strtod(colon + 2, NULL) / 1000000;
 #else
-			// strip \n
-			frequency[strlen(frequency) - 1] = '\0';
-			freq = strtod(frequency, NULL);
+				freq_table[cpu - 1].mhz = strtod(colon + 2, NULL);
 #endif
-			break;
+				freq_table[cpu - 1].read_at = current_update_time;
+			}
 		}
-		if (strncmp(s, "processor", 9) == 0) {
-			cpu--;
-			continue;
+
+		fclose(f);
+		return true;
+	}
+
+	/* the frequency of the cpu (counted from 1) in MHz, read at most once per update */
+	bool get_cpu_mhz(unsigned int cpu, double &mhz)
+	{
+		if (cpu == 0)
+			cpu = 1;
+		if (freq_table.size() < cpu)
+			freq_table.resize(cpu);
+
+		cpu_freq &cf = freq_table[cpu - 1];
+		if (cf.read_at == current_update_time) {
+			mhz = cf.mhz;
+			return true;
+		}
+
+		if (!prefer_proc && cf.fd == -2) {
+			char current_freq_file[128];
+
+			snprintf(current_freq_file, 127, "%s/cpu%u/%s", CPUFREQ_PREFIX, cpu - 1,
+				CPUFREQ_POSTFIX);
+			cf.fd = open(current_freq_file, O_RDONLY | O_CLOEXEC);
+			if (cf.fd < 0)
+				cf.fd = -1;
+		}
+		if (!prefer_proc && cf.fd >= 0) {
+			/* if there's a cpufreq /sys node, read the current frequency from
+			 * this node and divide by 1000 to get Mhz. */
+			char s[32];
+			ssize_t n = pread(cf.fd, s, sizeof(s) - 1, 0);
+
+			if (n > 0) {
+				s[n] = '\0';
+				cf.mhz = strtod(s, NULL) / 1000;
+				cf.read_at = current_update_time;
+				mhz = cf.mhz;
+				return true;
+			}
 		}
+
+		if (!read_cpuinfo_freqs())
+			return false;
+		/* a cpu cpuinfo doesn't list shows 0, like it used to */
+		cpu_freq &now = freq_table[cpu - 1];
+		now.read_at = current_update_time;
+		mhz = now.mhz;
+		return true;
+	}
+}
+
+char get_freq(char *p_client_buffer, size_t client_buffer_size,
+		const char *p_format, int divisor, unsigned int cpu)
+{
+	double freq = 0;
+
+	if (!p_client_buffer || client_buffer_size <= 0 || !p_format
+			|| divisor <= 0) {
+		return 0;
 	}
 
-	fclose(f);
+	if (!get_cpu_mhz(cpu, freq))
+		return 0;
+
 	snprintf(p_client_buffer, client_buffer_size, p_format,
-		(float) freq / divisor);
+		freq / divisor);
 	return 1;
 }
 
@@ -1683,223 +2875,131 @@ present voltage:         16608 mV
 #define SYSFS_BATTERY_BASE_PATH "/sys/class/power_supply"
 #define ACPI_BATTERY_BASE_PATH "/proc/acpi/battery"
 #define APM_PATH "/proc/apm"
-#define MAX_BATTERY_COUNT 4
-
-static FILE *sysfs_bat_fp[MAX_BATTERY_COUNT] = { NULL, NULL, NULL, NULL };
-static FILE *acpi_bat_fp[MAX_BATTERY_COUNT] = { NULL, NULL, NULL, NULL };
-static FILE *apm_bat_fp[MAX_BATTERY_COUNT] = { NULL, NULL, NULL, NULL };
-
-static int batteries_initialized = 0;
-static char batteries[MAX_BATTERY_COUNT][32];
-
-static int acpi_last_full[MAX_BATTERY_COUNT];
-static int acpi_design_capacity[MAX_BATTERY_COUNT];
-
-/* e.g. "charging 75%" */
-static char last_battery_str[MAX_BATTERY_COUNT][64];
-/* e.g. "3h 15m" */
-static char last_battery_time_str[MAX_BATTERY_COUNT][64];
-
-static double last_battery_time[MAX_BATTERY_COUNT];
-
-static int last_battery_perct[MAX_BATTERY_COUNT];
-static double last_battery_perct_time[MAX_BATTERY_COUNT];
-
-void init_batteries(void)
-{
-	int idx;
-
-	if (batteries_initialized) {
-		return;
-	}
-#ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(dynamic,10)
-#endif /* HAVE_OPENMP */
-	for (idx = 0; idx < MAX_BATTERY_COUNT; idx++) {
-		batteries[idx][0] = '\0';
-	}
-	batteries_initialized = 1;
-}
-
-int get_battery_idx(const char *bat)
-{
-	int idx;
-
-	for (idx = 0; idx < MAX_BATTERY_COUNT; idx++) {
-		if (!strlen(batteries[idx]) || !strcmp(batteries[idx], bat)) {
-			break;
-		}
-	}
-
-	/* if not found, enter a new entry */
-	if (!strlen(batteries[idx])) {
-		snprintf(batteries[idx], 31, "%s", bat);
-	}
-
-	return idx;
-}
-
-void set_return_value(char *buffer, unsigned int n, int item, int idx);
-
-void get_battery_stuff(char *buffer, unsigned int n, const char *bat, int item)
-{
-	static int idx, rep = 0, rep1 = 0, rep2 = 0;
-	char acpi_path[128];
-	char sysfs_path[128];
-
-	snprintf(acpi_path, 127, ACPI_BATTERY_BASE_PATH "/%s/state", bat);
-	snprintf(sysfs_path, 127, SYSFS_BATTERY_BASE_PATH "/%s/uevent", bat);
-
-	init_batteries();
-
-	idx = get_battery_idx(bat);
 
-	/* don't update battery too often */
-	if (current_update_time - last_battery_time[idx] < 29.5) {
-		set_return_value(buffer, n, item, idx);
-		return;
-	}
+namespace {
+	/* what the battery objects show of a battery */
+	struct battery_info {
+		/* e.g. "charging 75%" */
+		char status[64];
+		/* e.g. "3h 15m" */
+		char time[64];
+		int perct;
+
+		battery_info()
+			: perct(0)
+		{ status[0] = time[0] = '\0'; }
+	};
+
+	/* the raw readings, the same whether they came from sysfs or acpi */
+	struct battery_reading {
+		bool present;
+		char charging_state[64];
+		int present_rate;
+		int remaining_capacity;
+		int last_full;
 
-	last_battery_time[idx] = current_update_time;
+		battery_reading()
+			: present(true), present_rate(-1), remaining_capacity(-1), last_full(0)
+		{ strcpy(charging_state, "unknown"); }
+	};
 
-	memset(last_battery_str[idx], 0, sizeof(last_battery_str[idx]));
-	memset(last_battery_time_str[idx], 0, sizeof(last_battery_time_str[idx]));
+	/*
+	 * Reads a battery once per period for all the $battery* objects naming it (and the
+	 * update_interval_on_battery check of the main loop). The sysfs uevent file has
+	 * everything in one go, it's read as a proc_file. If there is none, the acpi state
+	 * file or /proc/apm is read instead.
+	 */
+	class battery_cb: public conky::callback<battery_info, std::string> {
+		typedef conky::callback<battery_info, std::string> Base;
 
-	/* first try SYSFS if that fails try ACPI */
+		proc_file uevent;
+		int acpi_last_full;
+		int acpi_rep, apm_rep;
 
-	if (sysfs_bat_fp[idx] == NULL && acpi_bat_fp[idx] == NULL && apm_bat_fp[idx] == NULL) {
-		sysfs_bat_fp[idx] = open_file(sysfs_path, &rep);
-	}
+		bool read_sysfs(battery_reading &r);
+		bool read_acpi(battery_reading &r);
+		bool read_apm(battery_info &info);
 
-	if (sysfs_bat_fp[idx] == NULL && acpi_bat_fp[idx] == NULL && apm_bat_fp[idx] == NULL) {
-		acpi_bat_fp[idx] = open_file(acpi_path, &rep1);
-	}
+	protected:
+		virtual void work();
 
-	if (sysfs_bat_fp[idx] != NULL) {
-		/* SYSFS */
-		int present_rate = -1;
-		int remaining_capacity = -1;
-		char charging_state[64];
-		char present[4];
+	public:
+		battery_cb(uint32_t period, const std::string &bat)
+			: Base(period, true, Tuple(bat)),
+			  uevent(SYSFS_BATTERY_BASE_PATH "/" + bat + "/uevent", true), acpi_last_full(0),
+			  acpi_rep(0), apm_rep(0)
+		{}
+	};
 
-		strcpy(charging_state, "unknown");
+	bool battery_cb::read_sysfs(battery_reading &r)
+	{
+		const char *line;
 
-		while (!feof(sysfs_bat_fp[idx])) {
-			char buf[256];
-			if (fgets(buf, 256, sysfs_bat_fp[idx]) == NULL)
-				break;
+		if (!uevent.read())
+			return false;
 
+		line = uevent.data();
+		do {
 			/* let's just hope units are ok */
-			if (strncmp (buf, "POWER_SUPPLY_PRESENT=1", 22) == 0)
-				strcpy(present, "yes");
-			else if (strncmp (buf, "POWER_SUPPLY_PRESENT=0", 22) == 0)
-				strcpy(present, "no");
-			else if (strncmp (buf, "POWER_SUPPLY_STATUS=", 20) == 0)
-				sscanf(buf, "POWER_SUPPLY_STATUS=%63s", charging_state);
+			if (strncmp(line, "POWER_SUPPLY_PRESENT=", 21) == 0)
+				r.present = line[21] != '0';
+			else if (strncmp(line, "POWER_SUPPLY_STATUS=", 20) == 0)
+				sscanf(line, "POWER_SUPPLY_STATUS=%63s", r.charging_state);
 			/* present_rate is not the same as the current flowing now but it
 			 * is the same value which was used in the past. so we continue the
 			 * tradition! */
-			else if (strncmp(buf, "POWER_SUPPLY_CURRENT_NOW=", 25) == 0)
-				sscanf(buf, "POWER_SUPPLY_CURRENT_NOW=%d", &present_rate);
-			else if (strncmp(buf, "POWER_SUPPLY_POWER_NOW=", 23) == 0)
-				sscanf(buf, "POWER_SUPPLY_POWER_NOW=%d", &present_rate);
-			else if (strncmp(buf, "POWER_SUPPLY_ENERGY_NOW=", 24) == 0)
-				sscanf(buf, "POWER_SUPPLY_ENERGY_NOW=%d", &remaining_capacity);
-			else if (strncmp(buf, "POWER_SUPPLY_ENERGY_FULL=", 25) == 0)
-				sscanf(buf, "POWER_SUPPLY_ENERGY_FULL=%d", &acpi_last_full[idx]);
-			else if (strncmp(buf, "POWER_SUPPLY_CHARGE_NOW=", 24) == 0)
-				sscanf(buf, "POWER_SUPPLY_CHARGE_NOW=%d", &remaining_capacity);
-			else if (strncmp(buf, "POWER_SUPPLY_CHARGE_FULL=", 25) == 0)
-				sscanf(buf, "POWER_SUPPLY_CHARGE_FULL=%d", &acpi_last_full[idx]);
-		}
-
-		fclose(sysfs_bat_fp[idx]);
-		sysfs_bat_fp[idx] = NULL;
+			else if (strncmp(line, "POWER_SUPPLY_CURRENT_NOW=", 25) == 0)
+				sscanf(line, "POWER_SUPPLY_CURRENT_NOW=%d", &r.present_rate);
+			else if (strncmp(line, "POWER_SUPPLY_POWER_NOW=", 23) == 0)
+				sscanf(line, "POWER_SUPPLY_POWER_NOW=%d", &r.present_rate);
+			else if (strncmp(line, "POWER_SUPPLY_ENERGY_NOW=", 24) == 0)
+				sscanf(line, "POWER_SUPPLY_ENERGY_NOW=%d", &r.remaining_capacity);
+			else if (strncmp(line, "POWER_SUPPLY_ENERGY_FULL=", 25) == 0)
+				sscanf(line, "POWER_SUPPLY_ENERGY_FULL=%d", &r.last_full);
+			else if (strncmp(line, "POWER_SUPPLY_CHARGE_NOW=", 24) == 0)
+				sscanf(line, "POWER_SUPPLY_CHARGE_NOW=%d", &r.remaining_capacity);
+			else if (strncmp(line, "POWER_SUPPLY_CHARGE_FULL=", 25) == 0)
+				sscanf(line, "POWER_SUPPLY_CHARGE_FULL=%d", &r.last_full);
+		} while (proc_next_line(line));
+		return true;
+	}
 
-		/* Hellf[i]re notes that remaining capacity can exceed acpi_last_full */
-		if (remaining_capacity > acpi_last_full[idx])
-			acpi_last_full[idx] = remaining_capacity;  /* normalize to 100% */
+	bool battery_cb::read_acpi(battery_reading &r)
+	{
+		std::string base = ACPI_BATTERY_BASE_PATH "/" + get<0>();
+		char present[4] = "yes";
+		FILE *fp;
 
-		/* not present */
-		if (strcmp(present, "No") == 0) {
-			strncpy(last_battery_str[idx], "not present", 64);
-		}
-		/* charging */
-		else if (strcmp(charging_state, "Charging") == 0) {
-			if (acpi_last_full[idx] != 0 && present_rate > 0) {
-				/* e.g. charging 75% */
-				snprintf(last_battery_str[idx], sizeof(last_battery_str[idx])-1, "charging %i%%",
-						(int) (((float) remaining_capacity / acpi_last_full[idx]) * 100 ));
-				/* e.g. 2h 37m */
-				format_seconds(last_battery_time_str[idx], sizeof(last_battery_time_str[idx])-1,
-						(long) (((float)(acpi_last_full[idx] - remaining_capacity) / present_rate) * 3600));
-			} else if (acpi_last_full[idx] != 0 && present_rate <= 0) {
-				snprintf(last_battery_str[idx], sizeof(last_battery_str[idx])-1, "charging %d%%",
-						(int) (((float)remaining_capacity / acpi_last_full[idx]) * 100));
-				snprintf(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1, "unknown");
-			} else {
-				strncpy(last_battery_str[idx], "charging", sizeof(last_battery_str[idx])-1);
-				snprintf(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1, "unknown");
+		fp = open_file((base + "/state").c_str(), &acpi_rep);
+		if (fp == NULL)
+			return false;
+
+		while (!feof(fp)) {
+			char buf[256];
+
+			if (fgets(buf, 256, fp) == NULL) {
+				break;
 			}
-		}
-		/* discharging */
-		else if (strncmp(charging_state, "Discharging", 64) == 0) {
-			if (present_rate > 0) {
-				/* e.g. discharging 35% */
-				snprintf(last_battery_str[idx], sizeof(last_battery_str[idx])-1, "discharging %i%%",
-					(int) (((float) remaining_capacity / acpi_last_full[idx]) * 100 ));
-				/* e.g. 1h 12m */
-				format_seconds(last_battery_time_str[idx], sizeof(last_battery_time_str[idx])-1,
-					      (long) (((float) remaining_capacity / present_rate) * 3600));
-			} else if (present_rate == 0) { /* Thanks to Nexox for this one */
-				snprintf(last_battery_str[idx], sizeof(last_battery_str[idx])-1, "full");
-				snprintf(last_battery_time_str[idx],
-					sizeof(last_battery_time_str[idx]) - 1, "unknown");
-			} else {
-				snprintf(last_battery_str[idx], sizeof(last_battery_str[idx])-1,
-					"discharging %d%%",
-					(int) (((float)remaining_capacity / acpi_last_full[idx]) * 100));
-				snprintf(last_battery_time_str[idx],
-					sizeof(last_battery_time_str[idx]) - 1, "unknown");
+
+			/* let's just hope units are ok */
+			if (strncmp(buf, "present:", 8) == 0) {
+				sscanf(buf, "present: %3s", present);
+			} else if (strncmp(buf, "charging state:", 15) == 0) {
+				sscanf(buf, "charging state: %63s", r.charging_state);
+			} else if (strncmp(buf, "present rate:", 13) == 0) {
+				sscanf(buf, "present rate: %d", &r.present_rate);
+			} else if (strncmp(buf, "remaining capacity:", 19) == 0) {
+				sscanf(buf, "remaining capacity: %d", &r.remaining_capacity);
 			}
 		}
-		/* charged */
-		/* thanks to Lukas Zapletal <lzap@seznam.cz> */
-		else if (strncmp(charging_state, "Charged", 64) == 0 || strncmp(charging_state, "Full", 64) == 0) {
-				/* Below happens with the second battery on my X40,
-				 * when the second one is empty and the first one
-				 * being charged. */
-				if (remaining_capacity == 0)
-					strcpy(last_battery_str[idx], "empty");
-				else
-					strcpy(last_battery_str[idx], "charged");
-		}
-		/* unknown, probably full / AC */
-		else {
-			if (acpi_last_full[idx] != 0
-			    && remaining_capacity != acpi_last_full[idx])
-				snprintf(last_battery_str[idx], 64, "unknown %d%%",
-					(int) (((float)remaining_capacity / acpi_last_full[idx]) * 100));
-			else
-				strncpy(last_battery_str[idx], "AC", 64);
-		}
-	} else if (acpi_bat_fp[idx] != NULL) {
-		/* ACPI */
-		int present_rate = -1;
-		int remaining_capacity = -1;
-		char charging_state[64];
-		char present[4];
+		fclose(fp);
+		r.present = strcmp(present, "no") != 0;
 
 		/* read last full capacity if it's zero */
-		if (acpi_last_full[idx] == 0) {
-			static int rep3 = 0;
-			char path[128];
-			FILE *fp;
+		if (acpi_last_full == 0) {
+			static int rep = 0;
 
-			snprintf(path, 127, ACPI_BATTERY_BASE_PATH "/%s/info", bat);
-			fp = open_file(path, &rep3);
+			fp = open_file((base + "/info").c_str(), &rep);
 			if (fp != NULL) {
 				while (!feof(fp)) {
 					char b[256];
@@ -1907,161 +3007,159 @@ void get_battery_stuff(char *buffer, unsigned int n, const char *bat, int item)
 					if (fgets(b, 256, fp) == NULL) {
 						break;
 					}
-					if (sscanf(b, "last full capacity: %d",
-								&acpi_last_full[idx]) != 0) {
+					if (sscanf(b, "last full capacity: %d", &acpi_last_full) != 0) {
 						break;
 					}
 				}
-
 				fclose(fp);
 			}
 		}
+		/* Hellf[i]re notes that remaining capacity can exceed acpi_last_full */
+		if (r.remaining_capacity > acpi_last_full) {
+			/* normalize to 100% */
+			acpi_last_full = r.remaining_capacity;
+		}
+		r.last_full = acpi_last_full;
+		return true;
+	}
 
-		fseek(acpi_bat_fp[idx], 0, SEEK_SET);
+	bool battery_cb::read_apm(battery_info &info)
+	{
+		unsigned int ac, status, flag;
+		int life;
+		FILE *fp;
+		int rc;
 
-		strcpy(charging_state, "unknown");
+		fp = open_file(APM_PATH, &apm_rep);
+		if (fp == NULL)
+			return false;
 
-		while (!feof(acpi_bat_fp[idx])) {
-			char buf[256];
+		rc = fscanf(fp, "%*s %*s %*x %x   %x       %x     %d%%", &ac, &status, &flag, &life);
+		fclose(fp);
+		if (rc <= 0)
+			return false;
 
-			if (fgets(buf, 256, acpi_bat_fp[idx]) == NULL) {
-				break;
-			}
+		if (life == -1) {
+			/* could check now that there is ac */
+			snprintf(info.status, 64, "AC");
 
-			/* let's just hope units are ok */
-			if (strncmp(buf, "present:", 8) == 0) {
-				sscanf(buf, "present: %4s", present);
-			} else if (strncmp(buf, "charging state:", 15) == 0) {
-				sscanf(buf, "charging state: %63s", charging_state);
-			} else if (strncmp(buf, "present rate:", 13) == 0) {
-				sscanf(buf, "present rate: %d", &present_rate);
-			} else if (strncmp(buf, "remaining capacity:", 19) == 0) {
-				sscanf(buf, "remaining capacity: %d", &remaining_capacity);
-			}
+		/* could check that status == 3 here? */
+		} else if (ac && life != 100) {
+			snprintf(info.status, 64, "charging %d%%", life);
+		} else {
+			snprintf(info.status, 64, "%d%%", life);
 		}
-		/* Hellf[i]re notes that remaining capacity can exceed acpi_last_full */
-		if (remaining_capacity > acpi_last_full[idx]) {
-			/* normalize to 100% */
-			acpi_last_full[idx] = remaining_capacity;
+		return true;
+	}
+
+	inline int battery_perct(const battery_reading &r)
+	{
+		if (r.last_full <= 0)
+			return 0;
+		return (int) (((float) r.remaining_capacity / r.last_full) * 100);
+	}
+
+	void battery_cb::work()
+	{
+		battery_info info;
+		battery_reading r;
+		int perct;
+
+		/* first try SYSFS if that fails try ACPI, then APM */
+		if (!read_sysfs(r) && !read_acpi(r)) {
+			read_apm(info);
+			std::lock_guard<std::mutex> lock(result_mutex);
+			result = info;
+			return;
 		}
 
+		/* Hellf[i]re notes that remaining capacity can exceed the last full capacity */
+		if (r.remaining_capacity > r.last_full)
+			r.last_full = r.remaining_capacity;  /* normalize to 100% */
+		perct = battery_perct(r);
+
 		/* not present */
-		if (strcmp(present, "no") == 0) {
-			strncpy(last_battery_str[idx], "not present", 64);
-			/* charging */
-		} else if (strcmp(charging_state, "charging") == 0) {
-			if (acpi_last_full[idx] != 0 && present_rate > 0) {
+		if (!r.present) {
+			strncpy(info.status, "not present", 64);
+		}
+		/* charging */
+		else if (strcasecmp(r.charging_state, "charging") == 0) {
+			if (r.last_full != 0 && r.present_rate > 0) {
 				/* e.g. charging 75% */
-				snprintf(last_battery_str[idx],
-						sizeof(last_battery_str[idx]) - 1, "charging %i%%",
-						(int) ((remaining_capacity * 100) / acpi_last_full[idx]));
+				snprintf(info.status, sizeof(info.status) - 1, "charging %i%%", perct);
 				/* e.g. 2h 37m */
-				format_seconds(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1,
-						(long) (((acpi_last_full[idx] - remaining_capacity) *
-								3600) / present_rate));
-			} else if (acpi_last_full[idx] != 0 && present_rate <= 0) {
-				snprintf(last_battery_str[idx],
-						sizeof(last_battery_str[idx]) - 1, "charging %d%%",
-						(int) ((remaining_capacity * 100) / acpi_last_full[idx]));
-				snprintf(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1, "unknown");
+				format_seconds(info.time, sizeof(info.time) - 1,
+						(long) (((float)(r.last_full - r.remaining_capacity) / r.present_rate) * 3600));
+			} else if (r.last_full != 0 && r.present_rate <= 0) {
+				snprintf(info.status, sizeof(info.status) - 1, "charging %d%%", perct);
+				snprintf(info.time, sizeof(info.time) - 1, "unknown");
 			} else {
-				strncpy(last_battery_str[idx], "charging",
-						sizeof(last_battery_str[idx]) - 1);
-				snprintf(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1, "unknown");
+				strncpy(info.status, "charging", sizeof(info.status) - 1);
+				snprintf(info.time, sizeof(info.time) - 1, "unknown");
 			}
-			/* discharging */
-		} else if (strncmp(charging_state, "discharging", 64) == 0) {
-			if (present_rate > 0) {
+		}
+		/* discharging */
+		else if (strcasecmp(r.charging_state, "discharging") == 0) {
+			if (r.present_rate > 0) {
 				/* e.g. discharging 35% */
-				snprintf(last_battery_str[idx],
-						sizeof(last_battery_str[idx]) - 1, "discharging %i%%",
-						(int) ((remaining_capacity * 100) / acpi_last_full[idx]));
+				snprintf(info.status, sizeof(info.status) - 1, "discharging %i%%", perct);
 				/* e.g. 1h 12m */
-				format_seconds(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1,
-						(long) ((remaining_capacity * 3600) / present_rate));
-			} else if (present_rate == 0) {	/* Thanks to Nexox for this one */
-				snprintf(last_battery_str[idx],
-						sizeof(last_battery_str[idx]) - 1, "full");
-				snprintf(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1, "unknown");
+				format_seconds(info.time, sizeof(info.time) - 1,
+						(long) (((float) r.remaining_capacity / r.present_rate) * 3600));
+			} else if (r.present_rate == 0) { /* Thanks to Nexox for this one */
+				snprintf(info.status, sizeof(info.status) - 1, "full");
+				snprintf(info.time, sizeof(info.time) - 1, "unknown");
 			} else {
-				snprintf(last_battery_str[idx],
-						sizeof(last_battery_str[idx]) - 1, "discharging %d%%",
-						(int) ((remaining_capacity * 100) / acpi_last_full[idx]));
-				snprintf(last_battery_time_str[idx],
-						sizeof(last_battery_time_str[idx]) - 1, "unknown");
+				snprintf(info.status, sizeof(info.status) - 1, "discharging %d%%", perct);
+				snprintf(info.time, sizeof(info.time) - 1, "unknown");
 			}
-			/* charged */
-		} else if (strncmp(charging_state, "charged", 64) == 0) {
-			/* thanks to Lukas Zapletal <lzap@seznam.cz> */
+		}
+		/* charged */
+		/* thanks to Lukas Zapletal <lzap@seznam.cz> */
+		else if (strcasecmp(r.charging_state, "charged") == 0
+				|| strcmp(r.charging_state, "Full") == 0) {
 			/* Below happens with the second battery on my X40,
-			 * when the second one is empty and the first one being charged. */
-			if (remaining_capacity == 0) {
-				strcpy(last_battery_str[idx], "empty");
-			} else {
-				strcpy(last_battery_str[idx], "charged");
-			}
-			/* unknown, probably full / AC */
-		} else {
-			if (strncmp(charging_state, "Full", 64) == 0) {
-				strncpy(last_battery_str[idx], "full", 64);
-			} else if (acpi_last_full[idx] != 0
-					&& remaining_capacity != acpi_last_full[idx]) {
-				snprintf(last_battery_str[idx], 64, "unknown %d%%",
-						(int) ((remaining_capacity * 100) / acpi_last_full[idx]));
-			} else {
-				strncpy(last_battery_str[idx], "AC", 64);
-			}
+			 * when the second one is empty and the first one
+			 * being charged. */
+			if (r.remaining_capacity == 0)
+				strcpy(info.status, "empty");
+			else
+				strcpy(info.status, "charged");
 		}
-		fclose(acpi_bat_fp[idx]);
-		acpi_bat_fp[idx] = NULL;
-	} else {
-		/* APM */
-		if (apm_bat_fp[idx] == NULL) {
-			apm_bat_fp[idx] = open_file(APM_PATH, &rep2);
+		/* unknown, probably full / AC */
+		else {
+			if (r.last_full != 0 && r.remaining_capacity != r.last_full)
+				snprintf(info.status, 64, "unknown %d%%", perct);
+			else
+				strncpy(info.status, "AC", 64);
 		}
 
-		if (apm_bat_fp[idx] != NULL) {
-			unsigned int ac, status, flag;
-			int life;
-
-			if (fscanf(apm_bat_fp[idx], "%*s %*s %*x %x   %x       %x     %d%%",
-			           &ac, &status, &flag, &life) <= 0)
-				goto read_bat_fp_end;
+		if (r.remaining_capacity >= 0)
+			info.perct = std::min(perct, 100);
 
-			if (life == -1) {
-				/* could check now that there is ac */
-				snprintf(last_battery_str[idx], 64, "AC");
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result = info;
+	}
 
-			/* could check that status == 3 here? */
-			} else if (ac && life != 100) {
-				snprintf(last_battery_str[idx], 64, "charging %d%%", life);
-			} else {
-				snprintf(last_battery_str[idx], 64, "%d%%", life);
-			}
+	battery_info get_battery_info(const char *bat)
+	{
+		/* don't update battery too often */
+		uint32_t period = std::max(lround(30 / active_update_interval()), 1l);
 
-read_bat_fp_end:
-			/* it seemed to buffer it so file must be closed (or could use
-			 * syscalls directly but I don't feel like coding it now) */
-			fclose(apm_bat_fp[idx]);
-			apm_bat_fp[idx] = NULL;
-		}
+		return conky::register_cb<battery_cb>(period, std::string(bat))->get_result_copy();
 	}
-	set_return_value(buffer, n, item, idx);
 }
 
-void set_return_value(char *buffer, unsigned int n, int item, int idx)
+void get_battery_stuff(char *buffer, unsigned int n, const char *bat, int item)
 {
+	battery_info info = get_battery_info(bat);
+
 	switch (item) {
 		case BATTERY_STATUS:
-			snprintf(buffer, n, "%s", last_battery_str[idx]);
+			snprintf(buffer, n, "%s", info.status);
 			break;
 		case BATTERY_TIME:
-			snprintf(buffer, n, "%s", last_battery_time_str[idx]);
+			snprintf(buffer, n, "%s", info.time);
 			break;
 		default:
 			break;
@@ -2071,7 +3169,10 @@ void set_return_value(char *buffer, unsigned int n, int item, int idx)
 void get_battery_short_status(char *buffer, unsigned int n, const char *bat)
 {
 	get_battery_stuff(buffer, n, bat, BATTERY_STATUS);
-	if (0 == strncmp("charging", buffer, 8)) {
+	/* not read yet */
+	if (!*buffer) {
+		return;
+	} else if (0 == strncmp("charging", buffer, 8)) {
 		buffer[0] = 'C';
 		memmove(buffer + 1, buffer + 8, n - 8);
 	} else if (0 == strncmp("discharging", buffer, 11)) {
@@ -2094,114 +3195,12 @@ void get_battery_short_status(char *buffer, unsigned int n, const char *bat)
 
 int get_battery_perct(const char *bat)
 {
-	static int rep = 0;
-	int idx;
-	char acpi_path[128];
-	char sysfs_path[128];
-	int remaining_capacity = -1;
-
-	snprintf(acpi_path, 127, ACPI_BATTERY_BASE_PATH "/%s/state", bat);
-	snprintf(sysfs_path, 127, SYSFS_BATTERY_BASE_PATH "/%s/uevent", bat);
-
-	init_batteries();
-
-	idx = get_battery_idx(bat);
-
-	/* don't update battery too often */
-	if (current_update_time - last_battery_perct_time[idx] < 30) {
-		return last_battery_perct[idx];
-	}
-	last_battery_perct_time[idx] = current_update_time;
-
-	/* Only check for SYSFS or ACPI */
-
-	if (sysfs_bat_fp[idx] == NULL && acpi_bat_fp[idx] == NULL && apm_bat_fp[idx] == NULL) {
-		sysfs_bat_fp[idx] = open_file(sysfs_path, &rep);
-		rep = 0;
-	}
-
-	if (sysfs_bat_fp[idx] == NULL && acpi_bat_fp[idx] == NULL && apm_bat_fp[idx] == NULL) {
-		acpi_bat_fp[idx] = open_file(acpi_path, &rep);
-	}
-
-	if (sysfs_bat_fp[idx] != NULL) {
-		/* SYSFS */
-		while (!feof(sysfs_bat_fp[idx])) {
-			char buf[256];
-			if (fgets(buf, 256, sysfs_bat_fp[idx]) == NULL)
-				break;
-
-			if (strncmp(buf, "POWER_SUPPLY_CHARGE_NOW=", 24) == 0) {
-				sscanf(buf, "POWER_SUPPLY_CHARGE_NOW=%d", &remaining_capacity);
-			} else if (strncmp(buf, "POWER_SUPPLY_CHARGE_FULL=",25) == 0) {
-				sscanf(buf, "POWER_SUPPLY_CHARGE_FULL=%d", &acpi_design_capacity[idx]);
-			} else if (strncmp(buf, "POWER_SUPPLY_ENERGY_NOW=", 24) == 0) {
-				sscanf(buf, "POWER_SUPPLY_ENERGY_NOW=%d", &remaining_capacity);
-			} else if (strncmp(buf, "POWER_SUPPLY_ENERGY_FULL=",25) == 0) {
-				sscanf(buf, "POWER_SUPPLY_ENERGY_FULL=%d", &acpi_design_capacity[idx]);
-			}
-		}
-
-		fclose(sysfs_bat_fp[idx]);
-		sysfs_bat_fp[idx] = NULL;
-
-	} else if (acpi_bat_fp[idx] != NULL) {
-		/* ACPI */
-		/* read last full capacity if it's zero */
-		if (acpi_design_capacity[idx] == 0) {
-			static int rep2;
-			char path[128];
-			FILE *fp;
-
-			snprintf(path, 127, ACPI_BATTERY_BASE_PATH "/%s/info", bat);
-			fp = open_file(path, &rep2);
-			if (fp != NULL) {
-				while (!feof(fp)) {
-					char b[256];
-
-					if (fgets(b, 256, fp) == NULL) {
-						break;
-					}
-					if (sscanf(b, "last full capacity: %d",
-								&acpi_design_capacity[idx]) != 0) {
-						break;
-					}
-				}
-				fclose(fp);
-			}
-		}
-
-		fseek(acpi_bat_fp[idx], 0, SEEK_SET);
-
-		while (!feof(acpi_bat_fp[idx])) {
-			char buf[256];
-
-			if (fgets(buf, 256, acpi_bat_fp[idx]) == NULL) {
-				break;
-			}
-
-			if (buf[0] == 'r') {
-				sscanf(buf, "remaining capacity: %d", &remaining_capacity);
-			}
-		}
-	}
-	if (remaining_capacity < 0) {
-		return 0;
-	}
-	/* compute the battery percentage */
-	last_battery_perct[idx] =
-		(int) (((float) remaining_capacity / acpi_design_capacity[idx]) * 100);
-	if (last_battery_perct[idx] > 100) last_battery_perct[idx] = 100;
-	return last_battery_perct[idx];
+	return get_battery_info(bat).perct;
 }
 
 double get_battery_perct_bar(struct text_object *obj)
 {
-	int idx;
-
-	get_battery_perct(obj->data.s);
-	idx = get_battery_idx(obj->data.s);
-	return last_battery_perct[idx];
+	return get_battery_perct(obj->data.s);
 }
 
 /* On Apple powerbook and ibook:
@@ -2337,16 +3336,14 @@ void get_powerbook_batt_info(struct text_object *obj, char *buffer, int n)
 
 int get_entropy_avail(unsigned int *val)
 {
-	static int rep = 0;
-	FILE *fp;
+	static proc_file entropy_file(ENTROPY_AVAIL_PATH, true);
+	const char *p;
 
-	if (!(fp = open_file(ENTROPY_AVAIL_PATH, &rep)))
+	if (!entropy_file.read())
 		return 1;
 
-	if (fscanf(fp, "%u", val) != 1)
-		return 1;
-
-	fclose(fp);
+	p = entropy_file.data();
+	*val = proc_scan_ull(p);
 	return 0;
 }
 
@@ -2354,19 +3351,168 @@ int get_entropy_avail(unsigned int *val)
 
 int get_entropy_poolsize(unsigned int *val)
 {
-	static int rep = 0;
-	FILE *fp;
-
-	if (!(fp = open_file(ENTROPY_POOLSIZE_PATH, &rep)))
-		return 1;
+	static proc_file poolsize_file(ENTROPY_POOLSIZE_PATH, true);
+	const char *p;
 
-	if (fscanf(fp, "%u", val) != 1)
+	if (!poolsize_file.read())
 		return 1;
 
-	fclose(fp);
+	p = poolsize_file.data();
+	*val = proc_scan_ull(p);
 	return 0;
 }
 
+/* the resources of /proc/pressure, and what of them ${pressure} shows */
+static const char *pressure_resources[] = { "cpu", "memory", "io" };
+enum { PRESSURE_AVG10, PRESSURE_AVG60, PRESSURE_AVG300, PRESSURE_TOTAL };
+
+struct pressure_s {
+	int resource;
+	/* the "full" line rather than "some" */
+	int full;
+	int field;
+	/* the file a trigger is registered on, -1 without one */
+	int trigger_fd;
+};
+
+/* the figures of a resource, read at most once per update for all the objects */
+struct pressure_values {
+	proc_file file;
+	double read_at;
+	/* [some, full][avg10, avg60, avg300, total] */
+	double value[2][4];
+
+	explicit pressure_values(const char *resource)
+		: file(std::string("/proc/pressure/") + resource), read_at(-1)
+	{}
+};
+
+static pressure_values *get_pressure(int resource)
+{
+	static pressure_values *values[3];
+	pressure_values *v = values[resource];
+	const char *line;
+
+	if (!v)
+		v = values[resource] = new pressure_values(pressure_resources[resource]);
+	if (v->read_at == current_update_time)
+		return v;
+	v->read_at = current_update_time;
+
+	/* some avg10=0.00 avg60=0.00 avg300=0.00 total=0 */
+	memset(v->value, 0, sizeof(v->value));
+	if (!v->file.read())
+		return NULL;
+	line = v->file.data();
+	do {
+		int kind = strncmp(line, "full", 4) == 0;
+
+		proc_skip_word(line);
+		for (int i = 0; i < 4; i++) {
+			while (*line == ' ')
+				line++;
+			while (*line && *line != '=' && *line != '\n')
+				line++;
+			if (*line != '=')
+				break;
+			line++;
+			v->value[kind][i] = proc_scan_double(line);
+		}
+	} while (proc_next_line(line));
+	return v;
+}
+
+/* ${pressure cpu|memory|io [some|full] [avg10|avg60|avg300|total] [stall window]}
+ * with a stall and a window in ms, a PSI trigger makes conky update as soon as
+ * the tasks stall for that long within a window */
+void parse_pressure_arg(struct text_object *obj, const char *arg)
+{
+	struct pressure_s *ps;
+	char resource[16] = "", kind[8] = "some", field[8] = "avg10";
+	unsigned int stall = 0, window = 2000;
+	int n;
+
+	obj->data.opaque = ps = (struct pressure_s *) calloc(1, sizeof(struct pressure_s));
+	ps->trigger_fd = -1;
+
+	n = sscanf(arg, "%15s %7s %7s %u %u", resource, kind, field, &stall, &window);
+	for (ps->resource = 0; ps->resource < 3; ps->resource++) {
+		if (strcmp(resource, pressure_resources[ps->resource]) == 0)
+			break;
+	}
+	if (n < 1 || ps->resource == 3) {
+		NORM_ERR("pressure: the resource must be cpu, memory or io");
+		free_and_zero(obj->data.opaque);
+		return;
+	}
+	ps->full = strcmp(kind, "full") == 0;
+	if (strcmp(field, "avg60") == 0)
+		ps->field = PRESSURE_AVG60;
+	else if (strcmp(field, "avg300") == 0)
+		ps->field = PRESSURE_AVG300;
+	else if (strcmp(field, "total") == 0)
+		ps->field = PRESSURE_TOTAL;
+	else
+		ps->field = PRESSURE_AVG10;
+
+	if (n >= 4 && stall > 0 && procfs_is_real()) {
+		char path[64], trigger[64];
+		int fd;
+
+		snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+		snprintf(trigger, sizeof(trigger), "%s %u %u", ps->full ? "full" : "some",
+				stall * 1000, window * 1000);
+		fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0 || write(fd, trigger, strlen(trigger) + 1) < 0) {
+			/* windows of unprivileged triggers must be multiples of 2 s */
+			NORM_ERR("pressure: can't set the trigger '%s' on %s: %s", trigger, path,
+					strerror(errno));
+			if (fd >= 0)
+				close(fd);
+		} else {
+			ps->trigger_fd = fd;
+			add_wake_fd(fd);
+		}
+	}
+}
+
+void print_pressure(struct text_object *obj, char *p, int p_max_size)
+{
+	struct pressure_s *ps = (struct pressure_s *) obj->data.opaque;
+	pressure_values *v;
+
+	if (!ps || !(v = get_pressure(ps->resource)))
+		return;
+
+	if (ps->field == PRESSURE_TOTAL)
+		snprintf(p, p_max_size, "%.0f", v->value[ps->full][ps->field]);
+	else
+		snprintf(p, p_max_size, "%.2f", v->value[ps->full][ps->field]);
+}
+
+double pressure_value(struct text_object *obj)
+{
+	struct pressure_s *ps = (struct pressure_s *) obj->data.opaque;
+	pressure_values *v;
+
+	if (!ps || !(v = get_pressure(ps->resource)))
+		return NAN;
+	return v->value[ps->full][ps->field];
+}
+
+void free_pressure(struct text_object *obj)
+{
+	struct pressure_s *ps = (struct pressure_s *) obj->data.opaque;
+
+	if (!ps)
+		return;
+	if (ps->trigger_fd >= 0) {
+		remove_wake_fd(ps->trigger_fd);
+		close(ps->trigger_fd);
+	}
+	free_and_zero(obj->data.opaque);
+}
+
 void print_disk_protect_queue(struct text_object *obj, char *p, int p_max_size)
 {
 	FILE *fp;
@@ -2390,78 +3536,141 @@ void print_disk_protect_queue(struct text_object *obj, char *p, int p_max_size)
 	snprintf(p, p_max_size, (state > 0) ? "frozen" : "free  ");
 }
 
-std::unordered_map<std::string, bool> dev_list;
+/* the whole disks which are summed up for the totals of $diskio, the entries
+ * of /sys/block without the virtual devices (LVM, network block devices, RAM
+ * disks, loopback and device mapper); their stat files stay open */
+static std::vector<std::pair<std::string, std::unique_ptr<proc_file>>> total_disks;
+static double total_disks_scanned;
+
+/* how often /sys/block is looked at again for disks that came or went */
+#define TOTAL_DISKS_RESCAN 30
 
-/* Same as sf #2942117 but memoized using a linked list */
-int is_disk(char *dev)
+static void scan_total_disks(void)
 {
-	std::string orig(dev);
-	std::string syspath("/sys/block/");
-	char *slash;
+	std::vector<std::pair<std::string, std::unique_ptr<proc_file>>> disks;
+	DIR *dir = opendir("/sys/block");
+	struct dirent *ent;
 
-	auto i = dev_list.find(orig);
-	if(i != dev_list.end())
-		return i->second;
+	if (!dir)
+		return;
+	while ((ent = readdir(dir))) {
+		std::string path = std::string("/sys/block/") + ent->d_name;
+		unsigned int major, minor;
+		FILE *fp;
+		int n;
 
-	while ((slash = strchr(dev, '/')))
-		*slash = '!';
-	syspath += dev;
+		if (ent->d_name[0] == '.')
+			continue;
+		if (!(fp = fopen((path + "/dev").c_str(), "r")))
+			continue;
+		n = fscanf(fp, "%u:%u", &major, &minor);
+		fclose(fp);
+		/* XXX: ignore devices which are part of a SW RAID (MD_MAJOR) */
+		if (n != 2 || major == LVM_BLK_MAJOR || major == NBD_MAJOR ||
+				major == RAMDISK_MAJOR || major == LOOP_MAJOR || major == DM_MAJOR)
+			continue;
 
-	return dev_list[orig] = !(access(syspath.c_str(), F_OK));
+		auto old = std::find_if(total_disks.begin(), total_disks.end(),
+				[ent](const std::pair<std::string, std::unique_ptr<proc_file>> &d)
+				{ return d.first == ent->d_name; });
+		if (old != total_disks.end())
+			disks.push_back(std::move(*old));
+		else
+			disks.push_back(std::make_pair(std::string(ent->d_name),
+					std::unique_ptr<proc_file>(new proc_file(path + "/stat", true))));
+	}
+	closedir(dir);
+	total_disks.swap(disks);
 }
 
-int update_diskio(void)
+/* the sectors read and written from a stat file of a block device, and its
+ * diskio_counters if there are any; disks have (at least) 11 fields there,
+ * with the sectors in the 3rd and 7th, old kernels give partitions only 4,
+ * with the sectors in the 2nd and 4th */
+static bool read_disk_stat(proc_file &f, unsigned long long &reads,
+		unsigned long long &writes, struct diskio_counters &c, bool &have_counters)
 {
-	FILE *fp;
-	static int rep = 0;
-	char buf[512], devbuf[64];
-	unsigned int major, minor;
+	unsigned long long val[11];
+	const char *p;
 	int col_count = 0;
+
+	if (!f.read())
+		return false;
+	p = f.data();
+	while (col_count < 11) {
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (!isdigit(*p))
+			break;
+		val[col_count++] = proc_scan_ull(p);
+	}
+
+	have_counters = col_count == 11;
+	if (have_counters) {
+		/* the 9th field is the number of requests in flight right now */
+		c.ios = val[0] + val[4];
+		c.ticks = val[3] + val[7];
+		c.io_ticks = val[9];
+		c.time_in_queue = val[10];
+	}
+	if (col_count >= 7) {
+		reads = val[2];
+		writes = val[6];
+	} else if (col_count == 4) {
+		reads = val[1];
+		writes = val[3];
+	} else {
+		return false;
+	}
+	return true;
+}
+
+int update_diskio(void)
+{
 	struct diskio_stat *cur;
-	unsigned int reads, writes;
-	unsigned int total_reads = 0, total_writes = 0;
+	unsigned long long reads, writes;
+	unsigned long long total_reads = 0, total_writes = 0;
+	struct diskio_counters c, total = diskio_counters();
+	unsigned int disks = 0;
+	bool have_counters;
+	double now = get_time();
 
 	stats.current = 0;
 	stats.current_read = 0;
 	stats.current_write = 0;
 
-	if (!(fp = open_file("/proc/diskstats", &rep))) {
-		return 0;
+	if (now - total_disks_scanned >= TOTAL_DISKS_RESCAN || now < total_disks_scanned) {
+		scan_total_disks();
+		total_disks_scanned = now;
 	}
 
-	/* read reads and writes from all disks (minor = 0), including cd-roms
-	 * and floppies, and sum them up */
-	while (fgets(buf, 512, fp)) {
-		col_count = sscanf(buf, "%u %u %s %*u %*u %u %*u %*u %*u %u", &major,
-			&minor, devbuf, &reads, &writes);
-		/* ignore subdevices (they have only 3 matching entries in their line)
-		 * and virtual devices (LVM, network block devices, RAM disks, Loopback)
-		 *
-		 * XXX: ignore devices which are part of a SW RAID (MD_MAJOR) */
-		if (col_count == 5 && major != LVM_BLK_MAJOR && major != NBD_MAJOR
-				&& major != RAMDISK_MAJOR && major != LOOP_MAJOR
-				&& major != DM_MAJOR) {
-			/* check needed for kernel >= 2.6.31, see sf #2942117 */
-			if (is_disk(devbuf)) {
-				total_reads += reads;
-				total_writes += writes;
-			}
-		} else {
-			col_count = sscanf(buf, "%u %u %s %*u %u %*u %u",
-				&major, &minor, devbuf, &reads, &writes);
-			if (col_count != 5) {
-				continue;
-			}
+	/* reads and writes of all disks, including cd-roms and floppies */
+	for (auto d = total_disks.begin(); d != total_disks.end(); ++d) {
+		if (!read_disk_stat(*d->second, reads, writes, c, have_counters))
+			continue;
+		total_reads += reads;
+		total_writes += writes;
+		if (have_counters) {
+			total.ios += c.ios;
+			total.ticks += c.ticks;
+			total.io_ticks += c.io_ticks;
+			total.time_in_queue += c.time_in_queue;
+			++disks;
 		}
-		cur = stats.next;
-		while (cur && strcmp(devbuf, cur->dev))
-			cur = cur->next;
+	}
 
-		if (cur)
-			update_diskio_values(cur, reads, writes);
+	/* and of the devices of $diskio objects */
+	for (cur = stats.next; cur; cur = cur->next) {
+		if (!cur->sysfs_stat ||
+				!read_disk_stat(*cur->sysfs_stat, reads, writes, c, have_counters))
+			continue;
+		update_diskio_values(cur, reads, writes);
+		if (have_counters)
+			update_diskio_counters(cur, c, 1);
 	}
 	update_diskio_values(&stats, total_reads, total_writes);
-	fclose(fp);
+	if (disks)
+		update_diskio_counters(&stats, total, disks);
 	return 0;
 }
 
@@ -2525,7 +3734,7 @@ static unsigned long long calc_cpu_total(void)
 	const char *template_ =
 		KFLAG_ISSET(KFLAG_IS_LONGSTAT) ? TMPL_LONGPROC : TMPL_SHORTPROC;
 
-	ps = open("/proc/stat", O_RDONLY);
+	ps = open(procfs_path("/proc/stat").c_str(), O_RDONLY);
 	rc = read(ps, line, BUFFER_LEN - 1);
 	close(ps);
 	if (rc < 0) {
@@ -2546,92 +3755,242 @@ static unsigned long long calc_cpu_total(void)
  * Calculate each processes cpu			  *
  ******************************************/
 
-inline static void calc_cpu_each(unsigned long long total)
+inline static void calc_cpu_each(unsigned long long total)
+{
+	float mul = 100.0;
+	if(top_cpu_separate.get(*state))
+		mul *= info.cpu_count;
+
+	for(struct process *p = first_process; p; p = p->next)
+		p->amount = mul * (p->user_time + p->kernel_time) / (float) total;
+}
+
+#ifdef BUILD_IOSTATS
+static void calc_io_each(void)
+{
+	struct process *p;
+	unsigned long long sum = 0;
+	double scale = update_delta_scale();
+
+	/* bytes per update interval, also with sample_interval */
+	for (p = first_process; p; p = p->next) {
+		p->read_bytes *= scale;
+		p->write_bytes *= scale;
+		sum += p->read_bytes + p->write_bytes;
+	}
+
+	if(sum == 0)
+		sum = 1; /* to avoid having NANs if no I/O occured */
+	for (p = first_process; p; p = p->next)
+		p->io_perc = 100.0 * (p->read_bytes + p->write_bytes) / (float) sum;
+}
+#endif /* BUILD_IOSTATS */
+
+/******************************************
+ * Extract information from /proc		  *
+ ******************************************/
+
+/* the first argument is procfs_root */
+#define PROCFS_TEMPLATE "%s/%d/stat"
+#define PROCFS_CMDLINE_TEMPLATE "%s/%d/cmdline"
+
+/* /proc/<pid>/stat files are kept open between updates, so that a single
+ * pread() per process and update is enough. To stay within the file
+ * descriptor limit, at most max_stat_fds() of them are open; above that,
+ * the least recently read ones are closed. While processes are parsed in
+ * parallel, another thread may be reading the least recently used file, so
+ * new files are then just read and closed instead.
+ * The list and the counter are protected by stat_lru_mutex. */
+static struct process *stat_lru_first = NULL, *stat_lru_last = NULL;
+static unsigned int stat_fds_open = 0;
+static bool stat_lru_parallel = false;
+static std::mutex stat_lru_mutex;
+
+static unsigned int max_stat_fds(void)
+{
+	static unsigned int max = 0;
+
+	if (max == 0) {
+		struct rlimit rl;
+
+		/* leave the other half to the rest of conky */
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+			max = rl.rlim_cur / 2;
+		else
+			max = 512;
+		if (max == 0)
+			max = 1;
+	}
+	return max;
+}
+
+static void stat_lru_unlink(struct process *p)
+{
+	if (p->lru_previous)
+		p->lru_previous->lru_next = p->lru_next;
+	else
+		stat_lru_first = p->lru_next;
+	if (p->lru_next)
+		p->lru_next->lru_previous = p->lru_previous;
+	else
+		stat_lru_last = p->lru_previous;
+	p->lru_next = p->lru_previous = NULL;
+}
+
+static void stat_lru_push(struct process *p)
+{
+	p->lru_previous = NULL;
+	p->lru_next = stat_lru_first;
+	if (stat_lru_first)
+		stat_lru_first->lru_previous = p;
+	else
+		stat_lru_last = p;
+	stat_lru_first = p;
+}
+
+/* to be called with stat_lru_mutex locked */
+static void process_close_stat_locked(struct process *p)
+{
+	if (p->stat_fd < 0)
+		return;
+
+	stat_lru_unlink(p);
+	close(p->stat_fd);
+	p->stat_fd = -1;
+	--stat_fds_open;
+}
+
+static void process_close_stat(struct process *p)
 {
-	float mul = 100.0;
-	if(top_cpu_separate.get(*state))
-		mul *= info.cpu_count;
+	std::lock_guard<std::mutex> lock(stat_lru_mutex);
+	process_close_stat_locked(p);
+}
 
-	for(struct process *p = first_process; p; p = p->next)
-		p->amount = mul * (p->user_time + p->kernel_time) / (float) total;
+void process_close_files(struct process *p)
+{
+	process_close_stat(p);
+	free_and_zero(p->comm);
 }
 
-#ifdef BUILD_IOSTATS
-static void calc_io_each(void)
+static int process_read_stat_file(struct process *process, char *line, int len,
+		struct stat *st)
 {
-	struct process *p;
-	unsigned long long sum = 0;
+	char filename[BUFFER_LEN];
+	int fd, rc;
+	bool keep;
+
+	if (process->stat_fd >= 0) {
+		rc = pread(process->stat_fd, line, len, 0);
+		if (rc > 0 && fstat(process->stat_fd, st) == 0) {
+			std::lock_guard<std::mutex> lock(stat_lru_mutex);
+			stat_lru_unlink(process);
+			stat_lru_push(process);
+			return rc;
+		}
+		/* the process died, and possibly its pid got reused since */
+		process_close_files(process);
+	}
 
-	for (p = first_process; p; p = p->next)
-		sum += p->read_bytes + p->write_bytes;
+	snprintf(filename, sizeof(filename), PROCFS_TEMPLATE,
+			procfs_root.c_str(), process->pid);
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
 
-	if(sum == 0)
-		sum = 1; /* to avoid having NANs if no I/O occured */
-	for (p = first_process; p; p = p->next)
-		p->io_perc = 100.0 * (p->read_bytes + p->write_bytes) / (float) sum;
-}
-#endif /* BUILD_IOSTATS */
+	{
+		std::lock_guard<std::mutex> lock(stat_lru_mutex);
+		if (stat_fds_open >= max_stat_fds() && !stat_lru_parallel)
+			process_close_stat_locked(stat_lru_last);
+		keep = stat_fds_open < max_stat_fds();
+		if (keep) {
+			process->stat_fd = fd;
+			++stat_fds_open;
+			stat_lru_push(process);
+		}
+	}
 
-/******************************************
- * Extract information from /proc		  *
- ******************************************/
+	rc = pread(fd, line, len, 0);
+	if (rc <= 0 || fstat(fd, st) != 0)
+		rc = -1;
 
-#define PROCFS_TEMPLATE "/proc/%d/stat"
-#define PROCFS_CMDLINE_TEMPLATE "/proc/%d/cmdline"
+	if (!keep)
+		close(fd);
+	else if (rc < 0)
+		process_close_files(process);
+	return rc;
+}
 
-/* These are the guts that extract information out of /proc.
- * Anyone hoping to port wmtop should look here first. */
-static void process_parse_stat(struct process *process)
+/* read /proc/<pid>/stat of the process into line and stat() it, returns the
+ * number of bytes read or -1 if the process is gone */
+static int process_read_stat(struct process *process, char *line, int len,
+		struct stat *st)
 {
-	char line[BUFFER_LEN] = { 0 }, filename[BUFFER_LEN], procname[BUFFER_LEN];
-	char cmdline[BUFFER_LEN] = { 0 }, cmdline_filename[BUFFER_LEN], cmdline_procname[BUFFER_LEN];
-	char tmpstr[BUFFER_LEN] = { 0 };
-	char state[4];
-	int ps, cmdline_ps;
-	unsigned long user_time = 0;
-	unsigned long kernel_time = 0;
+	char filename[BUFFER_LEN];
 	int rc;
-	char *r, *q;
-	int endl;
-	int nice_val;
-	char *lparen, *rparen;
-	struct stat process_stat;
 
-	snprintf(filename, sizeof(filename), PROCFS_TEMPLATE, process->pid);
-	snprintf(cmdline_filename, sizeof(cmdline_filename), PROCFS_CMDLINE_TEMPLATE, process->pid);
+	if (replaying_samples) {
+		std::string sample;
+		uid_t uid;
 
-	ps = open(filename, O_RDONLY);
-	if (ps < 0) {
-		/* The process must have finished in the last few jiffies! */
-		return;
+		snprintf(filename, sizeof(filename), PROCFS_TEMPLATE,
+				procfs_root.c_str(), process->pid);
+		if (!replay_sample(filename, &sample, &uid) || sample.empty())
+			return -1;
+		rc = MIN((int) sample.size(), len);
+		memcpy(line, sample.data(), rc);
+		st->st_uid = uid;
+		return rc;
 	}
 
-	if (fstat(ps, &process_stat) != 0)
-		return;
-	process->uid=process_stat.st_uid;
+	rc = process_read_stat_file(process, line, len, st);
+	if (rc > 0 && recording_samples) {
+		snprintf(filename, sizeof(filename), PROCFS_TEMPLATE,
+				procfs_root.c_str(), process->pid);
+		record_sample(filename, line, rc, st->st_uid);
+	}
+	return rc;
+}
 
-	/* Mark process as up-to-date. */
-	process->time_stamp = g_time;
+/* derive the name of the process with the command procname from
+ * /proc/<pid>/cmdline, returns 0 if the process is gone */
+static int process_parse_cmdline(struct process *process, char *procname)
+{
+	char cmdline[BUFFER_LEN] = { 0 }, cmdline_filename[BUFFER_LEN], cmdline_procname[BUFFER_LEN];
+	char line[BUFFER_LEN] = { 0 }, tmpstr[BUFFER_LEN] = { 0 };
+	int cmdline_ps, endl;
+	char *r, *q;
 
-	rc = read(ps, line, BUFFER_LEN - 1);
-	close(ps);
-	if (rc < 0) {
-		return;
-	}
+	snprintf(cmdline_filename, sizeof(cmdline_filename), PROCFS_CMDLINE_TEMPLATE,
+			procfs_root.c_str(), process->pid);
 
 	/* Read /proc/<pid>/cmdline */
-	cmdline_ps = open(cmdline_filename, O_RDONLY);
-	if (cmdline_ps < 0) {
-		/* The process must have finished in the last few jiffies! */
-		return;
-	}
+	if (replaying_samples) {
+		std::string sample;
 
-	endl = read(cmdline_ps, cmdline, BUFFER_LEN - 1);
-	close(cmdline_ps);
-	if (endl < 0) {
-		return;
+		if (!replay_sample(cmdline_filename, &sample))
+			return 0;
+		endl = MIN((int) sample.size(), BUFFER_LEN - 1);
+		memcpy(cmdline, sample.data(), endl);
+	} else {
+		cmdline_ps = open(cmdline_filename, O_RDONLY);
+		if (cmdline_ps < 0) {
+			/* The process must have finished in the last few jiffies! */
+			return 0;
+		}
+
+		endl = read(cmdline_ps, cmdline, BUFFER_LEN - 1);
+		close(cmdline_ps);
+		if (endl < 0) {
+			return 0;
+		}
+		if (recording_samples)
+			record_sample(cmdline_filename, cmdline, endl);
 	}
 
+	/* keep the raw contents for the kdeinit check below */
+	memcpy(line, cmdline, endl);
+	line[endl] = 0;
+
 	/* Some processes have null-separated arguments, let's fix it */
 	for(int i = 0; i < endl; i++)
 		if (cmdline[i] == 0)
@@ -2667,47 +4026,11 @@ static void process_parse_stat(struct process *process)
 		cmdline_procname[BUFFER_LEN - slash_pos] = 0;
 	}
 
-	/* Extract cpu times from data in /proc filesystem */
-	lparen = strchr(line, '(');
-	rparen = strrchr(line, ')');
-	if(!lparen || !rparen || rparen < lparen)
-		return; // this should not happen
-
-	rc = MIN((unsigned)(rparen - lparen - 1), sizeof(procname) - 1);
-	strncpy(procname, lparen + 1, rc);
-	procname[rc] = '\0';
-
 	if (strlen(procname) < strlen(cmdline_procname))
 		strncpy(procname, cmdline_procname, strlen(cmdline_procname)+1);
 
-	rc = sscanf(rparen + 1, "%3s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %lu "
-			"%lu %*s %*s %*s %d %*s %*s %*s %llu %llu", state, &process->user_time,
-			&process->kernel_time, &nice_val, &process->vsize, &process->rss);
-	if (rc < 6) {
-		NORM_ERR("scaning data for %s failed, got only %d fields", procname, rc);
-		return;
-	}
-
-	if(state[0]=='R')
-		++ info.run_procs;
-
 	/* remove any "kdeinit: " */
 	if (procname == strstr(procname, "kdeinit")) {
-		snprintf(filename, sizeof(filename), PROCFS_CMDLINE_TEMPLATE,
-				process->pid);
-
-		ps = open(filename, O_RDONLY);
-		if (ps < 0) {
-			/* The process must have finished in the last few jiffies! */
-			return;
-		}
-
-		endl = read(ps, line, BUFFER_LEN - 1);
-		close(ps);
-		if(endl < 0)
-			return;
-		line[endl] = 0;
-
 		/* account for "kdeinit: " */
 		if ((char *) line == strstr(line, "kdeinit: ")) {
 			r = ((char *) line) + 9;
@@ -2723,8 +4046,107 @@ static void process_parse_stat(struct process *process)
 		*q = 0;
 	}
 
-	free_and_zero(process->name);
-	process->name = strndup(procname, text_buffer_size.get(*::state));
+	return 1;
+}
+
+/* the length process names are cut to, text_buffer_size can't be read from
+ * the threads parsing the processes */
+static size_t proc_name_len = DEFAULT_TEXT_BUFFER_SIZE;
+
+void process_resolve_name(struct process *process)
+{
+	char procname[BUFFER_LEN];
+
+	if (process->name || !process->comm)
+		return;
+
+	/* if the process is gone by now, the name from stat has to do */
+	strncpy(procname, process->comm, BUFFER_LEN - 1);
+	procname[BUFFER_LEN - 1] = 0;
+	process_parse_cmdline(process, procname);
+	process_set_name(process, strndup(procname, proc_name_len));
+}
+
+/* These are the guts that extract information out of /proc.
+ * Anyone hoping to port wmtop should look here first.
+ * Returns 1 if the process is running. */
+static int process_parse_stat_line(struct process *process, const char *line,
+		uid_t uid);
+
+int process_parse_stat(struct process *process)
+{
+	char line[BUFFER_LEN] = { 0 };
+	int rc;
+	struct stat process_stat;
+
+	rc = process_read_stat(process, line, BUFFER_LEN - 1, &process_stat);
+	if (rc < 0) {
+		/* The process must have finished in the last few jiffies! */
+		return 0;
+	}
+	line[rc] = 0;
+	return process_parse_stat_line(process, line, process_stat.st_uid);
+}
+
+/* parse the contents of /proc/<pid>/stat of the process, owned by uid */
+static int process_parse_stat_line(struct process *process, const char *line,
+		uid_t uid)
+{
+	char procname[BUFFER_LEN];
+	char state[4];
+	unsigned long user_time = 0;
+	unsigned long kernel_time = 0;
+	int rc;
+	int nice_val;
+	unsigned long long starttime = 0;
+	const char *lparen, *rparen;
+
+	process->uid = uid;
+
+	/* Mark process as up-to-date. */
+	process->time_stamp = g_time;
+
+	/* Extract cpu times from data in /proc filesystem */
+	lparen = strchr(line, '(');
+	rparen = strrchr(line, ')');
+	if(!lparen || !rparen || rparen < lparen)
+		return 0; // this should not happen
+
+	rc = MIN((unsigned)(rparen - lparen - 1), sizeof(procname) - 1);
+	strncpy(procname, lparen + 1, rc);
+	procname[rc] = '\0';
+
+	rc = sscanf(rparen + 1, "%3s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %lu "
+			"%lu %*s %*s %*s %d %*s %*s %llu %llu %llu", state, &process->user_time,
+			&process->kernel_time, &nice_val, &starttime, &process->vsize,
+			&process->rss);
+	if (rc < 7) {
+		NORM_ERR("scaning data for %s failed, got only %d fields", procname, rc);
+		return 0;
+	}
+
+	if (process->starttime != starttime) {
+		/* a new process got the pid of one we knew */
+		if (process->starttime != 0) {
+			process->previous_user_time = ULONG_MAX;
+			process->previous_kernel_time = ULONG_MAX;
+#ifdef BUILD_IOSTATS
+			process->previous_read_bytes = ULLONG_MAX;
+			process->previous_write_bytes = ULLONG_MAX;
+#endif /* BUILD_IOSTATS */
+		}
+		process->starttime = starttime;
+		free_and_zero(process->comm);
+	}
+
+	/* The name is only derived from the cmdline when someone asks for it, see
+	 * process_resolve_name(). It is kept until the process exec()s. */
+	if (!process->comm || strcmp(process->comm, procname)) {
+		free_and_zero(process->comm);
+		process_set_name(process, NULL);
+		process->comm = strdup(procname);
+	}
+
 	process->rss *= getpagesize();
 
 	process->total_cpu_time = process->user_time + process->kernel_time;
@@ -2753,10 +4175,12 @@ static void process_parse_stat(struct process *process)
 	/* store only the difference of the user_time here... */
 	process->user_time = user_time;
 	process->kernel_time = kernel_time;
+
+	return state[0] == 'R';
 }
 
 #ifdef BUILD_IOSTATS
-#define PROCFS_TEMPLATE_IO "/proc/%d/io"
+#define PROCFS_TEMPLATE_IO "%s/%d/io"
 static void process_parse_io(struct process *process)
 {
 	static const char *read_bytes_str="read_bytes:";
@@ -2768,7 +4192,8 @@ static void process_parse_io(struct process *process)
 	char *pos, *endpos;
 	unsigned long long read_bytes, write_bytes;
 
-	snprintf(filename, sizeof(filename), PROCFS_TEMPLATE_IO, process->pid);
+	snprintf(filename, sizeof(filename), PROCFS_TEMPLATE_IO,
+			procfs_root.c_str(), process->pid);
 
 	ps = open(filename, O_RDONLY);
 	if (ps < 0) {
@@ -2811,6 +4236,10 @@ static void process_parse_io(struct process *process)
 	if (process->previous_write_bytes == ULLONG_MAX) {
 		process->previous_write_bytes = process->write_bytes;
 	}
+	if (process->previous_read_bytes > process->read_bytes)
+		process->previous_read_bytes = process->read_bytes;
+	if (process->previous_write_bytes > process->write_bytes)
+		process->previous_write_bytes = process->write_bytes;
 
 	/* store the difference of the byte counts */
 	read_bytes = process->read_bytes - process->previous_read_bytes;
@@ -2824,6 +4253,21 @@ static void process_parse_io(struct process *process)
 	process->read_bytes = read_bytes;
 	process->write_bytes = write_bytes;
 }
+
+/* /proc/<pid>/io costs another open() per process, so it is only read while
+ * there is a top_io list, and only for the processes that can make it in:
+ * those that got cpu time since the last update (issuing I/O takes some),
+ * those in the list last time (so they can drop out of it again) and new
+ * ones (for their first count). The bytes of skipped updates end up in the
+ * next read. */
+static inline bool process_wants_io(struct process *process)
+{
+	if (!top_io)
+		return false;
+	return process->user_time || process->kernel_time ||
+		process->previous_read_bytes == ULLONG_MAX ||
+		process->io_ranked + 1 == g_time;
+}
 #endif /* BUILD_IOSTATS */
 
 /******************************************
@@ -2831,14 +4275,27 @@ static void process_parse_io(struct process *process)
  ******************************************/
 
 /* This function seems to hog all of the CPU time.
- * I can't figure out why - it doesn't do much. */
-static void calculate_stats(struct process *process)
+ * I can't figure out why - it doesn't do much.
+ * Returns 1 if the process is running. */
+static int calculate_stats(struct process *process, const char *line = NULL,
+		uid_t uid = 0)
 {
-	/* compute each process cpu usage by reading /proc/<proc#>/stat */
-	process_parse_stat(process);
+	/* compute each process cpu usage by reading /proc/<proc#>/stat, unless
+	 * the caller already did */
+	int running = line ? process_parse_stat_line(process, line, uid) :
+		process_parse_stat(process);
+
+	/* if_running looks processes up by name */
+	if (top_running)
+		process_resolve_name(process);
 
 #ifdef BUILD_IOSTATS
-	process_parse_io(process);
+	if (process_wants_io(process)) {
+		process_parse_io(process);
+	} else {
+		process->read_bytes = 0;
+		process->write_bytes = 0;
+	}
 #endif /* BUILD_IOSTATS */
 
 	/*
@@ -2847,22 +4304,353 @@ static void calculate_stats(struct process *process)
 	/* if (process->counted && exclusion_expression &&
 	 * !regexec(exclusion_expression, process->name, 0, 0, 0))
 	 * process->counted = 0; */
+
+	return running;
+}
+
+/* processes are parsed in parallel in batches of at least this size */
+#define PROCESS_BATCH_SIZE 256
+
+/* the stat files kept open are read (and statx()ed for the uid) in batches of
+ * this many processes */
+#define STAT_READ_BATCH 128
+
+static void calculate_stats_batch(struct process **begin, struct process **end,
+		unsigned short *running)
+{
+	unsigned short n = 0;
+	std::vector<struct proc_batch_op> ops;
+	std::vector<struct statx> stx;
+	std::vector<char> lines;
+
+	/* samples are read and written by process_read_stat() */
+	if (replaying_samples || recording_samples) {
+		for (; begin != end; ++begin)
+			n += calculate_stats(*begin);
+		*running = n;
+		return;
+	}
+
+	stx.resize(STAT_READ_BATCH);
+	lines.resize(STAT_READ_BATCH * BUFFER_LEN);
+	while (begin != end) {
+		struct process **chunk_end = begin +
+			std::min<ptrdiff_t>(end - begin, STAT_READ_BATCH);
+		size_t j = 0;
+
+		/* only this thread touches the fds of its processes, and none are
+		 * evicted while parsing in parallel */
+		ops.clear();
+		for (struct process **p = begin; p != chunk_end; ++p) {
+			size_t i = p - begin;
+
+			if ((*p)->stat_fd < 0)
+				continue;
+			ops.push_back({ (*p)->stat_fd, &lines[i * BUFFER_LEN],
+					BUFFER_LEN - 1, NULL, 0 });
+			ops.push_back({ (*p)->stat_fd, NULL, 0, &stx[i], 0 });
+		}
+		proc_batch_run(ops.data(), ops.size());
+
+		for (struct process **p = begin; p != chunk_end; ++p) {
+			size_t i = p - begin;
+
+			if ((*p)->stat_fd < 0) {
+				n += calculate_stats(*p);
+				continue;
+			}
+			if (ops[j].res <= 0 || ops[j + 1].res != 0) {
+				/* the process died, process_read_stat_file() sorts it out */
+				n += calculate_stats(*p);
+				j += 2;
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lock(stat_lru_mutex);
+				stat_lru_unlink(*p);
+				stat_lru_push(*p);
+			}
+			lines[i * BUFFER_LEN + ops[j].res] = '\0';
+			n += calculate_stats(*p, &lines[i * BUFFER_LEN], stx[i].stx_uid);
+			j += 2;
+		}
+		begin = chunk_end;
+	}
+	*running = n;
+}
+
+/* Parse the processes and count the running ones. Each thread works on its
+ * own slice of processes, only the file descriptor cache is shared. */
+static void calculate_stats_all(std::vector<struct process *> &procs)
+{
+	size_t batches = (procs.size() + PROCESS_BATCH_SIZE - 1) / PROCESS_BATCH_SIZE;
+	batches = std::min<size_t>(batches, std::max(std::thread::hardware_concurrency(), 1u));
+	batches = std::max<size_t>(batches, 1);
+
+	std::vector<unsigned short> running(batches, 0);
+	std::vector<std::thread> threads;
+	struct process **first = procs.data();
+
+	proc_name_len = text_buffer_size.get(*state);
+	stat_lru_parallel = batches > 1;
+
+	for (size_t i = 1; i < batches; i++) {
+		threads.push_back(std::thread([=, &running] {
+					conky::setup_worker_thread("conky-top");
+					calculate_stats_batch(first + procs.size() * i / batches,
+							first + procs.size() * (i + 1) / batches, &running[i]);
+				}));
+	}
+	calculate_stats_batch(first, first + procs.size() / batches, &running[0]);
+	for (auto i = threads.begin(); i != threads.end(); ++i)
+		i->join();
+
+	stat_lru_parallel = false;
+	info.run_procs = 0;
+	for (auto i = running.begin(); i != running.end(); ++i)
+		info.run_procs += *i;
+}
+
+#ifdef BUILD_PROC_CONNECTOR
+/******************************************
+ * Process events from the proc connector *
+ ******************************************/
+
+/* The kernel announces every new process on the proc connector, so /proc
+ * only needs to be listed once, and again whenever events were lost.
+ * Processes which exited are found by their stat file no longer being
+ * readable. Listening needs CAP_NET_ADMIN; if it can't be done, the /proc
+ * listing is used on every update as usual. */
+static int proc_cn_fd = -1;
+static bool proc_cn_failed = false;
+static bool proc_cn_rescan = true;
+
+static void proc_cn_close(const char *what)
+{
+	NORM_ERR("proc connector: %s failed: %s, scanning /proc instead", what,
+			strerror(errno));
+	if (proc_cn_fd >= 0)
+		close(proc_cn_fd);
+	proc_cn_fd = -1;
+	proc_cn_failed = true;
 }
 
+static void proc_cn_open(void)
+{
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+	struct cn_msg *cn = (struct cn_msg *) NLMSG_DATA(nlh);
+	struct sockaddr_nl addr;
+
+	proc_cn_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_CONNECTOR);
+	if (proc_cn_fd < 0) {
+		proc_cn_close("socket()");
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	if (bind(proc_cn_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		proc_cn_close("bind()");
+		return;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(enum proc_cn_mcast_op);
+	*(enum proc_cn_mcast_op *) cn->data = PROC_CN_MCAST_LISTEN;
+	if (send(proc_cn_fd, buf, nlh->nlmsg_len, 0) < 0) {
+		proc_cn_close("send()");
+		return;
+	}
+	proc_cn_rescan = true;
+}
+
+static void proc_cn_handle(const struct proc_event *ev)
+{
+	switch (ev->what) {
+		case proc_event::PROC_EVENT_FORK:
+			/* only processes show up in /proc, not their threads */
+			if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+				get_process(ev->event_data.fork.child_tgid);
+			break;
+		case proc_event::PROC_EVENT_NONE:
+			/* the answer to PROC_CN_MCAST_LISTEN */
+			if (ev->event_data.ack.err != 0) {
+				errno = ev->event_data.ack.err;
+				proc_cn_close("PROC_CN_MCAST_LISTEN");
+			}
+			break;
+		default:
+			/* exec() is noticed by the changing name, exit() by the
+			 * process' stat file going away */
+			break;
+	}
+}
+
+/* read the pending events, returns false if /proc has to be listed */
+static bool proc_cn_update(void)
+{
+	union {
+		struct nlmsghdr nlh;
+		char buf[8192];
+	} msg;
+	int len;
+
+	if (proc_cn_failed)
+		return false;
+	if (proc_cn_fd < 0)
+		proc_cn_open();
+
+	while (proc_cn_fd >= 0) {
+		len = recv(proc_cn_fd, msg.buf, sizeof(msg.buf), 0);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				/* we were too slow and lost some events */
+				proc_cn_rescan = true;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				proc_cn_close("recv()");
+			break;
+		}
+
+		for (struct nlmsghdr *nlh = &msg.nlh; NLMSG_OK(nlh, len);
+				nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_NOOP || nlh->nlmsg_type == NLMSG_ERROR)
+				continue;
+
+			struct cn_msg *cn = (struct cn_msg *) NLMSG_DATA(nlh);
+			if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+				continue;
+			proc_cn_handle((const struct proc_event *) cn->data);
+		}
+	}
+
+	if (proc_cn_fd < 0 || proc_cn_rescan) {
+		proc_cn_rescan = false;
+		return false;
+	}
+	return true;
+}
+#endif /* BUILD_PROC_CONNECTOR */
+
+#ifdef BUILD_BPF
+static conky::simple_config_setting<bool> top_bpf("top_bpf", true, false);
+
+/* With the cpu time of every process summed up by bpf_top, only the stat
+ * files of the processes that make it into the top list are read; the others
+ * are dropped from the process list. Returns false if all of them are
+ * needed, for the other lists or if_running. */
+static bool update_process_table_bpf(void)
+{
+	static std::vector<struct bpf_top_usage> usage;
+	static const unsigned long long hz = sysconf(_SC_CLK_TCK);
+	size_t n;
+
+	if (!top_bpf.get(*state) || top_mem || top_time || top_running || top_group ||
+#ifdef BUILD_IOSTATS
+			top_io ||
+#endif /* BUILD_IOSTATS */
+			replaying_samples || recording_samples || !procfs_is_real() ||
+			!bpf_top_start())
+		return false;
+
+	bpf_top_read(usage);
+	n = std::min<size_t>(usage.size(), top_cpu);
+	std::partial_sort(usage.begin(), usage.begin() + n, usage.end(),
+			[](const struct bpf_top_usage &a, const struct bpf_top_usage &b) {
+				return a.runtime > b.runtime;
+			});
+
+	proc_name_len = text_buffer_size.get(*state);
+	for (size_t i = 0; i < n; i++) {
+		struct process *p = get_process(usage[i].pid);
+
+		/* for the name, the memory and the total time; the process is
+		 * dropped if it is gone */
+		process_parse_stat(p);
+		/* in the clock ticks of /proc/stat, with no user/kernel split */
+		p->user_time = usage[i].runtime * hz / 1000000000;
+		p->kernel_time = 0;
+		p->net_tx = usage[i].tx;
+		p->net_rx = usage[i].rx;
+	}
+	return true;
+}
+#endif /* BUILD_BPF */
+
 /******************************************
  * Update process table					  *
  ******************************************/
 
+/* the list of processes of a recorded update, as "/proc" */
+static void record_process_list(const std::vector<struct process *> &procs)
+{
+	std::string pids;
+	char buf[16];
+
+	for (size_t i = 0; i < procs.size(); i++) {
+		snprintf(buf, sizeof(buf), "%d\n", procs[i]->pid);
+		pids += buf;
+	}
+	record_sample("/proc", pids.data(), pids.size());
+}
+
 static void update_process_table(void)
 {
 	DIR *dir;
 	struct dirent *entry;
+	std::vector<struct process *> procs;
+
+	if (replaying_samples) {
+		std::string pids;
+		const char *p;
+		char *end;
+
+		if (replay_sample("/proc", &pids)) {
+			for (p = pids.c_str(); *p; p = end) {
+				pid_t pid = strtol(p, &end, 10);
 
-	if (!(dir = opendir("/proc"))) {
+				if (end == p)
+					break;
+				procs.push_back(get_process(pid));
+				while (*end == '\n')
+					end++;
+			}
+		}
+		calculate_stats_all(procs);
 		return;
 	}
 
-	info.run_procs = 0;
+#ifdef BUILD_BPF
+	if (update_process_table_bpf())
+		return;
+#endif /* BUILD_BPF */
+
+#ifdef BUILD_PROC_CONNECTOR
+	if (procfs_is_real() && proc_cn_update()) {
+		/* the list of processes is up to date */
+		for (struct process *p = first_process; p; p = p->next)
+			procs.push_back(p);
+		if (recording_samples)
+			record_process_list(procs);
+		calculate_stats_all(procs);
+		return;
+	}
+#endif /* BUILD_PROC_CONNECTOR */
+
+	if (!(dir = opendir(procfs_root.c_str()))) {
+		info.run_procs = 0;
+		return;
+	}
 
 	/* Get list of processes from /proc directory */
 	while ((entry = readdir(dir))) {
@@ -2875,12 +4663,17 @@ static void update_process_table(void)
 		}
 
 		if (sscanf(entry->d_name, "%d", &pid) > 0) {
-		/* compute each process cpu usage */
-			calculate_stats(get_process(pid));
+			procs.push_back(get_process(pid));
 		}
 	}
 
 	closedir(dir);
+
+	if (recording_samples)
+		record_process_list(procs);
+
+	/* compute each process cpu usage */
+	calculate_stats_all(procs);
 }
 
 void get_top_info(void)
@@ -51,8 +51,21 @@ void free_sysfs_sensor(struct text_object *);
 int get_entropy_avail(unsigned int *);
 int get_entropy_poolsize(unsigned int *);
 
+void parse_meminfo_arg(struct text_object *, const char *);
+void print_meminfo(struct text_object *, char *, int);
+double meminfo_value(struct text_object *);
+
+void parse_pressure_arg(struct text_object *, const char *);
+void print_pressure(struct text_object *, char *, int);
+double pressure_value(struct text_object *);
+void free_pressure(struct text_object *);
+
 int update_stat(void);
 
+struct process;
+/* read /proc/<pid>/stat into process, returns 1 if it is running */
+int process_parse_stat(struct process *);
+
 void print_distribution(struct text_object *, char *, int);
 
 void determine_longstat_file(void);
@@ -27,6 +27,27 @@
 #include "llua.h"
 #include "logging.h"
 #include "build.h"
+#include "data-source.hh"
+#include "c++wrap.hh"
+#include "reactor.hh"
+#include "update-cb.hh"
+#ifdef BUILD_CURL
+#include "ccurl_thread.h"
+#endif /* BUILD_CURL */
+#ifdef BUILD_LUA_FFI
+#include "ffi.h"
+#endif /* BUILD_LUA_FFI */
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 #ifdef BUILD_LUA_EXTRAS
 extern "C" {
@@ -43,8 +64,23 @@ static int llua_block_notify = 0;
 #endif /* HAVE_SYS_INOTIFY_H */
 
 static void llua_load(const char *script);
+static int llua_conky_async_read(lua_State *L);
+static int llua_conky_async_exec(lua_State *L);
+#ifdef BUILD_CURL
+static int llua_conky_async_fetch(lua_State *L);
+#endif /* BUILD_CURL */
+static void llua_forget_waiting(void);
 
 lua_State *lua_L = NULL;
+/* bumped when lua_L is created, so references into an older state are known
+ * to be stale, and when a script is loaded, as it may define the functions
+ * anew */
+static unsigned int llua_state_generation = 0;
+static unsigned int llua_load_generation = 0;
+/* with a lua_gc_budget, collection only happens in llua_gc_idle(); the heap
+ * size in KiB after the last finished cycle */
+static bool llua_gc_stopped = false;
+static int llua_gc_live = 0;
 
 namespace {
 	class lua_load_setting: public conky::simple_config_setting<std::string> {
@@ -80,6 +116,7 @@ namespace {
 			llua_rm_notifies();
 #endif /* HAVE_SYS_INOTIFY_H */
 			if(!lua_L) return;
+			llua_forget_waiting();
 			lua_close(lua_L);
 			lua_L = NULL;
 		}
@@ -101,6 +138,9 @@ namespace {
 	conky::simple_config_setting<std::string> lua_draw_hook_post("lua_draw_hook_post",
 																std::string(), true);
 #endif
+	/* milliseconds of garbage collection per update, 0 leaves it to Lua */
+	conky::range_config_setting<double> lua_gc_budget("lua_gc_budget", 0,
+			std::numeric_limits<double>::infinity(), 0, true);
 }
 
 static int llua_conky_parse(lua_State *L)
@@ -117,6 +157,7 @@ static int llua_conky_parse(lua_State *L)
 		lua_error(L);
 	}
 	str = strdup(lua_tostring(L, 1));
+	wait_for_update();
 	evaluate(str, buf, max_user_text.get(*state));
 	lua_pushstring(L, buf);
 	free(str);
@@ -146,6 +187,10 @@ void llua_init(void)
 	char *old_path, *new_path;
 	if (lua_L) return;
 	lua_L = luaL_newstate();
+	llua_state_generation++;
+	llua_load_generation++;
+	llua_gc_stopped = false;
+	llua_gc_live = 0;
 
 	/* add our library path to the lua package.cpath global var */
 	luaL_openlibs(lua_L);
@@ -182,6 +227,17 @@ void llua_init(void)
 	lua_pushcfunction(lua_L, &llua_conky_set_update_interval);
 	lua_setglobal(lua_L, "conky_set_update_interval");
 
+	lua_pushcfunction(lua_L, &llua_conky_async_read);
+	lua_setglobal(lua_L, "conky_async_read");
+
+	lua_pushcfunction(lua_L, &llua_conky_async_exec);
+	lua_setglobal(lua_L, "conky_async_exec");
+
+#ifdef BUILD_CURL
+	lua_pushcfunction(lua_L, &llua_conky_async_fetch);
+	lua_setglobal(lua_L, "conky_async_fetch");
+#endif /* BUILD_CURL */
+
 #if defined(BUILD_X11) && defined(BUILD_LUA_EXTRAS)
 	/* register tolua++ user types */
 	tolua_open(lua_L);
@@ -199,6 +255,7 @@ void llua_load(const char *script)
 
 	std::string path = to_real_path(script);
 	error = luaL_dofile(lua_L, path.c_str());
+	llua_load_generation++;
 	if (error) {
 		NORM_ERR("llua_load: %s", lua_tostring(lua_L, -1));
 		lua_pop(lua_L, 1);
@@ -306,25 +363,164 @@ static char *llua_do_read_call(const char *function, const char *arg, int retc)
 }
 #endif
 
-/* call a function with args, and return a string from it (must be free'd) */
-static char *llua_getstring(const char *args)
+/* A call of ${lua} and friends: the function and the arguments are looked up
+ * once and kept in the registry, so calling it every update needs no string
+ * work. The function runs in a coroutine, which conky_async_*() suspend until
+ * their I/O is done; meanwhile the call shows what it returned last. */
+struct llua_call {
+	std::string func;
+	std::vector<std::string> args;
+	/* LUA_NOREF while not resolved, or if the function isn't defined */
+	int func_ref;
+	std::vector<int> arg_refs;
+	unsigned int state_generation, load_generation;
+	/* the suspended coroutine, LUA_NOREF if there is none */
+	int thread_ref;
+	/* the value of the last run that finished */
+	bool has_result, has_string, has_number;
+	std::string last_string;
+	double last_number;
+};
+
+/* the coroutines suspended in conky_async_*(), with the serial of the job
+ * they wait for */
+struct llua_waiter {
+	struct llua_call *call;
+	unsigned long serial;
+};
+static std::map<lua_State *, llua_waiter> llua_waiting;
+/* the coroutine being resumed, the only one conky_async_*() may suspend, and
+ * the serial of the job it was suspended for */
+static lua_State *llua_resuming = NULL;
+static unsigned long llua_job_serial = 0;
+
+static void llua_forget_waiting(void)
 {
-	char *func;
-	char *ret = NULL;
+	for (auto i = llua_waiting.begin(); i != llua_waiting.end(); ++i)
+		i->second.call->thread_ref = LUA_NOREF;
+	llua_waiting.clear();
+}
 
-	if(!lua_L) return NULL;
+static void llua_unref_call(struct llua_call *call)
+{
+	if (lua_L && call->state_generation == llua_state_generation) {
+		luaL_unref(lua_L, LUA_REGISTRYINDEX, call->func_ref);
+		for (size_t i = 0; i < call->arg_refs.size(); i++)
+			luaL_unref(lua_L, LUA_REGISTRYINDEX, call->arg_refs[i]);
+		luaL_unref(lua_L, LUA_REGISTRYINDEX, call->thread_ref);
+	}
+	for (auto i = llua_waiting.begin(); i != llua_waiting.end(); ++i) {
+		if (i->second.call == call) {
+			llua_waiting.erase(i);
+			break;
+		}
+	}
+	call->func_ref = LUA_NOREF;
+	call->thread_ref = LUA_NOREF;
+	call->arg_refs.clear();
+}
 
-	func = llua_do_call(args, 1);
-	if (func) {
-		if (!lua_isstring(lua_L, -1)) {
-			NORM_ERR("llua_getstring: function %s didn't return a string, result discarded", func);
-		} else {
-			ret = strdup(lua_tostring(lua_L, -1));
+/* push the function and the arguments of call */
+static void llua_push_call(struct llua_call *call)
+{
+	if (call->func_ref == LUA_NOREF
+			|| call->state_generation != llua_state_generation
+			|| call->load_generation != llua_load_generation) {
+		llua_unref_call(call);
+		call->state_generation = llua_state_generation;
+		call->load_generation = llua_load_generation;
+		for (size_t i = 0; i < call->args.size(); i++) {
+			lua_pushlstring(lua_L, call->args[i].data(), call->args[i].size());
+			call->arg_refs.push_back(luaL_ref(lua_L, LUA_REGISTRYINDEX));
+		}
+		lua_getglobal(lua_L, call->func.c_str());
+		/* not defined (yet), look again next time */
+		if (lua_isnil(lua_L, -1)) {
 			lua_pop(lua_L, 1);
+			lua_getglobal(lua_L, call->func.c_str());
+		} else {
+			call->func_ref = luaL_ref(lua_L, LUA_REGISTRYINDEX);
+			lua_rawgeti(lua_L, LUA_REGISTRYINDEX, call->func_ref);
 		}
+	} else {
+		lua_rawgeti(lua_L, LUA_REGISTRYINDEX, call->func_ref);
 	}
+	for (size_t i = 0; i < call->arg_refs.size(); i++)
+		lua_rawgeti(lua_L, LUA_REGISTRYINDEX, call->arg_refs[i]);
+}
 
-	return ret;
+static int llua_resume(lua_State *co, int nargs)
+{
+#if LUA_VERSION_NUM >= 502
+	return lua_resume(co, lua_L, nargs);
+#else
+	return lua_resume(co, nargs);
+#endif
+}
+
+/* resume the coroutine co of call, which is referenced by ref, with the nargs
+ * values on its stack. If it finishes its value is kept in call, if it is
+ * suspended again it is kept waiting */
+static void llua_resume_call(struct llua_call *call, lua_State *co, int ref, int nargs)
+{
+	int status;
+
+	llua_resuming = co;
+	status = llua_resume(co, nargs);
+	llua_resuming = NULL;
+	if (status == LUA_YIELD) {
+		call->thread_ref = ref;
+		llua_waiting[co] = { call, llua_job_serial };
+		return;
+	}
+	luaL_unref(lua_L, LUA_REGISTRYINDEX, ref);
+	call->thread_ref = LUA_NOREF;
+	call->has_result = call->has_string = call->has_number = false;
+	if (status != 0) {
+		NORM_ERR("llua_do_call: function %s execution failed: %s", call->func.c_str(),
+				lua_tostring(co, -1));
+		return;
+	}
+	call->has_result = true;
+	if (lua_gettop(co) >= 1 && lua_isstring(co, 1)) {
+		call->has_string = true;
+		call->last_string = lua_tostring(co, 1);
+	}
+	if (lua_gettop(co) >= 1 && lua_isnumber(co, 1)) {
+		call->has_number = true;
+		call->last_number = lua_tonumber(co, 1);
+	}
+}
+
+/* run call, unless it still waits for I/O from its last run */
+static void llua_do_object_call(struct llua_call *call)
+{
+	lua_State *co;
+	int ref;
+
+	if (call->thread_ref != LUA_NOREF && call->state_generation == llua_state_generation)
+		return;
+	call->thread_ref = LUA_NOREF;
+	co = lua_newthread(lua_L);
+	ref = luaL_ref(lua_L, LUA_REGISTRYINDEX);
+	llua_push_call(call);
+	lua_xmove(lua_L, co, call->arg_refs.size() + 1);
+	llua_resume_call(call, co, ref, call->arg_refs.size());
+}
+
+/* call a function with args, and return a string from it (must be free'd) */
+static char *llua_getstring(struct llua_call *call)
+{
+	if(!lua_L || !call) return NULL;
+
+	llua_do_object_call(call);
+	if (!call->has_string) {
+		if (call->has_result)
+			NORM_ERR("llua_getstring: function %s didn't return a string, result discarded",
+					call->func.c_str());
+		return NULL;
+	}
+	return strdup(call->last_string.c_str());
 }
 
 #if 0
@@ -351,24 +547,200 @@ static char *llua_getstring_read(const char *function, const char *arg)
 #endif
 
 /* call a function with args, and put the result in ret */
-static int llua_getnumber(const char *args, double *ret)
+static int llua_getnumber(struct llua_call *call, double *ret)
 {
-	char *func;
+	if(!lua_L || !call) return 0;
+
+	llua_do_object_call(call);
+	if (!call->has_number) {
+		if (call->has_result)
+			NORM_ERR("llua_getnumber: function %s didn't return a number, result discarded",
+					call->func.c_str());
+		return 0;
+	}
+	*ret = call->last_number;
+	return 1;
+}
 
-	if(!lua_L) return 0;
+/*
+ * conky_async_read(path), conky_async_exec(command) and conky_async_fetch(url)
+ * do their I/O in a thread of its own and suspend the coroutine of the ${lua}
+ * call until it is done; then the main loop resumes it, and they return the
+ * contents, or nil and an error message. The text meanwhile shows what the
+ * call returned last.
+ */
+namespace {
+	struct llua_job {
+		enum kind_t { READ, EXEC, FETCH } kind;
+		std::string arg;
+		lua_State *co;
+		unsigned long serial;
+		unsigned int generation;
+		bool ok;
+		std::string result;
+	};
 
-	func = llua_do_call(args, 1);
-	if(func) {
-		if(!lua_isnumber(lua_L, -1)) {
-			NORM_ERR("llua_getnumber: function %s didn't return a number, result discarded", func);
-		} else {
-			*ret = lua_tonumber(lua_L, -1);
-			lua_pop(lua_L, 1);
-			return 1;
+	/* the jobs that are done, and a pipe to wake the main loop for them; shared
+	 * with threads that may outlive everything else, so never freed */
+	struct llua_job_queue {
+		std::mutex mutex;
+		std::deque<llua_job> done;
+		std::pair<int, int> wakeup;
+	};
+
+	llua_job_queue *job_queue = NULL;
+
+	void read_file(llua_job &job)
+	{
+		char buf[0x1000];
+		ssize_t n;
+		int fd = open(job.arg.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0) {
+			job.result = job.arg + ": " + strerror(errno);
+			return;
+		}
+		while ((n = read(fd, buf, sizeof buf)) > 0 || (n < 0 && errno == EINTR)) {
+			if (n > 0)
+				job.result.append(buf, n);
 		}
+		job.ok = n == 0;
+		if (!job.ok)
+			job.result = job.arg + ": " + strerror(errno);
+		close(fd);
 	}
-	return 0;
+
+	void exec_command(llua_job &job)
+	{
+		char buf[0x1000];
+		size_t n;
+		FILE *f = popen(job.arg.c_str(), "re");
+
+		if (!f) {
+			job.result = job.arg + ": " + strerror(errno);
+			return;
+		}
+		while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+			job.result.append(buf, n);
+		job.ok = pclose(f) != -1;
+		/* like $exec */
+		if (!job.result.empty() && *job.result.rbegin() == '\n')
+			job.result.resize(job.result.size() - 1);
+	}
+
+	void run_job(llua_job job)
+	{
+		char c = 0;
+
+		conky::setup_worker_thread("conky-lua-io");
+		job.ok = false;
+		switch (job.kind) {
+			case llua_job::READ:
+				read_file(job);
+				break;
+			case llua_job::EXEC:
+				exec_command(job);
+				break;
+			case llua_job::FETCH:
+#ifdef BUILD_CURL
+				job.ok = ccurl_fetch(job.arg, job.result);
+				if (!job.ok)
+					job.result = job.arg + ": no data from server";
+#endif /* BUILD_CURL */
+				break;
+		}
+
+		std::lock_guard<std::mutex> lock(job_queue->mutex);
+		job_queue->done.push_back(std::move(job));
+		if (write(job_queue->wakeup.second, &c, 1) == -1 && errno != EAGAIN)
+			NORM_ERR("lua: waking up the main loop failed: %s", strerror(errno));
+	}
+
+	/* resume the coroutines whose jobs are done */
+	void finish_jobs(int)
+	{
+		char buf[64];
+		std::deque<llua_job> jobs;
+
+		while (read(job_queue->wakeup.first, buf, sizeof buf) > 0)
+			;
+		{
+			std::lock_guard<std::mutex> lock(job_queue->mutex);
+			jobs.swap(job_queue->done);
+		}
+		for (auto job = jobs.begin(); job != jobs.end(); ++job) {
+			auto w = llua_waiting.find(job->co);
+			int nargs = 1;
+
+			if (!lua_L || job->generation != llua_state_generation
+					|| w == llua_waiting.end() || w->second.serial != job->serial)
+				continue;
+			struct llua_call *call = w->second.call;
+			llua_waiting.erase(w);
+			if (job->ok) {
+				lua_pushlstring(job->co, job->result.data(), job->result.size());
+			} else {
+				lua_pushnil(job->co);
+				lua_pushlstring(job->co, job->result.data(), job->result.size());
+				nargs = 2;
+			}
+			llua_resume_call(call, job->co, call->thread_ref, nargs);
+		}
+	}
+
+	int start_job(lua_State *L, llua_job::kind_t kind, const char *name)
+	{
+		llua_job job;
+
+		if (lua_gettop(L) != 1 || !lua_isstring(L, 1)) {
+			lua_pushfstring(L, "incorrect arguments, %s(string) takes exactly 1 argument",
+					name);
+			lua_error(L);
+		}
+		if (L != llua_resuming) {
+			lua_pushfstring(L, "%s can only be called from a function of ${lua} and friends, "
+					"not from a coroutine of its own or a hook", name);
+			lua_error(L);
+		}
+		if (!job_queue) {
+			try {
+				std::pair<int, int> ends = pipe2(O_CLOEXEC | O_NONBLOCK);
+				job_queue = new llua_job_queue;
+				job_queue->wakeup = ends;
+			} catch (errno_error &e) {
+				lua_pushfstring(L, "%s: %s", name, e.what());
+				lua_error(L);
+			}
+		}
+		/* again every time, a reload drops what the main loop waits on */
+		conky::watch_fd(job_queue->wakeup.first, POLLIN, finish_jobs);
+
+		job.kind = kind;
+		job.arg = lua_tostring(L, 1);
+		job.co = L;
+		job.serial = ++llua_job_serial;
+		job.generation = llua_state_generation;
+		std::thread(run_job, std::move(job)).detach();
+		return lua_yield(L, 0);
+	}
+}
+
+static int llua_conky_async_read(lua_State *L)
+{
+	return start_job(L, llua_job::READ, "conky_async_read");
+}
+
+static int llua_conky_async_exec(lua_State *L)
+{
+	return start_job(L, llua_job::EXEC, "conky_async_exec");
+}
+
+#ifdef BUILD_CURL
+static int llua_conky_async_fetch(lua_State *L)
+{
+	return start_job(L, llua_job::FETCH, "conky_async_fetch");
 }
+#endif /* BUILD_CURL */
 
 #ifdef HAVE_SYS_INOTIFY_H
 struct _lua_notify_s {
@@ -458,6 +830,28 @@ void llua_set_number(const char *key, double value)
 	lua_setfield(lua_L, -2, key);
 }
 
+/* set key of the table at the top of the stack to value, unless *last (what
+ * it was set to before, NAN after the table was made) says it already is;
+ * true if it changed */
+static bool llua_set_changed_number(const char *key, double value, double *last)
+{
+	if (value == *last)
+		return false;
+	*last = value;
+	llua_set_number(key, value);
+	return true;
+}
+
+/* the fields of conky_window and conky_info that are updated, as they were
+ * written last */
+enum { WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TEXT_START_X, WINDOW_TEXT_START_Y,
+	WINDOW_TEXT_WIDTH, WINDOW_TEXT_HEIGHT, WINDOW_FIELDS };
+static double llua_window_fields[WINDOW_FIELDS];
+/* conky_window.generation, bumped whenever its geometry changes */
+static unsigned int llua_window_generation = 0;
+enum { INFO_UPDATE_INTERVAL, INFO_UPTIME, INFO_FIELDS };
+static double llua_info_fields[INFO_FIELDS];
+
 void llua_startup_hook(void)
 {
 	if (!lua_L || lua_startup_hook.get(*state).empty()) return;
@@ -470,6 +864,24 @@ void llua_shutdown_hook(void)
 	llua_do_call(lua_shutdown_hook.get(*state).c_str(), 0);
 }
 
+void llua_alert_hook(const char *function, const char *name, double value, bool raised)
+{
+	std::string func(function);
+
+	if (!lua_L) return;
+	if (func.compare(0, strlen(LUAPREFIX), LUAPREFIX) != 0)
+		func = LUAPREFIX + func;
+	lua_getglobal(lua_L, func.c_str());
+	lua_pushstring(lua_L, name);
+	lua_pushnumber(lua_L, value);
+	lua_pushboolean(lua_L, raised);
+	if (lua_pcall(lua_L, 3, 0, 0) != 0) {
+		NORM_ERR("llua_alert_hook: function %s execution failed: %s", func.c_str(),
+				lua_tostring(lua_L, -1));
+		lua_pop(lua_L, 1);
+	}
+}
+
 #ifdef BUILD_X11
 void llua_draw_pre_hook(void)
 {
@@ -483,6 +895,12 @@ void llua_draw_post_hook(void)
 	llua_do_call(lua_draw_hook_post.get(*state).c_str(), 0);
 }
 
+bool llua_has_draw_hooks(void)
+{
+	return lua_L && (!lua_draw_hook_pre.get(*state).empty()
+			|| !lua_draw_hook_post.get(*state).empty());
+}
+
 #ifdef BUILD_LUA_EXTRAS
 void llua_set_userdata(const char *key, const char *type, void *value)
 {
@@ -491,6 +909,27 @@ void llua_set_userdata(const char *key, const char *type, void *value)
 }
 #endif /* BUILD_LUA_EXTRAS */
 
+/* write the geometry of the window that changed into the table at the top of
+ * the stack */
+static void llua_set_window_geometry(int text_start_x, int text_start_y, int text_width,
+		int text_height)
+{
+	double *last = llua_window_fields;
+	bool changed = false;
+
+	changed |= llua_set_changed_number("width", window.width, &last[WINDOW_WIDTH]);
+	changed |= llua_set_changed_number("height", window.height, &last[WINDOW_HEIGHT]);
+	changed |= llua_set_changed_number("text_start_x", text_start_x,
+			&last[WINDOW_TEXT_START_X]);
+	changed |= llua_set_changed_number("text_start_y", text_start_y,
+			&last[WINDOW_TEXT_START_Y]);
+	changed |= llua_set_changed_number("text_width", text_width, &last[WINDOW_TEXT_WIDTH]);
+	changed |= llua_set_changed_number("text_height", text_height,
+			&last[WINDOW_TEXT_HEIGHT]);
+	if (changed)
+		llua_set_number("generation", ++llua_window_generation);
+}
+
 void llua_setup_window_table(int text_start_x, int text_start_y, int text_width, int text_height)
 {
 	if (!lua_L) return;
@@ -504,18 +943,16 @@ void llua_setup_window_table(int text_start_x, int text_start_y, int text_width,
 #endif /* BUILD_LUA_EXTRAS */
 
 
-		llua_set_number("width", window.width);
-		llua_set_number("height", window.height);
 		llua_set_number("border_inner_margin", border_inner_margin.get(*state));
 		llua_set_number("border_outer_margin", border_outer_margin.get(*state));
 		llua_set_number("border_width", border_width.get(*state));
 
-		llua_set_number("text_start_x", text_start_x);
-		llua_set_number("text_start_y", text_start_y);
-		llua_set_number("text_width", text_width);
-		llua_set_number("text_height", text_height);
+		std::fill_n(llua_window_fields, WINDOW_FIELDS, NAN);
+		llua_set_window_geometry(text_start_x, text_start_y, text_width, text_height);
 
 		lua_setglobal(lua_L, "conky_window");
+	} else {
+		lua_pop(lua_L, 1);
 	}
 }
 
@@ -530,27 +967,149 @@ void llua_update_window_table(int text_start_x, int text_start_y, int text_width
 		return;
 	}
 
-	llua_set_number("width", window.width);
-	llua_set_number("height", window.height);
+	llua_set_window_geometry(text_start_x, text_start_y, text_width, text_height);
+	lua_pop(lua_L, 1);
+}
+#endif /* BUILD_X11 */
+
+namespace {
+	/* writes the snapshot into the table at the top of the stack of lua_L */
+	class llua_snapshot_writer: public conky::snapshot_writer {
+		/* replace the value at the top of the stack by a new table, which is
+		 * also left below it to be stored */
+		void new_table()
+		{
+			lua_pop(lua_L, 1);
+			lua_newtable(lua_L);
+			lua_pushvalue(lua_L, -1);
+		}
 
-	llua_set_number("text_start_x", text_start_x);
-	llua_set_number("text_start_y", text_start_y);
-	llua_set_number("text_width", text_width);
-	llua_set_number("text_height", text_height);
+	public:
+		void number(const char *key, double value)
+		{
+			lua_pushnumber(lua_L, value);
+			lua_setfield(lua_L, -2, key);
+		}
 
-	lua_setglobal(lua_L, "conky_window");
+		void number(int index, double value)
+		{
+			lua_pushnumber(lua_L, value);
+			lua_rawseti(lua_L, -2, index);
+		}
+
+		void text(const char *key, const char *value)
+		{
+			lua_pushstring(lua_L, value);
+			lua_setfield(lua_L, -2, key);
+		}
+
+		void open(const char *key)
+		{
+			lua_getfield(lua_L, -1, key);
+			if (!lua_istable(lua_L, -1)) {
+				new_table();
+				lua_setfield(lua_L, -3, key);
+			}
+		}
+
+		void open(int index)
+		{
+			lua_rawgeti(lua_L, -1, index);
+			if (!lua_istable(lua_L, -1)) {
+				new_table();
+				lua_rawseti(lua_L, -3, index);
+			}
+		}
+
+		void close()
+		{
+			lua_pop(lua_L, 1);
+		}
+
+		void erase(int index)
+		{
+			lua_pushnil(lua_L);
+			lua_rawseti(lua_L, -2, index);
+		}
+	};
+
+	/* the values of this update in the conky_values table */
+	void llua_update_values()
+	{
+		llua_snapshot_writer w;
+
+		lua_getglobal(lua_L, "conky_values");
+		if (!lua_istable(lua_L, -1)) {
+			lua_pop(lua_L, 1);
+			lua_newtable(lua_L);
+			lua_pushvalue(lua_L, -1);
+			lua_setglobal(lua_L, "conky_values");
+		}
+		conky::write_snapshot(w);
+		lua_pop(lua_L, 1);
+#ifdef BUILD_LUA_FFI
+		update_ffi();
+#endif /* BUILD_LUA_FFI */
+	}
+}
+
+/* Collect garbage in slices until the budget is used up, a cycle is done or
+ * until is reached, so that the collector doesn't run in the middle of a
+ * frame. Should the garbage grow faster than the slices take it away, Lua
+ * collects on its own again until the next call. */
+void llua_gc_idle(double until)
+{
+	double budget = lua_gc_budget.get(*state) / 1000;
+	double end;
+
+	if (!lua_L)
+		return;
+	if (budget <= 0) {
+		if (llua_gc_stopped) {
+			lua_gc(lua_L, LUA_GCRESTART, 0);
+			llua_gc_stopped = false;
+		}
+		return;
+	}
+
+	end = std::min(get_time() + budget, until);
+	do {
+		if (lua_gc(lua_L, LUA_GCSTEP, 0)) {
+			llua_gc_live = lua_gc(lua_L, LUA_GCCOUNT, 0);
+			break;
+		}
+	} while (get_time() < end);
+
+	/* stop it again, Lua 5.1 restarts the collector in a step */
+	if (lua_gc(lua_L, LUA_GCCOUNT, 0) > std::max(4 * llua_gc_live, 1024)) {
+		lua_gc(lua_L, LUA_GCRESTART, 0);
+		llua_gc_stopped = false;
+	} else {
+		lua_gc(lua_L, LUA_GCSTOP, 0);
+		llua_gc_stopped = true;
+	}
+}
+
+size_t llua_heap_bytes(void)
+{
+	if (!lua_L)
+		return 0;
+	return (size_t) lua_gc(lua_L, LUA_GCCOUNT, 0) * 1024 + lua_gc(lua_L, LUA_GCCOUNTB, 0);
 }
-#endif /* BUILD_X11 */
 
 void llua_setup_info(struct information *i, double u_interval)
 {
 	if (!lua_L) return;
 	lua_newtable(lua_L);
 
-	llua_set_number("update_interval", u_interval);
-	llua_set_number("uptime", i->uptime);
+	std::fill_n(llua_info_fields, INFO_FIELDS, NAN);
+	llua_set_changed_number("update_interval", u_interval,
+			&llua_info_fields[INFO_UPDATE_INTERVAL]);
+	llua_set_changed_number("uptime", i->uptime, &llua_info_fields[INFO_UPTIME]);
 
 	lua_setglobal(lua_L, "conky_info");
+
+	llua_update_values();
 }
 
 void llua_update_info(struct information *i, double u_interval)
@@ -564,15 +1123,48 @@ void llua_update_info(struct information *i, double u_interval)
 		return;
 	}
 
-	llua_set_number("update_interval", u_interval);
-	llua_set_number("uptime", i->uptime);
+	llua_set_changed_number("update_interval", u_interval,
+			&llua_info_fields[INFO_UPDATE_INTERVAL]);
+	llua_set_changed_number("uptime", i->uptime, &llua_info_fields[INFO_UPTIME]);
+	lua_pop(lua_L, 1);
 
-	lua_setglobal(lua_L, "conky_info");
+	llua_update_values();
+}
+
+void parse_lua_arg(struct text_object *obj, const char *arg)
+{
+	struct llua_call *call = new llua_call;
+	size_t len = 0;
+	const char *ptr = tokenize(arg, &len);
+
+	/* call only conky_ prefixed functions */
+	if(strncmp(ptr, LUAPREFIX, strlen(LUAPREFIX)) != 0)
+		call->func = LUAPREFIX;
+	call->func.append(ptr, len);
+	while( ptr = tokenize(ptr, &len), len)
+		call->args.push_back(std::string(ptr, len));
+	call->func_ref = LUA_NOREF;
+	call->thread_ref = LUA_NOREF;
+	call->has_result = call->has_string = call->has_number = false;
+	call->last_number = 0;
+	call->state_generation = call->load_generation = 0;
+	obj->data.opaque = call;
+}
+
+void free_lua(struct text_object *obj)
+{
+	struct llua_call *call = (struct llua_call *) obj->data.opaque;
+
+	if (!call)
+		return;
+	llua_unref_call(call);
+	delete call;
+	obj->data.opaque = NULL;
 }
 
 void print_lua(struct text_object *obj, char *p, int p_max_size)
 {
-	char *str = llua_getstring(obj->data.s);
+	char *str = llua_getstring((struct llua_call *) obj->data.opaque);
 	if (str) {
 		snprintf(p, p_max_size, "%s", str);
 		free(str);
@@ -581,7 +1173,7 @@ void print_lua(struct text_object *obj, char *p, int p_max_size)
 
 void print_lua_parse(struct text_object *obj, char *p, int p_max_size)
 {
-	char *str = llua_getstring(obj->data.s);
+	char *str = llua_getstring((struct llua_call *) obj->data.opaque);
 	if (str) {
 		evaluate(str, p, p_max_size);
 		free(str);
@@ -591,7 +1183,7 @@ void print_lua_parse(struct text_object *obj, char *p, int p_max_size)
 double lua_barval(struct text_object *obj)
 {
 	double per;
-	if (llua_getnumber(obj->data.s, &per)) {
+	if (llua_getnumber((struct llua_call *) obj->data.opaque, &per)) {
 		return per;
 	}
 	return 0;
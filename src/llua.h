@@ -46,18 +46,32 @@ void llua_inotify_query(int wd, int mask);
 
 void llua_startup_hook(void);
 void llua_shutdown_hook(void);
+/* call the conky_ function of an alert with its name, the value and whether
+ * it was raised (or cleared) */
+void llua_alert_hook(const char *function, const char *name, double value, bool raised);
 
 #ifdef BUILD_X11
 void llua_draw_pre_hook(void);
 void llua_draw_post_hook(void);
+/* true if a lua draw hook may paint outside of the text */
+bool llua_has_draw_hooks(void);
 
 void llua_setup_window_table(int text_start_x, int text_start_y, int text_width, int text_height);
 void llua_update_window_table(int text_start_x, int text_start_y, int text_width, int text_height);
 #endif /* BUILD_X11 */
 
+/* run the garbage collector in the idle time before until (see get_time()) */
+void llua_gc_idle(double until);
+
+/* the bytes the Lua heap takes, 0 without Lua */
+size_t llua_heap_bytes(void);
+
 void llua_setup_info(struct information *i, double u_interval);
 void llua_update_info(struct information *i, double u_interval);
 
+/* resolve the function and the arguments of a lua object */
+void parse_lua_arg(struct text_object *, const char *);
+void free_lua(struct text_object *);
 void print_lua(struct text_object *, char *, int);
 void print_lua_parse(struct text_object *, char *, int);
 double lua_barval(struct text_object *);
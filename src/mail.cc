@@ -52,6 +52,9 @@
 
 #include <dirent.h>
 #include <termios.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif /* HAVE_SYS_INOTIFY_H */
 
 #include <cmath>
 #include <mutex>
@@ -76,6 +79,10 @@ struct local_mail_s {
 	float interval;
 	time_t last_mtime;
 	double last_update;
+	/* the inotify watches of a maildir, -1 if it isn't watched */
+	int inotify;
+	int cur_wd;
+	int new_wd;
 };
 
 std::pair<std::string, bool>
@@ -179,16 +186,27 @@ namespace {
 	class imap_cb: public mail_cb {
 		typedef mail_cb Base;
 
+		// the logged in connection to a server without IDLE, kept for the next check
+		int session;
+
 		void check_status(char *recvbuf);
 		void unseen_command(unsigned long old_unseen, unsigned long old_messages);
+		bool check_session(char *recvbuf);
+		bool wait_done(unsigned int seconds);
 
 	protected:
 		virtual void work();
 
 	public:
 		imap_cb(uint32_t period, const Tuple &tuple, uint16_t retries_)
-			: Base(period, tuple, retries_)
+			: Base(period, tuple, retries_), session(-1)
 		{}
+
+		~imap_cb()
+		{
+			if(session != -1)
+				close(session);
+		}
 	};
 
 	class pop3_cb: public mail_cb {
@@ -206,6 +224,124 @@ namespace {
 	struct mail_param_ex *global_mail;
 }
 
+#if HAVE_DIRENT_H
+/* add a message of a maildir to the counts, or take it away with delta -1 */
+static void count_maildir_message(struct local_mail_s *mail, const char *name,
+		bool is_new, int delta)
+{
+	const char *mailflags;
+
+	/* . and .. are skipped */
+	if (name[0] == '.') {
+		return;
+	}
+	mail->mail_count += delta;
+	if (is_new) {
+		mail->new_mail_count += delta;
+		mail->unseen_mail_count += delta;  /* new messages cannot have been seen */
+		return;
+	}
+	mailflags = strrchr(name, ',');
+	if (!mailflags) {
+		mailflags = "";
+	}
+	if (!strchr(mailflags, 'T')) { /* The message is not in the trash */
+		if (strchr(mailflags, 'S')) { /*The message has been seen */
+			mail->seen_mail_count += delta;
+		} else {
+			mail->unseen_mail_count += delta;
+		}
+		if (strchr(mailflags, 'F')) { /*The message was flagged */
+			mail->flagged_mail_count += delta;
+		} else {
+			mail->unflagged_mail_count += delta;
+		}
+		if (strchr(mailflags, 'P')) { /*The message was forwarded */
+			mail->forwarded_mail_count += delta;
+		} else {
+			mail->unforwarded_mail_count += delta;
+		}
+		if (strchr(mailflags, 'R')) { /*The message was replied */
+			mail->replied_mail_count += delta;
+		} else {
+			mail->unreplied_mail_count += delta;
+		}
+		if (strchr(mailflags, 'D')) { /*The message is a draft */
+			mail->draft_mail_count += delta;
+		}
+	} else {
+		mail->trashed_mail_count += delta;
+	}
+}
+
+static bool count_maildir_dir(struct local_mail_s *mail, const char *sub)
+{
+	std::string dirname = std::string(mail->mbox) + "/" + sub;
+	DIR *dir;
+	struct dirent *dirent;
+
+	dir = opendir(dirname.c_str());
+	if (!dir) {
+		NORM_ERR("cannot open directory");
+		return false;
+	}
+	while ((dirent = readdir(dir))) {
+		count_maildir_message(mail, dirent->d_name, sub[0] == 'n', 1);
+	}
+	closedir(dir);
+	return true;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define MAILDIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+		| IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* watch cur/ and new/ so the counts can follow the changes to them */
+static void watch_maildir(struct local_mail_s *mail)
+{
+	std::string dirname(mail->mbox);
+
+	mail->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mail->inotify == -1) {
+		return;
+	}
+	mail->cur_wd = inotify_add_watch(mail->inotify, (dirname + "/cur").c_str(),
+			MAILDIR_EVENTS);
+	mail->new_wd = inotify_add_watch(mail->inotify, (dirname + "/new").c_str(),
+			MAILDIR_EVENTS);
+	if (mail->cur_wd == -1 || mail->new_wd == -1) {
+		close(mail->inotify);
+		mail->inotify = -1;
+	}
+}
+
+/* apply the queued changes, returns false if the maildir has to be counted
+ * again */
+static bool follow_maildir(struct local_mail_s *mail)
+{
+	char buf[0x4000] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(mail->inotify, buf, sizeof buf)) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			struct inotify_event *ev = (struct inotify_event *) ptr;
+
+			ptr += sizeof(struct inotify_event) + ev->len;
+			if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+				return false;
+			}
+			if (!ev->len || (ev->mask & IN_ISDIR)) {
+				continue;
+			}
+			count_maildir_message(mail, ev->name, ev->wd == mail->new_wd,
+					ev->mask & (IN_CREATE | IN_MOVED_TO) ? 1 : -1);
+		}
+	}
+	return true;
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+#endif /* HAVE_DIRENT_H */
+
 static void update_mail_count(struct local_mail_s *mail)
 {
 	struct stat st;
@@ -214,7 +350,17 @@ static void update_mail_count(struct local_mail_s *mail)
 		return;
 	}
 
-	/* TODO: use that fine file modification notify on Linux 2.4 */
+#if defined(HAVE_DIRENT_H) && defined(HAVE_SYS_INOTIFY_H)
+	/* a watched maildir is kept up to date with every change */
+	if (mail->inotify != -1) {
+		if (follow_maildir(mail)) {
+			return;
+		}
+		close(mail->inotify);
+		mail->inotify = -1;
+		mail->last_update = 0;
+	}
+#endif
 
 	/* don't check mail so often (9.5s is minimum interval) */
 	if (current_update_time - mail->last_update < 9.5) {
@@ -235,100 +381,25 @@ static void update_mail_count(struct local_mail_s *mail)
 #if HAVE_DIRENT_H
 	/* maildir format */
 	if (S_ISDIR(st.st_mode)) {
-		DIR *dir;
-		char *dirname;
-		struct dirent *dirent;
-		char *mailflags;
-
 		mail->mail_count = mail->new_mail_count = 0;
 		mail->seen_mail_count = mail->unseen_mail_count = 0;
 		mail->flagged_mail_count = mail->unflagged_mail_count = 0;
 		mail->forwarded_mail_count = mail->unforwarded_mail_count = 0;
 		mail->replied_mail_count = mail->unreplied_mail_count = 0;
 		mail->draft_mail_count = mail->trashed_mail_count = 0;
-		dirname = (char *) malloc(sizeof(char) * (strlen(mail->mbox) + 5));
-		if (!dirname) {
-			NORM_ERR("malloc");
-			return;
-		}
-		strcpy(dirname, mail->mbox);
-		strcat(dirname, "/");
-		/* checking the cur subdirectory */
-		strcat(dirname, "cur");
-
-		dir = opendir(dirname);
-		if (!dir) {
-			NORM_ERR("cannot open directory");
-			free(dirname);
-			return;
-		}
-		dirent = readdir(dir);
-		while (dirent) {
-			/* . and .. are skipped */
-			if (dirent->d_name[0] != '.') {
-				mail->mail_count++;
-				mailflags = (char *) malloc(sizeof(char) * strlen(strrchr(dirent->d_name, ',')));
-				if (!mailflags) {
-					NORM_ERR("malloc");
-					free(dirname);
-					return;
-				}
-				strcpy(mailflags, strrchr(dirent->d_name, ','));
-				if (!strchr(mailflags, 'T')) { /* The message is not in the trash */
-					if (strchr(mailflags, 'S')) { /*The message has been seen */
-						mail->seen_mail_count++;
-					} else {
-						mail->unseen_mail_count++;
-					}
-					if (strchr(mailflags, 'F')) { /*The message was flagged */
-						mail->flagged_mail_count++;
-					} else {
-						mail->unflagged_mail_count++;
-					}
-					if (strchr(mailflags, 'P')) { /*The message was forwarded */
-						mail->forwarded_mail_count++;
-					} else {
-						mail->unforwarded_mail_count++;
-					}
-					if (strchr(mailflags, 'R')) { /*The message was replied */
-						mail->replied_mail_count++;
-					} else {
-						mail->unreplied_mail_count++;
-					}
-					if (strchr(mailflags, 'D')) { /*The message is a draft */
-						mail->draft_mail_count++;
-					}
-				} else {
-					mail->trashed_mail_count++;
-				}
-				free(mailflags);
-			}
-			dirent = readdir(dir);
-		}
-		closedir(dir);
-
-		dirname[strlen(dirname) - 3] = '\0';
-		strcat(dirname, "new");
 
-		dir = opendir(dirname);
-		if (!dir) {
-			NORM_ERR("cannot open directory");
-			free(dirname);
-			return;
-		}
-		dirent = readdir(dir);
-		while (dirent) {
-			/* . and .. are skipped */
-			if (dirent->d_name[0] != '.') {
-				mail->new_mail_count++;
-				mail->mail_count++;
-				mail->unseen_mail_count++;  /* new messages cannot have been seen */
+#ifdef HAVE_SYS_INOTIFY_H
+		/* the watches go first, so nothing happens unseen during the count */
+		watch_maildir(mail);
+#endif /* HAVE_SYS_INOTIFY_H */
+		if (!count_maildir_dir(mail, "cur") || !count_maildir_dir(mail, "new")) {
+#ifdef HAVE_SYS_INOTIFY_H
+			if (mail->inotify != -1) {
+				close(mail->inotify);
+				mail->inotify = -1;
 			}
-			dirent = readdir(dir);
+#endif /* HAVE_SYS_INOTIFY_H */
 		}
-		closedir(dir);
-
-		free(dirname);
 		return;
 	}
 #endif
@@ -463,6 +534,7 @@ void parse_local_mail_args(struct text_object *obj, const char *arg)
 	memset(locmail, 0, sizeof(struct local_mail_s));
 	locmail->mbox = strndup(dst.c_str(), text_buffer_size.get(*state));
 	locmail->interval = n1;
+	locmail->inotify = -1;
 	obj->data.opaque = locmail;
 }
 
@@ -496,6 +568,8 @@ void free_local_mails(struct text_object *obj)
 	if (!locmail)
 		return;
 
+	if (locmail->inotify != -1)
+		close(locmail->inotify);
 	free_and_zero(locmail->mbox);
 	free_and_zero(obj->data.opaque);
 }
@@ -738,8 +812,8 @@ void imap_cb::check_status(char *recvbuf)
 {
 	char *reply;
 	reply = (char*)strstr(recvbuf, " (MESSAGES ");
-	if (!reply || strlen(reply) < 2)
-		std::runtime_error("Unexpected response from server");
+	if (!reply || !strchr(reply, ')'))
+		throw std::runtime_error("Unexpected response from server");
 
 	reply += 2;
 	*strchr(reply, ')') = '\0';
@@ -759,30 +833,79 @@ void imap_cb::unseen_command(unsigned long old_unseen, unsigned long old_message
 	}
 }
 
+/* ask the kept session of a server without IDLE again, returns false if
+ * there is none or it went away */
+bool imap_cb::check_session(char *recvbuf)
+{
+	unsigned long old_unseen = result.unseen;
+	unsigned long old_messages = result.messages;
+
+	if(session == -1)
+		return false;
+
+	try {
+		command(session, "a2 STATUS \"" + get<MP_FOLDER>() + "\" (MESSAGES UNSEEN)\r\n",
+				recvbuf, "a2 OK");
+		check_status(recvbuf);
+	}
+	catch(std::runtime_error &) {
+		close(session);
+		session = -1;
+		return false;
+	}
+	unseen_command(old_unseen, old_messages);
+	succeeded();
+	return true;
+}
+
+/* sleep, returns true if the callback is stopped meanwhile */
+bool imap_cb::wait_done(unsigned int seconds)
+{
+	struct timeval timeout;
+	fd_set fdset;
+
+	timeout.tv_sec = seconds;
+	timeout.tv_usec = 0;
+	FD_ZERO(&fdset);
+	FD_SET(donefd(), &fdset);
+	return select(donefd() + 1, &fdset, NULL, NULL, &timeout) > 0 || is_done();
+}
+
 void imap_cb::work()
 {
-	int sockfd, numbytes;
+	int sockfd = -1, numbytes;
 	char recvbuf[MAXDATASIZE];
 	unsigned long old_unseen = ULONG_MAX;
 	unsigned long old_messages = ULONG_MAX;
 	bool has_idle = false;
+	std::string error;
+
+	if(check_session(recvbuf))
+		return;
 
+	/* each run gets its tries, the callback backs off when they all fail */
+	fail = 0;
 	while (fail < retries) {
 		struct timeval fetchtimeout;
 		int res;
 		fd_set fdset;
 
-		if(not ai)
-			resolve_host();
-
 		try {
+			if(not ai)
+				resolve_host();
+
 			sockfd = connect();
 
 			command(sockfd, "", recvbuf, "* OK");
 
 			command(sockfd, "abc CAPABILITY\r\n", recvbuf, "abc OK");
-			if (strstr(recvbuf, " IDLE ") != NULL)
-				has_idle = true;
+			/* the capability may be last on its line */
+			for(char *cap = strstr(recvbuf, " IDLE"); cap; cap = strstr(cap + 1, " IDLE")) {
+				if (cap[5] == ' ' || cap[5] == '\r' || cap[5] == '\n') {
+					has_idle = true;
+					break;
+				}
+			}
 
 			std::ostringstream str;
 			str << "a1 login " << get<MP_USER>() << " {" << get<MP_PASS>().length() << "}\r\n";
@@ -798,11 +921,11 @@ void imap_cb::work()
 			fail = 0;
 			old_unseen = result.unseen;
 			old_messages = result.messages;
+			succeeded();
 
 			if(not has_idle) {
-				try { command(sockfd, "a3 LOGOUT\r\n", recvbuf, "a3 OK"); }
-				catch(std::runtime_error &) {}
-				close(sockfd);
+				/* the next check reuses the connection */
+				session = sockfd;
 				return;
 			}
 
@@ -905,20 +1028,27 @@ void imap_cb::work()
 		catch(std::runtime_error &e) {
 			if(sockfd != -1)
 				close(sockfd);
-			freeaddrinfo(ai);
+			sockfd = -1;
+			if(ai)
+				freeaddrinfo(ai);
 			ai = NULL;
 
 			++fail;
-			if(*e.what())
-				NORM_ERR("Error while communicating with IMAP server: %s", e.what());
-			NORM_ERR("Trying IMAP connection again for %s@%s (try %u/%u)",
+			error = *e.what() ? e.what() : "connection lost";
+			if (fail >= retries)
+				break;
+			DBGP("Trying IMAP connection again for %s@%s (try %u/%u)",
 					get<MP_USER>().c_str(), get<MP_HOST>().c_str(), fail+1, retries);
-			sleep(fail); /* sleep more for the more failures we have */
+			/* wait twice as long after each failure, at most a minute */
+			if(wait_done(std::min(1u << std::min<unsigned int>(fail, 6), 60u)))
+				return;
 		}
 
 		if(is_done())
 			return;
 	}
+	failed("Error while communicating with IMAP server for " + get<MP_USER>() + "@"
+			+ get<MP_HOST>() + ": " + error);
 }
 
 void print_imap_unseen(struct text_object *obj, char *p, int p_max_size)
@@ -947,16 +1077,19 @@ void print_imap_messages(struct text_object *obj, char *p, int p_max_size)
 
 void pop3_cb::work()
 {
-	int sockfd;
+	int sockfd = -1;
 	char recvbuf[MAXDATASIZE];
 	char *reply;
 	unsigned long old_unseen = ULONG_MAX;
+	std::string error;
 
+	/* each run gets its tries, the callback backs off when they all fail */
+	fail = 0;
 	while (fail < retries) {
-		if(not ai)
-			resolve_host();
-
 		try {
+			if(not ai)
+				resolve_host();
+
 			sockfd = connect();
 
 			command(sockfd, "", recvbuf, "+OK ");
@@ -981,18 +1114,22 @@ void pop3_cb::work()
 			}
 			fail = 0;
 			old_unseen = result.unseen;
+			succeeded();
 			return;
 		}
 		catch(std::runtime_error &e) {
 			if(sockfd != -1)
 				close(sockfd);
-			freeaddrinfo(ai);
+			sockfd = -1;
+			if(ai)
+				freeaddrinfo(ai);
 			ai = NULL;
 
 			++fail;
-			if(*e.what())
-				NORM_ERR("Error while communicating with POP3 server: %s", e.what());
-			NORM_ERR("Trying POP3 connection again for %s@%s (try %u/%u)",
+			error = *e.what() ? e.what() : "connection lost";
+			if (fail >= retries)
+				break;
+			DBGP("Trying POP3 connection again for %s@%s (try %u/%u)",
 					get<MP_USER>().c_str(), get<MP_HOST>().c_str(), fail+1, retries);
 			sleep(fail); /* sleep more for the more failures we have */
 		}
@@ -1000,6 +1137,8 @@ void pop3_cb::work()
 		if(is_done())
 			return;
 	}
+	failed("Error while communicating with POP3 server for " + get<MP_USER>() + "@"
+			+ get<MP_HOST>() + ": " + error);
 }
 
 void print_pop3_unseen(struct text_object *obj, char *p, int p_max_size)
@@ -61,6 +61,50 @@ static int time_delay;
 
 static char mbox_mail_spool[DEFAULT_TEXT_BUFFER_SIZE];
 
+/* The ring and the parser state are kept between scans, so a box that was
+ * only appended to is read from where the last scan stopped. The bytes before
+ * that point are compared first, mail clients rewrite the box when they
+ * change a Status: header. */
+#define SCAN_TAIL 64
+static struct ring_list *scan_ring;
+static int scan_flag;
+static long scan_offset;
+static off_t scan_size;
+static ino_t scan_ino;
+static char scan_tail[SCAN_TAIL];
+static size_t scan_tail_len;
+
+static void free_ring(void)
+{
+	struct ring_list *curr = scan_ring;
+
+	if (!curr) {
+		return;
+	}
+	curr->previous->next = NULL;
+	while (curr) {
+		struct ring_list *next = curr->next;
+
+		free(curr->from);
+		free(curr->subject);
+		free(curr);
+		curr = next;
+	}
+	scan_ring = NULL;
+}
+
+/* whether the box still has the bytes the last scan ended with */
+static bool scan_tail_matches(FILE *fp)
+{
+	char buf[SCAN_TAIL];
+
+	if (fseek(fp, scan_offset - scan_tail_len, SEEK_SET) != 0
+			|| fread(buf, 1, scan_tail_len, fp) != scan_tail_len) {
+		return false;
+	}
+	return memcmp(buf, scan_tail, scan_tail_len) == 0;
+}
+
 static void mbox_scan(char *args, char *output, size_t max_len)
 {
 	int i, u, flag;
@@ -181,6 +225,22 @@ static void mbox_scan(char *args, char *output, size_t max_len)
 	last_ctime = statbuf.st_ctime;
 	last_mtime = statbuf.st_mtime;
 
+	/* mbox */
+	fp = fopen(mbox_mail_spool, "r");
+	if (!fp) {
+		return;
+	}
+
+	if (!force_rescan && scan_ring && statbuf.st_ino == scan_ino
+			&& statbuf.st_size >= scan_size && scan_tail_matches(fp)) {
+		curr = scan_ring;
+		flag = scan_flag;
+		fseek(fp, scan_offset, SEEK_SET);
+		goto scan;
+	}
+	free_ring();
+	rewind(fp);
+
 	/* build up double-linked ring-list to hold data, while scanning down the
 	 * mbox */
 	for (i = 0; i < print_num_mails; i++) {
@@ -204,14 +264,9 @@ static void mbox_scan(char *args, char *output, size_t max_len)
 	startlist->previous = curr;
 	curr->next = startlist;
 
-	/* mbox */
-	fp = fopen(mbox_mail_spool, "r");
-	if (!fp) {
-		return;
-	}
-
 	/* first find a "From " to set it to 0 for header-sarchings */
 	flag = 1;
+scan:
 	while (!feof(fp)) {
 		if (fgets(buf, text_buffer_size.get(*state), fp) == NULL) {
 			break;
@@ -344,13 +399,24 @@ static void mbox_scan(char *args, char *output, size_t max_len)
 		}
 	}
 
+	clearerr(fp);
+	scan_ring = curr;
+	scan_flag = flag;
+	scan_offset = ftell(fp);
+	scan_size = statbuf.st_size;
+	scan_ino = statbuf.st_ino;
+	scan_tail_len = scan_offset < SCAN_TAIL ? scan_offset : SCAN_TAIL;
+	if (fseek(fp, scan_offset - scan_tail_len, SEEK_SET) != 0
+			|| fread(scan_tail, 1, scan_tail_len, fp) != scan_tail_len) {
+		/* scan it again next time */
+		scan_ino = 0;
+	}
 	fclose(fp);
 
 	output[0] = '\0';
 
 	i = print_num_mails;
 	while (i) {
-		struct ring_list *tmp;
 		if (curr->from[0] != '\0') {
 			if (i != print_num_mails) {
 				snprintf(buf, text_buffer_size.get(*state), "\nF: %-*s S: %-*s", from_width,
@@ -364,11 +430,7 @@ static void mbox_scan(char *args, char *output, size_t max_len)
 		}
 		strncat(output, buf, max_len - strlen(output));
 
-		tmp = curr;
 		curr = curr->previous;
-		free(tmp->from);
-		free(tmp->subject);
-		free(tmp);
 
 		i--;
 	}
@@ -414,5 +476,6 @@ void free_mboxscan(struct text_object *obj)
 	free_and_zero(msd->args);
 	free_and_zero(msd->output);
 	free_and_zero(obj->data.opaque);
+	free_ring();
 }
 
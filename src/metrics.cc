@@ -0,0 +1,184 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "diskio.h"
+#include "fs.h"
+#include "metrics.h"
+#include "net_stat.h"
+#include <mutex>
+#include <sstream>
+
+/* Values only change between updates, so they are rendered once by the main
+ * loop. The http threads take a reference to the finished text; the lock is
+ * only held to swap or copy the pointer, never while rendering or sending. */
+static std::mutex metrics_mutex;
+static std::shared_ptr<const std::string> metrics_snapshot;
+
+/* label values must have backslashes, quotes and newlines escaped */
+static std::string metrics_label(const char *s)
+{
+	std::string out;
+
+	for (; s && *s; s++) {
+		if (*s == '\\' || *s == '"') {
+			out += '\\';
+			out += *s;
+		} else if (*s == '\n') {
+			out += "\\n";
+		} else {
+			out += *s;
+		}
+	}
+	return out;
+}
+
+static void metrics_help(std::ostringstream &out, const char *name,
+		const char *type, const char *help)
+{
+	out << "# TYPE " << name << ' ' << type << '\n';
+	out << "# HELP " << name << ' ' << help << '\n';
+}
+
+void update_metrics(void)
+{
+	std::ostringstream out;
+	int i;
+
+	out.precision(10);
+
+	metrics_help(out, "conky_uptime_seconds", "gauge", "System uptime.");
+	out << "conky_uptime_seconds " << info.uptime << '\n';
+
+	metrics_help(out, "conky_cpu_usage_ratio", "gauge",
+			"CPU usage, cpu=\"0\" is all of them.");
+	for (i = 0; info.cpu_usage && i <= info.cpu_count; i++) {
+		out << "conky_cpu_usage_ratio{cpu=\"" << i << "\"} "
+			<< info.cpu_usage[i] << '\n';
+	}
+
+	metrics_help(out, "conky_load_average", "gauge", "Load average.");
+	static const char *const periods[3] = { "1", "5", "15" };
+	for (i = 0; i < 3; i++) {
+		out << "conky_load_average{period=\"" << periods[i] << "\"} "
+			<< info.loadavg[i] << '\n';
+	}
+
+	metrics_help(out, "conky_memory_bytes", "gauge", "Memory and swap.");
+	const struct {
+		const char *type;
+		unsigned long long kb;
+	} mem[] = {
+		{ "used", info.mem }, { "used_with_buffers", info.memwithbuffers },
+		{ "free", info.memfree }, { "easy_free", info.memeasyfree },
+		{ "total", info.memmax }, { "dirty", info.memdirty },
+		{ "buffers", info.buffers }, { "cached", info.cached },
+		{ "swap_used", info.swap }, { "swap_free", info.swapfree },
+		{ "swap_total", info.swapmax },
+	};
+	for (i = 0; i < (int) (sizeof mem / sizeof mem[0]); i++) {
+		out << "conky_memory_bytes{type=\"" << mem[i].type << "\"} "
+			<< mem[i].kb * 1024 << '\n';
+	}
+
+	metrics_help(out, "conky_processes", "gauge", "Processes and threads.");
+	out << "conky_processes{state=\"all\"} " << info.procs << '\n';
+	out << "conky_processes{state=\"running\"} " << info.run_procs << '\n';
+	out << "conky_processes{state=\"threads\"} " << info.threads << '\n';
+
+	metrics_help(out, "conky_network_bytes_total", "counter",
+			"Bytes moved by a network device.");
+	for (size_t n = 0; n < netstats.size(); n++) {
+		std::string dev = metrics_label(netstats[n]->dev);
+
+		out << "conky_network_bytes_total{device=\"" << dev
+			<< "\",direction=\"receive\"} " << netstats[n]->recv << '\n';
+		out << "conky_network_bytes_total{device=\"" << dev
+			<< "\",direction=\"transmit\"} " << netstats[n]->trans << '\n';
+	}
+	metrics_help(out, "conky_network_bytes_per_second", "gauge",
+			"Average network speed over net_avg_samples.");
+	for (size_t n = 0; n < netstats.size(); n++) {
+		std::string dev = metrics_label(netstats[n]->dev);
+
+		out << "conky_network_bytes_per_second{device=\"" << dev
+			<< "\",direction=\"receive\"} " << netstats[n]->recv_speed << '\n';
+		out << "conky_network_bytes_per_second{device=\"" << dev
+			<< "\",direction=\"transmit\"} " << netstats[n]->trans_speed << '\n';
+	}
+
+	metrics_help(out, "conky_disk_bytes_per_second", "gauge",
+			"Average disk io over diskio_avg_samples.");
+	for (struct diskio_stat *ds = &stats; ds; ds = ds->next) {
+		/* the samples are kB per update */
+		double scale = 1024 / active_update_interval();
+		std::string dev = ds->dev ? metrics_label(ds->dev) : "";
+
+		out << "conky_disk_bytes_per_second{device=\"" << dev
+			<< "\",direction=\"read\"} " << ds->current_read * scale << '\n';
+		out << "conky_disk_bytes_per_second{device=\"" << dev
+			<< "\",direction=\"write\"} " << ds->current_write * scale << '\n';
+	}
+
+	metrics_help(out, "conky_filesystem_bytes", "gauge", "Filesystem space.");
+	for (i = 0; i < MAX_FS_STATS; i++) {
+		if (!fs_stats[i].set)
+			continue;
+		std::string path = metrics_label(fs_stats[i].path);
+
+		out << "conky_filesystem_bytes{path=\"" << path << "\",type=\"size\"} "
+			<< fs_stats[i].size << '\n';
+		out << "conky_filesystem_bytes{path=\"" << path << "\",type=\"avail\"} "
+			<< fs_stats[i].avail << '\n';
+		out << "conky_filesystem_bytes{path=\"" << path << "\",type=\"free\"} "
+			<< fs_stats[i].free << '\n';
+	}
+	out << "# EOF\n";
+
+	std::shared_ptr<const std::string> snapshot(new std::string(out.str()));
+	std::lock_guard<std::mutex> lock(metrics_mutex);
+	metrics_snapshot.swap(snapshot);
+}
+
+std::shared_ptr<const std::string> get_metrics(void)
+{
+	std::lock_guard<std::mutex> lock(metrics_mutex);
+
+	if (!metrics_snapshot)
+		return std::shared_ptr<const std::string>(new std::string("# EOF\n"));
+	return metrics_snapshot;
+}
+
+void clear_metrics(void)
+{
+	std::lock_guard<std::mutex> lock(metrics_mutex);
+
+	metrics_snapshot.reset();
+}
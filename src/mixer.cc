@@ -38,6 +38,13 @@
 #include <ctype.h>
 
 
+#ifdef BUILD_ALSA
+#include "reactor.hh"
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <string>
+#include <vector>
+#else
 #ifdef HAVE_LINUX_SOUNDCARD_H
 #include <linux/soundcard.h>
 #else
@@ -47,7 +54,242 @@
 #include <sys/soundcard.h>
 #endif /* __OpenBSD__ */
 #endif /* HAVE_LINUX_SOUNDCARD_H */
+#endif /* BUILD_ALSA */
+
+#ifdef BUILD_ALSA
+/*
+ * With BUILD_ALSA the simple mixer elements of the default card are used. What
+ * they are set to is read once and then again only when alsa says they
+ * changed: its poll fds are watched by the main loop, which lets
+ * snd_mixer_handle_events() run the element callbacks. The objects only read
+ * what is kept here.
+ */
+
+#define MIXER_CARD "default"
+
+struct mixer_control {
+	std::string name;
+	/* NULL while the element (or the whole mixer) is gone */
+	snd_mixer_elem_t *elem;
+	int left, right;
+	bool muted;
+};
+
+static snd_mixer_t *mixer_handle;
+static std::vector<int> mixer_fds;
+/* the controls the objects use, the index is in obj->data */
+static std::vector<mixer_control> controls;
+
+/* the OSS names that alsa calls differently */
+static const struct {
+	const char *oss, *alsa;
+} mixer_aliases[] = {
+	{ "vol", "Master" },
+	{ "trebl", "Treble" },
+	{ "spkr", "Speaker" },
+	{ "rec", "Capture" },
+	{ "igain", "Capture" },
+};
+
+static int mixer_to_percent(long v, long min, long max)
+{
+	return max > min ? (v - min) * 100 / (max - min) : 0;
+}
+
+static void mixer_read(mixer_control &c)
+{
+	snd_mixer_elem_t *e = c.elem;
+	long min = 0, max = 0, l = 0, r = 0;
+	int sw = 1;
+
+	if (snd_mixer_selem_has_playback_volume(e)) {
+		snd_mixer_selem_get_playback_volume_range(e, &min, &max);
+		snd_mixer_selem_get_playback_volume(e, SND_MIXER_SCHN_FRONT_LEFT, &l);
+		r = l;
+		if (!snd_mixer_selem_is_playback_mono(e))
+			snd_mixer_selem_get_playback_volume(e, SND_MIXER_SCHN_FRONT_RIGHT, &r);
+	} else if (snd_mixer_selem_has_capture_volume(e)) {
+		snd_mixer_selem_get_capture_volume_range(e, &min, &max);
+		snd_mixer_selem_get_capture_volume(e, SND_MIXER_SCHN_FRONT_LEFT, &l);
+		r = l;
+		if (!snd_mixer_selem_is_capture_mono(e))
+			snd_mixer_selem_get_capture_volume(e, SND_MIXER_SCHN_FRONT_RIGHT, &r);
+	}
+	if (snd_mixer_selem_has_playback_switch(e))
+		snd_mixer_selem_get_playback_switch(e, SND_MIXER_SCHN_FRONT_LEFT, &sw);
+	else if (snd_mixer_selem_has_capture_switch(e))
+		snd_mixer_selem_get_capture_switch(e, SND_MIXER_SCHN_FRONT_LEFT, &sw);
+
+	c.left = mixer_to_percent(l, min, max);
+	c.right = mixer_to_percent(r, min, max);
+	c.muted = !sw || (c.left == 0 && c.right == 0);
+}
+
+static void mixer_forget(mixer_control &c)
+{
+	c.elem = NULL;
+	c.left = c.right = 0;
+	c.muted = true;
+}
+
+static int mixer_elem_event(snd_mixer_elem_t *elem, unsigned int mask)
+{
+	size_t i = (size_t) snd_mixer_elem_get_callback_private(elem);
+
+	if (i >= controls.size())
+		return 0;
+	if (mask == SND_CTL_EVENT_MASK_REMOVE)
+		mixer_forget(controls[i]);
+	else if (mask & SND_CTL_EVENT_MASK_VALUE)
+		mixer_read(controls[i]);
+	return 0;
+}
+
+static void mixer_close(void)
+{
+	for (auto i = mixer_fds.begin(); i != mixer_fds.end(); ++i)
+		conky::unwatch_fd(*i);
+	mixer_fds.clear();
+	for (auto i = controls.begin(); i != controls.end(); ++i)
+		mixer_forget(*i);
+	snd_mixer_close(mixer_handle);
+	mixer_handle = NULL;
+}
+
+static void mixer_events(int events)
+{
+	/* the card is gone, the next config (re)load opens it again */
+	if (events & (POLLERR | POLLHUP | POLLNVAL)) {
+		NORM_ERR("lost the %s mixer", MIXER_CARD);
+		mixer_close();
+		return;
+	}
+	snd_mixer_handle_events(mixer_handle);
+}
+
+static bool mixer_open(void)
+{
+	int err, n;
+
+	if (mixer_handle)
+		return true;
+	if ((err = snd_mixer_open(&mixer_handle, 0)) < 0) {
+		NORM_ERR("can't open the %s mixer: %s", MIXER_CARD, snd_strerror(err));
+		mixer_handle = NULL;
+		return false;
+	}
+	if ((err = snd_mixer_attach(mixer_handle, MIXER_CARD)) < 0 ||
+			(err = snd_mixer_selem_register(mixer_handle, NULL, NULL)) < 0 ||
+			(err = snd_mixer_load(mixer_handle)) < 0) {
+		NORM_ERR("can't open the %s mixer: %s", MIXER_CARD, snd_strerror(err));
+		snd_mixer_close(mixer_handle);
+		mixer_handle = NULL;
+		return false;
+	}
+
+	n = snd_mixer_poll_descriptors_count(mixer_handle);
+	if (n > 0) {
+		std::vector<struct pollfd> pfds(n);
+
+		n = snd_mixer_poll_descriptors(mixer_handle, &pfds[0], n);
+		for (int i = 0; i < n; ++i) {
+			conky::watch_fd(pfds[i].fd, pfds[i].events, mixer_events);
+			mixer_fds.push_back(pfds[i].fd);
+		}
+	}
+	return true;
+}
+
+static snd_mixer_elem_t *mixer_find(const char *name)
+{
+	snd_mixer_elem_t *e;
+
+	for (e = snd_mixer_first_elem(mixer_handle); e; e = snd_mixer_elem_next(e)) {
+		if (snd_mixer_selem_is_active(e) &&
+				strcasecmp(snd_mixer_selem_get_name(e), name) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+int mixer_init(const char *name)
+{
+	size_t i;
+
+	if (name == 0 || name[0] == '\0') {
+		name = "vol";
+	}
+	for (i = 0; i < sizeof(mixer_aliases) / sizeof(mixer_aliases[0]); i++) {
+		if (strcasecmp(mixer_aliases[i].oss, name) == 0) {
+			name = mixer_aliases[i].alsa;
+			break;
+		}
+	}
+
+	if (!mixer_open()) {
+		return -1;
+	}
+
+	/* a control is kept once however many objects (and reloads) use it */
+	for (i = 0; i < controls.size(); i++) {
+		if (strcasecmp(controls[i].name.c_str(), name) == 0)
+			break;
+	}
+	if (i == controls.size()) {
+		controls.push_back(mixer_control());
+		controls[i].name = name;
+		mixer_forget(controls[i]);
+	}
+
+	mixer_control &c = controls[i];
+	if (!c.elem) {
+		c.elem = mixer_find(name);
+		if (!c.elem) {
+			NORM_ERR("the %s mixer has no control '%s'", MIXER_CARD, name);
+			return -1;
+		}
+		snd_mixer_elem_set_callback(c.elem, mixer_elem_event);
+		snd_mixer_elem_set_callback_private(c.elem, (void *) i);
+		mixer_read(c);
+	}
+	return i;
+}
+
+static const mixer_control *mixer_get(int i)
+{
+	if (i < 0 || (size_t) i >= controls.size())
+		return NULL;
+	return &controls[i];
+}
+
+static int mixer_get_avg(int i)
+{
+	const mixer_control *c = mixer_get(i);
+
+	return c ? (c->left + c->right) / 2 : 0;
+}
+
+static int mixer_get_left(int i)
+{
+	const mixer_control *c = mixer_get(i);
+
+	return c ? c->left : 0;
+}
+
+static int mixer_get_right(int i)
+{
+	const mixer_control *c = mixer_get(i);
+
+	return c ? c->right : 0;
+}
 
+int mixer_is_mute(int i)
+{
+	const mixer_control *c = mixer_get(i);
+
+	return c ? c->muted : 1;
+}
+#else
 #define MIXER_DEV "/dev/mixer"
 
 static int mixer_fd;
@@ -116,6 +358,7 @@ int mixer_is_mute(int i)
 {
 	return !mixer_get(i);
 }
+#endif /* BUILD_ALSA */
 
 #define mixer_to_255(i, x) x
 
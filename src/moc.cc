@@ -31,7 +31,7 @@
 #include <cmath>
 #include <mutex>
 
-#include "update-cb.hh"
+#include "player-cb.hh"
 
 namespace {
 	struct moc_result {
@@ -46,21 +46,30 @@ namespace {
 		std::string curtime;
 		std::string bitrate;
 		std::string rate;
+		int totalsec;
+		conky::playback_clock clock;
+
+		moc_result()
+			: totalsec(-1)
+		{}
 	};
 
-	class moc_cb: public conky::callback<moc_result> {
-		typedef conky::callback<moc_result> Base;
+	/* moc has no way to tell us about changes short of speaking its own
+	 * protocol, so it's asked every period, but the times in between are
+	 * worked out here */
+	class moc_cb: public conky::player_callback<moc_result> {
+		typedef conky::player_callback<moc_result> Base;
 
 	protected:
-		virtual void work();
+		virtual void refresh();
 
 	public:
 		moc_cb(uint32_t period)
-			: Base(period, false, Tuple())
+			: Base(period)
 		{}
 	};
 
-	void moc_cb::work()
+	void moc_cb::refresh()
 	{
 		moc_result moc;
 		FILE *fp;
@@ -102,24 +111,52 @@ namespace {
 					moc.bitrate = line + 9;
 				else if (strncmp(line, "Rate:", 5) == 0)
 					moc.rate = line + 6;
+				else if (strncmp(line, "TotalSec:", 9) == 0)
+					moc.totalsec = atoi(line + 10);
+				else if (strncmp(line, "CurrentSec:", 11) == 0)
+					moc.clock.set(atoi(line + 12), false);
 			}
+			pclose(fp);
 		}
 
-		pclose(fp);
+		if (moc.state == "PLAY")
+			moc.clock.set(moc.clock.get(), true);
 
 		std::lock_guard<std::mutex> l(result_mutex);
 		result = moc;
 	}
+
+	void format_moc_time(std::string &out, int seconds)
+	{
+		char buf[16];
+
+		snprintf(buf, sizeof(buf), "%02d:%02d", seconds / 60, seconds % 60);
+		out = buf;
+	}
+
+	moc_result get_moc()
+	{
+		uint32_t period = std::max(
+				lround(music_player_interval.get(*state)/active_update_interval()), 1l
+			);
+		moc_result moc = conky::register_cb<moc_cb>(period)->get_result_copy();
+
+		/* only older mocs don't give the times in seconds */
+		if (moc.clock.is_running() && moc.totalsec >= 0) {
+			int cur = moc.clock.get(moc.totalsec);
+
+			format_moc_time(moc.curtime, cur);
+			format_moc_time(moc.timeleft, moc.totalsec - cur);
+		}
+		return moc;
+	}
 }
 
 #define MOC_PRINT_GENERATOR(type, alt) \
 void print_moc_##type(struct text_object *obj, char *p, int p_max_size) \
 { \
 	(void)obj; \
-	uint32_t period = std::max( \
-				lround(music_player_interval.get(*state)/active_update_interval()), 1l \
-			); \
-	const moc_result &moc = conky::register_cb<moc_cb>(period)->get_result_copy(); \
+	const moc_result &moc = get_moc(); \
 	snprintf(p, p_max_size, "%s", (moc.type.length() ? moc.type.c_str() : alt)); \
 }
 
@@ -34,7 +34,7 @@
 #include "timeinfo.h"
 #include "libmpdclient.h"
 #include "mpd.h"
-#include "update-cb.hh"
+#include "player-cb.hh"
 
 namespace {
 
@@ -137,19 +137,31 @@ namespace {
 		int bitrate;
 		int length;
 		int elapsed;
+		/* elapsed as reported, it's extrapolated from there while playing */
+		conky::playback_clock clock;
+
+		mpd_result()
+			: is_playing(0), vol(0), progress(0), bitrate(0), length(0), elapsed(0)
+		{}
 	};
 
-	class mpd_cb: public conky::callback<mpd_result> {
-		typedef conky::callback<mpd_result> Base;
+	/* the subsystems whose changes show up in the mpd objects */
+	const char IDLE_SUBSYSTEMS[] = "player mixer options";
+
+	class mpd_cb: public conky::player_callback<mpd_result> {
+		typedef conky::player_callback<mpd_result> Base;
 	
 		mpd_Connection *conn;
+		/* an idle command is pending on conn */
+		bool idling;
 
 	protected:
-		virtual void work();
+		virtual bool changed();
+		virtual void refresh();
 	
 	public:
 		mpd_cb(uint32_t period)
-			: Base(period, false, Tuple()), conn(NULL)
+			: Base(period), conn(NULL), idling(false)
 		{}
 
 		~mpd_cb()
@@ -159,19 +171,43 @@ namespace {
 		}
 	};
 
-	void mpd_cb::work()
+	/* Checks whether the pending idle command was answered, i.e. something we
+	 * show has changed since the last refresh. Doesn't block. */
+	bool mpd_cb::changed()
+	{
+		char *subsystem;
+
+		if (!conn || !idling)
+			return true;
+		if (!mpd_replyReady(conn))
+			return false;
+
+		idling = false;
+		while ((subsystem = mpd_getNextChanged(conn)))
+			free(subsystem);
+		mpd_finishCommand(conn);
+		if (conn->error) {
+			/* most likely the connection went away, reconnect */
+			mpd_closeConnection(conn);
+			conn = 0;
+		}
+		return true;
+	}
+
+	void mpd_cb::refresh()
 	{
 		mpd_Status *status;
 		mpd_InfoEntity *entity;
 		mpd_result mpd_info;
 		
 		do {
-			if (!conn)
-				conn = mpd_newConnection(mpd_host.get(*state).c_str(), mpd_port.get(*state), 10);
+			if (!conn) {
+				conn = mpd_newConnection(mpd_host.get(*::state).c_str(), mpd_port.get(*::state), 10);
 
-			if (mpd_password.get(*state).size()) {
-				mpd_sendPasswordCommand(conn, mpd_password.get(*state).c_str());
-				mpd_finishCommand(conn);
+				if (!conn->error && mpd_password.get(*::state).size()) {
+					mpd_sendPasswordCommand(conn, mpd_password.get(*::state).c_str());
+					mpd_finishCommand(conn);
+				}
 			}
 
 			if (conn->error) {
@@ -241,6 +277,8 @@ namespace {
 					status->totalTime;
 				mpd_info.elapsed = status->elapsedTime;
 				mpd_info.length = status->totalTime;
+				mpd_info.clock.set(status->elapsedTime,
+						status->state == MPD_STATUS_STATE_PLAY);
 			} else {
 				mpd_info.progress = 0;
 				mpd_info.is_playing = 0;
@@ -298,6 +336,14 @@ if (b) a=b; else a="";
 			   conn = 0;
 			   } */
 		} while (0);
+
+		/* idle appeared in mpd 0.14, older ones get polled every period */
+		if (conn && (conn->version[0] > 0 || conn->version[1] >= 14)) {
+			mpd_sendIdleCommand(conn, IDLE_SUBSYSTEMS);
+			idling = !conn->error;
+		}
+
+		std::lock_guard<std::mutex> lock(result_mutex);
 		result = mpd_info; // don't forget to save results!
 	}
 
@@ -306,7 +352,15 @@ if (b) a=b; else a="";
 		uint32_t period = std::max(
 					lround(music_player_interval.get(*state)/active_update_interval()), 1l
 				);
-		return conky::register_cb<mpd_cb>(period)->get_result_copy();
+		mpd_result mpd_info = conky::register_cb<mpd_cb>(period)->get_result_copy();
+
+		/* mpd only tells us about seeks and song changes, the clock we run ourselves */
+		if (mpd_info.clock.is_running()) {
+			mpd_info.elapsed = mpd_info.clock.get(mpd_info.length);
+			if (mpd_info.length > 0)
+				mpd_info.progress = (float) mpd_info.elapsed / mpd_info.length;
+		}
+		return mpd_info;
 	}
 }
 
@@ -16,6 +16,9 @@ namespace priv {
         if(init && do_convert(l, -1).first) {
             initscr();
             start_color();
+            /* don't spend output on moving the cursor back after updates */
+            leaveok(stdscr, TRUE);
+            curs_set(0);
         }
 
         ++s;
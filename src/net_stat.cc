@@ -35,11 +35,19 @@
 #include "net/if.h"
 #include "text_object.h"
 #include "net_stat.h"
+#include "data-source.hh"
 #include <netinet/in.h>
 #include <errno.h>
+#include <math.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif /* HAVE_SYS_INOTIFY_H */
 
 /* network interface stuff */
 
@@ -59,33 +67,35 @@ conky::lua_traits<if_up_strictness_>::Map conky::lua_traits<if_up_strictness_>::
 static conky::simple_config_setting<if_up_strictness_> if_up_strictness("if_up_strictness",
 																		IFUP_UP, true);
 
-struct net_stat netstats[MAX_NET_INTERFACES];
+std::vector<struct net_stat *> netstats;
+
+/* the same entries indexed by name, everything that looks interfaces up
+ * (the text objects and the per-update parsers) only knows them by name */
+static std::unordered_map<std::string, struct net_stat *> netstats_by_name;
 
 struct net_stat *get_net_stat(const char *dev, void *free_at_crash1, void *free_at_crash2)
 {
-	unsigned int i;
+	struct net_stat *ns;
+
+	(void)free_at_crash1;
+	(void)free_at_crash2;
 
 	if (!dev) {
 		return 0;
 	}
 
 	/* find interface stat */
-	for (i = 0; i < MAX_NET_INTERFACES; i++) {
-		if (netstats[i].dev && strcmp(netstats[i].dev, dev) == 0) {
-			return &netstats[i];
-		}
+	std::unordered_map<std::string, struct net_stat *>::iterator i = netstats_by_name.find(dev);
+	if (i != netstats_by_name.end()) {
+		return i->second;
 	}
 
 	/* wasn't found? add it */
-	for (i = 0; i < MAX_NET_INTERFACES; i++) {
-		if (netstats[i].dev == 0) {
-			netstats[i].dev = strndup(dev, text_buffer_size.get(*state));
-			return &netstats[i];
-		}
-	}
-
-	CRIT_ERR(free_at_crash1, free_at_crash2, "too many interfaces used (limit is %d)", MAX_NET_INTERFACES);
-	return 0;
+	ns = (struct net_stat *) calloc(1, sizeof(struct net_stat));
+	ns->dev = strndup(dev, text_buffer_size.get(*state));
+	netstats.push_back(ns);
+	netstats_by_name[dev] = ns;
+	return ns;
 }
 
 void parse_net_stat_arg(struct text_object *obj, const char *arg, void *free_at_crash)
@@ -194,6 +204,20 @@ void print_totalup(struct text_object *obj, char *p, int p_max_size)
 	human_readable(ns->trans, p, p_max_size);
 }
 
+#define NET_VALUE_GENERATOR(name, expr) \
+double name##_value(struct text_object *obj) \
+{ \
+	struct net_stat *ns = (struct net_stat *)obj->data.opaque; \
+	return ns ? (double) (expr) : NAN; \
+}
+
+NET_VALUE_GENERATOR(downspeed, ns->recv_speed)
+NET_VALUE_GENERATOR(upspeed, ns->trans_speed)
+NET_VALUE_GENERATOR(downspeedf, ns->recv_speed / 1024.0)
+NET_VALUE_GENERATOR(upspeedf, ns->trans_speed / 1024.0)
+NET_VALUE_GENERATOR(totaldown, ns->recv)
+NET_VALUE_GENERATOR(totalup, ns->trans)
+
 void print_addr(struct text_object *obj, char *p, int p_max_size)
 {
 	struct net_stat *ns = (struct net_stat *)obj->data.opaque;
@@ -219,53 +243,60 @@ void print_addr(struct text_object *obj, char *p, int p_max_size)
 void print_addrs(struct text_object *obj, char *p, int p_max_size)
 {
 	struct net_stat *ns = (struct net_stat *)obj->data.opaque;
+	size_t len;
 
 	if (!ns)
 		return;
 
-	if (NULL != ns->addrs && strlen(ns->addrs) > 2) {
-		ns->addrs[strlen(ns->addrs) - 2] = 0; /* remove ", " from end of string */
-		strncpy(p, ns->addrs, p_max_size);
+	/* each address is followed by ", ", which isn't shown after the last */
+	len = strlen(ns->addrs);
+	if (len > 2) {
+		snprintf(p, p_max_size, "%.*s", (int) (len - 2), ns->addrs);
 	} else {
-		strncpy(p, "0.0.0.0", p_max_size);
+		snprintf(p, p_max_size, "0.0.0.0");
 	}
 }
 
 #ifdef BUILD_IPV6
+unsigned int v6addrs_generation = 0;
+
+static void format_v6addrs(struct net_stat *ns)
+{
+	size_t size = 1, len = 0;
+	struct v6addr *v6;
+
+	/* address, "/128", "(G)" and ", " */
+	for (v6 = ns->v6addrs; v6; v6 = v6->next)
+		size += INET6_ADDRSTRLEN + 4 + 3 + 2;
+	ns->v6text = (char *) realloc(ns->v6text, size);
+	ns->v6text[0] = 0;
+	for (v6 = ns->v6addrs; v6; v6 = v6->next) {
+		inet_ntop(AF_INET6, &v6->addr, ns->v6text + len, size - len);
+		len += strlen(ns->v6text + len);
+		if (ns->v6show_nm)
+			len += snprintf(ns->v6text + len, size - len, "/%u", v6->netmask);
+		if (ns->v6show_sc)
+			len += snprintf(ns->v6text + len, size - len, "(%c)", v6->scope);
+		if (v6->next)
+			len += snprintf(ns->v6text + len, size - len, ", ");
+	}
+	ns->v6text_generation = v6addrs_generation;
+}
+
 void print_v6addrs(struct text_object *obj, char *p, int p_max_size)
 {
 	struct net_stat *ns = (struct net_stat *)obj->data.opaque;
-	char tempaddress[INET6_ADDRSTRLEN];
-	struct v6addr *current_v6 = ns->v6addrs;
 
-	if (!ns)
+	if (!ns || p_max_size == 0)
 		return;
 
-	if(p_max_size == 0) return;
-	if( ! ns->v6addrs) {
+	if (!ns->v6addrs) {
 		snprintf(p, p_max_size, "No Address");
 		return;
 	}
-	*p=0;
-	while(current_v6) {
-		inet_ntop(AF_INET6, &(current_v6->addr), tempaddress, INET6_ADDRSTRLEN);
-		strncat(p, tempaddress, p_max_size);
-		//netmask
-		if(ns->v6show_nm) {
-			char netmaskstr[5]; //max 5 chars (/128 + null-terminator)
-			sprintf(netmaskstr, "/%u", current_v6->netmask);
-			strncat(p, netmaskstr, p_max_size);
-		}
-		//scope
-		if(ns->v6show_sc) {
-			char scopestr[3];
-			sprintf(scopestr, "(%c)", current_v6->scope);
-			strncat(p, scopestr, p_max_size);
-		}
-		//next (or last) address
-		current_v6 = current_v6->next;
-		if(current_v6) strncat(p, ", ", p_max_size);
-	}
+	if (!ns->v6text || ns->v6text_generation != v6addrs_generation)
+		format_v6addrs(ns);
+	snprintf(p, p_max_size, "%s", ns->v6text);
 }
 #endif /* BUILD_IPV6 */
 
@@ -307,9 +338,9 @@ void print_wireless_essid(struct text_object *obj, char *p, int p_max_size)
 	struct net_stat *ns = (struct net_stat *)obj->data.opaque;
 
 	if (!ns) {
-		for(unsigned int i = 0; *(netstats[i].dev) != 0; i++) {
-			if(*(netstats[i].essid) != 0) {
-				snprintf(p, p_max_size, "%s", netstats[i].essid);
+		for(unsigned int i = 0; i < netstats.size(); i++) {
+			if(*(netstats[i]->essid) != 0) {
+				snprintf(p, p_max_size, "%s", netstats[i]->essid);
 				return;
 			}
 		}
@@ -420,18 +451,23 @@ void clear_net_stats(void)
 #ifdef BUILD_IPV6
 	struct v6addr *nextv6;
 #endif /* BUILD_IPV6 */
-	int i;
-	for (i = 0; i < MAX_NET_INTERFACES; i++) {
-		free_and_zero(netstats[i].dev);
+	for (unsigned int i = 0; i < netstats.size(); i++) {
+		free_and_zero(netstats[i]->dev);
 #ifdef BUILD_IPV6
-		while(netstats[i].v6addrs) {
-			nextv6 = netstats[i].v6addrs;
-			netstats[i].v6addrs = netstats[i].v6addrs->next;
+		while(netstats[i]->v6addrs) {
+			nextv6 = netstats[i]->v6addrs;
+			netstats[i]->v6addrs = netstats[i]->v6addrs->next;
 			free_and_zero(nextv6);
 		}
+		free_and_zero(netstats[i]->v6text);
 #endif /* BUILD_IPV6 */
+		free(netstats[i]);
 	}
-	memset(netstats, 0, sizeof(netstats));
+	netstats.clear();
+	netstats_by_name.clear();
+#ifdef BUILD_IPV6
+	v6addrs_generation++;
+#endif /* BUILD_IPV6 */
 }
 
 void parse_if_up_arg(struct text_object *obj, const char *arg)
@@ -491,52 +527,108 @@ END_TRUE:
 	return 1;
 }
 
-struct _dns_data {
-	_dns_data() : nscount(0), ns_list(0) {}
-	int nscount;
-	char **ns_list;
-};
+/* The nameservers of /etc/resolv.conf, which is only read again after
+ * inotify saw it (or the file its symlink points to, as systemd-resolved
+ * sets it up) replaced or written. The directories are watched rather than
+ * the files, since resolvers replace the file by renaming a new one over
+ * it. Without inotify the file is read on every update. */
+#define RESOLV_CONF "/etc/resolv.conf"
 
-static _dns_data dns_data;
+static std::vector<std::string> nameservers;
+static bool nameservers_stale = true;
+#ifdef HAVE_SYS_INOTIFY_H
+static int resolv_fd = -1;
+static int resolv_etc_wd = -1;
+static int resolv_target_wd = -1;
+static std::string resolv_target_name;
 
-void free_dns_data(struct text_object *obj)
+static void resolv_watch(void)
 {
-	int i;
+	char *target;
 
+	if (resolv_fd < 0) {
+		resolv_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (resolv_fd < 0)
+			return;
+		resolv_etc_wd = inotify_add_watch(resolv_fd, "/etc",
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+	}
+
+	/* the symlink may point somewhere else now */
+	resolv_target_wd = -1;
+	resolv_target_name.clear();
+	if ((target = realpath(RESOLV_CONF, NULL)) != NULL) {
+		char *slash = strrchr(target, '/');
+
+		if (slash && strcmp(target, RESOLV_CONF)) {
+			resolv_target_name = slash + 1;
+			*slash = 0;
+			resolv_target_wd = inotify_add_watch(resolv_fd, *target ? target : "/",
+					IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+		}
+		free(target);
+	}
+}
+
+static void resolv_read_changes(void)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(resolv_fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+
+			if ((ev->mask & IN_Q_OVERFLOW) ||
+					(ev->len && ev->wd == resolv_etc_wd && !strcmp(ev->name, "resolv.conf")) ||
+					(ev->len && ev->wd == resolv_target_wd && resolv_target_name == ev->name))
+				nameservers_stale = true;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+
+void free_dns_data(struct text_object *obj)
+{
 	(void)obj;
 
-	for (i = 0; i < dns_data.nscount; i++)
-		free(dns_data.ns_list[i]);
-	free(dns_data.ns_list);
-	memset(&dns_data, 0, sizeof(dns_data));
+	nameservers.clear();
+	nameservers_stale = true;
+#ifdef HAVE_SYS_INOTIFY_H
+	if (resolv_fd >= 0)
+		close(resolv_fd);
+	resolv_fd = resolv_etc_wd = resolv_target_wd = -1;
+#endif /* HAVE_SYS_INOTIFY_H */
 }
 
 int update_dns_data(void)
 {
 	FILE *fp;
 	char line[256];
-	//static double last_dns_update = 0.0;
 
-	/* maybe updating too often causes higher load because of /etc lying on a real FS
-	if (current_update_time - last_dns_update < 10.0)
+#ifdef HAVE_SYS_INOTIFY_H
+	if (resolv_fd >= 0)
+		resolv_read_changes();
+	else
+		nameservers_stale = true;
+#endif /* HAVE_SYS_INOTIFY_H */
+	if (!nameservers_stale)
 		return 0;
-
-	last_dns_update = current_update_time;
-	*/
-
-	free_dns_data(NULL);
-
-	if ((fp = fopen("/etc/resolv.conf", "r")) == NULL)
+	nameservers.clear();
+#ifdef HAVE_SYS_INOTIFY_H
+	/* before reading, so that no change gets lost in between */
+	resolv_watch();
+	nameservers_stale = resolv_fd < 0;
+#endif /* HAVE_SYS_INOTIFY_H */
+
+	if ((fp = fopen(RESOLV_CONF, "r")) == NULL)
 		return 0;
-	while(!feof(fp)) {
-		if (fgets(line, 255, fp) == NULL) {
-			break;
-		}
+	while (fgets(line, sizeof(line), fp) != NULL) {
 		if (!strncmp(line, "nameserver ", 11)) {
-			line[strlen(line) - 1] = '\0';	// remove trailing newline
-			dns_data.nscount++;
-			dns_data.ns_list = (char**)realloc(dns_data.ns_list, dns_data.nscount * sizeof(char *));
-			dns_data.ns_list[dns_data.nscount - 1] = strndup(line + 11, text_buffer_size.get(*state));
+			line[strcspn(line, "\n")] = '\0';	// remove trailing newline
+			nameservers.push_back(std::string(line + 11, strnlen(line + 11,
+							text_buffer_size.get(*state))));
 		}
 	}
 	fclose(fp);
@@ -550,6 +642,22 @@ void parse_nameserver_arg(struct text_object *obj, const char *arg)
 
 void print_nameserver(struct text_object *obj, char *p, int p_max_size)
 {
-	if (dns_data.nscount > obj->data.l)
-		snprintf(p, p_max_size, "%s", dns_data.ns_list[obj->data.l]);
-}
+	if (obj->data.l >= 0 && (size_t) obj->data.l < nameservers.size())
+		snprintf(p, p_max_size, "%s", nameservers[obj->data.l].c_str());
+}
+
+/* net.<interface> in the snapshot of the Lua scripts, speeds in bytes per
+ * second */
+static conky::register_snapshot net_snapshot("net", [](conky::snapshot_writer &w) {
+	w.open("net");
+	for (size_t i = 0; i < netstats.size(); i++) {
+		w.open(netstats[i]->dev);
+		w.number("up", netstats[i]->up);
+		w.number("downspeed", netstats[i]->recv_speed);
+		w.number("upspeed", netstats[i]->trans_speed);
+		w.number("totaldown", netstats[i]->recv);
+		w.number("totalup", netstats[i]->trans);
+		w.close();
+	}
+	w.close();
+});
@@ -32,6 +32,8 @@
 #define _NET_STAT_H
 
 #include <sys/socket.h>	/* struct sockaddr */
+#include <vector>
+#include "average.hh"
 
 #ifdef BUILD_IPV6
 struct v6addr {
@@ -53,11 +55,17 @@ struct net_stat {
         struct v6addr *v6addrs;
 	bool v6show_nm;
 	bool v6show_sc;
+	/* v6addrs as print_v6addrs() shows them, made from v6addrs_generation */
+	char *v6text;
+	unsigned int v6text_generation;
 #endif /* BUILD_IPV6 */
 #if defined(__linux__)
         char addrs[17 * MAX_NET_INTERFACES + 1];
+#ifdef BUILD_RTNETLINK
+        struct sockaddr nl_addr;	/* kept between address dumps */
+#endif /* BUILD_RTNETLINK */
 #endif /* __linux__ */
-        double net_rec[15], net_trans[15];
+        conky::moving_average<double> recv_avg, trans_avg;
         // wireless extensions
         char essid[32];
         int channel;
@@ -69,7 +77,15 @@ struct net_stat {
         char ap[18];
 };
 
-extern struct net_stat netstats[];
+/* every interface seen so far, in the order they were first seen; the
+ * entries stay at the same address until clear_net_stats() */
+extern std::vector<struct net_stat *> netstats;
+
+#ifdef BUILD_IPV6
+/* changed whenever the v6addrs lists are made anew, so that the text made
+ * from them is only redone then */
+extern unsigned int v6addrs_generation;
+#endif /* BUILD_IPV6 */
 
 struct net_stat *get_net_stat(const char *, void *, void *);
 
@@ -81,6 +97,12 @@ void print_upspeed(struct text_object *, char *, int);
 void print_upspeedf(struct text_object *, char *, int);
 void print_totaldown(struct text_object *, char *, int);
 void print_totalup(struct text_object *, char *, int);
+double downspeed_value(struct text_object *);
+double upspeed_value(struct text_object *);
+double downspeedf_value(struct text_object *);
+double upspeedf_value(struct text_object *);
+double totaldown_value(struct text_object *);
+double totalup_value(struct text_object *);
 void print_addr(struct text_object *, char *, int);
 #ifdef __linux__
 void print_addrs(struct text_object *, char *, int);
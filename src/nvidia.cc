@@ -32,15 +32,18 @@
 #include "logging.h"
 #include "nvidia.h"
 #include "temphelper.h"
-#include "x11.h"
+#include "update-cb.hh"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#ifdef BUILD_X11
+#include <X11/Xlib.h>
+#include <NVCtrl/NVCtrl.h>
 #include <NVCtrl/NVCtrlLib.h>
-
-const int nvidia_query_to_attr[] = {NV_CTRL_GPU_CORE_TEMPERATURE,
-				    NV_CTRL_GPU_CORE_THRESHOLD,
-				    NV_CTRL_AMBIENT_TEMPERATURE,
-				    NV_CTRL_GPU_CURRENT_CLOCK_FREQS,
-				    NV_CTRL_GPU_CURRENT_CLOCK_FREQS,
-				    NV_CTRL_IMAGE_SETTINGS};
+#endif /* BUILD_X11 */
+#ifdef BUILD_NVML
+#include <nvml.h>
+#endif /* BUILD_NVML */
 
 typedef enum _QUERY_ID {
 	NV_TEMP,
@@ -48,84 +51,211 @@ typedef enum _QUERY_ID {
 	NV_TEMP_AMBIENT,
 	NV_GPU_FREQ,
 	NV_MEM_FREQ,
-	NV_IMAGE_QUALITY
+	NV_IMAGE_QUALITY,
+	NV_QUERY_COUNT
 } QUERY_ID;
 
+#ifdef BUILD_X11
+const int nvidia_query_to_attr[] = {NV_CTRL_GPU_CORE_TEMPERATURE,
+				    NV_CTRL_GPU_CORE_THRESHOLD,
+				    NV_CTRL_AMBIENT_TEMPERATURE,
+				    NV_CTRL_GPU_CURRENT_CLOCK_FREQS,
+				    NV_CTRL_GPU_CURRENT_CLOCK_FREQS,
+				    NV_CTRL_IMAGE_SETTINGS};
+#endif /* BUILD_X11 */
+
 struct nvidia_s {
 	int interval;
 	int print_as_float;
 	QUERY_ID type;
+	/* which GPU, counting from 0 */
+	unsigned int gpu;
 };
 
-static Display *nvdisplay;
-
 namespace {
-	class nvidia_display_setting: public conky::simple_config_setting<std::string> {
-		typedef conky::simple_config_setting<std::string> Base;
-	
+	/* the X display that NV-CONTROL is asked on, the one conky draws on if empty */
+	conky::simple_config_setting<std::string> nvidia_display("nvidia_display",
+			std::string(), false);
+
+	/* the last values of a GPU, -1 where unknown */
+	struct nvidia_values {
+		int value[NV_QUERY_COUNT];
+
+		nvidia_values()
+		{ std::fill(value, value + NV_QUERY_COUNT, -1); }
+	};
+
+#ifdef BUILD_NVML
+	/* whether NVML can be used, it's initialised once for all GPUs */
+	bool nvml_available()
+	{
+		static std::once_flag once;
+		static bool ok = false;
+
+		std::call_once(once, [] {
+			nvmlReturn_t r = nvmlInit();
+
+			if (r == NVML_SUCCESS)
+				ok = true;
+			else
+				NORM_ERR("nvidia: can't initialise NVML: %s", nvmlErrorString(r));
+		});
+		return ok;
+	}
+#endif /* BUILD_NVML */
+
+	/*
+	 * Samples one GPU in the background, once per update, for all the $nvidia objects
+	 * showing it. Only the values some object asked for are queried. NVML answers
+	 * without X, so it's asked first where it knows the value. The rest goes to
+	 * NV-CONTROL, on an X connection of the callback's own since Xlib mustn't be used
+	 * from two threads.
+	 */
+	class nvidia_cb: public conky::callback<nvidia_values, unsigned int, std::string> {
+		typedef conky::callback<nvidia_values, unsigned int, std::string> Base;
+
+		std::atomic<unsigned int> wanted;
+#ifdef BUILD_X11
+		Display *dpy;
+		bool dpy_failed;
+
+		int query_nvctrl(QUERY_ID qid);
+#endif /* BUILD_X11 */
+#ifdef BUILD_NVML
+		int query_nvml(nvmlDevice_t dev, QUERY_ID qid);
+#endif /* BUILD_NVML */
+
 	protected:
-		virtual void lua_setter(lua::state &l, bool init);
-		virtual void cleanup(lua::state &l);
+		virtual void work();
 
 	public:
-		nvidia_display_setting()
-			: Base("nvidia_display", std::string(), false)
+		nvidia_cb(uint32_t period, unsigned int gpu, const std::string &display_name)
+			: Base(period, false, Tuple(gpu, display_name)), wanted(0)
+#ifdef BUILD_X11
+			  , dpy(NULL), dpy_failed(false)
+#endif /* BUILD_X11 */
 		{}
+
+		~nvidia_cb()
+		{
+#ifdef BUILD_X11
+			if (dpy)
+				XCloseDisplay(dpy);
+#endif /* BUILD_X11 */
+		}
+
+		void want(QUERY_ID qid)
+		{ wanted |= 1u << qid; }
 	};
 
-	void nvidia_display_setting::lua_setter(lua::state &l, bool init)
+#ifdef BUILD_X11
+	int nvidia_cb::query_nvctrl(QUERY_ID qid)
 	{
-		lua::stack_sentry s(l, -2);
+		int tmp;
 
-		Base::lua_setter(l, init);
+		if (!dpy && !dpy_failed) {
+			const std::string &name = get<1>();
 
-		std::string str = do_convert(l, -1).first;
-		if(str.size()) {
-			if ((nvdisplay = XOpenDisplay(str.c_str())) == NULL) {
-				CRIT_ERR(NULL, NULL, "can't open nvidia display: %s", XDisplayName(str.c_str()));
+			dpy = XOpenDisplay(name.empty() ? NULL : name.c_str());
+			if (!dpy) {
+				NORM_ERR("nvidia: can't open display: %s",
+						XDisplayName(name.empty() ? NULL : name.c_str()));
+				dpy_failed = true;
 			}
-		}	
+		}
+		if (!dpy)
+			return -1;
 
-		++s;
+		if (qid == NV_IMAGE_QUALITY) {
+			/* an attribute of the X screen rather than the GPU */
+			if (!XNVCTRLQueryAttribute(dpy, DefaultScreen(dpy), 0,
+						nvidia_query_to_attr[qid], &tmp))
+				return -1;
+		} else if (!XNVCTRLQueryTargetAttribute(dpy, NV_CTRL_TARGET_TYPE_GPU, get<0>(), 0,
+					nvidia_query_to_attr[qid], &tmp)) {
+			return -1;
+		}
+		/* FIXME: when are the low 2 bytes of NV_GPU_FREQ needed? */
+		if (qid == NV_GPU_FREQ)
+			return tmp >> 16;
+		if (qid == NV_MEM_FREQ)
+			return tmp & 0xFFFF;
+		return tmp;
 	}
+#endif /* BUILD_X11 */
 
-	void nvidia_display_setting::cleanup(lua::state &l)
+#ifdef BUILD_NVML
+	int nvidia_cb::query_nvml(nvmlDevice_t dev, QUERY_ID qid)
 	{
-		lua::stack_sentry s(l, -1);
+		unsigned int tmp;
+		nvmlReturn_t r;
 
-		if(nvdisplay) {
-			XCloseDisplay(nvdisplay);
-			nvdisplay = NULL;
+		switch (qid) {
+			case NV_TEMP:
+				r = nvmlDeviceGetTemperature(dev, NVML_TEMPERATURE_GPU, &tmp);
+				break;
+			case NV_TEMP_THRESHOLD:
+				r = nvmlDeviceGetTemperatureThreshold(dev,
+						NVML_TEMPERATURE_THRESHOLD_SLOWDOWN, &tmp);
+				break;
+			case NV_GPU_FREQ:
+				r = nvmlDeviceGetClockInfo(dev, NVML_CLOCK_GRAPHICS, &tmp);
+				break;
+			case NV_MEM_FREQ:
+				r = nvmlDeviceGetClockInfo(dev, NVML_CLOCK_MEM, &tmp);
+				break;
+			default:
+				/* NVML has no ambient temperature or image settings */
+				return -1;
 		}
-
-		l.pop();
+		return r == NVML_SUCCESS ? (int) tmp : -1;
 	}
+#endif /* BUILD_NVML */
 
-	nvidia_display_setting nvidia_display;
-}
+	void nvidia_cb::work()
+	{
+		const unsigned int w = wanted;
+		nvidia_values values;
+#ifdef BUILD_NVML
+		nvmlDevice_t dev;
+		bool have_dev = nvml_available()
+			&& nvmlDeviceGetHandleByIndex(get<0>(), &dev) == NVML_SUCCESS;
+#endif /* BUILD_NVML */
+
+		for (int qid = 0; qid < NV_QUERY_COUNT; ++qid) {
+			int &v = values.value[qid];
 
-static int get_nvidia_value(QUERY_ID qid){
-	int tmp;
-	Display *dpy = nvdisplay ? nvdisplay : display;
-	if(!dpy || !XNVCTRLQueryAttribute(dpy, 0, 0, nvidia_query_to_attr[qid], &tmp)){
-		return -1;
+			if (!(w & (1u << qid)))
+				continue;
+#ifdef BUILD_NVML
+			if (have_dev)
+				v = query_nvml(dev, (QUERY_ID) qid);
+#endif /* BUILD_NVML */
+#ifdef BUILD_X11
+			if (v == -1)
+				v = query_nvctrl((QUERY_ID) qid);
+#endif /* BUILD_X11 */
+		}
+
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result = values;
 	}
-	/* FIXME: when are the low 2 bytes of NV_GPU_FREQ needed? */
-	if (qid == NV_GPU_FREQ)
-		return tmp >> 16;
-	if (qid == NV_MEM_FREQ)
-		return tmp & 0xFFFF;
-	return tmp;
 }
 
 int set_nvidia_type(struct text_object *obj, const char *arg)
 {
 	struct nvidia_s *nvs;
+	const char *gpu;
 
 	obj->data.opaque = malloc(sizeof(struct nvidia_s));
 	nvs = static_cast<nvidia_s *>(obj->data.opaque);
 	memset(nvs, 0, sizeof(struct nvidia_s));
 
+	/* e.g. "temp 1" for the second GPU */
+	gpu = strchr(arg, ' ');
+	if (gpu && sscanf(gpu, "%u", &nvs->gpu) != 1)
+		return 1;
+
 	switch(arg[0]) {
 		case 't':                              // temp or threshold
 			nvs->print_as_float = 1;
@@ -160,8 +290,16 @@ void print_nvidia_value(struct text_object *obj, char *p, int p_max_size)
 	int value;
 	struct nvidia_s *nvs = static_cast<nvidia_s *>(obj->data.opaque);
 
-	if (!nvs ||
-	    (value = get_nvidia_value(nvs->type)) == -1) {
+	if (!nvs) {
+		snprintf(p, p_max_size, "N/A");
+		return;
+	}
+
+	auto cb = conky::register_cb<nvidia_cb>(1, nvs->gpu, nvidia_display.get(*state));
+	cb->want(nvs->type);
+	value = cb->get_result_copy().value[nvs->type];
+
+	if (value == -1) {
 		snprintf(p, p_max_size, "N/A");
 		return;
 	}
@@ -683,28 +683,33 @@ void update_diskio()
 
 void get_top_info(void)
 {
+	static std::vector<struct process_sample> samples;
 	struct kinfo_proc2 *p;
-	struct process *proc;
 	int n_processes;
 	int i;
+	unsigned long long pagesize = getpagesize();
 
 	kvm_init();
 
 	p = kvm_getproc2(kd, KERN_PROC_ALL, 0, sizeof(struct kinfo_proc2),
 					 &n_processes);
 
+	samples.clear();
 	for (i = 0; i < n_processes; i++) {
 		if (!((p[i].p_flag & P_SYSTEM)) && p[i].p_comm != NULL) {
-			proc = find_process(p[i].p_pid);
-			if (!proc)
-				proc = new_process(p[i].p_pid);
-
-			proc->time_stamp = g_time;
-			proc->name = strndup(p[i].p_comm, text_buffer_size);
-			proc->amount = 100.0 * p[i].p_pctcpu / FSCALE;
-			/* TODO: vsize, rss, total_cpu_time */
+			struct process_sample s;
+
+			s.pid = p[i].p_pid;
+			s.uid = p[i].p_uid;
+			s.name = p[i].p_comm;
+			s.cpu_perc = 100.0 * p[i].p_pctcpu / FSCALE;
+			s.vsize = (p[i].p_vm_tsize + p[i].p_vm_dsize + p[i].p_vm_ssize) * pagesize;
+			s.rss = p[i].p_vm_rssize * pagesize;
+			s.total_cpu_time = p[i].p_rtime_sec * 100 + p[i].p_rtime_usec / 10000;
+			samples.push_back(s);
 		}
 	}
+	top_update_processes(samples);
 }
 
 /* empty stubs so conky links */
@@ -0,0 +1,339 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "logging.h"
+#include "common.h"
+#include "perf.h"
+#include "text_object.h"
+#include "update-cb.hh"
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <memory>
+#include <vector>
+
+namespace {
+	/* the counters of a group, the leader first */
+	enum perf_counter { CYCLES, INSTRUCTIONS, LLC_REFERENCES, LLC_MISSES, COUNTERS };
+
+	const uint64_t counter_config[COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_REFERENCES,
+		PERF_COUNT_HW_CACHE_MISSES,
+	};
+
+	/* what a cpu counted per second, scaled up for the time the group was
+	 * multiplexed out */
+	struct perf_rates {
+		double counts[COUNTERS];
+		/* whether the cpu has the counter at all */
+		bool valid[COUNTERS];
+
+		perf_rates()
+		{
+			for (int i = 0; i < COUNTERS; ++i) {
+				counts[i] = 0;
+				valid[i] = false;
+			}
+		}
+	};
+
+	/* what a perf_cb read in one run, never changed afterwards; cpus[0] is
+	 * the sum of all, cpus[n] cpu n-1 like in info.cpu_usage */
+	struct perf_sample {
+		std::vector<perf_rates> cpus;
+	};
+	typedef std::shared_ptr<const perf_sample> sample_ptr;
+
+	/* the counter group of a cpu, read with one read() */
+	struct perf_group {
+		int fd[COUNTERS];
+		/* where each counter is in what read() returns, -1 if it isn't */
+		int pos[COUNTERS];
+		int count;
+		uint64_t last[COUNTERS];
+		uint64_t enabled, running;
+
+		perf_group()
+			: count(0), enabled(0), running(0)
+		{
+			for (int i = 0; i < COUNTERS; ++i) {
+				fd[i] = -1;
+				pos[i] = -1;
+				last[i] = 0;
+			}
+		}
+	};
+
+	int perf_event_open(struct perf_event_attr *attr, int cpu, int group_fd)
+	{
+		return syscall(__NR_perf_event_open, attr, -1, cpu, group_fd, PERF_FLAG_FD_CLOEXEC);
+	}
+
+	/*
+	 * Counts cycles, instructions and last level cache references and misses on every
+	 * cpu, in a group per cpu so that they are scheduled together and read with one
+	 * read() each (PERF_FORMAT_GROUP). A cpu without the cycles counter has none; one
+	 * without the cache counters just lacks them.
+	 */
+	class perf_cb: public conky::callback<sample_ptr> {
+		typedef conky::callback<sample_ptr> Base;
+
+		std::vector<perf_group> groups;
+		bool opened;
+		double read_at;
+
+		void open_groups();
+		void close_groups();
+
+	protected:
+		virtual void work();
+
+	public:
+		perf_cb(uint32_t period)
+			: Base(period, true, Tuple()), opened(false), read_at(0)
+		{}
+
+		~perf_cb()
+		{ close_groups(); }
+	};
+
+	void perf_cb::open_groups()
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_CONF);
+		int err = 0;
+
+		opened = true;
+		groups.resize(std::max(cpus, 1l));
+		for (size_t cpu = 0; cpu < groups.size(); ++cpu) {
+			perf_group &g = groups[cpu];
+
+			for (int i = 0; i < COUNTERS; ++i) {
+				struct perf_event_attr attr;
+
+				memset(&attr, 0, sizeof(attr));
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.size = sizeof(attr);
+				attr.config = counter_config[i];
+				attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+					PERF_FORMAT_TOTAL_TIME_RUNNING;
+				attr.disabled = i == CYCLES;
+				g.fd[i] = perf_event_open(&attr, cpu, i == CYCLES ? -1 : g.fd[CYCLES]);
+				if (g.fd[i] < 0) {
+					if (!err)
+						err = errno;
+					/* offline, or no such counter */
+					if (i == CYCLES)
+						break;
+					continue;
+				}
+				g.pos[i] = g.count++;
+			}
+			if (g.fd[CYCLES] >= 0)
+				ioctl(g.fd[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+
+		if (err == EACCES || err == EPERM)
+			NORM_ERR("perf: counting all processes takes CAP_PERFMON or "
+					"kernel.perf_event_paranoid <= 0");
+		else if (err && groups[0].fd[CYCLES] < 0)
+			NORM_ERR("perf: no hardware counters: %s", strerror(err));
+	}
+
+	void perf_cb::close_groups()
+	{
+		for (auto g = groups.begin(); g != groups.end(); ++g) {
+			for (int i = COUNTERS - 1; i >= 0; --i) {
+				if (g->fd[i] >= 0)
+					close(g->fd[i]);
+			}
+		}
+		groups.clear();
+	}
+
+	void perf_cb::work()
+	{
+		std::shared_ptr<perf_sample> sample(new perf_sample);
+		const double now = get_time();
+		const double elapsed = read_at > 0 ? now - read_at : 0;
+
+		if (!opened)
+			open_groups();
+
+		sample->cpus.resize(groups.size() + 1);
+		for (size_t cpu = 0; cpu < groups.size(); ++cpu) {
+			perf_group &g = groups[cpu];
+			/* nr, time_enabled, time_running, then the values */
+			uint64_t buf[3 + COUNTERS];
+			double scale;
+
+			if (g.fd[CYCLES] < 0)
+				continue;
+			if (read(g.fd[CYCLES], buf, sizeof(buf)) < (ssize_t) (3 + g.count) * 8)
+				continue;
+
+			/* the group was only on the pmu for part of the time */
+			scale = buf[2] > g.running && buf[1] > g.enabled ?
+				(double) (buf[1] - g.enabled) / (buf[2] - g.running) : 0;
+			for (int i = 0; i < COUNTERS; ++i) {
+				perf_rates &all = sample->cpus[0], &one = sample->cpus[cpu + 1];
+				uint64_t v;
+
+				if (g.pos[i] < 0)
+					continue;
+				v = buf[3 + g.pos[i]];
+				if (elapsed > 0 && v >= g.last[i]) {
+					one.counts[i] = (v - g.last[i]) * scale / elapsed;
+					all.counts[i] += one.counts[i];
+				}
+				one.valid[i] = all.valid[i] = true;
+				g.last[i] = v;
+			}
+			g.enabled = buf[1];
+			g.running = buf[2];
+		}
+		read_at = now;
+
+		std::lock_guard<std::mutex> lock(result_mutex);
+		result = sample;
+	}
+
+	enum perf_figure { IPC, FIG_CYCLES, FIG_INSTRUCTIONS, FIG_LLC_MISSES, LLC_MISS_RATE };
+
+	const struct {
+		const char *name;
+		perf_figure figure;
+	} perf_figures[] = {
+		{ "ipc", IPC },
+		{ "cycles", FIG_CYCLES },
+		{ "instructions", FIG_INSTRUCTIONS },
+		{ "llc_misses", FIG_LLC_MISSES },
+		{ "llc_miss_rate", LLC_MISS_RATE },
+	};
+
+	struct perf_obj {
+		perf_figure figure;
+		/* 0 for all, like info.cpu_usage */
+		int cpu;
+	};
+
+	/* the figure an object shows, NAN if there is none (yet) */
+	double get_figure(struct text_object *obj)
+	{
+		struct perf_obj *pf = (struct perf_obj *) obj->data.opaque;
+		sample_ptr sample;
+
+		if (!pf)
+			return NAN;
+		sample = conky::register_cb<perf_cb>(1)->get_result_copy();
+		if (!sample || (size_t) pf->cpu >= sample->cpus.size())
+			return NAN;
+
+		const perf_rates &r = sample->cpus[pf->cpu];
+		switch (pf->figure) {
+			case IPC:
+				if (!r.valid[INSTRUCTIONS] || r.counts[CYCLES] == 0)
+					return NAN;
+				return r.counts[INSTRUCTIONS] / r.counts[CYCLES];
+			case FIG_CYCLES:
+				return r.valid[CYCLES] ? r.counts[CYCLES] : NAN;
+			case FIG_INSTRUCTIONS:
+				return r.valid[INSTRUCTIONS] ? r.counts[INSTRUCTIONS] : NAN;
+			case FIG_LLC_MISSES:
+				return r.valid[LLC_MISSES] ? r.counts[LLC_MISSES] : NAN;
+			case LLC_MISS_RATE:
+				if (!r.valid[LLC_MISSES] || r.counts[LLC_REFERENCES] == 0)
+					return NAN;
+				return 100 * r.counts[LLC_MISSES] / r.counts[LLC_REFERENCES];
+		}
+		return NAN;
+	}
+}
+
+void parse_perf_args(struct text_object *obj, const char *arg)
+{
+	char name[32];
+	int n = 0, cpu = 0;
+
+	if (!arg || sscanf(arg, "%31s %n", name, &n) < 1) {
+		NORM_ERR("perf needs a figure: ipc, cycles, instructions, llc_misses or "
+				"llc_miss_rate");
+		return;
+	}
+	for (size_t i = 0; i < sizeof(perf_figures) / sizeof(perf_figures[0]); ++i) {
+		if (strcmp(name, perf_figures[i].name))
+			continue;
+		if (arg[n] && (sscanf(arg + n, "cpu%d", &cpu) != 1 || cpu < 0)) {
+			NORM_ERR("perf: '%s' is not a cpu like cpu0 or cpu2", arg + n);
+			return;
+		}
+
+		struct perf_obj *pf = new perf_obj;
+		pf->figure = perf_figures[i].figure;
+		pf->cpu = cpu;
+		obj->data.opaque = pf;
+		return;
+	}
+	NORM_ERR("perf: unknown figure '%s'", name);
+}
+
+/* ipc and the miss rate (in percent) with two decimals, the counts per second
+ * with a unit prefix */
+void print_perf(struct text_object *obj, char *p, int p_max_size)
+{
+	static const char prefixes[] = " kMGT";
+	struct perf_obj *pf = (struct perf_obj *) obj->data.opaque;
+	double v = get_figure(obj);
+	int i = 0;
+
+	if (isnan(v))
+		return;
+	if (pf->figure == IPC || pf->figure == LLC_MISS_RATE) {
+		snprintf(p, p_max_size, "%.2f", v);
+		return;
+	}
+	for (; v >= 1000 && prefixes[i + 1]; ++i)
+		v /= 1000;
+	if (i == 0)
+		snprintf(p, p_max_size, "%.0f", v);
+	else
+		snprintf(p, p_max_size, "%.1f%c", v, prefixes[i]);
+}
+
+double perf_value(struct text_object *obj)
+{
+	return get_figure(obj);
+}
+
+void free_perf(struct text_object *obj)
+{
+	delete (struct perf_obj *) obj->data.opaque;
+	obj->data.opaque = NULL;
+}
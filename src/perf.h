@@ -0,0 +1,41 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PERF_H
+#define _PERF_H
+
+#include <stdint.h>
+
+struct text_object;
+
+/* $perf, a figure of the hardware performance counters of all cpus (cpu0)
+ * or one of them (cpuN, numbered like for $cpu), e.g. ${perf ipc cpu2} */
+void parse_perf_args(struct text_object *, const char *arg);
+
+void print_perf(struct text_object *, char *, int);
+double perf_value(struct text_object *);
+void free_perf(struct text_object *);
+
+#endif /* _PERF_H */
@@ -0,0 +1,97 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PLAYER_CB_HH
+#define PLAYER_CB_HH
+
+#include <algorithm>
+
+#include "common.h"
+#include "update-cb.hh"
+
+namespace conky {
+	/*
+	 * The playback position of a track, as last reported by the player. While the track
+	 * is playing, get() moves it on by the time passed since, so the position needn't be
+	 * asked for on every update.
+	 */
+	class playback_clock {
+		double position;
+		double at;
+		bool running;
+
+	public:
+		playback_clock()
+			: position(0), at(0), running(false)
+		{}
+
+		void set(double position_, bool running_)
+		{
+			position = position_;
+			at = get_time();
+			running = running_;
+		}
+
+		// the current position, in the units given to set(), never beyond length (if > 0)
+		double get(double length = 0) const
+		{
+			double p = position;
+			if(running)
+				p += get_time() - at;
+			return length > 0 ? std::min(p, length) : p;
+		}
+
+		bool is_running() const { return running; }
+	};
+
+	/*
+	 * Base for the music player callbacks. refresh() asks the player for its complete state
+	 * and stores it in the result. Players that can notify about changes override changed()
+	 * to return false (without blocking) as long as nothing happened, then work() leaves the
+	 * result alone, and the playback_clock in it keeps the position going. Players that can't
+	 * are simply refreshed every period.
+	 */
+	template<typename Result>
+	class player_callback: public callback<Result> {
+		typedef callback<Result> Base;
+
+	protected:
+		virtual bool changed() { return true; }
+		virtual void refresh() = 0;
+
+		virtual void work()
+		{
+			if(changed())
+				refresh();
+		}
+
+	public:
+		player_callback(uint32_t period)
+			: Base(period, false, typename Base::Tuple())
+		{}
+	};
+}
+
+#endif /* PLAYER_CB_HH */
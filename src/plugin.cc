@@ -0,0 +1,78 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "logging.h"
+#include "plugin.h"
+#include <dlfcn.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+
+namespace {
+	/* by name, NULL for those that couldn't be loaded */
+	std::unordered_map<std::string, const struct conky_plugin *> plugins;
+
+	const struct conky_plugin *load_plugin(const std::string &name)
+	{
+		auto i = plugins.find(name);
+		std::string path = PACKAGE_LIBDIR "/conky_" + name + ".so";
+		std::string symbol = "conky_plugin_" + name;
+		const struct conky_plugin *plugin;
+		void *handle;
+
+		if (i != plugins.end())
+			return i->second;
+		plugins[name] = NULL;
+
+		/* no such plugin is the common case: a typo or an object of a
+		 * module that isn't built at all */
+		if (access(path.c_str(), R_OK))
+			return NULL;
+		if (!(handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL))) {
+			NORM_ERR("can't load plugin %s: %s", path.c_str(), dlerror());
+			return NULL;
+		}
+		plugin = (const struct conky_plugin *) dlsym(handle, symbol.c_str());
+		if (!plugin || plugin->version != CONKY_PLUGIN_VERSION) {
+			NORM_ERR("%s is not a plugin of this version of conky", path.c_str());
+			dlclose(handle);
+			return NULL;
+		}
+		DBGP("loaded plugin %s", path.c_str());
+		return plugins[name] = plugin;
+	}
+}
+
+bool construct_plugin_object(struct text_object *obj, const char *name,
+		const char *arg, void *free_at_crash)
+{
+	const char *end = strchr(name, '_');
+	const struct conky_plugin *plugin;
+
+	plugin = load_plugin(end ? std::string(name, end) : std::string(name));
+	return plugin && plugin->construct(obj, name, arg, free_at_crash);
+}
@@ -0,0 +1,53 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PLUGIN_H
+#define _PLUGIN_H
+
+#include "text_object.h"
+
+/* With BUILD_PLUGINS, modules which drag in libraries of their own are built
+ * as plugins instead of into conky: conky_<name>.so in PACKAGE_LIBDIR, which
+ * is only loaded when the config uses one of its objects. The objects of a
+ * plugin are named <name> or <name>_something, and it exports a struct
+ * conky_plugin as conky_plugin_<name>. Plugins stay loaded until conky exits,
+ * as the objects keep pointers into them. */
+
+#define CONKY_PLUGIN_VERSION 1
+
+struct conky_plugin {
+	int version;	/* CONKY_PLUGIN_VERSION */
+	/* like the objects of construct_text_object(), false if the plugin has
+	 * none called name */
+	bool (*construct)(struct text_object *obj, const char *name,
+			const char *arg, void *free_at_crash);
+};
+
+/* constructs the object from the plugin it belongs to, loading that first;
+ * false if there's no such plugin or object */
+bool construct_plugin_object(struct text_object *obj, const char *name,
+		const char *arg, void *free_at_crash);
+
+#endif /* _PLUGIN_H */
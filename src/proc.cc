@@ -35,7 +35,12 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 pid_t strtopid(const char *s)
 {
@@ -78,6 +83,173 @@ void pid_readlink(char *file, char *p, int p_max_size)
 	}
 }
 
+/* The /proc/<pid> files the pid_* objects show, each read and split up once
+ * per update however many objects look at it. The buffers are kept for the
+ * next update; files nobody asked for in the last update are dropped. */
+enum pid_file_type {
+	PID_FILE_STAT,
+	PID_FILE_STATUS,
+	PID_FILE_CMDLINE,
+	PID_FILE_ENVIRON,
+	PID_FILE_IO,
+	PID_FILE_TYPES
+};
+
+static const char *const pid_file_names[PID_FILE_TYPES] = {
+	"stat", "status", "cmdline", "environ", "io"
+};
+
+struct pid_file {
+	std::vector<char> data;
+	size_t len;
+	bool ok;
+	double read_at;
+	/* stat: the fields, numbered from 0 (the pid is field 1 in proc(5)) */
+	std::vector<const char *> columns;
+	/* status and io: each line's key and value */
+	std::vector<std::pair<const char *, const char *> > lines;
+
+	pid_file() : len(0), ok(false), read_at(-1) {}
+};
+
+static std::unordered_map<uint64_t, struct pid_file> pid_files;
+
+static bool pid_file_read(struct pid_file &f, const char *path)
+{
+	int fd, n;
+
+	f.len = 0;
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		NORM_ERR(READERR, path);
+		return false;
+	}
+	do {
+		if (f.data.size() < f.len + READSIZE + 1)
+			f.data.resize(f.len + READSIZE + 1);
+		n = read(fd, f.data.data() + f.len, f.data.size() - f.len - 1);
+		if (n > 0)
+			f.len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+	close(fd);
+	f.data[f.len] = 0;
+	return true;
+}
+
+static void pid_file_split_stat(struct pid_file &f)
+{
+	char *s = f.data.data();
+	char *lparen = strchr(s, '('), *rparen = strrchr(s, ')');
+	char *save;
+
+	f.columns.clear();
+	if (!lparen || !rparen || rparen < lparen)
+		return;
+
+	/* the command may contain anything, even spaces and parentheses */
+	*lparen = *rparen = 0;
+	f.columns.push_back(s);
+	f.columns.push_back(lparen + 1);
+	for (s = strtok_r(rparen + 1, " \n", &save); s; s = strtok_r(NULL, " \n", &save))
+		f.columns.push_back(s);
+}
+
+static void pid_file_split_lines(struct pid_file &f)
+{
+	char *line = f.data.data(), *next, *value;
+
+	f.lines.clear();
+	for (; *line; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = 0;
+		else
+			next = line + strlen(line);
+		if (!(value = strchr(line, ':')))
+			continue;
+		*value++ = 0;
+		while (*value == ' ' || *value == '\t')
+			value++;
+		f.lines.push_back(std::make_pair(line, value));
+	}
+}
+
+static const struct pid_file *get_pid_file(pid_t pid, enum pid_file_type type)
+{
+	static double pruned_at = -1;
+	char path[64];
+
+	if (pruned_at != current_update_time) {
+		for (auto i = pid_files.begin(); i != pid_files.end(); ) {
+			if (i->second.read_at < last_update_time)
+				i = pid_files.erase(i);
+			else
+				++i;
+		}
+		pruned_at = current_update_time;
+	}
+
+	struct pid_file &f = pid_files[(uint64_t) pid * PID_FILE_TYPES + type];
+	if (f.read_at != current_update_time) {
+		f.read_at = current_update_time;
+		snprintf(path, sizeof(path), PROCDIR "/%d/%s", pid, pid_file_names[type]);
+		f.ok = pid_file_read(f, path);
+		if (f.ok && type == PID_FILE_STAT)
+			pid_file_split_stat(f);
+		else if (f.ok && (type == PID_FILE_STATUS || type == PID_FILE_IO))
+			pid_file_split_lines(f);
+	}
+	return f.ok ? &f : NULL;
+}
+
+/* field n of /proc/<pid>/stat, numbered as in proc(5) */
+static const char *pid_stat_field(pid_t pid, size_t n)
+{
+	const struct pid_file *f = get_pid_file(pid, PID_FILE_STAT);
+
+	return f && n >= 1 && n <= f->columns.size() ? f->columns[n - 1] : NULL;
+}
+
+/* the value of a "key: value" line of /proc/<pid>/status or io */
+static const char *pid_file_value(pid_t pid, enum pid_file_type type, const char *key)
+{
+	const struct pid_file *f = get_pid_file(pid, type);
+
+	if (!f)
+		return NULL;
+	for (size_t i = 0; i < f->lines.size(); i++) {
+		if (!strcmp(f->lines[i].first, key))
+			return f->lines[i].second;
+	}
+	return NULL;
+}
+
+/* print the value of a status line, or its column-th tab separated part */
+static void print_pid_status(struct text_object *obj, char *p, int p_max_size,
+		const char *key, int column, const char *notfound)
+{
+	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
+	char pathbuf[64];
+	pid_t pid;
+	const char *value;
+	size_t len;
+
+	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
+	pid = strtopid(objbuf.get());
+	if (!get_pid_file(pid, PID_FILE_STATUS))
+		return;
+	value = pid_file_value(pid, PID_FILE_STATUS, key);
+	for (; column > 0 && value; column--) {
+		if ((value = strchr(value, '\t')))
+			value++;
+	}
+	if (!value) {
+		snprintf(pathbuf, 64, PROCDIR "/%d/status", pid);
+		NORM_ERR(notfound, pathbuf);
+		return;
+	}
+	len = column < 0 ? strlen(value) : strcspn(value, "\t");
+	snprintf(p, p_max_size, "%.*s", (int) len, value);
+}
+
 struct ll_string {
 	char *string;
 	struct ll_string* next;
@@ -123,24 +295,20 @@ void print_pid_chroot(struct text_object *obj, char *p, int p_max_size) {
 
 void print_pid_cmdline(struct text_object *obj, char *p, int p_max_size)
 {
-	char* buf;
-	int i, bytes_read;
-	char pathbuf[64];
+	const struct pid_file *f;
+	int i;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
 	if(*(objbuf.get()) != 0) {
-		snprintf(pathbuf, 64, PROCDIR "/%d/cmdline", strtopid(objbuf.get()));
-		buf = readfile(pathbuf, &bytes_read, 1);
-		if(buf != NULL) {
-			for(i = 0; i < bytes_read-1; i++) {
-				if(buf[i] == 0) {
-					buf[i] = ' ';
-				}
+		f = get_pid_file(strtopid(objbuf.get()), PID_FILE_CMDLINE);
+		if(f != NULL) {
+			/* the arguments are separated by (and end with) a 0 */
+			for(i = 0; i < (int) f->len - 1 && i < p_max_size - 1; i++) {
+				p[i] = f->data[i] ? f->data[i] : ' ';
 			}
-			snprintf(p, p_max_size, "%s", buf);
-			free(buf);
+			p[i] = 0;
 		}
 	} else {
 		NORM_ERR("$pid_cmdline didn't receive a argument");
@@ -167,29 +335,29 @@ void print_pid_cwd(struct text_object *obj, char *p, int p_max_size)
 
 void print_pid_environ(struct text_object *obj, char *p, int p_max_size)
 {
-	int i, total_read;
+	int i;
+	size_t len;
 	pid_t pid;
-	char pathbuf[64];
+	const struct pid_file *f;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-	char *buf, *var=strdup(obj->data.s);;
+	char *var=strdup(obj->data.s);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 	if(sscanf(objbuf.get(), "%d %s", &pid, var) == 2) {
 		for(i = 0; var[i] != 0; i++) {
 			var[i] = toupper(var[i]);
 		}
-		snprintf(pathbuf, 64, PROCDIR "/%d/environ", pid);
-		buf = readfile(pathbuf, &total_read, 1);
-		if(buf != NULL) {
-			for(i = 0; i < total_read; i += strlen(buf + i) + 1) {
-				if(strncmp(buf + i, var, strlen(var)) == 0 && *(buf + i + strlen(var)) == '=') {
-					snprintf(p, p_max_size, "%s", buf + i + strlen(var) + 1);
-					free(buf);
+		len = strlen(var);
+		f = get_pid_file(pid, PID_FILE_ENVIRON);
+		if(f != NULL) {
+			const char *env = f->data.data();
+			for(i = 0; i < (int) f->len; i += strlen(env + i) + 1) {
+				if(strncmp(env + i, var, len) == 0 && env[i + len] == '=') {
+					snprintf(p, p_max_size, "%s", env + i + len + 1);
 					free(var);
 					return;
 				}
 			}
-			free(buf);
 		}
 		*p = 0;
 	}
@@ -198,28 +366,22 @@ void print_pid_environ(struct text_object *obj, char *p, int p_max_size)
 
 void print_pid_environ_list(struct text_object *obj, char *p, int p_max_size)
 {
-	char *buf = NULL;
-	char *buf2;
-	int bytes_read, total_read;
-	int i = 0;
-	char pathbuf[64];
+	const struct pid_file *f;
+	const char *env;
+	int i, n = 0;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/environ", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &total_read, 1);
-	if(buf != NULL) {
-		for(bytes_read = 0; bytes_read < total_read; buf[i-1] = ';') {
-			buf2 = strdup(buf+bytes_read);
-			bytes_read += strlen(buf2)+1;
-			sscanf(buf2, "%[^=]", buf+i);
-			free(buf2);
-			i = strlen(buf) + 1;
+
+	f = get_pid_file(strtopid(objbuf.get()), PID_FILE_ENVIRON);
+	if(f != NULL) {
+		/* the names of the variables, separated by ';' */
+		env = f->data.data();
+		for(i = 0; i < (int) f->len && n < p_max_size - 1; i += strlen(env + i) + 1) {
+			int len = strcspn(env + i, "=");
+
+			n += snprintf(p + n, p_max_size - n, "%s%.*s", n ? ";" : "", len, env + i);
 		}
-		buf[i-1] = 0;
-		snprintf(p, p_max_size, "%s", buf);
-		free(buf);
 	}
 }
 
@@ -233,21 +395,15 @@ void print_pid_exe(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_pid_nice(struct text_object *obj, char *p, int p_max_size) {
-	char *buf = NULL;
-	int bytes_read;
-	long int nice_value;
-	char pathbuf[64];
+	const char *value;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
-	if(*(obj->data.s) != 0) {
-		snprintf(pathbuf, 64, PROCDIR "/%d/stat", strtopid(objbuf.get()));
-		buf = readfile(pathbuf, &bytes_read, 1);
-		if(buf != NULL) {
-			sscanf(buf, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %ld", &nice_value);
-			snprintf(p, p_max_size, "%ld", nice_value);
-			free(buf);
+	if(*(objbuf.get()) != 0) {
+		value = pid_stat_field(strtopid(objbuf.get()), 19);
+		if(value != NULL) {
+			snprintf(p, p_max_size, "%ld", strtol(value, NULL, 10));
 		}
 	} else {
 		NORM_ERR("$pid_nice didn't receive a argument");
@@ -291,49 +447,20 @@ void print_pid_openfiles(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_pid_parent(struct text_object *obj, char *p, int p_max_size) {
-#define PARENT_ENTRY "PPid:\t"
 #define PARENTNOTFOUND	"Can't find the process parent in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, PARENT_ENTRY);
-		if(begin != NULL) {
-			begin += strlen(PARENT_ENTRY);
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(PARENTNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, "PPid", -1, PARENTNOTFOUND);
 }
 
 void print_pid_priority(struct text_object *obj, char *p, int p_max_size) {
-	char *buf = NULL;
-	int bytes_read;
-	long int priority;
-	char pathbuf[64];
+	const char *value;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
 	if(*(objbuf.get()) != 0) {
-		snprintf(pathbuf, 64, PROCDIR "/%d/stat", strtopid(objbuf.get()));
-		buf = readfile(pathbuf, &bytes_read, 1);
-		if(buf != NULL) {
-			sscanf(buf, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %ld", &priority);
-			snprintf(p, p_max_size, "%ld", priority);
-			free(buf);
+		value = pid_stat_field(strtopid(objbuf.get()), 18);
+		if(value != NULL) {
+			snprintf(p, p_max_size, "%ld", strtol(value, NULL, 10));
 		}
 	} else {
 		NORM_ERR("$pid_priority didn't receive a argument");
@@ -341,52 +468,30 @@ void print_pid_priority(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_pid_state(struct text_object *obj, char *p, int p_max_size) {
-#define STATE_ENTRY "State:\t"
 #define STATENOTFOUND	"Can't find the process state in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
+	const char *value, *begin, *end;
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, STATE_ENTRY);
-		if(begin != NULL) {
-			begin += strlen(STATE_ENTRY) + 3;	// +3 will strip the char representing the short state and the space and '(' that follow
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end-1) = 0;	// -1 strips the ')'
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(STATENOTFOUND, pathbuf);
-		}
-		free(buf);
+
+	/* "S (sleeping)", the part in parentheses */
+	value = pid_file_value(strtopid(objbuf.get()), PID_FILE_STATUS, "State");
+	if(value != NULL && (begin = strchr(value, '(')) && (end = strchr(begin, ')'))) {
+		snprintf(p, p_max_size, "%.*s", (int) (end - begin - 1), begin + 1);
+	} else if(value != NULL) {
+		NORM_ERR(STATENOTFOUND, objbuf.get());
 	}
 }
 
 void print_pid_state_short(struct text_object *obj, char *p, int p_max_size) {
-	char *begin, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
+	const char *value;
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, STATE_ENTRY);
-		if(begin != NULL) {
-			snprintf(p, p_max_size, "%c", *begin);
-		} else {
-			NORM_ERR(STATENOTFOUND, pathbuf);
-		}
-		free(buf);
+	value = pid_file_value(strtopid(objbuf.get()), PID_FILE_STATUS, "State");
+	if(value != NULL) {
+		snprintf(p, p_max_size, "%c", *value);
 	}
 }
 
@@ -475,31 +580,8 @@ void print_cmdline_to_pid(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_pid_threads(struct text_object *obj, char *p, int p_max_size) {
-#define THREADS_ENTRY "Threads:\t"
 #define THREADSNOTFOUND	"Can't find the number of the threads of the process in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, THREADS_ENTRY);
-		if(begin != NULL) {
-			begin += strlen(THREADS_ENTRY);
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(THREADSNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, "Threads", -1, THREADSNOTFOUND);
 }
 
 void print_pid_thread_list(struct text_object *obj, char *p, int p_max_size) {
@@ -528,21 +610,15 @@ void print_pid_thread_list(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_pid_time_kernelmode(struct text_object *obj, char *p, int p_max_size) {
-	char *buf = NULL;
-	int bytes_read;
-	unsigned long int umtime;
-	char pathbuf[64];
+	const char *value;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
 	if(*(objbuf.get()) != 0) {
-		snprintf(pathbuf, 64, PROCDIR "/%d/stat", strtopid(objbuf.get()));
-		buf = readfile(pathbuf, &bytes_read, 1);
-		if(buf != NULL) {
-			sscanf(buf, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu", &umtime);
-			snprintf(p, p_max_size, "%.2f", (float) umtime / 100);
-			free(buf);
+		value = pid_stat_field(strtopid(objbuf.get()), 15);
+		if(value != NULL) {
+			snprintf(p, p_max_size, "%.2f", (float) strtoul(value, NULL, 10) / 100);
 		}
 	} else {
 		NORM_ERR("$pid_time_kernelmode didn't receive a argument");
@@ -550,21 +626,15 @@ void print_pid_time_kernelmode(struct text_object *obj, char *p, int p_max_size)
 }
 
 void print_pid_time_usermode(struct text_object *obj, char *p, int p_max_size) {
-	char *buf = NULL;
-	int bytes_read;
-	unsigned long int kmtime;
-	char pathbuf[64];
+	const char *value;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
 	if(*(objbuf.get()) != 0) {
-		snprintf(pathbuf, 64, PROCDIR "/%d/stat", strtopid(objbuf.get()));
-		buf = readfile(pathbuf, &bytes_read, 1);
-		if(buf != NULL) {
-			sscanf(buf, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %lu", &kmtime);
-			snprintf(p, p_max_size, "%.2f", (float) kmtime / 100);
-			free(buf);
+		value = pid_stat_field(strtopid(objbuf.get()), 14);
+		if(value != NULL) {
+			snprintf(p, p_max_size, "%.2f", (float) strtoul(value, NULL, 10) / 100);
 		}
 	} else {
 		NORM_ERR("$pid_time_usermode didn't receive a argument");
@@ -572,376 +642,151 @@ void print_pid_time_usermode(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_pid_time(struct text_object *obj, char *p, int p_max_size) {
-	char *buf = NULL;
-	int bytes_read;
-	unsigned long int umtime, kmtime;
-	char pathbuf[64];
+	const char *umtime, *kmtime;
+	pid_t pid;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
 
 	if(*(objbuf.get()) != 0) {
-		snprintf(pathbuf, 64, PROCDIR "/%d/stat", strtopid(objbuf.get()));
-		buf = readfile(pathbuf, &bytes_read, 1);
-		if(buf != NULL) {
-			sscanf(buf, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &umtime, &kmtime);
-			snprintf(p, p_max_size, "%.2f", (float) (umtime + kmtime) / 100);
-			free(buf);
+		pid = strtopid(objbuf.get());
+		umtime = pid_stat_field(pid, 14);
+		kmtime = pid_stat_field(pid, 15);
+		if(umtime != NULL && kmtime != NULL) {
+			snprintf(p, p_max_size, "%.2f",
+					(float) (strtoul(umtime, NULL, 10) + strtoul(kmtime, NULL, 10)) / 100);
 		}
 	} else {
 		NORM_ERR("$pid_time didn't receive a argument");
 	}
 }
 
-#define UID_ENTRY "Uid:\t"
+#define UID_ENTRY "Uid"
 void print_pid_uid(struct text_object *obj, char *p, int p_max_size) {
 #define UIDNOTFOUND	"Can't find the process real uid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, UID_ENTRY);
-		if(begin != NULL) {
-			begin += strlen(UID_ENTRY);
-			end = strchr(begin, '\t');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(UIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, UID_ENTRY, 0, UIDNOTFOUND);
 }
 
 void print_pid_euid(struct text_object *obj, char *p, int p_max_size) {
 #define EUIDNOTFOUND	"Can't find the process effective uid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, UID_ENTRY);
-		if(begin != NULL) {
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			end = strchr(begin, '\t');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(EUIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, UID_ENTRY, 1, EUIDNOTFOUND);
 }
 
 void print_pid_suid(struct text_object *obj, char *p, int p_max_size) {
 #define SUIDNOTFOUND	"Can't find the process saved set uid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, UID_ENTRY);
-		if(begin != NULL) {
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			end = strchr(begin, '\t');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(SUIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, UID_ENTRY, 2, SUIDNOTFOUND);
 }
 
 void print_pid_fsuid(struct text_object *obj, char *p, int p_max_size) {
 #define FSUIDNOTFOUND	"Can't find the process file system uid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, UID_ENTRY);
-		if(begin != NULL) {
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(FSUIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, UID_ENTRY, 3, FSUIDNOTFOUND);
 }
 
-#define GID_ENTRY "Gid:\t"
+#define GID_ENTRY "Gid"
 void print_pid_gid(struct text_object *obj, char *p, int p_max_size) {
 #define GIDNOTFOUND	"Can't find the process real gid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, GID_ENTRY);
-		if(begin != NULL) {
-			begin += strlen(GID_ENTRY);
-			end = strchr(begin, '\t');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(GIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, GID_ENTRY, 0, GIDNOTFOUND);
 }
 
 void print_pid_egid(struct text_object *obj, char *p, int p_max_size) {
 #define EGIDNOTFOUND	"Can't find the process effective gid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, GID_ENTRY);
-		if(begin != NULL) {
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			end = strchr(begin, '\t');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(EGIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, GID_ENTRY, 1, EGIDNOTFOUND);
 }
 
 void print_pid_sgid(struct text_object *obj, char *p, int p_max_size) {
 #define SGIDNOTFOUND	"Can't find the process saved set gid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, GID_ENTRY);
-		if(begin != NULL) {
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			end = strchr(begin, '\t');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(SGIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, GID_ENTRY, 2, SGIDNOTFOUND);
 }
 
 void print_pid_fsgid(struct text_object *obj, char *p, int p_max_size) {
 #define FSGIDNOTFOUND	"Can't find the process file system gid in '%s'"
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, GID_ENTRY);
-		if(begin != NULL) {
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			begin = strchr(begin, '\t'); begin++;
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(FSGIDNOTFOUND, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, GID_ENTRY, 3, FSGIDNOTFOUND);
 }
 
 void internal_print_pid_vm(struct text_object *obj, char *p, int p_max_size, const char* entry, const char* errorstring) {
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
-	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
-
-	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/status", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, entry);
-		if(begin != NULL) {
-			begin += strlen(entry);
-			while(*begin == '\t' || *begin == ' ') {
-				begin++;
-			}
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(errorstring, pathbuf);
-		}
-		free(buf);
-	}
+	print_pid_status(obj, p, p_max_size, entry, -1, errorstring);
 }
 
 void print_pid_vmpeak(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmPeak:\t", "Can't find the process peak virtual memory size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmPeak", "Can't find the process peak virtual memory size in '%s'");
 }
 
 void print_pid_vmsize(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmSize:\t", "Can't find the process virtual memory size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmSize", "Can't find the process virtual memory size in '%s'");
 }
 
 void print_pid_vmlck(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmLck:\t", "Can't find the process locked memory size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmLck", "Can't find the process locked memory size in '%s'");
 }
 
 void print_pid_vmhwm(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmHWM:\t", "Can't find the process peak resident set size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmHWM", "Can't find the process peak resident set size in '%s'");
 }
 
 void print_pid_vmrss(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmHWM:\t", "Can't find the process resident set size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmRSS", "Can't find the process resident set size in '%s'");
 }
 
 void print_pid_vmdata(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmData:\t", "Can't find the process data segment size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmData", "Can't find the process data segment size in '%s'");
 }
 
 void print_pid_vmstk(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmData:\t", "Can't find the process stack segment size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmStk", "Can't find the process stack segment size in '%s'");
 }
 
 void print_pid_vmexe(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmData:\t", "Can't find the process text segment size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmExe", "Can't find the process text segment size in '%s'");
 }
 
 void print_pid_vmlib(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmLib:\t", "Can't find the process shared library code size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmLib", "Can't find the process shared library code size in '%s'");
 }
 
 void print_pid_vmpte(struct text_object *obj, char *p, int p_max_size) {
-	internal_print_pid_vm(obj, p, p_max_size, "VmPTE:\t", "Can't find the process page table entries size in '%s'");
+	internal_print_pid_vm(obj, p, p_max_size, "VmPTE", "Can't find the process page table entries size in '%s'");
 }
 
-#define READ_ENTRY "read_bytes: "
+#define READ_ENTRY "read_bytes"
 #define READNOTFOUND	"Can't find the amount of bytes read in '%s'"
 void print_pid_read(struct text_object *obj, char *p, int p_max_size) {
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
+	char pathbuf[64];
+	pid_t pid;
+	const char *value;
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/io", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, READ_ENTRY);
-		if(begin != NULL) {
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(READNOTFOUND, pathbuf);
-		}
-		free(buf);
+	pid = strtopid(objbuf.get());
+	if(!get_pid_file(pid, PID_FILE_IO))
+		return;
+
+	value = pid_file_value(pid, PID_FILE_IO, READ_ENTRY);
+	if(value != NULL) {
+		snprintf(p, p_max_size, "%s: %s", READ_ENTRY, value);
+	} else {
+		snprintf(pathbuf, 64, PROCDIR "/%d/io", pid);
+		NORM_ERR(READNOTFOUND, pathbuf);
 	}
 }
 
-#define WRITE_ENTRY "write_bytes: "
+#define WRITE_ENTRY "write_bytes"
 #define WRITENOTFOUND	"Can't find the amount of bytes written in '%s'"
 void print_pid_write(struct text_object *obj, char *p, int p_max_size) {
-	char *begin, *end, *buf = NULL;
-	int bytes_read;
-	char pathbuf[64];
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
+	char pathbuf[64];
+	pid_t pid;
+	const char *value;
 
 	generate_text_internal(objbuf.get(), max_user_text.get(*state), *obj->sub);
-	snprintf(pathbuf, 64, PROCDIR "/%d/io", strtopid(objbuf.get()));
-
-	buf = readfile(pathbuf, &bytes_read, 1);
-	if(buf != NULL) {
-		begin = strstr(buf, WRITE_ENTRY);
-		if(begin != NULL) {
-			end = strchr(begin, '\n');
-			if(end != NULL) {
-				*(end) = 0;
-			}
-			snprintf(p, p_max_size, "%s", begin);
-		} else {
-			NORM_ERR(WRITENOTFOUND, pathbuf);
-		}
-		free(buf);
+	pid = strtopid(objbuf.get());
+	if(!get_pid_file(pid, PID_FILE_IO))
+		return;
+
+	value = pid_file_value(pid, PID_FILE_IO, WRITE_ENTRY);
+	if(value != NULL) {
+		snprintf(p, p_max_size, "%s: %s", WRITE_ENTRY, value);
+	} else {
+		snprintf(pathbuf, 64, PROCDIR "/%d/io", pid);
+		NORM_ERR(WRITENOTFOUND, pathbuf);
 	}
 }
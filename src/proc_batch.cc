@@ -0,0 +1,350 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "logging.h"
+#include "proc_batch.h"
+#include "samples.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef BUILD_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif /* BUILD_IO_URING */
+
+#define PROC_BATCH_ENTRIES 256
+
+namespace {
+	void run_op(struct proc_batch_op *op)
+	{
+		if (op->stx) {
+			op->res = statx(op->fd, "", AT_EMPTY_PATH, STATX_BASIC_STATS, op->stx) < 0 ?
+				-errno : 0;
+			return;
+		}
+		do {
+			op->res = pread(op->fd, op->buf, op->len, 0);
+		} while (op->res < 0 && errno == EINTR);
+		if (op->res < 0)
+			op->res = -errno;
+	}
+
+#ifdef BUILD_IO_URING
+	struct uring {
+		int fd;
+		unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+		unsigned *cq_head, *cq_tail, *cq_mask;
+		struct io_uring_sqe *sqes;
+		struct io_uring_cqe *cqes;
+		unsigned entries;
+	};
+
+	/* the rings that are not in use, a thread takes one for its batch, so
+	 * there are as many as batches ran at the same time */
+	std::mutex rings_mutex;
+	std::vector<uring *> free_rings;
+	/* io_uring didn't work, don't try again */
+	std::atomic<bool> unusable(false);
+
+	uring *setup_ring(void)
+	{
+		struct io_uring_params p;
+		size_t sq_len, cq_len;
+		char *sq, *cq;
+		void *sqes;
+		uring *ring;
+		int fd;
+
+		memset(&p, 0, sizeof(p));
+		fd = syscall(__NR_io_uring_setup, PROC_BATCH_ENTRIES, &p);
+		if (fd < 0)
+			return NULL;
+
+		sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+			sq_len = cq_len = std::max(sq_len, cq_len);
+		sq = (char *) mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq == MAP_FAILED)
+			goto fail;
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			cq = sq;
+		} else {
+			cq = (char *) mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cq == MAP_FAILED)
+				goto fail;
+		}
+		sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+				IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			goto fail;
+
+		/* the mappings stay until conky exits */
+		ring = new uring;
+		ring->fd = fd;
+		ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+		ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+		ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+		ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+		ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+		ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+		ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+		ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+		ring->sqes = (struct io_uring_sqe *) sqes;
+		ring->entries = p.sq_entries;
+		return ring;
+
+fail:
+		close(fd);
+		return NULL;
+	}
+
+	int ring_enter(uring *ring, unsigned to_submit, unsigned min_complete,
+			unsigned flags)
+	{
+		return syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+				flags, NULL, 0);
+	}
+
+	/* submits ops[0..n), n being at most ring->entries, and waits for them.
+	 * The ops the kernel did not take are withdrawn from the ring and keep
+	 * res INT_MIN. Returns false if the ring can't be used again, which
+	 * leaves ops it may still complete. */
+	bool run_ring(uring *ring, struct proc_batch_op *ops, unsigned n)
+	{
+		static const char empty_path[] = "";
+		unsigned tail = *ring->sq_tail, head;
+		int submitted;
+
+		for (unsigned i = 0; i < n; i++, tail++) {
+			unsigned idx = tail & *ring->sq_mask;
+			struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->fd = ops[i].fd;
+			if (ops[i].stx) {
+				sqe->opcode = IORING_OP_STATX;
+				sqe->addr = (unsigned long) empty_path;
+				sqe->len = STATX_BASIC_STATS;
+				sqe->statx_flags = AT_EMPTY_PATH;
+				sqe->off = (unsigned long) ops[i].stx;
+			} else {
+				sqe->opcode = IORING_OP_READ;
+				sqe->addr = (unsigned long) ops[i].buf;
+				sqe->len = ops[i].len;
+				sqe->off = 0;
+			}
+			sqe->user_data = i;
+			ring->sq_array[idx] = idx;
+			ops[i].res = INT_MIN;
+		}
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+		do {
+			submitted = ring_enter(ring, n, 0, 0);
+		} while (submitted < 0 && errno == EINTR);
+		/* the kernel only looks at the ring in io_uring_enter(), so what it
+		 * left there can be taken back by moving the tail back to its head */
+		__atomic_store_n(ring->sq_tail, __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE),
+				__ATOMIC_RELEASE);
+		if (submitted < 0)
+			submitted = 0;
+
+		for (int done = 0; done < submitted; ) {
+			head = *ring->cq_head;
+			if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+				if (ring_enter(ring, 0, submitted - done, IORING_ENTER_GETEVENTS) < 0 &&
+						errno != EINTR)
+					return false;
+				continue;
+			}
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+			ops[cqe->user_data].res = cqe->res;
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			done++;
+		}
+		return true;
+	}
+#endif /* BUILD_IO_URING */
+
+	std::mutex batch_mutex;
+	std::vector<proc_file *> batch;
+	unsigned int last_generation = 0;
+	std::atomic<unsigned int> generation(0);
+}
+
+void proc_batch_run(struct proc_batch_op *ops, size_t n)
+{
+	size_t i;
+
+	if (n == 0)
+		return;
+#ifdef BUILD_IO_URING
+	uring *ring = NULL;
+
+	if (!unusable) {
+		std::unique_lock<std::mutex> lock(rings_mutex);
+
+		if (!free_rings.empty()) {
+			ring = free_rings.back();
+			free_rings.pop_back();
+		} else {
+			lock.unlock();
+			if (!(ring = setup_ring())) {
+				if (!unusable.exchange(true))
+					NORM_ERR("io_uring is not available, files are read one by one");
+			}
+		}
+	}
+	if (ring) {
+		bool ok = true;
+		size_t unsupported = 0;
+
+		for (i = 0; i < n && ok; i += ring->entries)
+			ok = run_ring(ring, ops + i, std::min<size_t>(ring->entries, n - i));
+		if (!ok) {
+			/* the buffers of the ops it didn't complete may still be written,
+			 * so the ring is dropped with them */
+			NORM_ERR("io_uring failed: %s, files are read one by one", strerror(errno));
+			unusable = true;
+			return;
+		}
+		/* what the kernel didn't take or can't do (no IORING_OP_READ or
+		 * IORING_OP_STATX before 5.6) is done here */
+		for (i = 0; i < n; i++) {
+			if (ops[i].res == -EINVAL || ops[i].res == -EOPNOTSUPP)
+				unsupported++;
+			else if (ops[i].res != INT_MIN)
+				continue;
+			run_op(&ops[i]);
+		}
+		if (unsupported == n && !unusable.exchange(true))
+			NORM_ERR("io_uring can't read files, they are read one by one");
+		std::lock_guard<std::mutex> lock(rings_mutex);
+		free_rings.push_back(ring);
+		return;
+	}
+#endif /* BUILD_IO_URING */
+	for (i = 0; i < n; i++)
+		run_op(&ops[i]);
+}
+
+void proc_batch_add(proc_file *f)
+{
+	std::lock_guard<std::mutex> lock(batch_mutex);
+
+	if (std::find(batch.begin(), batch.end(), f) == batch.end())
+		batch.push_back(f);
+}
+
+void proc_batch_remove(proc_file *f)
+{
+	std::lock_guard<std::mutex> lock(batch_mutex);
+
+	batch.erase(std::remove(batch.begin(), batch.end(), f), batch.end());
+}
+
+/* the friend of proc_file which reads ahead */
+class proc_batch {
+public:
+	static void prefetch(void);
+};
+
+void proc_batch::prefetch(void)
+{
+	std::lock_guard<std::mutex> lock(batch_mutex);
+	std::vector<proc_file *> files;
+	std::vector<struct proc_batch_op> ops;
+	unsigned int gen;
+
+	if (++last_generation == 0)
+		++last_generation;
+	gen = last_generation;
+	generation = gen;
+	if (batch.empty() || replaying_samples)
+		return;
+
+	/* a file that is being read by a callback from the last update is left
+	 * out, and so is one that wasn't read since the last prefetch */
+	files.reserve(batch.size());
+	ops.reserve(batch.size());
+	for (auto i = batch.begin(); i != batch.end(); ++i) {
+		proc_file *f = *i;
+
+		if (!f->mutex.try_lock())
+			continue;
+		if (f->fd < 0 || !f->buf || !f->wanted) {
+			f->mutex.unlock();
+			continue;
+		}
+		if (f->psize < f->size) {
+			f->psize = f->size;
+			f->pbuf = (char *) realloc(f->pbuf, f->psize);
+		}
+		files.push_back(f);
+		ops.push_back({ f->fd, f->pbuf, (unsigned int) f->psize - 1, NULL, 0 });
+	}
+	proc_batch_run(ops.data(), ops.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		files[i]->wanted = false;
+		files[i]->prefetch_res = ops[i].res;
+		files[i]->prefetch_gen = gen;
+		files[i]->mutex.unlock();
+	}
+}
+
+void proc_batch_prefetch(void)
+{
+	proc_batch::prefetch();
+}
+
+void proc_batch_end_update(void)
+{
+	generation = 0;
+}
+
+unsigned int proc_batch_generation(void)
+{
+	return generation;
+}
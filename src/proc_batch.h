@@ -0,0 +1,71 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PROC_BATCH_H
+#define _PROC_BATCH_H
+
+#include <stddef.h>
+
+class proc_file;
+struct statx;
+
+/* Small files in /proc and /sys that are read in bulk, the stat files of
+ * top's processes or the inputs of a sensor chip, are read in batches. With
+ * BUILD_IO_URING and a kernel that has io_uring (5.6 or later for
+ * IORING_OP_READ), one io_uring_enter() submits a whole batch; otherwise the
+ * operations are done one by one, as they would be without batching. */
+
+/* One operation of a batch: with stx NULL, read up to len bytes of fd from
+ * offset 0 into buf, otherwise statx() the fd itself into stx. res gets what
+ * the syscall returns, the number of bytes read or 0, or -errno. */
+struct proc_batch_op {
+	int fd;
+	char *buf;
+	unsigned int len;
+	struct statx *stx;
+	int res;
+};
+
+/* runs ops[0..n), which may be called from several threads at once */
+void proc_batch_run(struct proc_batch_op *ops, size_t n);
+
+/* The batched proc_files (those read on every update) are read ahead at the
+ * start of each update with proc_batch_prefetch(), into a second buffer of
+ * the file. proc_file::read() takes that result if it was made for the
+ * current update, which ends with proc_batch_end_update(). A file is added on
+ * its first read, and only read ahead while it is read in every update. */
+void proc_batch_add(proc_file *f);
+void proc_batch_remove(proc_file *f);
+void proc_batch_prefetch(void);
+void proc_batch_end_update(void);
+/* the update proc_batch_prefetch() last read ahead for, 0 once it ended */
+unsigned int proc_batch_generation(void);
+
+#endif /* _PROC_BATCH_H */
@@ -0,0 +1,316 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "logging.h"
+#include "profile.h"
+#include <time.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+bool profiling = false;
+bool profile_report = false;
+unsigned long profile_frames = 0;
+unsigned long profile_x_requests = 0;
+
+namespace {
+	struct profile_entry {
+		std::string label;
+		unsigned long calls;
+		/* seconds, in total */
+		double wall, cpu;
+		double max_wall;
+		/* decaying averages per call, for watching it live */
+		double recent_wall, recent_cpu;
+		/* keyed by the address of a text object or callback */
+		bool transient;
+		/* the wall times of the last calls of a phase, for the percentiles
+		 * of the report; next is where the next one goes */
+		std::vector<float> samples;
+		size_t next;
+	};
+
+	/* the weight of the newest call in the recent averages */
+	const double profile_decay = 0.1;
+	/* the calls of a phase the percentiles are of */
+	const size_t profile_max_samples = 1 << 16;
+
+	std::mutex profile_mutex;
+	std::vector<profile_entry> profile_entries;
+	/* the entry of each thing measured; the entries outlive the keys */
+	std::unordered_map<const void *, size_t> profile_keys;
+
+	double clock_seconds(clockid_t clock)
+	{
+		struct timespec ts;
+
+		clock_gettime(clock, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	/* called with the mutex locked, the label is empty if key is new */
+	profile_entry &add_time(const void *key, const struct profile_start &start)
+	{
+		double wall = clock_seconds(CLOCK_MONOTONIC) - start.wall;
+		double cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID) - start.cpu;
+		auto i = profile_keys.find(key);
+
+		if (i == profile_keys.end()) {
+			i = profile_keys.insert(std::make_pair(key, profile_entries.size())).first;
+			profile_entries.push_back(profile_entry());
+			profile_entry &e = profile_entries.back();
+			e.calls = 0;
+			e.wall = e.cpu = e.max_wall = 0;
+			e.transient = false;
+			e.next = 0;
+			e.recent_wall = wall;
+			e.recent_cpu = cpu;
+		}
+		profile_entry &e = profile_entries[i->second];
+		e.calls++;
+		e.wall += wall;
+		e.cpu += cpu;
+		e.max_wall = std::max(e.max_wall, wall);
+		e.recent_wall += (wall - e.recent_wall) * profile_decay;
+		e.recent_cpu += (cpu - e.recent_cpu) * profile_decay;
+		return e;
+	}
+
+	/* indices of the entries, the slowest first; called with the mutex
+	 * locked */
+	std::vector<size_t> slowest(bool recent)
+	{
+		std::vector<size_t> order(profile_entries.size());
+
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [recent](size_t a, size_t b) {
+			const profile_entry &x = profile_entries[a], &y = profile_entries[b];
+			return recent ? x.recent_wall > y.recent_wall : x.wall > y.wall;
+		});
+		return order;
+	}
+}
+
+void profile_begin(struct profile_start &start)
+{
+	start.wall = clock_seconds(CLOCK_MONOTONIC);
+	start.cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+double profile_elapsed(const struct profile_start &start)
+{
+	return clock_seconds(CLOCK_MONOTONIC) - start.wall;
+}
+
+void profile_end(const void *key, const std::string &label,
+		const struct profile_start &start)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+	profile_entry &e = add_time(key, start);
+	float wall = profile_elapsed(start);
+
+	if (e.label.empty())
+		e.label = label;
+	if (e.samples.size() < profile_max_samples)
+		e.samples.push_back(wall);
+	else
+		e.samples[e.next] = wall;
+	e.next = (e.next + 1) % profile_max_samples;
+}
+
+void profile_end_callback(const conky::priv::callback_base *cb,
+		const struct profile_start &start)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+	profile_entry &e = add_time(cb, start);
+
+	if (e.label.empty()) {
+		e.label = "callback " + cb->describe();
+		e.transient = true;
+	}
+}
+
+void profile_end_object(const struct text_object *obj,
+		const struct profile_start &start)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+	profile_entry &e = add_time(obj, start);
+
+	if (e.label.empty()) {
+		e.transient = true;
+		char buf[128];
+
+		snprintf(buf, sizeof buf, "$%s (line %ld)", obj->name ? obj->name : "text",
+				obj->line);
+		e.label = buf;
+	}
+}
+
+/* the wall time in ms that fraction of the sorted samples are below */
+static double percentile(const std::vector<float> &sorted, double fraction)
+{
+	return sorted[std::min((size_t) (fraction * sorted.size()), sorted.size() - 1)] * 1000;
+}
+
+/* The phases (update, text, layout, draw) have the percentiles of their
+ * last calls as well. The summary at the end is per update: the cpu time of
+ * all threads and the X requests sent. */
+void print_profile_report(void)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+	std::vector<size_t> order = slowest(false);
+	struct rusage usage;
+
+	fprintf(stderr, "%10s %12s %12s %10s %10s %10s %10s %10s  %s\n", "calls", "wall s",
+			"cpu s", "avg ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "what");
+	for (size_t i = 0; i < order.size(); i++) {
+		const profile_entry &e = profile_entries[order[i]];
+
+		fprintf(stderr, "%10lu %12.6f %12.6f %10.4f ", e.calls, e.wall, e.cpu,
+				e.wall * 1000 / e.calls);
+		if (e.samples.empty()) {
+			fprintf(stderr, "%10s %10s %10s ", "-", "-", "-");
+		} else {
+			std::vector<float> sorted(e.samples);
+
+			std::sort(sorted.begin(), sorted.end());
+			fprintf(stderr, "%10.4f %10.4f %10.4f ", percentile(sorted, 0.5),
+					percentile(sorted, 0.9), percentile(sorted, 0.99));
+		}
+		fprintf(stderr, "%10.4f  %s\n", e.max_wall * 1000, e.label.c_str());
+	}
+
+	if (profile_frames == 0 || getrusage(RUSAGE_SELF, &usage) != 0)
+		return;
+	fprintf(stderr, "%lu updates, %.4f cpu ms and %.1f X requests per update\n",
+			profile_frames,
+			(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+			 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6) * 1000
+			/ profile_frames,
+			(double) profile_x_requests / profile_frames);
+}
+
+/* Forget which entry belongs to which text object or callback, as their
+ * addresses may be reused once they are freed. The times stay for the
+ * report. */
+void clear_profile(void)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+
+	for (auto i = profile_keys.begin(); i != profile_keys.end(); ) {
+		if (profile_entries[i->second].transient)
+			i = profile_keys.erase(i);
+		else
+			++i;
+	}
+}
+
+enum conky_profile_field {
+	PROFILE_SUMMARY,
+	PROFILE_NAME,
+	PROFILE_WALL,
+	PROFILE_CPU,
+	PROFILE_TOTAL,
+	PROFILE_CALLS
+};
+
+struct conky_profile_data {
+	unsigned int rank;
+	enum conky_profile_field field;
+};
+
+void parse_conky_profile_arg(struct text_object *obj, const char *arg)
+{
+	struct conky_profile_data *pd;
+	char field[16] = "";
+	unsigned int rank = 1;
+
+	if (arg && sscanf(arg, "%u %15s", &rank, field) < 1) {
+		NORM_ERR("conky_profile needs arguments: [rank] [name|wall|cpu|total|calls]");
+	}
+	pd = new conky_profile_data;
+	pd->rank = std::max(rank, 1u);
+	pd->field = PROFILE_SUMMARY;
+	if (!strcmp(field, "name"))
+		pd->field = PROFILE_NAME;
+	else if (!strcmp(field, "wall"))
+		pd->field = PROFILE_WALL;
+	else if (!strcmp(field, "cpu"))
+		pd->field = PROFILE_CPU;
+	else if (!strcmp(field, "total"))
+		pd->field = PROFILE_TOTAL;
+	else if (!strcmp(field, "calls"))
+		pd->field = PROFILE_CALLS;
+	else if (*field)
+		NORM_ERR("conky_profile: unknown field '%s'", field);
+	obj->data.opaque = pd;
+	profiling = true;
+}
+
+void print_conky_profile(struct text_object *obj, char *p, int p_max_size)
+{
+	struct conky_profile_data *pd = (struct conky_profile_data *) obj->data.opaque;
+	std::lock_guard<std::mutex> lock(profile_mutex);
+
+	if (!pd || pd->rank > profile_entries.size())
+		return;
+	const profile_entry &e = profile_entries[slowest(true)[pd->rank - 1]];
+
+	switch (pd->field) {
+		case PROFILE_SUMMARY:
+			snprintf(p, p_max_size, "%.3fms %s", e.recent_wall * 1000, e.label.c_str());
+			break;
+		case PROFILE_NAME:
+			snprintf(p, p_max_size, "%s", e.label.c_str());
+			break;
+		case PROFILE_WALL:
+			snprintf(p, p_max_size, "%.3f", e.recent_wall * 1000);
+			break;
+		case PROFILE_CPU:
+			snprintf(p, p_max_size, "%.3f", e.recent_cpu * 1000);
+			break;
+		case PROFILE_TOTAL:
+			snprintf(p, p_max_size, "%.3f", e.wall);
+			break;
+		case PROFILE_CALLS:
+			snprintf(p, p_max_size, "%lu", e.calls);
+			break;
+	}
+}
+
+void free_conky_profile(struct text_object *obj)
+{
+	delete (struct conky_profile_data *) obj->data.opaque;
+	obj->data.opaque = NULL;
+}
@@ -0,0 +1,94 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <string>
+#include "text_object.h"
+
+/* Set by --profile and by the conky_profile objects. While it is, the time
+ * spent in every text object, callback and drawing phase is measured. */
+extern bool profiling;
+/* print the report when conky exits, set by --profile */
+extern bool profile_report;
+/* the updates main_loop() did and the X requests it sent, for the report */
+extern unsigned long profile_frames;
+extern unsigned long profile_x_requests;
+
+/* wall and cpu time of the calling thread at the start of a measurement */
+struct profile_start {
+	double wall;
+	double cpu;
+};
+
+void profile_begin(struct profile_start &start);
+/* wall seconds since start */
+double profile_elapsed(const struct profile_start &start);
+
+/* add the time since start to what is known as key; label is only used the
+ * first time key is seen. Phases are keyed by their label. */
+void profile_end(const void *key, const std::string &label,
+		const struct profile_start &start);
+void profile_end_callback(const conky::priv::callback_base *cb,
+		const struct profile_start &start);
+void profile_end_object(const struct text_object *obj,
+		const struct profile_start &start);
+
+/* measures the enclosing scope if profiling; if last is given, the wall time
+ * of the scope is always stored there */
+class profile_scope {
+	const char *label;
+	double *last;
+	struct profile_start start;
+
+	profile_scope(const profile_scope &) = delete;
+	profile_scope& operator=(const profile_scope &) = delete;
+
+public:
+	explicit profile_scope(const char *label_, double *last_ = NULL)
+		: label(profiling ? label_ : NULL), last(last_)
+	{ if (label || last) profile_begin(start); }
+
+	~profile_scope()
+	{
+		if (label) profile_end(label, label, start);
+		if (last) *last = profile_elapsed(start);
+	}
+};
+
+void print_profile_report(void);
+void clear_profile(void);
+
+void parse_conky_profile_arg(struct text_object *, const char *);
+void print_conky_profile(struct text_object *, char *, int);
+void free_conky_profile(struct text_object *);
+
+#endif /* _PROFILE_H */
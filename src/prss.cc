@@ -22,27 +22,29 @@
 #include "prss.h"
 #include "logging.h"
 #include <libxml/parser.h>
-#include <libxml/tree.h>
+#include <libxml/xmlreader.h>
+#include <string>
+#include <vector>
 
 #ifndef PARSE_OPTIONS
 #define PARSE_OPTIONS 0
 #endif
 
-void prss_parse_doc(PRSS *result, xmlDocPtr doc);
+static void prss_parse(PRSS *result, xmlTextReaderPtr reader, int max_items);
 
-PRSS::PRSS(const std::string &xml_data)
+PRSS::PRSS(const std::string &xml_data, int max_items)
 	: version(NULL), title(NULL), link(NULL), description(NULL), language(NULL),
 	  generator(NULL), managingEditor(NULL), webMaster(NULL), docs(NULL), lastBuildDate(NULL),
 	  pubDate(NULL), copyright(NULL), ttl(NULL), items(NULL), item_count(0)
 {
-	std::unique_ptr<xmlDoc, void (*)(xmlDoc *)> doc(
-			xmlReadMemory(xml_data.c_str(), xml_data.length(), "", NULL, PARSE_OPTIONS),
-			xmlFreeDoc);
+	std::unique_ptr<xmlTextReader, void (*)(xmlTextReaderPtr)> reader(
+			xmlReaderForMemory(xml_data.c_str(), xml_data.length(), "", NULL, PARSE_OPTIONS),
+			xmlFreeTextReader);
 
-	if (!doc)
+	if (!reader)
 		throw std::runtime_error("Unable to parse rss data");
 
-	prss_parse_doc(this, doc.get());
+	prss_parse(this, reader.get(), std::max(max_items, 1));
 }
 
 void free_rss_items(PRSS *data)
@@ -83,57 +85,47 @@ PRSS::~PRSS()
 	free(ttl);
 }
 
-static inline void prss_null_item(PRSS_Item *i)
+/* the text of the element the reader is at, NULL if it has none */
+static char *read_text(xmlTextReaderPtr reader)
 {
-	memset(i, 0, sizeof(PRSS_Item));
+	xmlChar *text;
+	char *res;
+
+	if (xmlTextReaderIsEmptyElement(reader))
+		return NULL;
+	text = xmlTextReaderReadString(reader);
+	if (!text)
+		return NULL;
+	res = strdup((const char *) text);
+	xmlFree(text);
+	return res;
 }
 
-static inline void read_item(PRSS_Item *res, xmlNodePtr data)
+static inline void read_item(PRSS_Item *res, const char *name, xmlTextReaderPtr reader)
 {
-	prss_null_item(res);
-
-	for (; data; data = data->next) {
-		xmlNodePtr child;
-
-		if (data->type != XML_ELEMENT_NODE) {
-			continue;
-		}
-		child = data->children;
-
-		if (!child) {
-			continue;
-		}
-
-#define ASSIGN(a) if (strcasecmp((const char*)data->name, #a) == EQUAL) { \
+#define ASSIGN(a) if (strcasecmp(name, #a) == EQUAL) { \
+		if (char *text = read_text(reader)) { \
 			free_and_zero(res->a); \
-			res->a = strdup((const char*)child->content); \
-			continue; \
-		}
-		ASSIGN(title);
-		ASSIGN(link);
-		ASSIGN(description);
-		ASSIGN(category);
-		ASSIGN(pubDate);
-		ASSIGN(guid);
-#undef ASSIGN
+			res->a = text; \
+		} \
+		return; \
 	}
+	ASSIGN(title);
+	ASSIGN(link);
+	ASSIGN(description);
+	ASSIGN(category);
+	ASSIGN(pubDate);
+	ASSIGN(guid);
+#undef ASSIGN
 }
-static inline void read_element(PRSS *res, xmlNodePtr n)
-{
-	xmlNodePtr child;
-
-	if (n->type != XML_ELEMENT_NODE) {
-		return;
-	}
-	child = n->children;
-
-	if (!child) {
-		return;
-	}
 
-#define ASSIGN(a) if (strcasecmp((const char*)n->name, #a) == EQUAL) { \
-		free_and_zero(res->a); \
-		res->a = strdup((const char*)child->content); \
+static inline void read_element(PRSS *res, const char *name, xmlTextReaderPtr reader)
+{
+#define ASSIGN(a) if (strcasecmp(name, #a) == EQUAL) { \
+		if (char *text = read_text(reader)) { \
+			free_and_zero(res->a); \
+			res->a = text; \
+		} \
 		return; \
 	}
 	ASSIGN(title);
@@ -149,100 +141,62 @@ static inline void read_element(PRSS *res, xmlNodePtr n)
 	ASSIGN(copyright);
 	ASSIGN(ttl);
 #undef ASSIGN
-	if (!strcasecmp((const char*)n->name, "item")) {
-		read_item(&res->items[res->item_count++], n->children);
-	}
 }
 
-static inline int parse_rss_2_0(PRSS *res, xmlNodePtr root)
-{
-	xmlNodePtr channel = root->children;
-	xmlNodePtr n;
-	int items = 0;
-
-	DBGP("parsing rss 2.0 or <1 doc");
-
-	while (channel && (channel->type != XML_ELEMENT_NODE
-				|| strcmp((const char *) channel->name, "channel"))) {
-		channel = channel->next;
-	}
-	if (!channel) {
-		return 0;
-	}
-
-	for (n = channel->children; n; n = n->next) {
-		if (n->type == XML_ELEMENT_NODE &&
-				!strcmp((const char *) n->name, "item")) {
-			++items;
-		}
-	}
-
-	free_and_zero(res->version);
-	res->version = strndup("2.0", text_buffer_size.get(*state));
-	free_rss_items(res);
-	res->items = (PRSS_Item*) malloc(items * sizeof(PRSS_Item));
-	res->item_count = 0;
-
-	for (n = channel->children; n; n = n->next) {
-		read_element(res, n);
-	}
-
-	return 1;
-}
-static inline int parse_rss_1_0(PRSS *res, xmlNodePtr root)
+/*
+ * Reads the feed as a stream, which stops at the item after the first
+ * max_items. In RSS 2.0 the items are in <rss><channel>, in RSS 1.0 they are
+ * next to the <channel> in <rdf:RDF>.
+ */
+static void prss_parse(PRSS *res, xmlTextReaderPtr reader, int max_items)
 {
-	int items = 0;
-	xmlNodePtr n;
-
-	DBGP("parsing rss 1.0 doc");
-
-	for (n = root->children; n; n = n->next) {
-		if (n->type == XML_ELEMENT_NODE) {
-			if (!strcmp((const char *) n->name, "item")) {
-				++items;
-			} else if (!strcmp((const char *) n->name, "channel")) {
-				xmlNodePtr i;
+	std::vector<std::string> path;
+	const char *item_parent = NULL;
+	int item_depth = -1;
 
-				for (i = n->children; i; i = i->next) {
-					read_element(res, i);
-				}
-			}
-		}
-	}
-
-	free_and_zero(res->version);
-	res->version = strndup("1.0", text_buffer_size.get(*state));
-	free_rss_items(res);
-	res->items = (PRSS_Item*) malloc(items * sizeof(PRSS_Item));
+	res->items = (PRSS_Item *) calloc(max_items, sizeof(PRSS_Item));
 	res->item_count = 0;
 
-	for (n = root->children; n; n = n->next) {
-		if (n->type == XML_ELEMENT_NODE &&
-				!strcmp((const char *) n->name, "item")) {
-			read_item(&res->items[res->item_count++], n->children);
-		}
-	}
+	while (xmlTextReaderRead(reader) == 1) {
+		int depth;
+		const char *name;
 
-	return 1;
-}
-
-void prss_parse_doc(PRSS *result, xmlDocPtr doc)
-{
-	xmlNodePtr root = xmlDocGetRootElement(doc);
+		if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+			continue;
 
-	do {
-		if (root->type == XML_ELEMENT_NODE) {
-			if (!strcmp((const char *) root->name, "RDF")) {
-				// RSS 1.0 document
-				parse_rss_1_0(result, root);
-				return;
-			} else if (!strcmp((const char *) root->name, "rss")) {
-				// RSS 2.0 or <1.0 document
-				parse_rss_2_0(result, root);
+		depth = xmlTextReaderDepth(reader);
+		name = (const char *) xmlTextReaderConstLocalName(reader);
+		path.resize(depth);
+
+		if (depth == 0) {
+			if (!strcmp(name, "RDF")) {
+				DBGP("parsing rss 1.0 doc");
+				item_parent = "RDF";
+				free_and_zero(res->version);
+				res->version = strndup("1.0", text_buffer_size.get(*state));
+			} else if (!strcmp(name, "rss")) {
+				DBGP("parsing rss 2.0 or <1 doc");
+				item_parent = "channel";
+				free_and_zero(res->version);
+				res->version = strndup("2.0", text_buffer_size.get(*state));
+			} else {
 				return;
 			}
+		} else if (!strcmp(name, "item") && path[depth - 1] == item_parent
+				&& depth == (item_parent[0] == 'R' ? 1 : 2)) {
+			if (res->item_count == max_items)
+				return;
+			item_depth = depth;
+			res->item_count++;
+		} else if (item_depth != -1 && depth == item_depth + 1
+				&& path[item_depth] == "item") {
+			read_item(&res->items[res->item_count - 1], name, reader);
+		} else if (depth == 2 && path[1] == "channel") {
+			read_element(res, name, reader);
 		}
-		root = root->next;
-	} while (root);
-	return;
+		if (!xmlTextReaderIsEmptyElement(reader))
+			path.push_back(name);
+		else
+			path.push_back("");
+	}
 }
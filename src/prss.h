@@ -49,7 +49,8 @@ struct PRSS {
 	PRSS_Item *items;
 	int item_count;
 
-	PRSS(const std::string &xml_data);
+	// reads the feed up to its max_items first items
+	PRSS(const std::string &xml_data, int max_items);
 	~PRSS();
 };
 
@@ -0,0 +1,171 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include "reactor.hh"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
+
+#include "logging.h"
+
+namespace conky {
+	namespace {
+		struct watched_fd {
+			int events;
+			// shared, so that a handler may unwatch its own fd while it runs
+			std::shared_ptr<fd_handler> handler;
+		};
+
+		std::unordered_map<int, watched_fd> watched;
+
+		int timeout_ms(double timeout)
+		{
+			if (timeout <= 0)
+				return 0;
+			return (int) std::min(ceil(timeout * 1000), 86400000.0);
+		}
+
+		int run_handler(int fd, int events)
+		{
+			auto i = watched.find(fd);
+
+			// unwatched by a handler that ran before it
+			if (i == watched.end())
+				return 0;
+			std::shared_ptr<fd_handler> handler = i->second.handler;
+			(*handler)(events);
+			return 1;
+		}
+
+#ifdef HAVE_SYS_EPOLL_H
+		int epfd = -1;
+		std::vector<struct epoll_event> ready;
+
+		uint32_t to_epoll(int events)
+		{
+			uint32_t e = 0;
+
+			if (events & POLLIN)
+				e |= EPOLLIN;
+			if (events & POLLPRI)
+				e |= EPOLLPRI;
+			if (events & POLLOUT)
+				e |= EPOLLOUT;
+			return e;
+		}
+
+		int from_epoll(uint32_t events)
+		{
+			int e = 0;
+
+			if (events & EPOLLIN)
+				e |= POLLIN;
+			if (events & EPOLLPRI)
+				e |= POLLPRI;
+			if (events & EPOLLOUT)
+				e |= POLLOUT;
+			if (events & EPOLLERR)
+				e |= POLLERR;
+			if (events & EPOLLHUP)
+				e |= POLLHUP;
+			return e;
+		}
+#else
+		std::vector<struct pollfd> pollfds;
+#endif /* HAVE_SYS_EPOLL_H */
+	}
+
+	void watch_fd(int fd, int events, const fd_handler &handler)
+	{
+		bool known = watched.count(fd);
+
+		watched[fd] = { events, std::make_shared<fd_handler>(handler) };
+#ifdef HAVE_SYS_EPOLL_H
+		struct epoll_event ev;
+
+		if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			NORM_ERR("can't create epoll instance: %s", strerror(errno));
+			return;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = to_epoll(events);
+		ev.data.fd = fd;
+		if (epoll_ctl(epfd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0)
+			NORM_ERR("can't watch fd %d: %s", fd, strerror(errno));
+#else
+		(void)known;
+#endif /* HAVE_SYS_EPOLL_H */
+	}
+
+	void unwatch_fd(int fd)
+	{
+		if (watched.erase(fd) == 0)
+			return;
+#ifdef HAVE_SYS_EPOLL_H
+		// the fd may have been closed already, which removed it from the set
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif /* HAVE_SYS_EPOLL_H */
+	}
+
+	int wait_for_fds(double timeout)
+	{
+		int n, ran = 0;
+
+		if (watched.empty()) {
+			if (timeout > 0)
+				usleep((useconds_t) (timeout * 1000000));
+			return 0;
+		}
+#ifdef HAVE_SYS_EPOLL_H
+		ready.resize(watched.size());
+		n = epoll_wait(epfd, &ready[0], ready.size(), timeout_ms(timeout));
+		for (int i = 0; i < n; i++)
+			ran += run_handler(ready[i].data.fd, from_epoll(ready[i].events));
+#else
+		pollfds.clear();
+		for (auto i = watched.begin(); i != watched.end(); ++i)
+			pollfds.push_back({ i->first, (short) i->second.events, 0 });
+		n = poll(&pollfds[0], pollfds.size(), timeout_ms(timeout));
+		for (size_t i = 0; n > 0 && i < pollfds.size(); i++) {
+			if (pollfds[i].revents)
+				ran += run_handler(pollfds[i].fd, pollfds[i].revents);
+		}
+#endif /* HAVE_SYS_EPOLL_H */
+		return n < 0 ? -1 : ran;
+	}
+}
@@ -0,0 +1,52 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REACTOR_HH
+#define REACTOR_HH
+
+#include <functional>
+
+namespace conky {
+	/*
+	 * The fds the main loop waits on between updates, besides its timeouts: the X
+	 * connection, the inotify fd and whatever else registers here. Handlers run in
+	 * the main thread, from within wait_for_fds(), with the poll() events (POLLIN,
+	 * POLLPRI, ...) that were reported for their fd. On Linux they are kept in one
+	 * epoll set, so a wait costs the same however many fds there are; elsewhere
+	 * poll() is used.
+	 */
+	typedef std::function<void (int events)> fd_handler;
+
+	// starts waiting for events on fd, replacing an earlier handler of the fd
+	void watch_fd(int fd, int events, const fd_handler &handler);
+	void unwatch_fd(int fd);
+
+	// waits up to timeout seconds for a watched fd and runs the handlers of the
+	// ready ones, returns how many ran, 0 on timeout and -1 on error (EINTR
+	// included)
+	int wait_for_fds(double timeout);
+}
+
+#endif /* REACTOR_HH */
@@ -38,14 +38,219 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <cinttypes>
+#include <cmath>
+#include <mutex>
+#include "update-cb.hh"
+
+#define DEFAULT_TCP_PING_PORT 80
+#define TCP_PING_FAILED "down"
+
+static conky::range_config_setting<double> tcp_ping_timeout("tcp_ping_timeout", 0.0,
+		std::numeric_limits<double>::infinity(), 10.0, true);
+static conky::range_config_setting<double> read_tcpip_timeout("read_tcpip_timeout", 0.0,
+		std::numeric_limits<double>::infinity(), 1.0, true);
 
 struct read_tcpip_data {
 	char *host;
 	unsigned int port;
 };
 
+namespace {
+	double now()
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, 0);
+		return tv.tv_sec + tv.tv_usec / 1000000.0;
+	}
+
+	/* waits for events on sock until the deadline, returns poll()'s result */
+	int wait_for(int sock, short events, double deadline)
+	{
+		struct pollfd pfd = { sock, events, 0 };
+		int ret;
+
+		do {
+			double left = deadline - now();
+			if (left < 0)
+				left = 0;
+			ret = poll(&pfd, 1, lround(left * 1000));
+		} while (ret < 0 && errno == EINTR);
+		return ret;
+	}
+
+	/* starts a nonblocking connect to ai and waits for it until the deadline,
+	 * returns the connected socket or -1 */
+	int connect_until(const struct addrinfo *ai, double deadline)
+	{
+		int sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				ai->ai_protocol);
+		int err = 0;
+		socklen_t errlen = sizeof(err);
+
+		if (sock == -1)
+			return -1;
+		if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+			return sock;
+		if (errno == EINPROGRESS && wait_for(sock, POLLOUT, deadline) > 0
+				&& getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err == 0)
+			return sock;
+		close(sock);
+		return -1;
+	}
+
+	struct addrinfo *resolve(const std::string &host, int port, int socktype, int protocol)
+	{
+		struct addrinfo hints;
+		struct addrinfo *airesult;
+		char portbuf[8];
+
+		memset(&hints, 0, sizeof(struct addrinfo));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = socktype;
+		hints.ai_protocol = protocol;
+		snprintf(portbuf, 8, "%d", port);
+		if (getaddrinfo(host.c_str(), portbuf, &hints, &airesult))
+			return NULL;
+		return airesult;
+	}
+
+	/* Measures how long it takes until a tcp connection to the host is
+	 * answered (accepted or refused), in microseconds. Runs from the callback
+	 * threads, so an unreachable host only delays its own result. */
+	class tcp_ping_cb: public conky::callback<std::string, std::string, int> {
+		typedef conky::callback<std::string, std::string, int> Base;
+
+	protected:
+		virtual void work();
+
+	public:
+		tcp_ping_cb(uint32_t period, const std::string &host, int port)
+			: Base(period, false, Tuple(host, port))
+		{}
+	};
+
+	/* Reads whatever the host sends right after connecting (tcp) or after
+	 * being sent an empty datagram (udp). */
+	class read_tcpip_cb: public conky::callback<std::string, std::string, int, int> {
+		typedef conky::callback<std::string, std::string, int, int> Base;
+
+		int read_reply(const struct addrinfo *airesult, std::string &reply);
+
+	protected:
+		virtual void work();
+
+	public:
+		read_tcpip_cb(uint32_t period, const std::string &host, int port, int protocol)
+			: Base(period, false, Tuple(host, port, protocol))
+		{}
+	};
+}
+
+void tcp_ping_cb::work()
+{
+	struct addrinfo *airesult = resolve(get<0>(), get<1>(), SOCK_STREAM, IPPROTO_TCP);
+	double timeout = tcp_ping_timeout.get(*::state);
+	std::string reply;
+
+	if (!airesult) {
+		NORM_ERR("tcp_ping: Problem with resolving '%s'", get<0>().c_str());
+	} else {
+		int sock = socket(airesult->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				IPPROTO_TCP);
+
+		if (sock == -1) {
+			NORM_ERR("tcp_ping: Couldn't create socket");
+		} else {
+			double start = now();
+			//this will "fail" because sock is non-blocking
+			int rc = connect(sock, airesult->ai_addr, airesult->ai_addrlen);
+			bool pending = rc == -1 && errno == EINPROGRESS;
+
+			//but EINPROGRESS is only a "false fail", and a refusal is a 'pong' too
+			if (rc == 0 || pending || errno == ECONNREFUSED) {
+				int ret = pending ? wait_for(sock, POLLOUT, start + timeout) : 1;
+				char buf[24];
+
+				if (ret > 0) {
+					snprintf(buf, sizeof(buf), "%llu",
+							(unsigned long long) llround((now() - start) * 1000000));
+					reply = buf;
+				} else if (ret == 0) {
+					reply = TCP_PING_FAILED;
+				} else {
+					NORM_ERR("tcp_ping: Couldn't wait on the 'pong'");
+				}
+			} else {
+				NORM_ERR("tcp_ping: Couldn't start connection");
+			}
+			close(sock);
+		}
+		freeaddrinfo(airesult);
+	}
+
+	std::lock_guard<std::mutex> lock(result_mutex);
+	result = reply;
+}
+
+int read_tcpip_cb::read_reply(const struct addrinfo *airesult, std::string &reply)
+{
+	const int protocol = get<2>();
+	double deadline = now() + read_tcpip_timeout.get(*::state);
+	const struct addrinfo *rp;
+	int sock = -1;
+	ssize_t received;
+
+	for (rp = airesult; rp != NULL; rp = rp->ai_next) {
+		if ((sock = connect_until(rp, deadline)) != -1)
+			break;
+	}
+	if (rp == NULL) {
+		if(protocol == IPPROTO_TCP) {
+			NORM_ERR("read_tcp: Couldn't create a connection");
+		} else {
+			NORM_ERR("read_udp: Couldn't listen"); //other error because udp is connectionless
+		}
+		return -1;
+	}
+	if(protocol == IPPROTO_UDP) {
+		//when using udp send a zero-length packet to let the other end know of our existence
+		if(write(sock, NULL, 0) < 0) {
+			NORM_ERR("read_udp: Couldn't create a empty package");
+		}
+	}
+	reply.resize(text_buffer_size.get(*::state));
+	if(wait_for(sock, POLLIN, deadline) > 0
+			&& (received = recv(sock, &reply[0], reply.size(), 0)) != -1)
+		reply.resize(received);
+	else
+		reply.clear();
+	close(sock);
+	return 0;
+}
+
+void read_tcpip_cb::work()
+{
+	const int protocol = get<2>();
+	struct addrinfo *airesult = resolve(get<0>(), get<1>(),
+			protocol == IPPROTO_TCP ? SOCK_STREAM : SOCK_DGRAM, protocol);
+	std::string reply;
+
+	if (!airesult) {
+		NORM_ERR("%s: Problem with resolving the hostname", protocol == IPPROTO_TCP ? "read_tcp" : "read_udp");
+	} else {
+		read_reply(airesult, reply);
+		freeaddrinfo(airesult);
+	}
+
+	std::lock_guard<std::mutex> lock(result_mutex);
+	result = reply;
+}
+
 void parse_read_tcpip_arg(struct text_object *obj, const char *arg, void *free_at_crash)
 {
 	struct read_tcpip_data *rtd;
@@ -63,143 +268,52 @@ void parse_read_tcpip_arg(struct text_object *obj, const char *arg, void *free_a
 	if(rtd->port < 1 || rtd->port > 65535)
 		CRIT_ERR(obj, free_at_crash, "read_tcp and read_udp need a port from 1 to 65535 as argument");
 
-	rtd->port = htons(rtd->port);
 	obj->data.opaque = rtd;
 }
 
 void parse_tcp_ping_arg(struct text_object *obj, const char *arg, void *free_at_crash)
 {
-#define DEFAULT_TCP_PING_PORT 80
-	struct sockaddr_in *addr;
-	char *hostname;
-	struct hostent* he;
-
-	addr = (struct sockaddr_in *) malloc(sizeof(struct sockaddr_in));
-	obj->data.opaque = addr;
-	memset(addr, 0, sizeof(struct sockaddr_in));
-	hostname = (char *) malloc(strlen(arg)+1);
-	switch( sscanf(arg, "%s %" SCNu16, hostname, &(addr->sin_port)) ) {
+	struct read_tcpip_data *rtd;
+	uint16_t port;
+
+	rtd = (struct read_tcpip_data *) malloc(sizeof(struct read_tcpip_data));
+	memset(rtd, 0, sizeof(struct read_tcpip_data));
+	obj->data.opaque = rtd;
+	rtd->host = (char *) malloc(strlen(arg)+1);
+	switch( sscanf(arg, "%s %" SCNu16, rtd->host, &port) ) {
 	case 1:
-		addr->sin_port = DEFAULT_TCP_PING_PORT;
+		port = DEFAULT_TCP_PING_PORT;
 		break;
 	case 2:
 		break;
 	default:	//this point should never be reached
-		free(hostname);
 		CRIT_ERR(obj, free_at_crash, "tcp_ping: Reading arguments failed");
 	}
-	if(!(he = gethostbyname(hostname))) {
-		NORM_ERR("tcp_ping: Problem with resolving '%s', using 'localhost' instead", hostname);
-		if(!(he = gethostbyname("localhost"))) {
-			free(hostname);
-			CRIT_ERR(obj, free_at_crash, "tcp_ping: Resolving 'localhost' also failed");
-		}
-	}
-	free(hostname);
-	addr->sin_port = htons(addr->sin_port);
-	addr->sin_family = he->h_addrtype;
-	memcpy(&(addr->sin_addr), he->h_addr, he->h_length);
+	rtd->port = port;
 }
 
 void print_tcp_ping(struct text_object *obj, char *p, int p_max_size)
 {
-	struct timeval tv1, tv2, timeout;
-	struct sockaddr_in *addr = (struct sockaddr_in *) obj->data.opaque;
-	int addrlen = sizeof(struct sockaddr);
-	int sock = socket(addr->sin_family, SOCK_STREAM, IPPROTO_TCP);
-	unsigned long long usecdiff;
-	fd_set writefds;
-
-	if(sock != -1) {
-		fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL));
-
-		FD_ZERO(&writefds);
-		FD_SET(sock, &writefds);
-#define TCP_PING_TIMEOUT 10
-		timeout.tv_sec = (int) TCP_PING_TIMEOUT;
-		timeout.tv_usec = (TCP_PING_TIMEOUT - timeout.tv_sec) * 1000000;
-		connect(sock, (struct sockaddr*) addr, addrlen);	//this will "fail" because sock is non-blocking
-		if(errno == EINPROGRESS) {	//but EINPROGRESS is only a "false fail"
-			gettimeofday(&tv1, 0);
-			if(select(sock+1, NULL, &writefds, NULL, &timeout) != -1) {
-				gettimeofday(&tv2, 0);
-				usecdiff = ((tv2.tv_sec - tv1.tv_sec) * 1000000) + tv2.tv_usec - tv1.tv_usec;
-				if(usecdiff <= TCP_PING_TIMEOUT * 1000000) {
-					snprintf(p, p_max_size, "%llu", usecdiff);
-				} else {
-#define TCP_PING_FAILED "down"
-					snprintf(p, p_max_size, TCP_PING_FAILED);
-				}
-			} else {
-				NORM_ERR("tcp_ping: Couldn't wait on the 'pong'");
-			}
-		} else {
-			NORM_ERR("tcp_ping: Couldn't start connection");
-		}
-		close(sock);
-	} else {
-		NORM_ERR("tcp_ping: Couldn't create socket");
-	}
+	struct read_tcpip_data *rtd = (struct read_tcpip_data *) obj->data.opaque;
+
+	if (!rtd)
+		return;
+
+	auto cb = conky::register_cb<tcp_ping_cb>(1, rtd->host, rtd->port);
+	std::lock_guard<std::mutex> lock(cb->result_mutex);
+	snprintf(p, p_max_size, "%s", cb->get_result().c_str());
 }
 
 void print_read_tcpip(struct text_object *obj, char *p, int p_max_size, int protocol)
 {
-	int sock, received;
-	fd_set readfds;
-	struct timeval tv;
 	struct read_tcpip_data *rtd = (struct read_tcpip_data *) obj->data.opaque;
-	struct addrinfo hints;
-	struct addrinfo* airesult, *rp;
-	char portbuf[8];
 
 	if (!rtd)
 		return;
 
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = protocol==IPPROTO_TCP ? SOCK_STREAM : SOCK_DGRAM;
-	hints.ai_flags = 0;
-	hints.ai_protocol = protocol;
-	snprintf(portbuf, 8, "%d", rtd->port);
-	if (getaddrinfo(rtd->host, portbuf, &hints, &airesult)) {
-		NORM_ERR("%s: Problem with resolving the hostname", protocol == IPPROTO_TCP ? "read_tcp" : "read_udp");
-		return;
-	}
-	for (rp = airesult; rp != NULL; rp = rp->ai_next) {
-		sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-		if (sock == -1) {
-			continue;
-		}
-		if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) {
-			break;
-		}
-		close(sock);
-		return;
-	}
-	freeaddrinfo(airesult);
-	if (rp == NULL) {
-		if(protocol == IPPROTO_TCP) {
-			NORM_ERR("read_tcp: Couldn't create a connection");
-		} else {
-			NORM_ERR("read_udp: Couldn't listen"); //other error because udp is connectionless
-		}
-		return;
-	}
-	if(protocol == IPPROTO_UDP) {
-		//when using udp send a zero-length packet to let the other end know of our existence
-		if(write(sock, NULL, 0) < 0) {
-			NORM_ERR("read_udp: Couldn't create a empty package");
-		}
-	}
-	FD_ZERO(&readfds);
-	FD_SET(sock, &readfds);
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-	if(select(sock + 1, &readfds, NULL, NULL, &tv) > 0){
-		received = recv(sock, p, p_max_size, 0);
-		if(received != -1) p[received] = 0; else p[0] = 0;
-	}
-	close(sock);
+	auto cb = conky::register_cb<read_tcpip_cb>(1, rtd->host, rtd->port, protocol);
+	std::lock_guard<std::mutex> lock(cb->result_mutex);
+	snprintf(p, p_max_size, "%s", cb->get_result().c_str());
 }
 
 void print_read_tcp(struct text_object *obj, char *p, int p_max_size)
@@ -225,10 +339,5 @@ void free_read_tcpip(struct text_object *obj)
 
 void free_tcp_ping(struct text_object *obj)
 {
-	struct sockaddr_in *addr = (struct sockaddr_in *) obj->data.opaque;
-
-	if (!addr)
-		return;
-
-	free_and_zero(obj->data.opaque);
+	free_read_tcpip(obj);
 }
@@ -0,0 +1,523 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "common.h"
+#include "core.h"
+#include "logging.h"
+#include "net_stat.h"
+#include "remote.h"
+#include "update-cb.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+conky::range_config_setting<unsigned int> agent_port("agent_port", 0, 65535, 0, false);
+
+namespace {
+	/* seconds to wait before connecting to an agent again */
+	const double remote_retry = 5;
+	/* frames longer than this must be garbage */
+	const uint32_t remote_max_frame = 1 << 20;
+
+	int agent_fd = -1;
+	std::vector<int> agent_clients;
+	/* the collectors an agent runs whether its text uses them or not */
+	std::vector<std::unique_ptr<legacy_cb_handle>> agent_collectors;
+
+	void set_nonblocking(int fd)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	}
+
+	void put_record(std::string &out, uint8_t key, const char *name, double value)
+	{
+		size_t len = name ? std::min(strlen(name), (size_t) 255) : 0;
+		uint64_t bits;
+
+		memcpy(&bits, &value, sizeof bits);
+		out += (char) key;
+		out += (char) len;
+		out.append(name ? name : "", len);
+		for (int i = 56; i >= 0; i -= 8)
+			out += (char) (bits >> i);
+	}
+
+	void put32(std::string &out, size_t pos, uint32_t v)
+	{
+		v = htonl(v);
+		out.replace(pos, sizeof v, (const char *) &v, sizeof v);
+	}
+
+	bool agent_listen(void)
+	{
+		struct addrinfo hints, *result, *rp;
+		char port[8];
+		int one = 1, i;
+
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		snprintf(port, sizeof port, "%u", agent_port.get(*state));
+		if ((i = getaddrinfo(NULL, port, &hints, &result))) {
+			NORM_ERR("agent: getaddrinfo(): %s", gai_strerror(i));
+			return false;
+		}
+		for (rp = result; rp; rp = rp->ai_next) {
+			agent_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+			if (agent_fd == -1)
+				continue;
+			setsockopt(agent_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+			if (bind(agent_fd, rp->ai_addr, rp->ai_addrlen) == 0 && listen(agent_fd, 16) == 0)
+				break;
+			close(agent_fd);
+			agent_fd = -1;
+		}
+		freeaddrinfo(result);
+		if (agent_fd == -1) {
+			NORM_ERR("agent: can't listen on port %s: %s", port, strerror(errno));
+			return false;
+		}
+		set_nonblocking(agent_fd);
+		return true;
+	}
+}
+
+void update_agent(void)
+{
+	std::string frame;
+	int fd, one = 1;
+
+	if (!agent_port.get(*state))
+		return;
+	if (agent_collectors.empty()) {
+		int (*const collectors[])() = {
+			&update_cpu_usage, &update_meminfo, &update_load_average, &update_uptime,
+			&update_total_processes, &update_running_processes, &update_net_stats,
+		};
+		for (size_t i = 0; i < sizeof collectors / sizeof collectors[0]; i++)
+			agent_collectors.emplace_back(create_cb_handle(collectors[i], "agent"));
+	}
+	if (agent_fd == -1 && !agent_listen())
+		return;
+
+	while ((fd = accept(agent_fd, NULL, NULL)) != -1) {
+		set_nonblocking(fd);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+#ifdef SO_NOSIGPIPE
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof one);
+#endif
+		agent_clients.push_back(fd);
+	}
+	if (agent_clients.empty())
+		return;
+	for (size_t i = 0; i < agent_collectors.size(); i++) {
+		if (agent_collectors[i])
+			(*agent_collectors[i])->visit();
+	}
+
+	frame.assign(8, 0);
+	if (info.cpu_usage)
+		put_record(frame, REMOTE_CPU, NULL, info.cpu_usage[0] * 100);
+	put_record(frame, REMOTE_MEM, NULL, info.mem);
+	put_record(frame, REMOTE_MEMMAX, NULL, info.memmax);
+	put_record(frame, REMOTE_SWAP, NULL, info.swap);
+	put_record(frame, REMOTE_SWAPMAX, NULL, info.swapmax);
+	put_record(frame, REMOTE_LOADAVG1, NULL, info.loadavg[0]);
+	put_record(frame, REMOTE_LOADAVG5, NULL, info.loadavg[1]);
+	put_record(frame, REMOTE_LOADAVG15, NULL, info.loadavg[2]);
+	put_record(frame, REMOTE_UPTIME, NULL, info.uptime);
+	put_record(frame, REMOTE_PROCESSES, NULL, info.procs);
+	put_record(frame, REMOTE_RUNNING_PROCESSES, NULL, info.run_procs);
+	for (size_t i = 0; i < netstats.size(); i++) {
+		put_record(frame, REMOTE_DOWNSPEED, netstats[i]->dev, netstats[i]->recv_speed);
+		put_record(frame, REMOTE_UPSPEED, netstats[i]->dev, netstats[i]->trans_speed);
+	}
+	put32(frame, 0, REMOTE_MAGIC);
+	put32(frame, 4, frame.size() - 8);
+
+	/* a partial write would break the framing, so slow clients are dropped */
+	for (size_t i = 0; i < agent_clients.size(); ) {
+		if (send(agent_clients[i], frame.data(), frame.size(), MSG_NOSIGNAL)
+				== (ssize_t) frame.size()) {
+			i++;
+			continue;
+		}
+		close(agent_clients[i]);
+		agent_clients.erase(agent_clients.begin() + i);
+	}
+}
+
+void clear_agent(void)
+{
+	for (size_t i = 0; i < agent_clients.size(); i++)
+		close(agent_clients[i]);
+	agent_clients.clear();
+	if (agent_fd != -1) {
+		close(agent_fd);
+		agent_fd = -1;
+	}
+	agent_collectors.clear();
+}
+
+namespace {
+	/* one connection to an agent, shared by all objects naming it */
+	struct remote_host {
+		const std::string host, port;
+		int fd;
+		bool connecting;
+		double retry;
+		std::string buf;
+		/* values of the last frame, by key and name; protected by mutex */
+		std::unordered_map<std::string, double> values;
+		std::mutex mutex;
+
+		remote_host(const std::string &host_, const std::string &port_)
+			: host(host_), port(port_), fd(-1), connecting(false), retry(0)
+		{}
+
+		~remote_host()
+		{ disconnect(0); }
+
+		void disconnect(double now)
+		{
+			if (fd != -1)
+				close(fd);
+			fd = -1;
+			connecting = false;
+			retry = now + remote_retry;
+			buf.clear();
+			std::lock_guard<std::mutex> lock(mutex);
+			values.clear();
+		}
+
+		void connect(double now);
+		void receive(double now);
+		bool parse_frames(void);
+	};
+
+	void remote_host::connect(double now)
+	{
+		struct addrinfo hints, *result, *rp;
+		int i;
+
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if ((i = getaddrinfo(host.c_str(), port.c_str(), &hints, &result))) {
+			NORM_ERR("remote %s: getaddrinfo(): %s", host.c_str(), gai_strerror(i));
+			retry = now + remote_retry;
+			return;
+		}
+		for (rp = result; rp; rp = rp->ai_next) {
+			fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+			if (fd == -1)
+				continue;
+			set_nonblocking(fd);
+			if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0 || errno == EINPROGRESS)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(result);
+		if (fd == -1)
+			retry = now + remote_retry;
+		else
+			connecting = true;
+	}
+
+	void remote_host::receive(double now)
+	{
+		char chunk[0x1000];
+		ssize_t n;
+
+		while ((n = recv(fd, chunk, sizeof chunk, 0)) > 0)
+			buf.append(chunk, n);
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || !parse_frames())
+			disconnect(now);
+	}
+
+	uint32_t get32(const std::string &s, size_t pos)
+	{
+		uint32_t v;
+
+		memcpy(&v, s.data() + pos, sizeof v);
+		return ntohl(v);
+	}
+
+	/* keep the values of the newest complete frame; false on garbage */
+	bool remote_host::parse_frames(void)
+	{
+		while (buf.size() >= 8) {
+			uint32_t length = get32(buf, 4);
+			std::unordered_map<std::string, double> frame;
+			size_t pos = 8;
+
+			if (get32(buf, 0) != REMOTE_MAGIC || length > remote_max_frame)
+				return false;
+			if (buf.size() < 8 + length)
+				break;
+			while (pos + 2 <= 8 + length) {
+				size_t len = (uint8_t) buf[pos + 1];
+				uint64_t bits = 0;
+				double value;
+
+				if (pos + 2 + len + 8 > 8 + length)
+					return false;
+				for (int i = 0; i < 8; i++)
+					bits = bits << 8 | (uint8_t) buf[pos + 2 + len + i];
+				memcpy(&value, &bits, sizeof value);
+				frame[buf.substr(pos, 1) + buf.substr(pos + 2, len)] = value;
+				pos += 2 + len + 8;
+			}
+			buf.erase(0, 8 + length);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			values.swap(frame);
+		}
+		return true;
+	}
+
+	std::mutex remote_hosts_mutex;
+	/* by "host:port", held by the objects using them */
+	std::map<std::string, std::weak_ptr<remote_host>> remote_hosts;
+
+	/* All agents are served by one poll() over their connections per update,
+	 * reading whatever frames arrived since the last one. */
+	class remote_cb: public conky::callback<bool> {
+		typedef conky::callback<bool> Base;
+
+	protected:
+		virtual void work();
+
+		/* the hosts are shared with the readers, it has to be waited for */
+		virtual bool can_be_late() const
+		{ return false; }
+
+	public:
+		remote_cb(uint32_t period)
+			: Base(period, true, Base::Tuple())
+		{}
+	};
+
+	void remote_cb::work()
+	{
+		std::vector<std::shared_ptr<remote_host>> hosts;
+		std::vector<struct pollfd> fds;
+		double now = get_time();
+
+		{
+			std::lock_guard<std::mutex> lock(remote_hosts_mutex);
+			for (auto i = remote_hosts.begin(); i != remote_hosts.end(); ++i) {
+				if (auto h = i->second.lock())
+					hosts.push_back(h);
+			}
+		}
+		for (size_t i = 0; i < hosts.size(); i++) {
+			struct pollfd pfd;
+
+			if (hosts[i]->fd == -1 && now >= hosts[i]->retry)
+				hosts[i]->connect(now);
+			pfd.fd = hosts[i]->fd;
+			pfd.events = hosts[i]->connecting ? POLLOUT : POLLIN;
+			pfd.revents = 0;
+			fds.push_back(pfd);
+		}
+		if (fds.empty() || poll(&fds[0], fds.size(), 0) <= 0)
+			return;
+
+		for (size_t i = 0; i < hosts.size(); i++) {
+			remote_host &h = *hosts[i];
+
+			if (fds[i].fd == -1 || !fds[i].revents)
+				continue;
+			if (h.connecting) {
+				int err = 0;
+				socklen_t len = sizeof err;
+
+				if (getsockopt(h.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+					NORM_ERR("remote %s: can't connect: %s", h.host.c_str(),
+							strerror(err ? err : errno));
+					h.disconnect(now);
+				} else {
+					h.connecting = false;
+				}
+			} else {
+				h.receive(now);
+			}
+		}
+	}
+
+	const struct {
+		const char *name;
+		uint8_t key;
+		bool needs_device;
+	} remote_fields[] = {
+		{ "cpu", REMOTE_CPU, false },
+		{ "mem", REMOTE_MEM, false },
+		{ "memmax", REMOTE_MEMMAX, false },
+		{ "swap", REMOTE_SWAP, false },
+		{ "swapmax", REMOTE_SWAPMAX, false },
+		{ "loadavg", REMOTE_LOADAVG1, false },
+		{ "loadavg5", REMOTE_LOADAVG5, false },
+		{ "loadavg15", REMOTE_LOADAVG15, false },
+		{ "uptime", REMOTE_UPTIME, false },
+		{ "processes", REMOTE_PROCESSES, false },
+		{ "running_processes", REMOTE_RUNNING_PROCESSES, false },
+		{ "downspeed", REMOTE_DOWNSPEED, true },
+		{ "upspeed", REMOTE_UPSPEED, true },
+	};
+
+	struct remote_data {
+		std::shared_ptr<remote_host> host;
+		std::string value;	/* the key followed by the device name */
+		conky::callback_handle<remote_cb> cb;
+
+		remote_data(const std::shared_ptr<remote_host> &host_, const std::string &value_)
+			: host(host_), value(value_), cb(conky::register_cb<remote_cb>(1))
+		{}
+	};
+}
+
+void parse_remote_arg(struct text_object *obj, const char *arg)
+{
+	char host[256], field[32], dev[64] = "";
+	std::string port = REMOTE_DEFAULT_PORT;
+	std::shared_ptr<remote_host> h;
+	size_t i;
+	char *colon;
+
+	obj->data.opaque = NULL;
+	if (!arg || sscanf(arg, "%255s %31s %63s", host, field, dev) < 2) {
+		NORM_ERR("remote needs arguments: <host[:port]> <value> [device]");
+		return;
+	}
+	for (i = 0; i < sizeof remote_fields / sizeof remote_fields[0]; i++) {
+		if (!strcmp(field, remote_fields[i].name))
+			break;
+	}
+	if (i == sizeof remote_fields / sizeof remote_fields[0]) {
+		NORM_ERR("remote: unknown value '%s'", field);
+		return;
+	}
+	if (remote_fields[i].needs_device && !*dev) {
+		NORM_ERR("remote: %s needs a device", field);
+		return;
+	}
+	if ((colon = strrchr(host, ':')) && !strchr(colon + 1, ']')) {
+		port = colon + 1;
+		*colon = 0;
+	}
+
+	std::string name = std::string(host) + ':' + port;
+	std::lock_guard<std::mutex> lock(remote_hosts_mutex);
+	h = remote_hosts[name].lock();
+	if (!h) {
+		h.reset(new remote_host(host, port));
+		remote_hosts[name] = h;
+	}
+	obj->data.opaque = new remote_data(h, std::string(1, (char) remote_fields[i].key)
+			+ (remote_fields[i].needs_device ? dev : ""));
+}
+
+void print_remote(struct text_object *obj, char *p, int p_max_size)
+{
+	struct remote_data *rd = (struct remote_data *) obj->data.opaque;
+	double v;
+
+	if (!rd)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(rd->host->mutex);
+		auto i = rd->host->values.find(rd->value);
+
+		if (i == rd->host->values.end())
+			return;
+		v = i->second;
+	}
+
+	switch ((uint8_t) rd->value[0]) {
+		case REMOTE_CPU:
+			percent_print(p, p_max_size, round_to_int(v));
+			break;
+		case REMOTE_MEM:
+		case REMOTE_MEMMAX:
+		case REMOTE_SWAP:
+		case REMOTE_SWAPMAX:
+			human_readable((long long) v * 1024, p, p_max_size);
+			break;
+		case REMOTE_DOWNSPEED:
+		case REMOTE_UPSPEED:
+			human_readable((long long) v, p, p_max_size);
+			break;
+		case REMOTE_UPTIME:
+			format_seconds(p, p_max_size, (long) v);
+			break;
+		case REMOTE_PROCESSES:
+		case REMOTE_RUNNING_PROCESSES:
+			snprintf(p, p_max_size, "%.0f", v);
+			break;
+		default:
+			snprintf(p, p_max_size, "%.2f", v);
+	}
+}
+
+void free_remote(struct text_object *obj)
+{
+	struct remote_data *rd = (struct remote_data *) obj->data.opaque;
+
+	if (!rd)
+		return;
+	std::string name = rd->host->host + ':' + rd->host->port;
+	delete rd;
+	obj->data.opaque = NULL;
+
+	std::lock_guard<std::mutex> lock(remote_hosts_mutex);
+	auto i = remote_hosts.find(name);
+	if (i != remote_hosts.end() && i->second.expired())
+		remote_hosts.erase(i);
+}
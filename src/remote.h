@@ -0,0 +1,80 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _REMOTE_H
+#define _REMOTE_H
+
+#include "setting.hh"
+#include "text_object.h"
+
+/* In agent mode conky listens on agent_port and, after every update, sends
+ * each connected client one frame with what it collected:
+ *
+ *	uint32 magic	REMOTE_MAGIC
+ *	uint32 length	of the records that follow
+ *	records, each of them
+ *		uint8 key		enum remote_key
+ *		uint8 len		length of the name, 0 if the value has none
+ *		char name[len]	e.g. the network device
+ *		uint64 value	bits of an IEEE 754 double
+ *
+ * All numbers are big-endian. A client which can't keep up is disconnected
+ * and connects again. */
+
+#define REMOTE_MAGIC		0x434e4b52	/* "CNKR" */
+#define REMOTE_DEFAULT_PORT	"10081"
+
+enum remote_key {
+	REMOTE_CPU = 1,			/* percent */
+	REMOTE_MEM,				/* kB */
+	REMOTE_MEMMAX,
+	REMOTE_SWAP,
+	REMOTE_SWAPMAX,
+	REMOTE_LOADAVG1,
+	REMOTE_LOADAVG5,
+	REMOTE_LOADAVG15,
+	REMOTE_UPTIME,			/* seconds */
+	REMOTE_PROCESSES,
+	REMOTE_RUNNING_PROCESSES,
+	REMOTE_DOWNSPEED,		/* bytes per second, named by device */
+	REMOTE_UPSPEED,
+};
+
+extern conky::range_config_setting<unsigned int> agent_port;
+
+/* accept new agent clients and send them this update */
+void update_agent(void);
+void clear_agent(void);
+
+void parse_remote_arg(struct text_object *, const char *);
+void print_remote(struct text_object *, char *, int);
+void free_remote(struct text_object *);
+
+#endif /* _REMOTE_H */
@@ -31,6 +31,7 @@
 #include "ccurl_thread.h"
 #include <time.h>
 #include <assert.h>
+#include <atomic>
 #include <cmath>
 #include <mutex>
 
@@ -46,12 +47,25 @@ namespace {
 	class rss_cb: public curl_callback<std::shared_ptr<PRSS>> {
 		typedef curl_callback<std::shared_ptr<PRSS>> Base;
 
+		// the feed last parsed, and how many of its items
+		size_t parsed_hash;
+		int parsed_items;
+
 	protected:
 		virtual void process_data()
 		{
+			size_t hash = std::hash<std::string>()(data);
+			int items = wanted_items;
+
+			// servers without ETag or Last-Modified send the same feed again
+			if (Base::result && hash == parsed_hash && items <= parsed_items)
+				return;
+
 			try {
-				std::shared_ptr<PRSS> tmp(new PRSS(data));
+				std::shared_ptr<PRSS> tmp(new PRSS(data, items));
 
+				parsed_hash = hash;
+				parsed_items = items;
 				std::unique_lock<std::mutex> lock(Base::result_mutex);
 				Base::result = tmp;
 			}
@@ -61,10 +75,20 @@ namespace {
 		}
 
 	public:
+		// the most items one of the $rss objects shows
+		std::atomic<int> wanted_items;
+
 		rss_cb(uint32_t period, const std::string &uri)
-			: Base(period, Base::Tuple(uri))
+			: Base(period, Base::Tuple(uri)), parsed_hash(0), parsed_items(0), wanted_items(1)
 		{}
 
+		void want_items(int items)
+		{
+			int old = wanted_items;
+
+			while (items > old && !wanted_items.compare_exchange_weak(old, items))
+				;
+		}
 	};
 }
 
@@ -80,6 +104,9 @@ static void rss_process_info(char *p, int p_max_size, const std::string &uri, ch
 
 	assert(act_par >= 0 && action);
 
+	/* item_title and item_desc count from 0, item_titles shows act_par */
+	cb->want_items(strcmp(action, "item_titles") == EQUAL ? act_par : act_par + 1);
+
 	std::shared_ptr<PRSS> data = cb->get_result_copy();
 
 	if (!data || data->item_count < 1) {
@@ -0,0 +1,233 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "logging.h"
+#include "samples.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <unordered_map>
+
+bool recording_samples = false;
+bool replaying_samples = false;
+
+namespace {
+	struct sample {
+		std::string data;
+		uid_t uid;
+	};
+
+	/* protects the file while recording and the samples while replaying */
+	std::mutex samples_mutex;
+	FILE *samples_fp = NULL;
+	std::string samples_file;
+
+	/* the samples of the current update */
+	std::unordered_map<std::string, sample> replay_samples;
+	/* the start of the next update, already read from the file */
+	bool replay_have_tick = false;
+	double replay_next_time = 0;
+	/* the time of the current update */
+	double replay_tick_time = 0;
+	/* added to the recorded times, so they keep going up when the recording
+	 * starts over */
+	double replay_offset = 0;
+	double replay_first = -1, replay_last = 0, replay_step = 1;
+
+	struct record_header {
+		uint32_t path_len;
+		uint32_t data_len;
+		uint32_t uid;
+	};
+
+	void write_record(const char *path, size_t path_len, const char *data,
+			size_t len, uid_t uid)
+	{
+		struct record_header h = { (uint32_t) path_len, (uint32_t) len, (uint32_t) uid };
+
+		if (fwrite(&h, sizeof h, 1, samples_fp) != 1
+				|| fwrite(path, 1, path_len, samples_fp) != path_len
+				|| fwrite(data, 1, len, samples_fp) != len) {
+			NORM_ERR("can't write to '%s': %s, recording stopped", samples_file.c_str(),
+					strerror(errno));
+			fclose(samples_fp);
+			samples_fp = NULL;
+			recording_samples = false;
+		}
+	}
+
+	bool check_header(void)
+	{
+		char magic[sizeof SAMPLES_MAGIC - 1];
+		uint32_t version;
+
+		return fread(magic, sizeof magic, 1, samples_fp) == 1
+			&& fread(&version, sizeof version, 1, samples_fp) == 1
+			&& memcmp(magic, SAMPLES_MAGIC, sizeof magic) == 0
+			&& version == SAMPLES_VERSION;
+	}
+
+	/* read up to the next update start record, false at the end of the file */
+	bool read_tick(void)
+	{
+		struct record_header h;
+
+		replay_samples.clear();
+		if (!replay_have_tick) {
+			if (fread(&h, sizeof h, 1, samples_fp) != 1 || h.path_len
+					|| h.data_len != sizeof replay_next_time
+					|| fread(&replay_next_time, sizeof replay_next_time, 1, samples_fp) != 1)
+				return false;
+		}
+		replay_tick_time = replay_next_time;
+		replay_have_tick = false;
+
+		while (fread(&h, sizeof h, 1, samples_fp) == 1) {
+			if (!h.path_len) {
+				if (h.data_len != sizeof replay_next_time
+						|| fread(&replay_next_time, sizeof replay_next_time, 1, samples_fp) != 1)
+					break;
+				replay_have_tick = true;
+				return true;
+			}
+			std::string path(h.path_len, 0);
+			if (fread(&path[0], 1, h.path_len, samples_fp) != h.path_len)
+				break;
+			sample &smp = replay_samples[path];
+			smp.data.resize(h.data_len);
+			smp.uid = h.uid;
+			if (h.data_len && fread(&smp.data[0], 1, h.data_len, samples_fp) != h.data_len)
+				break;
+		}
+		/* a truncated update at the end is still used */
+		return !replay_samples.empty();
+	}
+}
+
+bool open_record(const char *file)
+{
+	close_samples();
+	if (!(samples_fp = fopen(file, "w"))) {
+		NORM_ERR("can't record to '%s': %s", file, strerror(errno));
+		return false;
+	}
+	uint32_t version = SAMPLES_VERSION;
+	fwrite(SAMPLES_MAGIC, sizeof SAMPLES_MAGIC - 1, 1, samples_fp);
+	fwrite(&version, sizeof version, 1, samples_fp);
+	samples_file = file;
+	recording_samples = true;
+	return true;
+}
+
+bool open_replay(const char *file)
+{
+	close_samples();
+	if (!(samples_fp = fopen(file, "r"))) {
+		NORM_ERR("can't replay '%s': %s", file, strerror(errno));
+		return false;
+	}
+	if (!check_header()) {
+		NORM_ERR("'%s' isn't a recording of this version", file);
+		fclose(samples_fp);
+		samples_fp = NULL;
+		return false;
+	}
+	samples_file = file;
+	replaying_samples = true;
+	return true;
+}
+
+void close_samples(void)
+{
+	std::lock_guard<std::mutex> lock(samples_mutex);
+
+	if (samples_fp)
+		fclose(samples_fp);
+	samples_fp = NULL;
+	recording_samples = replaying_samples = false;
+	replay_samples.clear();
+	replay_have_tick = false;
+	replay_offset = 0;
+	replay_first = -1;
+	replay_last = 0;
+	replay_step = 1;
+}
+
+double sample_tick(double now)
+{
+	std::lock_guard<std::mutex> lock(samples_mutex);
+
+	if (recording_samples) {
+		write_record("", 0, (const char *) &now, sizeof now, 0);
+		return now;
+	}
+	if (!replaying_samples)
+		return now;
+
+	/* at the end the recording starts over */
+	if (!read_tick()) {
+		rewind(samples_fp);
+		replay_have_tick = false;
+		if (!check_header() || !read_tick()) {
+			NORM_ERR("nothing to replay in '%s'", samples_file.c_str());
+			return now;
+		}
+		replay_offset += replay_last - replay_tick_time + replay_step;
+	}
+	if (replay_first < 0)
+		replay_first = replay_tick_time;
+	else if (replay_tick_time > replay_last)
+		replay_step = replay_tick_time - replay_last;
+	replay_last = replay_tick_time;
+	return replay_tick_time + replay_offset;
+}
+
+void record_sample(const char *path, const char *data, size_t len, uid_t uid)
+{
+	std::lock_guard<std::mutex> lock(samples_mutex);
+
+	if (recording_samples)
+		write_record(path, strlen(path), data, len, uid);
+}
+
+bool replay_sample(const char *path, std::string *data, uid_t *uid)
+{
+	std::lock_guard<std::mutex> lock(samples_mutex);
+	auto i = replay_samples.find(path);
+
+	if (i == replay_samples.end())
+		return false;
+	*data = i->second.data;
+	if (uid)
+		*uid = i->second.uid;
+	return true;
+}
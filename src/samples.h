@@ -0,0 +1,72 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMPLES_H
+#define _SAMPLES_H
+
+#include <string>
+#include <sys/types.h>
+
+/* --record FILE keeps the raw contents of every /proc file the collectors
+ * read, together with the time of each update; --replay FILE hands those
+ * contents back, so the same updates can be parsed and drawn again.
+ *
+ * The file starts with SAMPLES_MAGIC and a version, followed by records in
+ * host byte order:
+ *
+ *	uint32 path_len	0 for the start of an update
+ *	uint32 data_len
+ *	uint32 uid		owner of the file, for /proc/<pid>/stat
+ *	char path[path_len]
+ *	char data[data_len]	the time of the update as a double if path_len is 0
+ *
+ * The list of processes is recorded as "/proc", one pid per line. */
+
+#define SAMPLES_MAGIC	"CONKYREC"
+#define SAMPLES_VERSION	1
+
+extern bool recording_samples;
+extern bool replaying_samples;
+
+bool open_record(const char *file);
+bool open_replay(const char *file);
+void close_samples(void);
+
+/* start an update at now; returns the time the update should use, which is
+ * the recorded one while replaying */
+double sample_tick(double now);
+
+/* keep what was read from path, safe to use from several threads */
+void record_sample(const char *path, const char *data, size_t len, uid_t uid = 0);
+
+/* what was read from path in the current update, false if nothing was */
+bool replay_sample(const char *path, std::string *data, uid_t *uid = 0);
+
+#endif /* _SAMPLES_H */
@@ -33,6 +33,8 @@
 #include "specials.h"
 #include "text_object.h"
 #include "x11.h"
+#include <algorithm>
+#include <string>
 #include <vector>
 
 #define SCROLL_LEFT true
@@ -45,6 +47,14 @@ struct scroll_data {
 	signed int start;
 	long resetcolor;
 	bool direction;
+	/* the sub-text of the last update, and an index of it that is only
+	 * rebuilt when the text changes: the byte offset of every character
+	 * (a SPECIAL_CHAR is not one) and the number of SPECIAL_CHARs in front
+	 * of it, each with an entry for the end of the text appended */
+	std::vector<char> buf;
+	std::string last;
+	std::vector<unsigned int> chars;
+	std::vector<unsigned int> specials;
 };
 
 void parse_scroll_arg(struct text_object *obj, const char *arg, void *free_at_crash, char *free_at_crash2)
@@ -53,8 +63,7 @@ void parse_scroll_arg(struct text_object *obj, const char *arg, void *free_at_cr
 	int n1 = 0, n2 = 0;
 	char dirarg[6];
 
-	sd = (struct scroll_data *)malloc(sizeof(struct scroll_data));
-	memset(sd, 0, sizeof(struct scroll_data));
+	sd = new scroll_data();
 
 	sd->resetcolor = get_current_text_color();
 	sd->step = 1;
@@ -68,7 +77,7 @@ void parse_scroll_arg(struct text_object *obj, const char *arg, void *free_at_cr
 	}
 
 	if (!arg || sscanf(arg + n1, "%u %n", &sd->show, &n2) <= 0) {
-		free(sd);
+		delete sd;
 #ifdef BUILD_X11
 		free(obj->next);
 #endif
@@ -95,7 +104,7 @@ void parse_scroll_arg(struct text_object *obj, const char *arg, void *free_at_cr
 
 	strcat(sd->text, arg + n1);
 	sd->start = 0;
-	obj->sub = (struct text_object *)malloc(sizeof(struct text_object));
+	obj->sub = new_text_object();
 	extract_variable_text_internal(obj->sub, sd->text);
 
 	obj->data.opaque = sd;
@@ -105,79 +114,103 @@ void parse_scroll_arg(struct text_object *obj, const char *arg, void *free_at_cr
 #endif /* BUILD_X11 */
 }
 
+static void index_scroll_text(struct scroll_data *sd)
+{
+	unsigned int j, colorchanges = 0;
+
+	sd->chars.clear();
+	sd->specials.clear();
+	for (j = 0; sd->buf[j] != 0; j++) {
+		if (sd->buf[j] == SPECIAL_CHAR) {
+			colorchanges++;
+		} else if ((sd->buf[j] & 0xC0) != 0x80) {
+			/* not a UTF-8 continuation byte */
+			sd->chars.push_back(j);
+			sd->specials.push_back(colorchanges);
+		}
+	}
+	sd->chars.push_back(j);
+	sd->specials.push_back(colorchanges);
+	sd->last.assign(&(sd->buf[0]), j);
+}
+
 void print_scroll(struct text_object *obj, char *p, int p_max_size)
 {
 	struct scroll_data *sd = (struct scroll_data *)obj->data.opaque;
-	unsigned int j, colorchanges = 0, frontcolorchanges = 0, visibcolorchanges = 0, strend;
-	char *pwithcolors;
-	std::vector<char> buf(max_user_text.get(*state));
+	unsigned int j, len, nchars, end, from, to, colorchanges, frontcolorchanges, visibcolorchanges;
+	int pos = 0;
 
-	if (!sd)
+	if (!sd || !p_max_size)
 		return;
 
-	generate_text_internal(&(buf[0]), max_user_text.get(*state), *obj->sub);
-	for(j = 0; buf[j] != 0; j++) {
-		switch(buf[j]) {
-			case '\n':	//place all the lines behind each other with LINESEPARATOR between them
+	if (sd->buf.size() < (size_t) max_user_text.get(*state))
+		sd->buf.resize(max_user_text.get(*state));
+	generate_text_internal(&(sd->buf[0]), sd->buf.size(), *obj->sub);
+	for(len = 0; sd->buf[len] != 0; len++) {
+		//place all the lines behind each other with LINESEPARATOR between them
+		if (sd->buf[len] == '\n') {
 #define LINESEPARATOR '|'
-				buf[j]=LINESEPARATOR;
-				break;
-			case SPECIAL_CHAR:
-				colorchanges++;
-				break;
+			sd->buf[len] = LINESEPARATOR;
 		}
 	}
+	if (sd->chars.empty() || len != sd->last.size() ||
+			memcmp(&(sd->buf[0]), sd->last.data(), len) != 0)
+		index_scroll_text(sd);
+	nchars = sd->chars.size() - 1;
+	colorchanges = sd->specials[nchars];
+
 	//no scrolling necessary if the length of the text to scroll is too short
-	if (strlen(&(buf[0])) - colorchanges <= sd->show) {
-		snprintf(p, p_max_size, "%s", &(buf[0]));
+	if (nchars <= sd->show) {
+		snprintf(p, p_max_size, "%s", &(sd->buf[0]));
 		return;
 	}
-	//make sure a colorchange at the front is not part of the string we are going to show
-	while(buf[sd->start] == SPECIAL_CHAR) {
-		sd->start++;
+	if ((unsigned) sd->start >= nchars) {
+		sd->start = 0;
 	}
-	//place all chars that should be visible in p, including colorchanges
-	for(j=0; j < sd->show + visibcolorchanges; j++) {
-		p[j] = buf[sd->start + j];
-		if(p[j] == SPECIAL_CHAR) {
-			visibcolorchanges++;
-		}
-		//if there is still room fill it with spaces
-		if( ! p[j]) break;
+	end = std::min(sd->start + sd->show, nchars);
+
+	//a colorchange in front of the first visible char is not part of the string we are going to show,
+	//place as many colorchanges as there are in front of the visible part in front of it
+	frontcolorchanges = sd->specials[sd->start];
+	for(j = 0; j < frontcolorchanges && pos + 1 < p_max_size; j++) {
+		p[pos++] = SPECIAL_CHAR;
 	}
-	for(; j < sd->show + visibcolorchanges; j++) {
-		p[j] = ' ';
+	//place all chars that should be visible in p, including colorchanges,
+	//but not those following the last visible char
+	from = sd->chars[sd->start];
+	to = sd->chars[end];
+	while (to > from && sd->buf[to - 1] == SPECIAL_CHAR) {
+		to--;
 	}
-	p[j] = 0;
-	//count colorchanges in front of the visible part and place that many colorchanges in front of the visible part
-	for(j = 0; j < (unsigned) sd->start; j++) {
-		if(buf[j] == SPECIAL_CHAR) frontcolorchanges++;
+	visibcolorchanges = sd->specials[end] - frontcolorchanges - (sd->chars[end] - to);
+	if (to - from > (unsigned) (p_max_size - 1 - pos)) {
+		to = from + p_max_size - 1 - pos;
 	}
-	pwithcolors=(char*)malloc(strlen(p) + 1 + colorchanges - visibcolorchanges);
-	for(j = 0; j < frontcolorchanges; j++) {
-		pwithcolors[j] = SPECIAL_CHAR;
+	memcpy(p + pos, &(sd->buf[from]), to - from);
+	pos += to - from;
+	//if there is still room fill it with spaces
+	for(j = end - sd->start; j < sd->show && pos + 1 < p_max_size; j++) {
+		p[pos++] = ' ';
 	}
-	pwithcolors[j] = 0;
-	strcat(pwithcolors,p);
-	strend = strlen(pwithcolors);
 	//and place the colorchanges not in front or in the visible part behind the visible part
-	for(j = 0; j < colorchanges - frontcolorchanges - visibcolorchanges; j++) {
-		pwithcolors[strend + j] = SPECIAL_CHAR;
+	for(j = 0; j < colorchanges - frontcolorchanges - visibcolorchanges && pos + 1 < p_max_size; j++) {
+		p[pos++] = SPECIAL_CHAR;
 	}
-	pwithcolors[strend + j] = 0;
-	strcpy(p, pwithcolors);
-	free(pwithcolors);
+	p[pos] = 0;
 	//scroll
 	if(sd->direction == SCROLL_LEFT) {
 		sd->start += sd->step;
-		if(buf[sd->start] == 0 || (unsigned) sd->start > strlen(&(buf[0]))) {
+		if((unsigned) sd->start >= nchars) {
 			sd->start = 0;
 		}
 	} else {
 		if(sd->start < 1) {
-			sd->start = strlen(&(buf[0]));
+			sd->start = nchars;
 		}
 		sd->start -= sd->step;
+		if(sd->start < 0) {
+			sd->start = 0;
+		}
 	}
 #ifdef BUILD_X11
 	//reset color when scroll is finished
@@ -195,6 +228,8 @@ void free_scroll(struct text_object *obj)
 
 	free_and_zero(sd->text);
 	free_text_objects(obj->sub);
-	free_and_zero(obj->sub);
-	free_and_zero(obj->data.opaque);
+	delete_text_object(obj->sub);
+	obj->sub = NULL;
+	delete sd;
+	obj->data.opaque = NULL;
 }
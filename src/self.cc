@@ -0,0 +1,351 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "llua.h"
+#include "logging.h"
+#include "self.h"
+#include "specials.h"
+#include "update-cb.hh"
+#include <string.h>
+#if defined(HAVE_MALLINFO2) || defined(HAVE_MALLOC_TRIM)
+#include <malloc.h>
+#endif
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+double self_update_time, self_text_time, self_layout_time, self_draw_time;
+unsigned long self_missed_updates;
+
+enum conky_self_field {
+	SELF_CPU,
+	SELF_CPUTIME,
+	SELF_RSS,
+	SELF_THREADS,
+	SELF_CALLBACKS,
+	SELF_FRAME,
+	SELF_UPDATE,
+	SELF_TEXT,
+	SELF_LAYOUT,
+	SELF_DRAW,
+	SELF_MISSED
+};
+
+static const char *conky_self_fields[] = {
+	"cpu", "cputime", "rss", "threads", "callbacks", "frame", "update", "text",
+	"layout", "draw", "missed", 0
+};
+
+struct conky_self_data {
+	enum conky_self_field field;
+	/* for cpu: the cpu and wall time at the previous print */
+	double last_cpu, last_wall;
+};
+
+static double self_cpu_seconds(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static long long self_rss(void)
+{
+#ifdef __linux__
+	FILE *fp = fopen("/proc/self/statm", "r");
+	long long size, pages;
+
+	if (fp) {
+		int n = fscanf(fp, "%lld %lld", &size, &pages);
+
+		fclose(fp);
+		if (n == 2)
+			return pages * sysconf(_SC_PAGESIZE);
+	}
+#endif /* __linux__ */
+	/* the peak instead, in KiB */
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+	return ru.ru_maxrss * 1024LL;
+}
+
+static int self_threads(void)
+{
+#ifdef __linux__
+	FILE *fp = fopen("/proc/self/status", "r");
+	char line[128];
+	int threads = 0;
+
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof line, fp)) {
+		if (sscanf(line, "Threads: %d", &threads) == 1)
+			break;
+	}
+	fclose(fp);
+	return threads;
+#else
+	return 0;
+#endif /* __linux__ */
+}
+
+void parse_conky_self_arg(struct text_object *obj, const char *arg)
+{
+	struct conky_self_data *sd = new conky_self_data;
+	int i;
+
+	sd->field = SELF_CPU;
+	if (arg) {
+		for (i = 0; conky_self_fields[i]; i++) {
+			if (!strcmp(arg, conky_self_fields[i]))
+				break;
+		}
+		if (conky_self_fields[i])
+			sd->field = (enum conky_self_field) i;
+		else
+			NORM_ERR("conky_self: unknown field '%s'", arg);
+	}
+	sd->last_cpu = self_cpu_seconds();
+	sd->last_wall = get_time();
+	obj->data.opaque = sd;
+}
+
+void print_conky_self(struct text_object *obj, char *p, int p_max_size)
+{
+	struct conky_self_data *sd = (struct conky_self_data *) obj->data.opaque;
+
+	if (!sd)
+		return;
+
+	switch (sd->field) {
+		case SELF_CPU:
+			{
+				double cpu = self_cpu_seconds(), wall = get_time();
+				double used = wall > sd->last_wall
+					? (cpu - sd->last_cpu) / (wall - sd->last_wall) * 100 : 0;
+
+				sd->last_cpu = cpu;
+				sd->last_wall = wall;
+				snprintf(p, p_max_size, "%.2f", used);
+			}
+			break;
+		case SELF_CPUTIME:
+			snprintf(p, p_max_size, "%.2f", self_cpu_seconds());
+			break;
+		case SELF_RSS:
+			human_readable(self_rss(), p, p_max_size);
+			break;
+		case SELF_THREADS:
+			snprintf(p, p_max_size, "%d", self_threads());
+			break;
+		case SELF_CALLBACKS:
+			snprintf(p, p_max_size, "%lu", (unsigned long) conky::callback_count());
+			break;
+		case SELF_FRAME:
+			snprintf(p, p_max_size, "%.3f", (self_update_time + self_text_time
+						+ self_layout_time + self_draw_time) * 1000);
+			break;
+		case SELF_UPDATE:
+			snprintf(p, p_max_size, "%.3f", self_update_time * 1000);
+			break;
+		case SELF_TEXT:
+			snprintf(p, p_max_size, "%.3f", self_text_time * 1000);
+			break;
+		case SELF_LAYOUT:
+			snprintf(p, p_max_size, "%.3f", self_layout_time * 1000);
+			break;
+		case SELF_DRAW:
+			snprintf(p, p_max_size, "%.3f", self_draw_time * 1000);
+			break;
+		case SELF_MISSED:
+			snprintf(p, p_max_size, "%lu", self_missed_updates);
+			break;
+	}
+}
+
+void free_conky_self(struct text_object *obj)
+{
+	delete (struct conky_self_data *) obj->data.opaque;
+	obj->data.opaque = NULL;
+}
+
+void print_source_state(struct text_object *obj, char *p, int p_max_size)
+{
+	snprintf(p, p_max_size, "%s", conky::callback_source_state(obj->data.s).c_str());
+}
+
+/* what the heap of conky holds, from malloc's own books where it keeps them,
+ * and what the larger parts of conky hold of it */
+enum conky_mem_field {
+	MEM_HEAP,
+	MEM_FREE,
+	MEM_MMAP,
+	MEM_ARENAS,
+	MEM_TEXT,
+	MEM_GRAPHS,
+	MEM_LUA
+};
+
+static const char *conky_mem_fields[] = {
+	"heap", "free", "mmap", "arenas", "text", "graphs", "lua", 0
+};
+
+/* the arenas of glibc's malloc, each thread that allocates may get one of its
+ * own; malloc_info() is the only thing that tells how many there are */
+static int malloc_arenas(void)
+{
+#ifdef HAVE_MALLINFO2
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fp = open_memstream(&buf, &size);
+	int arenas = 0;
+
+	if (!fp)
+		return 0;
+	malloc_info(0, fp);
+	fclose(fp);
+	for (const char *p = buf; p && (p = strstr(p, "<heap nr=")); p++)
+		arenas++;
+	free(buf);
+	return arenas;
+#else
+	return 0;
+#endif /* HAVE_MALLINFO2 */
+}
+
+static double conky_mem_get(enum conky_mem_field field)
+{
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 mi;
+#endif /* HAVE_MALLINFO2 */
+
+	switch (field) {
+#ifdef HAVE_MALLINFO2
+		case MEM_HEAP:
+			mi = mallinfo2();
+			return mi.uordblks + mi.hblkhd;
+		case MEM_FREE:
+			mi = mallinfo2();
+			return mi.fordblks;
+		case MEM_MMAP:
+			mi = mallinfo2();
+			return mi.hblkhd;
+#else
+		case MEM_HEAP:
+		case MEM_FREE:
+		case MEM_MMAP:
+			return 0;
+#endif /* HAVE_MALLINFO2 */
+		case MEM_ARENAS:
+			return malloc_arenas();
+		case MEM_TEXT:
+			return text_buffer_bytes();
+		case MEM_GRAPHS:
+			return graph_history_bytes();
+		case MEM_LUA:
+			return llua_heap_bytes();
+	}
+	return 0;
+}
+
+void parse_conky_mem_arg(struct text_object *obj, const char *arg)
+{
+	int i = 0;
+
+	if (arg) {
+		for (; conky_mem_fields[i]; i++) {
+			if (!strcmp(arg, conky_mem_fields[i]))
+				break;
+		}
+		if (!conky_mem_fields[i]) {
+			NORM_ERR("conky_mem: unknown field '%s'", arg);
+			i = 0;
+		}
+	}
+	obj->data.i = i;
+}
+
+void print_conky_mem(struct text_object *obj, char *p, int p_max_size)
+{
+	enum conky_mem_field field = (enum conky_mem_field) obj->data.i;
+
+	if (field == MEM_ARENAS)
+		snprintf(p, p_max_size, "%d", malloc_arenas());
+	else
+		human_readable(conky_mem_get(field), p, p_max_size);
+}
+
+double conky_mem_value(struct text_object *obj)
+{
+	return conky_mem_get((enum conky_mem_field) obj->data.i);
+}
+
+/* 0 leaves the arenas to malloc, which makes up to 8 per cpu */
+static conky::range_config_setting<unsigned int> malloc_arena_max("malloc_arena_max",
+		0, 1024, 0, false);
+static conky::simple_config_setting<bool> malloc_trim_idle("malloc_trim", false, false);
+
+/* trimming walks all arenas, so it is done at most this often, in seconds,
+ * and only with this much time before the next wake-up */
+#define MALLOC_TRIM_INTERVAL 60
+#define MALLOC_TRIM_SLACK 0.1
+
+void self_malloc_setup(void)
+{
+#if defined(HAVE_MALLOC_TRIM) && defined(M_ARENA_MAX)
+	/* only limits the arenas made from now on */
+	if (malloc_arena_max.get(*state))
+		mallopt(M_ARENA_MAX, malloc_arena_max.get(*state));
+#endif /* HAVE_MALLOC_TRIM && M_ARENA_MAX */
+}
+
+void self_malloc_idle(double until)
+{
+#ifdef HAVE_MALLOC_TRIM
+	static double last_trim;
+	double now;
+
+	if (!malloc_trim_idle.get(*state))
+		return;
+	now = get_time();
+	if (now - last_trim < MALLOC_TRIM_INTERVAL || until - now < MALLOC_TRIM_SLACK)
+		return;
+	malloc_trim(0);
+	last_trim = now;
+#else
+	(void) until;
+#endif /* HAVE_MALLOC_TRIM */
+}
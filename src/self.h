@@ -0,0 +1,60 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SELF_H
+#define _SELF_H
+
+#include "text_object.h"
+
+/* how long the last update, text evaluation, layout and drawing took, in
+ * seconds */
+extern double self_update_time, self_text_time, self_layout_time, self_draw_time;
+/* updates which started after the time they were due */
+extern unsigned long self_missed_updates;
+
+void parse_conky_self_arg(struct text_object *, const char *);
+void print_conky_self(struct text_object *, char *, int);
+void free_conky_self(struct text_object *);
+
+void parse_conky_mem_arg(struct text_object *, const char *);
+void print_conky_mem(struct text_object *, char *, int);
+double conky_mem_value(struct text_object *);
+
+/* how the callbacks reading remote sources are doing, see failed() in
+ * update-cb.hh */
+void print_source_state(struct text_object *, char *, int);
+
+/* applies malloc_arena_max, after the config is loaded */
+void self_malloc_setup(void);
+/* with malloc_trim, gives the free memory of the heap back to the system
+ * now and then, if there's time until the given one (see get_time()) */
+void self_malloc_idle(double until);
+
+#endif /* _SELF_H */
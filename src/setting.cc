@@ -135,6 +135,7 @@ namespace conky {
 				return;
 
 			ptr->lua_setter(l, init);
+			ptr->cache_value(l);
 			l.pushvalue(-2);
 			l.insert(-2);
 			l.rawset(-4);
@@ -244,6 +245,9 @@ namespace conky {
 			l.getfield(-1, v[i-1]->name.c_str());
 			v[i-1]->cleanup(l);
 		}
+		// the cleanups may still want the values
+		for(size_t i = 0; i < v.size(); ++i)
+			v[i]->forget_value();
 
 		l.pop();
 	}
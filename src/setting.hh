@@ -24,7 +24,9 @@
 #ifndef SETTING_HH
 #define SETTING_HH
 
+#include <atomic>
 #include <limits>
+#include <mutex>
 #include <string>
 #include <type_traits>
 
@@ -138,6 +140,74 @@ namespace conky {
 	};
 
 	namespace priv {
+		/*
+		 * The value of a setting as a C++ type, kept up to date whenever the setting is
+		 * assigned, so that get() doesn't have to lock the Lua state. Numbers, bools and enums
+		 * are atomics, anything else has a mutex of its own.
+		 */
+		template<typename T,
+			bool is_atomic = std::is_arithmetic<T>::value || std::is_enum<T>::value>
+		class setting_cache {
+			std::atomic<bool> valid;
+			std::atomic<T> value;
+
+		public:
+			setting_cache()
+				: valid(false), value(T())
+			{}
+
+			bool load(T &v) const
+			{
+				if(not valid.load(std::memory_order_acquire))
+					return false;
+				v = value.load(std::memory_order_relaxed);
+				return true;
+			}
+
+			void store(const T &v)
+			{
+				value.store(v, std::memory_order_relaxed);
+				valid.store(true, std::memory_order_release);
+			}
+
+			void invalidate()
+			{ valid.store(false, std::memory_order_release); }
+		};
+
+		template<typename T>
+		class setting_cache<T, false> {
+			mutable std::mutex mutex;
+			bool valid;
+			T value;
+
+		public:
+			setting_cache()
+				: valid(false), value()
+			{}
+
+			bool load(T &v) const
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(not valid)
+					return false;
+				v = value;
+				return true;
+			}
+
+			void store(const T &v)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				value = v;
+				valid = true;
+			}
+
+			void invalidate()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				valid = false;
+			}
+		};
+
 		class config_setting_base {
 		private:
 			static void process_setting(lua::state &l, bool init);
@@ -164,6 +234,14 @@ namespace conky {
 			 */
 			virtual void cleanup(lua::state &l) { l.pop(); }
 
+			/*
+			 * Remember the value the setter settled on, and forget it.
+			 * stack on entry: | ... value |
+			 * stack on exit:  | ... value |
+			 */
+			virtual void cache_value(lua::state &l) = 0;
+			virtual void forget_value() = 0;
+
 		public:
 			const std::string name;
 			const size_t seq_no;
@@ -204,11 +282,29 @@ namespace conky {
 		 * stack on exit:  | ... |
 		 */
 		virtual T getter(lua::state &l) = 0;
+
+		virtual void cache_value(lua::state &l)
+		{
+			l.pushvalue(-1);
+			cache.store(getter(l));
+		}
+
+		virtual void forget_value()
+		{ cache.invalidate(); }
+
+	private:
+		priv::setting_cache<T> cache;
 	};
 
 	template<typename T>
 	T config_setting_template<T>::get(lua::state &l)
 	{
+		T value;
+
+		// the setting hasn't been assigned since the config was (re)loaded
+		if(cache.load(value))
+			return value;
+
 		std::lock_guard<lua::state> guard(l);
 		lua::stack_sentry s(l);
 		l.checkstack(2);
@@ -0,0 +1,381 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "conky.h"
+#include "common.h"
+#include "conky_shm.h"
+#include "diskio.h"
+#include "fs.h"
+#include "logging.h"
+#include "net_stat.h"
+#include "shm.h"
+#include "top.h"
+#ifdef __linux__
+#include "linux.h"
+#endif /* __linux__ */
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+conky::simple_config_setting<std::string> shm_name("shm_name", std::string(), false);
+conky::simple_config_setting<bool> shm_reader("shm_reader", false, false);
+
+namespace {
+	/* the mapped region, writable for the publisher */
+	struct conky_shm *shm_region = NULL;
+	/* built outside the region, so the sequence stays odd only for a copy */
+	struct conky_shm shm_snapshot;
+	/* the processes the reader shows in its top lists */
+	struct process shm_processes[4][CONKY_SHM_MAX_TOP];
+	bool shm_warned = false;
+
+	bool shm_map(bool writable)
+	{
+		const std::string &name = shm_name.get(*state);
+		struct stat st;
+		void *p;
+		int fd;
+
+		if (shm_region)
+			return true;
+		fd = shm_open(name.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+		if (fd < 0) {
+			if (!shm_warned)
+				NORM_ERR("can't open shared memory '%s': %s", name.c_str(), strerror(errno));
+			shm_warned = true;
+			return false;
+		}
+		if (writable && ftruncate(fd, sizeof(struct conky_shm)) < 0) {
+			NORM_ERR("can't resize shared memory '%s': %s", name.c_str(), strerror(errno));
+			close(fd);
+			return false;
+		}
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct conky_shm)) {
+			if (!shm_warned)
+				NORM_ERR("shared memory '%s' is too small", name.c_str());
+			shm_warned = true;
+			close(fd);
+			return false;
+		}
+		p = mmap(NULL, sizeof(struct conky_shm), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+				MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) {
+			NORM_ERR("can't map shared memory '%s': %s", name.c_str(), strerror(errno));
+			return false;
+		}
+		shm_region = (struct conky_shm *) p;
+		shm_warned = false;
+		return true;
+	}
+
+	void copy_name(char *dst, const char *src, size_t size)
+	{
+		strncpy(dst, src ? src : "", size - 1);
+		dst[size - 1] = 0;
+	}
+
+	void write_processes(struct conky_shm_process *dst, struct process **src)
+	{
+		for (int i = 0; i < CONKY_SHM_MAX_TOP && i < top_list_size && src[i]; i++) {
+			copy_name(dst[i].name, src[i]->name, sizeof dst[i].name);
+			dst[i].pid = src[i]->pid;
+			dst[i].uid = src[i]->uid;
+			dst[i].amount = src[i]->amount;
+			dst[i].rss = src[i]->rss;
+			dst[i].vsize = src[i]->vsize;
+			dst[i].total_cpu_time = src[i]->total_cpu_time;
+#ifdef BUILD_IOSTATS
+			dst[i].io_perc = src[i]->io_perc;
+			dst[i].read_bytes = src[i]->read_bytes;
+			dst[i].write_bytes = src[i]->write_bytes;
+#endif /* BUILD_IOSTATS */
+		}
+	}
+
+	void read_processes(struct process **dst, struct process *procs,
+			struct conky_shm_process *src)
+	{
+		for (int i = 0; i < CONKY_SHM_MAX_TOP && i < top_list_size; i++) {
+			if (!src[i].pid) {
+				dst[i] = NULL;
+				continue;
+			}
+			memset(&procs[i], 0, sizeof procs[i]);
+			procs[i].name = src[i].name;
+			procs[i].pid = src[i].pid;
+			procs[i].uid = src[i].uid;
+			procs[i].amount = src[i].amount;
+			procs[i].rss = src[i].rss;
+			procs[i].vsize = src[i].vsize;
+			procs[i].total_cpu_time = src[i].total_cpu_time;
+#ifdef BUILD_IOSTATS
+			procs[i].io_perc = src[i].io_perc;
+			procs[i].read_bytes = src[i].read_bytes;
+			procs[i].write_bytes = src[i].write_bytes;
+#endif /* BUILD_IOSTATS */
+#ifdef __linux__
+			procs[i].stat_fd = -1;
+#endif /* __linux__ */
+			dst[i] = &procs[i];
+		}
+	}
+
+	/* replaces all the collectors in reader mode */
+	int update_from_shm(void)
+	{
+		struct conky_shm &s = shm_snapshot;
+		unsigned int i;
+
+		if (!shm_map(false))
+			return 0;
+		if (conky_shm_read(shm_region, &s) < 0) {
+			if (!shm_warned)
+				NORM_ERR("shared memory '%s' has no snapshot of this version",
+						shm_name.get(*state).c_str());
+			shm_warned = true;
+			return 0;
+		}
+		shm_warned = false;
+
+		info.uptime = s.uptime;
+		info.mem = s.mem;
+		info.memwithbuffers = s.memwithbuffers;
+		info.memeasyfree = s.memeasyfree;
+		info.memfree = s.memfree;
+		info.memmax = s.memmax;
+		info.memdirty = s.memdirty;
+		info.swap = s.swap;
+		info.swapfree = s.swapfree;
+		info.swapmax = s.swapmax;
+		info.bufmem = s.bufmem;
+		info.buffers = s.buffers;
+		info.cached = s.cached;
+		info.procs = s.procs;
+		info.run_procs = s.run_procs;
+		info.threads = s.threads;
+		info.run_threads = s.run_threads;
+		memcpy(info.loadavg, s.loadavg, sizeof info.loadavg);
+
+		if (s.cpu_count < 0 || s.cpu_count > CONKY_SHM_MAX_CPUS)
+			s.cpu_count = 0;
+		if (!info.cpu_usage || info.cpu_count != s.cpu_count) {
+			info.cpu_usage = (float *) realloc(info.cpu_usage,
+					(s.cpu_count + 1) * sizeof(float));
+			info.cpu_count = s.cpu_count;
+		}
+		memcpy(info.cpu_usage, s.cpu_usage, (s.cpu_count + 1) * sizeof(float));
+
+		for (i = 0; i < s.net_count && i < CONKY_SHM_MAX_NET; i++) {
+			struct conky_shm_net &n = s.net[i];
+			struct net_stat *ns;
+
+			n.dev[sizeof n.dev - 1] = 0;
+			ns = get_net_stat(n.dev, NULL, NULL);
+			ns->up = n.up;
+			ns->recv = n.recv;
+			ns->trans = n.trans;
+			ns->recv_speed = n.recv_speed;
+			ns->trans_speed = n.trans_speed;
+			memcpy(&ns->addr, n.addr, sizeof ns->addr);
+			copy_name(ns->essid, n.essid, sizeof ns->essid);
+			ns->link_qual = n.link_qual;
+			ns->link_qual_max = n.link_qual_max;
+		}
+
+		for (struct diskio_stat *ds = &stats; ds; ds = ds->next) {
+			const char *dev = ds->dev ? ds->dev : "";
+
+			for (i = 0; i < s.disk_count && i < CONKY_SHM_MAX_DISKS; i++) {
+				if (strncmp(s.disk[i].dev, dev, sizeof s.disk[i].dev) == 0) {
+					ds->current = s.disk[i].current;
+					ds->current_read = s.disk[i].current_read;
+					ds->current_write = s.disk[i].current_write;
+					break;
+				}
+			}
+		}
+
+		for (int f = 0; fs_stats && f < MAX_FS_STATS; f++) {
+			if (!fs_stats[f].set)
+				continue;
+			for (i = 0; i < s.fs_count && i < CONKY_SHM_MAX_FS; i++) {
+				if (strncmp(s.fs[i].path, fs_stats[f].path, sizeof s.fs[i].path) == 0) {
+					copy_name(fs_stats[f].type, s.fs[i].type, sizeof s.fs[i].type);
+					fs_stats[f].size = s.fs[i].size;
+					fs_stats[f].avail = s.fs[i].avail;
+					fs_stats[f].free = s.fs[i].free;
+					break;
+				}
+			}
+		}
+
+		read_processes(info.cpu, shm_processes[0], s.top_cpu);
+		read_processes(info.memu, shm_processes[1], s.top_mem);
+		read_processes(info.time, shm_processes[2], s.top_time);
+#ifdef BUILD_IOSTATS
+		read_processes(info.io, shm_processes[3], s.top_io);
+#endif /* BUILD_IOSTATS */
+		return 0;
+	}
+}
+
+void update_shm(void)
+{
+	struct conky_shm &s = shm_snapshot;
+	unsigned int i;
+	uint32_t seq;
+
+	if (shm_name.get(*state).empty() || shm_reader.get(*state) || !shm_map(true))
+		return;
+
+	memset(&s, 0, sizeof s);
+	s.magic = CONKY_SHM_MAGIC;
+	s.version = CONKY_SHM_VERSION;
+	s.size = sizeof s;
+	s.update_time = current_update_time;
+	s.update_interval = active_update_interval();
+	s.uptime = info.uptime;
+	s.mem = info.mem;
+	s.memwithbuffers = info.memwithbuffers;
+	s.memeasyfree = info.memeasyfree;
+	s.memfree = info.memfree;
+	s.memmax = info.memmax;
+	s.memdirty = info.memdirty;
+	s.swap = info.swap;
+	s.swapfree = info.swapfree;
+	s.swapmax = info.swapmax;
+	s.bufmem = info.bufmem;
+	s.buffers = info.buffers;
+	s.cached = info.cached;
+	s.procs = info.procs;
+	s.run_procs = info.run_procs;
+	s.threads = info.threads;
+	s.run_threads = info.run_threads;
+	memcpy(s.loadavg, info.loadavg, sizeof s.loadavg);
+
+	if (info.cpu_usage) {
+		s.cpu_count = std::min(info.cpu_count, CONKY_SHM_MAX_CPUS);
+		memcpy(s.cpu_usage, info.cpu_usage, (s.cpu_count + 1) * sizeof(float));
+	}
+
+	for (i = 0; i < netstats.size() && i < CONKY_SHM_MAX_NET; i++) {
+		struct conky_shm_net &n = s.net[i];
+
+		copy_name(n.dev, netstats[i]->dev, sizeof n.dev);
+		n.up = netstats[i]->up;
+		n.recv = netstats[i]->recv;
+		n.trans = netstats[i]->trans;
+		n.recv_speed = netstats[i]->recv_speed;
+		n.trans_speed = netstats[i]->trans_speed;
+		memcpy(n.addr, &netstats[i]->addr, sizeof n.addr);
+		copy_name(n.essid, netstats[i]->essid, sizeof n.essid);
+		n.link_qual = netstats[i]->link_qual;
+		n.link_qual_max = netstats[i]->link_qual_max;
+	}
+	s.net_count = i;
+
+	i = 0;
+	for (struct diskio_stat *ds = &stats; ds && i < CONKY_SHM_MAX_DISKS; ds = ds->next, i++) {
+		copy_name(s.disk[i].dev, ds->dev, sizeof s.disk[i].dev);
+		s.disk[i].current = ds->current;
+		s.disk[i].current_read = ds->current_read;
+		s.disk[i].current_write = ds->current_write;
+	}
+	s.disk_count = i;
+
+	i = 0;
+	for (int f = 0; fs_stats && f < MAX_FS_STATS && i < CONKY_SHM_MAX_FS; f++) {
+		if (!fs_stats[f].set)
+			continue;
+		copy_name(s.fs[i].path, fs_stats[f].path, sizeof s.fs[i].path);
+		copy_name(s.fs[i].type, fs_stats[f].type, sizeof s.fs[i].type);
+		s.fs[i].size = fs_stats[f].size;
+		s.fs[i].avail = fs_stats[f].avail;
+		s.fs[i].free = fs_stats[f].free;
+		i++;
+	}
+	s.fs_count = i;
+
+	write_processes(s.top_cpu, info.cpu);
+	write_processes(s.top_mem, info.memu);
+	write_processes(s.top_time, info.time);
+#ifdef BUILD_IOSTATS
+	write_processes(s.top_io, info.io);
+#endif /* BUILD_IOSTATS */
+
+	/* readers retry while seq is odd or has changed under them */
+	seq = shm_region->seq;
+	__atomic_store_n(&shm_region->seq, seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s.seq = seq | 1;
+	memcpy(shm_region, &s, sizeof s);
+	__atomic_store_n(&shm_region->seq, (seq | 1) + 1, __ATOMIC_RELEASE);
+}
+
+int (*shm_collector(int (*fn)()))()
+{
+	static int (*const covered[])() = {
+		&update_uptime, &update_meminfo, &update_net_stats, &update_cpu_usage,
+		&update_total_processes, &update_threads, &update_running_processes,
+		&update_load_average, &update_diskio, &update_fs_stats, &update_top,
+#ifdef __linux__
+		&update_stat,
+#endif /* __linux__ */
+	};
+
+	if (!shm_reader.get(*state) || shm_name.get(*state).empty())
+		return fn;
+	for (size_t i = 0; i < sizeof covered / sizeof covered[0]; i++) {
+		if (covered[i] == fn)
+			return &update_from_shm;
+	}
+	return fn;
+}
+
+void clear_shm(void)
+{
+	if (shm_region) {
+		munmap(shm_region, sizeof(struct conky_shm));
+		shm_region = NULL;
+	}
+	if (shm_reader.get(*state)) {
+		/* the top lists point into shm_processes */
+		for (int i = 0; i < CONKY_SHM_MAX_TOP && i < top_list_size; i++) {
+			info.cpu[i] = info.memu[i] = info.time[i] = NULL;
+#ifdef BUILD_IOSTATS
+			info.io[i] = NULL;
+#endif /* BUILD_IOSTATS */
+		}
+	}
+	shm_warned = false;
+}
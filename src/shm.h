@@ -0,0 +1,50 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "setting.hh"
+
+/* name of the shared memory snapshot, see conky_shm.h */
+extern conky::simple_config_setting<std::string> shm_name;
+/* read the snapshot instead of collecting */
+extern conky::simple_config_setting<bool> shm_reader;
+
+/* copy what this update collected into the snapshot */
+void update_shm(void);
+
+/* With shm_reader, the collectors the snapshot covers are replaced by one
+ * that reads it. Returns the collector to register instead of fn. */
+int (*shm_collector(int (*fn)()))();
+
+void clear_shm(void);
+
+#endif /* _SHM_H */
@@ -23,76 +23,63 @@
  */
 #include "conky.h"	/* text_buffer_size, PACKAGE_NAME, maybe more */
 #include <errno.h>
+#include "laptop.h"
 #include "temphelper.h"
 #include "logging.h"
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <stdlib.h>
 
-#define SYS_SMAPI_PATH "/sys/devices/platform/smapi"
+/* The files below /sys/devices/platform/smapi are read by the laptop
+ * callback, see laptop.cc; each object asks for the ones it shows. */
 
-static int smapi_read_int(const char *path)
+/* the first word of a file, NULL if it isn't there (or wasn't read yet) */
+static const char *smapi_read_str(const char *fname, laptop_ptr &sample)
 {
-	FILE *fp;
-	int i = 0;
-	if ((fp = fopen(path, "r"))) {
-		if (fscanf(fp, "%i\n", &i) < 0)
-			perror("fscanf()");
-		fclose(fp);
-	}
-	return i;
+	sample = get_laptop_sample(LAPTOP_SMAPI, fname);
+	if (!sample)
+		return NULL;
+
+	auto i = sample->smapi.find(fname);
+	return i == sample->smapi.end() ? NULL : i->second.c_str();
 }
 
-static int smapi_bat_installed_internal(int idx)
+static int smapi_read_int(const char *fname)
 {
-	char path[128];
-	struct stat sb;
-	int ret = 0;
-
-	snprintf(path, 127, SYS_SMAPI_PATH "/BAT%i", idx);
-	if (!stat(path, &sb) && (sb.st_mode & S_IFMT) == S_IFDIR) {
-		snprintf(path, 127, SYS_SMAPI_PATH "/BAT%i/installed", idx);
-		ret = (smapi_read_int(path) == 1) ? 1 : 0;
-	}
-	return ret;
+	laptop_ptr sample;
+	const char *s = smapi_read_str(fname, sample);
 
+	return s ? strtol(s, NULL, 0) : 0;
 }
 
-static char *smapi_read_str(const char *path)
+static int smapi_bat_installed_internal(int idx)
 {
-	FILE *fp;
-	char str[256] = "failed";
-	if ((fp = fopen(path, "r")) != NULL) {
-		if (fscanf(fp, "%255s\n", str) < 0)
-			perror("fscanf()");
-		fclose(fp);
-	}
-	return strndup(str, text_buffer_size.get(*state));
+	char path[128];
+
+	snprintf(path, 127, "BAT%i/installed", idx);
+	return (smapi_read_int(path) == 1) ? 1 : 0;
 }
 
 static char *smapi_get_str(const char *fname)
 {
-	char path[128];
-	if(snprintf(path, 127, SYS_SMAPI_PATH "/%s", fname) < 0)
-		return NULL;
+	laptop_ptr sample;
+	const char *s = smapi_read_str(fname, sample);
 
-	return smapi_read_str(path);
+	return strndup(s ? s : "failed", text_buffer_size.get(*state));
 }
 
 static char *smapi_get_bat_str(int idx, const char *fname)
 {
 	char path[128];
-	if(snprintf(path, 127, SYS_SMAPI_PATH "/BAT%i/%s", idx, fname) < 0)
+	if(snprintf(path, 127, "BAT%i/%s", idx, fname) < 0)
 		return NULL;
-	return smapi_read_str(path);
+	return smapi_get_str(path);
 }
 
 static int smapi_get_bat_int(int idx, const char *fname)
 {
 	char path[128];
-	if(snprintf(path, 127, SYS_SMAPI_PATH "/BAT%i/%s", idx, fname) < 0)
+	if(snprintf(path, 127, "BAT%i/%s", idx, fname) < 0)
 		return 0;
 	return smapi_read_int(path);
 }
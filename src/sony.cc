@@ -32,6 +32,7 @@
 #include "conky.h"
 #include "config.h"
 #include "sony.h"
+#include "laptop.h"
 #include "logging.h"
 #include "text_object.h"
 #include <stdio.h>
@@ -39,44 +40,19 @@
 #include <string.h>
 #include <stdlib.h>
 
-#define SONY_LAPTOP_DIR "/sys/devices/platform/sony-laptop"
-
 /* fanspeed in SONY_LAPTOP_DIR contains an integer value for fanspeed (0~255).
  * I don't know the exact measurement unit, though. I may assume that 0 for
- * 'fan stopped' and 255 for 'maximum fan speed'. */
+ * 'fan stopped' and 255 for 'maximum fan speed'. It is read by the laptop
+ * callback, see laptop.cc. */
 void get_sony_fanspeed(struct text_object *obj, char *p_client_buffer, int client_buffer_size)
 {
-	FILE *fp;
-	unsigned int speed = 0;
-	char fan[128];
+	laptop_ptr sample = get_laptop_sample(LAPTOP_SONY_FANSPEED);
 
 	(void)obj;
 
-	if (!p_client_buffer || client_buffer_size <= 0) {
+	if (!p_client_buffer || client_buffer_size <= 0 || !sample) {
 		return;
 	}
 
-	snprintf(fan, 127, "%s/fanspeed", SONY_LAPTOP_DIR);
-
-	fp = fopen(fan, "r");
-	if (fp != NULL) {
-		while (!feof(fp)) {
-			char line[256];
-
-			if (fgets(line, 255, fp) == NULL) {
-				break;
-			}
-			if (sscanf(line, "%u", &speed)) {
-				break;
-			}
-		}
-	} else {
-		CRIT_ERR(NULL, NULL, "can't open '%s': %s\nEnable sony support or remove "
-			"sony* from your " PACKAGE_NAME" config file.",
-			fan, strerror(errno));
-	}
-
-	fclose(fp);
-	snprintf(p_client_buffer, client_buffer_size, "%d", speed);
+	snprintf(p_client_buffer, client_buffer_size, "%d", sample->sony_fanspeed);
 }
-
@@ -31,6 +31,7 @@
 #include "colours.h"
 #ifdef BUILD_X11
 #include "fonts.h"
+#include "history.h"
 #endif /* BUILD_X11 */
 #include "logging.h"
 #include "nc.h"
@@ -40,6 +41,11 @@
 #include <sys/param.h>
 #endif /* HAVE_SYS_PARAM_H */
 #include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 struct special_t *specials = NULL;
 
@@ -61,6 +67,12 @@ namespace {
 										std::numeric_limits<int>::max(), 40, false);
 	conky::range_config_setting<int> default_gauge_height("default_gauge_height", 0,
 										std::numeric_limits<int>::max(), 25, false);
+
+	/* the name and arguments each graph object was scanned with */
+	std::unordered_map<const struct text_object *, std::string> graph_keys;
+	/* samples of the freed graphs, oldest first, in the order they were freed */
+	std::map<std::string, std::deque<std::vector<float> > > kept_histories;
+	bool keeping_histories = false;
 #endif /* BUILD_X11 */
 }
 
@@ -90,6 +102,7 @@ struct graph {
 	unsigned int first_colour, last_colour;
 	double scale;
 	char tempgrad;
+	struct graph_history history;	/* followed by its samples and queue */
 };
 
 struct stippled_hr {
@@ -175,7 +188,30 @@ void scan_font(struct text_object *obj, const char *args)
 		obj->data.s = strndup(args, DEFAULT_TEXT_BUFFER_SIZE);
 }
 
-char *scan_graph(struct text_object *obj, const char *args, double defscale)
+/* the seconds of "-s span", with an optional m, h or d suffix, 0 without */
+static double scan_graph_span(const char *args)
+{
+	const char *p = strstr(args, " " GRAPHSPAN " ");
+	char *end;
+	double span;
+
+	if (p) {
+		p++;
+	} else if (strncmp(args, GRAPHSPAN " ", strlen(GRAPHSPAN) + 1) == 0) {
+		p = args;
+	} else {
+		return 0;
+	}
+	span = strtod(p + strlen(GRAPHSPAN), &end);
+	switch (*end) {
+		case 'm': span *= 60; break;
+		case 'h': span *= 60 * 60; break;
+		case 'd': span *= 24 * 60 * 60; break;
+	}
+	return span > 0 ? span : 0;
+}
+
+static char *do_scan_graph(struct text_object *obj, const char *args, double defscale)
 {
 	struct graph *g;
 	char buf[1024];
@@ -199,6 +235,7 @@ char *scan_graph(struct text_object *obj, const char *args, double defscale)
 		if (strstr(args, " " LOGGRAPH) || strncmp(args, LOGGRAPH, strlen(LOGGRAPH)) == 0) {
 			g->flags |= SF_SHOWLOG;
 		}
+		g->history.span = scan_graph_span(args);
 		if (sscanf(args, "%d,%d %x %x %lf", &g->height, &g->width, &g->first_colour, &g->last_colour, &g->scale) == 5) {
 			return NULL;
 		}
@@ -275,13 +312,11 @@ char *scan_graph(struct text_object *obj, const char *args, double defscale)
  * Printing various special text objects
  */
 
-struct special_t *new_special_t_node()
-{
-	special_t *newnode = new special_t;
-
-	memset(newnode, 0, sizeof *newnode);
-	return newnode;
-}
+/* The specials of a frame are handed out in order from an arena that only
+ * grows, so a frame allocates nothing once the arena is large enough. The
+ * nodes are linked for the drawing code; a deque keeps them in place as it
+ * grows. */
+static std::deque<special_t> special_arena;
 
 struct special_t *new_special(char *buf, enum special_types t)
 {
@@ -289,19 +324,93 @@ struct special_t *new_special(char *buf, enum special_types t)
 
 	buf[0] = SPECIAL_CHAR;
 	buf[1] = '\0';
-	if(!specials)
-		specials = new_special_t_node();
-	current = specials;
-	for(int i=0; i < special_count; i++) {
-		if(current->next == NULL)
-			current->next = new_special_t_node();
-		current = current->next;
+	if (special_count == (int) special_arena.size()) {
+		special_arena.push_back(special_t());
+		current = &special_arena.back();
+		memset(current, 0, sizeof *current);
+		if (special_count)
+			special_arena[special_count - 1].next = current;
+		specials = &special_arena.front();
 	}
+	current = &special_arena[special_count];
 	current->type = t;
 	special_count++;
 	return current;
 }
 
+struct special_t *get_special(int index)
+{
+	if (index < 0 || index >= special_count)
+		return NULL;
+	return &special_arena[index];
+}
+
+#ifdef BUILD_X11
+static void keep_graph_history(const std::string &, struct graph *);
+#endif /* BUILD_X11 */
+
+/* free an object's special_data, making sure this frame's graphs don't
+ * point into it any more (objects of evaluate() are freed before drawing) */
+void free_special_data(struct text_object *obj)
+{
+	if (!obj->special_data)
+		return;
+
+#ifdef BUILD_X11
+	auto key = graph_keys.find(obj);
+	if (key != graph_keys.end()) {
+		if (keeping_histories)
+			keep_graph_history(key->second, (struct graph *)obj->special_data);
+		history_release(((struct graph *)obj->special_data)->history.store);
+		graph_keys.erase(key);
+	}
+#endif /* BUILD_X11 */
+
+	for (int i = 0; i < special_count; i++) {
+		special_t *s = &special_arena[i];
+		if (s->type == GRAPH && s->graph &&
+				s->graph == &((struct graph *)obj->special_data)->history)
+			s->graph = NULL;
+	}
+	free_and_zero(obj->special_data);
+}
+
+void clear_specials(void)
+{
+	special_arena.clear();
+	specials = NULL;
+	special_count = 0;
+}
+
+void keep_graph_histories(void)
+{
+#ifdef BUILD_X11
+	keeping_histories = true;
+#endif /* BUILD_X11 */
+}
+
+void forget_graph_histories(void)
+{
+#ifdef BUILD_X11
+	keeping_histories = false;
+	kept_histories.clear();
+#endif /* BUILD_X11 */
+}
+
+size_t graph_history_bytes(void)
+{
+	size_t bytes = 0;
+
+#ifdef BUILD_X11
+	for (auto i = graph_keys.begin(); i != graph_keys.end(); ++i) {
+		const struct graph *g = (const struct graph *) i->first->special_data;
+
+		bytes += g->history.allocated * (sizeof(float) + sizeof(unsigned int));
+	}
+#endif /* BUILD_X11 */
+	return bytes;
+}
+
 void new_gauge_in_shell(struct text_object *obj, char *p, int p_max_size, double usage)
 {
 	static const char *gaugevals[] = { "_. ", "\\. ", " | ", " ./", " ._" };
@@ -377,12 +486,96 @@ void new_font(struct text_object *obj, char *p, int p_max_size)
 	}
 }
 
-static void graph_append(struct special_t *graph, double f, char showaslog)
+/* The samples of a graph live in a ring, so appending one doesn't move the
+ * others. For auto-scaled graphs the maximum of the visible samples is kept
+ * in a monotonic queue: it holds the sequence numbers of the samples which
+ * are larger than everything appended after them, so its front is the
+ * maximum and every sample enters and leaves it only once. */
+static inline float graph_sample(const struct graph_history *h, unsigned int seq)
+{
+	return h->samples[seq % h->allocated];
+}
+
+static void graph_maxq_add(struct graph_history *h, unsigned int seq)
+{
+	int n = h->allocated;
+	float f = graph_sample(h, seq);
+
+	/* drop what scrolled out of the graph */
+	while (h->maxq_len && h->maxq[h->maxq_first] + (unsigned int) n <= seq) {
+		h->maxq_first = (h->maxq_first + 1) % n;
+		h->maxq_len--;
+	}
+	/* and what can't be the maximum any more */
+	while (h->maxq_len && graph_sample(h, h->maxq[(h->maxq_first + h->maxq_len - 1) % n]) <= f) {
+		h->maxq_len--;
+	}
+	h->maxq[(h->maxq_first + h->maxq_len) % n] = seq;
+	h->maxq_len++;
+}
+
+static void graph_push(struct graph_history *h, float f)
+{
+	unsigned int seq = h->seq++;
+
+	h->head = seq % h->allocated;
+	h->samples[h->head] = f;
+	graph_maxq_add(h, seq);
+}
+
+/* Resize the ring of a graph to history.width samples, keeping the newest
+ * ones. The samples and the queue are stored right behind struct graph, so
+ * they go away with the object's special_data. */
+static struct graph *graph_resize(struct text_object *obj)
+{
+	struct graph *g = (struct graph *)obj->special_data;
+	struct graph_history *h = &g->history;
+	int n = h->width, k = std::min(n, h->allocated);
+
+	DBGP("reallocing graph from %d to %d", h->allocated, n);
+
+	/* line the ring up oldest first and keep the newest k at the start */
+	if (h->allocated) {
+		std::rotate(h->samples, h->samples + (h->head + 1) % h->allocated,
+				h->samples + h->allocated);
+		memmove(h->samples, h->samples + h->allocated - k, k * sizeof(float));
+	}
+
+	g = (struct graph *)realloc(g, sizeof(struct graph) +
+			n * (sizeof(float) + sizeof(unsigned int)));
+	obj->special_data = g;
+	h = &g->history;
+	h->samples = (float *)(g + 1);
+	h->maxq = (unsigned int *)(h->samples + n);
+
+	/* older samples than we had are zero */
+	memmove(h->samples + n - k, h->samples, k * sizeof(float));
+	memset(h->samples, 0, (n - k) * sizeof(float));
+
+	h->allocated = n;
+	h->seq = 0;
+	h->maxq_first = h->maxq_len = 0;
+	for (int i = 0; i < n; i++) {
+		graph_maxq_add(h, h->seq++);
+	}
+	h->head = n - 1;
+	return g;
+}
+
+/* a new sample, for the graph and its copy in history_file */
+static void graph_add(struct graph_history *h, float f)
 {
-	int i;
+	graph_push(h, f);
+	if (h->store)
+		history_append(h->store, f, current_update_time);
+}
+
+void graph_append(struct special_t *graph, double f, char showaslog)
+{
+	struct graph_history *h = graph->graph;
 
 	/* do nothing if we don't even have a graph yet */
-	if (!graph->graph) return;
+	if (!h->allocated) return;
 
 	if (showaslog) {
 #ifdef MATH
@@ -394,14 +587,28 @@ static void graph_append(struct special_t *graph, double f, char showaslog)
 		f = graph->scale;
 	}
 
-	/* shift all the data by 1 */
-	for (i = graph->graph_allocated - 1; i > 0; i--) {
-		graph->graph[i] = graph->graph[i - 1];
+	if (h->span > 0) {
+		/* collect the updates of the column, it's added once complete */
+		double column = h->span / h->allocated;
+
+		h->column_sum += f;
+		h->column_n++;
+		if (!h->column_end)
+			h->column_end = current_update_time + column;
+		if (current_update_time >= h->column_end) {
+			graph_add(h, h->column_sum / h->column_n);
+			h->column_sum = 0;
+			h->column_n = 0;
+			/* stay on the column grid unless updates were missed */
+			h->column_end = current_update_time - h->column_end < column ?
+				h->column_end + column : current_update_time + column;
+		}
+	} else {
+		graph_add(h, f);
 	}
-	graph->graph[0] = f;	/* add new data */
-	
+
 	if(graph->scaled) {
-		graph->scale = *std::max_element(graph->graph + 0, graph->graph + graph->graph_width);
+		graph->scale = graph_sample(h, h->maxq[h->maxq_first]);
 		if(graph->scale < 1e-47) {
 			/* avoid NaN's when the graph is all-zero (e.g. before the first update)
 			 * there is nothing magical about 1e-47 here */
@@ -410,43 +617,92 @@ static void graph_append(struct special_t *graph, double f, char showaslog)
 	}
 }
 
-void new_graph(struct text_object *obj, char *buf, int buf_max_size, double val)
+struct graph_history *resize_graph_history(struct text_object *obj, int width)
 {
-	struct special_t *s = 0;
 	struct graph *g = (struct graph *)obj->special_data;
 
-	if (not out_to_x.get(*state))
-		return;
+	g->history.width = width;
+	if (g->history.width != g->history.allocated) {
+		g = graph_resize(obj);
+	}
+	return &g->history;
+}
 
-	if (!g || !buf_max_size)
+static void keep_graph_history(const std::string &key, struct graph *g)
+{
+	const struct graph_history *h = &g->history;
+	std::vector<float> samples;
+
+	if (!h->allocated)
 		return;
 
-	s = new_special(buf, GRAPH);
+	samples.reserve(h->allocated);
+	for (unsigned int seq = h->seq - h->allocated; seq != h->seq; seq++) {
+		samples.push_back(graph_sample(h, seq));
+	}
+	kept_histories[key].push_back(std::move(samples));
+}
 
-	s->width = g->width;
-	if (s->width) s->graph_width = s->width;
-
-	if (s->graph_width != s->graph_allocated) {
-		double *graph = static_cast<double *>(realloc(s->graph, s->graph_width * sizeof(double)));
-		DBGP("reallocing graph from %d to %d", s->graph_allocated, s->graph_width);
-		if (!s->graph) {
-			/* initialize */
-			memset(graph, 0, s->graph_width * sizeof(double));
-			s->scale = 100;
-		} else {
-			if (s->graph_width > s->graph_allocated) {
-				/* initialize the new region */
-				memset(graph + (s->graph_allocated * sizeof(double)), 0,
-						(s->graph_width - s->graph_allocated) *
-						sizeof(double));
+/* Start a graph with the samples history_file has of it, followed by zeros for
+ * the updates (or columns, with a span) conky wasn't running. */
+static void graph_seed(struct text_object *obj, struct history_slot *store)
+{
+	struct graph *g = (struct graph *)obj->special_data;
+	unsigned int count, gap;
+	double interval, missed;
+
+	if (store && (count = history_count(store))) {
+		if (g->history.span > 0)
+			interval = g->history.span / (g->width > 0 ? g->width : count);
+		else
+			interval = active_sample_interval();
+		missed = (get_time() - store->last_time) / interval;
+		if (missed < count) {
+			gap = std::max(missed, 0.0);
+			g->history.width = count;
+			g = graph_resize(obj);
+			for (unsigned int j = count - gap; j-- > 0; ) {
+				graph_push(&g->history, history_value(store, j));
+			}
+			for (unsigned int j = 0; j < gap; j++) {
+				graph_push(&g->history, 0);
+				history_append(store, 0, store->last_time);
 			}
 		}
-		s->graph = graph;
-		s->graph_allocated = s->graph_width;
 	}
-	s->height = g->height;
-	s->first_colour = adjust_colours(g->first_colour);
-	s->last_colour = adjust_colours(g->last_colour);
+	g->history.store = store;
+}
+
+char *scan_graph(struct text_object *obj, const char *args, double defscale)
+{
+	char *buf = do_scan_graph(obj, args, defscale);
+	std::string key = std::string(obj->name ? obj->name : "") + " " + (args ? args : "");
+	auto kept = kept_histories.find(key);
+
+	if (kept != kept_histories.end()) {
+		/* the same graph of the previous config, give it its samples back */
+		std::vector<float> samples = std::move(kept->second.front());
+		struct graph *g = (struct graph *)obj->special_data;
+
+		kept->second.pop_front();
+		if (kept->second.empty())
+			kept_histories.erase(kept);
+
+		g->history.width = samples.size();
+		g = graph_resize(obj);
+		for (size_t i = 0; i < samples.size(); i++) {
+			graph_push(&g->history, samples[i]);
+		}
+		g->history.store = history_claim(key.c_str());
+	} else {
+		graph_seed(obj, history_claim(key.c_str()));
+	}
+	graph_keys[obj] = std::move(key);
+	return buf;
+}
+
+static void graph_set_scale(struct special_t *s, const struct graph *g)
+{
 	if (g->scale != 0) {
 		s->scaled = 0;
 		s->scale = g->scale;
@@ -456,15 +712,57 @@ void new_graph(struct text_object *obj, char *buf, int buf_max_size, double val)
 		s->scale = 1;
 		s->show_scale = 1;
 	}
-	s->tempgrad = g->tempgrad;
 #ifdef MATH
 	if (g->flags & SF_SHOWLOG) {
 		s->scale = log10(s->scale + 1);
 	}
 #endif
+}
+
+void new_graph(struct text_object *obj, char *buf, int buf_max_size, double val)
+{
+	struct special_t *s = 0;
+	struct graph *g = (struct graph *)obj->special_data;
+
+	if (not out_to_x.get(*state))
+		return;
+
+	if (!g || !buf_max_size)
+		return;
+
+	s = new_special(buf, GRAPH);
+
+	s->width = g->width;
+	if (s->width) g->history.width = s->width;
+
+	if (g->history.width != g->history.allocated) {
+		g = graph_resize(obj);
+	}
+	s->graph = &g->history;
+	s->height = g->height;
+	s->first_colour = adjust_colours(g->first_colour);
+	s->last_colour = adjust_colours(g->last_colour);
+	graph_set_scale(s, g);
+	s->tempgrad = g->tempgrad;
 	graph_append(s, val, g->flags & SF_SHOWLOG);
 }
 
+/* a sample between two updates of the text, the special it goes through is
+ * only there for graph_append() */
+void sample_graph(struct text_object *obj, double val)
+{
+	struct graph *g = (struct graph *)obj->special_data;
+	struct special_t s;
+
+	if (!g || !g->history.allocated)
+		return;
+
+	memset(&s, 0, sizeof(s));
+	s.graph = &g->history;
+	graph_set_scale(&s, g);
+	graph_append(&s, val, g->flags & SF_SHOWLOG);
+}
+
 void new_hr(struct text_object *obj, char *p, int p_max_size)
 {
 	if (not out_to_x.get(*state))
@@ -37,6 +37,7 @@
 // don't use spaces in LOGGRAPH or NORMGRAPH if you change them
 #define LOGGRAPH "-l"
 #define TEMPGRAD "-t"
+#define GRAPHSPAN "-s"
 
 enum special_types {
 	NONSPECIAL = 0,
@@ -57,16 +58,35 @@ enum special_types {
 	TAB
 };
 
+struct history_slot;
+
+/* the samples of a graph, kept in its text object's special_data so they
+ * follow the object rather than its position among this frame's specials */
+struct graph_history {
+	float *samples;			/* ring of allocated samples */
+	unsigned int *maxq;		/* sequence numbers of decreasing samples */
+	int head;				/* slot of the newest sample */
+	unsigned int seq;		/* number of samples appended since the last resize */
+	int maxq_first, maxq_len;
+	int width;				/* number of samples wanted */
+	int allocated;
+	struct history_slot *store;	/* its copy in history_file, if any */
+	/* With a span, a sample covers span / allocated seconds and is the mean
+	 * of the updates in that time, collected in column_sum until column_end */
+	double span;
+	double column_end;
+	double column_sum;
+	int column_n;
+};
+
 struct special_t {
 	int type;
 	short height;
 	short width;
 	double arg;
-	double *graph;
+	struct graph_history *graph;	/* only valid during the frame */
 	double scale;			/* maximum value */
 	short show_scale;
-	int graph_width;
-	int graph_allocated;
 	int scaled;			/* auto adjust maximum */
 	unsigned long first_colour;	// for graph gradient
 	unsigned long last_colour;
@@ -75,13 +95,38 @@ struct special_t {
 	struct special_t *next;
 };
 
+/* the j-th newest sample of a graph, j < allocated */
+static inline float graph_value(const struct graph_history *h, int j)
+{
+	j = h->head - j;
+	return h->samples[j < 0 ? j + h->allocated : j];
+}
+
 /* direct access to the registered specials (FIXME: bad encapsulation) */
 extern struct special_t *specials;
 extern int special_count;
 
+/* the special at index of this frame, NULL past the last one */
+struct special_t *get_special(int index);
+
+/* throw away the specials of all frames */
+void clear_specials(void);
+
+/* Until forget_graph_histories(), the samples of the graphs that are freed are
+ * kept and given to the next graphs scanned with the same object name and
+ * arguments, so that reloading the config doesn't empty them. */
+void keep_graph_histories(void);
+void forget_graph_histories(void);
+
+/* the bytes the samples of the graphs take, for $conky_mem */
+size_t graph_history_bytes(void);
+
 /* forward declare to avoid mutual inclusion between specials.h and text_object.h */
 struct text_object;
 
+/* free the special_data of an object */
+void free_special_data(struct text_object *);
+
 /* scanning special arguments */
 const char *scan_bar(struct text_object *, const char *, double);
 const char *scan_gauge(struct text_object *, const char *, double);
@@ -94,8 +139,13 @@ void scan_stippled_hr(struct text_object *, const char*);
 /* printing specials */
 void new_font(struct text_object *, char *, int);
 void new_graph(struct text_object *, char *, int, double);
+void sample_graph(struct text_object *, double);
 void new_hr(struct text_object *, char *, int);
 void new_stippled_hr(struct text_object *, char *, int);
+
+/* what new_graph() does to the samples of a scanned graph, for conky_bench */
+struct graph_history *resize_graph_history(struct text_object *, int);
+void graph_append(struct special_t *, double, char);
 #endif /* BUILD_X11 */
 void new_gauge(struct text_object *, char *, int, double);
 void new_bar(struct text_object *, char *, int, double);
@@ -33,11 +33,18 @@
 #include "common.h"
 #include "text_object.h"
 #include "logging.h"
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif /* HAVE_SYS_INOTIFY_H */
+#include <algorithm>
+#include <deque>
 #include <memory>
 
 #define MAX_HEADTAIL_LINES 30
@@ -51,12 +58,30 @@ struct headtail {
 	int max_uses;
 	int reported;
 
+	/* $tail of a regular file keeps it open and only reads what was appended
+	 * since, the complete lines of which are kept in lines */
+	int fd;
+	off_t offset;
+	dev_t dev;
+	ino_t ino;
+	std::deque<std::string> lines;
+	std::string partial;
+	/* tells when the file was written to, moved or deleted */
+	int inotify;
+
 	headtail()
-		: wantedlines(0), buffer(NULL), current_use(0), max_uses(0), reported(0)
+		: wantedlines(0), buffer(NULL), current_use(0), max_uses(0), reported(0),
+		  fd(-1), offset(0), dev(0), ino(0), inotify(-1)
 	{}
 
 	~headtail()
-	{ free(buffer); }
+	{
+		free(buffer);
+		if (fd != -1)
+			close(fd);
+		if (inotify != -1)
+			close(inotify);
+	}
 };
 
 static void tailstring(char *string, int endofstring, int wantedlines) {
@@ -78,6 +103,131 @@ static void tailstring(char *string, int endofstring, int wantedlines) {
 	}
 }
 
+static void tail_add(struct headtail *ht, const char *data, size_t len)
+{
+	size_t start = 0;
+
+	ht->partial.append(data, len);
+	for (size_t i = 0; i < ht->partial.size(); i++) {
+		if (ht->partial[i] != '\n')
+			continue;
+		ht->lines.push_back(ht->partial.substr(start, i - start));
+		if (ht->lines.size() > (size_t) ht->wantedlines)
+			ht->lines.pop_front();
+		start = i + 1;
+	}
+	ht->partial.erase(0, start);
+}
+
+/* (re)open the log, reading the last max_size bytes of it */
+static bool tail_open(struct headtail *ht, int max_size)
+{
+	struct stat st;
+	char buf[0x1000];
+	ssize_t len;
+
+	if (ht->fd != -1)
+		close(ht->fd);
+	ht->lines.clear();
+	ht->partial.clear();
+	ht->fd = open(ht->logfile.c_str(), O_RDONLY | O_CLOEXEC);
+	if (ht->fd == -1 || fstat(ht->fd, &st) != 0) {
+		if (!ht->reported) {
+			NORM_ERR("can't open %s: %s", ht->logfile.c_str(), strerror(errno));
+			ht->reported = 1;
+		}
+		if (ht->fd != -1)
+			close(ht->fd);
+		ht->fd = -1;
+		return false;
+	}
+	ht->dev = st.st_dev;
+	ht->ino = st.st_ino;
+	ht->offset = st.st_size > max_size ? st.st_size - max_size : 0;
+	if (ht->offset > 0) {
+		/* skip the line cut in half */
+		while ((len = pread(ht->fd, buf, sizeof buf, ht->offset)) > 0) {
+			char *nl = (char *) memchr(buf, '\n', len);
+
+			if (nl) {
+				ht->offset += nl - buf + 1;
+				break;
+			}
+			ht->offset += len;
+		}
+	}
+#ifdef HAVE_SYS_INOTIFY_H
+	if (ht->inotify != -1)
+		close(ht->inotify);
+	ht->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ht->inotify != -1 && inotify_add_watch(ht->inotify, ht->logfile.c_str(),
+				IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) == -1) {
+		close(ht->inotify);
+		ht->inotify = -1;
+	}
+#endif /* HAVE_SYS_INOTIFY_H */
+	return true;
+}
+
+/* whether the log may have changed since it was last read, without inotify
+ * it always may */
+static bool tail_changed(struct headtail *ht)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	char buf[0x1000];
+	bool changed = false;
+
+	if (ht->inotify == -1)
+		return true;
+	while (read(ht->inotify, buf, sizeof buf) > 0)
+		changed = true;
+	return changed;
+#else
+	(void) ht;
+	return true;
+#endif /* HAVE_SYS_INOTIFY_H */
+}
+
+static void print_tailfile(struct headtail *ht, const struct stat *st, char *p, int p_max_size)
+{
+	struct stat fst;
+	char buf[0x1000];
+	ssize_t len;
+	int n = 0;
+	bool changed = ht->fd == -1 || tail_changed(ht);
+
+	/* rotated, truncated, or appended to by more than fits in p */
+	if (ht->fd == -1 || st->st_dev != ht->dev || st->st_ino != ht->ino
+			|| (changed && (fstat(ht->fd, &fst) != 0
+					|| fst.st_size < ht->offset
+					|| fst.st_size - ht->offset > p_max_size))) {
+		if (!tail_open(ht, p_max_size)) {
+			p[0] = 0;
+			return;
+		}
+		changed = true;
+	}
+	while (changed && (len = pread(ht->fd, buf, sizeof buf, ht->offset)) > 0) {
+		tail_add(ht, buf, len);
+		ht->offset += len;
+	}
+
+	/* like tailstring(), a last line without a newline is shown too */
+	size_t skip = ht->partial.empty() || ht->lines.size() < (size_t) ht->wantedlines ? 0 : 1;
+	p[0] = 0;
+	for (const std::string &line : ht->lines) {
+		if (skip) {
+			skip--;
+			continue;
+		}
+		n += snprintf(p + n, p_max_size - n, "%s%s", n ? "\n" : "", line.c_str());
+		if (n >= p_max_size)
+			return;
+	}
+	if (!ht->partial.empty())
+		snprintf(p + n, p_max_size - n, "%s%s", n ? "\n" : "", ht->partial.c_str());
+}
+
 void free_tailhead(struct text_object *obj)
 {
 	struct headtail *ht = (struct headtail *)obj->data.opaque;
@@ -155,6 +305,8 @@ static void print_tailhead(const char* type, struct text_object *obj, char *p, i
 					}
 				}
 				close(fd);
+			} else if (strcmp(type, "tail") == 0) {
+				print_tailfile(ht, &st, p, p_max_size);
 			} else {
 				fp = open_file(ht->logfile.c_str(), &ht->reported);
 				if(fp != NULL) {
@@ -192,60 +344,155 @@ void print_tail(struct text_object *obj, char *p, int p_max_size)
 	print_tailhead("tail", obj, p, p_max_size);
 }
 
-/* FIXME: use something more general (see also tail.c, head.c */
-#define BUFSZ 0x1000
+/* $lines and $words remember how far they counted a file, so a file that
+ * was only appended to is counted from there on */
+struct filecount {
+	std::string file;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	unsigned long lines;
+	unsigned long words;
+	bool inword;
+	int reported;
 
-void print_lines(struct text_object *obj, char *p, int p_max_size)
+	filecount()
+		: dev(0), ino(0), size(-1), mtime(0), lines(0), words(0), inword(false),
+		  reported(0)
+	{}
+};
+
+void scan_filecount(struct text_object *obj, const char *arg)
 {
-	static int rep = 0;
-	FILE *fp = open_file(obj->data.s, &rep);
-	char buf[BUFSZ];
-	int j, lines;
+	struct filecount *fc = new filecount;
 
-	if (!fp) {
-		snprintf(p, p_max_size, "File Unreadable");
+	fc->file = std::string(arg).substr(0, text_buffer_size.get(*state));
+	obj->data.opaque = fc;
+}
+
+void free_filecount(struct text_object *obj)
+{
+	delete (struct filecount *)obj->data.opaque;
+	obj->data.opaque = NULL;
+}
+
+static void count_data(struct filecount *fc, const char *data, size_t len, bool words)
+{
+	const char *end = data + len;
+
+	if (!words) {
+		/* memchr() is vectorised by the C library */
+		while ((data = (const char *) memchr(data, '\n', end - data))) {
+			fc->lines++;
+			data++;
+		}
 		return;
 	}
+	for (; data < end; data++) {
+		bool space = isspace((unsigned char) *data);
 
-	lines = 0;
-	while(fgets(buf, BUFSZ, fp) != NULL){
-		for(j = 0; buf[j] != 0; j++) {
-			if(buf[j] == '\n') {
-				lines++;
-			}
+		fc->words += !space && !fc->inword;
+		fc->inword = !space;
+	}
+}
+
+static void count_reset(struct filecount *fc)
+{
+	fc->lines = fc->words = 0;
+	fc->inword = false;
+}
+
+/* brings fc up to date with its file, returns false if it can't be read */
+static bool count_file(struct filecount *fc, bool words)
+{
+	struct stat st;
+	off_t from = 0;
+	char buf[0x1000];
+	ssize_t len;
+	int fd = open(fc->file.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1 || fstat(fd, &st) != 0) {
+		if (!fc->reported) {
+			NORM_ERR("can't open %s: %s", fc->file.c_str(), strerror(errno));
+			fc->reported = 1;
 		}
+		if (fd != -1)
+			close(fd);
+		fc->size = -1;
+		return false;
 	}
-	snprintf(p, p_max_size, "%d", lines);
-	fclose(fp);
+
+	/* files in /proc and the like have no size, they are read every time */
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		count_reset(fc);
+		while ((len = read(fd, buf, sizeof buf)) > 0)
+			count_data(fc, buf, len, words);
+		close(fd);
+		fc->size = -1;
+		return true;
+	}
+
+	if (fc->size != -1 && st.st_dev == fc->dev && st.st_ino == fc->ino) {
+		if (st.st_size == fc->size && st.st_mtime == fc->mtime) {
+			close(fd);
+			return true;
+		}
+		if (st.st_size > fc->size)
+			from = fc->size;
+	}
+	if (!from)
+		count_reset(fc);
+
+	/* mmap() needs a page aligned offset */
+	off_t map_from = from - from % sysconf(_SC_PAGESIZE);
+	size_t map_len = st.st_size - map_from;
+	void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_from);
+
+	if (map != MAP_FAILED) {
+		count_data(fc, (const char *) map + (from - map_from), st.st_size - from, words);
+		munmap(map, map_len);
+	} else {
+		off_t at = from;
+
+		while (at < st.st_size && (len = pread(fd, buf, sizeof buf, at)) > 0) {
+			count_data(fc, buf, std::min<off_t>(len, st.st_size - at), words);
+			at += len;
+		}
+	}
+	close(fd);
+
+	fc->dev = st.st_dev;
+	fc->ino = st.st_ino;
+	fc->size = st.st_size;
+	fc->mtime = st.st_mtime;
+	return true;
 }
 
-void print_words(struct text_object *obj, char *p, int p_max_size)
+void print_lines(struct text_object *obj, char *p, int p_max_size)
 {
-	static int rep = 0;
-	FILE *fp = open_file(obj->data.s, &rep);
-	char buf[BUFSZ];
-	int j, words;
-	char inword = 0;
+	struct filecount *fc = (struct filecount *)obj->data.opaque;
 
-	if(!fp) {
+	if (!fc)
+		return;
+
+	if (!count_file(fc, false)) {
 		snprintf(p, p_max_size, "File Unreadable");
 		return;
 	}
+	snprintf(p, p_max_size, "%lu", fc->lines);
+}
 
-	words = 0;
-	while(fgets(buf, BUFSZ, fp) != NULL){
-		for(j = 0; buf[j] != 0; j++) {
-			if(!isspace(buf[j])) {
-				if(!inword) {
-					words++;
-					inword = 1;
-				}
-			} else {
-				inword = 0;
-			}
-		}
+void print_words(struct text_object *obj, char *p, int p_max_size)
+{
+	struct filecount *fc = (struct filecount *)obj->data.opaque;
+
+	if (!fc)
+		return;
+
+	if (!count_file(fc, true)) {
+		snprintf(p, p_max_size, "File Unreadable");
+		return;
 	}
-	snprintf(p, p_max_size, "%d", words);
-	fclose(fp);
+	snprintf(p, p_max_size, "%lu", fc->words);
 }
-
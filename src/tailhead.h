@@ -36,7 +36,9 @@ void init_tailhead(const char *, const char *, struct text_object *, void *);
 void print_head(struct text_object *, char *, int);
 void print_tail(struct text_object *, char *, int);
 
+void scan_filecount(struct text_object *, const char *);
 void print_lines(struct text_object *, char *, int);
 void print_words(struct text_object *, char *, int);
+void free_filecount(struct text_object *);
 
 #endif /* _TAILHEAD_H */
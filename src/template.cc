@@ -30,7 +30,10 @@
 #include "conky.h"
 #include "logging.h"
 #include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <string>
 
 namespace {
@@ -46,6 +49,8 @@ namespace {
 		{ "template8", std::string(), true },
 		{ "template9", std::string(), true }
 	};
+
+	conky::simple_config_setting<std::string> text_cache("text_cache", std::string(), false);
 }
 
 
@@ -160,41 +165,42 @@ static char *handle_template(const char *tmpl, const char *args)
 	return eval_text;
 }
 
-/* Search inbuf and replace all found template object references
- * with the substituted value. */
-char *find_and_replace_templates(const char *inbuf)
-{
-	char *outbuf, *indup, *p, *o, *templ, *args, *tmpl_out;
-	int stack, outlen;
+/* how deep templates may refer to templates, to stop ones that expand to themselves */
+#define MAX_TEMPLATE_DEPTH 32
 
-	outlen = strlen(inbuf) + 1;
-	o = outbuf = (char*) calloc(outlen, sizeof(char));
-	memset(outbuf, 0, outlen * sizeof(char));
-
-	p = indup = strdup(inbuf);
+/* Append p to out with the template object references replaced. The text a
+ * template expands to is expanded right away, so out is written once from
+ * start to end and never scanned again. */
+static void expand_templates(const char *p, std::string &out, int depth)
+{
 	while (*p) {
-		while (*p && *p != '$')
-			*(o++) = *(p++);
+		const char *dollar = strchr(p, '$');
+		std::string templ, args;
+		bool has_args = false;
+		char *tmpl_out;
 
-		if (!(*p))
+		if (!dollar) {
+			out += p;
 			break;
+		}
+		out.append(p, dollar - p);
+		p = dollar;
 
 		if (strncmp(p, "$template", strlen("$template")) && strncmp(p, "${template", strlen("${template"))) {
-			*(o++) = *(p++);
+			out += *(p++);
 			continue;
 		}
 
 		if (*(p + 1) == '{') {
+			const char *start;
+			int stack = 1;
+
 			p += 2;
-			templ = p;
+			start = p;
 			while (*p && !isspace(*p) && *p != '{' && *p != '}')
 				p++;
-			if (*p == '}')
-				args = NULL;
-			else
-				args = p;
-
-			stack = 1;
+			templ.assign(start, p - start);
+			start = p;
 			while (*p && stack > 0) {
 				if (*p == '{')
 					stack++;
@@ -202,36 +208,46 @@ char *find_and_replace_templates(const char *inbuf)
 					stack--;
 				p++;
 			}
-			if (stack == 0) {
-				// stack is empty. that means the previous char was }, so we zero it
-				*(p - 1) = '\0';
-			} else {
+			if (stack != 0) {
 				// we ran into the end of string without finding a closing }, bark
 				CRIT_ERR(NULL, NULL, "cannot find a closing '}' in template expansion");
 			}
+			if (*start != '}') {
+				has_args = true;
+				args.assign(start, p - 1 - start);
+			}
 		} else {
-			templ = p + 1;
+			const char *start = p + 1;
+
 			p += strlen("$template");
 			while (*p && isdigit(*p))
 				p++;
-			args = NULL;
+			templ.assign(start, p - start);
 		}
-		tmpl_out = handle_template(templ, args);
-		if (tmpl_out) {
-			outlen += strlen(tmpl_out);
-			*o = '\0';
-			outbuf = (char*) realloc(outbuf, outlen * sizeof(char));
-			strcat (outbuf, tmpl_out);
-			free(tmpl_out);
-			o = outbuf + strlen(outbuf);
+
+		tmpl_out = handle_template(templ.c_str(), has_args ? args.c_str() : NULL);
+		if (!tmpl_out) {
+			NORM_ERR("failed to handle template '%s' with args '%s'", templ.c_str(), args.c_str());
+		} else if (depth >= MAX_TEMPLATE_DEPTH) {
+			NORM_ERR("templates nested more than %d deep at '%s', not expanding any further",
+					MAX_TEMPLATE_DEPTH, templ.c_str());
+			out += tmpl_out;
 		} else {
-			NORM_ERR("failed to handle template '%s' with args '%s'", templ, args);
+			expand_templates(tmpl_out, out, depth + 1);
 		}
+		free(tmpl_out);
 	}
-	*o = '\0';
-	outbuf = (char*) realloc(outbuf, (strlen(outbuf) + 1) * sizeof(char));
-	free(indup);
-	return outbuf;
+}
+
+/* Search inbuf and replace all found template object references
+ * with the substituted value, including the ones templates expand to. */
+char *find_and_replace_templates(const char *inbuf)
+{
+	std::string out;
+
+	out.reserve(strlen(inbuf) + 1);
+	expand_templates(inbuf, out, 0);
+	return strdup(out.c_str());
 }
 
 /* check text for any template object references */
@@ -244,3 +260,108 @@ int text_contains_templates(const char *text)
 	return 0;
 }
 
+
+/* FNV-1a, so that the names of the cached texts stay the same between builds */
+static unsigned long long hash_bytes(unsigned long long h, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char) s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* the file in text_cache for text with the current templates */
+static std::string cached_text_file(const char *text)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	char name[32];
+
+	h = hash_bytes(h, text, strlen(text) + 1);
+	for (int i = 0; i < MAX_TEMPLATES; i++) {
+		const std::string &t = _template[i].get(*state);
+		h = hash_bytes(h, t.c_str(), t.size() + 1);
+	}
+	snprintf(name, sizeof name, "/text-%016llx", h);
+	return to_real_path(text_cache.get(*state)) + name;
+}
+
+static char *read_cached_text(const std::string &file)
+{
+	FILE *fp = fopen(file.c_str(), "r");
+	char *text;
+	long len;
+
+	if (!fp)
+		return NULL;
+	if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+		fclose(fp);
+		return NULL;
+	}
+	text = (char*) malloc(len + 1);
+	if (fread(text, 1, len, fp) != (size_t) len) {
+		free(text);
+		text = NULL;
+	} else {
+		text[len] = '\0';
+	}
+	fclose(fp);
+	return text;
+}
+
+static void write_cached_text(const std::string &file, const char *text)
+{
+	std::string tmp = file + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	size_t len = strlen(text);
+
+	if (!fp) {
+		NORM_ERR("can't write the text cache '%s': %s", tmp.c_str(), strerror(errno));
+		return;
+	}
+	bool failed = fwrite(text, 1, len, fp) != len;
+
+	if (fclose(fp))
+		failed = true;
+	if (failed) {
+		NORM_ERR("can't write the text cache '%s'", tmp.c_str());
+		unlink(tmp.c_str());
+		return;
+	}
+	if (rename(tmp.c_str(), file.c_str())) {
+		NORM_ERR("can't write the text cache '%s': %s", file.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+	}
+}
+
+char *replace_templates(const char *text, bool cached)
+{
+	char *p = strndup(text, max_user_text.get(*state) - 1);
+	char *tmp;
+	std::string file;
+
+	if (!text_contains_templates(p)) {
+		DBGP2("no templates to replace");
+		return p;
+	}
+
+	if (cached && !text_cache.get(*state).empty()) {
+		char *hit;
+
+		file = cached_text_file(p);
+		if ((hit = read_cached_text(file))) {
+			DBGP("read the text with its templates replaced from '%s'", file.c_str());
+			free(p);
+			return hit;
+		}
+	}
+
+	tmp = find_and_replace_templates(p);
+	free(p);
+	p = tmp;
+	DBGP2("replaced all templates in text: input is\n'%s'\noutput is\n'%s'", text, p);
+
+	if (!file.empty())
+		write_cached_text(file, p);
+	return p;
+}
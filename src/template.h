@@ -34,4 +34,9 @@
 char *find_and_replace_templates(const char *);
 int text_contains_templates(const char *);
 
+/* a copy of the text, cut to max_user_text, with all templates replaced;
+ * the result for the config text is kept in the text_cache directory if
+ * cached is set */
+char *replace_templates(const char *, bool cached);
+
 #endif /* _TEMPLATE_H */
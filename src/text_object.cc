@@ -32,7 +32,11 @@
 #include "logging.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
 #include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 void gen_free_opaque(struct text_object *obj)
 {
@@ -77,6 +81,8 @@ int append_object(struct text_object *root, struct text_object *obj)
 {
 	struct text_object *end;
 
+	free_text_program(root);
+
 	/* hook in start of list to append */
 	end = root->prev;
 	obj->prev = end;
@@ -98,6 +104,246 @@ int append_object(struct text_object *root, struct text_object *obj)
 	return 0;
 }
 
+/* objects whose print callbacks only format what the update collected, so
+ * they can run on any thread */
+static const char *const reentrant_objects[] = {
+	"buffers", "cached", "cpu", "diskio", "diskio_await", "diskio_iops",
+	"diskio_queue", "diskio_read", "diskio_util", "diskio_write", "downspeed",
+	"downspeedf", "fs_free", "fs_size", "fs_used", "loadavg", "mem",
+	"memeasyfree", "memfree", "meminfo", "memmax", "memwithbuffers",
+	"processes", "running_processes", "running_threads", "swap", "swapfree",
+	"swapmax", "threads", "upspeed", "upspeedf", "uptime", "uptime_short",
+};
+
+/* meters whose values only depend on what the update collected; the bars
+ * and graphs themselves are specials of each object */
+static const char *const pure_meters[] = {
+	"cpubar", "cpugauge", "cpugraph", "fs_bar", "fs_bar_free", "fs_free_perc",
+	"fs_used_perc", "loadgraph", "membar", "memgauge", "memgraph", "memperc",
+	"swapbar", "swapperc",
+};
+
+template<size_t n>
+static bool name_in(const struct text_object *obj, const char *const (&names)[n])
+{
+	if (!obj->name)
+		return false;
+	for (size_t i = 0; i < n; i++) {
+		if (!strcmp(obj->name, names[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool is_reentrant(const struct text_object *obj)
+{
+	if (obj->callbacks.print == &gen_print_obj_data_s)
+		return true;
+	return name_in(obj, reentrant_objects);
+}
+
+struct text_memo {
+	std::string key;
+	int refs;
+	std::mutex mutex;
+	/* the frames the text and the value are from, 0 for none */
+	unsigned long text_frame, value_frame;
+	std::string text;
+	double value;
+
+	text_memo(const std::string &key_)
+		: key(key_), refs(0), text_frame(0), value_frame(0), value(0)
+	{}
+};
+
+/* by "name argument", only touched while parsing and freeing */
+static std::unordered_map<std::string, struct text_memo *> text_memos;
+static unsigned long text_frame = 1;
+
+void text_memo_attach(struct text_object *obj, const char *arg)
+{
+	if (!is_reentrant(obj) && !name_in(obj, pure_meters))
+		return;
+	/* plain text copies nothing faster than it prints */
+	if (!obj->name)
+		return;
+
+	std::string key = std::string(obj->name) + ' ' + (arg ? arg : "");
+	struct text_memo *&memo = text_memos[key];
+
+	if (!memo)
+		memo = new text_memo(key);
+	memo->refs++;
+	obj->memo = memo;
+}
+
+void text_memo_release(struct text_object *obj)
+{
+	struct text_memo *memo = obj->memo;
+
+	obj->memo = NULL;
+	if (!memo || --memo->refs > 0)
+		return;
+	text_memos.erase(memo->key);
+	delete memo;
+}
+
+void text_memo_next_frame(void)
+{
+	text_frame++;
+}
+
+bool text_memo_get_text(struct text_memo *memo, char *p, int p_max_size)
+{
+	std::lock_guard<std::mutex> lock(memo->mutex);
+
+	if (memo->text_frame != text_frame)
+		return false;
+	snprintf(p, p_max_size, "%s", memo->text.c_str());
+	return true;
+}
+
+void text_memo_set_text(struct text_memo *memo, const char *p)
+{
+	std::lock_guard<std::mutex> lock(memo->mutex);
+
+	memo->text = p;
+	memo->text_frame = text_frame;
+}
+
+bool text_memo_get_value(struct text_memo *memo, double *v)
+{
+	std::lock_guard<std::mutex> lock(memo->mutex);
+
+	if (memo->value_frame != text_frame)
+		return false;
+	*v = memo->value;
+	return true;
+}
+
+void text_memo_set_value(struct text_memo *memo, double v)
+{
+	std::lock_guard<std::mutex> lock(memo->mutex);
+
+	memo->value = v;
+	memo->value_frame = text_frame;
+}
+
+/* a chunk of fewer instructions isn't worth handing to another thread */
+#define PARALLEL_CHUNK_MIN 64
+
+/* Splits a program into chunks at the ends of lines outside ifblocks, then
+ * joins neighbouring chunks of the same kind until the parallel ones have
+ * PARALLEL_CHUNK_MIN instructions. The chunks are kept if at least two of
+ * them can run in parallel. */
+static void split_text_program(text_program &program)
+{
+	std::vector<struct text_chunk> &chunks = program.chunks;
+	size_t begin = 0, ifblock_end = 0, parallel = 0;
+	bool reentrant = true;
+
+	chunks.clear();
+	for (size_t i = 0; i < program.size(); i++) {
+		const struct text_instr &in = program[i];
+		const char *s;
+
+		if (in.obj->name && !strncmp(in.obj->name, "iconv", 5)) {
+			/* the conversion goes on from one chunk to the next */
+			chunks.clear();
+			return;
+		}
+		if (in.op == TEXT_OP_IFTEST)
+			ifblock_end = std::max(ifblock_end, (size_t) in.jump);
+		if (in.op != TEXT_OP_NOP && !is_reentrant(in.obj))
+			reentrant = false;
+
+		s = in.obj->callbacks.print == &gen_print_obj_data_s ? in.obj->data.s : NULL;
+		if (i + 1 < program.size() && (!s || !*s || s[strlen(s) - 1] != '\n' ||
+					ifblock_end > i + 1))
+			continue;
+
+		struct text_chunk *last = chunks.empty() ? NULL : &chunks.back();
+		if (last && last->parallel == reentrant &&
+				(!reentrant || last->end - last->begin < PARALLEL_CHUNK_MIN)) {
+			last->end = i + 1;
+		} else {
+			chunks.push_back({ begin, i + 1, reentrant });
+		}
+		begin = i + 1;
+		reentrant = true;
+	}
+
+	for (size_t i = 0; i < chunks.size(); i++) {
+		if (chunks[i].parallel && chunks[i].end - chunks[i].begin >= PARALLEL_CHUNK_MIN)
+			parallel++;
+	}
+	if (parallel < 2)
+		chunks.clear();
+}
+
+const text_program &get_text_program(struct text_object *root)
+{
+	std::unordered_map<struct text_object *, int> index;
+	struct text_object *obj;
+	int i;
+
+	if (root->program)
+		return *root->program;
+
+	root->program = new text_program;
+	for (obj = root->next, i = 0; obj; obj = obj->next, i++) {
+		struct text_instr in;
+
+		/* the same order of precedence the callbacks always had */
+		in.obj = obj;
+		in.jump = i + 1;
+		in.cb = obj->cb_handle ? &**obj->cb_handle : NULL;
+		if (obj->callbacks.print) {
+			in.op = TEXT_OP_PRINT;
+			in.fn.print = obj->callbacks.print;
+			if (in.fn.print == &gen_print_nothing)
+				in.op = TEXT_OP_NOP;
+		} else if (obj->callbacks.iftest) {
+			in.op = TEXT_OP_IFTEST;
+			in.fn.iftest = obj->callbacks.iftest;
+		} else if (obj->callbacks.barval) {
+			in.op = TEXT_OP_BARVAL;
+			in.fn.val = obj->callbacks.barval;
+		} else if (obj->callbacks.gaugeval) {
+			in.op = TEXT_OP_GAUGEVAL;
+			in.fn.val = obj->callbacks.gaugeval;
+#ifdef BUILD_X11
+		} else if (obj->callbacks.graphval) {
+			in.op = TEXT_OP_GRAPHVAL;
+			in.fn.val = obj->callbacks.graphval;
+#endif /* BUILD_X11 */
+		} else if (obj->callbacks.percentage) {
+			in.op = TEXT_OP_PERCENTAGE;
+			in.fn.percentage = obj->callbacks.percentage;
+		} else {
+			in.op = TEXT_OP_NOP;
+		}
+		index[obj] = i;
+		root->program->push_back(in);
+	}
+
+	/* a failed iftest continues after its ifblock_next */
+	for (i = 0; i < (int) root->program->size(); i++) {
+		struct text_instr &in = (*root->program)[i];
+		if (in.op == TEXT_OP_IFTEST && in.obj->ifblock_next &&
+				index.count(in.obj->ifblock_next))
+			in.jump = index[in.obj->ifblock_next] + 1;
+	}
+	split_text_program(*root->program);
+	return *root->program;
+}
+
+void free_text_program(struct text_object *root)
+{
+	delete root->program;
+	root->program = NULL;
+}
+
 /* ifblock handlers for the object list
  *
  * - each if points to it's else or endif
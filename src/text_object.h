@@ -33,12 +33,18 @@
 #include "config.h"		/* for the defines */
 #include "specials.h"		/* enum special_types */
 #include "update-cb.hh"
+#include <vector>
 
 /* text object callbacks */
 struct obj_cb {
 	/* text object: print obj's output to p */
 	void (*print)(struct text_object *obj, char *p, int p_max_size);
 
+	/* text object with a numeric output: return the number print shows,
+	 * before it is formatted (bytes, bytes per second, seconds, ...);
+	 * NAN when print shows nothing */
+	double (*value)(struct text_object *obj);
+
 	/* ifblock object: return zero to trigger jumping */
 	int (*iftest)(struct text_object *obj);
 
@@ -82,36 +88,123 @@ protected:
     virtual void work()
     { std::get<0>(tuple)(); }
 
+    /* the object it was registered for first, for the profiler */
+    const char *name;
+
+    /* the update functions write to info and such, it has to be waited for */
+    virtual bool can_be_late() const
+    { return false; }
+
+    /* generating text visits the callbacks of the objects it reaches, so the
+     * ones of objects in hidden ifblock branches are skipped */
+    virtual bool on_demand() const
+    { return true; }
+
 public:
-    legacy_cb(uint32_t period, int (*fn)())
-        : Base(period, true, Base::Tuple(fn))
+    legacy_cb(uint32_t period, int (*fn)(), const char *name_ = NULL)
+        : Base(period, true, Base::Tuple(fn)), name(name_)
     {}
+
+    virtual std::string describe() const
+    { return name ? std::string("for $") + name : Base::describe(); }
 };
 typedef conky::callback_handle<legacy_cb> legacy_cb_handle;
 
+/* The object list of a root, lowered into an array so generating text
+ * doesn't have to chase the list and test every callback of every object.
+ * It is built on first use and thrown away when the list changes. */
+enum text_op {
+	TEXT_OP_NOP,
+	TEXT_OP_PRINT,
+	TEXT_OP_IFTEST,
+	TEXT_OP_BARVAL,
+	TEXT_OP_GAUGEVAL,
+	TEXT_OP_GRAPHVAL,
+	TEXT_OP_PERCENTAGE
+};
+
+struct text_instr {
+	enum text_op op;
+	int jump;		/* where to go on when an iftest fails */
+	struct text_object *obj;
+	legacy_cb *cb;		/* to visit() when obj is reached, if it has one */
+	union {
+		void (*print)(struct text_object *, char *, int);
+		int (*iftest)(struct text_object *);
+		double (*val)(struct text_object *);
+		uint8_t (*percentage)(struct text_object *);
+	} fn;
+};
+
+/* A run of instructions from the start of a line to the start of another,
+ * which no ifblock crosses. Those whose objects are all reentrant (plain
+ * text and objects which only format what the update collected, without
+ * specials) can be generated in parallel with others like them. */
+struct text_chunk {
+	size_t begin, end;
+	bool parallel;
+};
+
+struct text_program: std::vector<struct text_instr> {
+	/* the whole program in order, empty if there's nothing to do in parallel */
+	std::vector<struct text_chunk> chunks;
+};
+
+/* what one of the objects sharing it printed or returned in this frame */
+struct text_memo;
+
 struct text_object {
-	struct text_object *next, *prev;	/* doubly linked list of text objects */
-	struct text_object *sub;		/* for objects parsing text into objects */
-	struct text_object *ifblock_next;	/* jump target for ifblock objects */
+	/* what the callbacks look at while generating text, at the front so
+	 * that is one cache line per object */
 	union {
 		void *opaque;		/* new style generic per object data */
 		char *s;		/* some string */
 		int i;			/* some integer */
 		long l;			/* some long integer */
 	} data;
-
+	struct text_object *sub;		/* for objects parsing text into objects */
 	void *special_data;
-	long line;
 	struct obj_cb callbacks;
-	bool parse;	//if this true then data.s should still be parsed
-	bool thread;	//if this true then data.s should be set by a seperate thread
+
+	/* only used while parsing, lowering into a program and freeing */
+	struct text_object *next, *prev;	/* doubly linked list of text objects */
+	struct text_object *ifblock_next;	/* jump target for ifblock objects */
+	const char *name;	/* of the variable, NULL for plain text */
+	long line;
 
         legacy_cb_handle *cb_handle;
+	/* shared with the objects of the same name and argument, NULL if they
+	 * don't show the same wherever they are */
+	struct text_memo *memo;
+
+	text_program *program;		/* only used in root objects */
+	bool parse;	//if this true then data.s should still be parsed
+	bool thread;	//if this true then data.s should be set by a seperate thread
 };
 
 /* text object list helpers */
 int append_object(struct text_object *root, struct text_object *obj);
 
+/* the program of a root object's list, and throwing it away */
+const text_program &get_text_program(struct text_object *root);
+void free_text_program(struct text_object *root);
+
+/* Objects which show the same wherever they are in a frame share a memo per
+ * name and argument: the first one reached in a frame fills it, the others
+ * copy from it. text_memo_attach() is for new objects, text_memo_release()
+ * for freed ones. text_memo_next_frame() throws away what the memos hold,
+ * whenever what the objects show may have changed. The get functions return
+ * false if the memo isn't filled in this frame yet. They may be called from
+ * the threads of parallel chunks, where two objects may both fill a memo
+ * with the same. */
+void text_memo_attach(struct text_object *, const char *arg);
+void text_memo_release(struct text_object *);
+void text_memo_next_frame(void);
+bool text_memo_get_text(struct text_memo *, char *p, int p_max_size);
+void text_memo_set_text(struct text_memo *, const char *p);
+bool text_memo_get_value(struct text_memo *, double *v);
+void text_memo_set_value(struct text_memo *, double v);
+
 /* ifblock helpers
  *
  * Opaque is a pointer to the address of the ifblock stack's top object.
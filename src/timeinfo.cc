@@ -40,18 +40,196 @@
 #include <errno.h>
 #include "logging.h"
 
+#include <map>
 #include <memory>
+#include <string>
 
 struct tztime_s {
 	char *tz;	/* timezone variable */
 	char *fmt;	/* time display formatting */
+
+	/* the offset and name of tz, valid until zone_expires */
+	time_t zone_expires;
+	long gmtoff;
+	int isdst;
+	char zone[16];
+
+	/* fmt needs tz in the environment, see scan_tztime() */
+	bool needs_env;
+	/* the last output, and the local second or minute (per_second) it is for */
+	bool per_second;
+	time_t cached_at;
+	char *cached;
 };
 
 conky::simple_config_setting<bool> times_in_seconds("times_in_seconds", false, false);
 
+/* the struct tm fields a strftime() conversion reads */
+enum {
+	TM_SEC = 1,
+	TM_MIN = 2,
+	TM_HOUR = 4,
+	TM_DAY = 8,
+	TM_MON = 16,
+	TM_YEAR = 32,
+	TM_ZONE = 64,
+	TM_ALL = 127,
+};
+
+static int conversion_fields(char c)
+{
+	switch (c) {
+		case 'n': case 't': case '%':
+			return 0;
+		case 'S':
+			return TM_SEC;
+		case 'M':
+			return TM_MIN;
+		case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+			return TM_HOUR;
+		case 'R':
+			return TM_HOUR | TM_MIN;
+		case 'T': case 'r':
+			return TM_HOUR | TM_MIN | TM_SEC;
+		case 'a': case 'A': case 'd': case 'e': case 'j': case 'u': case 'w':
+			return TM_DAY;
+		case 'U': case 'W': case 'V': case 'G': case 'g':
+			return TM_DAY | TM_YEAR;
+		case 'b': case 'B': case 'h': case 'm':
+			return TM_MON;
+		case 'y': case 'Y': case 'C':
+			return TM_YEAR;
+		case 'D': case 'F': case 'x':
+			return TM_DAY | TM_MON | TM_YEAR;
+		case 'z': case 'Z':
+			return TM_ZONE;
+		default:
+			return TM_ALL;
+	}
+}
+
+/* the struct tm fields a strftime() format reads */
+static int format_fields(const char *fmt)
+{
+	int fields = 0;
+
+	for (; *fmt; fmt++) {
+		if (*fmt != '%')
+			continue;
+		while (*++fmt && strchr("_-0^#123456789EO", *fmt))
+			;
+		if (!*fmt)
+			break;
+		fields |= conversion_fields(*fmt);
+	}
+	return fields;
+}
+
+static bool same_fields(const struct tm *a, const struct tm *b, int fields)
+{
+	return !((fields & TM_SEC && a->tm_sec != b->tm_sec)
+			|| (fields & TM_MIN && a->tm_min != b->tm_min)
+			|| (fields & TM_HOUR && a->tm_hour != b->tm_hour)
+			|| (fields & TM_DAY && (a->tm_mday != b->tm_mday
+					|| a->tm_wday != b->tm_wday || a->tm_yday != b->tm_yday))
+			|| (fields & TM_MON && a->tm_mon != b->tm_mon)
+			|| (fields & TM_YEAR && a->tm_year != b->tm_year)
+			|| (fields & TM_ZONE && (a->tm_isdst != b->tm_isdst
+					|| a->tm_gmtoff != b->tm_gmtoff)));
+}
+
+/* A $time or $utime format, shared by all objects using it. The text is
+ * kept until one of the fields the format reads changes. */
+struct time_format {
+	std::string fmt;
+	bool utc;
+	int fields;
+	int refs;
+	bool valid;
+	struct tm tm;
+	int size;
+	std::string text;
+};
+
+static std::map<std::pair<std::string, bool>, time_format> time_formats;
+
+/* the broken down time of this second, worked out once for all objects */
+static const struct tm *current_tm(bool utc)
+{
+	static time_t last = -1;
+	static struct tm local_tm, utc_tm;
+	time_t t = time(NULL);
+
+	if (t != last) {
+		localtime_r(&t, &local_tm);
+		gmtime_r(&t, &utc_tm);
+		last = t;
+	}
+	return utc ? &utc_tm : &local_tm;
+}
+
+static void scan_time_format(struct text_object *obj, const char *arg, bool utc)
+{
+	std::string fmt(arg ? arg : "%F %T");
+	time_format *tf;
+
+	fmt = fmt.substr(0, text_buffer_size.get(*state));
+	tf = &time_formats[std::make_pair(fmt, utc)];
+	if (!tf->refs++) {
+		tf->fmt = fmt;
+		tf->utc = utc;
+		tf->fields = format_fields(fmt.c_str());
+		tf->valid = false;
+	}
+	obj->data.opaque = tf;
+}
+
+static void print_time_format(struct text_object *obj, char *p, int p_max_size)
+{
+	time_format *tf = (time_format *) obj->data.opaque;
+	const struct tm *tm;
+
+	if (!tf)
+		return;
+
+	tm = current_tm(tf->utc);
+	if (!tf->valid || tf->size < p_max_size || !same_fields(&tf->tm, tm, tf->fields)) {
+		setlocale(LC_TIME, "");
+		strftime(p, p_max_size, tf->fmt.c_str(), tm);
+		tf->text = p;
+		tf->tm = *tm;
+		tf->size = p_max_size;
+		tf->valid = true;
+		return;
+	}
+	snprintf(p, p_max_size, "%s", tf->text.c_str());
+}
+
 void scan_time(struct text_object *obj, const char *arg)
 {
-	obj->data.opaque = strndup(arg ? arg : "%F %T", text_buffer_size.get(*state));
+	scan_time_format(obj, arg, false);
+}
+
+void scan_utime(struct text_object *obj, const char *arg)
+{
+	scan_time_format(obj, arg, true);
+}
+
+/* whether the strftime() format has one of the conversions in convs */
+static bool format_uses(const char *fmt, const char *convs)
+{
+	for (; *fmt; fmt++) {
+		if (*fmt != '%')
+			continue;
+		/* flags, width and modifiers */
+		while (*++fmt && strchr("_-0^#123456789EO", *fmt))
+			;
+		if (!*fmt)
+			break;
+		if (strchr(convs, *fmt))
+			return true;
+	}
+	return false;
 }
 
 void scan_tztime(struct text_object *obj, const char *arg)
@@ -75,59 +253,112 @@ void scan_tztime(struct text_object *obj, const char *arg)
 	memset(ts, 0, sizeof(struct tztime_s));
 	ts->fmt = strndup(fmt ? fmt : "%F %T", text_buffer_size.get(*state));
 	ts->tz = tz ? strndup(tz, text_buffer_size.get(*state)) : NULL;
+	/* %s is worked out by mktime(), which only knows the zone in TZ */
+	ts->needs_env = format_uses(ts->fmt, "s");
+	ts->per_second = format_uses(ts->fmt, "STrcsX+");
 	obj->data.opaque = ts;
 }
 
 void print_time(struct text_object *obj, char *p, int p_max_size)
 {
-	time_t t = time(NULL);
-	struct tm *tm = localtime(&t);
-
-	setlocale(LC_TIME, "");
-	strftime(p, p_max_size, (char *)obj->data.opaque, tm);
+	print_time_format(obj, p, p_max_size);
 }
 
 void print_utime(struct text_object *obj, char *p, int p_max_size)
 {
-	time_t t = time(NULL);
-	struct tm *tm = gmtime(&t);
+	print_time_format(obj, p, p_max_size);
+}
 
-	setlocale(LC_TIME, "");
-	strftime(p, p_max_size, (char *)obj->data.opaque, tm);
+/* run f with TZ set to tz, putting the previous TZ back afterwards */
+template<typename F>
+static void with_tz(const char *tz, F f)
+{
+	const char *oldTZ = getenv("TZ");
+	std::string saved(oldTZ ? oldTZ : "");
+
+	setenv("TZ", tz, 1);
+	tzset();
+	f();
+	if (oldTZ) {
+		setenv("TZ", saved.c_str(), 1);
+	} else {
+		unsetenv("TZ");
+	}
+	tzset();
+}
+
+/* Look up the offset of ts->tz at t. Zones only change their offset on a
+ * quarter of an hour, so it holds until the next one and the zoneinfo file
+ * is read a few times an hour instead of every frame. */
+static void tztime_zone(struct tztime_s *ts, time_t t)
+{
+	if (t < ts->zone_expires)
+		return;
+
+	with_tz(ts->tz, [ts, t] {
+		struct tm tm;
+
+		localtime_r(&t, &tm);
+		ts->gmtoff = tm.tm_gmtoff;
+		ts->isdst = tm.tm_isdst;
+		snprintf(ts->zone, sizeof ts->zone, "%s", tm.tm_zone ? tm.tm_zone : "");
+	});
+	ts->zone_expires = t - t % 900 + 900;
 }
 
 void print_tztime(struct text_object *obj, char *p, int p_max_size)
 {
-	char *oldTZ = NULL;
-	time_t t;
-	struct tm *tm;
+	time_t t, key;
+	struct tm tm;
 	struct tztime_s *ts = (tztime_s*) obj->data.opaque;
 
 	if (!ts)
 		return;
 
+	t = time(NULL);
 	if (ts->tz) {
-		oldTZ = getenv("TZ");
-		setenv("TZ", ts->tz, 1);
-		tzset();
+		time_t local;
+
+		tztime_zone(ts, t);
+		local = t + ts->gmtoff;
+		gmtime_r(&local, &tm);
+		tm.tm_gmtoff = ts->gmtoff;
+		tm.tm_isdst = ts->isdst;
+		tm.tm_zone = ts->zone;
+	} else {
+		localtime_r(&t, &tm);
+	}
+
+	/* the output only changes every second, or minute */
+	key = (t + tm.tm_gmtoff) / (ts->per_second ? 1 : 60);
+	if (ts->cached && key == ts->cached_at) {
+		snprintf(p, p_max_size, "%s", ts->cached);
+		return;
 	}
-	t = time(NULL);
-	tm = localtime(&t);
 
 	setlocale(LC_TIME, "");
-	strftime(p, p_max_size, ts->fmt, tm);
-	if (oldTZ) {
-		setenv("TZ", oldTZ, 1);
-		tzset();
+	if (ts->tz && ts->needs_env) {
+		with_tz(ts->tz, [&] {
+			localtime_r(&t, &tm);
+			strftime(p, p_max_size, ts->fmt, &tm);
+		});
 	} else {
-		unsetenv("TZ");
+		strftime(p, p_max_size, ts->fmt, &tm);
 	}
-	// Needless to free oldTZ since getenv gives ptr to static data
+	free(ts->cached);
+	ts->cached = strdup(p);
+	ts->cached_at = key;
 }
 
 void free_time(struct text_object *obj)
 {
-	free_and_zero(obj->data.opaque);
+	time_format *tf = (time_format *) obj->data.opaque;
+
+	if (!tf)
+		return;
+	if (!--tf->refs)
+		time_formats.erase(std::make_pair(tf->fmt, tf->utc));
+	obj->data.opaque = NULL;
 }
 
 void free_tztime(struct text_object *obj)
@@ -139,6 +370,7 @@ void free_tztime(struct text_object *obj)
 
 	free_and_zero(ts->tz);
 	free_and_zero(ts->fmt);
+	free_and_zero(ts->cached);
 
 	free_and_zero(obj->data.opaque);
 }
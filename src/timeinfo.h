@@ -39,6 +39,7 @@ extern conky::simple_config_setting<bool> times_in_seconds;
 
 /* parse args passed to *time objects */
 void scan_time(struct text_object *, const char *);
+void scan_utime(struct text_object *, const char *);
 void scan_tztime(struct text_object *, const char *);
 
 /* print the time */
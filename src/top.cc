@@ -29,79 +29,167 @@
  *
  */
 
-#include "prioqueue.h"
 #include "top.h"
 #include "logging.h"
-
-/* hash table size - always a power of 2 */
+#include "user.h"
+#include "data-source.hh"
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/* initial size of the pid hash table - always a power of 2 */
 #define HTABSIZE 256
 
+/* number of processes allocated at once */
+#define PROCESS_CHUNK 256
+
 struct process *first_process = 0;
 
+/* the processes by name, for get_process_by_name(); names are set by the
+ * threads parsing the processes, hence the mutex */
+static std::unordered_multimap<std::string, struct process *> process_names;
+static std::mutex process_names_mutex;
+
 unsigned long g_time = 0;
 
-/* a simple hash table to speed up find_process() */
-struct proc_hash_entry {
-	struct proc_hash_entry *next;
-	struct process *proc;
+/* What the processes of a user, or those with a name, add up to, for
+ * top_group. The processes add the change of their cpu and memory to their
+ * groups as they are ranked, and take what they added back out when they
+ * go, so the groups are kept without another pass over the processes. The
+ * entries stay where they are in the maps, the processes point at them. */
+struct process_group {
+	/* the user's name, or that of the processes */
+	std::string name;
+	uid_t uid;
+	double amount;
+	unsigned long long rss;
+	unsigned int count;
 };
-static struct proc_hash_entry proc_hash_table[HTABSIZE];
 
-static void hash_process(struct process *p)
+static std::unordered_map<uid_t, struct process_group> user_groups;
+static std::unordered_map<std::string, struct process_group> name_groups;
+
+/* the rankings of top_group */
+enum group_rank { GROUP_USER_CPU, GROUP_USER_MEM, GROUP_NAME_CPU, GROUP_NAME_MEM,
+	GROUP_RANKS };
+
+static struct process_group **group_lists[GROUP_RANKS];
+/* how deep the objects show each ranking, 0 if they don't */
+static int group_depth[GROUP_RANKS];
+
+/* Processes are allocated in chunks, which are only released by
+ * free_all_processes(). Deleted processes are kept in a free list (linked by
+ * their next pointer) for reuse, so the process list mostly stays within a
+ * few contiguous blocks of memory. */
+struct process_chunk {
+	struct process_chunk *next;
+	struct process procs[PROCESS_CHUNK];
+};
+static struct process_chunk *process_chunks = NULL;
+static struct process *free_processes = NULL;
+
+static struct process *alloc_process(void)
 {
-	struct proc_hash_entry *phe;
-	static char first_run = 1;
-	int bucket;
+	struct process *p;
+
+	if (!free_processes) {
+		struct process_chunk *chunk =
+			(struct process_chunk *) malloc(sizeof(struct process_chunk));
 
-	/* better make sure all next pointers are zero upon first access */
-	if (first_run) {
-		memset(proc_hash_table, 0, sizeof(struct proc_hash_entry) * HTABSIZE);
-		first_run = 0;
+		chunk->next = process_chunks;
+		process_chunks = chunk;
+		for (int i = PROCESS_CHUNK - 1; i >= 0; i--) {
+			chunk->procs[i].next = free_processes;
+			free_processes = &chunk->procs[i];
+		}
 	}
 
-	/* get the bucket index */
-	bucket = p->pid & (HTABSIZE - 1);
+	p = free_processes;
+	free_processes = p->next;
+	return p;
+}
+
+static void release_process(struct process *p)
+{
+	p->next = free_processes;
+	free_processes = p;
+}
+
+/* An open addressing hash table (with linear probing) to speed up
+ * find_process(). It is kept at most half full. */
+static struct process **proc_hash_table = NULL;
+static size_t proc_hash_size = 0;
+static size_t proc_hash_used = 0;
 
-	/* insert a new element on bucket's top */
-	phe = (struct proc_hash_entry *)malloc(sizeof(struct proc_hash_entry));
-	phe->proc = p;
-	phe->next = proc_hash_table[bucket].next;
-	proc_hash_table[bucket].next = phe;
+static inline size_t proc_hash_slot(pid_t pid)
+{
+	/* pids are mostly sequential, spread them over the table */
+	return ((size_t) pid * 2654435761u) & (proc_hash_size - 1);
 }
 
-static void unhash_process(struct process *p)
+static void hash_insert(struct process *p)
 {
-	struct proc_hash_entry *phe, *tmp;
+	size_t i = proc_hash_slot(p->pid);
 
-	/* get the bucket head */
-	phe = &proc_hash_table[p->pid & (HTABSIZE - 1)];
-	/* find the entry pointing to p and drop it */
-	while (phe->next) {
-		if (phe->next->proc == p) {
-			tmp = phe->next;
-			phe->next = phe->next->next;
-			free(tmp);
-			return;
+	while (proc_hash_table[i])
+		i = (i + 1) & (proc_hash_size - 1);
+	proc_hash_table[i] = p;
+}
+
+static void hash_process(struct process *p)
+{
+	if ((proc_hash_used + 1) * 2 > proc_hash_size) {
+		struct process **old = proc_hash_table;
+		size_t old_size = proc_hash_size;
+
+		proc_hash_size = old_size ? old_size * 2 : HTABSIZE;
+		proc_hash_table =
+			(struct process **) calloc(proc_hash_size, sizeof(struct process *));
+		for (size_t i = 0; i < old_size; i++) {
+			if (old[i])
+				hash_insert(old[i]);
 		}
-		phe = phe->next;
+		free(old);
 	}
+
+	hash_insert(p);
+	++proc_hash_used;
 }
 
-static void __unhash_all_processes(struct proc_hash_entry *phe)
+static void unhash_process(struct process *p)
 {
-	if (phe->next)
-		__unhash_all_processes(phe->next);
-	free(phe->next);
+	size_t mask = proc_hash_size - 1;
+	size_t i, j;
+
+	if (!proc_hash_table)
+		return;
+
+	/* find the slot holding p */
+	for (i = proc_hash_slot(p->pid); proc_hash_table[i] != p; i = (i + 1) & mask) {
+		if (!proc_hash_table[i])
+			return;
+	}
+
+	/* move back entries which would not be found with the gap in their way */
+	for (j = (i + 1) & mask; proc_hash_table[j]; j = (j + 1) & mask) {
+		size_t k = proc_hash_slot(proc_hash_table[j]->pid);
+
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			proc_hash_table[i] = proc_hash_table[j];
+			i = j;
+		}
+	}
+	proc_hash_table[i] = NULL;
+	--proc_hash_used;
 }
 
 static void unhash_all_processes(void)
 {
-	int i;
-
-	for (i = 0; i < HTABSIZE; i++) {
-		__unhash_all_processes(&proc_hash_table[i]);
-		proc_hash_table[i].next = NULL;
-	}
+	free_and_zero(proc_hash_table);
+	proc_hash_size = 0;
+	proc_hash_used = 0;
 }
 
 struct process *get_first_process(void)
@@ -115,44 +203,75 @@ void free_all_processes(void)
 
 	while (pr) {
 		next = pr->next;
+#ifdef __linux__
+		process_close_files(pr);
+#endif /* __linux__ */
 		free_and_zero(pr->name);
-		free(pr);
 		pr = next;
 	}
 	first_process = NULL;
+	process_names.clear();
+	user_groups.clear();
+	name_groups.clear();
+
+	while (process_chunks) {
+		struct process_chunk *next_chunk = process_chunks->next;
+		free(process_chunks);
+		process_chunks = next_chunk;
+	}
+	free_processes = NULL;
 
 	/* drop the whole hash table */
 	unhash_all_processes();
 }
 
+/* give a process a name allocated by the caller (or none), keeping the index
+ * get_process_by_name() looks in */
+void process_set_name(struct process *p, char *name)
+{
+	std::lock_guard<std::mutex> lock(process_names_mutex);
+
+	if (p->name) {
+		auto range = process_names.equal_range(p->name);
+		for (auto i = range.first; i != range.second; ++i) {
+			if (i->second == p) {
+				process_names.erase(i);
+				break;
+			}
+		}
+		free(p->name);
+	}
+	p->name = name;
+	if (name)
+		process_names.emplace(name, p);
+}
+
+/* On Linux, names are only derived from the cmdline when asked for; with
+ * top_running set, they are for every process as it is parsed. */
 struct process *get_process_by_name(const char *name)
 {
-	struct process *p = first_process;
+	std::lock_guard<std::mutex> lock(process_names_mutex);
+	auto i = process_names.find(name);
 
-	while (p) {
-		if (p->name && !strcmp(p->name, name))
-			return p;
-		p = p->next;
-	}
-	return 0;
+	return i != process_names.end() ? i->second : 0;
 }
 
 static struct process *find_process(pid_t pid)
 {
-	struct proc_hash_entry *phe;
+	if (!proc_hash_table)
+		return NULL;
 
-	phe = &proc_hash_table[pid & (HTABSIZE - 1)];
-	while (phe->next) {
-		if (phe->next->proc->pid == pid)
-			return phe->next->proc;
-		phe = phe->next;
+	for (size_t i = proc_hash_slot(pid); proc_hash_table[i];
+			i = (i + 1) & (proc_hash_size - 1)) {
+		if (proc_hash_table[i]->pid == pid)
+			return proc_hash_table[i];
 	}
 	return NULL;
 }
 
 static struct process *new_process(pid_t pid)
 {
-	struct process *p = (struct process *) malloc(sizeof(struct process));
+	struct process *p = alloc_process();
 
 	/* Do stitching necessary for doubly linked list */
 	p->previous = NULL;
@@ -179,10 +298,26 @@ static struct process *new_process(pid_t pid)
 	p->write_bytes = 0;
 	p->previous_write_bytes = ULLONG_MAX;
 	p->io_perc = 0;
+	p->io_ranked = 0;
 #endif /* BUILD_IOSTATS */
+#ifdef BUILD_BPF
+	p->net_tx = 0;
+	p->net_rx = 0;
+#endif /* BUILD_BPF */
 	p->time_stamp = 0;
 	p->counted = 1;
 	p->changed = 0;
+	p->user_group = 0;
+	p->name_group = 0;
+	p->group_amount = 0;
+	p->group_rss = 0;
+#ifdef __linux__
+	p->stat_fd = -1;
+	p->comm = 0;
+	p->starttime = 0;
+	p->lru_next = 0;
+	p->lru_previous = 0;
+#endif /* __linux__ */
 
 	/* process_find_name(p); */
 
@@ -199,10 +334,119 @@ struct process *get_process(pid_t pid)
 	return p ? p : new_process(pid);
 }
 
+void top_update_processes(const std::vector<struct process_sample> &samples)
+{
+	static double last_update = 0;
+	/* in hundredths of seconds, like total_cpu_time */
+	double elapsed = (current_update_time - last_update) * 100;
+
+	for (const struct process_sample &s : samples) {
+		struct process *p = get_process(s.pid);
+
+		p->time_stamp = g_time;
+		if (!p->name || strcmp(p->name, s.name))
+			process_set_name(p, strndup(s.name, text_buffer_size.get(*state)));
+		p->uid = s.uid;
+		p->vsize = s.vsize;
+		p->rss = s.rss;
+		if (s.cpu_perc >= 0) {
+			p->amount = s.cpu_perc;
+		} else if (p->previous_user_time != ULONG_MAX && elapsed > 0 &&
+				s.total_cpu_time >= p->previous_user_time) {
+			p->amount = 100.0 * (s.total_cpu_time - p->previous_user_time) / elapsed;
+		} else {
+			p->amount = 0;
+		}
+		/* the last total_cpu_time, there's no user/kernel split here */
+		p->previous_user_time = s.total_cpu_time;
+		p->total_cpu_time = s.total_cpu_time;
+	}
+	last_update = current_update_time;
+}
+
 /******************************************
  * Functions							  *
  ******************************************/
 
+/* The name processes are grouped by: on linux the command from stat, which
+ * every process has, not the one from the cmdline, which is only read for
+ * those shown */
+static const char *process_group_name(struct process *p)
+{
+#ifdef __linux__
+	const char *name = p->comm;
+#else /* __linux__ */
+	const char *name = p->name;
+#endif /* __linux__ */
+
+	return name ? name : "";
+}
+
+/* take what the process added to its groups back out of them */
+static void process_group_leave(struct process *p)
+{
+	struct process_group *g;
+
+	if ((g = p->user_group)) {
+		g->amount -= p->group_amount;
+		g->rss -= p->group_rss;
+		if (--g->count == 0) {
+			/* the key must not go with the entry while erase() looks at it */
+			uid_t uid = g->uid;
+			user_groups.erase(uid);
+		}
+	}
+	if ((g = p->name_group)) {
+		g->amount -= p->group_amount;
+		g->rss -= p->group_rss;
+		if (--g->count == 0) {
+			std::string name = g->name;
+			name_groups.erase(name);
+		}
+	}
+	p->user_group = 0;
+	p->name_group = 0;
+	p->group_amount = 0;
+	p->group_rss = 0;
+}
+
+/* add what changed since the last update to the groups of the process,
+ * moving it if it changed its user or name (setuid(), exec()) */
+static void process_group_update(struct process *p)
+{
+	const char *name = process_group_name(p);
+
+	if (p->user_group && (p->user_group->uid != p->uid || p->name_group->name != name))
+		process_group_leave(p);
+	if (!p->user_group) {
+		struct process_group &u = user_groups[p->uid];
+		struct process_group &n = name_groups[name];
+
+		if (u.count++ == 0) {
+			const char *user = get_user_name(p->uid);
+
+			u.uid = p->uid;
+			u.name = user ? user : std::to_string(p->uid);
+			u.amount = 0;
+			u.rss = 0;
+		}
+		if (n.count++ == 0) {
+			n.name = name;
+			n.uid = p->uid;
+			n.amount = 0;
+			n.rss = 0;
+		}
+		p->user_group = &u;
+		p->name_group = &n;
+	}
+	p->user_group->amount += p->amount - p->group_amount;
+	p->user_group->rss += p->rss - p->group_rss;
+	p->name_group->amount += p->amount - p->group_amount;
+	p->name_group->rss += p->rss - p->group_rss;
+	p->group_amount = p->amount;
+	p->group_rss = p->rss;
+}
+
 /******************************************
  * Destroy and remove a process           *
  ******************************************/
@@ -228,10 +472,14 @@ static void delete_process(struct process *p)
 	else
 		first_process = p->next;
 
-	free_and_zero(p->name);
+#ifdef __linux__
+	process_close_files(p);
+#endif /* __linux__ */
+	process_set_name(p, NULL);
+	process_group_leave(p);
 	/* remove the process from the hash table */
 	unhash_process(p);
-	free(p);
+	release_process(p);
 }
 
 /******************************************
@@ -262,11 +510,9 @@ static void process_cleanup(void)
  * Find the top processes				  *
  ******************************************/
 
-/* cpu comparison function for prio queue */
-static int compare_cpu(void *va, void *vb)
+/* cpu comparison function for the top lists */
+static int compare_cpu(struct process *a, struct process *b)
 {
-	struct process *a = (struct process *)va, *b = (struct process *)vb;
-
 	if (b->amount > a->amount) {
 		return 1;
 	} else if (a->amount > b->amount) {
@@ -276,11 +522,9 @@ static int compare_cpu(void *va, void *vb)
 	}
 }
 
-/* mem comparison function for prio queue */
-static int compare_mem(void *va, void *vb)
+/* mem comparison function for the top lists */
+static int compare_mem(struct process *a, struct process *b)
 {
-	struct process *a = (struct process *)va, *b = (struct process *)vb;
-
 	if (b->rss > a->rss) {
 		return 1;
 	} else if (a->rss > b->rss) {
@@ -290,11 +534,9 @@ static int compare_mem(void *va, void *vb)
 	}
 }
 
-/* CPU time comparision function for prio queue */
-static int compare_time(void *va, void *vb)
+/* CPU time comparision function for the top lists */
+static int compare_time(struct process *a, struct process *b)
 {
-	struct process *a = (struct process *)va, *b = (struct process *)vb;
-
 	if (b->total_cpu_time > a->total_cpu_time) {
 		return 1;
 	} else if (b->total_cpu_time < a->total_cpu_time) {
@@ -305,11 +547,9 @@ static int compare_time(void *va, void *vb)
 }
 
 #ifdef BUILD_IOSTATS
-/* I/O comparision function for prio queue */
-static int compare_io(void *va, void *vb)
+/* I/O comparision function for the top lists */
+static int compare_io(struct process *a, struct process *b)
 {
-	struct process *a = (struct process *)va, *b = (struct process *)vb;
-
 	if (b->io_perc > a->io_perc) {
 		return 1;
 	} else if (a->io_perc > b->io_perc) {
@@ -320,9 +560,61 @@ static int compare_io(void *va, void *vb)
 }
 #endif /* BUILD_IOSTATS */
 
+/* comparison functions for the top_group lists */
+static int compare_group_cpu(struct process_group *a, struct process_group *b)
+{
+	if (b->amount > a->amount) {
+		return 1;
+	} else if (a->amount > b->amount) {
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+static int compare_group_mem(struct process_group *a, struct process_group *b)
+{
+	if (b->rss > a->rss) {
+		return 1;
+	} else if (a->rss > b->rss) {
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+/* rank the groups as deep as the top_group objects show them */
+static void process_find_top_groups(void)
+{
+	struct top_list<struct process_group> lists[GROUP_RANKS];
+
+	for (int i = 0; i < GROUP_RANKS; i++) {
+		bool mem = i == GROUP_USER_MEM || i == GROUP_NAME_MEM;
+
+		lists[i] = { mem ? &compare_group_mem : &compare_group_cpu, group_lists[i], 0,
+			group_depth[i] };
+	}
+	for (auto i = user_groups.begin(); i != user_groups.end(); ++i) {
+		for (int r = GROUP_USER_CPU; r <= GROUP_USER_MEM; r++) {
+			if (lists[r].max)
+				top_list_insert(&lists[r], &i->second);
+		}
+	}
+	for (auto i = name_groups.begin(); i != name_groups.end(); ++i) {
+		for (int r = GROUP_NAME_CPU; r <= GROUP_NAME_MEM; r++) {
+			if (lists[r].max)
+				top_list_insert(&lists[r], &i->second);
+		}
+	}
+	for (int i = 0; i < GROUP_RANKS; i++) {
+		for (int j = lists[i].count; j < top_list_size; j++)
+			lists[i].procs[j] = NULL;
+	}
+}
+
 /* ****************************************************************** *
  * Get a sorted list of the top cpu hogs and top mem hogs.			  *
- * Results are stored in the cpu,mem arrays in decreasing order[0-9]. *
+ * Results are stored in the cpu,mem arrays in decreasing order.	  *
  * ****************************************************************** */
 
 static void process_find_top(struct process **cpu, struct process **mem,
@@ -332,39 +624,36 @@ static void process_find_top(struct process **cpu, struct process **mem,
 #endif /* BUILD_IOSTATS */
 		)
 {
-	prio_queue_t cpu_queue, mem_queue, time_queue;
-#ifdef BUILD_IOSTATS
-	prio_queue_t io_queue;
-#endif
+	struct top_list<struct process> lists[4];
+	int n = 0;
 	struct process *cur_proc = NULL;
-	int i;
+#ifdef BUILD_IOSTATS
+	int io_list = -1;
+#endif /* BUILD_IOSTATS */
 
 	if (!top_cpu && !top_mem && !top_time
 #ifdef BUILD_IOSTATS
 			&& !top_io
 #endif /* BUILD_IOSTATS */
-			&& !top_running
+			&& !top_running && !top_group
 	   ) {
 		return;
 	}
 
-	cpu_queue = init_prio_queue();
-	pq_set_compare(cpu_queue, &compare_cpu);
-	pq_set_max_size(cpu_queue, MAX_SP);
-
-	mem_queue = init_prio_queue();
-	pq_set_compare(mem_queue, &compare_mem);
-	pq_set_max_size(mem_queue, MAX_SP);
-
-	time_queue = init_prio_queue();
-	pq_set_compare(time_queue, &compare_time);
-	pq_set_max_size(time_queue, MAX_SP);
-
+	/* the lists are filled in place, as deep as the objects show them, the
+	 * entries past that are set to NULL below */
+	if (top_cpu)
+		lists[n++] = { &compare_cpu, cpu, 0, top_cpu };
+	if (top_mem)
+		lists[n++] = { &compare_mem, mem, 0, top_mem };
+	if (top_time)
+		lists[n++] = { &compare_time, ptime, 0, top_time };
 #ifdef BUILD_IOSTATS
-	io_queue = init_prio_queue();
-	pq_set_compare(io_queue, &compare_io);
-	pq_set_max_size(io_queue, MAX_SP);
-#endif
+	if (top_io) {
+		io_list = n;
+		lists[n++] = { &compare_io, io, 0, top_io };
+	}
+#endif /* BUILD_IOSTATS */
 
 	/* g_time is the time_stamp entry for process.  It is updated when the
 	 * process information is updated to indicate that the process is still
@@ -377,51 +666,35 @@ static void process_find_top(struct process **cpu, struct process **mem,
 
 	process_cleanup();			/* cleanup list from exited processes */
 
-	cur_proc = first_process;
-
-	while (cur_proc != NULL) {
-		if (top_cpu) {
-			insert_prio_elem(cpu_queue, cur_proc);
-		}
-		if (top_mem) {
-			insert_prio_elem(mem_queue, cur_proc);
-		}
-		if (top_time) {
-			insert_prio_elem(time_queue, cur_proc);
-		}
-#ifdef BUILD_IOSTATS
-		if (top_io) {
-			insert_prio_elem(io_queue, cur_proc);
-		}
-#endif /* BUILD_IOSTATS */
-		cur_proc = cur_proc->next;
+	/* one pass over the processes for all the lists, and the groups */
+	for (cur_proc = first_process; cur_proc; cur_proc = cur_proc->next) {
+		for (int i = 0; i < n; i++)
+			top_list_insert(&lists[i], cur_proc);
+		if (top_group)
+			process_group_update(cur_proc);
 	}
-
-	for (i = 0; i < MAX_SP; i++) {
-		if (top_cpu)
-			cpu[i] = (process*)pop_prio_elem(cpu_queue);
-		if (top_mem)
-			mem[i] = (process*)pop_prio_elem(mem_queue);
-		if (top_time)
-			ptime[i] = (process*)pop_prio_elem(time_queue);
-#ifdef BUILD_IOSTATS
-		if (top_io)
-			io[i] = (process*)pop_prio_elem(io_queue);
-#endif /* BUILD_IOSTATS */
+	if (top_group)
+		process_find_top_groups();
+
+	for (int i = 0; i < n; i++) {
+#ifdef __linux__
+		/* only the processes which get shown need a name */
+		for (int j = 0; j < lists[i].count; j++)
+			process_resolve_name(lists[i].procs[j]);
+#endif /* __linux__ */
+		for (int j = lists[i].count; j < top_list_size; j++)
+			lists[i].procs[j] = NULL;
 	}
-	free_prio_queue(cpu_queue);
-	free_prio_queue(mem_queue);
-	free_prio_queue(time_queue);
 #ifdef BUILD_IOSTATS
-	free_prio_queue(io_queue);
+	if (io_list >= 0) {
+		for (int j = 0; j < lists[io_list].count; j++)
+			lists[io_list].procs[j]->io_ranked = g_time;
+	}
 #endif /* BUILD_IOSTATS */
 }
 
 int update_top(void)
 {
-	// XXX: this was a separate callback. and it should be again, as soon as it's possible
-	update_meminfo();
-
 	process_find_top(info.cpu, info.memu, info.time
 #ifdef BUILD_IOSTATS
 					 , info.io
@@ -523,11 +796,16 @@ static void print_top_time(struct text_object *obj, char *p, int p_max_size)
 static void print_top_user(struct text_object *obj, char *p, int p_max_size)
 {
 	struct top_data *td = (struct top_data *)obj->data.opaque;
+	const char *name;
 
 	if (!td || !td->list || !td->list[td->num])
 		return;
 
-	snprintf(p, p_max_size, "%.8s", getpwuid(td->list[td->num]->uid)->pw_name);
+	name = get_user_name(td->list[td->num]->uid);
+	if (name)
+		snprintf(p, p_max_size, "%.8s", name);
+	else
+		snprintf(p, p_max_size, "%d", td->list[td->num]->uid);
 }
 
 #define PRINT_TOP_GENERATOR(name, width, fmt, field) \
@@ -558,6 +836,38 @@ PRINT_TOP_HR_GENERATOR(read_bytes, read_bytes, active_update_interval())
 PRINT_TOP_HR_GENERATOR(write_bytes, write_bytes, active_update_interval())
 PRINT_TOP_GENERATOR(io_perc, 7, "%6.2f", io_perc)
 #endif /* BUILD_IOSTATS */
+#ifdef BUILD_BPF
+PRINT_TOP_HR_GENERATOR(net_tx, net_tx, active_update_interval())
+PRINT_TOP_HR_GENERATOR(net_rx, net_rx, active_update_interval())
+#endif /* BUILD_BPF */
+
+/* the numbers the print_top_* functions show */
+#define TOP_VALUE_GENERATOR(name, expr) \
+static double top_##name##_value(struct text_object *obj) \
+{ \
+	struct top_data *td = (struct top_data *)obj->data.opaque; \
+	struct process *proc; \
+	if (!td || !td->list || !(proc = td->list[td->num])) \
+		return NAN; \
+	return (expr); \
+}
+
+TOP_VALUE_GENERATOR(cpu, proc->amount)
+TOP_VALUE_GENERATOR(pid, proc->pid)
+TOP_VALUE_GENERATOR(uid, proc->uid)
+TOP_VALUE_GENERATOR(mem, ((float)proc->rss / info.memmax) / 10)
+TOP_VALUE_GENERATOR(time, proc->total_cpu_time / 100.)
+TOP_VALUE_GENERATOR(mem_res, proc->rss)
+TOP_VALUE_GENERATOR(mem_vsize, proc->vsize)
+#ifdef BUILD_IOSTATS
+TOP_VALUE_GENERATOR(read_bytes, proc->read_bytes / active_update_interval())
+TOP_VALUE_GENERATOR(write_bytes, proc->write_bytes / active_update_interval())
+TOP_VALUE_GENERATOR(io_perc, proc->io_perc)
+#endif /* BUILD_IOSTATS */
+#ifdef BUILD_BPF
+TOP_VALUE_GENERATOR(net_tx, proc->net_tx / active_update_interval())
+TOP_VALUE_GENERATOR(net_rx, proc->net_rx / active_update_interval())
+#endif /* BUILD_BPF */
 
 static void free_top(struct text_object *obj)
 {
@@ -569,33 +879,74 @@ static void free_top(struct text_object *obj)
 	free_and_zero(obj->data.opaque);
 }
 
+static conky::range_config_setting<unsigned int> top_max_entries("top_max_entries", 1,
+										1000, MAX_SP, false);
+
+int top_list_size;
+
+/* The lists are as long as top_max_entries, but only sorted as deep as the
+ * objects show them (top_cpu etc.). */
+static void alloc_top_lists(void)
+{
+	if (top_list_size)
+		return;
+	top_list_size = top_max_entries.get(*state);
+	info.cpu = (struct process **) calloc(top_list_size, sizeof(struct process *));
+	info.memu = (struct process **) calloc(top_list_size, sizeof(struct process *));
+	info.time = (struct process **) calloc(top_list_size, sizeof(struct process *));
+#ifdef BUILD_IOSTATS
+	info.io = (struct process **) calloc(top_list_size, sizeof(struct process *));
+#endif /* BUILD_IOSTATS */
+	for (int i = 0; i < GROUP_RANKS; i++) {
+		group_lists[i] = (struct process_group **) calloc(top_list_size,
+				sizeof(struct process_group *));
+	}
+}
+
+void free_top_lists(void)
+{
+	free_and_zero(info.cpu);
+	free_and_zero(info.memu);
+	free_and_zero(info.time);
+#ifdef BUILD_IOSTATS
+	free_and_zero(info.io);
+#endif /* BUILD_IOSTATS */
+	for (int i = 0; i < GROUP_RANKS; i++) {
+		free_and_zero(group_lists[i]);
+		group_depth[i] = 0;
+	}
+	top_list_size = 0;
+}
+
 int parse_top_args(const char *s, const char *arg, struct text_object *obj)
 {
 	struct top_data *td;
 	char buf[64];
 	int n;
+	int *depth;
 
 	if (!arg) {
 		NORM_ERR("top needs arguments");
 		return 0;
 	}
 
+	alloc_top_lists();
 	obj->data.opaque = td = (struct top_data *)malloc(sizeof(struct top_data));
 	memset(td, 0, sizeof(struct top_data));
 
 	if (s[3] == 0) {
 		td->list = info.cpu;
-		top_cpu = 1;
+		depth = &top_cpu;
 	} else if (strcmp(&s[3], "_mem") == EQUAL) {
 		td->list = info.memu;
-		top_mem = 1;
+		depth = &top_mem;
 	} else if (strcmp(&s[3], "_time") == EQUAL) {
 		td->list = info.time;
-		top_time = 1;
+		depth = &top_time;
 #ifdef BUILD_IOSTATS
 	} else if (strcmp(&s[3], "_io") == EQUAL) {
 		td->list = info.io;
-		top_io = 1;
+		depth = &top_io;
 #endif /* BUILD_IOSTATS */
 	} else {
 #ifdef BUILD_IOSTATS
@@ -614,28 +965,46 @@ int parse_top_args(const char *s, const char *arg, struct text_object *obj)
 			obj->callbacks.print = &print_top_name;
 		} else if (strcmp(buf, "cpu") == EQUAL) {
 			obj->callbacks.print = &print_top_cpu;
+			obj->callbacks.value = &top_cpu_value;
 		} else if (strcmp(buf, "pid") == EQUAL) {
 			obj->callbacks.print = &print_top_pid;
+			obj->callbacks.value = &top_pid_value;
 		} else if (strcmp(buf, "mem") == EQUAL) {
 			obj->callbacks.print = &print_top_mem;
+			obj->callbacks.value = &top_mem_value;
 		} else if (strcmp(buf, "time") == EQUAL) {
 			obj->callbacks.print = &print_top_time;
+			obj->callbacks.value = &top_time_value;
 		} else if (strcmp(buf, "mem_res") == EQUAL) {
 			obj->callbacks.print = &print_top_mem_res;
+			obj->callbacks.value = &top_mem_res_value;
 		} else if (strcmp(buf, "mem_vsize") == EQUAL) {
 			obj->callbacks.print = &print_top_mem_vsize;
+			obj->callbacks.value = &top_mem_vsize_value;
 		} else if (strcmp(buf, "uid") == EQUAL) {
 			obj->callbacks.print = &print_top_uid;
+			obj->callbacks.value = &top_uid_value;
 		} else if (strcmp(buf, "user") == EQUAL) {
 			obj->callbacks.print = &print_top_user;
 #ifdef BUILD_IOSTATS
 		} else if (strcmp(buf, "io_read") == EQUAL) {
 			obj->callbacks.print = &print_top_read_bytes;
+			obj->callbacks.value = &top_read_bytes_value;
 		} else if (strcmp(buf, "io_write") == EQUAL) {
 			obj->callbacks.print = &print_top_write_bytes;
+			obj->callbacks.value = &top_write_bytes_value;
 		} else if (strcmp(buf, "io_perc") == EQUAL) {
 			obj->callbacks.print = &print_top_io_perc;
+			obj->callbacks.value = &top_io_perc_value;
 #endif /* BUILD_IOSTATS */
+#ifdef BUILD_BPF
+		} else if (strcmp(buf, "net_tx") == EQUAL) {
+			obj->callbacks.print = &print_top_net_tx;
+			obj->callbacks.value = &top_net_tx_value;
+		} else if (strcmp(buf, "net_rx") == EQUAL) {
+			obj->callbacks.print = &print_top_net_rx;
+			obj->callbacks.value = &top_net_rx_value;
+#endif /* BUILD_BPF */
 		} else {
 			NORM_ERR("invalid type arg for top");
 #ifdef BUILD_IOSTATS
@@ -648,13 +1017,15 @@ int parse_top_args(const char *s, const char *arg, struct text_object *obj)
 			free_and_zero(obj->data.opaque);
 			return 0;
 		}
-		if (n < 1 || n > 10) {
-			NORM_ERR("invalid num arg for top. Must be between 1 and 10.");
+		if (n < 1 || n > top_list_size) {
+			NORM_ERR("invalid num arg for top. Must be between 1 and %d "
+					"(top_max_entries).", top_list_size);
 			free_and_zero(td->s);
 			free_and_zero(obj->data.opaque);
 			return 0;
 		} else {
 			td->num = n - 1;
+			*depth = std::max(*depth, n);
 		}
 	} else {
 		NORM_ERR("invalid argument count for top");
@@ -665,3 +1036,157 @@ int parse_top_args(const char *s, const char *arg, struct text_object *obj)
 	obj->callbacks.free = &free_top;
 	return 1;
 }
+
+struct top_group_data {
+	enum group_rank rank;
+	int num;
+};
+
+/* the group a top_group object shows, NULL if there is none */
+static struct process_group *get_top_group(struct text_object *obj)
+{
+	struct top_group_data *tg = (struct top_group_data *) obj->data.opaque;
+
+	if (!tg || !group_lists[tg->rank])
+		return NULL;
+	return group_lists[tg->rank][tg->num];
+}
+
+static void print_top_group_name(struct text_object *obj, char *p, int p_max_size)
+{
+	struct process_group *g = get_top_group(obj);
+	int width;
+
+	if (!g)
+		return;
+
+	width = MIN(p_max_size, (int)top_name_width.get(*state) + 1);
+	snprintf(p, width + 1, "%-*s", width, g->name.c_str());
+}
+
+#define PRINT_TOP_GROUP_GENERATOR(name, stmt) \
+static void print_top_group_##name(struct text_object *obj, char *p, int p_max_size) \
+{ \
+	struct process_group *g = get_top_group(obj); \
+	if (g) \
+		stmt; \
+}
+
+#define TOP_GROUP_VALUE_GENERATOR(name, expr) \
+static double top_group_##name##_value(struct text_object *obj) \
+{ \
+	struct process_group *g = get_top_group(obj); \
+	return g ? (double) (expr) : NAN; \
+}
+
+/* the sums drift a little below 0 once all but idle processes are gone */
+PRINT_TOP_GROUP_GENERATOR(cpu, snprintf(p, MIN(p_max_size, 7), "%6.2f",
+			std::max(g->amount, 0.0)))
+PRINT_TOP_GROUP_GENERATOR(mem, snprintf(p, MIN(p_max_size, 7), "%6.2f",
+			(float) ((float)g->rss / info.memmax) / 10))
+PRINT_TOP_GROUP_GENERATOR(mem_res, human_readable(g->rss, p, p_max_size))
+PRINT_TOP_GROUP_GENERATOR(count, snprintf(p, p_max_size, "%u", g->count))
+
+TOP_GROUP_VALUE_GENERATOR(cpu, std::max(g->amount, 0.0))
+TOP_GROUP_VALUE_GENERATOR(mem, ((float)g->rss / info.memmax) / 10)
+TOP_GROUP_VALUE_GENERATOR(mem_res, g->rss)
+TOP_GROUP_VALUE_GENERATOR(count, g->count)
+
+/* ${top_group user|name cpu|mem field N}: the Nth user or process name by
+ * the cpu or memory of its processes together */
+int parse_top_group_args(struct text_object *obj, const char *arg)
+{
+	struct top_group_data *tg;
+	char by[16], rank[16], field[16];
+	int n, r;
+
+	if (!arg || sscanf(arg, "%15s %15s %15s %i", by, rank, field, &n) != 4) {
+		NORM_ERR("top_group needs user or name, cpu or mem, a field and a number");
+		return 0;
+	}
+	if (strcmp(by, "user") == EQUAL) {
+		r = GROUP_USER_CPU;
+	} else if (strcmp(by, "name") == EQUAL) {
+		r = GROUP_NAME_CPU;
+	} else {
+		NORM_ERR("top_group: '%s' must be user or name", by);
+		return 0;
+	}
+	if (strcmp(rank, "mem") == EQUAL) {
+		r += GROUP_USER_MEM - GROUP_USER_CPU;
+	} else if (strcmp(rank, "cpu") != EQUAL) {
+		NORM_ERR("top_group: '%s' must be cpu or mem", rank);
+		return 0;
+	}
+
+	if (strcmp(field, "name") == EQUAL) {
+		obj->callbacks.print = &print_top_group_name;
+	} else if (strcmp(field, "cpu") == EQUAL) {
+		obj->callbacks.print = &print_top_group_cpu;
+		obj->callbacks.value = &top_group_cpu_value;
+	} else if (strcmp(field, "mem") == EQUAL) {
+		obj->callbacks.print = &print_top_group_mem;
+		obj->callbacks.value = &top_group_mem_value;
+	} else if (strcmp(field, "mem_res") == EQUAL) {
+		obj->callbacks.print = &print_top_group_mem_res;
+		obj->callbacks.value = &top_group_mem_res_value;
+	} else if (strcmp(field, "count") == EQUAL) {
+		obj->callbacks.print = &print_top_group_count;
+		obj->callbacks.value = &top_group_count_value;
+	} else {
+		NORM_ERR("invalid type arg for top_group");
+		NORM_ERR("must be one of: name, cpu, mem, mem_res, count");
+		return 0;
+	}
+
+	alloc_top_lists();
+	if (n < 1 || n > top_list_size) {
+		NORM_ERR("invalid num arg for top_group. Must be between 1 and %d "
+				"(top_max_entries).", top_list_size);
+		return 0;
+	}
+
+	obj->data.opaque = tg = (struct top_group_data *) malloc(sizeof(struct top_group_data));
+	tg->rank = (enum group_rank) r;
+	tg->num = n - 1;
+	group_depth[r] = std::max(group_depth[r], n);
+	top_group = std::max(top_group, n);
+	obj->callbacks.free = &gen_free_opaque;
+	return 1;
+}
+
+static void snapshot_top_list(conky::snapshot_writer &w, const char *key,
+		struct process **list)
+{
+	w.open(key);
+	for (int i = 0; i < top_list_size; i++) {
+		if (!list[i]) {
+			w.erase(i + 1);
+			continue;
+		}
+		w.open(i + 1);
+		w.text("name", list[i]->name ? list[i]->name : "");
+		w.number("pid", list[i]->pid);
+		w.number("uid", list[i]->uid);
+		w.number("cpu", list[i]->amount);
+		w.number("mem", info.memmax ? (double) list[i]->rss / info.memmax / 10 : 0);
+		w.number("rss", list[i]->rss);
+		w.number("vsize", list[i]->vsize);
+		w.number("time", list[i]->total_cpu_time / 100.0);
+		w.close();
+	}
+	w.close();
+}
+
+/* top.cpu, top.mem, top.time (and top.io) in the snapshot of the Lua scripts,
+ * the processes like ${top}, ${top_mem} and ${top_time} list them */
+static conky::register_snapshot top_snapshot("top", [](conky::snapshot_writer &w) {
+	w.open("top");
+	snapshot_top_list(w, "cpu", info.cpu);
+	snapshot_top_list(w, "mem", info.memu);
+	snapshot_top_list(w, "time", info.time);
+#ifdef BUILD_IOSTATS
+	snapshot_top_list(w, "io", info.io);
+#endif /* BUILD_IOSTATS */
+	w.close();
+});
@@ -66,6 +66,8 @@
 #include <regex.h>
 #include <pwd.h>
 
+#include <vector>
+
 
 /******************************************
  * Defines								  *
@@ -75,12 +77,14 @@
  * and it'll take me a while to write a replacement. */
 #define BUFFER_LEN 1024
 
-#define MAX_SP 10	// number of elements to sort
+#define MAX_SP 10	// default depth of the top lists, that of top_cgroup
 
 /******************************************
  * Process class						  *
  ******************************************/
 
+struct process_group;
+
 struct process {
 	struct process *next;
 	struct process *previous;
@@ -104,12 +108,62 @@ struct process {
 	unsigned long long write_bytes;
 	unsigned long long previous_write_bytes;
 	float io_perc;
+	/* the g_time of the last update the process made it into a top_io list */
+	unsigned long io_ranked;
 #endif
+#ifdef BUILD_BPF
+	/* bytes through TCP sockets since the last update, from bpf_top */
+	unsigned long long net_tx;
+	unsigned long long net_rx;
+#endif /* BUILD_BPF */
 	unsigned int time_stamp;
 	unsigned int counted;
 	unsigned int changed;
+	/* the groups of top_group the process is counted in, NULL if none, and
+	 * what it added to them */
+	struct process_group *user_group;
+	struct process_group *name_group;
+	float group_amount;
+	unsigned long long group_rss;
+#ifdef __linux__
+	/* /proc/<pid>/stat, kept open between updates; -1 if closed */
+	int stat_fd;
+	/* the command in /proc/<pid>/stat that name was derived from */
+	char *comm;
+	/* start time of the process, to tell apart processes with the same pid */
+	unsigned long long starttime;
+	/* processes with an open stat_fd, the most recently read first */
+	struct process *lru_next;
+	struct process *lru_previous;
+#endif /* __linux__ */
 };
 
+/* The max highest ranking items (processes, cgroups), in decreasing order,
+ * in a flat array. compare() returns >0 if b ranks above a. */
+template<typename T>
+struct top_list {
+	int (*compare)(T *a, T *b);
+	T **procs;
+	int count;
+	int max;
+};
+
+template<typename T>
+void top_list_insert(struct top_list<T> *list, T *p)
+{
+	int i;
+
+	/* short-cut: the list is full and p doesn't make it */
+	if (list->count == list->max && list->compare(list->procs[list->max - 1], p) <= 0)
+		return;
+
+	i = list->count < list->max ? list->count++ : list->max - 1;
+	/* move the lower ranking items down, dropping the last one */
+	for (; i > 0 && list->compare(list->procs[i - 1], p) > 0; i--)
+		list->procs[i] = list->procs[i - 1];
+	list->procs[i] = p;
+}
+
 struct sorted_process {
 	struct sorted_process *greater;
 	struct sorted_process *less;
@@ -118,13 +172,46 @@ struct sorted_process {
 
 /* lookup a program by it's name */
 struct process *get_process_by_name(const char *);
+void process_set_name(struct process *, char *);
 
 int parse_top_args(const char *s, const char *arg, struct text_object *obj);
 
+/* top_group, ranking the processes of each user or with each name together */
+int parse_top_group_args(struct text_object *obj, const char *arg);
+
+/* the entries of info.cpu, info.memu, info.time and info.io, which are
+ * allocated for the first ${top*} object; 0 before */
+extern int top_list_size;
+
+void free_top_lists(void);
+
 int update_top(void);
 
 void get_top_info(void);
 
+/* What the platforms that read a process table (the BSDs) know about a
+ * process. Their get_top_info() fills a vector of these and hands it to
+ * top_update_processes(), which keeps the process list, so the lists and
+ * everything past them are the same as on linux. */
+struct process_sample {
+	pid_t pid;
+	uid_t uid;
+	const char *name;
+	float cpu_perc;					/* < 0 to work it out from total_cpu_time */
+	unsigned long total_cpu_time;	/* hundredths of seconds */
+	unsigned long long vsize, rss;	/* bytes */
+};
+
+void top_update_processes(const std::vector<struct process_sample> &);
+
+#ifdef __linux__
+/* release the files kept open for reading the process' information */
+void process_close_files(struct process *);
+
+/* set the name of the process, which is only done on demand on linux */
+void process_resolve_name(struct process *);
+#endif /* __linux__ */
+
 extern struct process *first_process;
 extern unsigned long g_time;
 
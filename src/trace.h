@@ -0,0 +1,51 @@
+/* -*- mode: c++; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: t -*-
+ * vim: ts=4 sw=4 noet ai cindent syntax=cpp
+ *
+ * Conky, a system monitor, based on torsmo
+ *
+ * Any original torsmo code is licensed under the BSD license
+ *
+ * All code written since the fork of torsmo is licensed under the GPL
+ *
+ * Please see COPYING for details
+ *
+ * Copyright (c) 2004, Hannu Saransaari and Lauri Hakkarainen
+ * Copyright (c) 2005-2012 Brenden Matthews, Philip Kovacs, et. al.
+ *	(see AUTHORS)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "config.h"
+
+/* Static tracepoints for perf, bpftrace and systemtap, e.g.
+ *   bpftrace -e 'usdt:/usr/bin/conky:conky:draw__done { ... }'
+ * Each phase has a start and a done probe. Without BUILD_USDT, or with no
+ * tracer attached, a probe is a nop. */
+#ifdef BUILD_USDT
+#include <sys/sdt.h>
+#define TRACE(name) DTRACE_PROBE(conky, name)
+#define TRACE1(name, a) DTRACE_PROBE1(conky, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(conky, name, a, b)
+#else
+#define TRACE(name) do {} while (0)
+#define TRACE1(name, a) do {} while (0)
+#define TRACE2(name, a, b) do {} while (0)
+#endif /* BUILD_USDT */
+
+#endif /* _TRACE_H */
@@ -22,37 +22,698 @@
  */
 
 #include "config.h"
+#include "conky.h"
 #include "logging.h"
+#include "profile.h"
+#include "trace.h"
 
 #include "update-cb.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <atomic>
+
+#include <cxxabi.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <typeinfo>
 
 namespace conky {
 	namespace {
-		semaphore sem_wait;
 		enum {UNUSED_MAX = 5};
+		// updates without a visit() after which an on_demand() callback is skipped
+		enum {UNVISITED_MAX = 5};
+
+		// 0 means "pick a sensible amount for this machine"
+		conky::range_config_setting<unsigned int> callback_threads("callback_threads", 0,
+						std::numeric_limits<unsigned int>::max(), 0, false);
+
+		// how long to wait for a wait=true callback, 0 means forever
+		conky::range_config_setting<double> callback_timeout("callback_timeout", 0,
+						std::numeric_limits<double>::infinity(), 0, true);
+
+		// earliest deadline of a wait=false callback, as computed by the last run_due()
+		double background_deadline = std::numeric_limits<double>::infinity();
+
+		// the cpus the callback threads run on, like "0-3,6"; empty means those of conky
+		conky::simple_config_setting<std::string> callback_cpus("callback_cpus", "", false);
+
+		// the longest a failing source is left alone, in seconds; 0 retries it every period
+		conky::range_config_setting<double> callback_backoff_max("callback_backoff_max", 0,
+						std::numeric_limits<double>::infinity(), 900, true);
+
+		// failures in a row which open the circuit of a callback
+		enum {BREAKER_FAILURES = 3};
+
+		// for the callbacks, where state is the place in the pool
+		double get_backoff_max()
+		{ return callback_backoff_max.get(*state); }
+
+		// the nice level of the callback threads, the render thread keeps that of conky
+		conky::range_config_setting<int> callback_nice("callback_nice", -20, 19, 0, false);
+
+		// run the callback threads with SCHED_IDLE, only when the cpus have nothing else to do
+		conky::simple_config_setting<bool> callback_sched_idle("callback_sched_idle", false,
+						false);
+
+		unsigned int get_callback_threads()
+		{
+			unsigned int n = callback_threads.get(*state);
+			if(n == 0)
+				n = std::max(std::thread::hardware_concurrency(), 4u);
+			return n;
+		}
+
+		// the cpus and scheduling of the worker threads. The main thread sets them, the
+		// workers pick them up when gen changed.
+		struct thread_attrs {
+#ifdef __linux__
+			cpu_set_t cpus;
+			bool have_cpus;
+#endif /* __linux__ */
+			int nice;
+			bool sched_idle;
+		};
+
+		std::mutex attrs_mutex;
+		thread_attrs attrs;
+		std::atomic<unsigned int> attrs_gen(0);
+
+#ifdef __linux__
+		// parses a cpu list like "0-3,6", false if it isn't one
+		bool parse_cpu_list(const std::string &list, cpu_set_t *cpus)
+		{
+			const char *p = list.c_str();
+			char *end;
+
+			CPU_ZERO(cpus);
+			while(*p) {
+				unsigned long first = strtoul(p, &end, 10), last = first;
+
+				if(end == p)
+					return false;
+				if(*end == '-') {
+					p = end + 1;
+					last = strtoul(p, &end, 10);
+					if(end == p or last < first)
+						return false;
+				}
+				if(last >= CPU_SETSIZE)
+					return false;
+				for(unsigned long i = first; i <= last; ++i)
+					CPU_SET(i, cpus);
+				p = end;
+				if(*p == ',')
+					++p;
+				else if(*p)
+					return false;
+			}
+			return CPU_COUNT(cpus) > 0;
+		}
+#endif /* __linux__ */
+
+		// called by the main thread before it hands out work
+		void update_thread_attrs()
+		{
+			static std::string last_cpus;
+			static bool first = true;
+			const std::string &cpus = callback_cpus.get(*state);
+			const int nice = callback_nice.get(*state);
+			const bool sched_idle = callback_sched_idle.get(*state);
+			std::lock_guard<std::mutex> lock(attrs_mutex);
+
+			if(not first and cpus == last_cpus and nice == attrs.nice and
+					sched_idle == attrs.sched_idle)
+				return;
+#ifdef __linux__
+			if(first or cpus != last_cpus) {
+				attrs.have_cpus = not cpus.empty();
+				if(attrs.have_cpus and not parse_cpu_list(cpus, &attrs.cpus)) {
+					NORM_ERR("callback_cpus: '%s' is not a list of cpus like 0-3,6",
+							cpus.c_str());
+					attrs.have_cpus = false;
+				}
+				// without a list, the threads go back to the cpus of conky
+				if(not attrs.have_cpus)
+					attrs.have_cpus = sched_getaffinity(0, sizeof(attrs.cpus), &attrs.cpus) == 0;
+			}
+#endif /* __linux__ */
+			first = false;
+			last_cpus = cpus;
+			attrs.nice = nice;
+			attrs.sched_idle = sched_idle;
+			++attrs_gen;
+		}
+
+		// applies attrs to the calling thread if they changed since gen
+		void apply_thread_attrs(unsigned int &gen)
+		{
+			thread_attrs a;
+
+			if(gen == attrs_gen)
+				return;
+			{
+				std::lock_guard<std::mutex> lock(attrs_mutex);
+				a = attrs;
+				gen = attrs_gen;
+			}
+#ifdef __linux__
+			if(a.have_cpus)
+				sched_setaffinity(0, sizeof(a.cpus), &a.cpus);
+#endif /* __linux__ */
+#ifdef SCHED_IDLE
+			struct sched_param param;
+
+			param.sched_priority = 0;
+			pthread_setschedparam(pthread_self(), a.sched_idle ? SCHED_IDLE : SCHED_OTHER,
+					&param);
+#endif /* SCHED_IDLE */
+#ifdef __linux__
+			// the nice level is per thread on linux; raising it back may need privileges
+			if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), a.nice) < 0)
+				DBGP("callback_nice %d: %s", a.nice, strerror(errno));
+#endif /* __linux__ */
+		}
+
+		void set_thread_name(const char *name)
+		{
+#ifdef __linux__
+			char buf[16];
+
+			// the kernel keeps 15 characters
+			snprintf(buf, sizeof(buf), "%s", name);
+			pthread_setname_np(pthread_self(), buf);
+#else
+			(void) name;
+#endif /* __linux__ */
+		}
+
+		// set in the pool threads; the callback the thread is named after
+		thread_local bool worker_thread = false;
+		thread_local const void *named = NULL;
+
+		// "perf" for (anonymous namespace)::perf_cb, "top" for a legacy_cb "for $top"
+		std::string short_name(const std::string &describe)
+		{
+			std::string name = describe;
+			size_t i;
+
+			if((i = name.find('$')) != std::string::npos)
+				return name.substr(i + 1);
+			if((i = name.find('<')) != std::string::npos)
+				name.erase(i);
+			if((i = name.rfind("::")) != std::string::npos)
+				name.erase(0, i + 2);
+			if(name.size() > 3 and name.compare(name.size() - 3, 3, "_cb") == 0)
+				name.erase(name.size() - 3);
+			return name;
+		}
 	}
 
 	namespace priv {
+		/*
+		 * A fixed-size pool of threads executing the work() of callbacks. Threads are started
+		 * lazily, when a job is queued and there is no idle thread to take it, up to the
+		 * limit set by set_max_threads().
+		 *
+		 * Jobs of wait=true callbacks are kept in their own queue which takes precedence.
+		 * wait_all() executes those jobs in the calling thread when no pool thread picks them
+		 * up, so that the main loop can never be starved by slow background callbacks.
+		 *
+		 * With a non-zero timeout, wait_all() only waits and never runs jobs itself, as it
+		 * could not give up on them. wait=true jobs are then allowed to start threads above
+		 * the limit instead, at most one per callback. Each job that can_be_late() gets its
+		 * deadline when it starts.
+		 *
+		 * parallel_for() hands out tasks, which are taken before any callback. The calling
+		 * thread runs them too, so they get done even if every pool thread is busy.
+		 *
+		 * A wait=true job is only taken from the queue once the callbacks it depends on are
+		 * not queued or running. As all due callbacks are submitted in one batch, this orders
+		 * them within a tick. A job whose dependency wait_all() gave up on is dropped from the
+		 * queue, it doesn't get to run before that one finishes.
+		 */
+		class thread_pool {
+			std::mutex mutex;
+			// signalled when new jobs are queued or when the pool is shutting down
+			std::condition_variable cv_work;
+			// signalled when a job is finished
+			std::condition_variable cv_done;
+			std::deque<callback_base *> wait_queue;
+			std::deque<callback_base *> queue;
+			// wait=true callbacks queued since the last wait_all()
+			std::vector<callback_base *> waiting;
+			// callbacks given up on, until publish_late() shows their results again
+			std::vector<callback_base *> late_cbs;
+			// the calls of the running parallel_for() not taken yet, and not finished yet
+			const std::function<void(size_t)> *task_fn;
+			size_t next_task, task_count, tasks_pending;
+			std::vector<std::thread> threads;
+			size_t max_threads;
+			size_t idle;
+			// number of wait=true callbacks that were queued and did not finish yet
+			size_t wait_pending;
+			double timeout;
+			bool quit;
+
+			thread_pool(const thread_pool &) = delete;
+			thread_pool& operator=(const thread_pool &) = delete;
+
+			static bool is_ready(const callback_base *cb)
+			{
+				for(auto i = cb->deps.begin(); i != cb->deps.end(); ++i) {
+					if((*i)->state != callback_base::IDLE)
+						return false;
+				}
+				return true;
+			}
+
+			static bool waits_for_late(const callback_base *cb)
+			{
+				for(auto i = cb->deps.begin(); i != cb->deps.end(); ++i) {
+					if((*i)->late)
+						return true;
+				}
+				return false;
+			}
+
+			std::deque<callback_base *>::iterator find_ready()
+			{ return std::find_if(wait_queue.begin(), wait_queue.end(), is_ready); }
+
+			bool has_work()
+			{
+				return next_task < task_count or not queue.empty() or
+						find_ready() != wait_queue.end();
+			}
+
+			// only call this if has_work() returned true
+			callback_base *pop_job()
+			{
+				callback_base *cb;
+				auto i = find_ready();
+				if(i != wait_queue.end()) {
+					cb = *i;
+					wait_queue.erase(i);
+				} else {
+					cb = queue.front();
+					queue.pop_front();
+				}
+				return cb;
+			}
+
+			void enqueue(callback_base *cb);
+
+			void execute(callback_base *cb, std::unique_lock<std::mutex> &lock);
+			void execute_task(std::unique_lock<std::mutex> &lock);
+			void worker();
+			double give_up_waiting(double now);
+
+		public:
+			thread_pool()
+				: task_fn(NULL), next_task(0), task_count(0), tasks_pending(0), max_threads(1),
+				  idle(0), wait_pending(0), timeout(0), quit(false)
+			{}
+
+			~thread_pool();
+
+			void set_max_threads(size_t n)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				max_threads = std::max(n, size_t(1));
+			}
+
+			void set_timeout(double t)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				timeout = t;
+			}
+
+			void submit(const std::vector<callback_base *> &cbs);
+			void add_dependency(callback_base *cb, std::shared_ptr<callback_base> &&dep);
+			void cancel(callback_base *cb);
+			void wait_all();
+			void publish_late();
+			void parallel_for(size_t n, const std::function<void(size_t)> &fn);
+		};
+
+		thread_pool::~thread_pool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				quit = true;
+			}
+			cv_work.notify_all();
+			for(auto i = threads.begin(); i != threads.end(); ++i)
+				i->join();
+		}
+
+		// called with the mutex locked, returns with the mutex locked
+		void thread_pool::execute(callback_base *cb, std::unique_lock<std::mutex> &lock)
+		{
+			const bool may_be_late = cb->wait and timeout > 0 and cb->can_be_late();
+
+			if(cb->thread_name.empty())
+				cb->thread_name = short_name(cb->describe());
+			cb->state = callback_base::RUNNING;
+			if(may_be_late) {
+				cb->deadline = get_time() + timeout;
+				// wait_all() may be sleeping without a deadline
+				cv_done.notify_all();
+			}
+			lock.unlock();
+
+			// the main thread runs jobs too (wait_all()), it keeps its name
+			if(worker_thread and named != cb) {
+				set_thread_name(cb->thread_name.c_str());
+				named = cb;
+			}
+			if(may_be_late)
+				cb->save_result();
+
+			TRACE2(callback__start, cb, cb->hash);
+			const double started = get_time();
+			if (profiling) {
+				struct profile_start start;
+
+				profile_begin(start);
+				cb->work();
+				profile_end_callback(cb, start);
+			} else {
+				cb->work();
+			}
+			const double ran = get_time() - started;
+			cb->run_time.record(ran);
+			callback_latency.record(ran);
+			TRACE1(callback__done, cb);
+
+			lock.lock();
+			if(cb->state == callback_base::RERUN and not cb->done) {
+				// run() was called again while we were working
+				cb->state = callback_base::QUEUED;
+				(cb->wait ? wait_queue : queue).push_back(cb);
+				cv_work.notify_one();
+			} else {
+				cb->state = callback_base::IDLE;
+				// a late callback stays late until publish_late() notices it finished
+				if(cb->wait and not cb->late)
+					--wait_pending;
+			}
+			// jobs depending on this one may have become ready
+			if(not wait_queue.empty())
+				cv_work.notify_all();
+			cv_done.notify_all();
+		}
+
+		// called with the mutex locked and a task left, returns with the mutex locked
+		void thread_pool::execute_task(std::unique_lock<std::mutex> &lock)
+		{
+			const size_t i = next_task++;
+			const std::function<void(size_t)> &fn = *task_fn;
+
+			lock.unlock();
+			fn(i);
+			lock.lock();
+			if(--tasks_pending == 0)
+				cv_done.notify_all();
+		}
+
+		void thread_pool::worker()
+		{
+			unsigned int gen = 0;
+
+			worker_thread = true;
+			set_thread_name("conky-worker");
+			apply_thread_attrs(gen);
+
+			std::unique_lock<std::mutex> lock(mutex);
+			for(;;) {
+				++idle;
+				while(not quit and not has_work())
+					cv_work.wait(lock);
+				--idle;
+				if(quit)
+					return;
+
+				if(gen != attrs_gen) {
+					lock.unlock();
+					apply_thread_attrs(gen);
+					lock.lock();
+					continue;
+				}
+
+				if(next_task < task_count)
+					execute_task(lock);
+				else
+					execute(pop_job(), lock);
+			}
+		}
+
+		// only called by the main loop, so there is one at a time
+		void thread_pool::parallel_for(size_t n, const std::function<void(size_t)> &fn)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			task_fn = &fn;
+			next_task = 0;
+			task_count = tasks_pending = n;
+			for(size_t started = 0; idle + started + 1 < n and threads.size() < max_threads;
+					++started)
+				threads.push_back(std::thread(&thread_pool::worker, this));
+			cv_work.notify_all();
+
+			while(next_task < task_count)
+				execute_task(lock);
+			while(tasks_pending > 0)
+				cv_done.wait(lock);
+			task_fn = NULL;
+			task_count = next_task = 0;
+		}
+
+		// called with the mutex locked
+		void thread_pool::enqueue(callback_base *cb)
+		{
+			if(cb->late) {
+				// still busy with the work we stopped waiting for last time
+				++cb->missed;
+				return;
+			}
+
+			switch(cb->state) {
+				case callback_base::IDLE:
+					cb->state = callback_base::QUEUED;
+					if(cb->wait) {
+						wait_queue.push_back(cb);
+						waiting.push_back(cb);
+						++wait_pending;
+					} else
+						queue.push_back(cb);
+					break;
+
+				case callback_base::RUNNING:
+					// this can only happen to slow wait=false callbacks, run them once more
+					// after they finish, just like a dedicated thread would
+					cb->state = callback_base::RERUN;
+					return;
+
+				case callback_base::QUEUED:
+				case callback_base::RERUN:
+					return;
+			}
+		}
+
+		void thread_pool::submit(const std::vector<callback_base *> &cbs)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for(auto i = cbs.begin(); i != cbs.end(); ++i)
+				enqueue(*i);
+
+			const size_t jobs = wait_queue.size() + queue.size();
+			const size_t limit = max_threads + (timeout > 0 ? wait_queue.size() : 0);
+			// freshly started threads count themselves as idle only once they get the lock
+			for(size_t started = 0; idle + started < jobs and threads.size() < limit; ++started)
+				threads.push_back(std::thread(&thread_pool::worker, this));
+			cv_work.notify_all();
+		}
+
+		void thread_pool::add_dependency(callback_base *cb, std::shared_ptr<callback_base> &&dep)
+		{
+			assert(cb->wait and dep->wait);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for(auto i = cb->deps.begin(); i != cb->deps.end(); ++i) {
+				if(*i == dep)
+					return;
+			}
+			cb->deps.push_back(std::move(dep));
+		}
+
+		void thread_pool::cancel(callback_base *cb)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			if(cb->wait) {
+				auto i = std::find(waiting.begin(), waiting.end(), cb);
+				if(i != waiting.end())
+					waiting.erase(i);
+			}
+
+			if(cb->state == callback_base::QUEUED) {
+				std::deque<callback_base *> &q = cb->wait ? wait_queue : queue;
+				for(auto i = q.begin(); i != q.end(); ++i) {
+					if(*i == cb) {
+						q.erase(i);
+						break;
+					}
+				}
+				cb->state = callback_base::IDLE;
+				if(cb->wait)
+					--wait_pending;
+				cv_done.notify_all();
+				return;
+			}
+
+			if(cb->late)
+				late_cbs.erase(std::remove(late_cbs.begin(), late_cbs.end(), cb), late_cbs.end());
+
+			if(cb->state != callback_base::IDLE) {
+				// the callback is running, tell it to hurry up
+				if(cb->pipefd.second >= 0)
+					if(write(cb->pipefd.second, "X", 1) != 1)
+						NORM_ERR("can't write 'X' to pipefd %d: %s", cb->pipefd.second,
+								strerror(errno));
+
+				while(cb->state != callback_base::IDLE)
+					cv_done.wait(lock);
+			}
+			// only now, so that a late run doesn't count itself as pending when it ends
+			cb->late = false;
+		}
+
+		/*
+		 * Called with the mutex locked. Gives up on the running callbacks whose deadline has
+		 * passed, and drops the queued ones which depend on a late one. Their users see the
+		 * results saved before the late run. Returns the earliest deadline still to come.
+		 */
+		double thread_pool::give_up_waiting(double now)
+		{
+			double next = std::numeric_limits<double>::infinity();
+
+			for(auto i = waiting.begin(); i != waiting.end(); ++i) {
+				callback_base *cb = *i;
+				if(cb->state != callback_base::RUNNING or cb->late or not cb->can_be_late())
+					continue;
+
+				if(cb->deadline > now) {
+					next = std::min(next, cb->deadline);
+					continue;
+				}
+				cb->late = true;
+				++cb->missed;
+				--wait_pending;
+				cb->show_saved_result(true);
+				late_cbs.push_back(cb);
+				DBGP("callback %s missed its deadline (%u times)", typeid(*cb).name(),
+						cb->missed);
+			}
+
+			for(auto i = wait_queue.begin(); i != wait_queue.end(); ) {
+				callback_base *cb = *i;
+				if(not waits_for_late(cb)) {
+					++i;
+					continue;
+				}
+				i = wait_queue.erase(i);
+				cb->state = callback_base::IDLE;
+				++cb->missed;
+				--wait_pending;
+			}
+			return next;
+		}
+
+		void thread_pool::wait_all()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			if(timeout > 0) {
+				while(wait_pending > 0) {
+					const double now = get_time();
+					const double next = give_up_waiting(now);
+
+					if(wait_pending == 0)
+						break;
+					if(next == std::numeric_limits<double>::infinity())
+						cv_done.wait(lock);
+					else
+						cv_done.wait_for(lock, std::chrono::duration<double>(next - now));
+				}
+			} else {
+				while(wait_pending > 0) {
+					auto i = find_ready();
+					if(i != wait_queue.end()) {
+						callback_base *cb = *i;
+						wait_queue.erase(i);
+						execute(cb, lock);
+					} else
+						cv_done.wait(lock);
+				}
+			}
+
+			waiting.clear();
+		}
+
+		// show the results of the late callbacks which finished since, at the start of an update
+		void thread_pool::publish_late()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for(auto i = late_cbs.begin(); i != late_cbs.end(); ) {
+				callback_base *cb = *i;
+				if(cb->state != callback_base::IDLE) {
+					++i;
+					continue;
+				}
+				cb->late = false;
+				cb->show_saved_result(false);
+				i = late_cbs.erase(i);
+			}
+		}
+
+		namespace {
+			// defined before the callbacks list, so that it gets destroyed after it
+			thread_pool pool;
+		}
+
 		callback_base::~callback_base()
 		{
 			stop();
 		}
 
+		std::string callback_base::describe() const
+		{
+			const char *name = typeid(*this).name();
+			int status;
+			char *demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+			std::string ret(demangled ? demangled : name);
+
+			free(demangled);
+			return ret;
+		}
+
 		void callback_base::stop()
 		{
-			if(thread) {
-				done = true;
-				sem_start.post();
-				if(pipefd.second >= 0)
-					if(write(pipefd.second, "X", 1) != 1)
-						NORM_ERR("can't write 'X' to pipefd %d: %s", pipefd.second, strerror(errno));
-				thread->join();
-				delete thread;
-				thread = NULL;
-			}
+			done = true;
+			pool.cancel(this);
+
 			if(pipefd.first >= 0) {
 				close(pipefd.first);
 				pipefd.first = -1;
@@ -81,7 +742,7 @@ namespace conky {
 		{
 			if(other.period < period) {
 				period = other.period;
-				remaining = 0;
+				next_run = 0;
 			}
 			assert(wait == other.wait);
 			unused = 0;
@@ -97,60 +758,311 @@ namespace conky {
 			return *p.first;
 		}
 
-		void callback_base::run()
+		// the first visit in an update; what the callback depends on is wanted as well
+		void callback_base::visit_slow()
 		{
-			if(not thread)
-				thread = new std::thread(&callback_base::start_routine, this);
+			last_visit = updates;
+			if(idle) {
+				// run in the next update, as on the first one
+				idle = false;
+				next_run = 0;
+			}
+			for(auto i = deps.begin(); i != deps.end(); ++i)
+				(*i)->visit();
+		}
 
-			sem_start.post();
+		void callback_base::add_dependency(std::shared_ptr<callback_base> &&dep)
+		{
+			pool.add_dependency(this, std::move(dep));
 		}
 
-		void callback_base::start_routine()
+		void callback_base::failed(const std::string &error)
 		{
-			for(;;) {
-				sem_start.wait();
-				if(done)
-					return;
+			const double now = get_time();
+			const double max = get_backoff_max();
+			std::lock_guard<std::mutex> lock(breaker_mutex);
+			const bool opens = circuit == CLOSED;
+
+			++failures;
+			if(max > 0 and failures >= BREAKER_FAILURES) {
+				const double interval = period * active_update_interval();
+				double backoff = std::min(interval * std::ldexp(1.0,
+							std::min<uint32_t>(failures - BREAKER_FAILURES + 1, 30)), max);
 
-				// clear any remaining posts in case the previous iteration was very slow
-				// (this should only happen if wait == false)
-				while(sem_start.trywait());
+				// somewhere in the upper half, so that callbacks of the same server which
+				// failed together don't all come back together
+				double jitter = ((hash ^ uint64_t(now * 1000)) % 1024) / 1024.0;
+				backoff *= 0.5 + jitter / 2;
+				retry_at = now + std::max(backoff, interval);
+				circuit = OPEN;
 
-				work();
-				if(wait)
-					sem_wait.post();
+				// when it opens, and then as often as the longest backoff
+				if(opens or now - logged_at >= max) {
+					logged_at = now;
+					NORM_ERR("%s (failed %u times in a row, next try in %.0fs)", error.c_str(),
+							failures, retry_at - now);
+				}
+				return;
+			}
+			circuit = CLOSED;
+			if(failures == 1 or now - logged_at >= std::max(max, 60.0)) {
+				logged_at = now;
+				NORM_ERR("%s", error.c_str());
 			}
 		}
 
+		void callback_base::succeeded()
+		{
+			std::lock_guard<std::mutex> lock(breaker_mutex);
+
+			if(circuit != CLOSED)
+				NORM_ERR("%s is back after %u failures", short_name(describe()).c_str(),
+						failures);
+			failures = 0;
+			circuit = CLOSED;
+		}
+
+		bool callback_base::let_through(double now)
+		{
+			std::lock_guard<std::mutex> lock(breaker_mutex);
+
+			if(circuit != OPEN)
+				return true;
+			if(now < retry_at)
+				return false;
+			circuit = HALF_OPEN;
+			return true;
+		}
+
+		double callback_base::held_until()
+		{
+			std::lock_guard<std::mutex> lock(breaker_mutex);
+
+			return circuit == OPEN ? retry_at : 0;
+		}
+
+		void callback_base::run(const std::vector<callback_base *> &cbs)
+		{
+			pool.submit(cbs);
+		}
+
+		void callback_base::run_due(bool background_only)
+		{
+			const double now = get_time();
+			const double tick = active_update_interval();
+			double deadline = std::numeric_limits<double>::infinity();
+			std::vector<callback_base *> due;
+
+			if(not background_only)
+				++updates;
+
+			for(auto i = callbacks.begin(); i != callbacks.end(); ) {
+				callback_base &cb = **i;
+
+				if(background_only and cb.wait) {
+					++i;
+					continue;
+				}
+
+				// e.g. all its objects are in an ifblock branch that isn't shown
+				if(not cb.idle and cb.on_demand() and updates - cb.last_visit > UNVISITED_MAX) {
+					cb.idle = true;
+					DBGP("callback %s is idle", cb.describe().c_str());
+				}
+
+				// round to the nearest tick, ticks never come exactly on time
+				if(not cb.idle and cb.next_run - now < tick/2) {
+					if(!i->unique() || ++cb.unused < UNUSED_MAX) {
+						const double interval = cb.period * tick;
+
+						if(cb.next_run == 0) {
+							// first run: spread callbacks with the same period over the
+							// ticks of the period instead of firing them all together
+							double jitter = (cb.hash % 1024) / 1024.0;
+							cb.next_run = now + interval + jitter * (interval - tick);
+						} else {
+							cb.next_run += interval;
+							if(cb.next_run <= now)
+								cb.next_run = now + interval;
+						}
+						// its source failed, the next run waits for the backoff
+						if(cb.let_through(now + tick/2))
+							due.push_back(&cb);
+					}
+				}
+				if(cb.unused == UNUSED_MAX) {
+					auto t = i;
+					++i;
+					callbacks.erase(t);
+					continue;
+				}
+
+				if(not cb.wait)
+					deadline = std::min(deadline, std::max(cb.next_run, cb.held_until()));
+				++i;
+			}
+
+			background_deadline = deadline;
+			run(due);
+		}
+
+		/*
+		 * The callbacks run on every tick, and nothing else. Their deadlines stay where they
+		 * are, so the next tick runs them as usual.
+		 */
+		void callback_base::run_sampled()
+		{
+			std::vector<callback_base *> due;
+
+			for(auto i = callbacks.begin(); i != callbacks.end(); ++i) {
+				callback_base &cb = **i;
+
+				// not yet run by a tick, or not used any more
+				if(cb.wait && cb.period == 1 && cb.next_run != 0 && !cb.idle && !i->unique())
+					due.push_back(&cb);
+			}
+			run(due);
+		}
+
+		void callback_base::run_primed()
+		{
+			std::vector<callback_base *> due;
+
+			for(auto i = callbacks.begin(); i != callbacks.end(); ++i) {
+				callback_base &cb = **i;
+
+				if(cb.wait && !cb.idle && !i->unique())
+					due.push_back(&cb);
+			}
+			run(due);
+		}
+
 		callback_base::Callbacks callback_base::callbacks(1, get_hash, is_equal);
+		uint64_t callback_base::updates = 0;
 	}
 
 
 	void run_all_callbacks()
 	{
-		using priv::callback_base;
+		start_all_callbacks();
+		finish_callbacks();
+	}
 
-		size_t wait = 0;
-		for(auto i = callback_base::callbacks.begin(); i != callback_base::callbacks.end(); ) {
-			callback_base &cb = **i;
+	void start_all_callbacks()
+	{
+		priv::pool.set_max_threads(get_callback_threads());
+		priv::pool.set_timeout(callback_timeout.get(*state));
+		update_thread_attrs();
+		priv::pool.publish_late();
 
-			if(cb.remaining-- == 0) {
-				if(!i->unique() || ++cb.unused < UNUSED_MAX) {
-					cb.remaining = cb.period-1;
-					cb.run();
-					if(cb.wait)
-						++wait;
-				}
-			}
-			if(cb.unused == UNUSED_MAX) {
-				auto t = i;
-				++i;
-				callback_base::callbacks.erase(t);
-			} else 
-				++i;
+		priv::callback_base::run_due(false);
+	}
+
+	void finish_callbacks()
+	{
+		const double start = get_time();
+
+		priv::pool.wait_all();
+		wait_latency.record(get_time() - start);
+	}
+
+	// between two ticks, see sample_interval
+	void run_sample_callbacks()
+	{
+		priv::pool.set_max_threads(get_callback_threads());
+		priv::pool.set_timeout(callback_timeout.get(*state));
+		update_thread_attrs();
+		priv::pool.publish_late();
+
+		priv::callback_base::run_sampled();
+
+		priv::pool.wait_all();
+	}
+
+	// before the first update, so that it has a sample to work out rates from
+	void run_prime_callbacks()
+	{
+		start_prime_callbacks();
+		priv::pool.wait_all();
+	}
+
+	void start_prime_callbacks()
+	{
+		priv::pool.set_max_threads(get_callback_threads());
+		priv::pool.set_timeout(callback_timeout.get(*state));
+		update_thread_attrs();
+
+		priv::callback_base::run_primed();
+	}
+
+	void run_background_callbacks()
+	{
+		priv::callback_base::run_due(true);
+	}
+
+	double next_callback_deadline()
+	{
+		return background_deadline;
+	}
+
+	size_t callback_count()
+	{
+		return priv::callback_base::callbacks.size();
+	}
+
+	void parallel_for(size_t n, const std::function<void(size_t)> &fn)
+	{
+		if(n == 0)
+			return;
+		if(n == 1) {
+			fn(0);
+			return;
+		}
+		priv::pool.set_max_threads(get_callback_threads());
+		update_thread_attrs();
+		priv::pool.parallel_for(n, fn);
+	}
+
+	void for_each_callback_latency(
+			const std::function<void(const std::string &, const latency_histogram &)> &fn)
+	{
+		typedef priv::callback_base::Callbacks::const_iterator iterator;
+
+		for(iterator i = priv::callback_base::callbacks.begin();
+				i != priv::callback_base::callbacks.end(); ++i)
+			fn((*i)->describe(), (*i)->run_time);
+	}
+
+	std::string callback_source_state(const std::string &name)
+	{
+		typedef priv::callback_base::Callbacks::const_iterator iterator;
+		static const char *states[] = { "ok", "failing", "half-open", "open" };
+		int worst = -1;
+
+		for(iterator i = priv::callback_base::callbacks.begin();
+				i != priv::callback_base::callbacks.end(); ++i) {
+			priv::callback_base &cb = **i;
+			int s;
+
+			if(short_name(cb.describe()).find(name) == std::string::npos)
+				continue;
+			std::lock_guard<std::mutex> lock(cb.breaker_mutex);
+			if(cb.circuit == priv::callback_base::OPEN)
+				s = 3;
+			else if(cb.circuit == priv::callback_base::HALF_OPEN)
+				s = 2;
+			else
+				s = cb.failures > 0;
+			worst = std::max(worst, s);
 		}
+		return worst < 0 ? std::string() : states[worst];
+	}
+
+	void setup_worker_thread(const char *name)
+	{
+		unsigned int gen = 0;
 
-		while(wait-- > 0)
-			sem_wait.wait();
+		set_thread_name(name);
+		apply_thread_attrs(gen);
 	}
 }
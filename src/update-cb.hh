@@ -25,53 +25,133 @@
 #define UPDATE_CB_HH
 
 #include <cstdint>
+#include <functional>
 #include <memory>
-#include <thread>
 // the following probably requires a is-gcc-4.7.0 check
 #include <mutex>
+#include <string>
 #include <tuple>
 #include <unordered_set>
+#include <vector>
 
 
 #include <assert.h>
 
 #include "c++wrap.hh"
-#include "semaphore.hh"
+#include "latency.h"
 
 namespace conky {
 	// forward declarations
 	template<typename Callback>
 	class callback_handle;
 	void run_all_callbacks();
+	void start_all_callbacks();
+	void finish_callbacks();
+	void run_sample_callbacks();
+	void run_prime_callbacks();
+	// run_prime_callbacks() without waiting, finish_callbacks() waits for them
+	void start_prime_callbacks();
+	void run_background_callbacks();
+	double next_callback_deadline();
+	size_t callback_count();
+	// run fn(0) .. fn(n-1) on the threads of the callbacks and the calling one, and return
+	// when all are done; the calls must not depend on each other
+	void parallel_for(size_t n, const std::function<void(size_t)> &fn);
+	// name the calling thread (15 characters at most) and give it the cpus and scheduling
+	// of the callback threads, for the threads that collect data outside of callbacks
+	void setup_worker_thread(const char *name);
+	// call fn with the description and the run time histogram of each callback, from the
+	// main thread
+	void for_each_callback_latency(
+			const std::function<void(const std::string &, const latency_histogram &)> &fn);
+	// how the sources of the callbacks whose short name contains name are doing, the worst
+	// of them: "open", "half-open", "failing" or "ok"; empty if there is no such callback
+	std::string callback_source_state(const std::string &name);
 	template<typename Callback, typename... Params>
 	callback_handle<Callback> register_cb(uint32_t period, Params&&... params);
 
 	namespace priv {
+		class thread_pool;
+
 		class callback_base {
+		public:
+			// CLOSED runs as usual, OPEN skips the runs until the backoff is over and
+			// HALF_OPEN is the one run let through then
+			enum circuit_state { CLOSED, OPEN, HALF_OPEN };
+
+		private:
 			typedef callback_handle<callback_base> handle;
 			typedef std::unordered_set<handle, size_t (*)(const handle &),
 									   bool (*)(const handle &, const handle &)>
 			Callbacks;
 
+			// where the callback is in its life inside the thread pool
+			// protected by the pool mutex
+			enum job_state { IDLE, QUEUED, RUNNING, RERUN };
 
-			semaphore sem_start;
-			std::thread *thread;
 			const size_t hash;
 			uint32_t period;
-			uint32_t remaining;
+			// absolute time (see get_time()) of the next run, 0 means as soon as possible
+			double next_run;
 			std::pair<int, int> pipefd;
 			const bool wait;
 			bool done;
+			// the main loop stopped waiting for this wait=true callback, protected by the
+			// pool mutex. It is cleared by the first update after the callback finished.
+			bool late;
 			uint8_t unused;
+			job_state state;
+			// how many times run_all_callbacks() gave up waiting for this callback
+			uint32_t missed;
+			// when run_all_callbacks() gives up waiting for this running wait=true callback,
+			// see get_time(), protected by the pool mutex
+			double deadline;
+			// the update in which the callback was last visit()ed, see on_demand()
+			uint64_t last_visit;
+			// skipped as nobody visited it for a while
+			bool idle;
+			// what the pool thread running it is called, set by the pool on the first run
+			std::string thread_name;
+			// how long its work() took
+			latency_histogram run_time;
+			// callbacks which must finish their work() before this one starts, protected by
+			// the pool mutex
+			std::vector<std::shared_ptr<callback_base>> deps;
+			// failed() runs in a row and the circuit they opened, see failed()
+			uint32_t failures;
+			circuit_state circuit;
+			// while the circuit is open, when it lets a run through again, see get_time()
+			double retry_at;
+			// when failed() last logged
+			double logged_at;
+			// protects the four above, which work() changes while the main loop looks
+			std::mutex breaker_mutex;
 
 			callback_base(const callback_base &) = delete;
 			callback_base& operator=(const callback_base &) = delete;
 
 			virtual bool operator==(const callback_base &) = 0;
 
-			void run();
-			void start_routine();
 			void stop();
+			void add_dependency(std::shared_ptr<callback_base> &&dep);
+
+			// whether run_due() may run the callback now, moving an open circuit whose
+			// backoff is over to HALF_OPEN
+			bool let_through(double now);
+			// when an open circuit lets a run through again, 0 if it isn't open
+			double held_until();
+
+			// run a batch of callbacks, ordering them according to their dependencies
+			static void run(const std::vector<callback_base *> &cbs);
+
+			// run callbacks whose deadline has come, optionally only the wait=false ones
+			static void run_due(bool background_only);
+
+			// run the callbacks of every tick between two ticks, leaving their deadlines alone
+			static void run_sampled();
+
+			// run all the callbacks the update waits for, leaving their deadlines alone
+			static void run_primed();
 
 			static void deleter(callback_base *ptr)
 			{
@@ -88,20 +168,38 @@ namespace conky {
 
 			static handle do_register_cb(const handle &h);
 
+			// the number of updates (run_all_callbacks()) so far
+			static uint64_t updates;
+
+			void visit_slow();
+
 			template<typename Callback, typename... Params>
 			friend callback_handle<Callback>
 			conky::register_cb(uint32_t period, Params&&... params);
 
 			friend void conky::run_all_callbacks();
+			friend void conky::start_all_callbacks();
+			friend void conky::run_sample_callbacks();
+			friend void conky::run_prime_callbacks();
+			friend void conky::start_prime_callbacks();
+			friend void conky::run_background_callbacks();
+			friend size_t conky::callback_count();
+			friend std::string conky::callback_source_state(const std::string &);
+			friend void conky::for_each_callback_latency(
+					const std::function<void(const std::string &, const latency_histogram &)> &);
 
 			template<typename Callback>
 			friend class conky::callback_handle;
 
+			friend class thread_pool;
+
 		protected:
 			callback_base(size_t hash_, uint32_t period_, bool wait_, bool use_pipe)
-				: thread(NULL), hash(hash_), period(period_), remaining(0),
+				: hash(hash_), period(period_), next_run(0),
 				  pipefd(use_pipe ? pipe2(O_CLOEXEC) : std::pair<int, int>(-1, -1)),
-				  wait(wait_), done(false), unused(0)
+				  wait(wait_), done(false), late(false), unused(0), state(IDLE), missed(0),
+				  deadline(0), last_visit(updates), idle(false), failures(0), circuit(CLOSED),
+				  retry_at(0), logged_at(0)
 			{}
 
 			int donefd()
@@ -117,10 +215,69 @@ namespace conky {
 			// afterwards
 			virtual void merge(callback_base &&);
 
+			// Whether run_all_callbacks() may stop waiting for this callback. Only those whose
+			// output is entirely their result can, as the result is saved before each run and
+			// shown in its place until the next update after the late run finished.
+			virtual bool can_be_late() const
+			{ return false; }
+
+			// called before work() when the callback may be given up on
+			virtual void save_result()
+			{}
+
+			// make readers see the saved result (while late) or the current one again,
+			// called by the main loop only
+			virtual void show_saved_result(bool)
+			{}
+
+			// For callbacks reading a remote source: work() calls failed() when the source
+			// couldn't be read and succeeded() when it could. After a few failures in a row
+			// the circuit opens and the runs are skipped for a backoff which doubles with each
+			// further failure, see callback_backoff_max. Logs the error, though not on every
+			// failure.
+			void failed(const std::string &error);
+			void succeeded();
+
+			// Whether the callback only runs while its results are wanted. All its users then
+			// have to visit() it whenever they look at them, it is skipped once a few updates
+			// went by without a visit. A visit brings it back in the next update.
+			virtual bool on_demand() const
+			{ return false; }
+
 
 		public:
 			std::mutex result_mutex;
 
+			uint32_t missed_deadlines() const
+			{ return missed; }
+
+			circuit_state circuit_breaker()
+			{
+				std::lock_guard<std::mutex> lock(breaker_mutex);
+				return circuit;
+			}
+
+			uint32_t failure_count()
+			{
+				std::lock_guard<std::mutex> lock(breaker_mutex);
+				return failures;
+			}
+
+			// the results are wanted in this update, see on_demand(); main loop only
+			void visit()
+			{
+				if(last_visit != updates)
+					visit_slow();
+			}
+
+			// what the callback is, for the profiler
+			virtual std::string describe() const;
+
+			// make this callback wait for dep whenever both are due, both must have wait=true
+			template<typename Callback>
+			void depends_on(const callback_handle<Callback> &dep)
+			{ add_dependency(std::shared_ptr<Callback>(dep)); }
+
 			virtual ~callback_base();
 		};
 
@@ -143,7 +300,7 @@ namespace conky {
 		using Base::operator->;
 		using Base::operator*;
 
-		friend void conky::run_all_callbacks();
+		friend class priv::callback_base;
 		template<typename Callback_, typename... Params>
 		friend callback_handle<Callback_> register_cb(uint32_t period, Params&&... params);
 	};
@@ -191,6 +348,11 @@ namespace conky {
 	 * get_result_copy() returns a copy of the result object and it handles the necessary
 	 * locking. Don't call it if you hold a lock on the result_mutex.
 	 *
+	 * Callbacks with big results (command output, downloads) can publish_result() instead of
+	 * assigning result. The published value is never changed again, get_result_ptr() hands out
+	 * a reference to it, so neither side waits for the other and printing copies nothing. Such
+	 * callbacks must not be read with get_result() or get_result_copy().
+	 *
 	 * You should implement the work() function to do the actual updating and store the result in
 	 * the result variable (lock the mutex while you are doing it, especially if you have
 	 * wait=false).
@@ -202,14 +364,50 @@ namespace conky {
 	 *
 	 * Callbacks are registered with the register_cb() function. You pass the class name as the
 	 * template parameter, and any additional parameters to the constructor as function
-	 * parameters. The period parameter specifies how often the callback will run. It should be
-	 * left for the user to decide that. register_cb() returns a pointer to the newly created
-	 * object. As long as someone holds a pointer to the object, the callback will be run.
+	 * parameters. The period parameter specifies how often the callback will run, in multiples
+	 * of the update_interval. It should be left for the user to decide that. register_cb()
+	 * returns a pointer to the newly created object. As long as someone holds a pointer to the
+	 * object, the callback will be run.
 	 *
 	 * run_all_callbacks() runs the registered callbacks (with the specified periodicity). It
 	 * should be called from somewhere inside the main loop, according to the update_interval
 	 * setting. It waits for the callbacks which have wait=true. It leaves the rest to run in
-	 * background.
+	 * background. It is start_all_callbacks() followed by finish_callbacks(), the main loop may
+	 * do something else in between as long as it doesn't look at what they collect.
+	 *
+	 * Callbacks are scheduled by wall-clock deadlines, so a changing update_interval doesn't
+	 * disturb their phase, and callbacks with the same period are spread over different ticks.
+	 * wait=false callbacks need not wait for the next tick: next_callback_deadline() tells the
+	 * main loop when to call run_background_callbacks().
+	 *
+	 * The work() functions are executed by a shared pool of threads, whose size is limited by
+	 * the callback_threads setting. A callback never runs concurrently with itself. While
+	 * waiting, run_all_callbacks() executes queued wait=true callbacks itself, so these make
+	 * progress even if all pool threads are busy with long-running background work.
+	 *
+	 * If the callback_timeout setting is non-zero, run_all_callbacks() waits at most that long
+	 * for each wait=true callback, counted from when the callback starts. A callback which is
+	 * not finished by then keeps running in the background and missed_deadlines() is increased.
+	 * Its users see the result of its previous run, saved before work() started, until the
+	 * first update after it finished. It is not started again until then. This costs a copy of
+	 * the result per run, so it is only done with a timeout. Callbacks which write elsewhere
+	 * than their result (legacy_cb) can't be given up on, they are always waited for.
+	 *
+	 * A wait=true callback may use depends_on() to declare that it needs the results of another
+	 * one. When both are due in the same tick, it isn't started until the other one finishes.
+	 * If that one is late, the dependent one skips the update. Callbacks that don't depend on
+	 * each other run in parallel. The dependency is kept registered for as long as the
+	 * dependent callback exists.
+	 *
+	 * A callback which is on_demand() is skipped once nobody visit()ed it for a few updates,
+	 * and brought back by the next visit. Visiting one also visits those it depends on.
+	 *
+	 * Callbacks reading a server tell failed() and succeeded() how it went. Once a source failed
+	 * a few times in a row, its callback isn't run at its period any more but after a jittered,
+	 * exponentially growing backoff, so that a server which is down costs neither a thread
+	 * blocked in a timeout every period nor a log line each time. The first run after the
+	 * backoff decides: if it succeeds the callback is back to its period, otherwise it waits
+	 * twice as long. Users see the result of the last successful run meanwhile.
 	 */
 	template<typename Result, typename... Keys>
 	class callback: public priv::callback_base {
@@ -223,6 +421,26 @@ namespace conky {
 		const Tuple tuple;
 		Result result;
 
+		void publish_result(Result &&r)
+		{ std::atomic_store(&snapshot, std::shared_ptr<const Result>(new Result(std::move(r)))); }
+
+	private:
+		std::shared_ptr<const Result> snapshot;
+		// the result before the current run, and what get_result() returns
+		Result saved;
+		const Result *shown;
+
+		virtual bool can_be_late() const
+		{ return true; }
+
+		virtual void save_result()
+		{ saved = result; }
+
+		virtual void show_saved_result(bool show)
+		{ shown = show ? &saved : &result; }
+
+	protected:
+
 		template<size_t i>
 		typename std::add_lvalue_reference<
 					const typename std::tuple_element<i, Tuple>::type
@@ -234,17 +452,20 @@ namespace conky {
 		callback(uint32_t period_, bool wait_, const Tuple &tuple_, bool use_pipe = false)
 			: callback_base(priv::hash_tuple<sizeof...(Keys), Keys...>::hash(tuple_),
 						period_, wait_, use_pipe),
-			  tuple(tuple_)
+			  tuple(tuple_), snapshot(new Result()), saved(), shown(&result)
 		{}
 
 		const Result& get_result()
-		{ return result; }
+		{ return *shown; }
 
 		Result get_result_copy()
 		{
 			std::lock_guard<std::mutex> l(result_mutex);
-			return result;
+			return *shown;
 		}
+
+		std::shared_ptr<const Result> get_result_ptr()
+		{ return std::atomic_load(&snapshot); }
 	};
 }
 
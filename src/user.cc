@@ -35,10 +35,77 @@
 #include <grp.h>
 #include <errno.h>
 #include "conky.h"
+#include "user.h"
 #include <memory>
+#include <string>
+#include <unordered_map>
+
+/* how long looked up names (and ids without one) are kept, NSS may have to
+ * ask a directory server over the network */
+#define NAME_CACHE_TTL 300.0
+#define NAME_CACHE_NEGATIVE_TTL 60.0
+
+namespace {
+	struct cached_name {
+		std::string name;
+		bool found;
+		double expires;
+	};
+
+	template<typename Id>
+	class name_cache {
+		std::unordered_map<Id, cached_name> names;
+		const char *(*lookup)(Id);
+
+	public:
+		explicit name_cache(const char *(*lookup_)(Id))
+			: lookup(lookup_)
+		{}
+
+		const char *get(Id id)
+		{
+			double now = get_time();
+			cached_name &c = names[id];
+
+			if (c.expires <= now) {
+				const char *name = lookup(id);
+
+				c.found = name != NULL;
+				c.name = c.found ? name : "";
+				c.expires = now + (c.found ? NAME_CACHE_TTL : NAME_CACHE_NEGATIVE_TTL);
+			}
+			return c.found ? c.name.c_str() : NULL;
+		}
+	};
+
+	const char *lookup_user(uid_t uid)
+	{
+		struct passwd *pw = getpwuid(uid);
+		return pw ? pw->pw_name : NULL;
+	}
+
+	const char *lookup_group(gid_t gid)
+	{
+		struct group *grp = getgrgid(gid);
+		return grp ? grp->gr_name : NULL;
+	}
+
+	name_cache<uid_t> user_names(&lookup_user);
+	name_cache<gid_t> group_names(&lookup_group);
+}
+
+const char *get_user_name(uid_t uid)
+{
+	return user_names.get(uid);
+}
+
+const char *get_group_name(gid_t gid)
+{
+	return group_names.get(gid);
+}
 
 void print_uid_name(struct text_object *obj, char *p, int p_max_size) {
-	struct passwd *pw;
+	const char *name;
 	uid_t uid;
 	char* firstinvalid;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
@@ -48,9 +115,9 @@ void print_uid_name(struct text_object *obj, char *p, int p_max_size) {
 	errno = 0;
 	uid = strtol(objbuf.get(), &firstinvalid, 10);
 	if (errno == 0 && objbuf.get() != firstinvalid) {
-		pw = getpwuid(uid);
-		if(pw != NULL) {
-			snprintf(p, p_max_size, "%s", pw->pw_name);
+		name = get_user_name(uid);
+		if(name != NULL) {
+			snprintf(p, p_max_size, "%s", name);
 		} else {
 			NORM_ERR("The uid %d doesn't exist", uid);
 		}
@@ -60,7 +127,7 @@ void print_uid_name(struct text_object *obj, char *p, int p_max_size) {
 }
 
 void print_gid_name(struct text_object *obj, char *p, int p_max_size) {
-	struct group *grp;
+	const char *name;
 	gid_t gid;
 	char* firstinvalid;
 	std::unique_ptr<char []> objbuf(new char[max_user_text.get(*state)]);
@@ -70,9 +137,9 @@ void print_gid_name(struct text_object *obj, char *p, int p_max_size) {
 	errno = 0;
 	gid = strtol(objbuf.get(), &firstinvalid, 10);
 	if (errno == 0 && objbuf.get() != firstinvalid) {
-		grp = getgrgid(gid);
-		if(grp != NULL) {
-			snprintf(p, p_max_size, "%s", grp->gr_name);
+		name = get_group_name(gid);
+		if(name != NULL) {
+			snprintf(p, p_max_size, "%s", name);
 		} else {
 			NORM_ERR("The gid %d doesn't exist", gid);
 		}
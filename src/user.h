@@ -31,6 +31,12 @@
 #ifndef _USER_H
 #define _USER_H
 
+#include <sys/types.h>
+
+/* the names of users and groups, cached for a while; NULL if there is none */
+const char *get_user_name(uid_t uid);
+const char *get_group_name(gid_t gid);
+
 void print_gid_name(struct text_object *obj, char *p, int p_max_size);
 void print_uid_name(struct text_object *obj, char *p, int p_max_size);
 
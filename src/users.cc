@@ -32,171 +32,180 @@
 #include <utmp.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif /* HAVE_SYS_INOTIFY_H */
 
 #define BUFLEN 512
 
-static void user_name(char *ptr)
-{
-	const struct utmp *usr = 0;
+namespace {
+	struct session {
+		std::string name;
+		std::string line;
+		time_t log_in;
+	};
 
-	setutent();
-	while ((usr = getutent()) != NULL) {
-		if (usr->ut_type == USER_PROCESS) {
-			if (strlen(ptr) + strlen(usr->ut_name) + 1 <= BUFLEN) {
-				strncat(ptr, usr->ut_name, UT_NAMESIZE);
-			}
-		}
-	}
-}
-static void user_num(int *ptr)
-{
-	const struct utmp *usr;
-	int users_num = 0;
+	/* the USER_PROCESS entries of utmp, as of the last time it changed */
+	std::vector<session> sessions;
+	bool sessions_read = false;
 
-	setutent();
-	while ((usr = getutent()) != NULL) {
-		if (usr->ut_type == USER_PROCESS) {
-			++users_num;
-		}
+#ifdef HAVE_SYS_INOTIFY_H
+	/* inotify watching utmp, -1 if there is none, -2 if not tried yet */
+	int utmp_inotify = -2;
+	int utmp_wd = -1;
+#endif /* HAVE_SYS_INOTIFY_H */
+	/* without inotify, a change is noticed by stat()ing utmp */
+	struct stat utmp_stat;
+
+	bool utmp_stat_changed()
+	{
+		struct stat st;
+
+		if (stat(_PATH_UTMP, &st))
+			memset(&st, 0, sizeof(st));
+		bool changed = st.st_ino != utmp_stat.st_ino || st.st_size != utmp_stat.st_size
+			|| st.st_mtime != utmp_stat.st_mtime;
+		utmp_stat = st;
+		return changed;
 	}
-	*ptr = users_num;
-}
-static void user_term(char *ptr)
-{
-	const struct utmp *usr;
 
-	setutent();
-	while ((usr = getutent()) != NULL) {
-		if (usr->ut_type == USER_PROCESS) {
-			if (strlen(ptr) + strlen(usr->ut_line) + 1 <= BUFLEN) {
-				strncat(ptr, usr->ut_line, UT_LINESIZE);
-			}
+#ifdef HAVE_SYS_INOTIFY_H
+	void watch_utmp()
+	{
+		if (utmp_inotify == -2)
+			utmp_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (utmp_inotify == -1)
+			return;
+
+		if (utmp_wd != -1)
+			inotify_rm_watch(utmp_inotify, utmp_wd);
+		utmp_wd = inotify_add_watch(utmp_inotify, _PATH_UTMP,
+				IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+		if (utmp_wd == -1) {
+			close(utmp_inotify);
+			utmp_inotify = -1;
 		}
 	}
-}
-static void user_time(char *ptr)
-{
-	const struct utmp *usr;
-	time_t log_in, real, diff;
-	char buf[BUFLEN] = "";
+#endif /* HAVE_SYS_INOTIFY_H */
 
-	setutent();
-	while ((usr = getutent()) != NULL) {
-		if (usr->ut_type == USER_PROCESS) {
-			log_in = usr->ut_time;
-			time(&real);
-			diff = difftime(real, log_in);
-			format_seconds(buf, BUFLEN, diff);
-			if (strlen(ptr) + strlen(buf) + 1 <= BUFLEN) {
-				strncat(ptr, buf, BUFLEN-strlen(ptr)-1);
-			}
+	/* whether utmp could have changed since the last call */
+	bool utmp_changed()
+	{
+#ifdef HAVE_SYS_INOTIFY_H
+		if (utmp_inotify == -2) {
+			watch_utmp();
+			return true;
 		}
-	}
-}
-static void tty_user_time(char *ptr, char *tty)
-{
-	time_t real, diff, log_in;
-	char buf[BUFLEN] = "";
+		if (utmp_inotify != -1) {
+			char buf[0x1000] __attribute__((aligned(__alignof__(struct inotify_event))));
+			bool changed = false, replaced = false;
+			ssize_t len;
 
-	struct utmp *usr, line;
+			while ((len = read(utmp_inotify, buf, sizeof buf)) > 0) {
+				for (char *ptr = buf; ptr < buf + len; ) {
+					struct inotify_event *ev = (struct inotify_event *) ptr;
 
-	setutent();
-	strcpy(line.ut_line, tty);
-	usr = getutline(&line);
-	if (usr == NULL ) {
-		return;
+					ptr += sizeof(struct inotify_event) + ev->len;
+					changed = true;
+					if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+						replaced = true;
+				}
+			}
+			/* a new utmp, watch that one instead */
+			if (replaced)
+				watch_utmp();
+			if (utmp_inotify != -1)
+				return changed;
+		}
+#endif /* HAVE_SYS_INOTIFY_H */
+		return utmp_stat_changed();
 	}
 
-	log_in = usr->ut_time;
-
-	time(&real);
-	diff = difftime(real, log_in);
-	format_seconds(buf, BUFLEN, diff);
-	strncpy(ptr, buf, BUFLEN-1);
-}
+	/* one pass over utmp for everything the user_* objects show */
+	void read_sessions()
+	{
+		const struct utmp *usr;
 
-static void users_alloc(struct information *ptr)
-{
-	if (ptr->users.names == NULL) {
-		ptr->users.names = (char*)malloc(text_buffer_size.get(*state));
+		sessions.clear();
+		setutent();
+		while ((usr = getutent()) != NULL) {
+			if (usr->ut_type == USER_PROCESS) {
+				session s;
 
+				s.name.assign(usr->ut_name, strnlen(usr->ut_name, UT_NAMESIZE));
+				s.line.assign(usr->ut_line, strnlen(usr->ut_line, UT_LINESIZE));
+				s.log_in = usr->ut_time;
+				sessions.push_back(s);
+			}
+		}
+		endutent();
+		sessions_read = true;
 	}
-	if (ptr->users.terms == NULL) {
-		ptr->users.terms = (char*)malloc(text_buffer_size.get(*state));
+
+	void set_users_string(char *&str, const std::string &value)
+	{
+		if (str == NULL)
+			str = (char*)malloc(text_buffer_size.get(*state));
+		snprintf(str, text_buffer_size.get(*state), "%s", value.c_str());
 	}
-	if (ptr->users.times == NULL) {
-		ptr->users.times = (char*)malloc(text_buffer_size.get(*state));
+
+	/* appends value like the old strncat()s did, as long as it fits in BUFLEN */
+	void append_limited(std::string &out, const std::string &value)
+	{
+		if (out.size() + value.size() + 1 <= BUFLEN)
+			out += value;
 	}
 }
 
 static void update_user_time(char *tty)
 {
 	struct information *current_info = &info;
-	char temp[BUFLEN] = "";
+	char buf[BUFLEN] = "";
+	time_t real;
 
-	if (current_info->users.ctime == NULL) {
-		current_info->users.ctime = (char*)malloc(text_buffer_size.get(*state));
+	time(&real);
+	for (auto i = sessions.begin(); i != sessions.end(); ++i) {
+		if (i->line == tty) {
+			format_seconds(buf, BUFLEN, difftime(real, i->log_in));
+			break;
+		}
 	}
 
-	tty_user_time(temp, tty);
-
-	if (temp != NULL) {
-		free_and_zero(current_info->users.ctime);
-		current_info->users.ctime = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.ctime, temp, text_buffer_size.get(*state));
-	} else {
-		free_and_zero(current_info->users.ctime);
-		current_info->users.ctime = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.ctime, "broken", text_buffer_size.get(*state));
-	}
+	set_users_string(current_info->users.ctime, buf);
 }
 
 int update_users(void)
 {
 	struct information *current_info = &info;
-	char temp[BUFLEN] = "";
-	int t;
-	users_alloc(current_info);
-	user_name(temp);
-	if (temp != NULL) {
-		free_and_zero(current_info->users.names);
-		current_info->users.names = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.names, temp, text_buffer_size.get(*state));
-	} else {
-		free_and_zero(current_info->users.names);
-		current_info->users.names = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.names, "broken", text_buffer_size.get(*state));
-	}
-	user_num(&t);
-	if (t != 0) {
-		if (current_info->users.number) {
-			current_info->users.number = 0;
+	std::string names, terms, times;
+	char buf[BUFLEN];
+	time_t real;
+
+	bool rescan = utmp_changed() || !sessions_read;
+
+	if (rescan)
+		read_sessions();
+	/* the strings are freed with the objects showing them */
+	if (rescan || !current_info->users.names || !current_info->users.terms) {
+		for (auto i = sessions.begin(); i != sessions.end(); ++i) {
+			append_limited(names, i->name);
+			append_limited(terms, i->line);
 		}
-		current_info->users.number = t;
-	} else {
-		current_info->users.number = 0;
-	}
-	temp[0] = 0;
-	user_term(temp);
-	if (temp != NULL) {
-		free_and_zero(current_info->users.terms);
-		current_info->users.terms = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.terms, temp, text_buffer_size.get(*state));
-	} else {
-		free_and_zero(current_info->users.terms);
-		current_info->users.terms = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.terms, "broken", text_buffer_size.get(*state));
+		set_users_string(current_info->users.names, names);
+		set_users_string(current_info->users.terms, terms);
+		current_info->users.number = sessions.size();
 	}
-	user_time(temp);
-	if (temp != NULL) {
-		free_and_zero(current_info->users.times);
-		current_info->users.times = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.times, temp, text_buffer_size.get(*state));
-	} else {
-		free_and_zero(current_info->users.times);
-		current_info->users.times = (char*)malloc(text_buffer_size.get(*state));
-		strncpy(current_info->users.times, "broken", text_buffer_size.get(*state));
+
+	/* the times go on even when utmp doesn't change */
+	time(&real);
+	for (auto i = sessions.begin(); i != sessions.end(); ++i) {
+		format_seconds(buf, BUFLEN, difftime(real, i->log_in));
+		append_limited(times, buf);
 	}
+	set_users_string(current_info->users.times, times);
 	return 0;
 }
 
@@ -116,6 +116,38 @@ const char *xpath_expression_df[NUM_XPATH_EXPRESSIONS_DF] = {
 	"/weather/dayf/day[*]/part[1]/ppcp", "/weather/dayf/day[*]/part[1]/hmid",
 	"/weather/dayf/day[*]/@t", "/weather/dayf/day[*]/@dt"
 };
+
+namespace {
+	/* the expressions above, compiled once for all documents */
+	struct weather_xpaths {
+		xmlXPathCompExprPtr error;
+		xmlXPathCompExprPtr cc[NUM_XPATH_EXPRESSIONS_CC];
+		xmlXPathCompExprPtr df[NUM_XPATH_EXPRESSIONS_DF];
+		/* the callbacks of different locations parse at the same time */
+		std::mutex mutex;
+
+		weather_xpaths()
+			: error(xmlXPathCompile((const xmlChar *)"/error/err"))
+		{
+			for (int i = 0; i < NUM_XPATH_EXPRESSIONS_CC; i++)
+				cc[i] = xmlXPathCompile((const xmlChar *)xpath_expression_cc[i]);
+			for (int i = 0; i < NUM_XPATH_EXPRESSIONS_DF; i++)
+				df[i] = xmlXPathCompile((const xmlChar *)xpath_expression_df[i]);
+		}
+	};
+
+	/* never freed, they are needed until conky exits */
+	weather_xpaths &xpaths()
+	{
+		static weather_xpaths *x = new weather_xpaths;
+		return *x;
+	}
+
+	xmlXPathObjectPtr eval_xpath(xmlXPathCompExprPtr expr, xmlXPathContextPtr ctx)
+	{
+		return expr ? xmlXPathCompiledEval(expr, ctx) : NULL;
+	}
+}
 #endif /* BUILD_WEATHER_XOAP */
 
 /* Possible sky conditions */
@@ -139,9 +171,34 @@ const char *WC_CODES[NUM_WC_CODES] = {
 	"FC", "PO", "SQ", "SS", "DS"
 };
 
+/* the data types of $weather and $weather_forecast, looked up once when
+ * the object is scanned */
+enum weather_field {
+	WF_LAST_UPDATE, WF_TEMPERATURE, WF_CLOUD_COVER, WF_ICON, WF_PRESSURE,
+	WF_WIND_SPEED, WF_WIND_DIR, WF_WIND_DIR_DEG, WF_HUMIDITY, WF_WEATHER,
+	WF_HI, WF_LOW, WF_FORECAST, WF_PRECIPITATION, WF_DAY, WF_DATE,
+	WF_UNKNOWN
+};
+
+static const char *weather_field_names[WF_UNKNOWN] = {
+	"last_update", "temperature", "cloud_cover", "icon", "pressure",
+	"wind_speed", "wind_dir", "wind_dir_DEG", "humidity", "weather",
+	"hi", "low", "forecast", "precipitation", "day", "date"
+};
+
+static weather_field find_weather_field(const char *data_type)
+{
+	for (int i = 0; i < WF_UNKNOWN; i++) {
+		if (strcmp(data_type, weather_field_names[i]) == EQUAL)
+			return (weather_field) i;
+	}
+	return WF_UNKNOWN;
+}
+
 struct weather_data {
 	char uri[128];
 	char data_type[32];
+	weather_field field;
 	int interval;
 };
 
@@ -150,6 +207,7 @@ struct weather_forecast_data {
 	char uri[128];
 	unsigned int day;
 	char data_type[32];
+	weather_field field;
 	int interval;
 };
 #endif
@@ -172,8 +230,10 @@ void weather_forecast::parse_df(xmlXPathContextPtr xpathCtx)
 	int i, j, k;
 	char *content = NULL;
 	xmlXPathObjectPtr xpathObj;
+	weather_xpaths &x = xpaths();
+	std::lock_guard<std::mutex> lock(x.mutex);
 
-	xpathObj = xmlXPathEvalExpression((const xmlChar *)"/error/err", xpathCtx);
+	xpathObj = eval_xpath(x.error, xpathCtx);
 	if (xpathObj && xpathObj->nodesetval && xpathObj->nodesetval->nodeNr > 0 &&
 			xpathObj->nodesetval->nodeTab[0]->type == XML_ELEMENT_NODE) {
 		content = (char *)xmlNodeGetContent(xpathObj->nodesetval->nodeTab[0]);
@@ -185,8 +245,8 @@ void weather_forecast::parse_df(xmlXPathContextPtr xpathCtx)
 	xmlXPathFreeObject(xpathObj);
 
 	for (i = 0; i < NUM_XPATH_EXPRESSIONS_DF; i++) {
-		xpathObj = xmlXPathEvalExpression((const xmlChar *)xpath_expression_df[i], xpathCtx);
-		if (xpathObj != NULL) {
+		xpathObj = eval_xpath(x.df[i], xpathCtx);
+		if (xpathObj != NULL && xpathObj->nodesetval) {
 			xmlNodeSetPtr nodes = xpathObj->nodesetval;
 			k = 0;
 			for (j = 0; j < nodes->nodeNr; ++j) {
@@ -263,8 +323,10 @@ void weather::parse_cc(xmlXPathContextPtr xpathCtx)
 	int i;
 	char *content;
 	xmlXPathObjectPtr xpathObj;
+	weather_xpaths &x = xpaths();
+	std::lock_guard<std::mutex> lock(x.mutex);
 
-	xpathObj = xmlXPathEvalExpression((const xmlChar *)"/error/err", xpathCtx);
+	xpathObj = eval_xpath(x.error, xpathCtx);
 	if (xpathObj && xpathObj->nodesetval && xpathObj->nodesetval->nodeNr > 0 &&
 			xpathObj->nodesetval->nodeTab[0]->type == XML_ELEMENT_NODE) {
 		content = (char *)xmlNodeGetContent(xpathObj->nodesetval->nodeTab[0]);
@@ -276,7 +338,7 @@ void weather::parse_cc(xmlXPathContextPtr xpathCtx)
 	xmlXPathFreeObject(xpathObj);
 
 	for (i = 0; i < NUM_XPATH_EXPRESSIONS_CC; i++) {
-		xpathObj = xmlXPathEvalExpression((const xmlChar *)xpath_expression_cc[i], xpathCtx);
+		xpathObj = eval_xpath(x.cc[i], xpathCtx);
 		if (xpathObj && xpathObj->nodesetval && xpathObj->nodesetval->nodeNr >0 &&
 				xpathObj->nodesetval->nodeTab[0]->type ==
 				XML_ELEMENT_NODE) {
@@ -730,7 +792,7 @@ void wind_deg_to_dir(char *p, int p_max_size, int wind_deg) {
 
 #ifdef BUILD_WEATHER_XOAP
 static void weather_forecast_process_info(char *p, int p_max_size, const
-		std::string &uri, unsigned int day, char *data_type, int interval)
+		std::string &uri, unsigned int day, weather_field field, int interval)
 {
 	uint32_t period = std::max(lround(interval/active_update_interval()), 1l);
 
@@ -738,34 +800,48 @@ static void weather_forecast_process_info(char *p, int p_max_size, const
 
 	std::lock_guard<std::mutex> lock(cb->result_mutex);
 	const weather_forecast &data = cb->get_result();
-	if (strcmp(data_type, "hi") == EQUAL) {
-		temp_print(p, p_max_size, data[day].hi, TEMP_CELSIUS);
-	} else if (strcmp(data_type, "low") == EQUAL) {
-		temp_print(p, p_max_size, data[day].low, TEMP_CELSIUS);
-	} else if (strcmp(data_type, "icon") == EQUAL) {
-		strncpy(p, data[day].icon.c_str(), p_max_size);
-	} else if (strcmp(data_type, "forecast") == EQUAL) {
-		strncpy(p, data[day].xoap_t.c_str(), p_max_size);
-	} else if (strcmp(data_type, "wind_speed") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data[day].wind_s);
-	} else if (strcmp(data_type, "wind_dir") == EQUAL) {
-		wind_deg_to_dir(p, p_max_size, data[day].wind_d);
-	} else if (strcmp(data_type, "wind_dir_DEG") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data[day].wind_d);
-	} else if (strcmp(data_type, "humidity") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data[day].hmid);
-	} else if (strcmp(data_type, "precipitation") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data[day].ppcp);
-	} else if (strcmp(data_type, "day") == EQUAL) {
-		strncpy(p, data[day].day.c_str(), p_max_size);
-	} else if (strcmp(data_type, "date") == EQUAL) {
-		strncpy(p, data[day].date.c_str(), p_max_size);
+	switch (field) {
+		case WF_HI:
+			temp_print(p, p_max_size, data[day].hi, TEMP_CELSIUS);
+			break;
+		case WF_LOW:
+			temp_print(p, p_max_size, data[day].low, TEMP_CELSIUS);
+			break;
+		case WF_ICON:
+			strncpy(p, data[day].icon.c_str(), p_max_size);
+			break;
+		case WF_FORECAST:
+			strncpy(p, data[day].xoap_t.c_str(), p_max_size);
+			break;
+		case WF_WIND_SPEED:
+			snprintf(p, p_max_size, "%d", data[day].wind_s);
+			break;
+		case WF_WIND_DIR:
+			wind_deg_to_dir(p, p_max_size, data[day].wind_d);
+			break;
+		case WF_WIND_DIR_DEG:
+			snprintf(p, p_max_size, "%d", data[day].wind_d);
+			break;
+		case WF_HUMIDITY:
+			snprintf(p, p_max_size, "%d", data[day].hmid);
+			break;
+		case WF_PRECIPITATION:
+			snprintf(p, p_max_size, "%d", data[day].ppcp);
+			break;
+		case WF_DAY:
+			strncpy(p, data[day].day.c_str(), p_max_size);
+			break;
+		case WF_DATE:
+			strncpy(p, data[day].date.c_str(), p_max_size);
+			break;
+		default:
+			break;
 	}
-
 }
 #endif /* BUILD_WEATHER_XOAP */
 
-static void weather_process_info(char *p, int p_max_size, const std::string &uri, char *data_type, int interval)
+static void weather_process_info(char *p, int p_max_size, const std::string &uri,
+		weather_field field, int interval)
 {
 	static const char *wc[] = {
 		"", "drizzle", "rain", "hail", "soft hail",
@@ -780,55 +856,66 @@ static void weather_process_info(char *p, int p_max_size, const std::string &uri
 
 	std::lock_guard<std::mutex> lock(cb->result_mutex);
 	const weather *data = &cb->get_result();
-	if (strcmp(data_type, "last_update") == EQUAL) {
-		strncpy(p, data->lastupd.c_str(), p_max_size);
-	} else if (strcmp(data_type, "temperature") == EQUAL) {
-		temp_print(p, p_max_size, data->temp, TEMP_CELSIUS);
-	} else if (strcmp(data_type, "cloud_cover") == EQUAL) {
+	switch (field) {
+		case WF_LAST_UPDATE:
+			strncpy(p, data->lastupd.c_str(), p_max_size);
+			break;
+		case WF_TEMPERATURE:
+			temp_print(p, p_max_size, data->temp, TEMP_CELSIUS);
+			break;
+		case WF_CLOUD_COVER:
 #ifdef BUILD_WEATHER_XOAP
-		if (data->xoap_t[0] != '\0') {
-			char *s = p;
-			strncpy(p, data->xoap_t.c_str(), p_max_size);
-			while (*s) {
-				*s = tolower(*s);
-				s++;
-			}
-		} else
+			if (data->xoap_t[0] != '\0') {
+				char *s = p;
+				strncpy(p, data->xoap_t.c_str(), p_max_size);
+				while (*s) {
+					*s = tolower(*s);
+					s++;
+				}
+			} else
 #endif /* BUILD_WEATHER_XOAP */
-			if (data->cc == 0) {
-				strncpy(p, "", p_max_size);
-			} else if (data->cc < 3) {
-				strncpy(p, "clear", p_max_size);
-			} else if (data->cc < 5) {
-				strncpy(p, "partly cloudy", p_max_size);
-			} else if (data->cc == 5) {
-				strncpy(p, "cloudy", p_max_size);
-			} else if (data->cc == 6) {
-				strncpy(p, "overcast", p_max_size);
-			} else if (data->cc == 7) {
-				strncpy(p, "towering cumulus", p_max_size);
-			} else  {
-				strncpy(p, "cumulonimbus", p_max_size);
-			}
+				if (data->cc == 0) {
+					strncpy(p, "", p_max_size);
+				} else if (data->cc < 3) {
+					strncpy(p, "clear", p_max_size);
+				} else if (data->cc < 5) {
+					strncpy(p, "partly cloudy", p_max_size);
+				} else if (data->cc == 5) {
+					strncpy(p, "cloudy", p_max_size);
+				} else if (data->cc == 6) {
+					strncpy(p, "overcast", p_max_size);
+				} else if (data->cc == 7) {
+					strncpy(p, "towering cumulus", p_max_size);
+				} else  {
+					strncpy(p, "cumulonimbus", p_max_size);
+				}
+			break;
 #ifdef BUILD_WEATHER_XOAP
-	} else if (strcmp(data_type, "icon") == EQUAL) {
-		strncpy(p, data->icon.c_str(), p_max_size);
+		case WF_ICON:
+			strncpy(p, data->icon.c_str(), p_max_size);
+			break;
 #endif /* BUILD_WEATHER_XOAP */
-	} else if (strcmp(data_type, "pressure") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data->bar);
-	} else if (strcmp(data_type, "wind_speed") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data->wind_s);
-	} else if (strcmp(data_type, "wind_dir") == EQUAL) {
-		wind_deg_to_dir(p, p_max_size, data->wind_d);
-	} else if (strcmp(data_type, "wind_dir_DEG") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data->wind_d);
-
-	} else if (strcmp(data_type, "humidity") == EQUAL) {
-		snprintf(p, p_max_size, "%d", data->hmid);
-	} else if (strcmp(data_type, "weather") == EQUAL) {
-		strncpy(p, wc[data->wc], p_max_size);
+		case WF_PRESSURE:
+			snprintf(p, p_max_size, "%d", data->bar);
+			break;
+		case WF_WIND_SPEED:
+			snprintf(p, p_max_size, "%d", data->wind_s);
+			break;
+		case WF_WIND_DIR:
+			wind_deg_to_dir(p, p_max_size, data->wind_d);
+			break;
+		case WF_WIND_DIR_DEG:
+			snprintf(p, p_max_size, "%d", data->wind_d);
+			break;
+		case WF_HUMIDITY:
+			snprintf(p, p_max_size, "%d", data->hmid);
+			break;
+		case WF_WEATHER:
+			strncpy(p, wc[data->wc], p_max_size);
+			break;
+		default:
+			break;
 	}
-
 }
 
 #ifdef BUILD_WEATHER_XOAP
@@ -926,6 +1013,8 @@ void scan_weather_forecast_arg(struct text_object *obj, const char *arg, void *f
 				"could not recognize the weather forecast uri");
 	}
 
+	wfd->field = find_weather_field(wfd->data_type);
+
 	/* Limit the day between 0 (today) and FORECAST_DAYS */
 	if (wfd->day >= FORECAST_DAYS) {
 		wfd->day = FORECAST_DAYS-1;
@@ -954,7 +1043,7 @@ void print_weather_forecast(struct text_object *obj, char *p, int p_max_size)
 		NORM_ERR("error processing weather forecast data, check that you have a valid XOAP key if using XOAP.");
 		return;
 	}
-	weather_forecast_process_info(p, p_max_size, wfd->uri, wfd->day, wfd->data_type, wfd->interval);
+	weather_forecast_process_info(p, p_max_size, wfd->uri, wfd->day, wfd->field, wfd->interval);
 }
 #endif /* BUILD_WEATHER_XOAP */
 
@@ -982,6 +1071,8 @@ void scan_weather_arg(struct text_object *obj, const char *arg, void *free_at_cr
 				"could not recognize the weather uri");
 	}
 
+	wd->field = find_weather_field(wd->data_type);
+
 	/* Limit the data retrieval interval to half hour min */
 	if (interval < 30) {
 		interval = 30;
@@ -1005,7 +1096,7 @@ void print_weather(struct text_object *obj, char *p, int p_max_size)
 		NORM_ERR("error processing weather data, check that you have a valid XOAP key if using XOAP.");
 		return;
 	}
-	weather_process_info(p, p_max_size, wd->uri, wd->data_type, wd->interval);
+	weather_process_info(p, p_max_size, wd->uri, wd->field, wd->interval);
 }
 
 void free_weather(struct text_object *obj)
@@ -47,6 +47,9 @@
 #ifdef BUILD_XFT
 #include <X11/Xft/Xft.h>
 #endif
+#ifdef BUILD_XDPMS
+#include <X11/extensions/dpms.h>
+#endif /* BUILD_XDPMS */
 
 #ifdef BUILD_ARGB
 bool have_argb_visual;
@@ -74,6 +77,11 @@ static void deinit_X11();
 static void init_window(lua::state &l, bool own);
 
 /********************* <SETTINGS> ************************/
+#ifndef BUILD_XDBE
+/* size of the pixmap behind window.back_buffer */
+static int back_buffer_width, back_buffer_height;
+#endif
+
 namespace priv {
 	void out_to_x_setting::lua_setter(lua::state &l, bool init)
 	{
@@ -180,15 +188,12 @@ namespace priv {
 		if(not out_to_x.get(l))
 			return false;
 
-		window.back_buffer = XCreatePixmap(display,
-				window.window, window.width+1, window.height+1, DefaultDepth(display, screen));
-		if (window.back_buffer != None) {
-			window.drawable = window.back_buffer;
-		} else {
+		window.back_buffer = None;
+		back_buffer_width = back_buffer_height = 0;
+		if (not xpmdb_fit_back_buffer()) {
 			NORM_ERR("Failed to allocate back buffer");
 			return false;
 		}
-		
 
 		XFlush(display);
 		return true;
@@ -900,12 +905,34 @@ static void init_window(lua::state &l __attribute__((unused)), bool own)
 
 	XSelectInput(display, window.window, ExposureMask | PropertyChangeMask
 #ifdef OWN_WINDOW
-			| (own_window.get(l) ? (StructureNotifyMask |
+			| (own_window.get(l) ? (StructureNotifyMask | VisibilityChangeMask |
 					ButtonPressMask | ButtonReleaseMask) : 0)
 #endif
 			);
 }
 
+/* whether DPMS switched the monitor off, so nobody can see conky */
+bool x11_screen_blanked(void)
+{
+#ifdef BUILD_XDPMS
+	static Display *checked = NULL;
+	static bool have_dpms = false;
+	int dummy;
+	CARD16 level;
+	BOOL enabled;
+
+	if (checked != display) {
+		checked = display;
+		have_dpms = DPMSQueryExtension(display, &dummy, &dummy) && DPMSCapable(display);
+	}
+	if (!have_dpms || !DPMSInfo(display, &level, &enabled))
+		return false;
+	return enabled && level != DPMSModeOn;
+#else
+	return false;
+#endif /* BUILD_XDPMS */
+}
+
 static Window find_subwindow(Window win, int w, int h)
 {
 	unsigned int i, j;
@@ -941,14 +968,29 @@ static Window find_subwindow(Window win, int w, int h)
 	return win;
 }
 
+/* the foreground last set on window.gc, so drawing a run of text, shades and
+ * outlines in the same colour doesn't send a request for each */
+static unsigned long gc_foreground;
+
 void create_gc(void)
 {
 	XGCValues values;
 
 	values.graphics_exposures = 0;
 	values.function = GXcopy;
+	values.foreground = 0;
 	window.gc = XCreateGC(display, window.drawable,
-			GCFunction | GCGraphicsExposures, &values);
+			GCFunction | GCGraphicsExposures | GCForeground, &values);
+	gc_foreground = 0;
+}
+
+void set_gc_foreground(unsigned long pixel)
+{
+	if (gc_foreground == pixel) {
+		return;
+	}
+	XSetForeground(display, window.gc, pixel);
+	gc_foreground = pixel;
 }
 
 //Get current desktop number
@@ -969,7 +1011,8 @@ static inline void get_x11_desktop_current(Display *current_display, Window root
 					&bytes_after, &prop ) == Success ) &&
 			(actual_type == XA_CARDINAL) &&
 			(nitems == 1L) && (actual_format == 32) ) {
-		current_info->x11.desktop.current = prop[0]+1;
+		/* format 32 properties come as an array of longs */
+		current_info->x11.desktop.current = *(long *) prop + 1;
 	}
 	if(prop) {
 		XFree(prop);
@@ -994,7 +1037,7 @@ static inline void get_x11_desktop_number(Display *current_display, Window root,
 					&bytes_after, &prop ) == Success ) &&
 			(actual_type == XA_CARDINAL) &&
 			(nitems == 1L) && (actual_format == 32) ) {
-		current_info->x11.desktop.number = prop[0];
+		current_info->x11.desktop.number = *(long *) prop;
 	}
 	if(prop) {
 		XFree(prop);
@@ -1045,10 +1088,14 @@ static inline void get_x11_desktop_current_name(const std::string &names)
 	}
 }
 
+/* the root window properties behind info.x11.desktop */
+static Atom atom_current, atom_number, atom_names;
+/* properties that changed since they were last fetched */
+static bool stale_current, stale_number, stale_names;
+
 void get_x11_desktop_info(Display *current_display, Atom atom)
 {
 	Window root;
-	static Atom atom_current, atom_number, atom_names;
 	struct information *current_info = &info;
 	XWindowAttributes window_attributes;
 
@@ -1073,18 +1120,40 @@ void get_x11_desktop_info(Display *current_display, Atom atom)
 			XGetWindowAttributes(display, root, &window_attributes);
 		}
 	} else {
-		if (atom == atom_current) {
-			get_x11_desktop_current(current_display, root, atom_current);
-			get_x11_desktop_current_name(current_info->x11.desktop.all_names);
+		/* only remember what changed, a burst of PropertyNotify events is
+		 * fetched once by refresh_x11_desktop_info() */
+		if (atom == None) {
+			return;
+		} else if (atom == atom_current) {
+			stale_current = true;
 		} else if (atom == atom_number) {
-			get_x11_desktop_number(current_display, root, atom_number);
+			stale_number = true;
 		} else if (atom == atom_names) {
-			get_x11_desktop_names(current_display, root, atom_names);
-			get_x11_desktop_current_name(current_info->x11.desktop.all_names);
+			stale_names = true;
 		}
 	}
 }
 
+void refresh_x11_desktop_info(Display *current_display)
+{
+	struct information *current_info = &info;
+	Window root = RootWindow(current_display, current_info->x11.monitor.current);
+
+	if (stale_current) {
+		get_x11_desktop_current(current_display, root, atom_current);
+	}
+	if (stale_number) {
+		get_x11_desktop_number(current_display, root, atom_number);
+	}
+	if (stale_names) {
+		get_x11_desktop_names(current_display, root, atom_names);
+	}
+	if (stale_current || stale_names) {
+		get_x11_desktop_current_name(current_info->x11.desktop.all_names);
+	}
+	stale_current = stale_number = stale_names = false;
+}
+
 static const char NOT_IN_X[] = "Not running in X";
 
 void print_monitor(struct text_object *obj, char *p, int p_max_size)
@@ -1221,11 +1290,50 @@ void xdbe_swap_buffers(void)
 	}
 }
 #else
+bool xpmdb_fit_back_buffer(void)
+{
+	if (window.back_buffer != None && window.width <= back_buffer_width
+			&& window.height <= back_buffer_height) {
+		return true;
+	}
+
+	/* grow a bit ahead, so a window that keeps growing by a few pixels
+	 * doesn't get a new pixmap every time */
+	int width = std::max(window.width + 1, back_buffer_width);
+	int height = std::max(window.height + 1, back_buffer_height);
+
+	if (window.back_buffer != None && (width > back_buffer_width
+				|| height > back_buffer_height)) {
+		width += width / 4;
+		height += height / 4;
+	}
+	Pixmap pm = XCreatePixmap(display, window.window, width, height,
+			DefaultDepth(display, screen));
+	if (pm == None) {
+		return false;
+	}
+	if (window.back_buffer != None) {
+		XFreePixmap(display, window.back_buffer);
+	}
+	window.back_buffer = pm;
+	window.drawable = pm;
+	back_buffer_width = width;
+	back_buffer_height = height;
+#ifdef BUILD_XFT
+	if (window.xftdraw) {
+		XftDrawChange(window.xftdraw, window.drawable);
+	}
+#endif /* BUILD_XFT */
+	set_gc_foreground(0);
+	XFillRectangle(display, window.drawable, window.gc, 0, 0, width, height);
+	return true;
+}
+
 void xpmdb_swap_buffers(void)
 {
 	if (use_xpmdb.get(*state)) {
 		XCopyArea(display, window.back_buffer, window.window, window.gc, 0, 0, window.width, window.height, 0, 0);
-		XSetForeground(display, window.gc, 0);
+		set_gc_foreground(0);
 		XFillRectangle(display, window.drawable, window.gc, 0, 0, window.width, window.height);
 		XFlush(display);
 	}
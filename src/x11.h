@@ -106,9 +106,14 @@ extern char window_created;
 
 void destroy_window(void);
 void create_gc(void);
+/* XSetForeground() on window.gc, unless that is its foreground already */
+void set_gc_foreground(unsigned long pixel);
 void set_transparent_background(Window win);
 void get_x11_desktop_info(Display *display, Atom atom);
+/* fetch the desktop properties get_x11_desktop_info() was told changed */
+void refresh_x11_desktop_info(Display *display);
 void set_struts(int);
+bool x11_screen_blanked(void);
 
 void print_monitor(struct text_object *, char *, int);
 void print_monitor_number(struct text_object *, char *, int);
@@ -120,6 +125,8 @@ void print_desktop_name(struct text_object *, char *, int);
 void xdbe_swap_buffers(void);
 #else
 void xpmdb_swap_buffers(void);
+/* (re)allocate the back buffer if the window outgrew it, false on failure */
+bool xpmdb_fit_back_buffer(void);
 #endif /* BUILD_XDBE */
 
 /* alignments */
@@ -28,6 +28,9 @@
  */
 
 #include "conky.h"
+#include "player-cb.hh"
+#include <poll.h>
+#include <cmath>
 
 xmmsc_connection_t *xmms2_conn;
 
@@ -35,6 +38,23 @@ xmmsc_connection_t *xmms2_conn;
 #define CONN_OK		1
 #define CONN_NO		2
 
+/* seeks aren't broadcast, so the playtime is asked for again this often (in s) */
+#define XMMS2_PLAYTIME_RESYNC 10
+
+/* the playtime from the last answer, moving on while playing */
+static conky::playback_clock xmms2_clock;
+static bool xmms2_playing;
+static double xmms2_playtime_asked;
+
+static int handle_playtime(xmmsv_t *value, void *p);
+
+/* asks once for the playtime instead of having the server signal it all the time */
+static void request_playtime(struct information *ptr)
+{
+	XMMS_CALLBACK_SET(xmms2_conn, xmmsc_playback_playtime, handle_playtime, ptr);
+	xmms2_playtime_asked = get_time();
+}
+
 static void xmms_alloc(struct information *ptr)
 {
 
@@ -107,6 +127,8 @@ void connection_lost(void *p)
 	fprintf(stderr,"XMMS2 connection failed. %s\n", xmmsc_get_last_error(xmms2_conn));
 
 	xmms_alloc(ptr);
+	xmms2_playing = false;
+	xmms2_clock.set(0, false);
 	strncpy(ptr->xmms2.status, "Disconnected", text_buffer_size.get(*state) - 1);
 	ptr->xmms2.playlist[0] = '\0';
 	ptr->xmms2.id = 0;
@@ -189,11 +211,13 @@ int handle_curent_id(xmmsv_t *value, void *p)
 
 		xmmsv_unref(infos);
 		xmmsc_result_unref(res);
+
+		request_playtime(ptr);
 	}
 	return TRUE;
 }
 
-int handle_playtime(xmmsv_t *value, void *p)
+static int handle_playtime(xmmsv_t *value, void *p)
 {
 	struct information *ptr = (struct information*) p;
 	int play_time;
@@ -205,6 +229,7 @@ int handle_playtime(xmmsv_t *value, void *p)
 	}
 
 	if (xmmsv_get_int(value, &play_time)) {
+		xmms2_clock.set(play_time / 1000.0, xmms2_playing);
 		ptr->xmms2.elapsed = play_time;
 		ptr->xmms2.progress = (float) play_time / ptr->xmms2.duration;
 		ptr->xmms2.percent = (int)(ptr->xmms2.progress*100);
@@ -230,6 +255,10 @@ int handle_playback_state_change(xmmsv_t *value, void *p)
 	}
 
 	if (xmmsv_get_int(value, &pb_state)) {
+		xmms2_playing = pb_state == XMMS_PLAYBACK_STATUS_PLAY;
+		xmms2_clock.set(xmms2_clock.get(), xmms2_playing);
+		if (pb_state != XMMS_PLAYBACK_STATUS_STOP)
+			request_playtime(ptr);
 		switch (pb_state) {
 			case XMMS_PLAYBACK_STATUS_PLAY:
 				strncpy(ptr->xmms2.status, "Playing", text_buffer_size.get(*state) - 1);
@@ -240,6 +269,7 @@ int handle_playback_state_change(xmmsv_t *value, void *p)
 			case XMMS_PLAYBACK_STATUS_STOP:
 				strncpy(ptr->xmms2.status, "Stopped", text_buffer_size.get(*state) - 1);
 				ptr->xmms2.elapsed = ptr->xmms2.progress = ptr->xmms2.percent = 0;
+				xmms2_clock.set(0, false);
 				break;
 			default:
 				strncpy(ptr->xmms2.status, "Unknown", text_buffer_size.get(*state) - 1);
@@ -327,8 +357,6 @@ int update_xmms2(void)
 		xmmsc_disconnect_callback_set(xmms2_conn, connection_lost, current_info);
 		XMMS_CALLBACK_SET(xmms2_conn, xmmsc_broadcast_playback_current_id,
 				handle_curent_id, current_info);
-		XMMS_CALLBACK_SET(xmms2_conn, xmmsc_signal_playback_playtime,
-				handle_playtime, current_info);
 		XMMS_CALLBACK_SET(xmms2_conn, xmmsc_broadcast_playback_status,
 				handle_playback_state_change, current_info);
 		XMMS_CALLBACK_SET(xmms2_conn, xmmsc_broadcast_playlist_loaded,
@@ -351,10 +379,26 @@ int update_xmms2(void)
 	/* handle callbacks */
 	if (current_info->xmms2.conn_state == CONN_OK) {
 
-		xmmsc_io_in_handle(xmms2_conn);
+		/* only read when the server sent something, it does so on changes */
+		struct pollfd pfd = { xmmsc_io_fd_get(xmms2_conn), POLLIN, 0 };
+		if (poll(&pfd, 1, 0) > 0)
+			xmmsc_io_in_handle(xmms2_conn);
+
+		if (xmms2_playing && current_info->xmms2.conn_state == CONN_OK
+				&& get_time() - xmms2_playtime_asked >= XMMS2_PLAYTIME_RESYNC)
+			request_playtime(current_info);
+
 		if (xmmsc_io_want_out(xmms2_conn))
 			xmmsc_io_out_handle(xmms2_conn);
 
+		if (xmms2_clock.is_running()) {
+			int elapsed = lround(xmms2_clock.get(current_info->xmms2.duration / 1000.0) * 1000);
+
+			current_info->xmms2.elapsed = elapsed;
+			if (current_info->xmms2.duration > 0)
+				current_info->xmms2.progress = (float) elapsed / current_info->xmms2.duration;
+			current_info->xmms2.percent = (int)(current_info->xmms2.progress*100);
+		}
 	}
 	return 0;
 }